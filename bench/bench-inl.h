@@ -0,0 +1,263 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file bench-inl.h
+ * \brief the benchmarks, written once for cpu and gpu
+ */
+#ifndef MSHADOW_BENCH_BENCH_INL_H_
+#define MSHADOW_BENCH_BENCH_INL_H_
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mshadow/tensor.h>
+#include <mshadow/io.h>
+#include "./bench.h"
+
+namespace bench {
+using namespace mshadow;  // NOLINT(*)
+using namespace mshadow::expr;  // NOLINT(*)
+/*! \brief a * b without a packet version, to time the scalar path of the same map */
+struct nopacket_mul {
+  template<typename DType>
+  MSHADOW_XINLINE static DType Map(DType a, DType b) {
+    return a * b;
+  }
+};
+/*! \brief names of the devices and the data types */
+template<typename xpu>
+inline const char *DeviceName(void);
+template<>
+inline const char *DeviceName<cpu>(void) { return "cpu"; }
+template<>
+inline const char *DeviceName<gpu>(void) { return "gpu"; }
+template<typename DType>
+inline const char *TypeName(void);
+template<>
+inline const char *TypeName<float>(void) { return "float"; }
+template<>
+inline const char *TypeName<double>(void) { return "double"; }
+/*! \brief a stream in memory, to time io without the file system */
+class MemoryStream {
+ public:
+  MemoryStream(void) : pos_(0) {}
+  inline size_t Read(void *ptr, size_t size) {
+    size = std::min(size, data_.size() - pos_);
+    if (size != 0) std::memcpy(ptr, &data_[pos_], size);
+    pos_ += size;
+    return size;
+  }
+  inline void Write(const void *ptr, size_t size) {
+    if (data_.size() < pos_ + size) data_.resize(pos_ + size);
+    std::memcpy(&data_[pos_], ptr, size);
+    pos_ += size;
+  }
+  inline void Seek(size_t pos) {
+    pos_ = pos;
+  }
+
+ private:
+  std::vector<char> data_;
+  size_t pos_;
+};
+/*! \brief the state shared by the benchmarks of a device and a data type */
+template<typename xpu, typename DType>
+struct Context {
+  Runner *runner;
+  Stream<xpu> *stream;
+  Random<xpu, DType> rnd;
+  Context(Runner *runner, Stream<xpu> *stream)
+      : runner(runner), stream(stream), rnd(0) {
+    rnd.set_stream(stream);
+  }
+  /*! \brief time a benchmark of this device and data type */
+  template<typename Run>
+  inline void Time(const char *name, const std::string &shape,
+                   double bytes, double flops, Run run) {
+    Stream<xpu> *s = stream;
+    runner->Time(name, DeviceName<xpu>(), TypeName<DType>(), shape,
+                 bytes, flops, run, [s]() { s->Wait(); });
+  }
+  /*! \brief a tensor of uniform random numbers in [-1, 1) */
+  template<int dim>
+  inline void Fill(TensorContainer<xpu, dim, DType> *t, Shape<dim> shape) {
+    t->set_stream(stream);
+    t->Resize(shape);
+    rnd.SampleUniform(t, DType(-1), DType(1));
+  }
+};
+/*! \brief elementwise maps, with and without packets */
+template<typename xpu, typename DType>
+inline void BenchMap(Context<xpu, DType> *ctx) {
+  const size_t sz = sizeof(DType);
+  // one that fits in cache and one that does not
+  const index_t sizes[] = {64, 4096};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    const Shape<2> shape = Shape2(ctx->runner->Scale(sizes[i]), 1024);
+    const double n = shape.Size();
+    TensorContainer<xpu, 2, DType> x, y, z, d;
+    ctx->Fill(&x, shape); ctx->Fill(&y, shape); ctx->Fill(&z, shape); ctx->Fill(&d, shape);
+    const std::string name = ShapeName(shape);
+    ctx->Time("map.copy", name, 2 * n * sz, 0, [&]() { Copy(d, x, ctx->stream); });
+    ctx->Time("map.fma", name, 4 * n * sz, 2 * n, [&]() { d = x * y + z; });
+    ctx->Time("map.fma_plain", name, 4 * n * sz, 2 * n,
+              [&]() { d = F<nopacket_mul>(x, y) + z; });
+    ctx->Time("map.exp", name, 2 * n * sz, n, [&]() { d = F<op::exp>(x); });
+    ctx->Time("map.scalar_axpy", name, 3 * n * sz, 2 * n,
+              [&]() { d += DType(0.5f) * x; });
+  }
+}
+/*! \brief reductions over rows, columns and an axis */
+template<typename xpu, typename DType>
+inline void BenchReduce(Context<xpu, DType> *ctx) {
+  const size_t sz = sizeof(DType);
+  const Shape<2> shapes[] = {Shape2(ctx->runner->Scale(4096), 1024),
+                             Shape2(ctx->runner->Scale(262144), 16)};
+  for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+    const Shape<2> shape = shapes[i];
+    const double n = shape.Size();
+    TensorContainer<xpu, 2, DType> x;
+    TensorContainer<xpu, 1, DType> rows(Shape1(shape[0])), cols(Shape1(shape[1]));
+    rows.set_stream(ctx->stream); cols.set_stream(ctx->stream);
+    ctx->Fill(&x, shape);
+    const std::string name = ShapeName(shape);
+    ctx->Time("reduce.sum_rows", name, (n + shape[1]) * sz, n,
+              [&]() { cols = sum_rows(x); });
+    ctx->Time("reduce.sumall_except_dim", name, (n + shape[0]) * sz, n,
+              [&]() { rows = sumall_except_dim<0>(x); });
+    ctx->Time("reduce.axis_max", name, (n + shape[0]) * sz, n,
+              [&]() { rows = reduce_with_axis<red::maximum, false>(x, 1); });
+  }
+}
+/*! \brief softmax over the rows */
+template<typename xpu, typename DType>
+inline void BenchSoftmax(Context<xpu, DType> *ctx) {
+  const size_t sz = sizeof(DType);
+  const Shape<2> shapes[] = {Shape2(ctx->runner->Scale(512), 1000),
+                             Shape2(ctx->runner->Scale(32), 32000)};
+  for (size_t i = 0; i < sizeof(shapes) / sizeof(shapes[0]); ++i) {
+    const double n = shapes[i].Size();
+    TensorContainer<xpu, 2, DType> x, d;
+    ctx->Fill(&x, shapes[i]); ctx->Fill(&d, shapes[i]);
+    // counted as max, exp and normalize, the input is read twice
+    ctx->Time("softmax", ShapeName(shapes[i]), 3 * n * sz, 3 * n,
+              [&]() { Softmax(d, x); });
+  }
+}
+/*! \brief transpose of a matrix and swap of two axes */
+template<typename xpu, typename DType>
+inline void BenchTranspose(Context<xpu, DType> *ctx) {
+  const size_t sz = sizeof(DType);
+  {
+    const Shape<2> shape = Shape2(ctx->runner->Scale(2048), 2048);
+    const double n = shape.Size();
+    TensorContainer<xpu, 2, DType> x, d;
+    ctx->Fill(&x, shape); ctx->Fill(&d, Shape2(shape[1], shape[0]));
+    ctx->Time("transpose.2d", ShapeName(shape), 2 * n * sz, 0,
+              [&]() { d = transpose(x, Shape2(1, 0)); });
+  }
+  {
+    const Shape<4> shape = Shape4(ctx->runner->Scale(32), 64, 32, 32);
+    const double n = shape.Size();
+    TensorContainer<xpu, 4, DType> x, d;
+    ctx->Fill(&x, shape); ctx->Fill(&d, Shape4(shape[0], shape[2], shape[1], shape[3]));
+    ctx->Time("transpose.swapaxis", ShapeName(shape), 2 * n * sz, 0,
+              [&]() { d = swapaxis<2, 1>(x); });
+  }
+}
+/*! \brief 3x3 max pooling with stride 2 */
+template<typename xpu, typename DType>
+inline void BenchPool(Context<xpu, DType> *ctx) {
+  const size_t sz = sizeof(DType);
+  const Shape<4> shape = Shape4(ctx->runner->Scale(16), 64, 56, 56);
+  const index_t k = 3, stride = 2;
+  const Shape<2> pshape = Shape2((shape[2] - k) / stride + 1, (shape[3] - k) / stride + 1);
+  const Shape<4> oshape = Shape4(shape[0], shape[1], pshape[0], pshape[1]);
+  TensorContainer<xpu, 4, DType> x, d;
+  ctx->Fill(&x, shape); ctx->Fill(&d, oshape);
+  const double n = shape.Size(), nout = oshape.Size();
+  ctx->Time("pool.max", ShapeName(shape), (n + nout) * sz, nout * k * k,
+            [&]() { d = pool<red::maximum>(x, pshape, k, k, stride, stride); });
+}
+/*! \brief gather of embedding rows and its gradient */
+template<typename xpu, typename DType>
+inline void BenchTake(Context<xpu, DType> *ctx) {
+  const size_t sz = sizeof(DType);
+  const index_t nrow = ctx->runner->Scale(100000), dim = 256;
+  const index_t batch = ctx->runner->Scale(8192);
+  TensorContainer<xpu, 2, DType> table, d;
+  ctx->Fill(&table, Shape2(nrow, dim)); ctx->Fill(&d, Shape2(batch, dim));
+  TensorContainer<cpu, 1, int> hidx(Shape1(batch));
+  unsigned seed = 1;
+  for (index_t i = 0; i < batch; ++i) {
+    seed = seed * 1103515245U + 12345U;
+    hidx[i] = static_cast<int>((seed >> 8) % nrow);
+  }
+  TensorContainer<xpu, 1, int> idx(Shape1(batch));
+  idx.set_stream(ctx->stream);
+  Copy(idx, hidx, ctx->stream);
+  const double n = static_cast<double>(batch) * dim;
+  const std::string name = ShapeName(Shape2(nrow, dim)) + "/" + ShapeName(Shape1(batch));
+  ctx->Time("take", name, 2 * n * sz + batch * sizeof(int), 0,
+            [&]() { Take<sv::saveto>(d, idx, table); });
+  ctx->Time("take_grad", name, 3 * n * sz + batch * sizeof(int), n,
+            [&]() { AddTakeGrad(table, idx, d); });
+}
+/*! \brief matrix products */
+template<typename xpu, typename DType>
+inline void BenchGEMM(Context<xpu, DType> *ctx) {
+  const size_t sz = sizeof(DType);
+  const index_t sizes[] = {256, 1024};
+  for (size_t i = 0; i < sizeof(sizes) / sizeof(sizes[0]); ++i) {
+    const index_t m = ctx->runner->Scale(sizes[i]), k = sizes[i], n = sizes[i];
+    TensorContainer<xpu, 2, DType> a, b, d;
+    ctx->Fill(&a, Shape2(m, k)); ctx->Fill(&b, Shape2(k, n)); ctx->Fill(&d, Shape2(m, n));
+    const std::string name = ShapeName(Shape3(m, k, n));
+    ctx->Time("dot", name, (1.0 * m * k + 1.0 * k * n + 1.0 * m * n) * sz, 2.0 * m * n * k,
+              [&]() { d = dot(a, b); });
+  }
+  const index_t batches[] = {64, 8}, bsizes[] = {64, 256};
+  for (size_t i = 0; i < sizeof(batches) / sizeof(batches[0]); ++i) {
+    const index_t batch = ctx->runner->Scale(batches[i]), m = bsizes[i];
+    TensorContainer<xpu, 3, DType> a, b, d;
+    ctx->Fill(&a, Shape3(batch, m, m)); ctx->Fill(&b, Shape3(batch, m, m));
+    ctx->Fill(&d, Shape3(batch, m, m));
+    const double one = static_cast<double>(batch) * m * m;
+    ctx->Time("batch_gemm", ShapeName(Shape4(batch, m, m, m)), 3 * one * sz, 2.0 * one * m,
+              [&]() { BatchGEMM<false, false>(d, a, b, DType(1), DType(0)); });
+  }
+}
+/*! \brief binary save and load of a tensor, through memory */
+template<typename xpu, typename DType>
+inline void BenchIO(Context<xpu, DType> *ctx) {
+  const size_t sz = sizeof(DType);
+  const Shape<2> shape = Shape2(ctx->runner->Scale(4096), 1024);
+  const double n = shape.Size();
+  TensorContainer<xpu, 2, DType> x;
+  ctx->Fill(&x, shape);
+  MemoryStream fs;
+  SaveBinary(fs, x);
+  ctx->Time("io.save", ShapeName(shape), 2 * n * sz, 0,
+            [&]() { fs.Seek(0); SaveBinary(fs, x); });
+  Tensor<xpu, 2, DType> dst = x;
+  ctx->Time("io.load", ShapeName(shape), 2 * n * sz, 0,
+            [&]() { fs.Seek(0); LoadBinary(fs, &dst, true); });
+}
+/*! \brief run all the benchmarks of a device and a data type */
+template<typename xpu, typename DType>
+inline void RunBenchmarks(Runner *runner) {
+  if (!runner->SelectedType(TypeName<DType>())) return;
+  Stream<xpu> *stream = NewStream<xpu>();
+  {
+    Context<xpu, DType> ctx(runner, stream);
+    BenchMap(&ctx);
+    BenchReduce(&ctx);
+    BenchSoftmax(&ctx);
+    BenchTranspose(&ctx);
+    BenchPool(&ctx);
+    BenchTake(&ctx);
+    BenchGEMM(&ctx);
+    BenchIO(&ctx);
+  }
+  DeleteStream(stream);
+}
+}  // namespace bench
+#endif  // MSHADOW_BENCH_BENCH_INL_H_
@@ -0,0 +1,15 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file bench.cc
+ * \brief benchmarks of the CPU kernels, see bench.h for the arguments
+ */
+#include "./bench-inl.h"
+
+int main(int argc, char *argv[]) {
+  bench::Runner runner(argc, argv);
+  mshadow::InitTensorEngine<mshadow::cpu>();
+  bench::RunBenchmarks<mshadow::cpu, float>(&runner);
+  bench::RunBenchmarks<mshadow::cpu, double>(&runner);
+  mshadow::ShutdownTensorEngine<mshadow::cpu>();
+  return 0;
+}
@@ -0,0 +1,217 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file bench.h
+ * \brief a small harness to time the kernels of mshadow
+ *
+ *  Every benchmark runs an operation until min_time seconds passed, repeat times, and
+ *  reports the best time per run, with the bandwidth and the operation rate computed
+ *  from the bytes and flops the operation needs at least. Arguments are name=value:
+ *    filter=a,b      only run the benchmarks whose name contains a or b
+ *    dtype=a,b       only run the benchmarks of these data types, such as float
+ *    format=table    table, csv or json, json writes one object per line
+ *    min_time=0.2    seconds a measurement runs at least
+ *    repeat=3        number of measurements of a benchmark, the best is reported
+ *    scale=1         multiplies the sizes of the problems, e.g. 0.1 for a quick run
+ *    peak_gbs=0      peak memory bandwidth, GB/s is also reported relative to it if set
+ *    peak_gflops=0   peak operation rate, GFLOP/s is also reported relative to it if set
+ */
+#ifndef MSHADOW_BENCH_BENCH_H_
+#define MSHADOW_BENCH_BENCH_H_
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <mshadow/tensor.h>
+
+namespace bench {
+/*! \brief the measurement of a benchmark */
+struct Result {
+  /*! \brief name of the benchmark, such as map.fma */
+  std::string name;
+  /*! \brief cpu or gpu */
+  std::string device;
+  /*! \brief data type */
+  std::string dtype;
+  /*! \brief size of the problem */
+  std::string shape;
+  /*! \brief best time of a run in seconds */
+  double time;
+  /*! \brief bytes and operations of a run */
+  double bytes, flops;
+};
+/*! \brief runs the benchmarks and writes the results */
+class Runner {
+ public:
+  Runner(int argc, char *argv[])
+      : format_("table"), min_time_(0.2), repeat_(3), scale_(1.0),
+        peak_gbs_(0.0), peak_gflops_(0.0), nrun_(0) {
+    for (int i = 1; i < argc; ++i) {
+      const char *eq = strchr(argv[i], '=');
+      CHECK(eq != NULL) << "arguments must be name=value, got " << argv[i];
+      const std::string name(argv[i], eq - argv[i]);
+      const char *val = eq + 1;
+      if (name == "filter") {
+        filter_ = Split(val);
+      } else if (name == "dtype") {
+        dtype_ = Split(val);
+      } else if (name == "format") {
+        format_ = val;
+        CHECK(format_ == "table" || format_ == "csv" || format_ == "json")
+            << "format can only be table, csv or json";
+      } else if (name == "min_time") {
+        min_time_ = atof(val);
+      } else if (name == "repeat") {
+        repeat_ = std::max(atoi(val), 1);
+      } else if (name == "scale") {
+        scale_ = atof(val);
+        CHECK_GT(scale_, 0.0) << "scale must be positive";
+      } else if (name == "peak_gbs") {
+        peak_gbs_ = atof(val);
+      } else if (name == "peak_gflops") {
+        peak_gflops_ = atof(val);
+      } else {
+        LOG(FATAL) << "unknown argument " << name;
+      }
+    }
+  }
+  /*! \brief peak bandwidth, used unless given as an argument */
+  inline void DefaultPeak(double gbs, double gflops) {
+    if (peak_gbs_ == 0.0) peak_gbs_ = gbs;
+    if (peak_gflops_ == 0.0) peak_gflops_ = gflops;
+  }
+  /*! \brief n scaled by the scale argument, at least 1 */
+  inline mshadow::index_t Scale(mshadow::index_t n) const {
+    return std::max(static_cast<mshadow::index_t>(n * scale_), static_cast<mshadow::index_t>(1));
+  }
+  /*! \brief whether a benchmark of the name is selected by the filter */
+  inline bool Selected(const std::string &name) const {
+    if (filter_.size() == 0) return true;
+    for (size_t i = 0; i < filter_.size(); ++i) {
+      if (name.find(filter_[i]) != std::string::npos) return true;
+    }
+    return false;
+  }
+  /*! \brief whether the benchmarks of a data type are selected by the dtype argument */
+  inline bool SelectedType(const char *dtype) const {
+    if (dtype_.size() == 0) return true;
+    return std::find(dtype_.begin(), dtype_.end(), std::string(dtype)) != dtype_.end();
+  }
+  /*!
+   * \brief time a benchmark and write its result
+   * \param name name of the benchmark
+   * \param device cpu or gpu
+   * \param dtype data type
+   * \param shape size of the problem
+   * \param bytes bytes a run reads and writes at least
+   * \param flops operations of a run, 0 for data movement
+   * \param run runs the operation once, it may be asynchronous
+   * \param sync waits until the runs finished
+   */
+  template<typename Run, typename Sync>
+  inline void Time(const std::string &name, const char *device, const char *dtype,
+                   const std::string &shape, double bytes, double flops,
+                   Run run, Sync sync) {
+    if (!this->Selected(name)) return;
+    typedef std::chrono::steady_clock Clock;
+    // warm up caches, allocators and lazily created handles
+    run();
+    sync();
+    double best = 0.0;
+    for (int r = 0; r < repeat_; ++r) {
+      size_t niter = 1;
+      while (true) {
+        Clock::time_point start = Clock::now();
+        for (size_t i = 0; i < niter; ++i) run();
+        sync();
+        const double elapsed = std::chrono::duration<double>(Clock::now() - start).count();
+        if (elapsed >= min_time_ || niter >= (1UL << 30)) {
+          const double t = elapsed / niter;
+          if (r == 0 || t < best) best = t;
+          break;
+        }
+        // aim at min_time with the rate seen so far
+        const double grow = elapsed > 0.0 ? 1.2 * min_time_ / elapsed : 100.0;
+        niter = static_cast<size_t>(niter * std::min(std::max(grow, 2.0), 100.0));
+      }
+    }
+    Result res;
+    res.name = name; res.device = device; res.dtype = dtype; res.shape = shape;
+    res.time = best; res.bytes = bytes; res.flops = flops;
+    this->Write(res);
+  }
+
+ private:
+  // the items of a comma separated list
+  inline static std::vector<std::string> Split(const std::string &list) {
+    std::vector<std::string> ret;
+    for (size_t pos = 0; pos <= list.length();) {
+      size_t end = list.find(',', pos);
+      if (end == std::string::npos) end = list.length();
+      if (end != pos) ret.push_back(list.substr(pos, end - pos));
+      pos = end + 1;
+    }
+    return ret;
+  }
+  inline void Write(const Result &res) {
+    const double gbs = res.bytes / res.time * 1e-9, gflops = res.flops / res.time * 1e-9;
+    const double pbw = peak_gbs_ > 0.0 ? 100.0 * gbs / peak_gbs_ : -1.0;
+    const double pflops = peak_gflops_ > 0.0 && res.flops > 0.0 ?
+        100.0 * gflops / peak_gflops_ : -1.0;
+    if (format_ == "json") {
+      printf("{\"name\": \"%s\", \"device\": \"%s\", \"dtype\": \"%s\", \"shape\": \"%s\", "
+             "\"time_us\": %.3f, \"gbs\": %.3f, \"gflops\": %.3f",
+             res.name.c_str(), res.device.c_str(), res.dtype.c_str(), res.shape.c_str(),
+             res.time * 1e6, gbs, gflops);
+      if (pbw >= 0.0) printf(", \"peak_gbs_pct\": %.1f", pbw);
+      if (pflops >= 0.0) printf(", \"peak_gflops_pct\": %.1f", pflops);
+      printf("}\n");
+    } else if (format_ == "csv") {
+      if (nrun_ == 0) {
+        printf("name,device,dtype,shape,time_us,gbs,gflops,peak_gbs_pct,peak_gflops_pct\n");
+      }
+      printf("%s,%s,%s,%s,%.3f,%.3f,%.3f,", res.name.c_str(), res.device.c_str(),
+             res.dtype.c_str(), res.shape.c_str(), res.time * 1e6, gbs, gflops);
+      if (pbw >= 0.0) printf("%.1f", pbw);
+      printf(",");
+      if (pflops >= 0.0) printf("%.1f", pflops);
+      printf("\n");
+    } else {
+      if (nrun_ == 0) {
+        printf("%-24s %-4s %-7s %-22s %12s %9s %5s %9s %5s\n", "name", "dev", "dtype", "shape",
+               "time(us)", "GB/s", "%pk", "GFLOP/s", "%pk");
+      }
+      printf("%-24s %-4s %-7s %-22s %12.2f %9.2f ", res.name.c_str(), res.device.c_str(),
+             res.dtype.c_str(), res.shape.c_str(), res.time * 1e6, gbs);
+      if (pbw >= 0.0) printf("%5.1f ", pbw); else printf("%5s ", "-");
+      if (res.flops > 0.0) printf("%9.2f ", gflops); else printf("%9s ", "-");
+      if (pflops >= 0.0) printf("%5.1f", pflops); else printf("%5s", "-");
+      printf("\n");
+    }
+    fflush(stdout);
+    ++nrun_;
+  }
+  std::vector<std::string> filter_, dtype_;
+  std::string format_;
+  double min_time_;
+  int repeat_;
+  double scale_;
+  double peak_gbs_, peak_gflops_;
+  // number of results written
+  int nrun_;
+};
+/*! \brief formats a shape as AxBxC */
+template<int dim>
+inline std::string ShapeName(const mshadow::Shape<dim> &shape) {
+  std::string ret;
+  char buf[32];
+  for (int i = 0; i < dim; ++i) {
+    snprintf(buf, sizeof(buf), i == 0 ? "%u" : "x%u", static_cast<unsigned>(shape[i]));
+    ret += buf;
+  }
+  return ret;
+}
+}  // namespace bench
+#endif  // MSHADOW_BENCH_BENCH_H_
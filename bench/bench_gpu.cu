@@ -0,0 +1,30 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file bench_gpu.cu
+ * \brief benchmarks of the GPU kernels, see bench.h for the arguments,
+ *  besides them dev=i selects the device, whose memory bandwidth is the default peak_gbs
+ */
+#include <vector>
+#include "./bench-inl.h"
+
+int main(int argc, char *argv[]) {
+  int dev = 0;
+  std::vector<char*> args(1, argv[0]);
+  for (int i = 1; i < argc; ++i) {
+    if (!strncmp(argv[i], "dev=", 4)) {
+      dev = atoi(argv[i] + 4);
+    } else {
+      args.push_back(argv[i]);
+    }
+  }
+  bench::Runner runner(static_cast<int>(args.size()), &args[0]);
+  mshadow::InitTensorEngine<mshadow::gpu>(dev);
+  cudaDeviceProp prop;
+  MSHADOW_CUDA_CALL(cudaGetDeviceProperties(&prop, dev));
+  // memoryClockRate is in kHz, the memory is double data rate
+  runner.DefaultPeak(2.0 * prop.memoryClockRate * 1e3 * (prop.memoryBusWidth / 8) * 1e-9, 0.0);
+  bench::RunBenchmarks<mshadow::gpu, float>(&runner);
+  bench::RunBenchmarks<mshadow::gpu, double>(&runner);
+  mshadow::ShutdownTensorEngine<mshadow::gpu>();
+  return 0;
+}
@@ -0,0 +1,174 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file ps_bench.cc
+ * \brief throughput of the shared models of mshadow-ps under synthetic gradient traffic
+ *
+ *  Every iteration each simulated device pushes and pulls every key, then waits for all the
+ *  pulls, as in a training step without computation. The time is the latency of one such
+ *  synchronization, GB/s is the size of the model synchronized per second, i.e. the bytes
+ *  each device pushes and pulls, the algorithm bandwidth of an allreduce. The shape column is
+ *  keys x elements per key x devices. Arguments are name=value, the ones of bench.h and
+ *    type=local      local, dist or rabit, dist and rabit start one process per worker,
+ *                    with guide/mshadow-ps/local.sh or the rabit tracker
+ *    keys=1,64       numbers of keys
+ *    size=1024,262144  numbers of elements of each key, multiplied by scale
+ *    ndev=1,4        numbers of simulated devices on cpu
+ *    priority=0      1 gives key k the priority keys - k, so the first keys go first,
+ *                    0,1 runs both
+ *    ps.name=value   SetParam(name, value) of the model, e.g. ps.bucket_bound=4096,
+ *                    ps.metrics=1 writes the metrics of each run to stderr
+ *  Every combination of keys, size, ndev and priority is run, each worker writes its results.
+ */
+#include <string>
+#include <vector>
+#include "./bench.h"
+#include "../mshadow-ps/mshadow_ps.h"
+
+namespace mshadow {
+namespace ps {
+// only used by update_on_server and by the servers of dist
+template<>
+IModelUpdater<float> *CreateModelUpdater<float>(void) {
+  return CreateBuiltinUpdater<float>("sgd");
+}
+}  // namespace ps
+}  // namespace mshadow
+
+namespace bench {
+using namespace mshadow;
+/*! \brief the arguments of the benchmark, the others are passed to Runner */
+struct PSConfig {
+  std::string type;
+  std::vector<int> keys, size, ndev, priority;
+  std::vector<std::pair<std::string, std::string> > param;
+  PSConfig(void) : type("local") {
+    keys.push_back(1); keys.push_back(64);
+    size.push_back(1024); size.push_back(1 << 18);
+    ndev.push_back(1); ndev.push_back(4);
+    priority.push_back(0);
+  }
+  inline static std::vector<int> ParseList(const char *val) {
+    std::vector<int> ret;
+    for (const char *p = val; *p != '\0';) {
+      ret.push_back(atoi(p));
+      CHECK_GE(ret.back(), 0) << "expect a list of non-negative numbers, got " << val;
+      p = strchr(p, ',');
+      if (p == NULL) break;
+      ++p;
+    }
+    return ret;
+  }
+  // take the arguments of the benchmark, return the rest
+  inline std::vector<char*> Parse(int argc, char *argv[]) {
+    std::vector<char*> rest(1, argv[0]);
+    for (int i = 1; i < argc; ++i) {
+      const char *eq = strchr(argv[i], '=');
+      // flags of the parameter server such as -num_workers and of rabit are not ours
+      if (eq == NULL || argv[i][0] == '-' || !strncmp(argv[i], "rabit_", 6)) continue;
+      const std::string name(argv[i], eq - argv[i]);
+      const char *val = eq + 1;
+      if (name == "type") {
+        type = val;
+      } else if (name == "keys") {
+        keys = ParseList(val);
+      } else if (name == "size") {
+        size = ParseList(val);
+      } else if (name == "ndev") {
+        ndev = ParseList(val);
+      } else if (name == "priority") {
+        priority = ParseList(val);
+      } else if (!strncmp(argv[i], "ps.", 3)) {
+        param.push_back(std::make_pair(name.substr(3), std::string(val)));
+      } else {
+        rest.push_back(argv[i]);
+      }
+    }
+    return rest;
+  }
+};
+/*! \brief run one combination of the sweep */
+inline void RunSync(Runner *runner, const PSConfig &cfg,
+                    int nkey, index_t size, int ndev, bool priority) {
+  ps::ISharedModel<cpu, float> *model =
+      ps::CreateSharedModel<cpu, float>(cfg.type.c_str());
+  for (size_t i = 0; i < cfg.param.size(); ++i) {
+    model->SetParam(cfg.param[i].first.c_str(), cfg.param[i].second.c_str());
+  }
+  std::vector<int> devs;
+  for (int d = 0; d < ndev; ++d) devs.push_back(d);
+  model->Init(devs);
+  // rows of 1024 elements, so partition_size can split the keys
+  const index_t ncol = std::min(size, static_cast<index_t>(1024));
+  const Shape<2> shape = Shape2((size + ncol - 1) / ncol, ncol);
+  std::vector<TensorContainer<cpu, 2, float>*> grad;
+  for (int d = 0; d < ndev; ++d) {
+    for (int k = 0; k < nkey; ++k) {
+      grad.push_back(new TensorContainer<cpu, 2, float>(shape, 1.0f));
+      model->InitKey(shape, k, d);
+    }
+  }
+  std::string name = "ps." + cfg.type + (priority ? ".prio" : "");
+  const double bytes = static_cast<double>(nkey) * shape.Size() * sizeof(float);
+  runner->Time(name, "cpu", "float", ShapeName(Shape3(nkey, shape.Size(), ndev)), bytes, 0.0,
+               [&] {
+                 for (int d = 0; d < ndev; ++d) {
+                   for (int k = 0; k < nkey; ++k) {
+                     const int prio = priority ? nkey - k : 0;
+                     model->Push(*grad[d * nkey + k], k, d, prio);
+                     model->PullReq(*grad[d * nkey + k], k, d, prio);
+                   }
+                 }
+                 for (int d = 0; d < ndev; ++d) {
+                   for (int k = 0; k < nkey; ++k) model->PullWait(k, d);
+                 }
+               }, [] {});
+  ps::PSMetrics metrics;
+  if (model->GetMetrics(&metrics)) {
+    fprintf(stderr, "%s %s\n%s", name.c_str(),
+            ShapeName(Shape3(nkey, shape.Size(), ndev)).c_str(),
+            metrics.ToString().c_str());
+  }
+  delete model;
+  for (size_t i = 0; i < grad.size(); ++i) delete grad[i];
+}
+inline int Run(int argc, char *argv[]) {
+  PSConfig cfg;
+  std::vector<char*> rest = cfg.Parse(argc, argv);
+  Runner runner(static_cast<int>(rest.size()), &rest[0]);
+  InitTensorEngine<cpu>();
+  for (size_t i = 0; i < cfg.ndev.size(); ++i) {
+    for (size_t j = 0; j < cfg.keys.size(); ++j) {
+      for (size_t k = 0; k < cfg.size.size(); ++k) {
+        for (size_t p = 0; p < cfg.priority.size(); ++p) {
+          RunSync(&runner, cfg, cfg.keys[j], runner.Scale(cfg.size[k]), cfg.ndev[i],
+                  cfg.priority[p] != 0);
+        }
+      }
+    }
+  }
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}
+}  // namespace bench
+
+#if MSHADOW_DIST_PS
+// the main function of ps-lite starts the nodes
+int CreateServerNode(int argc, char *argv[]) {
+  mshadow::ps::MShadowServerNode<float> server(argc, argv);
+  return 0;
+}
+int WorkerNodeMain(int argc, char *argv[]) {
+  return bench::Run(argc, argv);
+}
+#else
+int main(int argc, char *argv[]) {
+#if MSHADOW_RABIT_PS
+  rabit::Init(argc, argv);
+#endif
+  const int ret = bench::Run(argc, argv);
+#if MSHADOW_RABIT_PS
+  rabit::Finalize();
+#endif
+  return ret;
+}
+#endif  // MSHADOW_DIST_PS
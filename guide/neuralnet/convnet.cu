@@ -54,8 +54,7 @@ class ConvNet : public INNet {
     obias.set_stream(stream);  g_obias.set_stream(stream);
     Ki2h.set_stream(stream);  g_Ki2h.set_stream(stream);
     Wh2o.set_stream(stream);   g_Wh2o.set_stream(stream);
-    tmp_col.set_stream(stream);
-    tmp_dst.set_stream(stream);
+    ws.set_stream(stream);
     // setup nodes
     ninput.Resize(Shape4(batch_size, 1, insize, insize));
     nhidden.Resize(Shape4(batch_size, nchannel, (insize - ksize)/kstride+1, (insize -ksize)/kstride+1));
@@ -83,7 +82,7 @@ class ConvNet : public INNet {
     // copy data to input layer
     Copy(ninput, inbatch, ninput.stream_);
     // first layer, conv, use stride=2
-    ConvForward(ninput, Ki2h, nhidden, ksize, kstride, tmp_col, tmp_dst);
+    ConvForward(ninput, Ki2h, nhidden, ksize, kstride, ws);
     // add bias
     nhidden += broadcast<1>(hbias, nhidden.shape_);
     // activation, relu, backup activation in nhidden
@@ -118,7 +117,7 @@ class ConvNet : public INNet {
     nhidden = F<relu_grad>(nhidden) * nhiddenbak;
     // calc grad of layer 1
     g_hbias = sumall_except_dim<1>(nhidden);
-    ConvBackWard(nhidden, Ki2h, g_Ki2h, ninput, ksize, kstride, tmp_col, tmp_dst);
+    ConvBackWard(nhidden, Ki2h, g_Ki2h, ninput, ksize, kstride, ws);
   }
   // update weight
   virtual void Update(void) {
@@ -133,26 +132,14 @@ class ConvNet : public INNet {
     obias-= eta * g_obias;
   }
  private:
-  // forward convolution, tmp_col and tmp_dst are helper structure
+  // forward convolution, ws holds the patches of a band of output rows at a time
   inline static void ConvForward(const Tensor<xpu, 4, real_t> &in,
                                  const Tensor<xpu, 2, real_t> &kernel,
                                  Tensor<xpu, 4, real_t> &out,
                                  int ksize, int kstride,
-                                 TensorContainer<xpu, 2, real_t> &tmp_col,
-                                 TensorContainer<xpu, 2, real_t> &tmp_dst) {
-    index_t oheight  = (in.size(2) - ksize)/kstride + 1;
-    index_t owidth   = (in.size(3) - ksize)/kstride + 1;
-    index_t nbatch   = in.size(0);
-    index_t nchannel = out.size(1);
-    // we directly unpack all local patches and do a dot product
-    // this cost lots of memory, normally for large image, only unpack several image at a time
-    tmp_col.Resize(Shape2(in.size(1)*ksize*ksize, nbatch*oheight*owidth));
-    tmp_dst.Resize(Shape2(nchannel, nbatch*oheight*owidth));
-    // unpack local patches , stride=1
-	tmp_col = unpack_patch2col(in, ksize, ksize, kstride, kstride, 1, 1);
-    tmp_dst = dot(kernel, tmp_col);
-    // reshape, then swap axis, we chain equations together
-    out = swapaxis<1,0>(reshape(tmp_dst, Shape4(nchannel, nbatch, oheight, owidth)));
+                                 Workspace<xpu> &ws) {
+    ws.Reset();
+    ConvolutionForward(in, kernel, out, ConvParam(ksize, kstride), &ws);
   }
   // backward convolution, calculate gradient of kernel, and backprop back to in
   inline static void ConvBackWard(const Tensor<xpu, 4, real_t> &out,
@@ -160,24 +147,11 @@ class ConvNet : public INNet {
                                   Tensor<xpu, 2, real_t> &g_kernel,
                                   Tensor<xpu, 4, real_t> &in,
                                   int ksize, int kstride,
-                                  TensorContainer<xpu, 2, real_t> &tmp_col,
-                                  TensorContainer<xpu, 2, real_t> &tmp_dst) {
-    index_t oheight  = (in.size(2) - ksize)/kstride + 1;
-    index_t owidth   = (in.size(3) - ksize)/kstride + 1;
-    index_t nbatch   = in.size(0);
-    index_t nchannel = out.size(1);
-    // we directly unpack all local patches and do a dot product
-    // this cost lots of memory, normally for large image, only unpack several image at a time
-    tmp_col.Resize(Shape2(in.size(1) * ksize * ksize,
-                          nbatch * oheight * owidth));
-    tmp_dst.Resize(Shape2(nchannel, nbatch * oheight * owidth));
-    // unpack local patches
-    tmp_col = unpack_patch2col(in, ksize, ksize, kstride, kstride, 1, 1);
-    tmp_dst = reshape(swapaxis<1,0>(out), tmp_dst.shape_);
-    g_kernel = dot(tmp_dst, tmp_col.T());
-        // backpropgation: not necessary for first layer, but included anyway
-    tmp_col = dot(kernel.T(), tmp_dst);
-    in = pack_col2patch(tmp_col, in.shape_, ksize, ksize, kstride, kstride, 1, 1);
+                                  Workspace<xpu> &ws) {
+    ws.Reset();
+    ConvolutionBackwardWeight(out, in, g_kernel, ConvParam(ksize, kstride), &ws);
+    // backpropgation: not necessary for first layer, but included anyway
+    ConvolutionBackwardData(out, kernel, in, ConvParam(ksize, kstride), &ws);
   }
  private:
   // random seed generator
@@ -187,8 +161,8 @@ class ConvNet : public INNet {
   // nodes in neural net
   TensorContainer<xpu, 4, real_t> ninput, nhidden, nhiddenbak, npool, npoolbak;
   TensorContainer<xpu, 2, real_t> nflat, nout;
-  // temp helper structure
-  TensorContainer<xpu, 2, real_t> tmp_col, tmp_dst;
+  // scratch space of the convolutions, shared by all the layers
+  Workspace<xpu> ws;
   // hidden bias, gradient
   TensorContainer<xpu, 1, real_t> hbias, obias, g_hbias, g_obias;
   // weight, gradient: Ki2h is actually convoltuion kernel, with shape=(num_channel,ksize*ksize)
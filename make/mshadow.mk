@@ -23,10 +23,55 @@ else
 	MSHADOW_CFLAGS += -DMSHADOW_USE_SSE=0
 endif
 
+# USE_AVX=1 targets AVX2 with FMA, USE_AVX512=1 targets AVX-512F
+ifeq ($(USE_AVX), 1)
+	MSHADOW_CFLAGS += -mavx2 -mfma
+endif
+ifeq ($(USE_AVX512), 1)
+	MSHADOW_CFLAGS += -mavx512f -mfma
+endif
+# build AVX and AVX-512 kernels next to the default ones and select at runtime
+ifeq ($(USE_PACKET_DISPATCH), 1)
+	MSHADOW_CFLAGS += -DMSHADOW_USE_PACKET_DISPATCH=1
+endif
+
 ifeq ($(USE_CUDA), 0)
 	MSHADOW_CFLAGS += -DMSHADOW_USE_CUDA=0
 else
 	MSHADOW_LDFLAGS += -lcudart -lcublas -lcurand
+# the gpu FFT of mshadow/fft.h, USE_CUFFT=0 leaves it out
+ifeq ($(USE_CUFFT), 0)
+	MSHADOW_CFLAGS += -DMSHADOW_USE_CUFFT=0
+else
+	MSHADOW_LDFLAGS += -lcufft
+endif
+endif
+# cache GPU device memory instead of calling cudaMalloc/cudaFree for every tensor
+ifeq ($(USE_GPU_POOL), 1)
+	MSHADOW_CFLAGS += -DMSHADOW_USE_GPU_POOL=1
+endif
+# compile the fused graphs of mshadow/fused_graph.h for gpu at runtime
+ifeq ($(USE_NVRTC), 1)
+	MSHADOW_CFLAGS += -DMSHADOW_USE_NVRTC=1
+	MSHADOW_LDFLAGS += -lnvrtc -lcuda
+endif
+# time the launch configurations of the gpu kernels, see mshadow/cuda/launch_tuner.cuh
+ifeq ($(USE_AUTOTUNE), 1)
+	MSHADOW_CFLAGS += -DMSHADOW_USE_AUTOTUNE=1
+endif
+# count the calls and time of the hot ops, see mshadow/profiler.h, USE_NVTX=1 adds NVTX ranges
+ifeq ($(USE_PROFILER), 1)
+	MSHADOW_CFLAGS += -DMSHADOW_USE_PROFILER=1
+ifeq ($(USE_NVTX), 1)
+	MSHADOW_CFLAGS += -DMSHADOW_USE_NVTX=1
+	MSHADOW_LDFLAGS += -lnvToolsExt
+else
+	MSHADOW_CFLAGS += -DMSHADOW_USE_NVTX=0
+endif
+endif
+# skip the shape checks of the expression engine, takes effect in builds with -DNDEBUG
+ifeq ($(USE_SHAPE_CHECK), 0)
+	MSHADOW_CFLAGS += -DMSHADOW_SHAPE_CHECK=0
 endif
 ifneq ($(USE_CUDA_PATH), NONE)
 	MSHADOW_CFLAGS += -I$(USE_CUDA_PATH)/include
@@ -15,6 +15,7 @@
 #include <functional>
 #endif  // C++11
 #include "../mshadow/tensor.h"
+#include "./ps_metrics.h"
 
 /*! \brief whether to adapt distributed PS from parameter-server */
 #ifndef MSHADOW_DIST_PS
@@ -29,6 +30,23 @@
 namespace mshadow {
 /*! \brief namespace of mshadow-ps */
 namespace ps {
+/*!
+ * \brief the rows of a 2D tensor that may be nonzero, such as the gradient of an
+ *  embedding table: row i of value is row index[i] of the tensor, the other rows are 0.
+ *  TakeGradRowSparse computes one from the index and the output gradient of a batch.
+ * \tparam xpu the device the values lie in, the row ids are always on the host
+ * \tparam DType the type of element in the tensor
+ */
+template<typename xpu, typename DType MSHADOW_DEFAULT_DTYPE>
+struct RowSparse {
+  /*! \brief row ids, in ascending order */
+  Tensor<cpu, 1, index_t> index;
+  /*! \brief the values of the rows, one row for each id */
+  Tensor<xpu, 2, DType> value;
+  RowSparse(void) {}
+  RowSparse(Tensor<cpu, 1, index_t> index, Tensor<xpu, 2, DType> value)
+      : index(index), value(value) {}
+};
 /*!
  * \brief interface of parameter server
  * \tparam xpu the device of the data lies
@@ -91,6 +109,16 @@ class ISharedModel {
    * \param devid the device id this tensor lies in
    */
   virtual void PullWait(int key, int devid) = 0;
+  /*!
+   * \brief get the runtime metrics, they are only kept after SetParam("metrics", "1")
+   * \param out the metrics of each key, their total and the depths of the queues
+   * \return false if the model keeps no metrics
+   */
+  virtual bool GetMetrics(PSMetrics *out) {
+    return false;
+  }
+  /*! \brief set the metrics to zero */
+  virtual void ResetMetrics(void) {}
   /*!
    * \brief check if the weight was correct on the current device
    *
@@ -148,6 +176,52 @@ class ISharedModel {
     this->PullReq_(data.FlatTo2D(), key,
                    devid, priority, callback, callback_arg);
   }
+  /*!
+   * \brief push out the rows of a tensor that may be nonzero, the rows missing are 0.
+   *  The key is initialized with the shape of the whole tensor, and every device
+   *  must push it the same way in a round. The rows of all devices are merged and
+   *  summed, so the traffic scales with the number of rows pushed.
+   *  This call is asynchronize and returns immediately, like Push
+   *
+   * \param grad the rows, grad.index must stay valid until the push is copied
+   * \param key the unique key to indicate the tensor
+   *        this is unique per device
+   * \param devid the device id this tensor lies in
+   * \param priority the priority of this operation,
+   *   the bigger the number is the higher the priority will be
+   */
+  inline void PushRowSparse(const RowSparse<xpu, DType> &grad,
+                            int key,
+                            int devid,
+                            int priority = 0) {
+    this->PushRowSparse_(grad, key, devid, priority);
+  }
+  /*!
+   * \brief send a pull request for some rows of the parameter, data[i] receives
+   *  row rows[i]. This call is asynchronize and returns immediately,
+   *  use PullWait to wait the event of copy finish
+   *
+   * \param rows the row ids, must stay valid until the pull finishes
+   * \param data the destination, one row per id
+   * \param key the unique key to indicate the tensor,
+   *        this is unique per device
+   * \param devid the device id this tensor lies in
+   * \param priority the priority of this operation,
+   *   the bigger the number is the higher the priority will be
+   * \param callback the callback function that will
+   *                 be invoked when the request finishes
+   * \param callback_arg the argument to pass to callback
+   */
+  inline void PullRowSparseReq(Tensor<cpu, 1, index_t> rows,
+                               Tensor<xpu, 2, DType> data,
+                               int key,
+                               int devid,
+                               int priority = 0,
+                               CallbackFunction callback = NULL,
+                               void *callback_arg = NULL) {
+    CHECK_EQ(rows.size(0), data.size(0)) << "PullRowSparseReq: one row of data per id";
+    this->PullRowSparseReq_(rows, data, key, devid, priority, callback, callback_arg);
+  }
 #if __cplusplus >= 201103L
   /*!
    * \brief send a pull request, to pull parameter into data
@@ -246,6 +320,29 @@ class ISharedModel {
                         int priority,
                         CallbackFunction callback,
                         void *callback_arg) = 0;
+  /*!
+   * \brief push out the rows of a tensor that may be nonzero,
+   *  the default implementation does not support it
+   */
+  virtual void PushRowSparse_(const RowSparse<xpu, DType> &grad,
+                              int key,
+                              int devid,
+                              int priority) {
+    LOG(FATAL) << "PushRowSparse: not supported by this model";
+  }
+  /*!
+   * \brief send a pull request for some rows of the parameter,
+   *  the default implementation does not support it
+   */
+  virtual void PullRowSparseReq_(Tensor<cpu, 1, index_t> rows,
+                                 Tensor<xpu, 2, DType> data,
+                                 int key,
+                                 int devid,
+                                 int priority,
+                                 CallbackFunction callback,
+                                 void *callback_arg) {
+    LOG(FATAL) << "PullRowSparseReq: not supported by this model";
+  }
 
  private:
 // C++11 support for lambda prepare function
@@ -325,6 +422,7 @@ IModelUpdater<DType> *CreateModelUpdater(void);
 }  // namespace ps
 }  // namespace mshadow
 
+#include "./ps_updater-inl.h"
 #include "./ps_local-inl.h"
 #include "./ps_dist-inl.h"
 #include "./ps_rabit-inl.h"
@@ -333,7 +431,8 @@ namespace ps {
 /*!
  * \brief create a parameter server implementation
  * \param type the type of paramerver server
- *     can either be "local" or "dist"
+ *     can either be "local", "dist" or "rabit", which is the allreduce of
+ *     rabit even if rabit is not distributed
  * \return the ISharedModel that can be used to synchronize weights
  */
 template<typename xpu, typename DType>
@@ -347,6 +446,9 @@ inline ISharedModel<xpu, DType> *CreateSharedModel(const char *type) {
 #endif
     return new LocalModel<xpu, DType>();
   }
+#if MSHADOW_RABIT_PS
+  if (!strcmp("rabit", type)) return new RabitModel<xpu, DType>();
+#endif
 #if MSHADOW_DIST_PS
   if (!strcmp("dist", type)) return new DistModel<xpu, DType>();
 #endif
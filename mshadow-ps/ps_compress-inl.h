@@ -0,0 +1,392 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file ps_compress-inl.h
+ * \brief gradient compressors used to reduce the traffic of distributed push
+ *
+ *  An encoded message starts with a CompressHeader followed by the payload,
+ *  the whole message is stored in a DType array so that it can be sent by the
+ *  same channel as the dense data. Whether a message is encoded is told by its
+ *  length and never by its content: an encoded message is padded so that its
+ *  length differs from the number of elements of the key, see PadEncodedLength.
+ *  The header then describes the encoding, so the receiver can decode it
+ *  without knowing the setting of the sender.
+ */
+#ifndef MSHADOW_PS_COMPRESS_INL_H_  // NOLINT(*)
+#define MSHADOW_PS_COMPRESS_INL_H_  // NOLINT(*)
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <string>
+#include <vector>
+#include "../mshadow/half.h"
+
+namespace mshadow {
+namespace ps {
+/*! \brief type of compression */
+enum CompressType {
+  /*! \brief each value is rounded to half precision */
+  kCompressFP16 = 1,
+  /*! \brief each value is quantized to {-threshold, 0, threshold} */
+  kCompressTwoBit = 2,
+  /*! \brief only the values with top-k magnitude are sent as (index, value) */
+  kCompressTopK = 3,
+  /*! \brief only the pushed rows of a row sparse gradient are sent as (row, values) */
+  kCompressRowSparse = 4
+};
+/*! \brief header of an encoded message */
+struct CompressHeader {
+  /*! \brief magic number, checked when a message is decoded */
+  static const uint32_t kMagic = 0x7FC0C0DEU;
+  /*! \brief magic number */
+  uint32_t magic;
+  /*! \brief bitwise not of magic, to further rule out dense data */
+  uint32_t check;
+  /*! \brief compression type */
+  uint32_t type;
+  /*! \brief number of elements of the decoded data */
+  uint32_t size;
+  /*! \brief number of nonzero entries for top-k, number of rows for row sparse */
+  uint32_t nnz;
+  /*! \brief the threshold used by 2-bit quantization */
+  float threshold;
+};
+/*!
+ * \brief number of DType needed to hold nbytes
+ */
+template<typename DType>
+inline size_t CompressUnits(size_t nbytes) {
+  return (nbytes + sizeof(DType) - 1) / sizeof(DType);
+}
+/*!
+ * \brief interface of gradient compressor,
+ *  one compressor is created for each key, because compressors with
+ *  error feedback keep the residual of the key
+ */
+template<typename DType>
+class ICompressor {
+ public:
+  /*! \brief virtual destructor */
+  virtual ~ICompressor(void) {}
+  /*!
+   * \brief upper bound of the encoded length
+   * \param size number of elements to be encoded
+   * \return the length in number of DType
+   */
+  virtual size_t MaxEncodeSize(size_t size) const = 0;
+  /*!
+   * \brief encode the data
+   * \param src the data to be encoded
+   * \param size number of elements in src
+   * \param dst the output buffer, must hold MaxEncodeSize(size) elements
+   * \return the length of the encoded message in number of DType
+   */
+  virtual size_t Encode(const DType *src, size_t size, DType *dst) = 0;
+
+ protected:
+  /*! \brief write header, return the start of the payload */
+  inline static char *WriteHeader(DType *dst, uint32_t type, size_t size,
+                                  uint32_t nnz, float threshold) {
+    CompressHeader h;
+    h.magic = CompressHeader::kMagic;
+    h.check = ~CompressHeader::kMagic;
+    h.type = type;
+    h.size = static_cast<uint32_t>(size);
+    h.nnz = nnz;
+    h.threshold = threshold;
+    std::memcpy(dst, &h, sizeof(h));
+    return reinterpret_cast<char*>(dst) + sizeof(h);
+  }
+};
+/*! \brief cast each value to half_t */
+template<typename DType>
+class FP16Compressor : public ICompressor<DType> {
+ public:
+  virtual size_t MaxEncodeSize(size_t size) const {
+    return CompressUnits<DType>(sizeof(CompressHeader) + size * sizeof(uint16_t));
+  }
+  virtual size_t Encode(const DType *src, size_t size, DType *dst) {
+    uint16_t *out = reinterpret_cast<uint16_t*>(
+        this->WriteHeader(dst, kCompressFP16, size, 0, 0.0f));
+    for (size_t i = 0; i < size; ++i) {
+      out[i] = half::half_t(static_cast<float>(src[i])).half_;
+    }
+    return this->MaxEncodeSize(size);
+  }
+};
+/*!
+ * \brief 2-bit threshold quantization with error feedback,
+ *  the quantization error is kept in the residual and added to the next push
+ */
+template<typename DType>
+class TwoBitCompressor : public ICompressor<DType> {
+ public:
+  explicit TwoBitCompressor(float threshold) : threshold_(threshold) {
+    CHECK_GT(threshold, 0.0f) << "2bit compression: threshold must be positive";
+  }
+  virtual size_t MaxEncodeSize(size_t size) const {
+    return CompressUnits<DType>(sizeof(CompressHeader) + (size + 3) / 4);
+  }
+  virtual size_t Encode(const DType *src, size_t size, DType *dst) {
+    if (residual_.size() != size) residual_.resize(size, DType(0));
+    uint8_t *out = reinterpret_cast<uint8_t*>(
+        this->WriteHeader(dst, kCompressTwoBit, size, 0, threshold_));
+    std::memset(out, 0, (size + 3) / 4);
+    const DType t = static_cast<DType>(threshold_);
+    for (size_t i = 0; i < size; ++i) {
+      DType r = residual_[i] + src[i];
+      uint8_t code = 0;
+      if (r >= t) {
+        code = 1; r -= t;
+      } else if (r <= -t) {
+        code = 2; r += t;
+      }
+      residual_[i] = r;
+      out[i >> 2] |= static_cast<uint8_t>(code << ((i & 3) << 1));
+    }
+    return this->MaxEncodeSize(size);
+  }
+
+ private:
+  /*! \brief quantization threshold */
+  float threshold_;
+  /*! \brief quantization error accumulated so far */
+  std::vector<DType> residual_;
+};
+/*!
+ * \brief top-k sparsification with error feedback,
+ *  the entries that are not sent stay in the residual
+ */
+template<typename DType>
+class TopKCompressor : public ICompressor<DType> {
+ public:
+  explicit TopKCompressor(float ratio) : ratio_(ratio) {
+    CHECK(ratio > 0.0f && ratio <= 1.0f) << "topk compression: ratio must be in (0, 1]";
+  }
+  virtual size_t MaxEncodeSize(size_t size) const {
+    return CompressUnits<DType>(sizeof(CompressHeader) +
+                                this->NumKeep(size) * (sizeof(uint32_t) + sizeof(DType)));
+  }
+  virtual size_t Encode(const DType *src, size_t size, DType *dst) {
+    if (residual_.size() != size) residual_.resize(size, DType(0));
+    for (size_t i = 0; i < size; ++i) residual_[i] += src[i];
+    const size_t k = this->NumKeep(size);
+    index_.resize(size);
+    for (size_t i = 0; i < size; ++i) index_[i] = static_cast<uint32_t>(i);
+    if (k < size) {
+      std::nth_element(index_.begin(), index_.begin() + k, index_.end(), AbsGreater(residual_));
+    }
+    // sorted index makes the scatter on the receiver side cache friendly
+    std::sort(index_.begin(), index_.begin() + k);
+    char *payload = this->WriteHeader(dst, kCompressTopK, size,
+                                      static_cast<uint32_t>(k), 0.0f);
+    uint32_t *oidx = reinterpret_cast<uint32_t*>(payload);
+    char *pval = payload + k * sizeof(uint32_t);
+    for (size_t i = 0; i < k; ++i) {
+      const uint32_t j = index_[i];
+      oidx[i] = j;
+      std::memcpy(pval + i * sizeof(DType), &residual_[j], sizeof(DType));
+      residual_[j] = DType(0);
+    }
+    return this->MaxEncodeSize(size);
+  }
+
+ private:
+  /*! \brief compare the magnitude of residual */
+  struct AbsGreater {
+    const std::vector<DType> &r;
+    explicit AbsGreater(const std::vector<DType> &r) : r(r) {}
+    inline bool operator()(uint32_t a, uint32_t b) const {
+      return std::abs(r[a]) > std::abs(r[b]);
+    }
+  };
+  inline size_t NumKeep(size_t size) const {
+    size_t k = static_cast<size_t>(std::ceil(ratio_ * static_cast<double>(size)));
+    return std::max(std::min(k, size), static_cast<size_t>(1));
+  }
+  /*! \brief fraction of entries to send */
+  float ratio_;
+  /*! \brief entries not sent so far */
+  std::vector<DType> residual_;
+  /*! \brief temp space for selection */
+  std::vector<uint32_t> index_;
+};
+/*!
+ * \brief create a compressor from its specification
+ * \param spec can be "none", "fp16", "2bit[:threshold]" or "topk[:ratio]"
+ * \return the compressor, NULL if no compression is needed
+ */
+template<typename DType>
+inline ICompressor<DType> *CreateCompressor(const std::string &spec) {
+  const size_t pos = spec.find(':');
+  const std::string name = spec.substr(0, pos);
+  const char *arg = pos == std::string::npos ? NULL : spec.c_str() + pos + 1;
+  if (name == "none") return NULL;
+  if (name == "fp16") return new FP16Compressor<DType>();
+  if (name == "2bit") {
+    return new TwoBitCompressor<DType>(arg != NULL ? static_cast<float>(atof(arg)) : 0.5f);
+  }
+  if (name == "topk") {
+    return new TopKCompressor<DType>(arg != NULL ? static_cast<float>(atof(arg)) : 0.01f);
+  }
+  LOG(FATAL) << "unknown compression " << spec
+             << ", can only be none, fp16, 2bit[:threshold] or topk[:ratio]";
+  return NULL;
+}
+/*!
+ * \brief length of a row sparse message, in number of DType
+ * \param nrow number of rows sent
+ * \param ncol number of elements in a row
+ */
+template<typename DType>
+inline size_t RowSparseEncodeSize(size_t nrow, size_t ncol) {
+  return CompressUnits<DType>(sizeof(CompressHeader) + sizeof(uint32_t) +
+                              nrow * (sizeof(uint32_t) + ncol * sizeof(DType)));
+}
+/*!
+ * \brief encode the rows of a tensor, the other rows decode to 0
+ * \param rows the row ids, ascending
+ * \param nrow number of rows
+ * \param value the values of the rows, nrow x ncol
+ * \param ncol number of elements in a row
+ * \param size number of elements of the whole tensor
+ * \param dst output buffer, must hold RowSparseEncodeSize(nrow, ncol) elements
+ * \return the length of the message in number of DType
+ */
+template<typename DType>
+inline size_t RowSparseEncode(const index_t *rows, size_t nrow, const DType *value,
+                              size_t ncol, size_t size, DType *dst) {
+  CompressHeader h;
+  h.magic = CompressHeader::kMagic;
+  h.check = ~CompressHeader::kMagic;
+  h.type = kCompressRowSparse;
+  h.size = static_cast<uint32_t>(size);
+  h.nnz = static_cast<uint32_t>(nrow);
+  h.threshold = 0.0f;
+  char *payload = reinterpret_cast<char*>(dst);
+  std::memcpy(payload, &h, sizeof(h));
+  payload += sizeof(h);
+  const uint32_t width = static_cast<uint32_t>(ncol);
+  std::memcpy(payload, &width, sizeof(width));
+  payload += sizeof(width);
+  for (size_t i = 0; i < nrow; ++i) {
+    const uint32_t r = static_cast<uint32_t>(rows[i]);
+    std::memcpy(payload + i * sizeof(uint32_t), &r, sizeof(r));
+  }
+  if (nrow != 0) {
+    std::memcpy(payload + nrow * sizeof(uint32_t), value, nrow * ncol * sizeof(DType));
+  }
+  return RowSparseEncodeSize<DType>(nrow, ncol);
+}
+/*!
+ * \brief pad an encoded message so that its length differs from the dense length
+ * \param buffer the buffer holding the message, grown by one element if needed
+ * \param len length of the encoded message in number of DType
+ * \param size number of elements of the key
+ * \return the length to send
+ */
+template<typename DType>
+inline size_t PadEncodedLength(std::vector<DType> *buffer, size_t len, size_t size) {
+  if (len != size) return len;
+  if (buffer->size() <= len) buffer->resize(len + 1);
+  (*buffer)[len] = DType(0);
+  return len + 1;
+}
+/*!
+ * \brief whether a message pushed to a key is encoded
+ * \param len length of the message in number of DType
+ * \param size number of elements of the key
+ */
+inline bool IsEncodedLength(size_t len, size_t size) {
+  return len != size;
+}
+/*!
+ * \brief check the header of a message known to be encoded
+ * \param src the message
+ * \param len length of the message in number of DType
+ */
+template<typename DType>
+inline bool IsCompressed(const DType *src, size_t len) {
+  if (len * sizeof(DType) < sizeof(CompressHeader)) return false;
+  CompressHeader h;
+  std::memcpy(&h, src, sizeof(h));
+  return h.magic == CompressHeader::kMagic && h.check == ~CompressHeader::kMagic;
+}
+/*!
+ * \brief number of elements of a compressed message after decoding
+ */
+template<typename DType>
+inline size_t DecompressSize(const DType *src) {
+  CompressHeader h;
+  std::memcpy(&h, src, sizeof(h));
+  return h.size;
+}
+/*!
+ * \brief decode a compressed message
+ * \param src the message
+ * \param len length of the message in number of DType
+ * \param dst output, must hold DecompressSize(src) elements
+ */
+template<typename DType>
+inline void Decompress(const DType *src, size_t len, DType *dst) {
+  CHECK(IsCompressed(src, len)) << "Decompress: not a compressed message";
+  CompressHeader h;
+  std::memcpy(&h, src, sizeof(h));
+  const char *payload = reinterpret_cast<const char*>(src) + sizeof(h);
+  const size_t nbytes = len * sizeof(DType) - sizeof(h);
+  const size_t size = h.size;
+  switch (h.type) {
+    case kCompressFP16: {
+      CHECK_GE(nbytes, size * sizeof(uint16_t)) << "Decompress: message truncated";
+      const uint16_t *in = reinterpret_cast<const uint16_t*>(payload);
+      for (size_t i = 0; i < size; ++i) {
+        dst[i] = static_cast<DType>(static_cast<float>(half::half_t::Binary(in[i])));
+      }
+      return;
+    }
+    case kCompressTwoBit: {
+      CHECK_GE(nbytes, (size + 3) / 4) << "Decompress: message truncated";
+      const uint8_t *in = reinterpret_cast<const uint8_t*>(payload);
+      const DType t = static_cast<DType>(h.threshold);
+      for (size_t i = 0; i < size; ++i) {
+        const int code = (in[i >> 2] >> ((i & 3) << 1)) & 3;
+        dst[i] = code == 1 ? t : (code == 2 ? -t : DType(0));
+      }
+      return;
+    }
+    case kCompressTopK: {
+      CHECK_GE(nbytes, h.nnz * (sizeof(uint32_t) + sizeof(DType)))
+          << "Decompress: message truncated";
+      const uint32_t *idx = reinterpret_cast<const uint32_t*>(payload);
+      const char *pval = payload + h.nnz * sizeof(uint32_t);
+      std::fill(dst, dst + size, DType(0));
+      for (uint32_t i = 0; i < h.nnz; ++i) {
+        CHECK_LT(idx[i], size) << "Decompress: index out of range";
+        std::memcpy(&dst[idx[i]], pval + i * sizeof(DType), sizeof(DType));
+      }
+      return;
+    }
+    case kCompressRowSparse: {
+      uint32_t ncol;
+      CHECK_GE(nbytes, sizeof(ncol)) << "Decompress: message truncated";
+      std::memcpy(&ncol, payload, sizeof(ncol));
+      CHECK_GE(nbytes, sizeof(ncol) + h.nnz * (sizeof(uint32_t) + ncol * sizeof(DType)))
+          << "Decompress: message truncated";
+      const char *prow = payload + sizeof(ncol);
+      const char *pval = prow + h.nnz * sizeof(uint32_t);
+      std::fill(dst, dst + size, DType(0));
+      for (uint32_t i = 0; i < h.nnz; ++i) {
+        uint32_t r;
+        std::memcpy(&r, prow + i * sizeof(uint32_t), sizeof(r));
+        CHECK_LE((static_cast<size_t>(r) + 1) * ncol, size) << "Decompress: row out of range";
+        std::memcpy(dst + static_cast<size_t>(r) * ncol,
+                    pval + static_cast<size_t>(i) * ncol * sizeof(DType), ncol * sizeof(DType));
+      }
+      return;
+    }
+    default: LOG(FATAL) << "Decompress: unknown compression type " << h.type;
+  }
+}
+}  // namespace ps
+}  // namespace mshadow
+#endif  // MSHADOW_PS_COMPRESS_INL_H_  NOLINT(*)
@@ -8,9 +8,13 @@
 #ifndef MSHADOW_PS_DIST_INL_H_ // NOLINT(*)
 #define MSHADOW_PS_DIST_INL_H_ // NOLINT(*)
 
+#include <deque>
+#include <map>
+#include <string>
 #include <vector>
 #include "./mshadow_ps.h"
 #include "./ps_local-inl.h"
+#include "./ps_compress-inl.h"
 
 #if MSHADOW_DIST_PS
 #include "parameter/kv_layer.h"
@@ -24,20 +28,43 @@ template<typename DType>
 class UpdaterWrapper {
  public:
   explicit UpdaterWrapper(IModelUpdater<DType> * updater)
-      : updater_(updater) { }
-  ~UpdaterWrapper() { delete updater_; }
+      : updater_(updater) {
+    lock_.Init();
+  }
+  ~UpdaterWrapper() {
+    delete updater_;
+    lock_.Destroy();
+  }
 
   /// @brief initialize the data
   void Init(int id, size_t size, DType* data) {
+    lock_.Lock();
+    key_size_[id] = size;
+    lock_.Unlock();
     updater_->InitModel(id, data, size);
   }
 
-  /// @brief update the model by using received data
+  /// @brief update the model by using received data, decode it first if it is encoded,
+  /// which is told by a length different from the size of the key
   void Update(int id, size_t size, const DType* recv_data, DType* data) {
-    updater_->Update(id, (DType*)recv_data, size);  // NOLINT(*)
+    lock_.Lock();
+    typename std::map<int, size_t>::const_iterator it = key_size_.find(id);
+    const bool encoded = it != key_size_.end() && IsEncodedLength(size, it->second);
+    lock_.Unlock();
+    if (encoded) {
+      std::vector<DType> grad(DecompressSize(recv_data));
+      Decompress(recv_data, size, &grad[0]);
+      updater_->Update(id, &grad[0], grad.size());
+    } else {
+      updater_->Update(id, (DType*)recv_data, size);  // NOLINT(*)
+    }
   }
  private:
   IModelUpdater<DType> *updater_;
+  // number of elements of each key, set by Init
+  std::map<int, size_t> key_size_;
+  // guards key_size_
+  utils::Mutex lock_;
 };
 
 
@@ -47,6 +74,28 @@ class DistModel : public LocalModel<xpu, DType> {
   // parent type
   typedef LocalModel<xpu, DType> Parent;
 
+  DistModel(void) : default_compress("none"), staleness_(0) {
+    compress_map.Init();
+    push_lock_.Init();
+  }
+  virtual void SetParam(const char *name, const char *val) {
+    int key;
+    if (sscanf(name, "compress[%d]", &key) == 1) {
+      // check the spec early
+      delete CreateCompressor<DType>(val);
+      compress_spec[key] = val;
+      return;
+    }
+    if (!strcmp(name, "compress")) {
+      delete CreateCompressor<DType>(val);
+      default_compress = val;
+      return;
+    }
+    if (!strcmp(name, "staleness")) {
+      staleness_ = atoi(val);
+    }
+    Parent::SetParam(name, val);
+  }
   // initialize the parameter server
   virtual void Init(const std::vector<int> &devices) {
     Parent::Init(devices);
@@ -56,6 +105,10 @@ class DistModel : public LocalModel<xpu, DType> {
     }
   }
   virtual ~DistModel(void) {
+    // stop the push threads before releasing the compressors they use
+    this->Destroy();
+    compress_map.Destroy();
+    push_lock_.Destroy();
   }
 
  protected:
@@ -63,6 +116,13 @@ class DistModel : public LocalModel<xpu, DType> {
   virtual void InitCustomerServer(void) {
   }
   virtual void ServerInitKey(Tensor<cpu, 2> weight, int key) {
+    if (compress_map.Get(key) == NULL) {
+      compress_map.Init(key);
+      std::map<int, std::string>::const_iterator it = compress_spec.find(key);
+      compress_map.GetRef(key).compressor = CreateCompressor<DType>(
+          it != compress_spec.end() ? it->second : default_compress);
+      compress_map.GetRef(key).buffers.resize(staleness_ + 1);
+    }
     // this is called when key get initialized for the first time
     // weight can be used to hold the model that pulled back
     // use this to initialize the key on serverside
@@ -73,39 +133,125 @@ class DistModel : public LocalModel<xpu, DType> {
           this->PullReady(weight, key);
         });
   }
+  // the reduced data is always sent to other machines
+  virtual bool NeedHostResult(int key) {
+    return true;
+  }
   // override this function, to use parameter server
   virtual void HandlePushFinish(Tensor<cpu, 3, DType> data,
                                 int key) {
     // summation the data fron all devices
-    LocalModel<xpu, DType>::ReduceSum(data);
-
-    // push and pull
-    Tensor<cpu, 2> sendrecv = data[0];
+    LocalModel<xpu, DType>::ReduceSum(data, key);
     CHECK_EQ(data[0].CheckContiguous(), true) << "data must be contiguous";
+    if (this->IsBucketKey(key)) {
+      // the server keeps the state of each key, so a bucket is reduced
+      // once locally but still sent key by key
+      int member;
+      for (size_t i = 0; i < this->NumBucketKey(key); ++i) {
+        this->PushPull(this->BucketMember(data[0], key, i, &member), member);
+      }
+    } else {
+      this->PushPull(data[0], key);
+    }
+  }
 
-    int ts = shared_model_.Push(
-        ::ps::Parameter::Request(key), sendrecv.dptr_, sendrecv.MSize(), false);
+  // only the merged rows are sent, the server decodes them into a dense gradient
+  virtual void HandleRowSparseFinish(Tensor<cpu, 1, index_t> rows,
+                                     Tensor<cpu, 2, DType> value,
+                                     Tensor<cpu, 3, DType> data,
+                                     int key) {
+    CompressEntry &c = compress_map.GetRef(key);
+    Tensor<cpu, 2, DType> recv = data[0];
+    CHECK_EQ(recv.CheckContiguous(), true) << "data must be contiguous";
+    std::vector<DType> &buffer = this->NextBuffer(&c);
+    buffer.resize(RowSparseEncodeSize<DType>(rows.size(0), value.size(1)));
+    size_t len = RowSparseEncode(rows.dptr_, rows.size(0), value.dptr_, value.size(1),
+                                 recv.MSize(), &buffer[0]);
+    len = PadEncodedLength(&buffer, len, recv.MSize());
+    this->PushPull(&buffer[0], len, recv, key);
+  }
 
-    // let this pull request wait the push finish at the server node
+ private:
+  // push the reduced data to server and pull the result back
+  inline void PushPull(Tensor<cpu, 2> sendrecv, int key) {
+    // encode the gradient if compression is enabled on the key,
+    // the server tells the encoded message by its length and decodes it
+    CompressEntry &c = compress_map.GetRef(key);
+    if (c.compressor != NULL) {
+      std::vector<DType> &buffer = this->NextBuffer(&c);
+      buffer.resize(c.compressor->MaxEncodeSize(sendrecv.MSize()));
+      size_t len = c.compressor->Encode(sendrecv.dptr_, sendrecv.MSize(), &buffer[0]);
+      len = PadEncodedLength(&buffer, len, sendrecv.MSize());
+      this->PushPull(&buffer[0], len, sendrecv, key);
+    } else {
+      this->PushPull(sendrecv.dptr_, sendrecv.MSize(), sendrecv, key);
+    }
+  }
+  // push a message of len elements to server and pull the whole key back into recv
+  inline void PushPull(DType *send, size_t len, Tensor<cpu, 2> recv, int key) {
+    int ts = shared_model_.Push(::ps::Parameter::Request(key), send, len, false);
+    this->AddMetric(key, &KeyMetrics::bytes_sent, len * sizeof(DType));
+    // let this pull request wait the push staleness pushes ago to finish at the server
+    // node, the server applies the pushes of a key in order
+    CompressEntry &c = compress_map.GetRef(key);
+    push_lock_.Lock();
+    c.push_ts.push_back(ts);
+    const int wait_ts = c.push_ts.size() > static_cast<size_t>(staleness_) ?
+        c.push_ts.front() : -1;
+    while (c.push_ts.size() > static_cast<size_t>(staleness_)) c.push_ts.pop_front();
+    push_lock_.Unlock();
     shared_model_.Pull(
-        ::ps::Parameter::Request(key, -1, {ts}), sendrecv.dptr_, sendrecv.MSize(),
-        [this, sendrecv, key]() {
+        wait_ts >= 0 ? ::ps::Parameter::Request(key, -1, {wait_ts}) :
+        ::ps::Parameter::Request(key), recv.dptr_, recv.MSize(),
+        [this, recv, key]() {
+          this->AddMetric(key, &KeyMetrics::bytes_recv, recv.MSize() * sizeof(DType));
           // call PullReady to notify LocalServer pulling is ready
-          this->PullReady(sendrecv, key);
+          this->PullReady(recv, key);
         });
   }
-
- private:
+  /*! \brief compression state of a key */
+  struct CompressEntry {
+    // the compressor, NULL if the key is sent as it is
+    ICompressor<DType> *compressor;
+    // buffers to hold the encoded messages until they are sent, used in turn
+    std::vector<std::vector<DType> > buffers;
+    size_t next_buffer;
+    // timestamps of the last pushes of the key
+    std::deque<int> push_ts;
+    CompressEntry(void) : compressor(NULL), buffers(1), next_buffer(0) {}
+    ~CompressEntry(void) { delete compressor; }
+  };
+  /*!
+   * \brief the buffer to encode the next message of a key in, with staleness a message
+   *  is still in flight while the next pushes of the key are encoded
+   */
+  inline std::vector<DType> &NextBuffer(CompressEntry *c) {
+    push_lock_.Lock();
+    std::vector<DType> &buffer = c->buffers[c->next_buffer];
+    c->next_buffer = (c->next_buffer + 1) % c->buffers.size();
+    push_lock_.Unlock();
+    return buffer;
+  }
   ::ps::KVLayer<DType, UpdaterWrapper<DType> > shared_model_;
+  // compression specification of each key, set by compress[key]
+  std::map<int, std::string> compress_spec;
+  // compression used by keys without specification, set by compress
+  std::string default_compress;
+  // compression state of each key
+  utils::ThreadSafeMap<CompressEntry> compress_map;
+  // the staleness of the pulls, see LocalModel
+  int staleness_;
+  // guards push_ts and next_buffer of the keys
+  utils::Mutex push_lock_;
 };
 
 
 template<typename DType>
 class MShadowServerNode {
  public:
-  // conf: get from the flag -app_conf
+  // conf: get from the flag -app_conf, updater=sgd|adam|adagrad selects a built-in updater
   MShadowServerNode(int argc, char *argv[]) {
-    IModelUpdater<DType> *updater = CreateModelUpdater<DType>();
+    IModelUpdater<DType> *updater = CreateServerUpdater<DType>(argc, argv);
     updater->InitUpdater(::ps::MyRank(), argc, argv);
 
     UpdaterWrapper<DType> *wrapper = new UpdaterWrapper<DType>(updater);
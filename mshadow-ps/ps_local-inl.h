@@ -7,6 +7,8 @@
  */
 #ifndef MSHADOW_PS_LOCAL_INL_H_  // NOLINT(*)
 #define MSHADOW_PS_LOCAL_INL_H_  // NOLINT(*)
+#include <algorithm>
+#include <cstring>
 #include <map>
 #include <utility>
 #include <string>
@@ -22,9 +24,89 @@ typedef unsigned ms_omp_uint;
 
 #include "./thread.h"
 #include "./thread_util.h"
+#include "./ps_metrics.h"
 
 namespace mshadow {
 namespace ps {
+/*!
+ * \brief device side reduction used by LocalModel when reduce_on_device is set,
+ *  the data of all devices is copied peer to peer into a buffer on the first
+ *  device and summed there, so the host is not involved
+ * \tparam xpu the device type, only gpu supports this
+ */
+template<typename xpu>
+struct DeviceReduce {
+  /*! \brief whether device reduction is supported */
+  static const bool kEnabled = false;
+  /*! \brief allow the first device to access the others directly */
+  inline static void EnablePeerAccess(const std::vector<int> &devices) {}
+  /*! \brief copy between two devices */
+  template<typename DType>
+  inline static void PeerCopy(Tensor<xpu, 2, DType> dst, int dst_dev,
+                              const Tensor<xpu, 2, DType> &src, int src_dev,
+                              Stream<xpu> *stream) {
+    LOG(FATAL) << "reduce_on_device is not supported by this device";
+  }
+  /*! \brief data[0] = sum of data[i] over i */
+  template<typename DType>
+  inline static void Sum(Tensor<xpu, 3, DType> data, Stream<xpu> *stream) {
+    LOG(FATAL) << "reduce_on_device is not supported by this device";
+  }
+};
+#if MSHADOW_USE_CUDA && defined(__CUDACC__)
+template<>
+struct DeviceReduce<gpu> {
+  static const bool kEnabled = true;
+  inline static void EnablePeerAccess(const std::vector<int> &devices) {
+    int curr;
+    MSHADOW_CUDA_CALL(cudaGetDevice(&curr));
+    for (size_t i = 1; i < devices.size(); ++i) {
+      // both directions, push copies into the first device, pull copies out of it
+      for (int dir = 0; dir < 2; ++dir) {
+        const int dev = dir == 0 ? devices[0] : devices[i];
+        const int peer = dir == 0 ? devices[i] : devices[0];
+        int can_access = 0;
+        MSHADOW_CUDA_CALL(cudaDeviceCanAccessPeer(&can_access, dev, peer));
+        if (can_access == 0) continue;
+        MSHADOW_CUDA_CALL(cudaSetDevice(dev));
+        cudaError_t err = cudaDeviceEnablePeerAccess(peer, 0);
+        CHECK(err == cudaSuccess || err == cudaErrorPeerAccessAlreadyEnabled)
+            << "EnablePeerAccess: " << cudaGetErrorString(err);
+        // clear the error if already enabled
+        cudaGetLastError();
+      }
+    }
+    MSHADOW_CUDA_CALL(cudaSetDevice(curr));
+  }
+  template<typename DType>
+  inline static void PeerCopy(Tensor<gpu, 2, DType> dst, int dst_dev,
+                              const Tensor<gpu, 2, DType> &src, int src_dev,
+                              Stream<gpu> *stream) {
+    CHECK_EQ(dst.shape_, src.shape_) << "PeerCopy: shape mismatch";
+    if (dst.CheckContiguous() && src.CheckContiguous()) {
+      MSHADOW_CUDA_CALL(cudaMemcpyPeerAsync(dst.dptr_, dst_dev, src.dptr_, src_dev,
+                                            dst.MSize() * sizeof(DType),
+                                            Stream<gpu>::GetStream(stream)));
+    } else {
+      // unified addressing, the driver works out the devices from the pointers
+      MSHADOW_CUDA_CALL(cudaMemcpy2DAsync(dst.dptr_, dst.stride_ * sizeof(DType),
+                                          src.dptr_, src.stride_ * sizeof(DType),
+                                          dst.size(1) * sizeof(DType), dst.size(0),
+                                          cudaMemcpyDefault,
+                                          Stream<gpu>::GetStream(stream)));
+    }
+  }
+  template<typename DType>
+  inline static void Sum(Tensor<gpu, 3, DType> data, Stream<gpu> *stream) {
+    Tensor<gpu, 2, DType> dst = data[0];
+    dst.set_stream(stream);
+    for (index_t i = 1; i < data.size(0); ++i) {
+      dst += data[i];
+    }
+  }
+};
+#endif  // MSHADOW_USE_CUDA && defined(__CUDACC__)
+
 // multi-threaded implementation of
 template<typename xpu, typename DType>
 class LocalModel : public ISharedModel<xpu, DType> {
@@ -39,12 +121,20 @@ class LocalModel : public ISharedModel<xpu, DType> {
     perdev_push_thread = 1;
     use_fifo_push_queue = 0;
     bigarray_bound = 1000 * 1000;
+    bucket_bound = 0;
+    bucket_size = 1000 * 1000;
+    reduce_on_device = 0;
+    partition_size = 0;
     nthread_reduction = 8;
+    staleness = 0;
     use_pin_memory = 1;
     test_on_server = 0;
     update_on_server = 0;
     destroy_signal = false;
     custom_server = NULL;
+    metrics_enabled = 0;
+    metrics_log_interval = 0.0;
+    metrics_last_log = 0.0;
   }
   // destructor
   virtual ~LocalModel(void) {
@@ -74,9 +164,15 @@ class LocalModel : public ISharedModel<xpu, DType> {
         pull_queues[i].Destroy();
       }
       pull_map.Destroy();
+      for (size_t i = 0; i < buckets.size(); ++i) {
+        delete buckets[i];
+      }
+      buckets.clear();
+      key2bucket.clear();
       request_lock.Destroy();
       wait_lock.Destroy();
       wait_cond.Destroy();
+      metrics_lock.Destroy();
       init_end = 0;
     }
     if (custom_server != NULL) {
@@ -98,6 +194,18 @@ class LocalModel : public ISharedModel<xpu, DType> {
       }
       LOG(FATAL) << "unknown push operation " << val;
     }
+    if (!strcmp(name, "staleness")) {
+      CHECK_EQ(init_end, 0) << "staleness must be set before Init";
+      staleness = atoi(val);
+      CHECK_GE(staleness, 0) << "staleness must be non-negative";
+    }
+    if (!strcmp(name, "metrics")) {
+      metrics_enabled = atoi(val);
+    }
+    if (!strcmp(name, "metrics_log_interval")) {
+      metrics_log_interval = atof(val);
+      if (metrics_log_interval > 0.0) metrics_enabled = 1;
+    }
     if (!strcmp(name, "reduce_thread")) {
       nthread_reduction = atoi(val);
     }
@@ -107,6 +215,20 @@ class LocalModel : public ISharedModel<xpu, DType> {
     if (!strcmp(name, "bigarray_bound")) {
       bigarray_bound = static_cast<size_t>(atol(val));
     }
+    if (!strcmp(name, "bucket_bound")) {
+      bucket_bound = static_cast<size_t>(atol(val));
+    }
+    if (!strcmp(name, "bucket_size")) {
+      bucket_size = static_cast<size_t>(atol(val));
+    }
+    if (!strcmp(name, "partition_size")) {
+      partition_size = static_cast<size_t>(atol(val));
+    }
+    if (!strcmp(name, "reduce_on_device")) {
+      reduce_on_device = atoi(val);
+      CHECK(reduce_on_device == 0 || DeviceReduce<xpu>::kEnabled)
+          << "reduce_on_device requires GPU and compiling with nvcc";
+    }
     if (!strcmp(name, "pull_thread")) {
       if (!strcmp(val, "ndev")) {
         perdev_pull_thread = 1;
@@ -144,6 +266,7 @@ class LocalModel : public ISharedModel<xpu, DType> {
     // wake up waiters if any
     CHECK_EQ(e.wait.size(), devices.size()) << "PullWait: must initialize the wait";
     PullWaitRecord &w = e.wait[wid];
+    const double start = metrics_enabled != 0 ? MetricsTime() : 0.0;
     if (!w.finished) {
       wait_lock.Lock();
       w.nwait += 1;
@@ -154,6 +277,38 @@ class LocalModel : public ISharedModel<xpu, DType> {
       CHECK_GE(w.nwait, 0) << "boundary check";
       wait_lock.Unlock();
     }
+    if (metrics_enabled != 0) {
+      this->AddLatency(key, &KeyMetrics::pull_wait, MetricsTime() - start);
+      this->LogMetrics();
+    }
+  }
+  virtual bool GetMetrics(PSMetrics *out) {
+    if (metrics_enabled == 0 || init_end == 0) return false;
+    metrics_lock.Lock();
+    *out = metrics;
+    metrics_lock.Unlock();
+    out->total = KeyMetrics();
+    for (std::map<int, KeyMetrics>::const_iterator it = out->keys.begin();
+         it != out->keys.end(); ++it) {
+      out->total.Merge(it->second);
+    }
+    out->push_queue_depth.resize(push_queues.size());
+    for (size_t i = 0; i < push_queues.size(); ++i) {
+      out->push_queue_depth[i] = push_queues[i].Size();
+    }
+    out->pull_queue_depth.resize(pull_queues.size());
+    for (size_t i = 0; i < pull_queues.size(); ++i) {
+      out->pull_queue_depth[i] = pull_queues[i].Size();
+    }
+    return true;
+  }
+  virtual void ResetMetrics(void) {
+    if (init_end == 0) return;
+    metrics_lock.Lock();
+    metrics.keys.clear();
+    std::fill(metrics.max_push_queue_depth.begin(), metrics.max_push_queue_depth.end(), 0);
+    std::fill(metrics.max_pull_queue_depth.begin(), metrics.max_pull_queue_depth.end(), 0);
+    metrics_lock.Unlock();
   }
   virtual void Init(const std::vector<int> &devices) {
     CHECK_EQ(init_end, 0) << "LocalServer.Init can only call Init once";
@@ -173,6 +328,10 @@ class LocalModel : public ISharedModel<xpu, DType> {
     // allocate space
     pull_stream.resize(devices.size());
     push_stream.resize(devices.size());
+    reduce_stream.resize(devices.size(), NULL);
+    if (reduce_on_device != 0) {
+      DeviceReduce<xpu>::EnablePeerAccess(devices);
+    }
     // initialize all the thread related things
     if (perdev_push_thread != 0) {
       push_queues.resize(devices.size());
@@ -188,6 +347,8 @@ class LocalModel : public ISharedModel<xpu, DType> {
     request_lock.Init();
     wait_lock.Init();
     wait_cond.Init();
+    metrics_lock.Init();
+    metrics_last_log = MetricsTime();
     if (perdev_pull_thread != 0) {
       pull_queues.resize(devices.size());
     } else {
@@ -196,6 +357,9 @@ class LocalModel : public ISharedModel<xpu, DType> {
     for (size_t i = 0; i < pull_queues.size(); ++i) {
       pull_queues[i].Init();
     }
+    metrics = PSMetrics();
+    metrics.max_push_queue_depth.resize(push_queues.size(), 0);
+    metrics.max_pull_queue_depth.resize(pull_queues.size(), 0);
     // initialize the thread
     if (perdev_push_thread != 0) {
       thread_push_handler.resize(devices.size());
@@ -287,25 +451,63 @@ class LocalModel : public ISharedModel<xpu, DType> {
   }
   virtual void Push_(Tensor<xpu, 2, DType> data,
                      int key, int devid, int priority) {
-    PullEntry &e = pull_map.GetRef(key);
-    e.req[GetWorkIndex(devid)].ready = false;
-    if (perdev_push_thread != 0) {
-      int wid = GetWorkIndex(devid);
-      push_queues[wid].Push(PullTask(data, key, devid), priority);
-    } else {
-      push_queues[0].Push(PullTask(data, key, devid), priority);
+    this->TickClock(key, GetWorkIndex(devid));
+    const size_t qid = perdev_push_thread != 0 ? GetWorkIndex(devid) : 0;
+    utils::ThreadPQueue<PullTask> &queue = push_queues[qid];
+    // big keys are partitioned into chunks, so that a push with higher
+    // priority that comes later only waits for the chunk in progress
+    const index_t nrow = data.size(0), step = this->ChunkRows(data.shape_);
+    for (index_t begin = 0; begin < nrow; begin += step) {
+      const index_t end = std::min(begin + step, nrow);
+      queue.Push(PullTask(data.Slice(begin, end), key, devid, begin, data.shape_), priority);
     }
+    this->AddQueueDepth(&metrics.max_push_queue_depth, qid, queue.Size());
+  }
+  virtual void PushRowSparse_(const RowSparse<xpu, DType> &grad,
+                              int key, int devid, int priority) {
+    CHECK_EQ(grad.index.size(0), grad.value.size(0)) << "PushRowSparse: one row of value per id";
+    CHECK(push_operation.count(key) == 0 || push_operation[key] != kGather)
+        << "PushRowSparse: a gather key can not be pushed as row sparse";
+    this->TickClock(key, GetWorkIndex(devid));
+    const size_t qid = perdev_push_thread != 0 ? GetWorkIndex(devid) : 0;
+    utils::ThreadPQueue<PullTask> &queue = push_queues[qid];
+    PullTask tsk(grad.value, key, devid, 0, grad.value.shape_);
+    tsk.rows = grad.index;
+    queue.Push(tsk, priority);
+    this->AddQueueDepth(&metrics.max_push_queue_depth, qid, queue.Size());
   }
   virtual void PullReq_(Tensor<xpu, 2, DType> data,
                         int key, int devid, int priority,
                         CallbackFunction callback,
                         void *callback_arg) {
+    Tensor<cpu, 1, index_t> rows(NULL, Shape1(0));
+    this->PullRequest(data, rows, key, devid, priority, callback, callback_arg);
+  }
+  virtual void PullRowSparseReq_(Tensor<cpu, 1, index_t> rows,
+                                 Tensor<xpu, 2, DType> data,
+                                 int key, int devid, int priority,
+                                 CallbackFunction callback,
+                                 void *callback_arg) {
+    CHECK(rows.dptr_ != NULL || rows.size(0) == 0) << "PullRowSparseReq: no row ids";
+    if (rows.dptr_ == NULL) {
+      // nothing to copy, still go through the queue so PullWait and callback behave the same
+      static index_t empty = 0;
+      rows.dptr_ = &empty;
+    }
+    this->PullRequest(data, rows, key, devid, priority, callback, callback_arg);
+  }
+  // record a pull request, rows.dptr_ is NULL for the whole tensor
+  inline void PullRequest(Tensor<xpu, 2, DType> data, Tensor<cpu, 1, index_t> rows,
+                          int key, int devid, int priority,
+                          CallbackFunction callback,
+                          void *callback_arg) {
     PullEntry &e = pull_map.GetRef(key);
     CHECK_EQ(e.req.size(), devices.size()) << "PullReq: must initialize the key, req";
     CHECK_EQ(e.wait.size(), devices.size()) << "PullReq: must initialize the key, wait";
     const int wid = GetWorkIndex(devid);
     PullReqRecord &r = e.req[wid];
     r.dest = data;
+    r.rows = rows;
     r.priority = priority;
     r.callback = callback;
     r.callback_arg = callback_arg;
@@ -318,11 +520,7 @@ class LocalModel : public ISharedModel<xpu, DType> {
     CHECK_EQ(!r.pending, true) << "key = " << key
       << "cannot send duplicate pull request before it finishes";
     if (e.req[wid].ready) {
-      if (perdev_pull_thread != 0) {
-        pull_queues[wid].Push(std::make_pair(key, devid));
-      } else {
-        pull_queues[0].Push(std::make_pair(key, devid));
-      }
+      this->EnqueuePull(key, wid);
     } else {
       r.pending = true;
     }
@@ -334,22 +532,126 @@ class LocalModel : public ISharedModel<xpu, DType> {
    * \param the key of the data
    */
   virtual void PullReady(Tensor<cpu, 2> data, int key) {
+    if (IsBucketKey(key)) {
+      // scatter the fused result back to the keys in the bucket
+      int member;
+      for (size_t i = 0; i < this->NumBucketKey(key); ++i) {
+        Tensor<cpu, 2> slice = this->BucketMember(data, key, i, &member);
+        this->PullReady(slice, member);
+      }
+      return;
+    }
     PullEntry &e = pull_map.GetRef(key);
     CHECK_EQ(e.req.size(), devices.size()) << "PullReady: must initialize the key, req";
     request_lock.Lock();
     e.src = data;
+    e.dsrc.dptr_ = NULL;
+    this->SchedulePull(key);
+    request_lock.Unlock();
+  }
+  /*!
+   * \brief same as PullReady, but the data lies in the first device
+   * \param data the data that can be pulled back
+   * \param the key of the data
+   */
+  inline void PullReadyDevice(Tensor<xpu, 2, DType> data, int key) {
+    PullEntry &e = pull_map.GetRef(key);
+    CHECK_EQ(e.req.size(), devices.size()) << "PullReady: must initialize the key, req";
+    request_lock.Lock();
+    e.dsrc = data;
+    this->SchedulePull(key);
+    request_lock.Unlock();
+  }
+  /*!
+   * \brief a device pushed the key, its pulls wait until the push is copied in, so that
+   *  the pull does not overwrite the pushed data, and until the result of the push came
+   *  back when that leaves the device more than staleness results ahead of the latest one
+   */
+  inline void TickClock(int key, int wid) {
+    PullEntry &e = pull_map.GetRef(key);
+    request_lock.Lock();
+    e.req[wid].clock += 1;
+    e.req[wid].ready = false;
+    if (metrics_enabled != 0) e.req[wid].push_time = MetricsTime();
+    request_lock.Unlock();
+  }
+  // the push thread finished copying in a push of the key by device wid
+  inline void PushCopied(int key, int wid) {
+    PullEntry &e = pull_map.GetRef(key);
+    request_lock.Lock();
+    e.req[wid].ncopied += 1;
+    this->UpdateReady(key, wid);
+    request_lock.Unlock();
+  }
+  // put the pending pull requests of the key into queue, must hold request_lock
+  inline void SchedulePull(int key) {
+    PullEntry &e = pull_map.GetRef(key);
+    // the result of a push round, once every device pushed in it; a result published
+    // before that, such as the initial weight, does not advance the version
+    int min_clock = e.req.size() != 0 ? e.req[0].clock : 0;
+    for (index_t i = 1; i < e.req.size(); ++i) {
+      min_clock = std::min(min_clock, e.req[i].clock);
+    }
+    if (min_clock > e.version) e.version += 1;
+    e.published = true;
     for (index_t i = 0; i < e.req.size(); ++i) {
-      e.req[i].ready = true;
-      if (e.req[i].pending) {
-        if (perdev_pull_thread != 0) {
-          pull_queues[i].Push(std::make_pair(key, devices[i]));
-        } else {
-          pull_queues[0].Push(std::make_pair(key, devices[i]));
-        }
-        e.req[i].pending = false;
+      this->UpdateReady(key, i);
+    }
+  }
+  // check whether device wid may pull the key, must hold request_lock
+  inline void UpdateReady(int key, int wid) {
+    PullEntry &e = pull_map.GetRef(key);
+    PullReqRecord &r = e.req[wid];
+    r.ready = e.published && r.ncopied == r.clock && r.clock - e.version <= staleness;
+    if (r.ready && r.push_time != 0.0) {
+      this->AddLatency(key, &KeyMetrics::push_to_ready, MetricsTime() - r.push_time);
+      r.push_time = 0.0;
+    }
+    if (r.ready && r.pending) {
+      this->EnqueuePull(key, wid);
+      r.pending = false;
+    }
+  }
+  // put the pull of key to device wid into queue in chunks, must hold request_lock
+  inline void EnqueuePull(int key, int wid) {
+    PullEntry &e = pull_map.GetRef(key);
+    PullReqRecord &r = e.req[wid];
+    utils::ThreadPQueue<PullChunk> &queue = pull_queues[perdev_pull_thread != 0 ? wid : 0];
+    r.nchunk_done = 0;
+    if (r.rows.dptr_ != NULL) {
+      // the rows are gathered in one go
+      r.nchunk = 1;
+      queue.Push(PullChunk(key, devices[wid], 0, r.rows.size(0)), r.priority);
+    } else {
+      Shape<2> shape = e.dsrc.dptr_ != NULL ? e.dsrc.shape_ : e.src.shape_;
+      const index_t step = this->ChunkRows(shape);
+      r.nchunk = (shape[0] + step - 1) / step;
+      for (index_t begin = 0; begin < shape[0]; begin += step) {
+        queue.Push(PullChunk(key, devices[wid], begin, std::min(begin + step, shape[0])),
+                   r.priority);
       }
     }
-    request_lock.Unlock();
+    this->AddQueueDepth(&metrics.max_pull_queue_depth, perdev_pull_thread != 0 ? wid : 0,
+                        queue.Size());
+  }
+  /*!
+   * \brief number of rows in each chunk a tensor is partitioned into,
+   *  keys fused in buckets are never partitioned
+   */
+  inline index_t ChunkRows(Shape<2> shape) const {
+    if (partition_size == 0 || shape.Size() <= partition_size ||
+        shape.Size() < bucket_bound) {
+      return std::max(shape[0], static_cast<index_t>(1));
+    }
+    return std::max(static_cast<index_t>(partition_size / shape[1]), static_cast<index_t>(1));
+  }
+  /*!
+   * \brief whether the reduced data must be copied back to host,
+   *  subclass that sends the data across machines returns true
+   * \param key the key of the data
+   */
+  virtual bool NeedHostResult(int key) {
+    return custom_server != NULL;
   }
   virtual void ServerInitKey(Tensor<cpu, 2> weight, int key) {
     if (custom_server != NULL) {
@@ -377,20 +679,13 @@ class LocalModel : public ISharedModel<xpu, DType> {
     }
     // customized server
     if (custom_server != NULL) {
-      this->ReduceSum(data);
-      custom_server->Update(key, data[0].dptr_, data[0].MSize());
-      if (update_on_server != 0) {
-        PushEntry &e = push_map.GetRef(key);
-        this->PullReady(e.weight, key);
-      } else {
-        CHECK_NE(test_on_server, 0) << "test mode";
-        this->PullReady(data[0], key);
-      }
+      this->ReduceSum(data, key);
+      this->HandleReduceFinish(data[0], key);
       return;
     }
     switch (op) {
       case kSum: {
-        this->ReduceSum(data);
+        this->ReduceSum(data, key);
         this->PullReady(data[0], key);
         return;
       }
@@ -401,6 +696,26 @@ class LocalModel : public ISharedModel<xpu, DType> {
       default: LOG(FATAL) << "unknown LocalOp";
     }
   }
+  /*!
+   * \brief event handler for a row sparse push finish,
+   *  called when the rows of all devices with the same key are merged
+   * \param rows the merged row ids, ascending
+   * \param value the sum of the rows pushed by the devices
+   * \param data the dense buffer of the key, used to hold the result
+   * \param key the key of the data
+   */
+  virtual void HandleRowSparseFinish(Tensor<cpu, 1, index_t> rows,
+                                     Tensor<cpu, 2, DType> value,
+                                     Tensor<cpu, 3, DType> data,
+                                     int key) {
+    // the rest of the pipeline is dense, scatter the rows into the first device buffer
+    Tensor<cpu, 2, DType> dense = data[0];
+    dense = DType(0);
+    for (index_t i = 0; i < rows.size(0); ++i) {
+      std::memcpy(dense[rows[i]].dptr_, value[i].dptr_, value.size(1) * sizeof(DType));
+    }
+    this->HandlePushFinish(data.Slice(0, 1), key);
+  }
   /*!
    * \brief event handler for reduce finish
    *  called when all the data with same key finishes the reduction
@@ -409,6 +724,14 @@ class LocalModel : public ISharedModel<xpu, DType> {
    */
   inline void HandleReduceFinish(Tensor<cpu, 2, DType> data,
                                  int key) {
+    if (IsBucketKey(key)) {
+      int member;
+      for (size_t i = 0; i < this->NumBucketKey(key); ++i) {
+        Tensor<cpu, 2, DType> slice = this->BucketMember(data, key, i, &member);
+        this->HandleReduceFinish(slice, member);
+      }
+      return;
+    }
     if (custom_server != NULL) {
       custom_server->Update(key, data.dptr_, data.MSize());
       if (update_on_server != 0) {
@@ -424,7 +747,15 @@ class LocalModel : public ISharedModel<xpu, DType> {
   }
   virtual void InitCustomerServer(void) {
     if (update_on_server != 0 || test_on_server != 0) {
-      custom_server = CreateModelUpdater<DType>();
+      // a built-in updater is chosen by the parameter updater
+      custom_server = NULL;
+      for (size_t j = 0; j < cfgvec.size(); ++j) {
+        if (cfgvec[j].first == "updater") {
+          delete custom_server;
+          custom_server = CreateBuiltinUpdater<DType>(cfgvec[j].second.c_str());
+        }
+      }
+      if (custom_server == NULL) custom_server = CreateModelUpdater<DType>();
       for (size_t j = 0; j < cfgvec.size(); ++j) {
         custom_server->SetParam(cfgvec[j].first.c_str(),
                                 cfgvec[j].second.c_str());
@@ -439,9 +770,54 @@ class LocalModel : public ISharedModel<xpu, DType> {
   // whether use fifo push queue
   int use_fifo_push_queue;
 
-  // perform sum reduction
-  inline void ReduceSum(Tensor<cpu, 3, DType> data) {
-    #if defined(_OPENMP)
+  /*!
+   * \brief whether the key refers to a bucket of fused keys,
+   *  buckets use negative keys so they never collide with user keys
+   */
+  inline bool IsBucketKey(int key) const {
+    return key < 0 && bucket_bound != 0;
+  }
+  /*! \brief number of keys fused in the bucket */
+  inline size_t NumBucketKey(int key) {
+    push_lock.Lock();
+    size_t n = buckets[-1 - key]->keys.size();
+    push_lock.Unlock();
+    return n;
+  }
+  /*!
+   * \brief get the part of the fused data that belongs to the i-th key of the bucket
+   * \param data the fused data of the bucket
+   * \param key the key of the bucket
+   * \param i index of the key in the bucket
+   * \param out_key the key of the i-th key
+   */
+  inline Tensor<cpu, 2, DType> BucketMember(Tensor<cpu, 2, DType> data,
+                                            int key, size_t i, int *out_key) {
+    push_lock.Lock();
+    const Bucket &b = *buckets[-1 - key];
+    Tensor<cpu, 2, DType> ret(data.dptr_ + b.offset[i], b.shape[i]);
+    *out_key = b.keys[i];
+    push_lock.Unlock();
+    return ret;
+  }
+  // perform sum reduction of the key
+  inline void ReduceSum(Tensor<cpu, 3, DType> data, int key) {
+    const double start = metrics_enabled != 0 ? MetricsTime() : 0.0;
+    #if MSHADOW_PS_TASK_SCHEDULER
+    // the columns are split over the shared scheduler, so the push threads
+    // do not each start a pool of OpenMP threads of their own
+    if (data[0].MSize() >= bigarray_bound &&
+        nthread_reduction != 0) {
+      utils::TaskScheduler::Get()->ParallelFor(
+          0, data.size(1), 1, [data](size_t begin, size_t end) {
+            for (size_t j = begin; j < end; ++j) {
+              for (index_t i = 1; i < data.size(0); ++i) {
+                data[0][j] += data[i][j];
+              }
+            }
+          }, static_cast<size_t>(nthread_reduction));
+    } else  //NOLINT(*)
+    #elif defined(_OPENMP)
     if (data[0].MSize() >= bigarray_bound &&
         nthread_reduction != 0) {
       ms_omp_uint ntask = static_cast<ms_omp_uint>(data.size(1));
@@ -458,6 +834,28 @@ class LocalModel : public ISharedModel<xpu, DType> {
         data[0] += data[i];
       }
     }
+    // the result of a single device, such as one reduced in the device, needs no reduction
+    if (metrics_enabled != 0 && data.size(0) > 1) {
+      this->AddLatency(key, &KeyMetrics::reduce, MetricsTime() - start);
+    }
+  }
+  /*! \brief whether the metrics are kept */
+  inline bool KeepMetrics(void) const {
+    return metrics_enabled != 0;
+  }
+  /*! \brief add to a counter of the metrics of the key, if metrics are kept */
+  inline void AddMetric(int key, uint64_t KeyMetrics::*field, uint64_t value) {
+    if (metrics_enabled == 0) return;
+    metrics_lock.Lock();
+    metrics.keys[key].*field += value;
+    metrics_lock.Unlock();
+  }
+  /*! \brief add a latency in seconds to the metrics of the key, if metrics are kept */
+  inline void AddLatency(int key, LatencyHistogram KeyMetrics::*hist, double sec) {
+    if (metrics_enabled == 0) return;
+    metrics_lock.Lock();
+    (metrics.keys[key].*hist).Add(sec);
+    metrics_lock.Unlock();
   }
 
  private:
@@ -472,9 +870,26 @@ class LocalModel : public ISharedModel<xpu, DType> {
      * uniquely identifies a mem location
      */
     int devid;
-    PullTask(void) {}
-    PullTask(Tensor<xpu, 2, DType> data, int key, int devid)
-        : data(data), key(key), devid(devid) {}
+    /*! \brief the first row of data in the whole tensor */
+    index_t begin;
+    /*! \brief shape of the whole tensor */
+    Shape<2> shape;
+    /*! \brief row ids of a row sparse push, NULL for a dense push */
+    Tensor<cpu, 1, index_t> rows;
+    PullTask(void) : rows(NULL, Shape1(0)) {}
+    PullTask(Tensor<xpu, 2, DType> data, int key, int devid,
+             index_t begin, Shape<2> shape)
+        : data(data), key(key), devid(devid), begin(begin), shape(shape),
+          rows(NULL, Shape1(0)) {}
+  };
+  /*! \brief task to pull rows [begin, end) of key to device devid */
+  struct PullChunk {
+    int key;
+    int devid;
+    index_t begin, end;
+    PullChunk(void) {}
+    PullChunk(int key, int devid, index_t begin, index_t end)
+        : key(key), devid(devid), begin(begin), end(end) {}
   };
   /*! \brief data structure to hold temporal push result */
   struct PushEntry {
@@ -482,20 +897,36 @@ class LocalModel : public ISharedModel<xpu, DType> {
     Tensor<cpu, 4, DType> data;
     // temporal space to hold weight, if needed
     Tensor<cpu, 2, DType> weight;
-    // indicator whether the certain devices is already copied in
-    std::vector<bool> copied;
-    // number of data copied in
-    int num_copied;
-    // version number of data used to hold incomming data in push
-    int copyin_version;
+    // temporal space in the first device, used by reduce_on_device
+    Tensor<xpu, 4, DType> ddata;
+    // number of rounds each device copied in, a bucket counts each (key, device),
+    // round r is copied into version r % data.size(0)
+    std::vector<int> round;
+    // number of chunks copied in each device
+    std::vector<index_t> nchunk_copied;
+    // number of data copied in each version
+    std::vector<int> num_copied;
+    // number of devices that pushed row sparse data in each version
+    std::vector<int> num_sparse;
+    // number of rounds finished
+    int num_finish;
+    // row ids and values pushed as row sparse, of version v and device i at v * ndevice + i
+    std::vector<std::vector<index_t> > srows;
+    std::vector<std::vector<DType> > svalue;
+    // the merged rows of each version
+    std::vector<std::vector<index_t> > mrows;
+    std::vector<std::vector<DType> > mvalue;
     // use pinned memory
     bool pin_memory;
     // constructor
-    PushEntry(void)
-        : copyin_version(0) {
+    PushEntry(void) : num_finish(0) {
       weight.dptr_ = NULL;
+      ddata.dptr_ = NULL;
     }
     ~PushEntry(void) {
+      if (ddata.dptr_ != NULL) {
+        mshadow::FreeSpace(&ddata);
+      }
       if (data.dptr_ != NULL) {
         if (pin_memory) {
           mshadow::FreeHost<xpu>(&data);
@@ -512,9 +943,9 @@ class LocalModel : public ISharedModel<xpu, DType> {
     }
     // constructor
     inline void Init(int ndevice, Shape<2> shape,
-                     bool pin_memory, bool need_weight) {
+                     bool pin_memory, bool need_weight, int nversion, size_t nround) {
       this->pin_memory = pin_memory;
-      data.shape_ = Shape4(2, ndevice, shape[0], shape[1]);
+      data.shape_ = Shape4(nversion, ndevice, shape[0], shape[1]);
       weight.shape_ = shape;
       if (pin_memory) {
         mshadow::AllocHost<xpu>(&data);
@@ -525,8 +956,23 @@ class LocalModel : public ISharedModel<xpu, DType> {
       }
       CHECK_EQ(data.CheckContiguous(), true) << "Data must be contiguous";
       CHECK(!need_weight || weight.CheckContiguous()) << "Weight must be contiguous";
-      num_copied = 0;
-      copied.resize(ndevice, false);
+      num_copied.resize(nversion, 0);
+      num_sparse.resize(nversion, 0);
+      srows.resize(data.size(0) * ndevice);
+      svalue.resize(data.size(0) * ndevice);
+      mrows.resize(data.size(0));
+      mvalue.resize(data.size(0));
+      round.resize(nround, 0);
+      nchunk_copied.resize(ndevice, 0);
+    }
+    // the version the next round of counter i is copied into
+    inline int CopyinVersion(size_t i) const {
+      return round[i] % static_cast<int>(data.size(0));
+    }
+    // whether counter i may start a new round, the version of the last finished
+    // round is still read by the pulls
+    inline bool CanCopyin(size_t i) const {
+      return round[i] - num_finish < static_cast<int>(data.size(0)) - 1;
     }
   };
   // a record to remember things related to pull request
@@ -538,13 +984,27 @@ class LocalModel : public ISharedModel<xpu, DType> {
     bool pending;
     // the destination to pull data into
     Tensor<xpu, 2, DType> dest;
+    // the rows to pull, NULL to pull the whole tensor
+    Tensor<cpu, 1, index_t> rows;
+    // host buffer the rows are gathered in, only accessed by pull thread
+    std::vector<DType> gather;
     // the priority of the
     int priority;
+    // number of chunks the request is partitioned into
+    index_t nchunk;
+    // number of chunks finished, only accessed by pull thread
+    index_t nchunk_done;
     // callback function
     CallbackFunction *callback;
     // argument for callback
     void *callback_arg;
-    PullReqRecord(void) : ready(false), pending(false) {
+    // number of pushes of the key by the device, and how many of them are copied in
+    int clock, ncopied;
+    // time of the last push whose pull is not ready yet, 0 if none, for metrics
+    double push_time;
+    PullReqRecord(void) : ready(false), pending(false), rows(NULL, Shape1(0)),
+                          nchunk(0), nchunk_done(0), clock(0), ncopied(0),
+                          push_time(0.0) {
     }
   };
   // a record to help handle pullwait
@@ -558,15 +1018,40 @@ class LocalModel : public ISharedModel<xpu, DType> {
       // set finished to true so pull without pull request returns
     }
   };
+  /*!
+   * \brief a bucket of small keys that are fused into one buffer,
+   *  they are copied into the buffer of the bucket in push,
+   *  and reduced and sent together when all of them arrive
+   */
+  struct Bucket {
+    // keys in the bucket
+    std::vector<int> keys;
+    // offset of each key in the fused buffer
+    std::vector<index_t> offset;
+    // shape of each key
+    std::vector<Shape<2> > shape;
+    // total number of elements
+    size_t size;
+    // whether the fused buffer is allocated, no key can join afterwards
+    bool sealed;
+    Bucket(void) : size(0), sealed(false) {}
+  };
   /*! \brief data structure to hold pull request */
   struct PullEntry {
     // data to be pulled back
     Tensor<cpu, 2, DType> src;
+    // data to be pulled back from the first device, used instead of src if set
+    Tensor<xpu, 2, DType> dsrc;
     // pullrequest record
     std::vector<PullReqRecord> req;
     // whether there is thread waiting on this event
     std::vector<PullWaitRecord> wait;
-    PullEntry(void) {
+    // number of push rounds whose result was published
+    int version;
+    // whether any result was published
+    bool published;
+    PullEntry(void) : version(0), published(false) {
+      dsrc.dptr_ = NULL;
     }
   };
   // signal to notify all the thread about class destruction
@@ -578,6 +1063,8 @@ class LocalModel : public ISharedModel<xpu, DType> {
   //----- data structure used to support push ----
   // stream used by push thread each device for memcpy
   std::vector<Stream<xpu>*> push_stream;
+  // stream in the first device used by each push thread to do reduce_on_device
+  std::vector<Stream<xpu>*> reduce_stream;
   // the queue used for push task
   std::vector<utils::ThreadPQueue<PullTask> > push_queues;
   // thread to handle push task
@@ -588,9 +1075,13 @@ class LocalModel : public ISharedModel<xpu, DType> {
   utils::ThreadSafeMap<PushEntry> push_map;
   // customized local reduction operation
   std::map<int, LocalOp> push_operation;
+  // buckets of fused keys, bucket i uses key -1 - i in push_map
+  std::vector<Bucket*> buckets;
+  // map key to (bucket index, index in bucket)
+  std::map<int, std::pair<int, int> > key2bucket;
   //----- data structure used to support pull ----
   // the queue used for pull task
-  std::vector<utils::ThreadPQueue<std::pair<int, int> > > pull_queues;
+  std::vector<utils::ThreadPQueue<PullChunk> > pull_queues;
   // stream used by pull thread each device for memcpy
   std::vector<Stream<xpu>*> pull_stream;
   // the map to store pull status
@@ -613,75 +1104,341 @@ class LocalModel : public ISharedModel<xpu, DType> {
   int use_pin_memory;
   // number of reduction thread
   int nthread_reduction;
+  /*!
+   * \brief stale synchronous parallel, a pull may return the result of a push up to
+   *  this many pushes of the device ago, 0 waits for the result of the last push
+   */
+  int staleness;
   // the threshold for big array
   size_t bigarray_bound;
+  // keys with less elements are fused into buckets, 0 means no fusion
+  size_t bucket_bound;
+  // maximum number of elements in a bucket
+  size_t bucket_size;
+  // whether reduce the data of all devices in the first device
+  int reduce_on_device;
+  // keys with more elements are pushed and pulled in chunks of this size, 0 means no partition
+  size_t partition_size;
   // whether use pull thread per device
   int perdev_pull_thread;
   // whether use push thread per device
   int perdev_push_thread;
   /*! \brief history of configurations */
   std::vector< std::pair<std::string, std::string> > cfgvec;
+  // whether the metrics are kept
+  int metrics_enabled;
+  // interval in seconds of logging the metrics, 0 means no logging
+  double metrics_log_interval;
+  // time the metrics were last logged
+  double metrics_last_log;
+  // the metrics, max_*_queue_depth is sized in Init
+  PSMetrics metrics;
+  // lock to lock metrics and metrics_last_log
+  utils::Mutex metrics_lock;
+  // record the depth of queue i, if metrics are kept
+  inline void AddQueueDepth(std::vector<int> *max_depth, size_t i, int depth) {
+    if (metrics_enabled == 0) return;
+    metrics_lock.Lock();
+    (*max_depth)[i] = std::max((*max_depth)[i], depth);
+    metrics_lock.Unlock();
+  }
+  // log the metrics to stderr when the interval passed since the last time
+  inline void LogMetrics(void) {
+    if (metrics_log_interval <= 0.0) return;
+    const double now = MetricsTime();
+    metrics_lock.Lock();
+    const bool log = now - metrics_last_log >= metrics_log_interval;
+    if (log) metrics_last_log = now;
+    metrics_lock.Unlock();
+    if (!log) return;
+    PSMetrics m;
+    this->GetMetrics(&m);
+    fprintf(stderr, "%s", m.ToString().c_str());
+  }
   // push handler
   inline void PushProc(utils::ThreadPQueue<PullTask> *queue) {
     while (!destroy_signal) {
       PullTask tsk;
       if (queue->Pop(&tsk)) {
         const int wid = GetWorkIndex(tsk.devid);
+        push_lock.Lock();
+        std::map<int, std::pair<int, int> >::const_iterator
+            it = key2bucket.find(tsk.key);
+        const bool fused = it != key2bucket.end();
+        std::pair<int, int> pos = fused ? it->second : std::make_pair(-1, -1);
+        push_lock.Unlock();
+        if (fused) {
+          CHECK(tsk.rows.dptr_ == NULL)
+              << "PushRowSparse: key " << tsk.key << " is fused into a bucket";
+          this->PushBucket(pos.first, pos.second, tsk, wid);
+          continue;
+        }
         PushEntry &e = push_map.GetRef(tsk.key);
-        CHECK_EQ(e.data[0][0].shape_, tsk.data.shape_)
+        if (tsk.rows.dptr_ != NULL) {
+          this->PushRowSparseProc(&e, tsk, wid);
+          continue;
+        }
+        CHECK_EQ(e.data[0][0].shape_, tsk.shape)
           << "Tensor with same key must share same shape "
           << e.data[0][0].shape_
           << " vs "
-          << tsk.data.shape_;
-        CHECK_EQ(!e.copied[wid], true) << "data inconsistency";
-        // start copy
-        SetDevice<xpu>(tsk.devid);
-        Copy(e.data[e.copyin_version][wid], tsk.data, push_stream[wid]);
+          << tsk.shape;
+        push_lock.Lock();
+        CHECK(e.CanCopyin(wid)) << "data inconsistency, a device pushed more than "
+                                << "staleness rounds ahead of the others";
+        const int cp_version = e.CopyinVersion(wid);
+        push_lock.Unlock();
+        // start copy, the task may be a chunk of rows of the tensor
+        const index_t begin = tsk.begin, end = tsk.begin + tsk.data.size(0);
+        const bool on_device = this->UseDeviceReduce(tsk.key);
+        if (on_device) {
+          this->AllocDeviceBuffer(&e);
+          SetDevice<xpu>(tsk.devid);
+          DeviceReduce<xpu>::PeerCopy(e.ddata[cp_version][wid].Slice(begin, end),
+                                      devices[0], tsk.data, tsk.devid, push_stream[wid]);
+        } else {
+          SetDevice<xpu>(tsk.devid);
+          Copy(e.data[cp_version][wid].Slice(begin, end), tsk.data, push_stream[wid]);
+        }
         // wait till the copy finishes
         push_stream[wid]->Wait();
-        // mark copied
-        e.copied[wid] = true;
+        this->AddMetric(tsk.key, &KeyMetrics::bytes_push, tsk.data.MSize() * sizeof(DType));
         push_lock.Lock();
-        e.num_copied += 1;
-        int cp_version = e.copyin_version;
-        bool push_finish = e.num_copied >= static_cast<int>(devices.size());
+        // the device is copied when all its chunks arrive
+        const index_t step = this->ChunkRows(tsk.shape);
+        if (++e.nchunk_copied[wid] < (tsk.shape[0] + step - 1) / step) {
+          push_lock.Unlock();
+          continue;
+        }
+        // mark copied
+        CHECK_EQ(e.num_sparse[cp_version], 0)
+            << "every device must push a key the same way in a round";
+        e.nchunk_copied[wid] = 0;
+        e.round[wid] += 1;
+        this->AddMetric(tsk.key, &KeyMetrics::num_push, 1);
+        bool push_finish = ++e.num_copied[cp_version] >= static_cast<int>(devices.size());
         if (push_finish) {
-          // switch version
-          e.copyin_version = (e.copyin_version + 1) % e.data.size(0);
-          std::fill(e.copied.begin(), e.copied.end(), false);
-          e.num_copied = 0;
+          e.num_copied[cp_version] = 0;
+          e.num_finish += 1;
         }
         push_lock.Unlock();
+        this->PushCopied(tsk.key, wid);
         if (push_finish) {
-          this->HandlePushFinish(e.data[cp_version], tsk.key);
+          if (on_device) {
+            this->HandleDeviceReduce(&e, cp_version, tsk.key, wid);
+          } else {
+            this->HandlePushFinish(e.data[cp_version], tsk.key);
+          }
         }
       } else {
         CHECK_EQ(destroy_signal, true) << "abort but not destroy";
       }
     }
   }
+  // copy the rows pushed by a device, merge them when all devices arrived
+  inline void PushRowSparseProc(PushEntry *pe, const PullTask &tsk, int wid) {
+    PushEntry &e = *pe;
+    const index_t nrow = tsk.rows.size(0), ncol = e.data.size(3);
+    CHECK_EQ(tsk.data.size(1), ncol) << "PushRowSparse: row size mismatch for key " << tsk.key;
+    push_lock.Lock();
+    CHECK(e.CanCopyin(wid)) << "data inconsistency, a device pushed more than "
+                            << "staleness rounds ahead of the others";
+    const int version = e.CopyinVersion(wid);
+    push_lock.Unlock();
+    const size_t slot = version * devices.size() + wid;
+    std::vector<index_t> &rows = e.srows[slot];
+    rows.assign(tsk.rows.dptr_, tsk.rows.dptr_ + nrow);
+    for (index_t i = 0; i < nrow; ++i) {
+      CHECK(rows[i] < e.data.size(2) && (i == 0 || rows[i - 1] < rows[i]))
+          << "PushRowSparse: row ids must be ascending and within the key";
+    }
+    e.svalue[slot].resize(static_cast<size_t>(nrow) * ncol);
+    if (nrow != 0) {
+      SetDevice<xpu>(tsk.devid);
+      Copy(Tensor<cpu, 2, DType>(&e.svalue[slot][0], Shape2(nrow, ncol)), tsk.data,
+           push_stream[wid]);
+      push_stream[wid]->Wait();
+    }
+    this->AddMetric(tsk.key, &KeyMetrics::num_push, 1);
+    this->AddMetric(tsk.key, &KeyMetrics::bytes_push,
+                    nrow * (sizeof(index_t) + ncol * sizeof(DType)));
+    push_lock.Lock();
+    CHECK_EQ(e.num_sparse[version], e.num_copied[version])
+        << "every device must push a key the same way in a round";
+    e.round[wid] += 1;
+    e.num_sparse[version] += 1;
+    bool push_finish = ++e.num_copied[version] >= static_cast<int>(devices.size());
+    if (push_finish) {
+      e.num_copied[version] = 0;
+      e.num_sparse[version] = 0;
+      e.num_finish += 1;
+    }
+    push_lock.Unlock();
+    this->PushCopied(tsk.key, wid);
+    if (push_finish) {
+      const double start = metrics_enabled != 0 ? MetricsTime() : 0.0;
+      this->MergeRowSparse(&e, version);
+      this->AddLatency(tsk.key, &KeyMetrics::reduce, MetricsTime() - start);
+      std::vector<index_t> &mrows = e.mrows[version];
+      std::vector<DType> &mvalue = e.mvalue[version];
+      const index_t nmerged = static_cast<index_t>(mrows.size());
+      this->HandleRowSparseFinish(
+          Tensor<cpu, 1, index_t>(nmerged != 0 ? &mrows[0] : NULL, Shape1(nmerged)),
+          Tensor<cpu, 2, DType>(nmerged != 0 ? &mvalue[0] : NULL, Shape2(nmerged, ncol)),
+          e.data[version], tsk.key);
+    }
+  }
+  // sorted merge of the rows of all devices of a version, the values of equal rows are summed
+  inline void MergeRowSparse(PushEntry *pe, int version) {
+    PushEntry &e = *pe;
+    const size_t ndev = devices.size(), ncol = e.data.size(3);
+    std::vector<index_t> &rows = e.mrows[version];
+    std::vector<DType> &value = e.mvalue[version];
+    rows.clear();
+    value.clear();
+    std::vector<size_t> pos(ndev, 0);
+    while (true) {
+      bool found = false;
+      index_t row = 0;
+      for (size_t i = 0; i < ndev; ++i) {
+        const std::vector<index_t> &r = e.srows[version * ndev + i];
+        if (pos[i] < r.size() && (!found || r[pos[i]] < row)) {
+          row = r[pos[i]];
+          found = true;
+        }
+      }
+      if (!found) break;
+      rows.push_back(row);
+      value.resize(value.size() + ncol, DType(0));
+      DType *out = &value[value.size() - ncol];
+      // devices are added in order, so the sum does not depend on the arrival order
+      for (size_t i = 0; i < ndev; ++i) {
+        const std::vector<index_t> &r = e.srows[version * ndev + i];
+        if (pos[i] < r.size() && r[pos[i]] == row) {
+          const DType *in = &e.svalue[version * ndev + i][pos[i] * ncol];
+          for (size_t j = 0; j < ncol; ++j) out[j] += in[j];
+          ++pos[i];
+        }
+      }
+    }
+  }
+  // whether the key is reduced in the first device
+  inline bool UseDeviceReduce(int key) {
+    if (reduce_on_device == 0 || devices.size() == 1) return false;
+    // gather needs the data of every device
+    return push_operation.count(key) == 0 || push_operation[key] != kGather;
+  }
+  // allocate the buffer in the first device when the key is pushed for the first time
+  inline void AllocDeviceBuffer(PushEntry *e) {
+    push_lock.Lock();
+    if (e->ddata.dptr_ == NULL) {
+      SetDevice<xpu>(devices[0]);
+      e->ddata.shape_ = e->data.shape_;
+      mshadow::AllocSpace(&e->ddata, false);
+    }
+    push_lock.Unlock();
+  }
+  // all devices are copied into ddata[version], reduce them in the first device
+  inline void HandleDeviceReduce(PushEntry *e, int version, int key, int wid) {
+    SetDevice<xpu>(devices[0]);
+    Stream<xpu> *s = reduce_stream[wid];
+    Tensor<xpu, 3, DType> d = e->ddata[version];
+    const double start = metrics_enabled != 0 ? MetricsTime() : 0.0;
+    DeviceReduce<xpu>::Sum(d, s);
+    if (this->NeedHostResult(key)) {
+      // only the reduced result goes through the host
+      Copy(e->data[version][0], d[0], s);
+      s->Wait();
+      this->AddLatency(key, &KeyMetrics::reduce, MetricsTime() - start);
+      this->HandlePushFinish(e->data[version].Slice(0, 1), key);
+    } else {
+      s->Wait();
+      this->AddLatency(key, &KeyMetrics::reduce, MetricsTime() - start);
+      this->PullReadyDevice(d[0], key);
+    }
+  }
+  // copy the data of a key into the buffer of its bucket
+  inline void PushBucket(int bid, int idx, const PullTask &tsk, int wid) {
+    const int bkey = -1 - bid;
+    push_lock.Lock();
+    Bucket &b = *buckets[bid];
+    if (!b.sealed) {
+      // the first push allocates the fused buffer, later keys go to a new bucket
+      b.sealed = true;
+      push_map.Init(bkey);
+      push_map.GetRef(bkey).Init(devices.size(), Shape2(1, b.size),
+                                 use_pin_memory != 0, false, staleness + 2,
+                                 b.keys.size() * devices.size());
+    }
+    PushEntry &e = push_map.GetRef(bkey);
+    const size_t cid = idx * devices.size() + wid;
+    CHECK(e.CanCopyin(cid))
+      << "data inconsistency, every key in a bucket must be pushed once per round";
+    const int cp_version = e.CopyinVersion(cid);
+    push_lock.Unlock();
+    CHECK_EQ(b.shape[idx], tsk.data.shape_)
+      << "Tensor with same key must share same shape "
+      << b.shape[idx]
+      << " vs "
+      << tsk.data.shape_;
+    Tensor<cpu, 2, DType> dst(e.data[cp_version][wid].dptr_ + b.offset[idx],
+                              b.shape[idx]);
+    SetDevice<xpu>(tsk.devid);
+    Copy(dst, tsk.data, push_stream[wid]);
+    push_stream[wid]->Wait();
+    this->AddMetric(tsk.key, &KeyMetrics::num_push, 1);
+    this->AddMetric(tsk.key, &KeyMetrics::bytes_push, tsk.data.MSize() * sizeof(DType));
+    push_lock.Lock();
+    e.round[cid] += 1;
+    bool push_finish = ++e.num_copied[cp_version] >= static_cast<int>(e.round.size());
+    if (push_finish) {
+      e.num_copied[cp_version] = 0;
+      e.num_finish += 1;
+    }
+    push_lock.Unlock();
+    this->PushCopied(tsk.key, wid);
+    if (push_finish) {
+      this->HandlePushFinish(e.data[cp_version], bkey);
+    }
+  }
   inline void PushHandlerGlobal(void) {
     // allocate stream resources
     for (size_t i = 0; i < devices.size(); ++i) {
       SetDevice<xpu>(devices[i]);
       push_stream[i] = NewStream<xpu>();
+      if (reduce_on_device != 0) {
+        SetDevice<xpu>(devices[0]);
+        reduce_stream[i] = NewStream<xpu>();
+      }
     }
     this->PushProc(&push_queues[0]);
     // free resources
     for (size_t i = 0; i < devices.size(); ++i) {
       SetDevice<xpu>(devices[i]);
       DeleteStream(push_stream[i]);
+      if (reduce_stream[i] != NULL) {
+        SetDevice<xpu>(devices[0]);
+        DeleteStream(reduce_stream[i]);
+      }
     }
   }
   inline void PushHandlerLocal(size_t tid) {
     CHECK_LT(tid, devices.size()) << "threadid exceed boundary";
     CHECK_EQ(push_queues.size(), devices.size()) << "must have one pull_queue per device";
     // allocate stream resources
+    if (reduce_on_device != 0) {
+      SetDevice<xpu>(devices[0]);
+      reduce_stream[tid] = NewStream<xpu>();
+    }
     SetDevice<xpu>(devices[tid]);
     push_stream[tid] = NewStream<xpu>();
     this->PushProc(&push_queues[tid]);
     SetDevice<xpu>(devices[tid]);
     DeleteStream(push_stream[tid]);
+    if (reduce_stream[tid] != NULL) {
+      SetDevice<xpu>(devices[0]);
+      DeleteStream(reduce_stream[tid]);
+    }
   }
   /*!\brief entry point of loader thread */
   inline static MSHADOW_THREAD_PREFIX PushGlobalThread(void *pthread) {
@@ -697,12 +1454,12 @@ class LocalModel : public ISharedModel<xpu, DType> {
     return NULL;
   }
   // push handler procedure
-  inline void PullProc(utils::ThreadPQueue<std::pair<int, int> > *queue) {
+  inline void PullProc(utils::ThreadPQueue<PullChunk> *queue) {
     while (!destroy_signal) {
-      std::pair<int, int> tsk;
+      PullChunk tsk;
       if (queue->Pop(&tsk)) {
-        const int key = tsk.first;
-        const int devid = tsk.second;
+        const int key = tsk.key;
+        const int devid = tsk.devid;
         const int wid = GetWorkIndex(devid);
         PullEntry &e = pull_map.GetRef(key);
         {
@@ -710,13 +1467,30 @@ class LocalModel : public ISharedModel<xpu, DType> {
           CHECK_EQ(e.req.size(), devices.size()) << "PullHandler: must initialize the key, req";
           PullReqRecord &r = e.req[wid];
           SetDevice<xpu>(devid);
-          Copy(r.dest, e.src, pull_stream[wid]);
+          if (r.rows.dptr_ != NULL) {
+            this->PullRows(e, &r, wid);
+          } else if (e.dsrc.dptr_ != NULL) {
+            DeviceReduce<xpu>::PeerCopy(r.dest.Slice(tsk.begin, tsk.end), devid,
+                                        e.dsrc.Slice(tsk.begin, tsk.end), devices[0],
+                                        pull_stream[wid]);
+          } else {
+            Copy(r.dest.Slice(tsk.begin, tsk.end), e.src.Slice(tsk.begin, tsk.end),
+                 pull_stream[wid]);
+          }
+          if (++r.nchunk_done < r.nchunk) {
+            // finish the chunk before the next task, which may have higher priority
+            pull_stream[wid]->Wait();
+            continue;
+          }
           // callback, if any
           if (r.callback != NULL) {
             (*r.callback)(pull_stream[wid], r.callback_arg);
           }
           // wait till the operation finishes
           pull_stream[wid]->Wait();
+          this->AddMetric(key, &KeyMetrics::num_pull, 1);
+          this->AddMetric(key, &KeyMetrics::bytes_pull, sizeof(DType) * (r.rows.dptr_ != NULL ?
+              r.rows.size(0) * r.dest.size(1) : r.dest.MSize()));
         }
         {
           // wake up waiters if any
@@ -734,6 +1508,31 @@ class LocalModel : public ISharedModel<xpu, DType> {
       }
     }
   }
+  // copy the rows of a row pull request from the result of the key
+  inline void PullRows(const PullEntry &e, PullReqRecord *pr, int wid) {
+    PullReqRecord &r = *pr;
+    const index_t n = r.rows.size(0);
+    if (n == 0) return;
+    if (e.dsrc.dptr_ != NULL) {
+      for (index_t i = 0; i < n; ++i) {
+        const index_t row = r.rows[i];
+        CHECK_LT(row, e.dsrc.size(0)) << "PullRowSparseReq: row out of range";
+        DeviceReduce<xpu>::PeerCopy(r.dest.Slice(i, i + 1), devices[wid],
+                                    e.dsrc.Slice(row, row + 1), devices[0], pull_stream[wid]);
+      }
+      return;
+    }
+    const index_t ncol = e.src.size(1);
+    CHECK_EQ(r.dest.size(1), ncol) << "PullRowSparseReq: row size mismatch";
+    r.gather.resize(static_cast<size_t>(n) * ncol);
+    Tensor<cpu, 2, DType> g(&r.gather[0], Shape2(n, ncol));
+    for (index_t i = 0; i < n; ++i) {
+      const index_t row = r.rows[i];
+      CHECK_LT(row, e.src.size(0)) << "PullRowSparseReq: row out of range";
+      std::memcpy(g[i].dptr_, e.src[row].dptr_, ncol * sizeof(DType));
+    }
+    Copy(r.dest, g, pull_stream[wid]);
+  }
   // use one thread for all pull actions
   inline void PullHandlerGlobal(void) {
     // allocate stream resources
@@ -795,15 +1594,37 @@ class LocalModel : public ISharedModel<xpu, DType> {
     }
     wait_lock.Unlock();
   }
+  // put a small key into the open bucket, must hold push_lock
+  inline void AssignBucket(int key, Shape<2> shape) {
+    if (bucket_bound == 0 || shape.Size() >= bucket_bound) return;
+    // gather does not reduce, keep it as it is
+    if (push_operation.count(key) != 0 && push_operation[key] == kGather) return;
+    CHECK_GE(key, 0) << "bucket_bound requires non-negative keys";
+    if (buckets.size() == 0 || buckets.back()->sealed ||
+        buckets.back()->size + shape.Size() > bucket_size) {
+      buckets.push_back(new Bucket());
+    }
+    Bucket &b = *buckets.back();
+    key2bucket[key] = std::make_pair(static_cast<int>(buckets.size()) - 1,
+                                     static_cast<int>(b.keys.size()));
+    b.keys.push_back(key);
+    b.offset.push_back(static_cast<index_t>(b.size));
+    b.shape.push_back(shape);
+    b.size += shape.Size();
+  }
   // functions to handle pull
   inline void InitPushMap(int key, Shape<2> shape) {
     push_map.Init(key);
     PushEntry &e = push_map.GetRef(key);
     push_lock.Lock();
-    if (e.copied.size() == 0) {
+    if (e.round.size() == 0) {
+      // a stale result is read while later pushes are copied in, it needs a buffer
+      // of its own until the devices that may pull it pushed again
       e.Init(devices.size(), shape,
              use_pin_memory != 0,
-             update_on_server != 0 || test_on_server != 0);
+             update_on_server != 0 || test_on_server != 0,
+             staleness + 2, devices.size());
+      this->AssignBucket(key, shape);
     }
     this->ServerInitKey(e.weight, key);
     push_lock.Unlock();
@@ -0,0 +1,186 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file ps_metrics.h
+ * \brief runtime metrics of the shared models, such as the latency from a push to the pull
+ *  being ready, the bytes moved, the time of the reductions and the time blocked in PullWait
+ *
+ *  The metrics are kept when the model is given SetParam("metrics", "1"), and logged to
+ *  stderr every t seconds with SetParam("metrics_log_interval", "t"). They are read with
+ *  ISharedModel::GetMetrics. Fused buckets are reduced as one, their reduction is reported
+ *  under the key of the bucket, which is negative.
+ */
+#ifndef MSHADOW_PS_METRICS_H_  // NOLINT(*)
+#define MSHADOW_PS_METRICS_H_  // NOLINT(*)
+#include <stdint.h>
+#include <cstdio>
+#include <map>
+#include <string>
+#include <vector>
+#if __cplusplus >= 201103L
+#include <chrono>
+#elif defined(_WIN32)
+#include <windows.h>
+#else
+#include <sys/time.h>
+#endif
+
+namespace mshadow {
+namespace ps {
+/*! \brief wall clock time in seconds, for intervals */
+inline double MetricsTime(void) {
+#if __cplusplus >= 201103L
+  return std::chrono::duration<double>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+#elif defined(_WIN32)
+  return GetTickCount64() * 1e-3;
+#else
+  timeval tv;
+  gettimeofday(&tv, NULL);
+  return tv.tv_sec + tv.tv_usec * 1e-6;
+#endif
+}
+/*!
+ * \brief histogram of latencies, bucket 0 counts the ones below 1us,
+ *  bucket i counts [2^(i-1), 2^i) us
+ */
+struct LatencyHistogram {
+  /*! \brief number of buckets, the last one also counts everything longer */
+  static const int kNumBucket = 36;
+  /*! \brief number of latencies */
+  uint64_t count;
+  /*! \brief sum and maximum of the latencies in seconds */
+  double sum, max;
+  /*! \brief number of latencies in each bucket */
+  uint64_t bucket[kNumBucket];
+  LatencyHistogram(void) {
+    this->Clear();
+  }
+  inline void Clear(void) {
+    count = 0; sum = 0.0; max = 0.0;
+    for (int i = 0; i < kNumBucket; ++i) bucket[i] = 0;
+  }
+  /*! \brief add a latency in seconds */
+  inline void Add(double sec) {
+    count += 1; sum += sec;
+    if (sec > max) max = sec;
+    int i = 0;
+    for (double us = sec * 1e6; us >= 1.0 && i < kNumBucket - 1; us *= 0.5) ++i;
+    bucket[i] += 1;
+  }
+  inline void Merge(const LatencyHistogram &other) {
+    count += other.count; sum += other.sum;
+    if (other.max > max) max = other.max;
+    for (int i = 0; i < kNumBucket; ++i) bucket[i] += other.bucket[i];
+  }
+  /*! \brief mean latency in seconds */
+  inline double Mean(void) const {
+    return count != 0 ? sum / count : 0.0;
+  }
+  /*!
+   * \brief upper bound of the p-th quantile in seconds, the upper end of its bucket
+   * \param p quantile in [0, 1]
+   */
+  inline double Quantile(double p) const {
+    if (count == 0) return 0.0;
+    const double target = p * count;
+    uint64_t acc = 0;
+    for (int i = 0; i < kNumBucket; ++i) {
+      acc += bucket[i];
+      if (acc >= target && acc != 0) {
+        const double upper = static_cast<double>(1ULL << i) * 1e-6;
+        return upper < max ? upper : max;
+      }
+    }
+    return max;
+  }
+};
+/*! \brief the metrics of a key, or of all keys */
+struct KeyMetrics {
+  /*! \brief number of pushes and pulls, counted per device */
+  uint64_t num_push, num_pull;
+  /*! \brief bytes copied from the devices in pushes, and to the devices in pulls */
+  uint64_t bytes_push, bytes_pull;
+  /*! \brief bytes sent to other machines and received from them */
+  uint64_t bytes_sent, bytes_recv;
+  /*! \brief from the push of a device to its pull of the key being ready */
+  LatencyHistogram push_to_ready;
+  /*! \brief time of the reductions, over the devices and, if distributed, the machines */
+  LatencyHistogram reduce;
+  /*! \brief time in PullWait, including the calls that did not block */
+  LatencyHistogram pull_wait;
+  KeyMetrics(void)
+      : num_push(0), num_pull(0), bytes_push(0), bytes_pull(0),
+        bytes_sent(0), bytes_recv(0) {}
+  inline void Merge(const KeyMetrics &other) {
+    num_push += other.num_push; num_pull += other.num_pull;
+    bytes_push += other.bytes_push; bytes_pull += other.bytes_pull;
+    bytes_sent += other.bytes_sent; bytes_recv += other.bytes_recv;
+    push_to_ready.Merge(other.push_to_ready);
+    reduce.Merge(other.reduce);
+    pull_wait.Merge(other.pull_wait);
+  }
+};
+/*! \brief the metrics of a shared model */
+struct PSMetrics {
+  /*! \brief metrics of each key */
+  std::map<int, KeyMetrics> keys;
+  /*! \brief sum over the keys */
+  KeyMetrics total;
+  /*! \brief number of tasks in each push and pull queue when the metrics were read */
+  std::vector<int> push_queue_depth, pull_queue_depth;
+  /*! \brief most tasks seen in each push and pull queue */
+  std::vector<int> max_push_queue_depth, max_pull_queue_depth;
+  /*!
+   * \brief a readable summary
+   * \param per_key whether to include each key, otherwise only the total
+   */
+  inline std::string ToString(bool per_key = false) const {
+    std::string ret = "PSMetrics: " + Format("total", total);
+    ret += "  queues: push " + Depth(push_queue_depth, max_push_queue_depth)
+        + " pull " + Depth(pull_queue_depth, max_pull_queue_depth) + "\n";
+    if (per_key) {
+      char name[32];
+      for (std::map<int, KeyMetrics>::const_iterator it = keys.begin();
+           it != keys.end(); ++it) {
+        snprintf(name, sizeof(name), "key %d", it->first);
+        ret += Format(name, it->second);
+      }
+    }
+    return ret;
+  }
+
+ private:
+  inline static std::string Format(const char *name, const KeyMetrics &m) {
+    char buf[512];
+    snprintf(buf, sizeof(buf),
+             "%s: push %llu (%.3f MB) pull %llu (%.3f MB) sent %.3f MB recv %.3f MB\n"
+             "  push_to_ready %s\n  reduce %s\n  pull_wait %s\n", name,
+             static_cast<unsigned long long>(m.num_push), m.bytes_push * 1e-6,  // NOLINT(*)
+             static_cast<unsigned long long>(m.num_pull), m.bytes_pull * 1e-6,  // NOLINT(*)
+             m.bytes_sent * 1e-6, m.bytes_recv * 1e-6,
+             Format(m.push_to_ready).c_str(), Format(m.reduce).c_str(),
+             Format(m.pull_wait).c_str());
+    return buf;
+  }
+  inline static std::string Format(const LatencyHistogram &h) {
+    char buf[160];
+    snprintf(buf, sizeof(buf), "n=%llu mean=%.3fms p50<=%.3fms p99<=%.3fms max=%.3fms",
+             static_cast<unsigned long long>(h.count), h.Mean() * 1e3,  // NOLINT(*)
+             h.Quantile(0.5) * 1e3, h.Quantile(0.99) * 1e3, h.max * 1e3);
+    return buf;
+  }
+  inline static std::string Depth(const std::vector<int> &depth,
+                                  const std::vector<int> &max_depth) {
+    std::string ret;
+    char buf[32];
+    for (size_t i = 0; i < depth.size(); ++i) {
+      snprintf(buf, sizeof(buf), "%s%d/%d", i == 0 ? "" : ",", depth[i],
+               i < max_depth.size() ? max_depth[i] : 0);
+      ret += buf;
+    }
+    return "[" + ret + "]";
+  }
+};
+}  // namespace ps
+}  // namespace mshadow
+#endif  // MSHADOW_PS_METRICS_H_  NOLINT(*)
@@ -7,6 +7,9 @@
  */
 #ifndef MSHADOW_PS_RABIT_INL_H_ // NOLINT(*)
 #define MSHADOW_PS_RABIT_INL_H_ // NOLINT(*)
+#include <climits>
+#include <cstring>
+#include <deque>
 #include <vector>
 #include "./mshadow_ps.h"
 #include "./ps_local-inl.h"
@@ -15,34 +18,55 @@
 #include <rabit.h>
 namespace mshadow {
 namespace ps {
+/*!
+ * \brief argument for rabit::Init that selects the allreduce algorithm of rabit,
+ *  which can not be changed after rabit is initialized
+ * \param algo "ring", the bandwidth optimal ring for every size,
+ *  "tree" the latency optimal tree for every size, or "auto", rabit's default
+ *  of ring for large messages only
+ * \return the argument, NULL for auto
+ */
+inline const char *RabitAllreduceAlgoArg(const char *algo) {
+  if (!strcmp(algo, "ring")) return "rabit_reduce_ring_mincount=1";
+  if (!strcmp(algo, "tree")) return "rabit_reduce_ring_mincount=4294967295";
+  CHECK_EQ(strcmp(algo, "auto"), 0) << "unknown allreduce algorithm " << algo
+                                    << ", can only be ring, tree or auto";
+  return NULL;
+}
 // multi-threaded implementation of
 template<typename xpu, typename DType>
 class RabitModel : public LocalModel<xpu, DType> {
  public:
   // parent type
   typedef LocalModel<xpu, DType> Parent;
+  /*! \brief most keys whose consensus is checked with one allreduce */
+  static const int kMaxBatch = 64;
   // constructor
   RabitModel() {
     // enforce usage of fifo queue
     this->use_fifo_push_queue = 1;
     destroy_reduce_thread_ = false;
     disable_allreduce_ = 0;
+    allreduce_segment_ = 1 << 20;
     this->init_reducer_ = 0;
   }
   virtual ~RabitModel(void) {
     Parent::Destroy();
     if (init_reducer_ != 0) {
+      reduce_lock_.Lock();
       destroy_reduce_thread_ = true;
-      reduce_queue_.Abort(1);
+      reduce_cond_.Signal();
+      reduce_lock_.Unlock();
       thread_reduce_handler_.Join();
-      reduce_queue_.Destroy();
+      reduce_cond_.Destroy();
+      reduce_lock_.Destroy();
     }
   }
   // initialize the parameter server
   virtual void Init(const std::vector<int> &devices) {
     this->use_fifo_push_queue = 1;
-    // use fifo
-    reduce_queue_.Init(true);
+    reduce_lock_.Init();
+    reduce_cond_.Init();
     thread_reduce_handler_.Start(ReduceGlobalThread, this);
     init_reducer_ = 1;
     // initialize other things
@@ -53,24 +77,36 @@ class RabitModel : public LocalModel<xpu, DType> {
     if (!strcmp(name, "msg:disable_allreduce")) {
       disable_allreduce_ = atoi(val);
     }
+    if (!strcmp(name, "allreduce_segment")) {
+      allreduce_segment_ = static_cast<size_t>(atol(val));
+      CHECK_NE(allreduce_segment_, 0U) << "allreduce_segment must be positive";
+    }
     Parent::SetParam(name, val);
   }
+  // the reduced data is always sent to other machines
+  virtual bool NeedHostResult(int key) {
+    return true;
+  }
   // override this function, to use parameter server
   virtual void HandlePushFinish(Tensor<cpu, 3, DType> data,
                                 int key) {
-    // summation the data fron all devices
-    LocalModel<xpu, DType>::ReduceSum(data);
-    CHECK_EQ(data[0].CheckContiguous(), true) << "data must be contiguous";
+    // the sum over the devices is done segment by segment on the reduce thread,
+    // next to the allreduce of the previous segment
+    CHECK_EQ(data.CheckContiguous(), true) << "data must be contiguous";
     ReduceTask tsk;
-    tsk.data = data[0]; tsk.key = key;
-    reduce_queue_.Push(tsk, 0);
+    tsk.data = data; tsk.key = key;
+    reduce_lock_.Lock();
+    reduce_queue_.push_back(tsk);
+    reduce_cond_.Signal();
+    reduce_lock_.Unlock();
   }
 
  private:
   // reduce task
   struct ReduceTask {
     int key;
-    mshadow::Tensor<cpu, 2> data;
+    // the data pushed by all the devices, the result goes to data[0]
+    Tensor<cpu, 3, DType> data;
   };
   // destroy reduce
   bool destroy_reduce_thread_;
@@ -78,28 +114,129 @@ class RabitModel : public LocalModel<xpu, DType> {
   int init_reducer_;
   // check disable_allreduce functionalities
   int disable_allreduce_;
+  // number of elements of each allreduce call
+  size_t allreduce_segment_;
   // reduce handler thread
   utils::Thread thread_reduce_handler_;
-  // queue for allreduce task
-  utils::ThreadPQueue<ReduceTask> reduce_queue_;
+  // the tasks waiting for the reduce thread, in push order
+  std::deque<ReduceTask> reduce_queue_;
+  // guards reduce_queue_ and destroy_reduce_thread_
+  utils::Mutex reduce_lock_;
+  // signals a new task or the destroy
+  utils::ConditionVariable reduce_cond_;
+  // take up to kMaxBatch tasks, block while there is none, false if destroyed
+  inline bool PopBatch(std::vector<ReduceTask> *batch) {
+    batch->clear();
+    reduce_lock_.Lock();
+    while (reduce_queue_.size() == 0 && !destroy_reduce_thread_) {
+      reduce_cond_.Wait(&reduce_lock_);
+    }
+    while (reduce_queue_.size() != 0 && batch->size() < static_cast<size_t>(kMaxBatch)) {
+      batch->push_back(reduce_queue_.front());
+      reduce_queue_.pop_front();
+    }
+    reduce_lock_.Unlock();
+    return batch->size() != 0;
+  }
+  // put back the tasks from position n of the batch, to the front of the queue
+  inline void Unpop(const std::vector<ReduceTask> &batch, size_t n) {
+    reduce_lock_.Lock();
+    for (size_t i = batch.size(); i > n; --i) {
+      reduce_queue_.push_front(batch[i - 1]);
+    }
+    reduce_lock_.Unlock();
+  }
+  /*!
+   * \brief agree on the keys of a batch with one allreduce, every rank takes the
+   *  tasks it has ready, the batch is cut to the shortest one among the ranks
+   * \return the number of tasks of the batch all the ranks reduce now
+   */
+  inline size_t CheckConsensus(const std::vector<ReduceTask> &batch) {
+    // max of -n is minus the shortest batch, max of key and -key tells whether
+    // every rank holds the same key
+    int buf[2 * kMaxBatch + 1];
+    buf[0] = -static_cast<int>(batch.size());
+    for (int i = 0; i < kMaxBatch; ++i) {
+      const bool has = i < static_cast<int>(batch.size());
+      buf[2 * i + 1] = has ? batch[i].key : INT_MIN;
+      buf[2 * i + 2] = has ? -batch[i].key : INT_MIN;
+    }
+    rabit::Allreduce<rabit::op::Max>(buf, 2 * kMaxBatch + 1);
+    const size_t n = static_cast<size_t>(-buf[0]);
+    for (size_t i = 0; i < n; ++i) {
+      CHECK(buf[2 * i + 1] == batch[i].key && buf[2 * i + 2] == -batch[i].key)
+          << "Allreduce not concensus";
+    }
+    return n;
+  }
+  // sum the devices into data[0] on [begin, end) of the flattened key
+  inline static void SumDevice(Tensor<cpu, 3, DType> data, size_t begin, size_t end) {
+    DType *dst = data[0].dptr_;
+    for (index_t d = 1; d < data.size(0); ++d) {
+      const DType *src = data[d].dptr_;
+      for (size_t j = begin; j < end; ++j) dst[j] += src[j];
+    }
+  }
+  // divide [begin, end) of the result by the number of ranks
+  inline static void Average(DType *dptr, size_t begin, size_t end) {
+    const DType scale = DType(1.0f / rabit::GetWorldSize());
+    for (size_t j = begin; j < end; ++j) dptr[j] *= scale;
+  }
+  /*!
+   * \brief allreduce one key segment by segment: while segment i is on the network,
+   *  the devices are summed on segment i + 1 and segment i - 1 is averaged,
+   *  on the threads of the shared scheduler when it is there
+   */
+  inline void AllreduceKey(const ReduceTask &tsk) {
+    const size_t size = tsk.data[0].MSize();
+    const size_t step = allreduce_segment_;
+    DType *dptr = tsk.data[0].dptr_;
+#if MSHADOW_PS_TASK_SCHEDULER
+    utils::TaskScheduler *sched = utils::TaskScheduler::Get();
+    utils::TaskScheduler::Group prepare, finish;
+    const Tensor<cpu, 3, DType> data = tsk.data;
+    SumDevice(data, 0, std::min(step, size));
+    for (size_t begin = 0; begin < size; begin += step) {
+      const size_t end = std::min(begin + step, size);
+      if (end < size) {
+        const size_t next_end = std::min(end + step, size);
+        sched->Submit([data, end, next_end] { SumDevice(data, end, next_end); }, &prepare);
+      }
+      rabit::Allreduce<rabit::op::Sum>(dptr + begin, end - begin);
+      sched->Submit([dptr, begin, end] { Average(dptr, begin, end); }, &finish);
+      sched->Wait(&prepare);
+    }
+    sched->Wait(&finish);
+#else
+    for (size_t begin = 0; begin < size; begin += step) {
+      const size_t end = std::min(begin + step, size);
+      SumDevice(tsk.data, begin, end);
+      rabit::Allreduce<rabit::op::Sum>(dptr + begin, end - begin);
+      Average(dptr, begin, end);
+    }
+#endif  // MSHADOW_PS_TASK_SCHEDULER
+  }
   // reduce handler
   inline void ReduceHandler(void) {
-    while (!destroy_reduce_thread_) {
-      ReduceTask tsk;
-      if (reduce_queue_.Pop(&tsk)) {
-        CHECK_EQ(disable_allreduce_, 0) << "Allreduce disabled error";
-        int key = tsk.key;
-        rabit::Allreduce<rabit::op::Max>(&key, 1);
-        CHECK_EQ(key, tsk.key) << "Allreduce not concensus";
-        rabit::Allreduce<rabit::op::Sum>
-            (tsk.data.dptr_, tsk.data.MSize());
-        tsk.data *= 1.0f / rabit::GetWorldSize();
+    std::vector<ReduceTask> batch;
+    while (this->PopBatch(&batch)) {
+      CHECK_EQ(disable_allreduce_, 0) << "Allreduce disabled error";
+      const size_t n = this->CheckConsensus(batch);
+      this->Unpop(batch, n);
+      for (size_t i = 0; i < n; ++i) {
+        const double start = this->KeepMetrics() ? MetricsTime() : 0.0;
+        this->AllreduceKey(batch[i]);
+        if (this->KeepMetrics()) {
+          const uint64_t bytes = batch[i].data[0].MSize() * sizeof(DType);
+          this->AddLatency(batch[i].key, &KeyMetrics::reduce, MetricsTime() - start);
+          this->AddMetric(batch[i].key, &KeyMetrics::bytes_sent, bytes);
+          this->AddMetric(batch[i].key, &KeyMetrics::bytes_recv, bytes);
+        }
         CHECK_EQ(disable_allreduce_, 0) << "Allreduce disabled error";
-        this->HandleReduceFinish(tsk.data, tsk.key);
-      } else {
-        CHECK_EQ(destroy_reduce_thread_, true) << "abort but not destroy";
+        this->HandleReduceFinish(batch[i].data[0], batch[i].key);
       }
     }
+    CHECK_EQ(destroy_reduce_thread_, true) << "abort but not destroy";
   }
   /*!\brief entry point of reduce thread */
   inline static MSHADOW_THREAD_PREFIX ReduceGlobalThread(void *pthread) {
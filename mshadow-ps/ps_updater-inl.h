@@ -0,0 +1,244 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file ps_updater-inl.h
+ * \brief built-in model updaters that run on the server, so that workers can push
+ *  raw gradients and pull the updated weights
+ *
+ *  The updater keeps the weight and the optimizer state of every key, each update is
+ *  fused into one pass over the key by MapMulti, using packets and OpenMP on CPU.
+ *  It is selected by the parameter updater=sgd|adam|adagrad, see CreateBuiltinUpdater.
+ */
+#ifndef MSHADOW_PS_UPDATER_INL_H_  // NOLINT(*)
+#define MSHADOW_PS_UPDATER_INL_H_  // NOLINT(*)
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include "./mshadow_ps.h"
+#include "./thread_util.h"
+
+namespace mshadow {
+namespace ps {
+/*!
+ * \brief base of the built-in updaters, the pushed gradient g is first turned into
+ *  rescale_grad * g + wd * w, the weight is initialized by init, which can be
+ *  zero, uniform:a for U(-a, a), gaussian:sigma for N(0, sigma^2), or push,
+ *  which takes the first pushed value of a key as its weight
+ */
+template<typename DType>
+class BuiltinUpdater : public IModelUpdater<DType> {
+ public:
+  BuiltinUpdater(void)
+      : lr(0.01f), wd(0.0f), rescale_grad(1.0f), init("zero"), seed(0) {
+    state_map.Init();
+  }
+  virtual ~BuiltinUpdater(void) {
+    state_map.Destroy();
+  }
+  virtual void SetParam(const char *name, const char *val) {
+    if (!strcmp(name, "lr")) lr = static_cast<float>(atof(val));
+    if (!strcmp(name, "wd")) wd = static_cast<float>(atof(val));
+    if (!strcmp(name, "rescale_grad")) rescale_grad = static_cast<float>(atof(val));
+    if (!strcmp(name, "seed")) seed = atoi(val);
+    if (!strcmp(name, "init")) {
+      init = val;
+      const std::string type = init.substr(0, init.find(':'));
+      CHECK(type == "zero" || type == "uniform" || type == "gaussian" || type == "push")
+          << "unknown init " << init << ", can only be zero, uniform:a, gaussian:sigma or push";
+    }
+  }
+  /*! \brief the server passes its arguments, the ones like name=value are set as parameters */
+  virtual void InitUpdater(int rank, int argc, char *argv[]) {
+    for (int i = 0; i < argc; ++i) {
+      const char *eq = strchr(argv[i], '=');
+      if (eq == NULL) continue;
+      this->SetParam(std::string(argv[i], eq - argv[i]).c_str(), eq + 1);
+    }
+  }
+
+ protected:
+  /*! \brief the weight and the optimizer state of a key */
+  struct State {
+    // the weight, owned by the server
+    Tensor<cpu, 1, DType> weight;
+    // optimizer state, such as momentum or the moments of Adam
+    TensorContainer<cpu, 1, DType> s0, s1;
+    // number of updates applied
+    int t;
+    // whether the weight still waits for its first push, for init=push
+    bool wait_push;
+    State(void) : t(0), wait_push(false) {}
+  };
+  /*! \brief number of state tensors the updater keeps per key, at most two */
+  virtual int NumState(void) const = 0;
+  /*! \brief apply the gradient of a key to its weight and state */
+  virtual void Apply(State *s, Tensor<cpu, 1, DType> grad) = 0;
+  // a key is initialized once, though every device of a local model initializes it
+  virtual void InitModel_(int key, Tensor<cpu, 1, DType> data) {
+    if (state_map.Get(key) != NULL) return;
+    state_map.Init(key);
+    State &s = state_map.GetRef(key);
+    s.weight = data;
+    const size_t pos = init.find(':');
+    const std::string type = init.substr(0, pos);
+    const float arg = pos == std::string::npos ?
+        1.0f : static_cast<float>(atof(init.c_str() + pos + 1));
+    if (type == "uniform" || type == "gaussian") {
+      // seeded by the key, so the weight does not depend on which server holds it
+      Random<cpu, DType> rnd(seed + key);
+      if (type == "uniform") {
+        rnd.SampleUniform(&s.weight, DType(-arg), DType(arg));
+      } else {
+        rnd.SampleGaussian(&s.weight, DType(0), DType(arg));
+      }
+    } else {
+      s.weight = DType(0);
+      s.wait_push = type == "push";
+    }
+    if (NumState() > 0) s.s0.Resize(data.shape_, DType(0));
+    if (NumState() > 1) s.s1.Resize(data.shape_, DType(0));
+  }
+  virtual void Update_(int key, Tensor<cpu, 1, DType> grad) {
+    State &s = state_map.GetRef(key);
+    CHECK_EQ(s.weight.shape_, grad.shape_) << "Update: the gradient does not match key " << key;
+    if (s.wait_push) {
+      Copy(s.weight, grad);
+      s.wait_push = false;
+      return;
+    }
+    s.t += 1;
+    this->Apply(&s, grad);
+  }
+  /*! \brief learning rate */
+  float lr;
+  /*! \brief weight decay */
+  float wd;
+  /*! \brief the gradient is multiplied by it, e.g. 1 / batch size */
+  float rescale_grad;
+  /*! \brief how the weight is initialized */
+  std::string init;
+  /*! \brief random seed of init */
+  int seed;
+
+ private:
+  utils::ThreadSafeMap<State> state_map;
+};
+/*! \brief SGD, with momentum m = momentum * m - lr * g, w += m when momentum is set */
+template<typename DType>
+class SGDUpdater : public BuiltinUpdater<DType> {
+ public:
+  SGDUpdater(void) : momentum(0.0f) {}
+  virtual void SetParam(const char *name, const char *val) {
+    BuiltinUpdater<DType>::SetParam(name, val);
+    if (!strcmp(name, "momentum")) momentum = static_cast<float>(atof(val));
+  }
+
+ protected:
+  typedef typename BuiltinUpdater<DType>::State State;
+  virtual int NumState(void) const {
+    return momentum != 0.0f ? 1 : 0;
+  }
+  virtual void Apply(State *s, Tensor<cpu, 1, DType> g) {
+    using namespace expr;
+    Tensor<cpu, 1, DType> &w = s->weight;
+    const DType lr = DType(this->lr), wd = DType(this->wd), rs = DType(this->rescale_grad);
+    if (momentum == 0.0f) {
+      w -= lr * (rs * g + wd * w);
+    } else {
+      Tensor<cpu, 1, DType> m = s->s0;
+      MapMulti(assign<sv::saveto>(m, DType(momentum) * m - lr * (rs * g + wd * w)),
+               assign<sv::plusto>(w, m));
+    }
+  }
+
+ private:
+  float momentum;
+};
+/*! \brief Adam, with bias correction of the moments */
+template<typename DType>
+class AdamUpdater : public BuiltinUpdater<DType> {
+ public:
+  AdamUpdater(void) : beta1(0.9f), beta2(0.999f), eps(1e-8f) {}
+  virtual void SetParam(const char *name, const char *val) {
+    BuiltinUpdater<DType>::SetParam(name, val);
+    if (!strcmp(name, "beta1")) beta1 = static_cast<float>(atof(val));
+    if (!strcmp(name, "beta2")) beta2 = static_cast<float>(atof(val));
+    if (!strcmp(name, "eps")) eps = static_cast<float>(atof(val));
+  }
+
+ protected:
+  typedef typename BuiltinUpdater<DType>::State State;
+  virtual int NumState(void) const {
+    return 2;
+  }
+  virtual void Apply(State *s, Tensor<cpu, 1, DType> g) {
+    using namespace expr;
+    Tensor<cpu, 1, DType> &w = s->weight;
+    Tensor<cpu, 1, DType> m = s->s0, v = s->s1;
+    const DType wd = DType(this->wd), rs = DType(this->rescale_grad);
+    const DType b1 = DType(beta1), b2 = DType(beta2);
+    // the bias correction is folded into the learning rate
+    const DType lr = DType(this->lr * std::sqrt(1.0 - std::pow(beta2, s->t)) /
+                           (1.0 - std::pow(beta1, s->t)));
+    MapMulti(assign<sv::saveto>(m, b1 * m + (DType(1) - b1) * (rs * g + wd * w)),
+             assign<sv::saveto>(v, b2 * v + (DType(1) - b2) *
+                                (rs * g + wd * w) * (rs * g + wd * w)),
+             assign<sv::minusto>(w, lr * m / (F<op::sqrt>(v) + DType(eps))));
+  }
+
+ private:
+  float beta1, beta2, eps;
+};
+/*! \brief AdaGrad, h += g * g, w -= lr * g / (sqrt(h) + eps) */
+template<typename DType>
+class AdaGradUpdater : public BuiltinUpdater<DType> {
+ public:
+  AdaGradUpdater(void) : eps(1e-7f) {}
+  virtual void SetParam(const char *name, const char *val) {
+    BuiltinUpdater<DType>::SetParam(name, val);
+    if (!strcmp(name, "eps")) eps = static_cast<float>(atof(val));
+  }
+
+ protected:
+  typedef typename BuiltinUpdater<DType>::State State;
+  virtual int NumState(void) const {
+    return 1;
+  }
+  virtual void Apply(State *s, Tensor<cpu, 1, DType> g) {
+    using namespace expr;
+    Tensor<cpu, 1, DType> &w = s->weight;
+    Tensor<cpu, 1, DType> h = s->s0;
+    const DType lr = DType(this->lr), wd = DType(this->wd), rs = DType(this->rescale_grad);
+    MapMulti(assign<sv::plusto>(h, (rs * g + wd * w) * (rs * g + wd * w)),
+             assign<sv::minusto>(w, lr * (rs * g + wd * w) / (F<op::sqrt>(h) + DType(eps))));
+  }
+
+ private:
+  float eps;
+};
+/*!
+ * \brief create a built-in updater
+ * \param type sgd, adam or adagrad
+ */
+template<typename DType>
+inline IModelUpdater<DType> *CreateBuiltinUpdater(const char *type) {
+  if (!strcmp(type, "sgd")) return new SGDUpdater<DType>();
+  if (!strcmp(type, "adam")) return new AdamUpdater<DType>();
+  if (!strcmp(type, "adagrad")) return new AdaGradUpdater<DType>();
+  LOG(FATAL) << "unknown updater " << type << ", can only be sgd, adam or adagrad";
+  return NULL;
+}
+/*!
+ * \brief the updater of a server, the built-in one named by an argument updater=type,
+ *  or else the one given by CreateModelUpdater
+ */
+template<typename DType>
+inline IModelUpdater<DType> *CreateServerUpdater(int argc, char *argv[]) {
+  for (int i = 0; i < argc; ++i) {
+    if (!strncmp(argv[i], "updater=", 8)) return CreateBuiltinUpdater<DType>(argv[i] + 8);
+  }
+  return CreateModelUpdater<DType>();
+}
+}  // namespace ps
+}  // namespace mshadow
+#endif  // MSHADOW_PS_UPDATER_INL_H_  NOLINT(*)
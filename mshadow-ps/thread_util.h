@@ -11,8 +11,357 @@
 #include <queue>
 #include <map>
 #include "./thread.h"
+
+/*!
+ * \brief whether ThreadPQueue uses lock-free ring buffers,
+ *  otherwise it is a priority queue guarded by a lock
+ */
+#ifndef MSHADOW_PS_LOCKFREE_QUEUE
+#define MSHADOW_PS_LOCKFREE_QUEUE (__cplusplus >= 201103L)
+#endif
+
+/*!
+ * \brief whether TaskScheduler, the work-stealing pool shared by the PS threads and
+ *  the parallel CPU work they do, is available
+ */
+#ifndef MSHADOW_PS_TASK_SCHEDULER
+#define MSHADOW_PS_TASK_SCHEDULER (__cplusplus >= 201103L)
+#endif
+
+#if MSHADOW_PS_LOCKFREE_QUEUE
+#include <stdint.h>
+#include <atomic>
+#include <thread>
+#include <vector>
+#endif
+#if MSHADOW_PS_TASK_SCHEDULER
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstdio>
+#include <cstdlib>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#if defined(__linux__)
+#include <pthread.h>
+#include <sched.h>
+#endif
+#endif
 namespace mshadow {
 namespace utils {
+#if MSHADOW_PS_LOCKFREE_QUEUE
+/*!
+ * \brief bounded multi-producer multi-consumer lock-free ring buffer,
+ *  each cell carries a sequence number that tells whether it is ready
+ *  to be written or read in the current lap
+ * \tparam DType the content of the queue
+ */
+template<typename DType>
+class MPMCRing {
+ public:
+  /*! \param capacity capacity of the ring, must be power of 2 */
+  explicit MPMCRing(size_t capacity)
+      : mask_(capacity - 1), cells_(capacity) {
+    CHECK(capacity >= 2 && (capacity & (capacity - 1)) == 0)
+        << "MPMCRing: capacity must be power of 2";
+    for (size_t i = 0; i < capacity; ++i) {
+      cells_[i].seq.store(i, std::memory_order_relaxed);
+    }
+    head_.store(0, std::memory_order_relaxed);
+    tail_.store(0, std::memory_order_relaxed);
+  }
+  /*! \brief try to push, return false if the ring is full */
+  inline bool TryPush(const DType &data) {
+    size_t pos = tail_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+      if (diff == 0) {
+        if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = tail_.load(std::memory_order_relaxed);
+      }
+    }
+    cell->data = data;
+    cell->seq.store(pos + 1, std::memory_order_release);
+    return true;
+  }
+  /*! \brief try to pop, return false if the ring is empty */
+  inline bool TryPop(DType *data_out) {
+    size_t pos = head_.load(std::memory_order_relaxed);
+    Cell *cell;
+    while (true) {
+      cell = &cells_[pos & mask_];
+      size_t seq = cell->seq.load(std::memory_order_acquire);
+      intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+      if (diff == 0) {
+        if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+      } else if (diff < 0) {
+        return false;
+      } else {
+        pos = head_.load(std::memory_order_relaxed);
+      }
+    }
+    *data_out = cell->data;
+    cell->seq.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+  }
+  /*! \brief whether the ring looks empty, can be stale */
+  inline bool Empty(void) const {
+    return head_.load(std::memory_order_acquire) == tail_.load(std::memory_order_acquire);
+  }
+
+ private:
+  struct Cell {
+    std::atomic<size_t> seq;
+    DType data;
+  };
+  // capacity - 1
+  size_t mask_;
+  // the cells
+  std::vector<Cell> cells_;
+  // position to pop
+  std::atomic<size_t> head_;
+  // padding to keep head and tail in different cache lines
+  char pad_[64];
+  // position to push
+  std::atomic<size_t> tail_;
+};
+/*!
+ * \brief thread safe queue that can be used for customer consumer model,
+ *  elements with the same priority go into one lock-free ring (a shard),
+ *  Pop takes from the non-empty shard with highest priority.
+ *  Only the first kMaxShard distinct priorities get a shard, the elements of
+ *  any later priority go to a priority queue guarded by a lock, so the
+ *  queue stays exact for any number of priorities.
+ *  A consumer spins for a while when the queue is empty, and only parks
+ *  on the condition variable after that, so a busy queue makes no system call.
+ * \tparam DType the content of the queue
+ */
+template<typename DType>
+class ThreadPQueue {
+ public:
+  /*! \brief maximum number of priorities that get a lock-free shard */
+  static const int kMaxShard = 1024;
+  /*! \brief capacity of each shard, Push spins when a shard is full */
+  static const size_t kShardCapacity = 4096;
+  /*! \brief number of spins before a consumer parks */
+  static const int kSpinCount = 1024;
+  // constructor
+  ThreadPQueue() : use_fifo_(false) {
+  }
+  // copy constructor, so queues can be kept in a vector, only valid before Init
+  ThreadPQueue(const ThreadPQueue &other) : use_fifo_(other.use_fifo_) {
+  }
+  /*! \brief intitialize the queue, must call this before use */
+  inline void Init(bool use_fifo = false) {
+    use_fifo_ = use_fifo;
+    lock_.Init();
+    cond_.Init();
+    nshard_.store(0);
+    count_.store(0);
+    nwait_.store(0);
+    noverflow_.store(0);
+    abort_.store(false);
+    shards_.resize(kMaxShard);
+    overflow_lock_.Init();
+  }
+  /*! \brief destroy the resources on the queue */
+  inline void Destroy(void) {
+    for (int i = 0; i < nshard_.load(); ++i) {
+      delete shards_[i].ring;
+    }
+    shards_.clear();
+    nshard_.store(0);
+    overflow_ = std::priority_queue<Entry>();
+    noverflow_.store(0);
+    overflow_lock_.Destroy();
+    cond_.Destroy();
+    lock_.Destroy();
+  }
+  /*!
+   * \brief Destroy the queue
+   *        wake up all the threads waits on pop
+   *  this is usually used in class destructor
+   * \param max_nthread the maximum number of thread that
+   *  could be waiting on the queue
+   */
+  inline void Abort(int max_nthread = 1) {
+    abort_.store(true);
+    lock_.Lock();
+    cond_.Broadcast();
+    lock_.Unlock();
+  }
+  /*!
+   * \brief push an element to the queue
+   * \param data the data to be puhed into queue
+   * \param optionally priority level to hint which
+   *        element should be poped first
+   */
+  inline void Push(const DType &data, int priority = 0) {
+    MPMCRing<DType> *ring = this->GetShard(use_fifo_ ? 0 : priority);
+    if (ring != NULL) {
+      while (!ring->TryPush(data)) {
+        // the shard is full, wait for the consumers
+        std::this_thread::yield();
+      }
+    } else {
+      overflow_lock_.Lock();
+      overflow_.push(Entry(data, priority));
+      noverflow_.fetch_add(1);
+      overflow_lock_.Unlock();
+    }
+    count_.fetch_add(1);
+    // pair with the nwait_ increase before the consumer checks count_
+    if (nwait_.load() != 0) {
+      lock_.Lock();
+      cond_.Signal();
+      lock_.Unlock();
+    }
+  }
+  /*!
+   * \brief pop an element from the queue
+   * this will block the thread if the queue is empty
+   * \param data_out the address to put output of the queue
+   * \return true if a correct element is returned
+   *  false if abort is called and no element was left in queue
+   */
+  inline bool Pop(DType *data_out) {
+    if (!this->Claim()) return false;
+    // an element is claimed, it must be in one of the shards or the overflow
+    while (true) {
+      const int n = nshard_.load(std::memory_order_acquire);
+      int best = -1;
+      for (int i = 0; i < n; ++i) {
+        if (!shards_[i].ring->Empty() &&
+            (best < 0 || shards_[i].priority > shards_[best].priority)) {
+          best = i;
+        }
+      }
+      if (noverflow_.load() != 0) {
+        overflow_lock_.Lock();
+        if (!overflow_.empty() &&
+            (best < 0 || overflow_.top().priority > shards_[best].priority)) {
+          *data_out = overflow_.top().data;
+          overflow_.pop();
+          noverflow_.fetch_sub(1);
+          overflow_lock_.Unlock();
+          return true;
+        }
+        overflow_lock_.Unlock();
+      }
+      if (best >= 0 && shards_[best].ring->TryPop(data_out)) return true;
+    }
+  }
+  /*! \brief number of elements in the queue, may be stale when it returns */
+  inline int Size(void) const {
+    return count_.load();
+  }
+
+ private:
+  // a shard holds the elements of one priority
+  struct Shard {
+    int priority;
+    MPMCRing<DType> *ring;
+    Shard(void) : priority(0), ring(NULL) {}
+  };
+  // entry of the overflow queue
+  struct Entry {
+    DType data;
+    int priority;
+    Entry(const DType &data, int priority)
+        : data(data), priority(priority) {}
+    inline bool operator<(const Entry &b) const {
+      return priority < b.priority;
+    }
+  };
+  // take one element from count_, block if there is none
+  inline bool Claim(void) {
+    int spin = 0;
+    while (true) {
+      int c = count_.load();
+      if (c > 0) {
+        if (count_.compare_exchange_weak(c, c - 1)) return true;
+        continue;
+      }
+      if (abort_.load()) return false;
+      if (++spin < kSpinCount) {
+        if (spin > 64) std::this_thread::yield();
+        continue;
+      }
+      // park
+      lock_.Lock();
+      nwait_.fetch_add(1);
+      while (count_.load() == 0 && !abort_.load()) {
+        cond_.Wait(&lock_);
+      }
+      nwait_.fetch_sub(1);
+      lock_.Unlock();
+      spin = 0;
+    }
+  }
+  // get the shard of priority, create it if it does not exist,
+  // NULL when all kMaxShard shards are taken by other priorities
+  inline MPMCRing<DType> *GetShard(int priority) {
+    int n = nshard_.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+      if (shards_[i].priority == priority) return shards_[i].ring;
+    }
+    lock_.Lock();
+    // recheck, another producer may have created it
+    n = nshard_.load(std::memory_order_acquire);
+    for (int i = 0; i < n; ++i) {
+      if (shards_[i].priority == priority) {
+        lock_.Unlock();
+        return shards_[i].ring;
+      }
+    }
+    if (n == kMaxShard) {
+      lock_.Unlock();
+      return NULL;
+    }
+    shards_[n].priority = priority;
+    shards_[n].ring = new MPMCRing<DType>(kShardCapacity);
+    nshard_.store(n + 1, std::memory_order_release);
+    lock_.Unlock();
+    return shards_[n].ring;
+  }
+  // whether use FIFO queue, all elements go to one shard
+  bool use_fifo_;
+  // the shards, only the first nshard_ are valid, never reallocated after Init
+  std::vector<Shard> shards_;
+  // number of shards
+  std::atomic<int> nshard_;
+  // number of elements in the queue
+  std::atomic<int> count_;
+  // elements whose priority has no shard
+  std::priority_queue<Entry> overflow_;
+  // size of overflow_, lets Pop skip the lock while it is empty
+  std::atomic<int> noverflow_;
+  // lock of overflow_
+  utils::Mutex overflow_lock_;
+  // number of parked consumers
+  std::atomic<int> nwait_;
+  // whether the queue is aborted
+  std::atomic<bool> abort_;
+  // lock to create shard and park
+  utils::Mutex lock_;
+  // condition variable to park the consumer
+  utils::ConditionVariable cond_;
+};
+#else
 /*!
  * \brief thread safe queue that can be used for customer consumer model
  * in the future, it will support priority scheduling
@@ -94,6 +443,13 @@ class ThreadPQueue {
     lock_.Unlock();
     return true;
   }
+  /*! \brief number of elements in the queue, may be stale when it returns */
+  inline int Size(void) {
+    lock_.Lock();
+    const int n = static_cast<int>(use_fifo_ ? fqueue_.size() : pqueue_.size());
+    lock_.Unlock();
+    return n;
+  }
 
  private:
   // entry in the queue
@@ -118,6 +474,8 @@ class ThreadPQueue {
   utils::Semaphore counter_;
 };
 
+#endif  // MSHADOW_PS_LOCKFREE_QUEUE
+
 // naive implementation of threadsafe map
 template<typename TValue>
 class ThreadSafeMap {
@@ -164,6 +522,335 @@ class ThreadSafeMap {
   std::map<int, TValue*> map_;
 };
 
+#if MSHADOW_PS_TASK_SCHEDULER
+/*!
+ * \brief work-stealing pool of worker threads, every worker owns a deque of tasks:
+ *  the tasks a worker submits go to the back of its own deque and are taken back
+ *  from there, an idle worker steals from the front of the others, trying the
+ *  workers on its own NUMA node first.
+ *
+ *  The number of threads is limited by MSHADOW_NUM_THREADS, or OMP_NUM_THREADS when
+ *  it is not set, or else the number of cores the process may run on; the OpenMP
+ *  regions started from the thread that creates the scheduler get the same limit.
+ *  With MSHADOW_BIND_THREADS=1 the workers are pinned to cores, node by node.
+ */
+class TaskScheduler {
+ public:
+  /*! \brief type of a task */
+  typedef std::function<void()> Task;
+  /*! \brief a set of submitted tasks that can be waited for */
+  class Group {
+   public:
+    Group(void) : pending_(0) {}
+
+   private:
+    friend class TaskScheduler;
+    /*! \brief number of tasks of the group not done yet */
+    std::atomic<int> pending_;
+    /*! \brief guards error_ */
+    std::mutex mutex_;
+    /*! \brief the first exception thrown by a task of the group */
+    std::exception_ptr error_;
+  };
+  /*!
+   * \brief create a scheduler
+   * \param nthread the limit of threads, including one thread that waits on it
+   */
+  explicit TaskScheduler(int nthread) : nthread_(std::max(nthread, 1)), next_(0),
+                                        num_queued_(0), stop_(false) {
+    std::vector<int> cpus, nodes;
+    GetCPUPlacement(&cpus, &nodes);
+    const bool bind = getenv("MSHADOW_BIND_THREADS") != NULL &&
+        atoi(getenv("MSHADOW_BIND_THREADS")) != 0;
+    const int nworker = std::max(nthread_ - 1, 1);
+    for (int i = 0; i < nworker; ++i) {
+      std::unique_ptr<Worker> w(new Worker());
+      w->cpu = cpus.empty() ? -1 : cpus[i % cpus.size()];
+      w->node = nodes.empty() ? 0 : nodes[i % nodes.size()];
+      workers_.push_back(std::move(w));
+    }
+    // steal from the workers of the same node first, then from the rest
+    for (int i = 0; i < nworker; ++i) {
+      for (int pass = 0; pass < 2; ++pass) {
+        for (int k = 1; k < nworker; ++k) {
+          const int j = (i + k) % nworker;
+          if ((workers_[j]->node == workers_[i]->node) == (pass == 0)) {
+            workers_[i]->victims.push_back(j);
+          }
+        }
+      }
+    }
+    for (int i = 0; i < nworker; ++i) {
+      workers_[i]->thread = std::thread(&TaskScheduler::RunWorker, this, i);
+#if defined(__linux__)
+      if (bind && workers_[i]->cpu >= 0) {
+        cpu_set_t mask;
+        CPU_ZERO(&mask);
+        CPU_SET(workers_[i]->cpu, &mask);
+        pthread_setaffinity_np(workers_[i]->thread.native_handle(), sizeof(mask), &mask);
+      }
+#endif
+    }
+#if defined(_OPENMP)
+    if (omp_get_max_threads() > nthread_) omp_set_num_threads(nthread_);
+#endif
+  }
+  /*! \brief runs the tasks that are still queued, then joins the workers */
+  ~TaskScheduler(void) {
+    {
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+      stop_ = true;
+    }
+    sleep_cond_.notify_all();
+    for (size_t i = 0; i < workers_.size(); ++i) {
+      workers_[i]->thread.join();
+    }
+  }
+  /*! \brief the scheduler shared by the process, created at the first call */
+  inline static TaskScheduler *Get(void) {
+    static TaskScheduler inst(DefaultNumThread());
+    return &inst;
+  }
+  /*! \brief the limit of threads from the environment, see TaskScheduler */
+  inline static int DefaultNumThread(void) {
+    const char *names[] = {"MSHADOW_NUM_THREADS", "OMP_NUM_THREADS"};
+    for (int i = 0; i < 2; ++i) {
+      const char *val = getenv(names[i]);
+      if (val != NULL && atoi(val) > 0) return atoi(val);
+    }
+    std::vector<int> cpus, nodes;
+    GetCPUPlacement(&cpus, &nodes);
+    if (!cpus.empty()) return static_cast<int>(cpus.size());
+    return std::max(static_cast<int>(std::thread::hardware_concurrency()), 1);
+  }
+  /*! \return the limit of threads */
+  inline int NumThread(void) const {
+    return nthread_;
+  }
+  /*!
+   * \brief queue a task, it can run on any worker
+   * \param task the task
+   * \param group the group to count the task in, can be NULL
+   */
+  inline void Submit(Task task, Group *group = NULL) {
+    if (group != NULL) group->pending_.fetch_add(1);
+    const int self = this->CurrentWorker();
+    const size_t i = self >= 0 ? static_cast<size_t>(self) :
+        next_.fetch_add(1) % workers_.size();
+    {
+      std::lock_guard<std::mutex> lock(workers_[i]->mutex);
+      workers_[i]->queue.push_back(Entry(std::move(task), group));
+    }
+    num_queued_.fetch_add(1);
+    {
+      // pairs with the check of num_queued_ of a worker going to sleep
+      std::lock_guard<std::mutex> lock(sleep_mutex_);
+    }
+    sleep_cond_.notify_one();
+  }
+  /*!
+   * \brief wait for the tasks of group, the calling thread runs queued tasks meanwhile,
+   *  so a task can wait for the tasks it submitted. The first exception thrown by a task
+   *  of the group is rethrown.
+   */
+  inline void Wait(Group *group) {
+    const int self = this->CurrentWorker();
+    Entry e;
+    while (group->pending_.load() != 0) {
+      if (this->TryTake(self, &e)) {
+        this->Run(&e);
+      } else {
+        std::this_thread::yield();
+      }
+    }
+    std::exception_ptr error;
+    {
+      std::lock_guard<std::mutex> lock(group->mutex_);
+      std::swap(error, group->error_);
+    }
+    if (error) std::rethrow_exception(error);
+  }
+  /*!
+   * \brief run fn(begin, end) over [begin, end) cut into chunks of at least grain
+   *  items, spread over the threads of the scheduler and the calling thread
+   * \param max_chunk at most this many chunks, 0 means four per thread
+   */
+  inline void ParallelFor(size_t begin, size_t end, size_t grain,
+                          const std::function<void(size_t, size_t)> &fn,
+                          size_t max_chunk = 0) {
+    if (end <= begin) return;
+    const size_t n = end - begin;
+    size_t nchunk = (n + std::max(grain, static_cast<size_t>(1)) - 1) /
+        std::max(grain, static_cast<size_t>(1));
+    nchunk = std::min(nchunk, max_chunk != 0 ? max_chunk :
+                      static_cast<size_t>(nthread_) * 4);
+    if (nchunk <= 1 || nthread_ == 1) {
+      fn(begin, end);
+      return;
+    }
+    const size_t step = (n + nchunk - 1) / nchunk;
+    Group group;
+    for (size_t b = begin + step; b < end; b += step) {
+      const size_t e = std::min(b + step, end);
+      this->Submit([&fn, b, e] { fn(b, e); }, &group);
+    }
+    std::exception_ptr error;
+    try {
+      fn(begin, begin + step);
+    } catch (...) {
+      error = std::current_exception();
+    }
+    this->Wait(&group);
+    if (error) std::rethrow_exception(error);
+  }
+
+ private:
+  /*! \brief a queued task */
+  struct Entry {
+    Task task;
+    Group *group;
+    Entry(void) : group(NULL) {}
+    Entry(Task task, Group *group) : task(std::move(task)), group(group) {}
+  };
+  /*! \brief a worker thread and its deque */
+  struct Worker {
+    std::mutex mutex;
+    std::deque<Entry> queue;
+    /*! \brief workers to steal from, in order */
+    std::vector<int> victims;
+    int cpu, node;
+    std::thread thread;
+  };
+  /*! \brief the scheduler and worker index of the calling thread */
+  struct ThreadInfo {
+    TaskScheduler *owner;
+    int index;
+  };
+  inline static ThreadInfo &CurrentThread(void) {
+    static thread_local ThreadInfo info = {NULL, -1};
+    return info;
+  }
+  inline int CurrentWorker(void) const {
+    const ThreadInfo &info = CurrentThread();
+    return info.owner == this ? info.index : -1;
+  }
+  /*!
+   * \brief the cores the process may run on, sorted by NUMA node, and their nodes
+   *  (left empty where that is not known)
+   */
+  inline static void GetCPUPlacement(std::vector<int> *cpus, std::vector<int> *nodes) {
+    cpus->clear(); nodes->clear();
+#if defined(__linux__)
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0) return;
+    std::vector<int> node_of(CPU_SETSIZE, 0);
+    for (int node = 0;; ++node) {
+      char path[64];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node);
+      FILE *fp = fopen(path, "r");
+      if (fp == NULL) break;
+      // a list of ranges such as 0-3,8-11
+      int lo, hi;
+      while (fscanf(fp, "%d", &lo) == 1) {
+        hi = lo;
+        int c = fgetc(fp);
+        if (c == '-') {
+          if (fscanf(fp, "%d", &hi) != 1) break;
+          c = fgetc(fp);
+        }
+        for (int i = std::max(lo, 0); i <= hi && i < CPU_SETSIZE; ++i) node_of[i] = node;
+        if (c != ',') break;
+      }
+      fclose(fp);
+    }
+    std::vector<std::pair<int, int> > order;
+    for (int i = 0; i < CPU_SETSIZE; ++i) {
+      if (CPU_ISSET(i, &mask)) order.push_back(std::make_pair(node_of[i], i));
+    }
+    std::sort(order.begin(), order.end());
+    for (size_t i = 0; i < order.size(); ++i) {
+      nodes->push_back(order[i].first);
+      cpus->push_back(order[i].second);
+    }
+#endif
+  }
+  /*! \brief take a task, from the back of the own deque or the front of another */
+  inline bool TryTake(int self, Entry *out) {
+    if (num_queued_.load() == 0) return false;
+    if (self >= 0) {
+      Worker *w = workers_[self].get();
+      std::lock_guard<std::mutex> lock(w->mutex);
+      if (!w->queue.empty()) {
+        *out = std::move(w->queue.back());
+        w->queue.pop_back();
+        num_queued_.fetch_sub(1);
+        return true;
+      }
+    }
+    const size_t nvictim = self >= 0 ? workers_[self]->victims.size() : workers_.size();
+    for (size_t k = 0; k < nvictim; ++k) {
+      Worker *w = workers_[self >= 0 ? workers_[self]->victims[k] : k].get();
+      std::lock_guard<std::mutex> lock(w->mutex);
+      if (!w->queue.empty()) {
+        *out = std::move(w->queue.front());
+        w->queue.pop_front();
+        num_queued_.fetch_sub(1);
+        return true;
+      }
+    }
+    return false;
+  }
+  inline void Run(Entry *e) {
+    Group *group = e->group;
+    try {
+      e->task();
+    } catch (...) {
+      if (group == NULL) throw;
+      std::lock_guard<std::mutex> lock(group->mutex_);
+      if (!group->error_) group->error_ = std::current_exception();
+    }
+    e->task = Task();
+    if (group != NULL) group->pending_.fetch_sub(1);
+  }
+  inline void RunWorker(int index) {
+    ThreadInfo &info = CurrentThread();
+    info.owner = this;
+    info.index = index;
+#if defined(_OPENMP)
+    // parallel regions inside the tasks stay within the limit too
+    omp_set_num_threads(nthread_);
+#endif
+    Entry e;
+    while (true) {
+      if (this->TryTake(index, &e)) {
+        this->Run(&e);
+        continue;
+      }
+      std::unique_lock<std::mutex> lock(sleep_mutex_);
+      if (num_queued_.load() != 0) continue;
+      if (stop_) return;
+      sleep_cond_.wait(lock);
+    }
+  }
+  /*! \brief the limit of threads */
+  int nthread_;
+  /*! \brief the workers */
+  std::vector<std::unique_ptr<Worker> > workers_;
+  /*! \brief round robin counter for the tasks submitted by other threads */
+  std::atomic<size_t> next_;
+  /*! \brief number of tasks in the deques */
+  std::atomic<int> num_queued_;
+  /*! \brief guards stop_ and the sleep of the workers */
+  std::mutex sleep_mutex_;
+  std::condition_variable sleep_cond_;
+  bool stop_;
+  // not copyable, the threads are owned
+  TaskScheduler(const TaskScheduler &other);
+  TaskScheduler &operator=(const TaskScheduler &other);
+};
+#endif  // MSHADOW_PS_TASK_SCHEDULER
+
 }  // namespace utils
 }  // namespace mshadow
 #endif  // MSHADOW_PS_THREAD_UTIL_H_
@@ -121,14 +121,136 @@ typedef unsigned __int64 uint64_t;
 #ifndef MSHADOW_USE_SSE
   #define MSHADOW_USE_SSE 1
 #endif
+/*!
+ * \brief number of elements below which CPU elementwise kernels stay serial,
+ *  can be overridden per stream by Stream<cpu>::SetParallelThreshold
+ */
+#ifndef MSHADOW_CPU_PARALLEL_THRESHOLD
+  #define MSHADOW_CPU_PARALLEL_THRESHOLD (1 << 16)
+#endif
+/*! \brief whether use AVX, on by default when the compiler targets AVX2 */
+#ifndef MSHADOW_USE_AVX
+  #ifdef __AVX2__
+    #define MSHADOW_USE_AVX 1
+  #else
+    #define MSHADOW_USE_AVX 0
+  #endif
+#endif
+/*! \brief whether use AVX-512, on by default when the compiler targets AVX-512F */
+#ifndef MSHADOW_USE_AVX512
+  #ifdef __AVX512F__
+    #define MSHADOW_USE_AVX512 1
+  #else
+    #define MSHADOW_USE_AVX512 0
+  #endif
+#endif
+/*!
+ * \brief compile AVX and AVX-512 packet kernels in addition to the default
+ *  packet arch, and pick the widest one supported by the host at runtime,
+ *  requires gcc or clang targeting x86
+ */
+#ifndef MSHADOW_USE_PACKET_DISPATCH
+  #define MSHADOW_USE_PACKET_DISPATCH 0
+#endif
+/*!
+ * \brief route AllocSpace/FreeSpace of GPU tensors through a caching device memory pool,
+ *  and AllocHost and host staging buffers through a pinned memory pool,
+ *  see pool::GPUMemoryPool and pool::PinnedMemoryPool, requires c++11
+ */
+#ifndef MSHADOW_USE_GPU_POOL
+  #define MSHADOW_USE_GPU_POOL 0
+#endif
+/*!
+ * \brief route AllocSpace/FreeSpace and AllocHost of CPU tensors through the allocator
+ *  selected for the calling thread, such as the thread-local arena or the huge page pool,
+ *  see pool::CPUAllocatorScope, requires c++11
+ */
+#ifndef MSHADOW_USE_CPU_ALLOCATOR
+  #define MSHADOW_USE_CPU_ALLOCATOR 0
+#endif
+/*! \brief size of the chunks of pool::ArenaAllocator, must be a power of two */
+#ifndef MSHADOW_CPU_ARENA_CHUNK
+  #define MSHADOW_CPU_ARENA_CHUNK (4UL << 20)
+#endif
+/*!
+ * \brief draw the numbers of Random<cpu> and Random<gpu> from the Philox4x32-10 counter
+ *  based generator, so both devices produce the same stream and CPU sampling runs in parallel
+ */
+#ifndef MSHADOW_RANDOM_PHILOX
+  #define MSHADOW_RANDOM_PHILOX 0
+#endif
+/*!
+ * \brief count the calls, elements, bytes and time of the hot ops per kind,
+ *  see profiler.h, requires c++11
+ */
+#ifndef MSHADOW_USE_PROFILER
+  #define MSHADOW_USE_PROFILER 0
+#endif
+/*! \brief mark each profiled op as an NVTX range, on by default with the profiler and CUDA */
+#ifndef MSHADOW_USE_NVTX
+  #define MSHADOW_USE_NVTX (MSHADOW_USE_PROFILER && MSHADOW_USE_CUDA)
+#endif
+/*!
+ * \brief compile the fused graphs of fused_graph.h for gpu at runtime with NVRTC,
+ *  links against nvrtc and the CUDA driver, requires c++11
+ */
+#ifndef MSHADOW_USE_NVRTC
+  #define MSHADOW_USE_NVRTC 0
+#endif
+/*!
+ * \brief pick the launch configuration of the main gpu kernels by timing candidates,
+ *  see cuda/launch_tuner.cuh, requires c++11
+ */
+#ifndef MSHADOW_USE_AUTOTUNE
+  #define MSHADOW_USE_AUTOTUNE 0
+#endif
+/*!
+ * \brief run the gpu transforms of fft.h on cuFFT, links against cufft,
+ *  on by default with CUDA
+ */
+#ifndef MSHADOW_USE_CUFFT
+  #define MSHADOW_USE_CUFFT MSHADOW_USE_CUDA
+#endif
+#if !MSHADOW_USE_CUDA
+  #undef MSHADOW_USE_CUFFT
+  #define MSHADOW_USE_CUFFT 0
+  #undef MSHADOW_USE_GPU_POOL
+  #define MSHADOW_USE_GPU_POOL 0
+  #undef MSHADOW_USE_NVRTC
+  #define MSHADOW_USE_NVRTC 0
+  #undef MSHADOW_USE_AUTOTUNE
+  #define MSHADOW_USE_AUTOTUNE 0
+#endif
+#if !MSHADOW_USE_PROFILER
+  #undef MSHADOW_USE_NVTX
+  #define MSHADOW_USE_NVTX 0
+#endif
+/*!
+ * \brief whether the expression engine checks that the shapes of an assignment agree,
+ *  0 skips the checks of ShapeCheck, MapExp, the reductions and Copy in builds with NDEBUG,
+ *  builds without NDEBUG always check, see MSHADOW_CHECK_SHAPE
+ */
+#ifndef MSHADOW_SHAPE_CHECK
+  #define MSHADOW_SHAPE_CHECK 1
+#endif
+#ifndef NDEBUG
+  #undef MSHADOW_SHAPE_CHECK
+  #define MSHADOW_SHAPE_CHECK 1
+#endif
 /*! \brief whether use NVML to get dynamic info */
 #ifndef MSHADOW_USE_NVML
   #define MSHADOW_USE_NVML 0
 #endif
-// SSE is conflict with cudacc
+// SSE and AVX are conflict with cudacc
 #ifdef __CUDACC__
   #undef MSHADOW_USE_SSE
   #define MSHADOW_USE_SSE 0
+  #undef MSHADOW_USE_AVX
+  #define MSHADOW_USE_AVX 0
+  #undef MSHADOW_USE_AVX512
+  #define MSHADOW_USE_AVX512 0
+  #undef MSHADOW_USE_PACKET_DISPATCH
+  #define MSHADOW_USE_PACKET_DISPATCH 0
 #endif
 
 #if MSHADOW_USE_CBLAS
@@ -148,6 +270,10 @@ extern "C" {
   #include <curand.h>
 #endif
 
+#if MSHADOW_USE_CUFFT
+  #include <cufft.h>
+#endif
+
 #if MSHADOW_USE_CUDNN == 1
   #include <cudnn.h>
 #endif
@@ -174,6 +300,12 @@ extern "C" {
 #endif
 /*! \brief cpu force inline */
 #define MSHADOW_CINLINE MSHADOW_FORCE_INLINE
+/*! \brief hint the cpu to bring the cache line of addr in for a read */
+#if defined(__GNUC__) || defined(__clang__)
+#define MSHADOW_PREFETCH(addr) __builtin_prefetch(addr)
+#else
+#define MSHADOW_PREFETCH(addr)
+#endif
 
 #if defined(__GXX_EXPERIMENTAL_CXX0X) ||\
     defined(__GXX_EXPERIMENTAL_CXX0X__) || __cplusplus >= 201103L
@@ -244,7 +376,21 @@ typedef int cudnnTensorFormat_t;
 #endif
 
 #include "./half.h"
+#include "./bfloat.h"
 #include "./logging.h"
+/*!
+ * \brief checks of the shapes of the expression engine, CHECK unless MSHADOW_SHAPE_CHECK
+ *  is 0, in which case neither the condition nor the message is evaluated
+ */
+#if MSHADOW_SHAPE_CHECK
+#define MSHADOW_CHECK_SHAPE(x) CHECK(x)
+#define MSHADOW_CHECK_SHAPE_EQ(x, y) CHECK_EQ(x, y)
+#else
+#define MSHADOW_CHECK_SHAPE(x) \
+  while (false) CHECK(x)
+#define MSHADOW_CHECK_SHAPE_EQ(x, y) \
+  while (false) CHECK_EQ(x, y)
+#endif  // MSHADOW_SHAPE_CHECK
 /*! \brief namespace for mshadow */
 namespace mshadow {
 /*! \brief buffer size for each random number generator */
@@ -253,6 +399,12 @@ const unsigned kRandBufferSize = 1000000;
 const float kPi = 3.1415926f;
 /*! \brief type that will be used for index */
 typedef unsigned index_t;
+/*! \brief loop index type used in openmp parallel loops */
+#ifdef _WIN32
+typedef int64_t openmp_index_t;
+#else
+typedef index_t openmp_index_t;
+#endif
 /*! \brief float point type that will be used in default by mshadow */
 typedef float default_real_t;
 
@@ -262,7 +414,9 @@ enum TypeFlag {
   kFloat64,
   kFloat16,
   kUint8,
-  kInt32
+  kInt32,
+  kBfloat16,
+  kInt8
 };
 
 template<typename DType>
@@ -293,6 +447,14 @@ struct DataType<half::half_t> {
 #endif
 };
 template<>
+struct DataType<bfloat::bf16_t> {
+  static const int kFlag = kBfloat16;
+#if (MSHADOW_USE_CUDA && MSHADOW_USE_CUDNN == 1 && CUDNN_MAJOR >= 8)
+  static const cudnnDataType_t kCudnnFlag = CUDNN_DATA_BFLOAT16;
+  typedef float ScaleType;
+#endif
+};
+template<>
 struct DataType<uint8_t> {
   static const int kFlag = kUint8;
 };
@@ -300,6 +462,31 @@ template<>
 struct DataType<int32_t> {
   static const int kFlag = kInt32;
 };
+template<>
+struct DataType<int8_t> {
+  static const int kFlag = kInt8;
+#if (MSHADOW_USE_CUDA && MSHADOW_USE_CUDNN == 1 && CUDNN_MAJOR >= 6)
+  static const cudnnDataType_t kCudnnFlag = CUDNN_DATA_INT8;
+  typedef float ScaleType;
+#endif
+};
+
+/*!
+ * \brief type the reductions of DType accumulate in,
+ *  float for the 16 bit floating point types
+ */
+template<typename DType>
+struct AccType {
+  typedef DType type;
+};
+template<>
+struct AccType<half::half_t> {
+  typedef float type;
+};
+template<>
+struct AccType<bfloat::bf16_t> {
+  typedef float type;
+};
 
 /*! \brief type enum value for default real type */
 const int default_type_flag = DataType<default_real_t>::kFlag;
@@ -419,6 +606,82 @@ struct identity{
     return a;
   }
 };
+/*! \brief exponential function */
+struct exp {
+  /*! \brief map a to result using defined operation */
+  template<typename DType>
+  MSHADOW_XINLINE static DType Map(DType a) {
+    return DType(expf(static_cast<float>(a)));
+  }
+  /*! \brief map a to result using defined operation */
+  MSHADOW_XINLINE static double Map(double a) {
+    return ::exp(a);
+  }
+};
+/*! \brief natural logarithm */
+struct log {
+  /*! \brief map a to result using defined operation */
+  template<typename DType>
+  MSHADOW_XINLINE static DType Map(DType a) {
+    return DType(logf(static_cast<float>(a)));
+  }
+  /*! \brief map a to result using defined operation */
+  MSHADOW_XINLINE static double Map(double a) {
+    return ::log(a);
+  }
+};
+/*! \brief hyperbolic tangent */
+struct tanh {
+  /*! \brief map a to result using defined operation */
+  template<typename DType>
+  MSHADOW_XINLINE static DType Map(DType a) {
+    return DType(tanhf(static_cast<float>(a)));
+  }
+  /*! \brief map a to result using defined operation */
+  MSHADOW_XINLINE static double Map(double a) {
+    return ::tanh(a);
+  }
+};
+/*! \brief square root */
+struct sqrt {
+  /*! \brief map a to result using defined operation */
+  template<typename DType>
+  MSHADOW_XINLINE static DType Map(DType a) {
+    return DType(sqrtf(static_cast<float>(a)));
+  }
+  /*! \brief map a to result using defined operation */
+  MSHADOW_XINLINE static double Map(double a) {
+    return ::sqrt(a);
+  }
+};
+/*! \brief sigmoid function 1 / (1 + exp(-a)) */
+struct sigmoid {
+  /*! \brief map a to result using defined operation */
+  template<typename DType>
+  MSHADOW_XINLINE static DType Map(DType a) {
+    return DType(1.0f / (1.0f + expf(-static_cast<float>(a))));
+  }
+  /*! \brief map a to result using defined operation */
+  MSHADOW_XINLINE static double Map(double a) {
+    return 1.0 / (1.0 + ::exp(-a));
+  }
+};
+/*! \brief maximum of two values */
+struct maximum {
+  /*! \brief map a, b to result using defined operation */
+  template<typename DType>
+  MSHADOW_XINLINE static DType Map(DType a, DType b) {
+    return a > b ? a : b;
+  }
+};
+/*! \brief minimum of two values */
+struct minimum {
+  /*! \brief map a, b to result using defined operation */
+  template<typename DType>
+  MSHADOW_XINLINE static DType Map(DType a, DType b) {
+    return a < b ? a : b;
+  }
+};
 }  // namespace op
 /*! \brief namespace for savers */
 namespace sv {
@@ -509,6 +772,11 @@ template<>
 MSHADOW_XINLINE half::half_t MinValue<half::half_t>(void) {
   return MSHADOW_HALF_MIN;
 }
+/*! \brief minimum value of bfloat16 */
+template<>
+MSHADOW_XINLINE bfloat::bf16_t MinValue<bfloat::bf16_t>(void) {
+  return MSHADOW_BF16_MIN;
+}
 /*! \brief minimum value of int */
 template<>
 MSHADOW_XINLINE int MinValue<int>(void) {
@@ -519,6 +787,11 @@ template<>
 MSHADOW_XINLINE uint8_t MinValue<uint8_t>(void) {
   return 0;
 }
+/*! \brief minimum value of int8 */
+template<>
+MSHADOW_XINLINE int8_t MinValue<int8_t>(void) {
+  return SCHAR_MIN;
+}
 }  // namespace limits
 
 /*! \brief sum reducer */
@@ -622,6 +895,12 @@ struct minimum {
       {__VA_ARGS__}                                 \
     }                                               \
     break;                                          \
+  case mshadow::kBfloat16:                          \
+    {                                               \
+      typedef mshadow::bfloat::bf16_t DType;        \
+      {__VA_ARGS__}                                 \
+    }                                               \
+    break;                                          \
   case mshadow::kUint8:                             \
     {                                               \
       typedef uint8_t DType;                        \
@@ -634,6 +913,12 @@ struct minimum {
       {__VA_ARGS__}                                 \
     }                                               \
     break;                                          \
+  case mshadow::kInt8:                              \
+    {                                               \
+      typedef int8_t DType;                         \
+      {__VA_ARGS__}                                 \
+    }                                               \
+    break;                                          \
   default:                                          \
     LOG(FATAL) << "Unknown type enum " << type;     \
   }
@@ -658,6 +943,12 @@ struct minimum {
       {__VA_ARGS__}                                 \
     }                                               \
     break;                                          \
+  case mshadow::kBfloat16:                          \
+    {                                               \
+      typedef mshadow::bfloat::bf16_t DType;        \
+      {__VA_ARGS__}                                 \
+    }                                               \
+    break;                                          \
   case mshadow::kUint8:                             \
     LOG(FATAL) << "This operation only support "    \
                   "floating point types not uint8"; \
@@ -666,6 +957,10 @@ struct minimum {
     LOG(FATAL) << "This operation only support "      \
                   "floating point types, not int32";  \
     break;                                            \
+  case mshadow::kInt8:                                \
+    LOG(FATAL) << "This operation only support "      \
+                  "floating point types, not int8";   \
+    break;                                            \
   default:                                            \
     LOG(FATAL) << "Unknown type enum " << type;       \
   }
@@ -0,0 +1,157 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file bfloat.h
+ * \brief definition of bfloat16 type, the upper half of a float:
+ *  the range of float with 8 bits of precision.
+ *  Arithmetic is done in float, conversion from float rounds to nearest even.
+ */
+#ifndef MSHADOW_BFLOAT_H_
+#define MSHADOW_BFLOAT_H_
+#include "./base.h"
+
+/*! \brief namespace for mshadow */
+namespace mshadow {
+/* \brief name space for host/device portable bfloat16 floats */
+namespace bfloat {
+#define MSHADOW_BF16_OPERATOR(RTYPE, OP)                                  \
+  MSHADOW_XINLINE RTYPE operator OP (bf16_t a, bf16_t b) {                \
+    return RTYPE(float(a) OP float(b));  /* NOLINT(*) */                  \
+  }                                                                       \
+  template<typename T>                                                    \
+  MSHADOW_XINLINE RTYPE operator OP (bf16_t a, T b) {                     \
+    return RTYPE(float(a) OP float(b));  /* NOLINT(*) */                  \
+  }                                                                       \
+  template<typename T>                                                    \
+  MSHADOW_XINLINE RTYPE operator OP (T a, bf16_t b) {                     \
+    return RTYPE(float(a) OP float(b));  /* NOLINT(*) */                  \
+  }
+
+#define MSHADOW_BF16_ASSIGNOP(AOP, OP)                                    \
+  template<typename T>                                                    \
+  MSHADOW_XINLINE bf16_t operator AOP (const T& a) {                      \
+    return *this = bf16_t(float(*this) OP float(a));  /* NOLINT(*)*/      \
+  }                                                                       \
+  template<typename T>                                                    \
+  MSHADOW_XINLINE bf16_t operator AOP (const volatile T& a) volatile {    \
+    return *this = bf16_t(float(*this) OP float(a));  /* NOLINT(*)*/      \
+  }
+
+#define MSHADOW_BF16_CONVERSIONOP(T)                                      \
+  MSHADOW_XINLINE operator T() const {                                    \
+    return T(bf162float(bf16_));  /* NOLINT(*)*/                          \
+  }                                                                       \
+  MSHADOW_XINLINE operator T() const volatile {                           \
+    return T(bf162float(bf16_));  /* NOLINT(*)*/                          \
+  }
+
+class bf16_t {
+ public:
+  uint16_t bf16_;
+
+  static MSHADOW_XINLINE bf16_t Binary(uint16_t value) {
+    bf16_t res;
+    res.bf16_ = value;
+    return res;
+  }
+
+  MSHADOW_XINLINE bf16_t() {}
+
+  MSHADOW_XINLINE bf16_t(const float& value) { constructor(value); }
+  MSHADOW_XINLINE explicit bf16_t(const double& value) { constructor(value); }
+  MSHADOW_XINLINE explicit bf16_t(const uint8_t& value) { constructor(value); }
+  MSHADOW_XINLINE explicit bf16_t(const int32_t& value) { constructor(value); }
+  MSHADOW_XINLINE explicit bf16_t(const uint32_t& value) { constructor(value); }
+  MSHADOW_XINLINE explicit bf16_t(const int64_t& value) { constructor(value); }
+  MSHADOW_XINLINE explicit bf16_t(const uint64_t& value) { constructor(value); }
+
+  MSHADOW_BF16_CONVERSIONOP(float)
+
+  MSHADOW_BF16_ASSIGNOP(+=, +)
+  MSHADOW_BF16_ASSIGNOP(-=, -)
+  MSHADOW_BF16_ASSIGNOP(*=, *)
+  MSHADOW_BF16_ASSIGNOP(/=, /)
+
+  MSHADOW_XINLINE bf16_t operator+() {
+    return *this;
+  }
+
+  MSHADOW_XINLINE bf16_t operator-() {
+    return Binary(bf16_ ^ 0x8000);
+  }
+
+  MSHADOW_XINLINE bf16_t operator=(const bf16_t& a) {
+    bf16_ = a.bf16_;
+    return a;
+  }
+
+  template<typename T>
+  MSHADOW_XINLINE bf16_t operator=(const T& a) {
+    return *this = bf16_t(a);  /* NOLINT(*)*/
+  }
+
+  MSHADOW_XINLINE bf16_t operator=(const bf16_t& a) volatile {
+    bf16_ = a.bf16_;
+    return a;
+  }
+
+  template<typename T>
+  MSHADOW_XINLINE bf16_t operator=(const T& a) volatile {
+    return *this = bf16_t(a);  /* NOLINT(*)*/
+  }
+
+ private:
+  union Bits {
+    float f;
+    uint32_t ui;
+  };
+
+  MSHADOW_XINLINE static uint16_t float2bf16(const float& value) {
+    Bits v;
+    v.f = value;
+    // keep nan a nan, the payload may sit in the bits that are dropped
+    if ((v.ui & 0x7FFFFFFFU) > 0x7F800000U) return (v.ui >> 16) | 0x0040U;
+    // round to nearest even, overflow goes to inf
+    v.ui += 0x7FFFU + ((v.ui >> 16) & 1U);
+    return v.ui >> 16;
+  }
+
+  MSHADOW_XINLINE static float bf162float(const uint16_t& value) {
+    Bits v;
+    v.ui = static_cast<uint32_t>(value) << 16;
+    return v.f;
+  }
+
+  MSHADOW_XINLINE static float bf162float(const volatile uint16_t& value) {  // NOLINT(*)
+    Bits v;
+    v.ui = static_cast<uint32_t>(value) << 16;
+    return v.f;
+  }
+
+  template<typename T>
+  MSHADOW_XINLINE void constructor(const T& value) {
+    bf16_ = float2bf16(float(value));  // NOLINT(*)
+  }
+};
+
+/*! \brief overloaded + operator for bf16_t */
+MSHADOW_BF16_OPERATOR(bf16_t, +)
+/*! \brief overloaded - operator for bf16_t */
+MSHADOW_BF16_OPERATOR(bf16_t, -)
+/*! \brief overloaded * operator for bf16_t */
+MSHADOW_BF16_OPERATOR(bf16_t, *)
+/*! \brief overloaded / operator for bf16_t */
+MSHADOW_BF16_OPERATOR(bf16_t, /)
+/*! \brief overloaded > operator for bf16_t */
+MSHADOW_BF16_OPERATOR(bool, >)
+/*! \brief overloaded < operator for bf16_t */
+MSHADOW_BF16_OPERATOR(bool, <)
+/*! \brief overloaded >= operator for bf16_t */
+MSHADOW_BF16_OPERATOR(bool, >=)
+/*! \brief overloaded <= operator for bf16_t */
+MSHADOW_BF16_OPERATOR(bool, <=)
+
+/*! \brief smallest finite bf16_t, the negative of the largest */
+#define MSHADOW_BF16_MIN mshadow::bfloat::bf16_t::Binary(0xFF7F)
+}  // namespace bfloat
+}  // namespace mshadow
+#endif  // MSHADOW_BFLOAT_H_
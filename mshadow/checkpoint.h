@@ -0,0 +1,396 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file checkpoint.h
+ * \brief a versioned container of named tensors that can be memory mapped,
+ *  so tensors are used in place without reading them into new memory.
+ *
+ *  Layout of the file, all integers of the header, index and trailer are little endian,
+ *  the tensor data is in the byte order of the host that wrote it, as it is mapped in place:
+ *   - header:  magic "MSHDCKPT", uint32 version, uint32 alignment
+ *   - data:    data of each tensor, each starts at a multiple of alignment
+ *   - index:   for each tensor, uint32 name length, name,
+ *              int32 type flag, int32 layout, uint32 ndim, uint64 shape[ndim],
+ *              uint64 offset, uint64 number of bytes
+ *   - trailer: uint64 offset of index, uint64 number of tensors, magic "MSHDCKPT"
+ *  The index is at the end, so the writer needs no seek.
+ */
+#ifndef MSHADOW_CHECKPOINT_H_
+#define MSHADOW_CHECKPOINT_H_
+#include <stdint.h>
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include "./tensor.h"
+#include "./tensor_blob.h"
+
+namespace mshadow {
+/*! \brief constants of the checkpoint format */
+struct CheckpointFormat {
+  /*! \brief current version */
+  static const uint32_t kVersion = 1;
+  /*! \brief default alignment of tensor data, enough for any packet load */
+  static const uint32_t kAlign = 64;
+  /*! \brief size of the magic */
+  static const size_t kMagicSize = 8;
+  /*! \brief size of header */
+  static const size_t kHeaderSize = kMagicSize + 2 * sizeof(uint32_t);
+  /*! \brief size of trailer */
+  static const size_t kTrailerSize = 2 * sizeof(uint64_t) + kMagicSize;
+  /*! \return the magic */
+  inline static const char *Magic(void) {
+    return "MSHDCKPT";
+  }
+  /*! \brief convert integer v between host and little endian byte order */
+  template<typename T>
+  inline static T LittleEndian(T v) {
+    const uint16_t probe = 1;
+    if (*reinterpret_cast<const char*>(&probe) == 1) return v;
+    char *bytes = reinterpret_cast<char*>(&v);
+    std::reverse(bytes, bytes + sizeof(T));
+    return v;
+  }
+};
+/*!
+ * \brief write tensors into checkpoint format
+ * \tparam TStream type of stream, need to support Write, one example is utils::IStream.
+ */
+template<typename TStream>
+class CheckpointWriter {
+ public:
+  /*!
+   * \brief constructor, writes the header
+   * \param fo the output stream, must be kept alive until Finish
+   * \param align alignment of tensor data in file, must be power of 2
+   */
+  explicit CheckpointWriter(TStream *fo, uint32_t align = CheckpointFormat::kAlign)
+      : fo_(fo), align_(align), offset_(0), finished_(false) {
+    CHECK(align != 0 && (align & (align - 1)) == 0)
+        << "CheckpointWriter: alignment must be power of 2";
+    this->Write(CheckpointFormat::Magic(), CheckpointFormat::kMagicSize);
+    this->WriteInt(CheckpointFormat::kVersion);
+    this->WriteInt(align_);
+  }
+  ~CheckpointWriter(void) {
+    if (!finished_) this->Finish();
+  }
+  /*!
+   * \brief add a tensor
+   * \param name name of the tensor, must be unique
+   * \param src the tensor
+   * \param layout layout flag of the tensor
+   */
+  template<int dim, typename DType>
+  inline void Add(const std::string &name, const Tensor<cpu, dim, DType> &src,
+                  int layout = default_layout) {
+    this->Add(name, TBlob(src), layout);
+  }
+  /*!
+   * \brief add a tensor in TBlob
+   * \param name name of the tensor, must be unique
+   * \param src the tensor, must lie in cpu
+   * \param layout layout flag of the tensor
+   */
+  inline void Add(const std::string &name, const TBlob &src, int layout = default_layout) {
+    CHECK(!finished_) << "CheckpointWriter: already finished";
+    CHECK_EQ(src.dev_mask_, cpu::kDevMask) << "CheckpointWriter: tensor must lie in cpu";
+    CHECK_EQ(names_.count(name), 0U) << "CheckpointWriter: duplicated name " << name;
+    names_[name] = entries_.size();
+    const size_t elem = mshadow_sizeof(src.type_flag_);
+    const index_t ndim = src.shape_.ndim();
+    const size_t ncol = ndim == 0 ? 1 : src.shape_[ndim - 1];
+    const size_t nrow = ncol == 0 ? 0 : src.shape_.Size() / ncol;
+    // pad to alignment
+    static const char zeros[CheckpointFormat::kAlign * 64] = {0};
+    size_t pad = (align_ - offset_ % align_) % align_;
+    while (pad != 0) {
+      size_t n = std::min(pad, sizeof(zeros));
+      this->Write(zeros, n);
+      pad -= n;
+    }
+    Entry e;
+    e.name = name;
+    e.type_flag = src.type_flag_;
+    e.layout = layout;
+    for (index_t i = 0; i < ndim; ++i) e.shape.push_back(src.shape_[i]);
+    e.offset = offset_;
+    e.nbytes = nrow * ncol * elem;
+    // rows may be padded by stride
+    const char *dptr = static_cast<const char*>(src.dptr_);
+    if (src.stride_ == ncol) {
+      this->Write(dptr, e.nbytes);
+    } else {
+      for (size_t i = 0; i < nrow; ++i) {
+        this->Write(dptr + i * src.stride_ * elem, ncol * elem);
+      }
+    }
+    entries_.push_back(e);
+  }
+  /*! \brief write the index and trailer, no tensor can be added afterwards */
+  inline void Finish(void) {
+    CHECK(!finished_) << "CheckpointWriter: already finished";
+    const uint64_t index_offset = offset_;
+    for (size_t i = 0; i < entries_.size(); ++i) {
+      const Entry &e = entries_[i];
+      const uint32_t len = static_cast<uint32_t>(e.name.length());
+      const int32_t type_flag = e.type_flag, layout = e.layout;
+      const uint32_t ndim = static_cast<uint32_t>(e.shape.size());
+      this->WriteInt(len);
+      this->Write(e.name.c_str(), len);
+      this->WriteInt(type_flag);
+      this->WriteInt(layout);
+      this->WriteInt(ndim);
+      for (uint32_t k = 0; k < ndim; ++k) this->WriteInt(e.shape[k]);
+      this->WriteInt(e.offset);
+      this->WriteInt(e.nbytes);
+    }
+    const uint64_t count = entries_.size();
+    this->WriteInt(index_offset);
+    this->WriteInt(count);
+    this->Write(CheckpointFormat::Magic(), CheckpointFormat::kMagicSize);
+    finished_ = true;
+  }
+
+ private:
+  struct Entry {
+    std::string name;
+    int type_flag;
+    int layout;
+    std::vector<uint64_t> shape;
+    uint64_t offset;
+    uint64_t nbytes;
+  };
+  inline void Write(const void *ptr, size_t size) {
+    if (size == 0) return;
+    fo_->Write(ptr, size);
+    offset_ += size;
+  }
+  // write an integer in little endian
+  template<typename T>
+  inline void WriteInt(T v) {
+    v = CheckpointFormat::LittleEndian(v);
+    this->Write(&v, sizeof(v));
+  }
+  /*! \brief output stream */
+  TStream *fo_;
+  /*! \brief alignment of data */
+  uint32_t align_;
+  /*! \brief number of bytes written */
+  uint64_t offset_;
+  /*! \brief whether index is written */
+  bool finished_;
+  /*! \brief entries written */
+  std::vector<Entry> entries_;
+  /*! \brief map name to index in entries */
+  std::map<std::string, size_t> names_;
+};
+/*!
+ * \brief a memory mapped checkpoint, the tensors are views of the mapped pages,
+ *  they are valid until the checkpoint is closed.
+ *  Read only mapping shares the pages with other processes mapping the same file,
+ *  writing to a read only view crashes, open with writable to get copy on write views.
+ */
+class MappedCheckpoint {
+ public:
+  MappedCheckpoint(void) : data_(NULL), size_(0) {
+#ifdef _WIN32
+    file_ = INVALID_HANDLE_VALUE;
+    mapping_ = NULL;
+#endif
+  }
+  ~MappedCheckpoint(void) {
+    this->Close();
+  }
+  /*!
+   * \brief map a checkpoint file
+   * \param path path to the file
+   * \param writable whether the views can be written, writes are private to the process
+   */
+  inline void Open(const std::string &path, bool writable = false) {
+    this->Close();
+#ifdef _WIN32
+    file_ = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, NULL,
+                        OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    CHECK(file_ != INVALID_HANDLE_VALUE) << "MappedCheckpoint: cannot open " << path;
+    LARGE_INTEGER fsize;
+    CHECK(GetFileSizeEx(file_, &fsize)) << "MappedCheckpoint: cannot stat " << path;
+    size_ = static_cast<size_t>(fsize.QuadPart);
+    mapping_ = CreateFileMappingA(file_, NULL, writable ? PAGE_WRITECOPY : PAGE_READONLY,
+                                  0, 0, NULL);
+    CHECK(mapping_ != NULL) << "MappedCheckpoint: cannot map " << path;
+    data_ = static_cast<char*>(MapViewOfFile(
+        mapping_, writable ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0));
+    CHECK(data_ != NULL) << "MappedCheckpoint: cannot map " << path;
+#else
+    int fd = open(path.c_str(), O_RDONLY);
+    CHECK_GE(fd, 0) << "MappedCheckpoint: cannot open " << path << ": " << strerror(errno);
+    struct stat st;
+    CHECK_EQ(fstat(fd, &st), 0) << "MappedCheckpoint: cannot stat " << path;
+    size_ = static_cast<size_t>(st.st_size);
+    CHECK_GE(size_, CheckpointFormat::kHeaderSize + CheckpointFormat::kTrailerSize)
+        << "MappedCheckpoint: " << path << " is not a checkpoint";
+    void *p = mmap(NULL, size_, writable ? PROT_READ | PROT_WRITE : PROT_READ,
+                   writable ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+    close(fd);
+    CHECK(p != MAP_FAILED) << "MappedCheckpoint: cannot map " << path << ": " << strerror(errno);
+    data_ = static_cast<char*>(p);
+#endif
+    this->ParseIndex(path);
+  }
+  /*! \brief unmap the file, all views become invalid */
+  inline void Close(void) {
+    if (data_ == NULL) return;
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+    CloseHandle(mapping_);
+    CloseHandle(file_);
+    mapping_ = NULL;
+    file_ = INVALID_HANDLE_VALUE;
+#else
+    munmap(data_, size_);
+#endif
+    data_ = NULL;
+    size_ = 0;
+    entries_.clear();
+    names_.clear();
+  }
+  /*! \return number of tensors */
+  inline size_t size(void) const {
+    return entries_.size();
+  }
+  /*! \return name of i-th tensor */
+  inline const std::string &name(size_t i) const {
+    return entries_[i].name;
+  }
+  /*! \return layout flag of i-th tensor */
+  inline int layout(size_t i) const {
+    return entries_[i].layout;
+  }
+  /*! \return whether there is a tensor of name */
+  inline bool Has(const std::string &name) const {
+    return names_.count(name) != 0;
+  }
+  /*! \return the i-th tensor */
+  inline TBlob GetBlob(size_t i) const {
+    const Entry &e = entries_[i];
+    return TBlob(data_ + e.offset, e.shape, cpu::kDevMask, e.type_flag);
+  }
+  /*! \return the tensor of name */
+  inline TBlob GetBlob(const std::string &name) const {
+    return this->GetBlob(this->Find(name));
+  }
+  /*!
+   * \return the tensor of name
+   * \tparam dim dimension of tensor, must match the saved one
+   * \tparam DType type of element, must match the saved one
+   */
+  template<int dim, typename DType>
+  inline Tensor<cpu, dim, DType> Get(const std::string &name) const {
+    const size_t i = this->Find(name);
+    CHECK_EQ(entries_[i].shape.ndim(), static_cast<index_t>(dim))
+        << "MappedCheckpoint: dimension of " << name << " does not match";
+    return this->GetBlob(i).get<cpu, dim, DType>();
+  }
+
+ private:
+  struct Entry {
+    std::string name;
+    int type_flag;
+    int layout;
+    TShape shape;
+    uint64_t offset;
+  };
+  // read from the mapped file with bound check
+  inline void Read(size_t *pos, void *dst, size_t n) const {
+    CHECK_LE(*pos + n, size_) << "MappedCheckpoint: file is truncated";
+    std::memcpy(dst, data_ + *pos, n);
+    *pos += n;
+  }
+  // read a little endian integer
+  template<typename T>
+  inline void ReadInt(size_t *pos, T *dst) const {
+    this->Read(pos, dst, sizeof(T));
+    *dst = CheckpointFormat::LittleEndian(*dst);
+  }
+  inline size_t Find(const std::string &name) const {
+    std::map<std::string, size_t>::const_iterator it = names_.find(name);
+    CHECK(it != names_.end()) << "MappedCheckpoint: cannot find tensor " << name;
+    return it->second;
+  }
+  inline void ParseIndex(const std::string &path) {
+    const size_t kMagicSize = CheckpointFormat::kMagicSize;
+    CHECK_GE(size_, CheckpointFormat::kHeaderSize + CheckpointFormat::kTrailerSize)
+        << "MappedCheckpoint: " << path << " is not a checkpoint";
+    CHECK_EQ(std::memcmp(data_, CheckpointFormat::Magic(), kMagicSize), 0)
+        << "MappedCheckpoint: " << path << " is not a checkpoint";
+    size_t pos = kMagicSize;
+    uint32_t version, align;
+    this->ReadInt(&pos, &version);
+    this->ReadInt(&pos, &align);
+    CHECK(align != 0 && (align & (align - 1)) == 0)
+        << "MappedCheckpoint: " << path << " has invalid alignment";
+    CHECK_LE(version, CheckpointFormat::kVersion)
+        << "MappedCheckpoint: " << path << " has newer version " << version;
+    pos = size_ - CheckpointFormat::kTrailerSize;
+    uint64_t index_offset, count;
+    this->ReadInt(&pos, &index_offset);
+    this->ReadInt(&pos, &count);
+    CHECK_EQ(std::memcmp(data_ + pos, CheckpointFormat::Magic(), kMagicSize), 0)
+        << "MappedCheckpoint: " << path << " is truncated";
+    pos = static_cast<size_t>(index_offset);
+    for (uint64_t i = 0; i < count; ++i) {
+      Entry e;
+      uint32_t len, ndim;
+      int32_t type_flag, layout;
+      uint64_t nbytes;
+      this->ReadInt(&pos, &len);
+      CHECK_LE(pos + len, size_) << "MappedCheckpoint: file is truncated";
+      e.name.assign(data_ + pos, len);
+      pos += len;
+      this->ReadInt(&pos, &type_flag);
+      this->ReadInt(&pos, &layout);
+      this->ReadInt(&pos, &ndim);
+      std::vector<index_t> shape(ndim);
+      for (uint32_t k = 0; k < ndim; ++k) {
+        uint64_t s;
+        this->ReadInt(&pos, &s);
+        shape[k] = static_cast<index_t>(s);
+      }
+      this->ReadInt(&pos, &e.offset);
+      this->ReadInt(&pos, &nbytes);
+      e.type_flag = type_flag;
+      e.layout = layout;
+      e.shape = TShape(shape.begin(), shape.end());
+      CHECK_LE(e.offset + nbytes, index_offset)
+          << "MappedCheckpoint: tensor " << e.name << " is out of range";
+      CHECK_EQ(nbytes, e.shape.Size() * mshadow_sizeof(e.type_flag))
+          << "MappedCheckpoint: size of tensor " << e.name << " does not match its shape";
+      names_[e.name] = entries_.size();
+      entries_.push_back(e);
+    }
+  }
+  /*! \brief start of mapped file */
+  char *data_;
+  /*! \brief size of mapped file */
+  size_t size_;
+#ifdef _WIN32
+  HANDLE file_;
+  HANDLE mapping_;
+#endif
+  /*! \brief entries in the file */
+  std::vector<Entry> entries_;
+  /*! \brief map name to index in entries */
+  std::map<std::string, size_t> names_;
+};
+}  // namespace mshadow
+#endif  // MSHADOW_CHECKPOINT_H_
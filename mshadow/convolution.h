@@ -0,0 +1,341 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file convolution.h
+ * \brief 2D convolution of NCHW images, without unpacking the patches of the whole batch.
+ *  The patches of a band of output rows are unpacked into a buffer of the workspace
+ *  and multiplied with the weight, so the scratch space is bounded by MSHADOW_CONV_TILE_BYTES
+ *  instead of kernel_y * kernel_x times the input. cuDNN is used on GPU when enabled.
+ */
+#ifndef MSHADOW_CONVOLUTION_H_
+#define MSHADOW_CONVOLUTION_H_
+#include <algorithm>
+#include "./tensor.h"
+#include "./workspace.h"
+
+/*! \brief bytes of the buffer the patches of one band of output rows are unpacked into */
+#ifndef MSHADOW_CONV_TILE_BYTES
+#define MSHADOW_CONV_TILE_BYTES (1UL << 24)
+#endif
+
+namespace mshadow {
+/*! \brief geometry of a 2D convolution, the weight is nfilter x (channel * kernel_y * kernel_x) */
+struct ConvParam {
+  /*! \brief kernel size */
+  index_t kernel_y, kernel_x;
+  /*! \brief stride */
+  index_t stride_y, stride_x;
+  /*! \brief zero padding on each side */
+  index_t pad_y, pad_x;
+  /*! \brief dilation of the kernel */
+  index_t dilate_y, dilate_x;
+  /*! \brief square kernel */
+  explicit ConvParam(index_t kernel, index_t stride = 1, index_t pad = 0, index_t dilate = 1)
+      : kernel_y(kernel), kernel_x(kernel), stride_y(stride), stride_x(stride),
+        pad_y(pad), pad_x(pad), dilate_y(dilate), dilate_x(dilate) {}
+  /*!
+   * \brief the output shape
+   * \param ishape shape of the input, batch x channel x height x width
+   * \param nfilter number of filters
+   */
+  inline Shape<4> OutShape(const Shape<4> &ishape, index_t nfilter) const {
+    const index_t ey = dilate_y * (kernel_y - 1) + 1, ex = dilate_x * (kernel_x - 1) + 1;
+    CHECK(ishape[2] + 2 * pad_y >= ey && ishape[3] + 2 * pad_x >= ex)
+        << "Convolution: image smaller than the kernel";
+    return Shape4(ishape[0], nfilter, (ishape[2] + 2 * pad_y - ey) / stride_y + 1,
+                  (ishape[3] + 2 * pad_x - ex) / stride_x + 1);
+  }
+  /*! \brief whether the patches are the image itself */
+  inline bool IsPointwise(void) const {
+    return kernel_y == 1 && kernel_x == 1 && stride_y == 1 && stride_x == 1 &&
+        pad_y == 0 && pad_x == 0;
+  }
+};
+/*!
+ * \brief unpack the patches of the output positions [begin, begin + col.size(1)) of an image,
+ *  row (c * kernel_y + ky) * kernel_x + kx of col holds the pixels under that kernel tap
+ * \param img the image, channel x height x width
+ * \param col the patches, (channel * kernel_y * kernel_x) x number of positions
+ * \param param the convolution
+ * \param oshape the output shape, only the height and width are used
+ * \param begin first output position, flattened as y * width + x
+ */
+template<typename DType>
+inline void ConvIm2Col(const Tensor<cpu, 3, DType> &img, Tensor<cpu, 2, DType> col,
+                       const ConvParam &param, const Shape<4> &oshape, index_t begin) {
+  WaitPushedTasks(col.stream_);
+  const index_t ksize = param.kernel_y * param.kernel_x, np = col.size(1), owidth = oshape[3];
+  const int height = img.size(1), width = img.size(2);
+#ifdef _OPENMP
+  const int nthread = GetNumParallelThread(col.stream_, col.shape_.Size());
+#endif
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t r = 0; r < col.size(0); ++r) {
+    const index_t c = r / ksize, ky = r % ksize / param.kernel_x, kx = r % param.kernel_x;
+    const int dy = static_cast<int>(ky * param.dilate_y) - static_cast<int>(param.pad_y);
+    const int dx = static_cast<int>(kx * param.dilate_x) - static_cast<int>(param.pad_x);
+    DType *out = col[r].dptr_;
+    index_t oy = begin / owidth, ox = begin % owidth;
+    for (index_t j = 0; j < np; ++j) {
+      const int iy = static_cast<int>(oy * param.stride_y) + dy;
+      const int ix = static_cast<int>(ox * param.stride_x) + dx;
+      out[j] = (iy >= 0 && iy < height && ix >= 0 && ix < width) ? img[c][iy][ix] : DType(0);
+      if (++ox == owidth) {
+        ox = 0; ++oy;
+      }
+    }
+  }
+}
+/*!
+ * \brief add the patches of the output positions [begin, begin + col.size(1)) back into
+ *  the pixels they were unpacked from, the reverse of ConvIm2Col
+ */
+template<typename DType>
+inline void ConvCol2Im(const Tensor<cpu, 2, DType> &col, Tensor<cpu, 3, DType> img,
+                       const ConvParam &param, const Shape<4> &oshape, index_t begin) {
+  WaitPushedTasks(img.stream_);
+  const index_t ksize = param.kernel_y * param.kernel_x, np = col.size(1), owidth = oshape[3];
+  const int height = img.size(1), width = img.size(2);
+  // the channels touch disjoint pixels, each is added in a fixed order
+#ifdef _OPENMP
+  const int nthread = std::min(GetNumParallelThread(col.stream_, col.shape_.Size()),
+                               static_cast<int>(img.size(0)));
+#endif
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t c = 0; c < img.size(0); ++c) {
+    for (index_t k = 0; k < ksize; ++k) {
+      const index_t ky = k / param.kernel_x, kx = k % param.kernel_x;
+      const int dy = static_cast<int>(ky * param.dilate_y) - static_cast<int>(param.pad_y);
+      const int dx = static_cast<int>(kx * param.dilate_x) - static_cast<int>(param.pad_x);
+      const DType *in = col[c * ksize + k].dptr_;
+      index_t oy = begin / owidth, ox = begin % owidth;
+      for (index_t j = 0; j < np; ++j) {
+        const int iy = static_cast<int>(oy * param.stride_y) + dy;
+        const int ix = static_cast<int>(ox * param.stride_x) + dx;
+        if (iy >= 0 && iy < height && ix >= 0 && ix < width) img[c][iy][ix] += in[j];
+        if (++ox == owidth) {
+          ox = 0; ++oy;
+        }
+      }
+    }
+  }
+}
+/*! \brief GPU version of ConvIm2Col */
+template<typename DType>
+inline void ConvIm2Col(const Tensor<gpu, 3, DType> &img, Tensor<gpu, 2, DType> col,
+                       const ConvParam &param, const Shape<4> &oshape, index_t begin);
+/*! \brief GPU version of ConvCol2Im */
+template<typename DType>
+inline void ConvCol2Im(const Tensor<gpu, 2, DType> &col, Tensor<gpu, 3, DType> img,
+                       const ConvParam &param, const Shape<4> &oshape, index_t begin);
+/*!
+ * \brief convolution as a GEMM over bands of output rows, the patches of a band are
+ *  unpacked into a buffer of the workspace just before they are multiplied.
+ *  Images whose rows are packed are multiplied in place, 1x1 convolutions of stride 1
+ *  then use the image directly; padded images go through a buffer.
+ * \tparam Device which device the tensors are on
+ * \tparam DType type of element in tensor
+ */
+template<typename Device, typename DType>
+struct ConvTiledEngine {
+  /*! \brief number of output rows in a band, the patches of a band fit in the tile */
+  inline static index_t BandRows(index_t nrow, const Shape<4> &oshape) {
+    const size_t row_bytes = static_cast<size_t>(nrow) * oshape[3] * sizeof(DType);
+    const index_t band = static_cast<index_t>(MSHADOW_CONV_TILE_BYTES / row_bytes);
+    return std::max(index_t(1), std::min(band, oshape[2]));
+  }
+  /*! \brief whether the planes of the images have no padding */
+  inline static bool Packed(const Tensor<Device, 4, DType> &t) {
+    return t.stride_ == t.size(3);
+  }
+  /*! \brief rows [y, y + ny) of all the channels of a packed image, channel x (ny * width) */
+  inline static Tensor<Device, 2, DType> Rows(const Tensor<Device, 3, DType> &t,
+                                              index_t y, index_t ny) {
+    return Tensor<Device, 2, DType>(t.dptr_ + y * t.size(2), Shape2(t.size(0), ny * t.size(2)),
+                                    t.size(1) * t.size(2), t.stream_);
+  }
+  /*! \brief copy rows [y, y + ny) of an image to or from a channel x (ny * width) matrix */
+  inline static void CopyRows(Tensor<Device, 2, DType> mat, Tensor<Device, 3, DType> t,
+                              index_t y, index_t ny, bool to_mat) {
+    const index_t width = t.size(2);
+    for (index_t i = 0; i < ny; ++i) {
+      Tensor<Device, 2, DType> row(t.dptr_ + (y + i) * t.stride_, Shape2(t.size(0), width),
+                                   t.size(1) * t.stride_, t.stream_);
+      Tensor<Device, 2, DType> part(mat.dptr_ + i * width, Shape2(t.size(0), width),
+                                    mat.stride_, t.stream_);
+      if (to_mat) {
+        Copy(part, row, t.stream_);
+      } else {
+        Copy(row, part, t.stream_);
+      }
+    }
+  }
+  /*! \brief the patches of rows [y, y + ny) of the output, unpacked into buf if needed */
+  inline static Tensor<Device, 2, DType> Patches(const Tensor<Device, 4, DType> &in, index_t n,
+                                                 const Tensor<Device, 2, DType> &buf,
+                                                 const ConvParam &param,
+                                                 const Shape<4> &oshape,
+                                                 index_t y, index_t ny) {
+    if (param.IsPointwise() && Packed(in)) return Rows(in[n], y, ny);
+    Tensor<Device, 2, DType> col(buf.dptr_, Shape2(buf.size(0), ny * oshape[3]), in.stream_);
+    ConvIm2Col(in[n], col, param, oshape, y * oshape[3]);
+    return col;
+  }
+  /*! \brief rows [y, y + ny) of an output sized image, copied into buf if it is padded */
+  inline static Tensor<Device, 2, DType> Load(const Tensor<Device, 4, DType> &t, index_t n,
+                                              const Tensor<Device, 2, DType> &buf,
+                                              index_t y, index_t ny) {
+    if (Packed(t)) return Rows(t[n], y, ny);
+    Tensor<Device, 2, DType> mat(buf.dptr_, Shape2(buf.size(0), ny * t.size(3)), t.stream_);
+    CopyRows(mat, t[n], y, ny, true);
+    return mat;
+  }
+  /*! \brief scratch buffer of rows x (band * width), empty when it is not needed */
+  inline static Tensor<Device, 2, DType> Buffer(bool need, index_t rows, index_t band,
+                                                const Shape<4> &oshape, Workspace<Device> *ws) {
+    if (!need) return Tensor<Device, 2, DType>(NULL, Shape2(rows, 0));
+    return ws->template Get<DType>(Shape2(rows, band * oshape[3]));
+  }
+  inline static void Forward(const Tensor<Device, 4, DType> &in,
+                             const Tensor<Device, 2, DType> &weight,
+                             Tensor<Device, 4, DType> out,
+                             const ConvParam &param, Workspace<Device> *ws) {
+    const index_t nrow = weight.size(1), band = BandRows(nrow, out.shape_);
+    const Tensor<Device, 2, DType> col =
+        Buffer(!param.IsPointwise() || !Packed(in), nrow, band, out.shape_, ws);
+    const Tensor<Device, 2, DType> obuf =
+        Buffer(!Packed(out), weight.size(0), band, out.shape_, ws);
+    for (index_t n = 0; n < in.size(0); ++n) {
+      for (index_t y = 0; y < out.size(2); y += band) {
+        const index_t ny = std::min(band, out.size(2) - y);
+        Tensor<Device, 2, DType> dst = Packed(out) ? Rows(out[n], y, ny) :
+            Tensor<Device, 2, DType>(obuf.dptr_, Shape2(obuf.size(0), ny * out.size(3)),
+                                     out.stream_);
+        dst = dot(weight, Patches(in, n, col, param, out.shape_, y, ny));
+        if (!Packed(out)) CopyRows(dst, out[n], y, ny, false);
+      }
+    }
+  }
+  inline static void BackwardData(const Tensor<Device, 4, DType> &grad_out,
+                                  const Tensor<Device, 2, DType> &weight,
+                                  Tensor<Device, 4, DType> grad_in,
+                                  const ConvParam &param, Workspace<Device> *ws) {
+    const index_t nrow = weight.size(1), band = BandRows(nrow, grad_out.shape_);
+    const bool direct = param.IsPointwise() && Packed(grad_in);
+    const Tensor<Device, 2, DType> col = Buffer(!direct, nrow, band, grad_out.shape_, ws);
+    const Tensor<Device, 2, DType> gbuf =
+        Buffer(!Packed(grad_out), weight.size(0), band, grad_out.shape_, ws);
+    if (!direct) grad_in = DType(0);
+    for (index_t n = 0; n < grad_in.size(0); ++n) {
+      for (index_t y = 0; y < grad_out.size(2); y += band) {
+        const index_t ny = std::min(band, grad_out.size(2) - y);
+        const Tensor<Device, 2, DType> src = Load(grad_out, n, gbuf, y, ny);
+        if (direct) {
+          Tensor<Device, 2, DType> dst = Rows(grad_in[n], y, ny);
+          dst = dot(weight.T(), src);
+        } else {
+          Tensor<Device, 2, DType> dst(col.dptr_, Shape2(nrow, ny * grad_out.size(3)),
+                                       grad_in.stream_);
+          dst = dot(weight.T(), src);
+          ConvCol2Im(dst, grad_in[n], param, grad_out.shape_, y * grad_out.size(3));
+        }
+      }
+    }
+  }
+  inline static void BackwardWeight(const Tensor<Device, 4, DType> &grad_out,
+                                    const Tensor<Device, 4, DType> &in,
+                                    Tensor<Device, 2, DType> grad_weight,
+                                    const ConvParam &param, Workspace<Device> *ws) {
+    const index_t nrow = grad_weight.size(1), band = BandRows(nrow, grad_out.shape_);
+    const Tensor<Device, 2, DType> col =
+        Buffer(!param.IsPointwise() || !Packed(in), nrow, band, grad_out.shape_, ws);
+    const Tensor<Device, 2, DType> gbuf =
+        Buffer(!Packed(grad_out), grad_weight.size(0), band, grad_out.shape_, ws);
+    bool first = true;
+    for (index_t n = 0; n < in.size(0); ++n) {
+      for (index_t y = 0; y < grad_out.size(2); y += band) {
+        const index_t ny = std::min(band, grad_out.size(2) - y);
+        const Tensor<Device, 2, DType> src = Load(grad_out, n, gbuf, y, ny);
+        const Tensor<Device, 2, DType> patches =
+            Patches(in, n, col, param, grad_out.shape_, y, ny);
+        if (first) {
+          grad_weight = dot(src, patches.T());
+        } else {
+          grad_weight += dot(src, patches.T());
+        }
+        first = false;
+      }
+    }
+    if (first) grad_weight = DType(0);
+  }
+};
+/*!
+ * \brief the engine the convolutions run on, cuDNN on GPU when it is enabled,
+ *  the tiled GEMM otherwise
+ */
+template<typename Device, typename DType>
+struct ConvEngine : public ConvTiledEngine<Device, DType> {};
+
+/*! \brief check the shapes of the tensors of a convolution */
+template<typename Device, typename DType>
+inline void ConvCheckShape(const Tensor<Device, 4, DType> &in,
+                           const Tensor<Device, 2, DType> &weight,
+                           const Tensor<Device, 4, DType> &out,
+                           const ConvParam &param) {
+  CHECK_EQ(weight.size(1), in.size(1) * param.kernel_y * param.kernel_x)
+      << "Convolution: weight must be nfilter x (channel * kernel_y * kernel_x)";
+  CHECK_EQ(param.OutShape(in.shape_, weight.size(0)), out.shape_)
+      << "Convolution: output shape mismatch";
+}
+/*!
+ * \brief out = convolution of in with weight, a cross correlation as in cuDNN
+ * \param in the input, batch x channel x height x width
+ * \param weight the filters, nfilter x (channel * kernel_y * kernel_x)
+ * \param out the output, of shape param.OutShape(in.shape_, nfilter)
+ * \param param the convolution
+ * \param ws workspace the scratch space is taken from, it stays taken until ws is reset
+ */
+template<typename Device, typename DType>
+inline void ConvolutionForward(const Tensor<Device, 4, DType> &in,
+                               const Tensor<Device, 2, DType> &weight,
+                               Tensor<Device, 4, DType> out,
+                               const ConvParam &param, Workspace<Device> *ws) {
+  ConvCheckShape(in, weight, out, param);
+  ConvEngine<Device, DType>::Forward(in, weight, out, param, ws);
+}
+/*!
+ * \brief grad_in = the gradient of the convolution with respect to its input
+ * \param grad_out the gradient of the output
+ * \param weight the filters
+ * \param grad_in the gradient of the input
+ * \param param the convolution
+ * \param ws workspace the scratch space is taken from, it stays taken until ws is reset
+ */
+template<typename Device, typename DType>
+inline void ConvolutionBackwardData(const Tensor<Device, 4, DType> &grad_out,
+                                    const Tensor<Device, 2, DType> &weight,
+                                    Tensor<Device, 4, DType> grad_in,
+                                    const ConvParam &param, Workspace<Device> *ws) {
+  ConvCheckShape(grad_in, weight, grad_out, param);
+  ConvEngine<Device, DType>::BackwardData(grad_out, weight, grad_in, param, ws);
+}
+/*!
+ * \brief grad_weight = the gradient of the convolution with respect to the filters
+ * \param grad_out the gradient of the output
+ * \param in the input of the convolution
+ * \param grad_weight the gradient of the filters
+ * \param param the convolution
+ * \param ws workspace the scratch space is taken from, it stays taken until ws is reset
+ */
+template<typename Device, typename DType>
+inline void ConvolutionBackwardWeight(const Tensor<Device, 4, DType> &grad_out,
+                                      const Tensor<Device, 4, DType> &in,
+                                      Tensor<Device, 2, DType> grad_weight,
+                                      const ConvParam &param, Workspace<Device> *ws) {
+  ConvCheckShape(in, grad_weight, grad_out, param);
+  ConvEngine<Device, DType>::BackwardWeight(grad_out, in, grad_weight, param, ws);
+}
+}  // namespace mshadow
+#ifdef __CUDACC__
+#include "./cuda/convolution.cuh"
+#endif
+#endif  // MSHADOW_CONVOLUTION_H_
@@ -0,0 +1,475 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file cpu_allocator-inl.h
+ * \brief pluggable allocators of CPU tensor memory, enabled by MSHADOW_USE_CPU_ALLOCATOR.
+ *  AllocSpace, NewTensor, TensorContainer and AllocHost<cpu> take memory from the
+ *  allocator selected for the calling thread, see CPUAllocatorScope.
+ *  Each block records the allocator it came from, so it can be freed by any thread,
+ *  under any selection.
+ */
+#ifndef MSHADOW_CPU_ALLOCATOR_INL_H_
+#define MSHADOW_CPU_ALLOCATOR_INL_H_
+#include "./base.h"
+#include "./logging.h"
+#include "./packet-inl.h"
+
+#if MSHADOW_USE_CPU_ALLOCATOR
+#if !MSHADOW_IN_CXX11
+#error "MSHADOW_USE_CPU_ALLOCATOR requires c++11"
+#endif
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <vector>
+#ifdef __linux__
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+namespace mshadow {
+namespace pool {
+/*!
+ * \brief interface of CPU allocator, blocks must be aligned to kCPUAlign bytes
+ *  and may be freed from any thread. CPUAlloc asks for kCPUAlign bytes more than
+ *  the tensor needs and keeps its tag in the first kCPUAlign bytes of the block.
+ */
+class ICPUAllocator {
+ public:
+  /*! \brief alignment of blocks, wide enough for every packet arch */
+  static const size_t kCPUAlign = 64;
+  /*! \brief virtual destructor */
+  virtual ~ICPUAllocator(void) {}
+  /*!
+   * \brief allocate a block
+   * \param size bytes requested
+   */
+  virtual void *Alloc(size_t size) = 0;
+  /*!
+   * \brief free a block allocated by this allocator
+   * \param ptr the block
+   */
+  virtual void Free(void *ptr) = 0;
+};
+/*! \brief allocate size bytes aligned to align, NULL if out of memory */
+inline void *AlignedAlloc(size_t align, size_t size) {
+#ifdef _MSC_VER
+  return _aligned_malloc(size, align);
+#else
+  void *ptr;
+  return posix_memalign(&ptr, align, size) == 0 ? ptr : NULL;
+#endif
+}
+/*! \brief free a block of AlignedAlloc */
+inline void AlignedRelease(void *ptr) {
+#ifdef _MSC_VER
+  _aligned_free(ptr);
+#else
+  free(ptr);
+#endif
+}
+/*! \brief plain posix_memalign, the allocator used when nothing is selected */
+class DefaultCPUAllocator : public ICPUAllocator {
+ public:
+  /*! \brief get the allocator */
+  inline static DefaultCPUAllocator *Get(void) {
+    // never deleted: blocks may be freed by static destructors
+    static DefaultCPUAllocator *inst = new DefaultCPUAllocator();
+    return inst;
+  }
+  virtual void *Alloc(size_t size) {
+    size_t pitch;
+    return packet::AlignedMallocPitch(&pitch, size, 1);
+  }
+  virtual void Free(void *ptr) {
+    packet::AlignedFree(ptr);
+  }
+};
+/*!
+ * \brief bump allocator with thread-local arenas, for short lived scratch tensors.
+ *  Each thread carves blocks out of its own MSHADOW_CPU_ARENA_CHUNK aligned chunks,
+ *  a chunk counts the blocks living in it, plus one while the thread carves it.
+ *  Once only that reference is left the chunk is rewound, so scratch tensors
+ *  allocated and freed in a loop keep reusing the same memory.
+ *  Blocks larger than half a chunk get a chunk of their own.
+ */
+class ArenaAllocator : public ICPUAllocator {
+ public:
+  /*! \brief size of each chunk */
+  static const size_t kChunk = MSHADOW_CPU_ARENA_CHUNK;
+  /*! \brief get the allocator, the arena used depends on the calling thread */
+  inline static ArenaAllocator *Get(void) {
+    static ArenaAllocator *inst = new ArenaAllocator();
+    return inst;
+  }
+  virtual void *Alloc(size_t size) {
+    size = (size + kCPUAlign - 1) / kCPUAlign * kCPUAlign;
+    if (size > kChunk / 2) {
+      // the block starts within the first kChunk bytes, so Free finds the header
+      return reinterpret_cast<char*>(NewChunk(kCPUAlign + size, 1)) + kCPUAlign;
+    }
+    Arena &a = ThreadArena();
+    if (a.chunk != NULL && a.chunk->live.load(std::memory_order_acquire) == 1) {
+      // only this thread adds blocks, so nothing else can be carved meanwhile
+      a.offset = kCPUAlign;
+    }
+    if (a.chunk == NULL || a.offset + size > kChunk) {
+      if (a.chunk != NULL) Release(a.chunk);
+      a.chunk = NewChunk(kChunk, 1);
+      a.offset = kCPUAlign;
+    }
+    void *ptr = reinterpret_cast<char*>(a.chunk) + a.offset;
+    a.offset += size;
+    a.chunk->live.fetch_add(1, std::memory_order_relaxed);
+    return ptr;
+  }
+  virtual void Free(void *ptr) {
+    Release(reinterpret_cast<Chunk*>(reinterpret_cast<size_t>(ptr) & ~(kChunk - 1)));
+  }
+
+ private:
+  /*! \brief header at the start of each chunk, padded to kCPUAlign */
+  struct Chunk {
+    /*! \brief number of blocks living in the chunk, plus one for the chunk being carved */
+    std::atomic<size_t> live;
+  };
+  /*! \brief arena of a thread */
+  struct Arena {
+    /*! \brief chunk being carved */
+    Chunk *chunk;
+    /*! \brief offset of the next block in chunk */
+    size_t offset;
+    Arena(void) : chunk(NULL), offset(0) {}
+    ~Arena(void) {
+      // blocks still in use keep the chunk alive, the last Free releases it
+      if (chunk != NULL) Release(chunk);
+    }
+  };
+  inline static Arena &ThreadArena(void) {
+    static thread_local Arena arena;
+    return arena;
+  }
+  inline static Chunk *NewChunk(size_t size, size_t live) {
+    void *ptr = AlignedAlloc(kChunk, size);
+    CHECK(ptr != NULL) << "ArenaAllocator: out of memory";
+    Chunk *c = new (ptr) Chunk();
+    c->live.store(live, std::memory_order_relaxed);
+    return c;
+  }
+  inline static void Release(Chunk *c) {
+    if (c->live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+      c->~Chunk();
+      AlignedRelease(c);
+    }
+  }
+};
+/*!
+ * \brief caching pool of blocks backed by transparent huge pages, for large long lived
+ *  tensors such as weights, fewer pages mean fewer TLB misses.
+ *  The first kCPUAlign bytes of a block, where CPUAlloc keeps its tag, lie in a small
+ *  page just before the huge pages, so a tensor of exactly n huge pages takes n of them.
+ *  Blocks smaller than half a huge page are served by DefaultCPUAllocator.
+ */
+class HugePageAllocator : public ICPUAllocator {
+ public:
+  /*! \brief size of a huge page */
+  static const size_t kHugePage = 2UL << 20;
+  /*! \brief get the pool, it lives until the program exits */
+  inline static HugePageAllocator *Get(void) {
+    static HugePageAllocator *pool = new HugePageAllocator();
+    return pool;
+  }
+  virtual void *Alloc(size_t size) {
+    if (size < kHugePage / 2) return DefaultCPUAllocator::Get()->Alloc(size);
+    // huge pages for the bytes after the tag
+    const size_t bytes = (size - kCPUAlign + kHugePage - 1) / kHugePage * kHugePage;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::vector<void*> &bin = free_[bytes];
+      if (bin.size() != 0) {
+        void *ptr = bin.back();
+        bin.pop_back();
+        cached_bytes_ -= bytes;
+        used_[ptr] = bytes;
+        return ptr;
+      }
+    }
+    void *ptr = MapBlock(bytes);
+    if (ptr == NULL) {
+      this->ReleaseAll();
+      ptr = MapBlock(bytes);
+      CHECK(ptr != NULL) << "HugePageAllocator: out of memory";
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    used_[ptr] = bytes;
+    return ptr;
+  }
+  virtual void Free(void *ptr) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::unordered_map<void*, size_t>::iterator it = used_.find(ptr);
+      if (it != used_.end()) {
+        free_[it->second].push_back(ptr);
+        cached_bytes_ += it->second;
+        used_.erase(it);
+        return;
+      }
+    }
+    DefaultCPUAllocator::Get()->Free(ptr);
+  }
+  /*! \brief give every cached block back to the system */
+  inline void ReleaseAll(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::map<size_t, std::vector<void*> >::iterator
+             it = free_.begin(); it != free_.end(); ++it) {
+      for (size_t i = 0; i < it->second.size(); ++i) UnmapBlock(it->second[i], it->first);
+    }
+    free_.clear();
+    cached_bytes_ = 0;
+  }
+  /*! \return bytes cached in the pool */
+  inline size_t cached_bytes(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_bytes_;
+  }
+
+ private:
+  /*! \brief guards all the members below */
+  std::mutex mutex_;
+  /*! \brief cached blocks of each size */
+  std::map<size_t, std::vector<void*> > free_;
+  /*! \brief huge page blocks handed out and their size */
+  std::unordered_map<void*, size_t> used_;
+  /*! \brief statistics */
+  size_t cached_bytes_;
+
+  HugePageAllocator(void) : cached_bytes_(0) {}
+  /*!
+   * \brief map a block whose bytes after the first kCPUAlign are bytes of aligned huge
+   *  pages, NULL if out of memory
+   */
+  inline static void *MapBlock(size_t bytes) {
+#ifdef __linux__
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    const size_t span = page + bytes + kHugePage;
+    void *map = mmap(NULL, span, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) return NULL;
+    // keep one small page before the aligned huge pages and unmap the rest
+    char *base = static_cast<char*>(map);
+    char *data = reinterpret_cast<char*>(
+        (reinterpret_cast<size_t>(base) + page + kHugePage - 1) / kHugePage * kHugePage);
+    if (data - page > base) munmap(base, data - page - base);
+    if (data + bytes < base + span) munmap(data + bytes, base + span - data - bytes);
+#ifdef MADV_HUGEPAGE
+    // only a hint, the kernel may still use small pages
+    madvise(data, bytes, MADV_HUGEPAGE);
+#endif
+#else
+    char *data = static_cast<char*>(AlignedAlloc(kCPUAlign, kCPUAlign + bytes));
+    if (data == NULL) return NULL;
+    data += kCPUAlign;
+#endif
+    return data - kCPUAlign;
+  }
+  /*! \brief unmap a block of MapBlock */
+  inline static void UnmapBlock(void *ptr, size_t bytes) {
+    char *data = static_cast<char*>(ptr) + kCPUAlign;
+#ifdef __linux__
+    const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    munmap(data - page, page + bytes);
+#else
+    AlignedRelease(data - kCPUAlign);
+#endif
+  }
+};
+/*!
+ * \brief places the pages of large blocks on NUMA nodes, either interleaved over all
+ *  the nodes, for tensors every thread reads such as weights, or preferably on one node,
+ *  for tensors computed by the threads of that node. The pages are only placed when
+ *  they are first touched, so no memory is moved. Blocks smaller than kMinBytes, and all
+ *  blocks on hosts with a single node, come from DefaultCPUAllocator.
+ * \code
+ *  // in a task pushed to a Stream<cpu> whose worker runs on the node of the data
+ *  pool::CPUAllocatorScope scope(pool::NUMAAllocator::Local());
+ * \endcode
+ */
+class NUMAAllocator : public ICPUAllocator {
+ public:
+  /*! \brief blocks below this size are not worth a mapping of their own */
+  static const size_t kMinBytes = 1UL << 20;
+  /*! \brief the allocator that interleaves the pages over all the nodes */
+  inline static NUMAAllocator *Interleaved(void) {
+    static NUMAAllocator *pool = new NUMAAllocator(-1);
+    return pool;
+  }
+  /*!
+   * \brief the allocator that places the pages on node, or on another node
+   *  when it is out of memory
+   */
+  inline static NUMAAllocator *Node(int node) {
+    static std::vector<NUMAAllocator*> *pools = MakeNodePools();
+    CHECK(node >= 0 && node < static_cast<int>(pools->size()))
+        << "NUMAAllocator: no node " << node;
+    return (*pools)[node];
+  }
+  /*! \brief the allocator of the node the calling thread runs on */
+  inline static NUMAAllocator *Local(void) {
+    return Node(CurrentNode());
+  }
+  /*! \return number of NUMA nodes of the host, 1 when that is not known */
+  inline static int NumNode(void) {
+    static const int nnode = CountNodes();
+    return nnode;
+  }
+  /*! \return the node the calling thread runs on now */
+  inline static int CurrentNode(void) {
+#if defined(__linux__) && defined(SYS_getcpu)
+    unsigned cpu = 0, node = 0;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0 &&
+        static_cast<int>(node) < NumNode()) {
+      return static_cast<int>(node);
+    }
+#endif
+    return 0;
+  }
+  virtual void *Alloc(size_t size) {
+#if defined(__linux__) && defined(SYS_mbind)
+    if (size >= kMinBytes && NumNode() > 1) {
+      const size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+      const size_t bytes = (size + page - 1) / page * page;
+      void *ptr = mmap(NULL, bytes, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+      CHECK(ptr != MAP_FAILED) << "NUMAAllocator: out of memory";
+      // the policy is only a hint, the pages are usable when it cannot be set
+      const int kMPolPreferred = 1, kMPolInterleave = 3;
+      const size_t kBits = sizeof(unsigned long) * 8;  // NOLINT(*)
+      std::vector<unsigned long> mask(NumNode() / kBits + 1, 0);  // NOLINT(*)
+      for (int i = 0; i < NumNode(); ++i) {
+        if (node_ < 0 || i == node_) mask[i / kBits] |= 1UL << (i % kBits);
+      }
+      syscall(SYS_mbind, ptr, bytes, node_ < 0 ? kMPolInterleave : kMPolPreferred,
+              mask.data(), mask.size() * kBits, 0);
+      std::lock_guard<std::mutex> lock(mutex_);
+      used_[ptr] = bytes;
+      return ptr;
+    }
+#endif
+    return DefaultCPUAllocator::Get()->Alloc(size);
+  }
+  virtual void Free(void *ptr) {
+#if defined(__linux__) && defined(SYS_mbind)
+    size_t bytes = 0;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      std::unordered_map<void*, size_t>::iterator it = used_.find(ptr);
+      if (it != used_.end()) {
+        bytes = it->second;
+        used_.erase(it);
+      }
+    }
+    if (bytes != 0) {
+      munmap(ptr, bytes);
+      return;
+    }
+#endif
+    DefaultCPUAllocator::Get()->Free(ptr);
+  }
+
+ private:
+  /*! \brief the node of the pages, -1 to interleave */
+  int node_;
+  /*! \brief guards used_ */
+  std::mutex mutex_;
+  /*! \brief mapped blocks handed out and their size */
+  std::unordered_map<void*, size_t> used_;
+
+  explicit NUMAAllocator(int node) : node_(node) {}
+  inline static int CountNodes(void) {
+    int nnode = 0;
+#ifdef __linux__
+    while (true) {
+      char path[64];
+      snprintf(path, sizeof(path), "/sys/devices/system/node/node%d", nnode);
+      if (access(path, F_OK) != 0) break;
+      ++nnode;
+    }
+#endif
+    return nnode > 0 ? nnode : 1;
+  }
+  inline static std::vector<NUMAAllocator*> *MakeNodePools(void) {
+    // never deleted, like the other pools
+    std::vector<NUMAAllocator*> *pools = new std::vector<NUMAAllocator*>();
+    for (int i = 0; i < NumNode(); ++i) pools->push_back(new NUMAAllocator(i));
+    return pools;
+  }
+};
+/*! \brief the allocator selected for the calling thread, NULL for the process default */
+inline ICPUAllocator *&ThreadCPUAllocator(void) {
+  static thread_local ICPUAllocator *alloc = NULL;
+  return alloc;
+}
+/*! \brief the process default allocator */
+inline std::atomic<ICPUAllocator*> &DefaultCPUAllocatorRef(void) {
+  static std::atomic<ICPUAllocator*> alloc(DefaultCPUAllocator::Get());
+  return alloc;
+}
+/*!
+ * \brief set the allocator used by threads that have not selected one
+ * \param alloc the allocator, must outlive every block it allocates
+ */
+inline void SetDefaultCPUAllocator(ICPUAllocator *alloc) {
+  DefaultCPUAllocatorRef().store(alloc != NULL ? alloc : DefaultCPUAllocator::Get());
+}
+/*!
+ * \brief select an allocator for the calling thread for the lifetime of the object,
+ *  scopes can be nested
+ * \code
+ *  {
+ *    pool::CPUAllocatorScope scope(pool::ArenaAllocator::Get());
+ *    TensorContainer<cpu, 2> tmp(Shape2(batch, nhidden));
+ *    ...
+ *  }
+ * \endcode
+ */
+class CPUAllocatorScope {
+ public:
+  explicit CPUAllocatorScope(ICPUAllocator *alloc) : prev_(ThreadCPUAllocator()) {
+    ThreadCPUAllocator() = alloc;
+  }
+  ~CPUAllocatorScope(void) {
+    ThreadCPUAllocator() = prev_;
+  }
+
+ private:
+  ICPUAllocator *prev_;
+  CPUAllocatorScope(const CPUAllocatorScope &other);
+  CPUAllocatorScope &operator=(const CPUAllocatorScope &other);
+};
+/*!
+ * \brief allocate from the allocator of the calling thread, the allocator is
+ *  remembered in the kCPUAlign bytes before the block
+ * \param size bytes requested
+ */
+inline void *CPUAlloc(size_t size) {
+  ICPUAllocator *alloc = ThreadCPUAllocator();
+  if (alloc == NULL) alloc = DefaultCPUAllocatorRef().load(std::memory_order_relaxed);
+  char *ptr = static_cast<char*>(alloc->Alloc(size + ICPUAllocator::kCPUAlign));
+  *reinterpret_cast<ICPUAllocator**>(ptr) = alloc;
+  return ptr + ICPUAllocator::kCPUAlign;
+}
+/*!
+ * \brief free a block of CPUAlloc
+ * \param ptr the block
+ */
+inline void CPUFree(void *ptr) {
+  if (ptr == NULL) return;
+  char *base = static_cast<char*>(ptr) - ICPUAllocator::kCPUAlign;
+  (*reinterpret_cast<ICPUAllocator**>(base))->Free(base);
+}
+}  // namespace pool
+}  // namespace mshadow
+#endif  // MSHADOW_USE_CPU_ALLOCATOR
+#endif  // MSHADOW_CPU_ALLOCATOR_INL_H_
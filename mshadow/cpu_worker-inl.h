@@ -0,0 +1,125 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file cpu_worker-inl.h
+ * \brief the thread behind an asynchronous Stream<cpu>, it runs the tasks pushed to the
+ *  stream one after another in the order they were pushed, see Stream::StartWorker
+ */
+#ifndef MSHADOW_CPU_WORKER_INL_H_
+#define MSHADOW_CPU_WORKER_INL_H_
+#include "./base.h"
+
+#if MSHADOW_IN_CXX11
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+namespace mshadow {
+/*!
+ * \brief a thread with a FIFO of tasks, task i (counting from 1) is done
+ *  when NumDone() >= i, which is what Event<cpu> records
+ */
+class CPUWorker {
+ public:
+  CPUWorker(void) : num_pushed_(0), num_done_(0), stop_(false),
+                    thread_(&CPUWorker::Run, this) {}
+  /*! \brief runs the tasks that are still queued, then joins the thread */
+  ~CPUWorker(void) {
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    task_cond_.notify_one();
+    thread_.join();
+  }
+  /*!
+   * \brief queue a task
+   * \return the sequence number of the task
+   */
+  inline uint64_t Push(std::function<void()> task) {
+    uint64_t seq;
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      queue_.push_back(std::move(task));
+      seq = ++num_pushed_;
+    }
+    task_cond_.notify_one();
+    return seq;
+  }
+  /*! \return the number of tasks pushed so far */
+  inline uint64_t NumPushed(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_pushed_;
+  }
+  /*! \return whether the tasks up to sequence number seq are done */
+  inline bool CheckDone(uint64_t seq) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return num_done_ >= seq;
+  }
+  /*!
+   * \brief block until the tasks up to sequence number seq are done, an exception
+   *  thrown by a task is rethrown by the first WaitFor that returns after it
+   */
+  inline void WaitFor(uint64_t seq) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    done_cond_.wait(lock, [this, seq] { return num_done_ >= seq; });
+    if (error_) {
+      std::exception_ptr error = error_;
+      error_ = nullptr;
+      std::rethrow_exception(error);
+    }
+  }
+  /*! \brief block until all the tasks pushed so far are done */
+  inline void Wait(void) {
+    this->WaitFor(this->NumPushed());
+  }
+  /*! \return whether the caller is the thread running the tasks */
+  inline bool InWorkerThread(void) const {
+    return std::this_thread::get_id() == thread_.get_id();
+  }
+
+ private:
+  inline void Run(void) {
+    while (true) {
+      std::function<void()> task;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        task_cond_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+        if (queue_.empty()) return;
+        task = std::move(queue_.front());
+        queue_.pop_front();
+      }
+      std::exception_ptr error;
+      try {
+        task();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (error && !error_) error_ = error;
+        ++num_done_;
+      }
+      done_cond_.notify_all();
+    }
+  }
+  /*! \brief guards all the members below */
+  std::mutex mutex_;
+  std::condition_variable task_cond_, done_cond_;
+  std::deque<std::function<void()> > queue_;
+  uint64_t num_pushed_, num_done_;
+  /*! \brief the first exception thrown by a task that nobody waited for yet */
+  std::exception_ptr error_;
+  bool stop_;
+  // started last, after everything it reads is constructed
+  std::thread thread_;
+  // not copyable, the thread is owned
+  CPUWorker(const CPUWorker &other);
+  CPUWorker &operator=(const CPUWorker &other);
+};
+}  // namespace mshadow
+#endif  // MSHADOW_IN_CXX11
+#endif  // MSHADOW_CPU_WORKER_INL_H_
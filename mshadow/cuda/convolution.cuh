@@ -0,0 +1,248 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file convolution.cuh
+ * \brief GPU kernels of the tiled convolution, and the cuDNN convolution engine
+ */
+#ifndef MSHADOW_CUDA_CONVOLUTION_CUH_
+#define MSHADOW_CUDA_CONVOLUTION_CUH_
+#include <algorithm>
+#include "../convolution.h"
+#include "./tensor_gpu-inl.cuh"
+
+namespace mshadow {
+namespace cuda {
+template<typename DType>
+__global__ void ConvIm2ColKernel(Tensor<gpu, 3, DType> img, Tensor<gpu, 2, DType> col,
+                                 ConvParam param, index_t owidth, index_t begin) {
+  const index_t ksize = param.kernel_y * param.kernel_x, np = col.size(1);
+  const index_t total = col.size(0) * np;
+  const int height = img.size(1), width = img.size(2);
+  for (index_t i = blockIdx.x * blockDim.x + threadIdx.x; i < total;
+       i += blockDim.x * gridDim.x) {
+    const index_t r = i / np, j = i % np, p = begin + j;
+    const index_t c = r / ksize, ky = r % ksize / param.kernel_x, kx = r % param.kernel_x;
+    const int iy = static_cast<int>(p / owidth * param.stride_y + ky * param.dilate_y) -
+        static_cast<int>(param.pad_y);
+    const int ix = static_cast<int>(p % owidth * param.stride_x + kx * param.dilate_x) -
+        static_cast<int>(param.pad_x);
+    col[r][j] = (iy >= 0 && iy < height && ix >= 0 && ix < width) ? img[c][iy][ix] : DType(0);
+  }
+}
+// one thread per pixel gathers the taps of the tile that read it, so no atomics are needed
+template<typename DType>
+__global__ void ConvCol2ImKernel(Tensor<gpu, 2, DType> col, Tensor<gpu, 3, DType> img,
+                                 ConvParam param, index_t oheight, index_t owidth,
+                                 index_t begin) {
+  const index_t ksize = param.kernel_y * param.kernel_x, np = col.size(1);
+  const index_t height = img.size(1), width = img.size(2);
+  const index_t total = img.size(0) * height * width;
+  for (index_t i = blockIdx.x * blockDim.x + threadIdx.x; i < total;
+       i += blockDim.x * gridDim.x) {
+    const index_t c = i / (height * width), iy = i / width % height, ix = i % width;
+    typename AccType<DType>::type sum = 0;
+    for (index_t ky = 0; ky < param.kernel_y; ++ky) {
+      const int ty = static_cast<int>(iy + param.pad_y) - static_cast<int>(ky * param.dilate_y);
+      if (ty < 0 || ty % param.stride_y != 0) continue;
+      const index_t oy = ty / param.stride_y;
+      if (oy >= oheight) continue;
+      for (index_t kx = 0; kx < param.kernel_x; ++kx) {
+        const int tx = static_cast<int>(ix + param.pad_x) - static_cast<int>(kx * param.dilate_x);
+        if (tx < 0 || tx % param.stride_x != 0) continue;
+        const index_t ox = tx / param.stride_x;
+        if (ox >= owidth) continue;
+        const index_t p = oy * owidth + ox;
+        if (p < begin || p >= begin + np) continue;
+        sum += col[(c * param.kernel_y + ky) * param.kernel_x + kx][p - begin];
+      }
+    }
+    img[c][iy][ix] += DType(sum);
+  }
+}
+/*! \brief grid of a grid-stride kernel over total items */
+inline dim3 ConvGrid(index_t total) {
+  return dim3(std::max(index_t(1), std::min(
+      (total + kBaseThreadNum - 1) / kBaseThreadNum, static_cast<index_t>(kMaxGridNum))));
+}
+}  // namespace cuda
+
+template<typename DType>
+inline void ConvIm2Col(const Tensor<gpu, 3, DType> &img, Tensor<gpu, 2, DType> col,
+                       const ConvParam &param, const Shape<4> &oshape, index_t begin) {
+  cudaStream_t stream = Stream<gpu>::GetStream(col.stream_);
+  cuda::ConvIm2ColKernel<DType>
+      <<<cuda::ConvGrid(col.shape_.Size()), cuda::kBaseThreadNum, 0, stream>>>(
+      img, col, param, oshape[3], begin);
+  MSHADOW_CUDA_CALL(cudaGetLastError());
+}
+
+template<typename DType>
+inline void ConvCol2Im(const Tensor<gpu, 2, DType> &col, Tensor<gpu, 3, DType> img,
+                       const ConvParam &param, const Shape<4> &oshape, index_t begin) {
+  cudaStream_t stream = Stream<gpu>::GetStream(img.stream_);
+  cuda::ConvCol2ImKernel<DType>
+      <<<cuda::ConvGrid(img.shape_.Size()), cuda::kBaseThreadNum, 0, stream>>>(
+      col, img, param, oshape[2], oshape[3], begin);
+  MSHADOW_CUDA_CALL(cudaGetLastError());
+}
+
+#if MSHADOW_USE_CUDNN == 1 && CUDNN_MAJOR >= 7
+#define MSHADOW_CUDNN_CALL(func)                                          \
+  {                                                                       \
+    cudnnStatus_t e = (func);                                             \
+    CHECK_EQ(e, CUDNN_STATUS_SUCCESS) << "cuDNN: " << cudnnGetErrorString(e); \
+  }
+/*!
+ * \brief descriptors of a convolution for cuDNN, created for one call,
+ *  the algorithms are the fastest by the cuDNN heuristics
+ */
+template<typename DType>
+class CuDNNConv {
+ public:
+  CuDNNConv(const Shape<4> &ishape, index_t nfilter, const ConvParam &param) {
+    typedef typename DataType<DType>::ScaleType ScaleType;
+    const Shape<4> oshape = param.OutShape(ishape, nfilter);
+    MSHADOW_CUDNN_CALL(cudnnCreateTensorDescriptor(&in_));
+    MSHADOW_CUDNN_CALL(cudnnCreateTensorDescriptor(&out_));
+    MSHADOW_CUDNN_CALL(cudnnCreateFilterDescriptor(&filter_));
+    MSHADOW_CUDNN_CALL(cudnnCreateConvolutionDescriptor(&conv_));
+    MSHADOW_CUDNN_CALL(cudnnSetTensor4dDescriptor(
+        in_, CUDNN_TENSOR_NCHW, DataType<DType>::kCudnnFlag,
+        ishape[0], ishape[1], ishape[2], ishape[3]));
+    MSHADOW_CUDNN_CALL(cudnnSetTensor4dDescriptor(
+        out_, CUDNN_TENSOR_NCHW, DataType<DType>::kCudnnFlag,
+        oshape[0], oshape[1], oshape[2], oshape[3]));
+    MSHADOW_CUDNN_CALL(cudnnSetFilter4dDescriptor(
+        filter_, DataType<DType>::kCudnnFlag, CUDNN_TENSOR_NCHW,
+        nfilter, ishape[1], param.kernel_y, param.kernel_x));
+    MSHADOW_CUDNN_CALL(cudnnSetConvolution2dDescriptor(
+        conv_, param.pad_y, param.pad_x, param.stride_y, param.stride_x,
+        param.dilate_y, param.dilate_x, CUDNN_CROSS_CORRELATION,
+        DataType<ScaleType>::kCudnnFlag));
+    MSHADOW_CUDNN_CALL(cudnnSetConvolutionMathType(conv_, CUDNN_TENSOR_OP_MATH));
+  }
+  ~CuDNNConv(void) {
+    cudnnDestroyConvolutionDescriptor(conv_);
+    cudnnDestroyFilterDescriptor(filter_);
+    cudnnDestroyTensorDescriptor(out_);
+    cudnnDestroyTensorDescriptor(in_);
+  }
+  /*! \brief a workspace tensor of at least bytes, NULL when none is needed */
+  inline static void *Space(Workspace<gpu> *ws, size_t bytes) {
+    if (bytes == 0) return NULL;
+    return ws->template Get<char>(Shape1(static_cast<index_t>(bytes))).dptr_;
+  }
+  inline void Forward(cudnnHandle_t handle, const DType *in, const DType *weight, DType *out,
+                      Workspace<gpu> *ws) {
+    cudnnConvolutionFwdAlgoPerf_t perf[CUDNN_CONVOLUTION_FWD_ALGO_COUNT];
+    int count = 0;
+    MSHADOW_CUDNN_CALL(cudnnGetConvolutionForwardAlgorithm_v7(
+        handle, in_, filter_, conv_, out_, CUDNN_CONVOLUTION_FWD_ALGO_COUNT, &count, perf));
+    CHECK(count > 0 && perf[0].status == CUDNN_STATUS_SUCCESS) << "cuDNN: no forward algorithm";
+    size_t bytes = 0;
+    MSHADOW_CUDNN_CALL(cudnnGetConvolutionForwardWorkspaceSize(
+        handle, in_, filter_, conv_, out_, perf[0].algo, &bytes));
+    void *space = Space(ws, bytes);
+    typename DataType<DType>::ScaleType alpha = 1, beta = 0;
+    MSHADOW_CUDNN_CALL(cudnnConvolutionForward(
+        handle, &alpha, in_, in, filter_, weight, conv_, perf[0].algo,
+        space, bytes, &beta, out_, out));
+  }
+  inline void BackwardData(cudnnHandle_t handle, const DType *grad_out, const DType *weight,
+                           DType *grad_in, Workspace<gpu> *ws) {
+    cudnnConvolutionBwdDataAlgoPerf_t perf[CUDNN_CONVOLUTION_BWD_DATA_ALGO_COUNT];
+    int count = 0;
+    MSHADOW_CUDNN_CALL(cudnnGetConvolutionBackwardDataAlgorithm_v7(
+        handle, filter_, out_, conv_, in_, CUDNN_CONVOLUTION_BWD_DATA_ALGO_COUNT, &count, perf));
+    CHECK(count > 0 && perf[0].status == CUDNN_STATUS_SUCCESS)
+        << "cuDNN: no backward data algorithm";
+    size_t bytes = 0;
+    MSHADOW_CUDNN_CALL(cudnnGetConvolutionBackwardDataWorkspaceSize(
+        handle, filter_, out_, conv_, in_, perf[0].algo, &bytes));
+    void *space = Space(ws, bytes);
+    typename DataType<DType>::ScaleType alpha = 1, beta = 0;
+    MSHADOW_CUDNN_CALL(cudnnConvolutionBackwardData(
+        handle, &alpha, filter_, weight, out_, grad_out, conv_, perf[0].algo,
+        space, bytes, &beta, in_, grad_in));
+  }
+  inline void BackwardWeight(cudnnHandle_t handle, const DType *grad_out, const DType *in,
+                             DType *grad_weight, Workspace<gpu> *ws) {
+    cudnnConvolutionBwdFilterAlgoPerf_t perf[CUDNN_CONVOLUTION_BWD_FILTER_ALGO_COUNT];
+    int count = 0;
+    MSHADOW_CUDNN_CALL(cudnnGetConvolutionBackwardFilterAlgorithm_v7(
+        handle, in_, out_, conv_, filter_, CUDNN_CONVOLUTION_BWD_FILTER_ALGO_COUNT,
+        &count, perf));
+    CHECK(count > 0 && perf[0].status == CUDNN_STATUS_SUCCESS)
+        << "cuDNN: no backward filter algorithm";
+    size_t bytes = 0;
+    MSHADOW_CUDNN_CALL(cudnnGetConvolutionBackwardFilterWorkspaceSize(
+        handle, in_, out_, conv_, filter_, perf[0].algo, &bytes));
+    void *space = Space(ws, bytes);
+    typename DataType<DType>::ScaleType alpha = 1, beta = 0;
+    MSHADOW_CUDNN_CALL(cudnnConvolutionBackwardFilter(
+        handle, &alpha, in_, in, out_, grad_out, conv_, perf[0].algo,
+        space, bytes, &beta, filter_, grad_weight));
+  }
+
+ private:
+  cudnnTensorDescriptor_t in_, out_;
+  cudnnFilterDescriptor_t filter_;
+  cudnnConvolutionDescriptor_t conv_;
+};
+/*!
+ * \brief convolutions through cuDNN on the streams that have a cuDNN handle,
+ *  the others use the tiled GEMM
+ */
+template<typename DType>
+struct ConvCuDNNEngine {
+  // cuDNN takes packed tensors, and needs the handle of the stream
+  inline static bool UseCuDNN(const Tensor<gpu, 4, DType> &a, const Tensor<gpu, 2, DType> &w,
+                              const Tensor<gpu, 4, DType> &b) {
+    Stream<gpu> *stream = a.stream_;
+    return stream != NULL && stream->dnn_handle_ownership_ != Stream<gpu>::NoHandle &&
+        a.CheckContiguous() && w.CheckContiguous() && b.CheckContiguous();
+  }
+  inline static void Forward(const Tensor<gpu, 4, DType> &in,
+                             const Tensor<gpu, 2, DType> &weight,
+                             Tensor<gpu, 4, DType> out,
+                             const ConvParam &param, Workspace<gpu> *ws) {
+    if (!UseCuDNN(in, weight, out)) {
+      ConvTiledEngine<gpu, DType>::Forward(in, weight, out, param, ws);
+      return;
+    }
+    CuDNNConv<DType>(in.shape_, weight.size(0), param).Forward(
+        Stream<gpu>::GetDnnHandle(in.stream_), in.dptr_, weight.dptr_, out.dptr_, ws);
+  }
+  inline static void BackwardData(const Tensor<gpu, 4, DType> &grad_out,
+                                  const Tensor<gpu, 2, DType> &weight,
+                                  Tensor<gpu, 4, DType> grad_in,
+                                  const ConvParam &param, Workspace<gpu> *ws) {
+    if (!UseCuDNN(grad_in, weight, grad_out)) {
+      ConvTiledEngine<gpu, DType>::BackwardData(grad_out, weight, grad_in, param, ws);
+      return;
+    }
+    CuDNNConv<DType>(grad_in.shape_, weight.size(0), param).BackwardData(
+        Stream<gpu>::GetDnnHandle(grad_in.stream_), grad_out.dptr_, weight.dptr_,
+        grad_in.dptr_, ws);
+  }
+  inline static void BackwardWeight(const Tensor<gpu, 4, DType> &grad_out,
+                                    const Tensor<gpu, 4, DType> &in,
+                                    Tensor<gpu, 2, DType> grad_weight,
+                                    const ConvParam &param, Workspace<gpu> *ws) {
+    if (!UseCuDNN(in, grad_weight, grad_out)) {
+      ConvTiledEngine<gpu, DType>::BackwardWeight(grad_out, in, grad_weight, param, ws);
+      return;
+    }
+    CuDNNConv<DType>(in.shape_, grad_weight.size(0), param).BackwardWeight(
+        Stream<gpu>::GetDnnHandle(in.stream_), grad_out.dptr_, in.dptr_,
+        grad_weight.dptr_, ws);
+  }
+};
+template<>
+struct ConvEngine<gpu, float> : public ConvCuDNNEngine<float> {};
+template<>
+struct ConvEngine<gpu, double> : public ConvCuDNNEngine<double> {};
+template<>
+struct ConvEngine<gpu, half::half_t> : public ConvCuDNNEngine<half::half_t> {};
+#endif  // MSHADOW_USE_CUDNN == 1 && CUDNN_MAJOR >= 7
+}  // namespace mshadow
+#endif  // MSHADOW_CUDA_CONVOLUTION_CUH_
@@ -0,0 +1,139 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file fft.cuh
+ * \brief the gpu transforms of fft.h on cuFFT, with the plans cached per layout and stream
+ */
+#ifndef MSHADOW_CUDA_FFT_CUH_
+#define MSHADOW_CUDA_FFT_CUH_
+#include <map>
+#include <mutex>
+#include <vector>
+#include "../fft.h"
+
+namespace mshadow {
+namespace cuda {
+#if MSHADOW_USE_CUFFT
+/*! \brief the complex to complex transform of cuFFT for DType */
+template<typename DType>
+struct CuFFTType;
+template<>
+struct CuFFTType<float> {
+  static const cufftType kType = CUFFT_C2C;
+  inline static cufftResult Exec(cufftHandle plan, const float *src, float *dst, int dir) {
+    return cufftExecC2C(plan, reinterpret_cast<cufftComplex*>(const_cast<float*>(src)),
+                        reinterpret_cast<cufftComplex*>(dst), dir);
+  }
+};
+template<>
+struct CuFFTType<double> {
+  static const cufftType kType = CUFFT_Z2Z;
+  inline static cufftResult Exec(cufftHandle plan, const double *src, double *dst, int dir) {
+    return cufftExecZ2Z(plan, reinterpret_cast<cufftDoubleComplex*>(const_cast<double*>(src)),
+                        reinterpret_cast<cufftDoubleComplex*>(dst), dir);
+  }
+};
+inline void CuFFTCheck(cufftResult status) {
+  CHECK_EQ(status, CUFFT_SUCCESS) << "cuFFT error " << static_cast<int>(status);
+}
+/*!
+ * \brief the plans made so far, a plan is bound to the device and the stream it was made
+ *  for, as its work area may not be shared by transforms running at the same time
+ */
+class CuFFTPlanCache {
+ public:
+  /*! \brief the cache of the process */
+  inline static CuFFTPlanCache *Get(void) {
+    static CuFFTPlanCache inst;
+    return &inst;
+  }
+  /*!
+   * \brief the plan of batch transforms of size n[0] (x n[1]), in numbers of complex
+   * \param pitch the row pitch of src and of dst for 2D, the sequence distances for 1D
+   * \param dist the distances of the planes for 2D
+   */
+  inline cufftHandle Plan(cufftType type, int rank, const int n[2], const int pitch[2],
+                          const int dist[2], int batch, cudaStream_t stream) {
+    int device;
+    MSHADOW_CUDA_CALL(cudaGetDevice(&device));
+    std::vector<long long> key;  // NOLINT(*)
+    key.push_back(device);
+    key.push_back(reinterpret_cast<long long>(stream));  // NOLINT(*)
+    key.push_back(type); key.push_back(rank); key.push_back(batch);
+    for (int i = 0; i < 2; ++i) {
+      key.push_back(n[i]); key.push_back(pitch[i]); key.push_back(dist[i]);
+    }
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::map<std::vector<long long>, cufftHandle>::iterator it = plans_.find(key);  // NOLINT(*)
+    if (it != plans_.end()) return it->second;
+    cufftHandle plan;
+    int inembed[2] = {n[0], pitch[0]}, onembed[2] = {n[0], pitch[1]};
+    if (rank == 1) {
+      inembed[0] = pitch[0]; onembed[0] = pitch[1];
+    }
+    CuFFTCheck(cufftPlanMany(&plan, rank, const_cast<int*>(n), inembed, 1,
+                             rank == 1 ? pitch[0] : dist[0], onembed, 1,
+                             rank == 1 ? pitch[1] : dist[1], type, batch));
+    CuFFTCheck(cufftSetStream(plan, stream));
+    plans_[key] = plan;
+    return plan;
+  }
+
+ private:
+  CuFFTPlanCache(void) {}
+  ~CuFFTPlanCache(void) {
+    // the driver may be gone at exit, the errors are ignored
+    for (std::map<std::vector<long long>, cufftHandle>::iterator it  // NOLINT(*)
+             = plans_.begin(); it != plans_.end(); ++it) {
+      cufftDestroy(it->second);
+    }
+  }
+  std::mutex mutex_;
+  std::map<std::vector<long long>, cufftHandle> plans_;  // NOLINT(*)
+};
+/*! \brief run a cached plan on src, and scale dst */
+template<int dim, typename DType>
+inline void CuFFTRun(Tensor<gpu, dim, DType> dst, const Tensor<gpu, dim, DType> &src,
+                     int rank, const int n[2], const int pitch[2], const int dist[2],
+                     int batch, bool inverse, DType scale) {
+  CHECK(src.stride_ % 2 == 0 && dst.stride_ % 2 == 0)
+      << "FFT: the rows of gpu tensors must start on whole complex numbers";
+  cudaStream_t stream = Stream<gpu>::GetStream(dst.stream_);
+  cufftHandle plan = CuFFTPlanCache::Get()->Plan(CuFFTType<DType>::kType, rank, n, pitch,
+                                                 dist, batch, stream);
+  CuFFTCheck(CuFFTType<DType>::Exec(plan, src.dptr_, dst.dptr_,
+                                    inverse ? CUFFT_INVERSE : CUFFT_FORWARD));
+  if (scale != DType(1)) dst *= scale;
+}
+#endif  // MSHADOW_USE_CUFFT
+}  // namespace cuda
+
+template<typename DType>
+inline void FFTEngine<gpu, DType>::Transform1D(Tensor<gpu, 2, DType> dst,
+                                               const Tensor<gpu, 2, DType> &src,
+                                               bool inverse, DType scale) {
+#if MSHADOW_USE_CUFFT
+  const int n[2] = {static_cast<int>(src.size(1) / 2), 1};
+  const int pitch[2] = {static_cast<int>(src.stride_ / 2), static_cast<int>(dst.stride_ / 2)};
+  const int dist[2] = {0, 0};
+  cuda::CuFFTRun(dst, src, 1, n, pitch, dist, static_cast<int>(src.size(0)), inverse, scale);
+#else
+  LOG(FATAL) << "FFT on gpu needs cuFFT, build with MSHADOW_USE_CUFFT=1";
+#endif  // MSHADOW_USE_CUFFT
+}
+
+template<typename DType>
+inline void FFTEngine<gpu, DType>::Transform2D(Tensor<gpu, 3, DType> dst,
+                                               const Tensor<gpu, 3, DType> &src,
+                                               bool inverse, DType scale) {
+#if MSHADOW_USE_CUFFT
+  const int h = static_cast<int>(src.size(1));
+  const int n[2] = {h, static_cast<int>(src.size(2) / 2)};
+  const int pitch[2] = {static_cast<int>(src.stride_ / 2), static_cast<int>(dst.stride_ / 2)};
+  const int dist[2] = {h * pitch[0], h * pitch[1]};
+  cuda::CuFFTRun(dst, src, 2, n, pitch, dist, static_cast<int>(src.size(0)), inverse, scale);
+#else
+  LOG(FATAL) << "FFT2D on gpu needs cuFFT, build with MSHADOW_USE_CUFFT=1";
+#endif  // MSHADOW_USE_CUFFT
+}
+}  // namespace mshadow
+#endif  // MSHADOW_CUDA_FFT_CUH_
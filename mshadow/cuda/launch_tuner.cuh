@@ -0,0 +1,313 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file launch_tuner.cuh
+ * \brief launch configurations of the gpu kernels picked by timing, enabled by
+ *  MSHADOW_USE_AUTOTUNE
+ *
+ *  The map kernels, the 2D Softmax, Pool and the reductions launch through TunedLaunch
+ *  with a short list of candidate configurations, the first one being the fixed default.
+ *  With MSHADOW_USE_AUTOTUNE=0 TunedLaunch runs the default and nothing else is compiled.
+ *
+ *  With the flag on, the configuration of a kernel is looked up by the device, the kernel
+ *  with its template arguments, and the class of the shape, the log2 of its rows and of its
+ *  columns. A miss runs the default unless tuning is on, set by the environment variable
+ *  MSHADOW_AUTOTUNE=1 or LaunchTuner::set_enabled. Tuning times every candidate on the
+ *  stream, restoring the destination before each run so the result is the one of a single
+ *  launch, and keeps the fastest. It synchronizes the stream once per new key, and is
+ *  skipped while the stream is captured into a CUDA graph.
+ *
+ *  The results are appended to the file named by MSHADOW_AUTOTUNE_CACHE, read back at the
+ *  first launch of the next run, so the tuning is done once per machine. The device is
+ *  part of the key, so one file can hold the results of different gpus.
+ */
+#ifndef MSHADOW_CUDA_LAUNCH_TUNER_CUH_
+#define MSHADOW_CUDA_LAUNCH_TUNER_CUH_
+#include "../tensor.h"
+
+#if MSHADOW_USE_AUTOTUNE
+#if !MSHADOW_IN_CXX11
+#error "MSHADOW_USE_AUTOTUNE requires c++11"
+#endif
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <typeinfo>
+#include <unordered_map>
+#include <vector>
+#endif  // MSHADOW_USE_AUTOTUNE
+
+namespace mshadow {
+namespace cuda {
+/*!
+ * \brief a launch configuration, each kernel documents which fields it reads
+ */
+struct LaunchConfig {
+  /*! \brief threads per block */
+  int block;
+  /*! \brief most blocks per multiprocessor, 0 for the default of the kernel */
+  int grid;
+};
+/*!
+ * \brief the memory a kernel writes, copied before the candidates are timed and restored
+ *  before each run, size 0 for a kernel that must not be timed
+ */
+struct TuneRegion {
+  /*! \brief start of the memory */
+  void *dptr;
+  /*! \brief bytes of the memory */
+  size_t size;
+  TuneRegion(void) : dptr(NULL), size(0) {}
+  TuneRegion(void *dptr, size_t size) : dptr(dptr), size(size) {}
+};
+/*! \brief the region of a destination that is not a tensor, it is not tuned */
+template<typename R>
+inline TuneRegion TuneRegionOf(const R &dst, Shape<2> dshape) {
+  return TuneRegion();
+}
+/*! \brief the region of a tensor of dshape rows and columns, dshape is the 2D view */
+template<int dim, typename DType>
+inline TuneRegion TuneRegionOf(const Tensor<gpu, dim, DType> &dst, Shape<2> dshape) {
+  if (dshape.Size() == 0) return TuneRegion();
+  const size_t stride = dim == 1 ? dshape[1] : dst.stride_;
+  return TuneRegion(dst.dptr_, ((dshape[0] - 1) * stride + dshape[1]) * sizeof(DType));
+}
+
+#if MSHADOW_USE_AUTOTUNE
+/*! \brief the tuned configurations, shared by all threads */
+class LaunchTuner {
+ public:
+  LaunchTuner(void) {
+    const char *tune = getenv("MSHADOW_AUTOTUNE");
+    enabled_ = tune != NULL && atoi(tune) != 0;
+    const char *path = getenv("MSHADOW_AUTOTUNE_CACHE");
+    if (path != NULL && path[0] != '\0') {
+      path_ = path;
+      this->Load(path);
+    }
+  }
+  /*! \brief whether keys that are not in the cache are tuned */
+  inline bool enabled(void) const {
+    return enabled_;
+  }
+  /*! \brief tune the keys that are not in the cache, or run their default */
+  inline void set_enabled(bool enabled) {
+    enabled_ = enabled;
+  }
+  /*! \brief find the configuration of key on the current device */
+  inline bool Find(const std::string &key, LaunchConfig *cfg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<std::string, LaunchConfig>::const_iterator
+        it = table_.find(this->DeviceTag() + key);
+    if (it == table_.end()) return false;
+    *cfg = it->second;
+    return true;
+  }
+  /*! \brief record the configuration of key on the current device, and append it to the file */
+  inline void Insert(const std::string &key, const LaunchConfig &cfg) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const std::string dkey = this->DeviceTag() + key;
+    table_[dkey] = cfg;
+    if (path_.length() == 0) return;
+    FILE *fo = fopen(path_.c_str(), "a");
+    if (fo == NULL) {
+      LOG(WARNING) << "LaunchTuner: cannot write " << path_;
+      return;
+    }
+    fprintf(fo, "%s %d %d\n", dkey.c_str(), cfg.block, cfg.grid);
+    fclose(fo);
+  }
+  /*! \brief write all configurations to path, in the format of MSHADOW_AUTOTUNE_CACHE */
+  inline void Save(const char *path) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    FILE *fo = fopen(path, "w");
+    CHECK(fo != NULL) << "LaunchTuner: cannot write " << path;
+    for (std::unordered_map<std::string, LaunchConfig>::const_iterator
+             it = table_.begin(); it != table_.end(); ++it) {
+      fprintf(fo, "%s %d %d\n", it->first.c_str(), it->second.block, it->second.grid);
+    }
+    fclose(fo);
+  }
+  /*! \brief the lock tuning holds, one kernel is timed at a time */
+  inline std::mutex &tune_mutex(void) {
+    return tune_mutex_;
+  }
+  inline static LaunchTuner *Get(void) {
+    static LaunchTuner inst;
+    return &inst;
+  }
+
+ private:
+  /*! \brief read the lines "key block grid", the later of two equal keys wins */
+  inline void Load(const char *path) {
+    FILE *fi = fopen(path, "r");
+    if (fi == NULL) return;
+    char key[1024];
+    LaunchConfig cfg;
+    while (fscanf(fi, "%1023s %d %d", key, &cfg.block, &cfg.grid) == 3) {
+      table_[key] = cfg;
+    }
+    fclose(fi);
+  }
+  /*! \brief name and compute capability of the current device, without spaces */
+  inline const std::string &DeviceTag(void) {
+    int dev = 0;
+    MSHADOW_CUDA_CALL(cudaGetDevice(&dev));
+    if (dev >= static_cast<int>(device_.size())) device_.resize(dev + 1);
+    if (device_[dev].length() == 0) {
+      cudaDeviceProp prop;
+      MSHADOW_CUDA_CALL(cudaGetDeviceProperties(&prop, dev));
+      std::string tag = prop.name;
+      for (size_t i = 0; i < tag.length(); ++i) {
+        if (tag[i] == ' ') tag[i] = '_';
+      }
+      char cc[32];
+      snprintf(cc, sizeof(cc), ":sm_%d%d/", prop.major, prop.minor);
+      device_[dev] = tag + cc;
+    }
+    return device_[dev];
+  }
+  std::atomic<bool> enabled_;
+  std::string path_;
+  std::mutex mutex_, tune_mutex_;
+  std::unordered_map<std::string, LaunchConfig> table_;
+  std::vector<std::string> device_;
+};
+/*!
+ * \brief name of kernel type Kernel in the keys, name and a hash of the type, which
+ *  holds the template arguments of the kernel and so the expression it evaluates
+ */
+template<typename Kernel>
+inline const std::string &TuneKernelName(const char *name) {
+  static const std::string ret = [name] {
+    uint64_t h = 14695981039346656037ULL;
+    for (const char *p = typeid(Kernel).name(); *p != '\0'; ++p) {
+      h = (h ^ static_cast<unsigned char>(*p)) * 1099511628211ULL;
+    }
+    char buf[32];
+    snprintf(buf, sizeof(buf), "#%016llx/", static_cast<unsigned long long>(h));  // NOLINT(*)
+    return std::string(name) + buf;
+  }();
+  return ret;
+}
+/*! \brief floor of the log2 of n, 0 for 0 */
+inline int TuneLog2(size_t n) {
+  int ret = 0;
+  while (n > 1) {
+    n >>= 1; ++ret;
+  }
+  return ret;
+}
+/*!
+ * \brief time each candidate on stream and set best to the fastest, the memory of out is
+ *  restored before every run and after the last. A candidate that fails to launch,
+ *  e.g. with too many threads for the registers of the kernel, is skipped.
+ * \return false if there is no memory for the copy of out, nothing is run then
+ */
+template<typename Launch>
+inline bool TuneLaunch(const LaunchConfig *cand, int ncand, const TuneRegion &out,
+                       cudaStream_t stream, const Launch &launch, LaunchConfig *best) {
+  const int kRepeat = 3;
+  void *backup = NULL;
+  if (cudaMalloc(&backup, out.size) != cudaSuccess) {
+    cudaGetLastError();
+    return false;
+  }
+  cudaEvent_t start, stop;
+  MSHADOW_CUDA_CALL(cudaEventCreate(&start));
+  MSHADOW_CUDA_CALL(cudaEventCreate(&stop));
+  MSHADOW_CUDA_CALL(cudaMemcpyAsync(backup, out.dptr, out.size,
+                                    cudaMemcpyDeviceToDevice, stream));
+  *best = cand[0];
+  float best_ms = -1.0f;
+  for (int i = 0; i < ncand; ++i) {
+    if (cand[i].block > kMaxThreadsPerBlock) continue;
+    float total = 0.0f;
+    bool ok = true;
+    // the first run warms up the caches and is not counted
+    for (int r = 0; r <= kRepeat && ok; ++r) {
+      MSHADOW_CUDA_CALL(cudaMemcpyAsync(out.dptr, backup, out.size,
+                                        cudaMemcpyDeviceToDevice, stream));
+      MSHADOW_CUDA_CALL(cudaEventRecord(start, stream));
+      launch(cand[i]);
+      ok = cudaPeekAtLastError() == cudaSuccess;
+      MSHADOW_CUDA_CALL(cudaEventRecord(stop, stream));
+      MSHADOW_CUDA_CALL(cudaEventSynchronize(stop));
+      float ms = 0.0f;
+      MSHADOW_CUDA_CALL(cudaEventElapsedTime(&ms, start, stop));
+      if (r != 0) total += ms;
+    }
+    if (!ok) {
+      cudaGetLastError();
+      continue;
+    }
+    if (best_ms < 0.0f || total < best_ms) {
+      *best = cand[i]; best_ms = total;
+    }
+  }
+  MSHADOW_CUDA_CALL(cudaMemcpyAsync(out.dptr, backup, out.size,
+                                    cudaMemcpyDeviceToDevice, stream));
+  MSHADOW_CUDA_CALL(cudaStreamSynchronize(stream));
+  MSHADOW_CUDA_CALL(cudaEventDestroy(start));
+  MSHADOW_CUDA_CALL(cudaEventDestroy(stop));
+  MSHADOW_CUDA_CALL(cudaFree(backup));
+  return true;
+}
+#endif  // MSHADOW_USE_AUTOTUNE
+/*!
+ * \brief launch(cfg) with the configuration tuned for the kernel and the shape class
+ *  (nrow, ncol), see the top of the file. Without MSHADOW_USE_AUTOTUNE it is launch(cand[0]).
+ * \param name name of the kernel in the cache
+ * \param nrow the first dimension of the shape class
+ * \param ncol the second dimension of the shape class
+ * \param cand the candidates, cand[0] is the default
+ * \param ncand number of candidates
+ * \param out the memory launch writes, an empty region is not tuned
+ * \param stream the stream launch runs on
+ * \param launch the launch of the kernel, a functor of const LaunchConfig&
+ * \tparam Kernel the kernel, or a type that tells the kernels of launch apart
+ */
+template<typename Kernel, typename Launch>
+inline void TunedLaunch(const char *name, size_t nrow, size_t ncol,
+                        const LaunchConfig *cand, int ncand, const TuneRegion &out,
+                        cudaStream_t stream, const Launch &launch) {
+#if MSHADOW_USE_AUTOTUNE
+  LaunchTuner *tuner = LaunchTuner::Get();
+  char shape[32];
+  snprintf(shape, sizeof(shape), "r%dc%d", TuneLog2(nrow), TuneLog2(ncol));
+  const std::string key = TuneKernelName<Kernel>(name) + shape;
+  LaunchConfig cfg;
+  if (tuner->Find(key, &cfg)) {
+    launch(cfg);
+    return;
+  }
+  bool capturing = false;
+#if CUDA_VERSION >= 10000
+  cudaStreamCaptureStatus status = cudaStreamCaptureStatusNone;
+  MSHADOW_CUDA_CALL(cudaStreamIsCapturing(stream, &status));
+  capturing = status != cudaStreamCaptureStatusNone;
+#endif
+  if (!tuner->enabled() || out.size == 0 || ncand < 2 || capturing) {
+    launch(cand[0]);
+    return;
+  }
+  {
+    std::lock_guard<std::mutex> lock(tuner->tune_mutex());
+    // another thread may have tuned the key while this one waited
+    if (!tuner->Find(key, &cfg)) {
+      if (TuneLaunch(cand, ncand, out, stream, launch, &cfg)) {
+        tuner->Insert(key, cfg);
+      } else {
+        cfg = cand[0];
+      }
+    }
+  }
+  launch(cfg);
+#else
+  launch(cand[0]);
+#endif  // MSHADOW_USE_AUTOTUNE
+}
+}  // namespace cuda
+}  // namespace mshadow
+#endif  // MSHADOW_CUDA_LAUNCH_TUNER_CUH_
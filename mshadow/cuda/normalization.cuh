@@ -0,0 +1,397 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file normalization.cuh
+ * \brief GPU kernels of the batch and layer normalizations
+ */
+#ifndef MSHADOW_CUDA_NORMALIZATION_CUH_
+#define MSHADOW_CUDA_NORMALIZATION_CUH_
+#include <algorithm>
+#include "../normalization.h"
+#include "./tensor_gpu-inl.cuh"
+
+namespace mshadow {
+namespace cuda {
+/*! \brief rows of a block of the layer normalizations, a warp per row */
+const int kNormRowsPerBlock = 8;
+/*! \brief merge the statistics of the lanes of the warp, every lane gets the result */
+template<typename AType>
+inline __device__ void WelfordWarpMerge(WelfordStat<AType> *st) {
+  #pragma unroll
+  for (int mask = 16; mask > 0; mask >>= 1) {
+    const AType n = MSHADOW_CUDA_SHFL_XOR(st->count, mask, 32);
+    const AType mean = MSHADOW_CUDA_SHFL_XOR(st->mean, mask, 32);
+    const AType m2 = MSHADOW_CUDA_SHFL_XOR(st->m2, mask, 32);
+    st->Merge(n, mean, m2);
+  }
+}
+/*! \brief merge the statistics of a one dimensional block, thread 0 gets the result */
+template<typename AType>
+inline __device__ void WelfordBlockMerge(WelfordStat<AType> *st) {
+  __shared__ AType s_stat[3][32];
+  WelfordWarpMerge(st);
+  const int lane = threadIdx.x & 31, wid = threadIdx.x >> 5;
+  if (lane == 0) {
+    s_stat[0][wid] = st->count; s_stat[1][wid] = st->mean; s_stat[2][wid] = st->m2;
+  }
+  __syncthreads();
+  if (wid == 0) {
+    WelfordStat<AType> w;
+    if (lane < static_cast<int>(blockDim.x >> 5)) {
+      w.count = s_stat[0][lane]; w.mean = s_stat[1][lane]; w.m2 = s_stat[2][lane];
+    }
+    WelfordWarpMerge(&w);
+    *st = w;
+  }
+}
+/*!
+ * \brief statistics of channel blockIdx.x over range blockIdx.y of chunk of the N * M
+ *  values, into part[blockIdx.y][3 * c + {count, mean, m2}]
+ */
+template<typename DType, typename AType>
+__global__ void BatchNormStatKernel(Tensor<gpu, 3, DType> data, AType *part, index_t chunk) {
+  const index_t c = blockIdx.x, nchannel = data.size(1), len = data.size(2);
+  const index_t total = data.size(0) * len;
+  const index_t begin = blockIdx.y * chunk, end = min(begin + chunk, total);
+  WelfordStat<AType> st;
+  for (index_t j = begin + threadIdx.x; j < end; j += blockDim.x) {
+    const index_t n = j / len, m = j % len;
+    st.Push(AType(data.dptr_[(n * nchannel + c) * data.stride_ + m]));
+  }
+  WelfordBlockMerge(&st);
+  if (threadIdx.x == 0) {
+    AType *p = part + blockIdx.y * 3 * nchannel + 3 * c;
+    p[0] = st.count; p[1] = st.mean; p[2] = st.m2;
+  }
+}
+template<typename DType, typename AType>
+__global__ void BatchNormStatMergeKernel(Tensor<gpu, 1, DType> mean,
+                                         Tensor<gpu, 1, DType> invstd,
+                                         const AType *part, index_t nsplit, DType eps) {
+  const index_t nchannel = mean.size(0);
+  for (index_t c = blockIdx.x * blockDim.x + threadIdx.x; c < nchannel;
+       c += blockDim.x * gridDim.x) {
+    WelfordStat<AType> st;
+    for (index_t k = 0; k < nsplit; ++k) {
+      const AType *p = part + k * 3 * nchannel + 3 * c;
+      st.Merge(p[0], p[1], p[2]);
+    }
+    mean[c] = DType(st.mean);
+    invstd[c] = DType(st.InvStd(AType(eps)));
+  }
+}
+/*! \brief out = data * gamma * invstd + beta - mean * gamma * invstd, by channel */
+template<typename DType>
+__global__ void BatchNormApplyKernel(Tensor<gpu, 3, DType> out, Tensor<gpu, 3, DType> data,
+                                     Tensor<gpu, 1, DType> mean, Tensor<gpu, 1, DType> invstd,
+                                     Tensor<gpu, 1, DType> gamma, Tensor<gpu, 1, DType> beta) {
+  typedef typename AccType<DType>::type AType;
+  const index_t nchannel = data.size(1), len = data.size(2);
+  const index_t total = data.size(0) * nchannel * len;
+  for (index_t i = blockIdx.x * blockDim.x + threadIdx.x; i < total;
+       i += blockDim.x * gridDim.x) {
+    const index_t r = i / len, m = i % len, c = r % nchannel;
+    const AType scale = AType(gamma[c]) * AType(invstd[c]);
+    const AType shift = AType(beta[c]) - AType(mean[c]) * scale;
+    out.dptr_[r * out.stride_ + m] =
+        DType(AType(data.dptr_[r * data.stride_ + m]) * scale + shift);
+  }
+}
+/*!
+ * \brief sums of dy and dy * (x - mean) of channel blockIdx.x over range blockIdx.y of
+ *  chunk, into part[blockIdx.y][2 * c + {0, 1}]
+ */
+template<typename DType, typename AType>
+__global__ void BatchNormGradSumKernel(Tensor<gpu, 3, DType> grad_out,
+                                       Tensor<gpu, 3, DType> data,
+                                       Tensor<gpu, 1, DType> mean, AType *part, index_t chunk) {
+  __shared__ AType s_buf[32];
+  const index_t c = blockIdx.x, nchannel = data.size(1), len = data.size(2);
+  const index_t total = data.size(0) * len;
+  const index_t begin = blockIdx.y * chunk, end = min(begin + chunk, total);
+  const AType mu = AType(mean[c]);
+  AType sdy = AType(0), sdyx = AType(0);
+  for (index_t j = begin + threadIdx.x; j < end; j += blockDim.x) {
+    const index_t r = j / len * nchannel + c, m = j % len;
+    const AType dy = AType(grad_out.dptr_[r * grad_out.stride_ + m]);
+    sdy += dy;
+    sdyx += dy * (AType(data.dptr_[r * data.stride_ + m]) - mu);
+  }
+  sdy = RowAllReduce<red::sum>(sdy, s_buf);
+  sdyx = RowAllReduce<red::sum>(sdyx, s_buf);
+  if (threadIdx.x == 0) {
+    part[blockIdx.y * 2 * nchannel + 2 * c] = sdy;
+    part[blockIdx.y * 2 * nchannel + 2 * c + 1] = sdyx;
+  }
+}
+/*! \brief the gradients of gamma and beta, and the coefficients of grad_data */
+template<typename DType, typename AType>
+__global__ void BatchNormGradMergeKernel(Tensor<gpu, 1, DType> grad_gamma,
+                                         Tensor<gpu, 1, DType> grad_beta,
+                                         Tensor<gpu, 1, DType> invstd,
+                                         Tensor<gpu, 1, DType> gamma,
+                                         const AType *part, index_t nsplit,
+                                         AType inv_count, AType *coef) {
+  const index_t nchannel = gamma.size(0);
+  for (index_t c = blockIdx.x * blockDim.x + threadIdx.x; c < nchannel;
+       c += blockDim.x * gridDim.x) {
+    AType sdy = AType(0), sdyx = AType(0);
+    for (index_t k = 0; k < nsplit; ++k) {
+      sdy += part[k * 2 * nchannel + 2 * c];
+      sdyx += part[k * 2 * nchannel + 2 * c + 1];
+    }
+    const AType is = AType(invstd[c]), k = AType(gamma[c]) * is;
+    grad_beta[c] = DType(sdy);
+    grad_gamma[c] = DType(sdyx * is);
+    coef[3 * c] = k;
+    coef[3 * c + 1] = -k * sdy * inv_count;
+    coef[3 * c + 2] = -k * is * is * sdyx * inv_count;
+  }
+}
+template<typename DType, typename AType>
+__global__ void BatchNormGradDataKernel(Tensor<gpu, 3, DType> grad_data,
+                                        Tensor<gpu, 3, DType> grad_out,
+                                        Tensor<gpu, 3, DType> data,
+                                        Tensor<gpu, 1, DType> mean, const AType *coef) {
+  const index_t nchannel = data.size(1), len = data.size(2);
+  const index_t total = data.size(0) * nchannel * len;
+  for (index_t i = blockIdx.x * blockDim.x + threadIdx.x; i < total;
+       i += blockDim.x * gridDim.x) {
+    const index_t r = i / len, m = i % len, c = r % nchannel;
+    const AType dy = AType(grad_out.dptr_[r * grad_out.stride_ + m]);
+    const AType x = AType(data.dptr_[r * data.stride_ + m]) - AType(mean[c]);
+    grad_data.dptr_[r * grad_data.stride_ + m] =
+        DType(coef[3 * c] * dy + coef[3 * c + 1] + coef[3 * c + 2] * x);
+  }
+}
+/*! \brief layer normalization, warp threadIdx.y of the block normalizes a row */
+template<typename DType>
+__global__ void LayerNormForwardKernel(Tensor<gpu, 2, DType> out, Tensor<gpu, 1, DType> mean,
+                                       Tensor<gpu, 1, DType> invstd,
+                                       Tensor<gpu, 2, DType> data,
+                                       Tensor<gpu, 1, DType> gamma,
+                                       Tensor<gpu, 1, DType> beta, DType eps) {
+  typedef typename AccType<DType>::type AType;
+  const index_t nrow = data.size(0), len = data.size(1);
+  for (index_t r = blockIdx.x * blockDim.y + threadIdx.y; r < nrow;
+       r += blockDim.y * gridDim.x) {
+    const DType *x = data.dptr_ + r * data.stride_;
+    DType *y = out.dptr_ + r * out.stride_;
+    WelfordStat<AType> st;
+    for (index_t i = threadIdx.x; i < len; i += 32) st.Push(AType(x[i]));
+    WelfordWarpMerge(&st);
+    const AType m = st.mean, is = st.InvStd(AType(eps));
+    if (threadIdx.x == 0) {
+      mean[r] = DType(m);
+      invstd[r] = DType(is);
+    }
+    for (index_t i = threadIdx.x; i < len; i += 32) {
+      y[i] = DType((AType(x[i]) - m) * is * AType(gamma[i]) + AType(beta[i]));
+    }
+  }
+}
+/*! \brief gradient of the input of the layer normalization, a warp per row */
+template<typename DType>
+__global__ void LayerNormGradDataKernel(Tensor<gpu, 2, DType> grad_data,
+                                        Tensor<gpu, 2, DType> grad_out,
+                                        Tensor<gpu, 2, DType> data,
+                                        Tensor<gpu, 1, DType> mean,
+                                        Tensor<gpu, 1, DType> invstd,
+                                        Tensor<gpu, 1, DType> gamma) {
+  typedef typename AccType<DType>::type AType;
+  const index_t nrow = data.size(0), len = data.size(1);
+  for (index_t r = blockIdx.x * blockDim.y + threadIdx.y; r < nrow;
+       r += blockDim.y * gridDim.x) {
+    const DType *dy = grad_out.dptr_ + r * grad_out.stride_;
+    const DType *x = data.dptr_ + r * data.stride_;
+    DType *dx = grad_data.dptr_ + r * grad_data.stride_;
+    const AType m = AType(mean[r]), is = AType(invstd[r]);
+    AType s1 = AType(0), s2 = AType(0);
+    for (index_t i = threadIdx.x; i < len; i += 32) {
+      const AType g = AType(dy[i]) * AType(gamma[i]);
+      s1 += g;
+      s2 += g * (AType(x[i]) - m) * is;
+    }
+    s1 = WarpAllReduce<red::sum>(s1) / AType(len);
+    s2 = WarpAllReduce<red::sum>(s2) / AType(len);
+    for (index_t i = threadIdx.x; i < len; i += 32) {
+      const AType xhat = (AType(x[i]) - m) * is;
+      dx[i] = DType(is * (AType(dy[i]) * AType(gamma[i]) - s1 - xhat * s2));
+    }
+  }
+}
+/*!
+ * \brief sums of dy * xhat and dy of the 32 columns of the block over range blockIdx.y
+ *  of chunk rows, into part[blockIdx.y][col] and part[nsplit + blockIdx.y][col]
+ */
+template<typename DType, typename AType>
+__global__ void LayerNormGradParamKernel(Tensor<gpu, 2, DType> grad_out,
+                                         Tensor<gpu, 2, DType> data,
+                                         Tensor<gpu, 1, DType> mean,
+                                         Tensor<gpu, 1, DType> invstd,
+                                         Tensor<gpu, 2, AType> part, index_t chunk) {
+  __shared__ AType s_gamma[kNormRowsPerBlock][33];
+  __shared__ AType s_beta[kNormRowsPerBlock][33];
+  const index_t nrow = data.size(0), len = data.size(1), nsplit = gridDim.y;
+  const index_t col = blockIdx.x * 32 + threadIdx.x;
+  const index_t begin = blockIdx.y * chunk, end = min(begin + chunk, nrow);
+  AType sg = AType(0), sb = AType(0);
+  if (col < len) {
+    for (index_t r = begin + threadIdx.y; r < end; r += blockDim.y) {
+      const AType dy = AType(grad_out.dptr_[r * grad_out.stride_ + col]);
+      const AType xhat = (AType(data.dptr_[r * data.stride_ + col]) - AType(mean[r])) *
+          AType(invstd[r]);
+      sg += dy * xhat;
+      sb += dy;
+    }
+  }
+  s_gamma[threadIdx.y][threadIdx.x] = sg;
+  s_beta[threadIdx.y][threadIdx.x] = sb;
+  __syncthreads();
+  if (threadIdx.y == 0 && col < len) {
+    for (int k = 1; k < kNormRowsPerBlock; ++k) {
+      sg += s_gamma[k][threadIdx.x];
+      sb += s_beta[k][threadIdx.x];
+    }
+    part[blockIdx.y][col] = sg;
+    part[nsplit + blockIdx.y][col] = sb;
+  }
+}
+/*! \brief grid of the layer normalizations over nrow rows */
+inline dim3 NormRowGrid(index_t nrow) {
+  return dim3(std::max(index_t(1), std::min(
+      (nrow + kNormRowsPerBlock - 1) / kNormRowsPerBlock, static_cast<index_t>(kMaxGridNum))));
+}
+/*! \brief grid of a grid-stride kernel over total items */
+inline dim3 NormGrid(index_t total) {
+  return dim3(std::max(index_t(1), std::min(
+      (total + kBaseThreadNum - 1) / kBaseThreadNum, static_cast<index_t>(kMaxGridNum))));
+}
+}  // namespace cuda
+
+template<typename DType>
+inline void NormEngine<gpu, DType>::BatchNormForward(Tensor<gpu, 3, DType> out,
+                                                     Tensor<gpu, 1, DType> mean,
+                                                     Tensor<gpu, 1, DType> invstd,
+                                                     const Tensor<gpu, 3, DType> &data,
+                                                     const Tensor<gpu, 1, DType> &gamma,
+                                                     const Tensor<gpu, 1, DType> &beta,
+                                                     DType eps) {
+  typedef typename AccType<DType>::type AType;
+  cudaStream_t stream = Stream<gpu>::GetStream(data.stream_);
+  const index_t nchannel = data.size(1), total = data.size(0) * data.size(2);
+  CHECK_LE(nchannel, static_cast<index_t>(cuda::kMaxGridNum))
+      << "BatchNormForward: too many channels";
+  const index_t nsplit = cuda::GetReduceSplit(nchannel, total);
+  const index_t chunk = (total + nsplit - 1) / nsplit;
+  Tensor<gpu, 2, AType> part(Shape2(nsplit, 3 * nchannel));
+  part.stream_ = data.stream_;
+  AllocSpace(&part, false);
+  dim3 dimGrid(nchannel, nsplit);
+  cuda::CheckLaunchParam(dimGrid, dim3(cuda::kBaseThreadNum), "BatchNormStat");
+  cuda::BatchNormStatKernel<DType, AType>
+      <<<dimGrid, cuda::kBaseThreadNum, 0, stream>>>(data, part.dptr_, chunk);
+  cuda::BatchNormStatMergeKernel<DType, AType>
+      <<<cuda::NormGrid(nchannel), cuda::kBaseThreadNum, 0, stream>>>(
+          mean, invstd, part.dptr_, nsplit, eps);
+  cuda::BatchNormApplyKernel<DType>
+      <<<cuda::NormGrid(data.shape_.Size()), cuda::kBaseThreadNum, 0, stream>>>(
+          out, data, mean, invstd, gamma, beta);
+  FreeSpace(&part);
+}
+template<typename DType>
+inline void NormEngine<gpu, DType>::BatchNormApply(Tensor<gpu, 3, DType> out,
+                                                   const Tensor<gpu, 3, DType> &data,
+                                                   const Tensor<gpu, 1, DType> &mean,
+                                                   const Tensor<gpu, 1, DType> &invstd,
+                                                   const Tensor<gpu, 1, DType> &gamma,
+                                                   const Tensor<gpu, 1, DType> &beta) {
+  cudaStream_t stream = Stream<gpu>::GetStream(data.stream_);
+  cuda::BatchNormApplyKernel<DType>
+      <<<cuda::NormGrid(data.shape_.Size()), cuda::kBaseThreadNum, 0, stream>>>(
+          out, data, mean, invstd, gamma, beta);
+}
+template<typename DType>
+inline void NormEngine<gpu, DType>::BatchNormBackward(Tensor<gpu, 3, DType> grad_data,
+                                                      Tensor<gpu, 1, DType> grad_gamma,
+                                                      Tensor<gpu, 1, DType> grad_beta,
+                                                      const Tensor<gpu, 3, DType> &grad_out,
+                                                      const Tensor<gpu, 3, DType> &data,
+                                                      const Tensor<gpu, 1, DType> &mean,
+                                                      const Tensor<gpu, 1, DType> &invstd,
+                                                      const Tensor<gpu, 1, DType> &gamma) {
+  typedef typename AccType<DType>::type AType;
+  cudaStream_t stream = Stream<gpu>::GetStream(data.stream_);
+  const index_t nchannel = data.size(1), total = data.size(0) * data.size(2);
+  CHECK_LE(nchannel, static_cast<index_t>(cuda::kMaxGridNum))
+      << "BatchNormBackward: too many channels";
+  const index_t nsplit = cuda::GetReduceSplit(nchannel, total);
+  const index_t chunk = (total + nsplit - 1) / nsplit;
+  // the partial sums of the ranges, then the coefficients of grad_data
+  Tensor<gpu, 2, AType> part(Shape2(nsplit * 2 + 3, nchannel));
+  part.stream_ = data.stream_;
+  AllocSpace(&part, false);
+  AType *coef = part.dptr_ + nsplit * 2 * nchannel;
+  dim3 dimGrid(nchannel, nsplit);
+  cuda::CheckLaunchParam(dimGrid, dim3(cuda::kBaseThreadNum), "BatchNormGradSum");
+  cuda::BatchNormGradSumKernel<DType, AType>
+      <<<dimGrid, cuda::kBaseThreadNum, 0, stream>>>(grad_out, data, mean, part.dptr_, chunk);
+  cuda::BatchNormGradMergeKernel<DType, AType>
+      <<<cuda::NormGrid(nchannel), cuda::kBaseThreadNum, 0, stream>>>(
+          grad_gamma, grad_beta, invstd, gamma, part.dptr_, nsplit,
+          AType(1) / AType(total), coef);
+  cuda::BatchNormGradDataKernel<DType, AType>
+      <<<cuda::NormGrid(data.shape_.Size()), cuda::kBaseThreadNum, 0, stream>>>(
+          grad_data, grad_out, data, mean, coef);
+  FreeSpace(&part);
+}
+template<typename DType>
+inline void NormEngine<gpu, DType>::LayerNormForward(Tensor<gpu, 2, DType> out,
+                                                     Tensor<gpu, 1, DType> mean,
+                                                     Tensor<gpu, 1, DType> invstd,
+                                                     const Tensor<gpu, 2, DType> &data,
+                                                     const Tensor<gpu, 1, DType> &gamma,
+                                                     const Tensor<gpu, 1, DType> &beta,
+                                                     DType eps) {
+  cudaStream_t stream = Stream<gpu>::GetStream(data.stream_);
+  dim3 dimBlock(32, cuda::kNormRowsPerBlock);
+  cuda::LayerNormForwardKernel<DType>
+      <<<cuda::NormRowGrid(data.size(0)), dimBlock, 0, stream>>>(
+          out, mean, invstd, data, gamma, beta, eps);
+}
+template<typename DType>
+inline void NormEngine<gpu, DType>::LayerNormBackward(Tensor<gpu, 2, DType> grad_data,
+                                                      Tensor<gpu, 1, DType> grad_gamma,
+                                                      Tensor<gpu, 1, DType> grad_beta,
+                                                      const Tensor<gpu, 2, DType> &grad_out,
+                                                      const Tensor<gpu, 2, DType> &data,
+                                                      const Tensor<gpu, 1, DType> &mean,
+                                                      const Tensor<gpu, 1, DType> &invstd,
+                                                      const Tensor<gpu, 1, DType> &gamma) {
+  typedef typename AccType<DType>::type AType;
+  cudaStream_t stream = Stream<gpu>::GetStream(data.stream_);
+  const index_t nrow = data.size(0), len = data.size(1);
+  dim3 dimBlock(32, cuda::kNormRowsPerBlock);
+  // the sums of the columns first, grad_data may be written over grad_out or data
+  const index_t ncolblock = (len + 31) / 32;
+  CHECK_LE(ncolblock, static_cast<index_t>(cuda::kMaxGridNum))
+      << "LayerNormBackward: too many columns";
+  const index_t nsplit = cuda::GetReduceSplit(ncolblock, nrow);
+  const index_t chunk = (nrow + nsplit - 1) / nsplit;
+  Tensor<gpu, 2, AType> part(Shape2(2 * nsplit, len));
+  part.stream_ = data.stream_;
+  AllocSpace(&part, false);
+  dim3 dimGrid(ncolblock, nsplit);
+  cuda::CheckLaunchParam(dimGrid, dimBlock, "LayerNormGradParam");
+  cuda::LayerNormGradParamKernel<DType, AType>
+      <<<dimGrid, dimBlock, 0, stream>>>(grad_out, data, mean, invstd, part, chunk);
+  cuda::MapRedMergePart<sv::saveto, red::sum>(expr::MakePlan(grad_gamma),
+                                              part.Slice(0, nsplit), DType(1), stream);
+  cuda::MapRedMergePart<sv::saveto, red::sum>(expr::MakePlan(grad_beta),
+                                              part.Slice(nsplit, 2 * nsplit), DType(1), stream);
+  cuda::LayerNormGradDataKernel<DType>
+      <<<cuda::NormRowGrid(nrow), dimBlock, 0, stream>>>(
+          grad_data, grad_out, data, mean, invstd, gamma);
+  FreeSpace(&part);
+}
+}  // namespace mshadow
+#endif  // MSHADOW_CUDA_NORMALIZATION_CUH_
@@ -112,6 +112,89 @@ inline __device__ void Reduce1DNotAlign(volatile DType buf[], int x_size) {
   __RD_NON_ALIGN(else, 2)
   __RD_NON_ALIGN(else, 1)
 }
+/*! \brief butterfly shuffle within a warp, lanes exchange with lane ^ mask */
+#if CUDA_VERSION >= 9000
+#define MSHADOW_CUDA_SHFL_XOR(val, mask, width) __shfl_xor_sync(0xffffffff, val, mask, width)
+#else
+#define MSHADOW_CUDA_SHFL_XOR(val, mask, width) __shfl_xor(val, mask, width)
+#endif
+/*! \brief bit i is set if pred is true on lane i of the warp */
+#if CUDA_VERSION >= 9000
+#define MSHADOW_CUDA_BALLOT(pred) __ballot_sync(0xffffffff, pred)
+#else
+#define MSHADOW_CUDA_BALLOT(pred) __ballot(pred)
+#endif
+/*!
+ * \brief reduce over groups of width lanes of a warp with shuffles, no shared memory needed.
+ *  every lane of the group gets the result
+ * \tparam Reducer reducer
+ * \tparam DType content data type, float or double
+ * \param val value of this lane
+ * \param width group size, a power of 2 no larger than the warp size
+ */
+template<typename Reducer, typename DType>
+inline __device__ DType WarpAllReduce(DType val, int width = 32) {
+  for (int mask = width >> 1; mask > 0; mask >>= 1) {
+    Reducer::Reduce(val, static_cast<DType>(MSHADOW_CUDA_SHFL_XOR(val, mask, width)));
+  }
+  return val;
+}
+/*!
+ * \brief merge the partial result v found at index i into val found at idx,
+ *  ties keep the smaller index, so merging partial results in any order gives
+ *  the first position of the result as a sequential scan does for maximum and minimum
+ */
+template<typename Reducer, typename DType>
+inline __device__ void ReduceWithIndex(DType &val, index_t &idx,  // NOLINT(*)
+                                       DType v, index_t i) {
+  DType tmp = val;
+  Reducer::Reduce(val, v);
+  if (tmp != val) {
+    idx = i;
+  } else if (tmp == v && i < idx) {
+    idx = i;
+  }
+}
+/*!
+ * \brief WarpAllReduce of values together with their indices, see ReduceWithIndex
+ * \tparam DType content data type, float or double
+ */
+template<typename Reducer, typename DType>
+inline __device__ void WarpAllReduceWithIndex(DType &val, index_t &idx) {  // NOLINT(*)
+  for (int mask = 16; mask > 0; mask >>= 1) {
+    const DType v = MSHADOW_CUDA_SHFL_XOR(val, mask, 32);
+    const index_t i = MSHADOW_CUDA_SHFL_XOR(idx, mask, 32);
+    ReduceWithIndex<Reducer>(val, idx, v, i);
+  }
+}
+/*!
+ * \brief reduce over the blockDim.x threads of each threadIdx.y row of the block,
+ *  every thread gets the result of its row. warp results are combined in shared memory,
+ *  must be called by all threads of the block
+ * \tparam Reducer reducer
+ * \tparam DType content data type, float or double
+ * \param val value of this thread
+ * \param buf shared memory of 32 * blockDim.y elements
+ */
+template<typename Reducer, typename DType>
+inline __device__ DType RowAllReduce(DType val, DType *buf) {
+  val = WarpAllReduce<Reducer>(val);
+  if (blockDim.x > 32) {
+    const int lane = threadIdx.x & 31, wid = threadIdx.x >> 5;
+    DType *row = buf + threadIdx.y * 32;
+    // buf may still be read by an earlier reduction
+    __syncthreads();
+    if (lane == 0) row[wid] = val;
+    __syncthreads();
+    if (lane < static_cast<int>(blockDim.x >> 5)) {
+      val = row[lane];
+    } else {
+      Reducer::SetInitValue(val);
+    }
+    val = WarpAllReduce<Reducer>(val);
+  }
+  return val;
+}
 }  // namespace cuda
 }  // namespace mshadow
 #endif  // MSHADOW_CUDA_REDUCE_CUH_
@@ -6,13 +6,18 @@
  */
 #ifndef MSHADOW_CUDA_TENSOR_GPU_INL_CUH_
 #define MSHADOW_CUDA_TENSOR_GPU_INL_CUH_
+#include <algorithm>
 #include <thrust/device_ptr.h>
+#include <thrust/iterator/zip_iterator.h>
 #include <thrust/sort.h>
+#include <thrust/tuple.h>
 #if CUDA_VERSION >= 7000
 #include <thrust/system/cuda/execution_policy.h>
 #endif
 #include "../tensor.h"
+#include "./launch_tuner.cuh"
 #include "./reduce.cuh"
+#include "./vector_plan.cuh"
 
 namespace mshadow {
 namespace cuda {
@@ -55,96 +60,1102 @@ inline void CheckLaunchParam(dim3 dimGrid, dim3 dimBlock, const char *estr = "")
       << dimBlock.z << "]";
   }
 }
-template<typename Saver, typename DstPlan,
-         typename Plan, int block_dim_bits>
-__device__ void MapPlanProc(DstPlan dst, index_t xstride,
-                            Shape<2> dshape, const Plan exp, int block_idx) {
-  const index_t tid = (block_idx << block_dim_bits) + threadIdx.x;
-  const int y = tid / xstride;
-  const int x = tid % xstride;
-  if (y < dshape[0] && x < dshape[1]) {
-    Saver::Save(dst.REval(y, x), exp.Eval(y,x));
+/*!
+ * \brief largest number of items the map kernels index with 32 bit,
+ *  the grid stride step past the last item must not wrap
+ */
+const size_t kMaxMapIndex32 = 0xFFFFFFFFUL - static_cast<size_t>(kMaxGridNum) * kBaseThreadNum;
+/*! \brief number of multiprocessors of the current device, queried once per device */
+inline int GetNumMultiProcessor(void) {
+  const int kMaxDevice = 64;
+  static int num_sm[kMaxDevice] = {0};
+  int dev = 0;
+  MSHADOW_CUDA_CALL(cudaGetDevice(&dev));
+  int ret = dev < kMaxDevice ? num_sm[dev] : 0;
+  if (ret == 0) {
+    MSHADOW_CUDA_CALL(cudaDeviceGetAttribute(&ret, cudaDevAttrMultiProcessorCount, dev));
+    if (dev < kMaxDevice) num_sm[dev] = ret;
   }
+  return ret;
 }
-template<typename Saver,int block_dim_bits,
-         typename DstPlan, typename Plan>
-__global__ void MapPlanKernel(DstPlan dst, index_t xstride,
-                              Shape<2> dshape, const Plan exp) {
-  MapPlanProc<Saver, DstPlan, Plan, block_dim_bits>
-      (dst, xstride, dshape, exp, blockIdx.x);
+/*!
+ * \brief number of blocks of nthread threads for a grid stride kernel over num_item,
+ *  at most per_sm blocks per multiprocessor, or with per_sm 0 and the default nthread
+ *  the blocks of the kernel that are resident on the current device at once
+ */
+template<typename Kernel>
+inline dim3 GetMapGrid(Kernel kernel, size_t num_item, int nthread = kBaseThreadNum,
+                       int per_sm = 0) {
+  const size_t num_block = (num_item + nthread - 1) / nthread;
+  if (per_sm > 0) {
+    // the grid stride step stays below the one kMaxMapIndex32 allows for
+    const size_t max_block = std::min(static_cast<size_t>(GetNumMultiProcessor()) * per_sm,
+                                      static_cast<size_t>(kMaxGridNum) * kBaseThreadNum / nthread);
+    return dim3(static_cast<unsigned>(std::min(num_block, max_block)), 1, 1);
+  }
+#if CUDA_VERSION >= 6050
+  // the occupancy query is cached per kernel and device, it does not change between launches
+  const int kMaxDevice = 64;
+  static int resident[kMaxDevice] = {0};
+  int dev = 0;
+  MSHADOW_CUDA_CALL(cudaGetDevice(&dev));
+  int max_block = dev < kMaxDevice ? resident[dev] : 0;
+  if (max_block == 0) {
+    int num_sm = 0, per_sm = 0;
+    MSHADOW_CUDA_CALL(cudaDeviceGetAttribute(&num_sm, cudaDevAttrMultiProcessorCount, dev));
+    MSHADOW_CUDA_CALL(cudaOccupancyMaxActiveBlocksPerMultiprocessor(
+        &per_sm, kernel, kBaseThreadNum, 0));
+    max_block = std::max(1, std::min(num_sm * per_sm, kMaxGridNum));
+    if (dev < kMaxDevice) resident[dev] = max_block;
+  }
+#else
+  const int max_block = kBaseGridNum;
+#endif
+  return dim3(static_cast<unsigned>(std::min(num_block, static_cast<size_t>(max_block))), 1, 1);
 }
-template<typename Saver, int block_dim_bits, int grid_size,
-         typename DstPlan, typename Plan>
-__global__ void MapPlanLargeKernel(DstPlan dst, index_t xstride,
-                                   Shape<2> dshape, const Plan exp, int repeat) {
-  for (int i = 0; i < repeat; ++i) {
-  MapPlanProc<Saver, DstPlan, Plan, block_dim_bits>
-      (dst, xstride, dshape, exp, blockIdx.x + i * grid_size);
+/*!
+ * \brief elementwise map over the rows of dshape, padded to xstride,
+ *  each thread strides over the items by the size of the grid
+ * \tparam IndexType index_t, or uint64_t when there are more than kMaxMapIndex32 items
+ */
+template<typename Saver, typename IndexType, typename DstPlan, typename Plan>
+__global__ void MapPlanKernel(DstPlan dst, IndexType xstride, IndexType num_item,
+                              index_t xsize, const Plan exp) {
+  const IndexType step = static_cast<IndexType>(blockDim.x) * gridDim.x;
+  for (IndexType tid = static_cast<IndexType>(blockIdx.x) * blockDim.x + threadIdx.x;
+       tid < num_item; tid += step) {
+    const IndexType y = tid / xstride;
+    const index_t x = static_cast<index_t>(tid - y * xstride);
+    if (x < xsize) {
+      Saver::Save(dst.REval(static_cast<index_t>(y), x), exp.Eval(static_cast<index_t>(y), x));
+    }
   }
 }
-
+/*!
+ * \brief candidates of the map kernels, block is the threads per block and grid the
+ *  blocks per multiprocessor, the default fills the device by occupancy
+ */
+const LaunchConfig kMapLaunchCand[] = {
+  {kBaseThreadNum, 0}, {128, 8}, {128, 16}, {256, 4}, {256, 8}, {512, 2}, {512, 4}, {1024, 2}
+};
+const int kNumMapLaunchCand = sizeof(kMapLaunchCand) / sizeof(kMapLaunchCand[0]);
+/*! \brief launch of MapPlanKernel, see TunedLaunch */
+template<typename Saver, typename IndexType, typename DstPlan, typename Plan>
+struct MapPlanLaunch {
+  const DstPlan &dst;
+  const Plan &plan;
+  index_t xstride;
+  size_t num_item;
+  index_t xsize;
+  cudaStream_t stream;
+  inline void operator()(const LaunchConfig &cfg) const {
+    dim3 dimBlock(cfg.block, 1, 1);
+    dim3 dimGrid = GetMapGrid(MapPlanKernel<Saver, IndexType, DstPlan, Plan>,
+                              num_item, cfg.block, cfg.grid);
+    MapPlanKernel<Saver, IndexType, DstPlan, Plan>
+        <<<dimGrid, dimBlock, 0, stream>>>(dst, xstride, num_item, xsize, plan);
+  }
+};
+template<typename Saver, typename IndexType, typename DstPlan, typename Plan>
+inline void LaunchMapPlan(const DstPlan &dst, const Plan &plan, index_t xstride,
+                          size_t num_item, index_t xsize, const TuneRegion &out,
+                          cudaStream_t stream) {
+  MapPlanLaunch<Saver, IndexType, DstPlan, Plan> launch = {
+    dst, plan, xstride, num_item, xsize, stream
+  };
+  TunedLaunch<MapPlanLaunch<Saver, IndexType, DstPlan, Plan> >(
+      "MapPlan", num_item / xstride, xsize, kMapLaunchCand, kNumMapLaunchCand,
+      out, stream, launch);
+}
+/*!
+ * \brief elementwise map of plan into the rows of dshape of dst
+ * \param out the memory of dst, to tune the launch with MSHADOW_USE_AUTOTUNE, see
+ *  TuneRegionOf
+ */
 template<typename Saver, typename DstExp, typename E, typename DType>
 inline void MapPlan(expr::Plan<DstExp, DType> dst,
                     const expr::Plan<E, DType> &plan,
                     Shape<2> dshape,
-                    cudaStream_t stream) {
+                    cudaStream_t stream,
+                    const TuneRegion &out = TuneRegion()) {
   const index_t xstride = GetAlignStride(dshape[1]);
-  const int num_block = (dshape[0] * xstride + kBaseThreadNum-1) / kBaseThreadNum;
+  const size_t num_item = static_cast<size_t>(dshape[0]) * xstride;
+  if (num_item == 0) return;
+  if (num_item <= kMaxMapIndex32) {
+    LaunchMapPlan<Saver, index_t>(dst, plan, xstride, num_item, dshape[1], out, stream);
+  } else {
+    LaunchMapPlan<Saver, uint64_t>(dst, plan, xstride, num_item, dshape[1], out, stream);
+  }
+}
+/*!
+ * \brief elementwise map of a list of assignments, every thread runs all of them
+ *  at its element, see MapMulti
+ */
+template<typename IndexType, typename Plan>
+__global__ void MapMultiKernel(Plan plan, IndexType xstride, IndexType num_item,
+                               index_t xsize) {
+  const IndexType step = static_cast<IndexType>(blockDim.x) * gridDim.x;
+  for (IndexType tid = static_cast<IndexType>(blockIdx.x) * blockDim.x + threadIdx.x;
+       tid < num_item; tid += step) {
+    const IndexType y = tid / xstride;
+    const index_t x = static_cast<index_t>(tid - y * xstride);
+    if (x < xsize) plan.Map(static_cast<index_t>(y), x);
+  }
+}
+template<typename IndexType, typename Plan>
+inline void LaunchMapMulti(const Plan &plan, index_t xstride, size_t num_item,
+                           index_t xsize, cudaStream_t stream) {
   dim3 dimBlock(kBaseThreadNum, 1, 1);
-
-  if (num_block < kMaxGridNum) {
-    dim3 dimGrid(num_block, 1, 1);
-    MapPlanKernel<Saver, kBaseThreadBits,
-                  expr::Plan<DstExp, DType>,
-                  expr::Plan<E, DType> >
-        <<<dimGrid, dimBlock, 0, stream>>>(dst, xstride, dshape, plan);
+  dim3 dimGrid = GetMapGrid(MapMultiKernel<IndexType, Plan>, num_item);
+  MapMultiKernel<IndexType, Plan>
+      <<<dimGrid, dimBlock, 0, stream>>>(plan, xstride, num_item, xsize);
+}
+template<typename Plan>
+inline void MapMulti(const Plan &plan, Shape<2> dshape, cudaStream_t stream) {
+  const index_t xstride = GetAlignStride(dshape[1]);
+  const size_t num_item = static_cast<size_t>(dshape[0]) * xstride;
+  if (num_item == 0) return;
+  if (num_item <= kMaxMapIndex32) {
+    LaunchMapMulti<index_t>(plan, xstride, num_item, dshape[1], stream);
   } else {
-    int repeat = (num_block + kBaseGridNum-1) / kBaseGridNum;
-    dim3 dimGrid(kBaseGridNum, 1 , 1);
-    MapPlanLargeKernel<Saver, kBaseThreadBits, kBaseGridNum,
-                       expr::Plan<DstExp, DType>,
-                       expr::Plan<E, DType> >
-        <<<dimGrid, dimBlock, 0, stream>>>(dst, xstride, dshape, plan, repeat);
+    LaunchMapMulti<uint64_t>(plan, xstride, num_item, dshape[1], stream);
+  }
+}
+/*!
+ * \brief elementwise map that reads and writes VecData<DType>::kSize elements at once,
+ *  the item at the end of a row that is shorter than that goes through the scalar plan
+ * \param nvec number of items per row
+ */
+template<typename Saver, typename IndexType, typename DType, typename VPlan, typename Plan>
+__global__ void MapVecKernel(DType *dst, index_t dstride, IndexType nvec, IndexType num_item,
+                             index_t xsize, const VPlan vexp, const Plan exp) {
+  const index_t kSize = VecData<DType>::kSize;
+  const IndexType step = static_cast<IndexType>(blockDim.x) * gridDim.x;
+  for (IndexType tid = static_cast<IndexType>(blockIdx.x) * blockDim.x + threadIdx.x;
+       tid < num_item; tid += step) {
+    const IndexType y = tid / nvec;
+    const index_t x = static_cast<index_t>(tid - y * nvec) * kSize;
+    DType *p = dst + static_cast<size_t>(y) * dstride + x;
+    if (x + kSize <= xsize) {
+      VecSaver<Saver, DType>::Save(p, vexp.Eval(static_cast<index_t>(y), x));
+    } else {
+      for (index_t i = x; i < xsize; ++i) {
+        Saver::Save(p[i - x], exp.Eval(static_cast<index_t>(y), i));
+      }
+    }
   }
 }
+/*! \brief launch of MapVecKernel, see TunedLaunch */
+template<typename Saver, typename IndexType, typename DType, typename VPlan, typename Plan>
+struct MapVecLaunch {
+  DType *dst;
+  index_t dstride;
+  size_t nvec, num_item;
+  index_t xsize;
+  const VPlan &vplan;
+  const Plan &plan;
+  cudaStream_t stream;
+  inline void operator()(const LaunchConfig &cfg) const {
+    dim3 dimBlock(cfg.block, 1, 1);
+    dim3 dimGrid = GetMapGrid(MapVecKernel<Saver, IndexType, DType, VPlan, Plan>,
+                              num_item, cfg.block, cfg.grid);
+    MapVecKernel<Saver, IndexType, DType, VPlan, Plan>
+        <<<dimGrid, dimBlock, 0, stream>>>(dst, dstride, nvec, num_item, xsize, vplan, plan);
+  }
+};
+template<typename Saver, typename IndexType, typename DType, typename VPlan, typename Plan>
+inline void LaunchMapVec(DType *dst, index_t dstride, size_t nvec, size_t num_item,
+                         index_t xsize, const VPlan &vplan, const Plan &plan,
+                         cudaStream_t stream) {
+  MapVecLaunch<Saver, IndexType, DType, VPlan, Plan> launch = {
+    dst, dstride, nvec, num_item, xsize, vplan, plan, stream
+  };
+  const size_t nrow = num_item / nvec;
+  TunedLaunch<MapVecLaunch<Saver, IndexType, DType, VPlan, Plan> >(
+      "MapVec", nrow, xsize, kMapLaunchCand, kNumMapLaunchCand,
+      TuneRegion(dst, ((nrow - 1) * dstride + xsize) * sizeof(DType)), stream, launch);
+}
+/*!
+ * \brief vectorized MapPlan, used when the destination is a tensor and the expression
+ *  only has tensors, scalars and maps, see VecCheck
+ * \return false if some tensor is not aligned, the caller falls back to MapPlan
+ */
+template<typename Saver, typename R, typename E, typename DType,
+         bool pass = VecCheck<E, DType>::kPass>
+struct MapVecEngine {
+  inline static bool Map(R *dst, const E &exp, Shape<2> dshape, cudaStream_t stream) {
+    return false;
+  }
+  inline static bool MapFlat(const Tensor<gpu, 2, DType> &dst, const E &exp,
+                             size_t addr, cudaStream_t stream) {
+    return false;
+  }
+};
+template<typename Saver, int dim, typename E, typename DType>
+struct MapVecEngine<Saver, Tensor<gpu, dim, DType>, E, DType, true> {
+  inline static bool Map(Tensor<gpu, dim, DType> *dst, const E &exp,
+                         Shape<2> dshape, cudaStream_t stream) {
+    const index_t kSize = VecData<DType>::kSize;
+    if (dshape[1] < kSize || !VecAligned(*dst) || !VecAligned(exp)) return false;
+    const size_t nvec = (dshape[1] + kSize - 1) / kSize;
+    const size_t num_item = nvec * dshape[0];
+    if (num_item <= kMaxMapIndex32) {
+      LaunchMapVec<Saver, index_t>(dst->dptr_, dst->stride_, nvec, num_item, dshape[1],
+                                   MakeVecPlan(exp), expr::MakePlan(exp), stream);
+    } else {
+      LaunchMapVec<Saver, uint64_t>(dst->dptr_, dst->stride_, nvec, num_item, dshape[1],
+                                    MakeVecPlan(exp), expr::MakePlan(exp), stream);
+    }
+    return true;
+  }
+  /*!
+   * \brief the assignment into a view of one row made by expr::FlatView, only the data
+   *  pointers need to be aligned, the vectors run across the rows of the tensors
+   * \param addr the data pointers given by expr::FlatView
+   */
+  inline static bool MapFlat(const Tensor<gpu, 2, DType> &dst, const E &exp,
+                             size_t addr, cudaStream_t stream) {
+    const index_t kSize = VecData<DType>::kSize;
+    const index_t size = dst.size(1);
+    if (size < kSize || (addr & 15) != 0) return false;
+    const size_t nvec = (size + kSize - 1) / kSize;
+    if (nvec <= kMaxMapIndex32) {
+      LaunchMapVec<Saver, index_t>(dst.dptr_, size, nvec, nvec, size,
+                                   MakeVecPlan(exp), expr::MakePlan(exp), stream);
+    } else {
+      LaunchMapVec<Saver, uint64_t>(dst.dptr_, size, nvec, nvec, size,
+                                    MakeVecPlan(exp), expr::MakePlan(exp), stream);
+    }
+    return true;
+  }
+};
+/*!
+ * \brief maps an assignment to a tensor as one row of all the elements when expr::FlatView
+ *  allows it, so the grid is not padded at the end of every row of narrow tensors
+ * \return false if it does not, the caller maps it by rows
+ */
+template<typename Saver, typename R, typename E, typename DType>
+struct MapFlatEngine {
+  inline static bool Map(R *dst, const E &exp, cudaStream_t stream) {
+    return false;
+  }
+};
+template<typename Saver, int dim, typename E, typename DType>
+struct MapFlatEngine<Saver, Tensor<gpu, dim, DType>, E, DType> {
+  inline static bool Map(Tensor<gpu, dim, DType> *dst, const E &exp, cudaStream_t stream) {
+    Tensor<gpu, 2, DType> flat;
+    size_t addr = 0;
+    if (!expr::FlatView(*dst, exp, &flat, &addr)) return false;
+    if (!MapVecEngine<Saver, Tensor<gpu, 2, DType>, E, DType>
+        ::MapFlat(flat, exp, addr, stream)) {
+      MapPlan<Saver>(expr::MakePlan(flat), expr::MakePlan(exp), flat.shape_, stream,
+                     TuneRegionOf(flat, flat.shape_));
+    }
+    return true;
+  }
+};
 
-template<typename Saver,typename Reducer, int warp_bits,
-         typename DType, typename DstPlan, typename Plan>
-__global__ void MapRedKeepLowestKernel(DstPlan dst, Plan plan,
-                                       DType scale, Shape<2> eshape) {
-  const unsigned warp_size = 1 << warp_bits;
-  const unsigned x = (blockIdx.x << warp_bits) + threadIdx.x;
-  // to avoid bank conflict
-  __shared__ DType s_res[warp_size][warp_size + 1];
-  // note: reverse store [y][x], so that we can reduce over threadIdx.x, use warp optimization
-  if (threadIdx.y < eshape[0] && x < eshape[1]) {
-    s_res[threadIdx.x][threadIdx.y] = plan.Eval(threadIdx.y, x);
+/*!
+ * \brief dst[a][d][c][b] = src[a][b][c][d], each block moves 32x32 tiles of the (b, d)
+ *  plane through shared memory, so both the reads and the writes are coalesced
+ */
+template<typename Saver, int tile_bits, int block_rows, typename DType>
+__global__ void SwapBlocksKernel(DType *dst, const DType *src,
+                                 index_t B, index_t C, index_t D,
+                                 index_t nbt, index_t ndt, index_t ntile) {
+  const index_t kTile = 1 << tile_bits;
+  // one more column to avoid bank conflicts on the transposed read
+  __shared__ DType tile[1 << tile_bits][(1 << tile_bits) + 1];
+  for (index_t t = blockIdx.x; t < ntile; t += gridDim.x) {
+    const index_t dt = t % ndt;
+    const index_t bt = (t / ndt) % nbt;
+    const index_t ac = t / ndt / nbt;
+    const index_t c = ac % C, a = ac / C;
+    const DType *sp = src + (a * B * C + c) * D;
+    DType *dp = dst + (a * D * C + c) * B;
+    for (index_t j = threadIdx.y; j < kTile; j += block_rows) {
+      const index_t b = bt * kTile + j, d = dt * kTile + threadIdx.x;
+      if (b < B && d < D) tile[j][threadIdx.x] = sp[b * C * D + d];
+    }
+    __syncthreads();
+    for (index_t j = threadIdx.y; j < kTile; j += block_rows) {
+      const index_t d = dt * kTile + j, b = bt * kTile + threadIdx.x;
+      if (b < B && d < D) Saver::Save(dp[d * C * B + b], tile[threadIdx.x][j]);
+    }
+    __syncthreads();
+  }
+}
+/*! \brief dst[a][d][c][b] = src[a][b][c][d] */
+template<typename Saver, typename DType>
+inline void SwapBlocks(DType *dst, const DType *src, const Shape<5> &s,
+                       cudaStream_t stream) {
+  const int kTileBits = 5, kBlockRows = 8;
+  const index_t kTile = 1 << kTileBits;
+  const index_t nbt = (s[1] + kTile - 1) / kTile, ndt = (s[3] + kTile - 1) / kTile;
+  const index_t ntile = s[0] * s[2] * nbt * ndt;
+  if (ntile == 0) return;
+  dim3 dimBlock(kTile, kBlockRows, 1);
+  dim3 dimGrid(std::min(ntile, static_cast<index_t>(kMaxGridNum)), 1, 1);
+  CheckLaunchParam(dimGrid, dimBlock, "SwapBlocks");
+  SwapBlocksKernel<Saver, kTileBits, kBlockRows, DType>
+      <<<dimGrid, dimBlock, 0, stream>>>(dst, src, s[1], s[2], s[3], nbt, ndt, ntile);
+}
+
+/*!
+ * \brief each block pools tiles of (1 << tile_bits) x (1 << tile_bits) outputs of a plane,
+ *  the source region of the tile is staged in shared memory when it fits, so the taps
+ *  shared by overlapping windows are read from global memory once
+ */
+template<typename Saver, typename Reducer, bool with_index, int tile_bits,
+         typename DType, typename IType>
+__global__ void PoolKernel(DType *dst, index_t dstride, IType *index, index_t istride,
+                           const DType *src, index_t sstride,
+                           index_t height, index_t width, index_t pheight, index_t pwidth,
+                           index_t ksize_y, index_t ksize_x,
+                           index_t kstride_y, index_t kstride_x,
+                           index_t ntile_y, index_t ntile_x, index_t ntile,
+                           bool use_shared) {
+  const index_t kTile = 1 << tile_bits;
+  extern __shared__ char pool_smem[];
+  DType *stile = reinterpret_cast<DType*>(pool_smem);
+  const index_t th = (kTile - 1) * kstride_y + ksize_y;
+  const index_t tw = (kTile - 1) * kstride_x + ksize_x;
+  for (index_t t = blockIdx.x; t < ntile; t += gridDim.x) {
+    const index_t tx = t % ntile_x, ty = (t / ntile_x) % ntile_y, c = t / ntile_x / ntile_y;
+    const index_t y0 = ty * kTile * kstride_y, x0 = tx * kTile * kstride_x;
+    const DType *sp = src + (c * height + y0) * sstride + x0;
+    // rows and columns of the region that are inside the image
+    const index_t ylim = height > y0 ? height - y0 : 0;
+    const index_t xlim = width > x0 ? width - x0 : 0;
+    const DType *win = sp;
+    index_t pitch = sstride;
+    if (use_shared) {
+      __syncthreads();
+      for (index_t i = threadIdx.y; i < th && i < ylim; i += blockDim.y) {
+        for (index_t j = threadIdx.x; j < tw && j < xlim; j += blockDim.x) {
+          stile[i * tw + j] = sp[i * sstride + j];
+        }
+      }
+      __syncthreads();
+      win = stile; pitch = tw;
+    }
+    const index_t py = ty * kTile + threadIdx.y, px = tx * kTile + threadIdx.x;
+    if (py < pheight && px < pwidth) {
+      const index_t ys = threadIdx.y * kstride_y, xs = threadIdx.x * kstride_x;
+      const index_t ye = min(ys + ksize_y, ylim), xe = min(xs + ksize_x, xlim);
+      DType res; Reducer::SetInitValue(res);
+      index_t best = (y0 + ys) * width + x0 + xs;
+      for (index_t i = ys; i < ye; ++i) {
+        for (index_t j = xs; j < xe; ++j) {
+          const DType v = win[i * pitch + j];
+          if (with_index) {
+            if (res < v) {
+              res = v; best = (y0 + i) * width + x0 + j;
+            }
+          } else {
+            Reducer::Reduce(res, v);
+          }
+        }
+      }
+      Saver::Save(dst[(c * pheight + py) * dstride + px], res);
+      if (with_index) index[(c * pheight + py) * istride + px] = static_cast<IType>(best);
+    }
   }
-  for (unsigned y = warp_size; y < eshape[0]; y += warp_size) {
-    if (threadIdx.y + y < eshape[0] && x < eshape[1]) {
-      Reducer::Reduce(s_res[threadIdx.x][threadIdx.y], plan.Eval(threadIdx.y + y, x));
+}
+/*!
+ * \brief candidates of Pool, grid is the most blocks per multiprocessor, 0 for a block
+ *  per tile, block is not used
+ */
+const LaunchConfig kPoolLaunchCand[] = {{0, 0}, {0, 4}, {0, 8}, {0, 16}, {0, 32}};
+const int kNumPoolLaunchCand = sizeof(kPoolLaunchCand) / sizeof(kPoolLaunchCand[0]);
+/*! \brief launch of PoolKernel, see TunedLaunch */
+template<typename Saver, typename Reducer, bool with_index, int tile_bits,
+         typename DType, typename IType>
+struct PoolLaunch {
+  Tensor<gpu, 3, DType> dst;
+  Tensor<gpu, 3, IType> index;
+  Tensor<gpu, 3, DType> src;
+  index_t ksize_y, ksize_x, kstride_y, kstride_x;
+  index_t ntile_y, ntile_x, ntile;
+  size_t smem;
+  bool use_shared;
+  cudaStream_t stream;
+  inline void operator()(const LaunchConfig &cfg) const {
+    const index_t kTile = 1 << tile_bits;
+    index_t nblock = std::min(ntile, static_cast<index_t>(kMaxGridNum));
+    if (cfg.grid > 0) {
+      nblock = std::min(nblock, static_cast<index_t>(GetNumMultiProcessor()) * cfg.grid);
     }
+    dim3 dimBlock(kTile, kTile, 1);
+    dim3 dimGrid(nblock, 1, 1);
+    CheckLaunchParam(dimGrid, dimBlock, "Pool");
+    PoolKernel<Saver, Reducer, with_index, tile_bits, DType, IType>
+        <<<dimGrid, dimBlock, use_shared ? smem : 0, stream>>>
+        (dst.dptr_, dst.stride_, index.dptr_, index.stride_, src.dptr_, src.stride_,
+         src.size(1), src.size(2), dst.size(1), dst.size(2),
+         ksize_y, ksize_x, kstride_y, kstride_x, ntile_y, ntile_x, ntile, use_shared);
   }
-  __syncthreads();
-  if (eshape[0] >= warp_size) {
-    Reduce1D<Reducer, warp_bits>(s_res[threadIdx.y]);
+};
+/*! \brief pool each plane of src into dst */
+template<typename Saver, typename Reducer, bool with_index, typename DType, typename IType>
+inline void Pool(Tensor<gpu, 3, DType> dst, Tensor<gpu, 3, IType> index,
+                 const Tensor<gpu, 3, DType> &src,
+                 index_t ksize_y, index_t ksize_x, index_t kstride_y, index_t kstride_x) {
+  const int kTileBits = 4;
+  const index_t kTile = 1 << kTileBits;
+  const index_t ntile_y = (dst.size(1) + kTile - 1) / kTile;
+  const index_t ntile_x = (dst.size(2) + kTile - 1) / kTile;
+  const index_t ntile = dst.size(0) * ntile_y * ntile_x;
+  if (ntile == 0) return;
+  const size_t smem = ((kTile - 1) * kstride_y + ksize_y) *
+      ((kTile - 1) * kstride_x + ksize_x) * sizeof(DType);
+  // large kernels or strides read straight from global memory
+  const bool use_shared = smem <= (32UL << 10);
+  PoolLaunch<Saver, Reducer, with_index, kTileBits, DType, IType> launch = {
+    dst, index, src, ksize_y, ksize_x, kstride_y, kstride_x,
+    ntile_y, ntile_x, ntile, smem, use_shared, Stream<gpu>::GetStream(dst.stream_)
+  };
+  // the index is assigned, not saved with Saver, so only dst is restored while tuning
+  TunedLaunch<PoolLaunch<Saver, Reducer, with_index, kTileBits, DType, IType> >(
+      "Pool", ntile, static_cast<size_t>(ksize_y) * ksize_x,
+      kPoolLaunchCand, kNumPoolLaunchCand,
+      TuneRegionOf(dst, dst.shape_.FlatTo2D()), launch.stream, launch);
+}
+/*!
+ * \brief reduce_with_axis over the last axis, each warp reduces source rows into
+ *  the output at the same flat position
+ */
+template<typename Saver, typename Reducer, bool mask, typename DType>
+__global__ void ReduceWithAxisRowKernel(DType *dst, index_t dstride, index_t dlast,
+                                        const DType *src, index_t sstride,
+                                        index_t nrow, index_t size) {
+  typedef typename AccType<DType>::type AType;
+  for (index_t y = blockIdx.x * blockDim.y + threadIdx.y; y < nrow;
+       y += gridDim.x * blockDim.y) {
+    const DType *srow = src + y * sstride;
+    AType res; Reducer::SetInitValue(res);
+    index_t idx = 0;
+    for (index_t k = threadIdx.x; k < size; k += 32) {
+      AType tmp = res;
+      Reducer::Reduce(res, AType(srow[k]));
+      if (mask && tmp != res) idx = k;
+    }
+    if (mask) {
+      WarpAllReduceWithIndex<Reducer>(res, idx);
+    } else {
+      res = WarpAllReduce<Reducer>(res);
+    }
+    if (threadIdx.x == 0) {
+      Saver::Save(dst[(y / dlast) * dstride + y % dlast],
+                  mask ? static_cast<DType>(static_cast<int>(idx)) : DType(res));
+    }
+  }
+}
+/*!
+ * \brief reduce_with_axis over another axis, output row u reduces the source rows
+ *  base(u) + k * nstep. Each block takes 32 consecutive columns of an output row,
+ *  threadIdx.x reads along the columns and the block_rows rows of threads split k,
+ *  the partial results are merged in shared memory
+ */
+template<typename Saver, typename Reducer, bool mask, int block_rows, typename DType>
+__global__ void ReduceWithAxisColKernel(DType *dst, index_t dstride,
+                                        const DType *src, index_t sstride,
+                                        index_t ncol, index_t size, index_t nstep,
+                                        index_t ntile, index_t nitem) {
+  typedef typename AccType<DType>::type AType;
+  __shared__ AType sres[block_rows][33];
+  __shared__ index_t sidx[block_rows][33];
+  for (index_t item = blockIdx.x; item < nitem; item += gridDim.x) {
+    const index_t u = item / ntile, x = (item % ntile) * 32 + threadIdx.x;
+    const index_t base = (u / nstep) * size * nstep + u % nstep;
+    AType res; Reducer::SetInitValue(res);
+    index_t idx = 0;
+    if (x < ncol) {
+      for (index_t k = threadIdx.y; k < size; k += block_rows) {
+        AType tmp = res;
+        Reducer::Reduce(res, AType(src[(base + k * nstep) * sstride + x]));
+        if (mask && tmp != res) idx = k;
+      }
+    }
+    __syncthreads();
+    sres[threadIdx.y][threadIdx.x] = res;
+    sidx[threadIdx.y][threadIdx.x] = idx;
+    __syncthreads();
+    if (threadIdx.y == 0 && x < ncol) {
+      for (int j = 1; j < block_rows; ++j) {
+        if (mask) {
+          ReduceWithIndex<Reducer>(res, idx, sres[j][threadIdx.x], sidx[j][threadIdx.x]);
+        } else {
+          Reducer::Reduce(res, sres[j][threadIdx.x]);
+        }
+      }
+      Saver::Save(dst[u * dstride + x],
+                  mask ? static_cast<DType>(static_cast<int>(idx)) : DType(res));
+    }
+  }
+}
+/*! \brief reduce src (outer, size, trailing) along size into dst (outer, trailing) */
+template<typename Saver, typename Reducer, bool mask, typename DType>
+inline void ReduceWithAxis(Tensor<gpu, 2, DType> dst, const Tensor<gpu, 2, DType> &src,
+                           index_t size, index_t trailing) {
+  const int kBlockRows = kBaseThreadNum / 32;
+  const index_t ncol = src.size(1);
+  dim3 dimBlock(32, kBlockRows, 1);
+  cudaStream_t stream = Stream<gpu>::GetStream(dst.stream_);
+  if (trailing == 1 && size == ncol) {
+    const index_t nrow = src.size(0);
+    dim3 dimGrid(std::min((nrow + kBlockRows - 1) / kBlockRows,
+                          static_cast<index_t>(kMaxGridNum)), 1, 1);
+    CheckLaunchParam(dimGrid, dimBlock, "ReduceWithAxis");
+    ReduceWithAxisRowKernel<Saver, Reducer, mask, DType>
+        <<<dimGrid, dimBlock, 0, stream>>>(dst.dptr_, dst.stride_, dst.size(1),
+                                           src.dptr_, src.stride_, nrow, size);
   } else {
-    Reduce1DNotAlign<Reducer, warp_bits>(s_res[threadIdx.y], eshape[0]);
+    const index_t ntile = (ncol + 31) / 32, nitem = dst.size(0) * ntile;
+    dim3 dimGrid(std::min(nitem, static_cast<index_t>(kMaxGridNum)), 1, 1);
+    CheckLaunchParam(dimGrid, dimBlock, "ReduceWithAxis");
+    ReduceWithAxisColKernel<Saver, Reducer, mask, kBlockRows, DType>
+        <<<dimGrid, dimBlock, 0, stream>>>(dst.dptr_, dst.stride_, src.dptr_, src.stride_,
+                                           ncol, size, trailing / ncol, ntile, nitem);
+  }
+}
+/*!
+ * \brief each source element sums the pooled gradients of the windows covering it
+ *  whose recorded argmax it is, no atomics are needed
+ */
+template<typename DType, typename IType>
+__global__ void UnPoolWithIndexKernel(DType *grad_src, index_t gstride,
+                                      const IType *index, index_t istride,
+                                      const DType *grad_pooled, index_t pstride,
+                                      index_t height, index_t width,
+                                      index_t pheight, index_t pwidth,
+                                      index_t ksize_y, index_t ksize_x,
+                                      index_t kstride_y, index_t kstride_x,
+                                      index_t num) {
+  for (index_t i = blockIdx.x * blockDim.x + threadIdx.x; i < num;
+       i += blockDim.x * gridDim.x) {
+    const index_t x = i % width, y = (i / width) % height, c = i / width / height;
+    const index_t py_min = y < ksize_y ? 0 : (y - ksize_y + kstride_y) / kstride_y;
+    const index_t px_min = x < ksize_x ? 0 : (x - ksize_x + kstride_x) / kstride_x;
+    const index_t py_max = min((y + kstride_y) / kstride_y, pheight);
+    const index_t px_max = min((x + kstride_x) / kstride_x, pwidth);
+    const index_t offset = y * width + x;
+    DType val = DType(0);
+    for (index_t py = py_min; py < py_max; ++py) {
+      for (index_t px = px_min; px < px_max; ++px) {
+        const index_t p = c * pheight + py;
+        if (static_cast<index_t>(index[p * istride + px]) == offset) {
+          val += grad_pooled[p * pstride + px];
+        }
+      }
+    }
+    grad_src[(c * height + y) * gstride + x] = val;
   }
+}
+/*! \brief gradient of Pool with index */
+template<typename DType, typename IType>
+inline void UnPoolWithIndex(Tensor<gpu, 3, DType> grad_src,
+                            const Tensor<gpu, 3, IType> &index,
+                            const Tensor<gpu, 3, DType> &grad_pooled,
+                            index_t ksize_y, index_t ksize_x,
+                            index_t kstride_y, index_t kstride_x) {
+  const index_t num = grad_src.shape_.Size();
+  if (num == 0) return;
+  dim3 dimBlock(kBaseThreadNum);
+  dim3 dimGrid(std::min((num + kBaseThreadNum - 1) / kBaseThreadNum,
+                        static_cast<index_t>(kMaxGridNum)));
+  CheckLaunchParam(dimGrid, dimBlock, "UnPoolWithIndex");
+  cudaStream_t stream = Stream<gpu>::GetStream(grad_src.stream_);
+  UnPoolWithIndexKernel<DType, IType><<<dimGrid, dimBlock, 0, stream>>>
+      (grad_src.dptr_, grad_src.stride_, index.dptr_, index.stride_,
+       grad_pooled.dptr_, grad_pooled.stride_,
+       grad_src.size(1), grad_src.size(2), grad_pooled.size(1), grad_pooled.size(2),
+       ksize_y, ksize_x, kstride_y, kstride_x, num);
+}
+
+/*! \brief rows and columns of the tile of source elements of a block of UnPool */
+const int kUnPoolTileY = 8, kUnPoolTileX = 32;
+/*!
+ * \brief each block takes tiles of kUnPoolTileY x kUnPoolTileX source elements of a plane,
+ *  the pooled values and gradients of the windows covering the tile are staged in shared
+ *  memory when they fit, each thread gathers the windows covering its element
+ */
+template<typename Saver, typename Reducer, typename DType>
+__global__ void UnPoolKernel(Tensor<gpu, 3, DType> grad_src, Tensor<gpu, 3, DType> data_src,
+                             Tensor<gpu, 3, DType> data_pooled,
+                             Tensor<gpu, 3, DType> grad_pooled,
+                             index_t ksize_y, index_t ksize_x,
+                             index_t kstride_y, index_t kstride_x,
+                             index_t ntile_y, index_t ntile_x, index_t ntile,
+                             index_t tph, index_t tpw, bool use_shared) {
+  extern __shared__ char unpool_smem[];
+  DType *spooled = reinterpret_cast<DType*>(unpool_smem);
+  DType *sgrad = spooled + tph * tpw;
+  const index_t height = grad_src.size(1), width = grad_src.size(2);
+  const index_t pheight = grad_pooled.size(1), pwidth = grad_pooled.size(2);
+  for (index_t t = blockIdx.x; t < ntile; t += gridDim.x) {
+    const index_t tx = t % ntile_x, ty = (t / ntile_x) % ntile_y, c = t / ntile_x / ntile_y;
+    const index_t y0 = ty * kUnPoolTileY, x0 = tx * kUnPoolTileX;
+    // the windows covering the tile
+    const index_t py0 = y0 < ksize_y ? 0 : (y0 - ksize_y + kstride_y) / kstride_y;
+    const index_t px0 = x0 < ksize_x ? 0 : (x0 - ksize_x + kstride_x) / kstride_x;
+    const DType *pp = data_pooled.dptr_ + (c * pheight + py0) * data_pooled.stride_ + px0;
+    const DType *gp = grad_pooled.dptr_ + (c * pheight + py0) * grad_pooled.stride_ + px0;
+    index_t ppitch = data_pooled.stride_, gpitch = grad_pooled.stride_;
+    if (use_shared) {
+      const index_t ylim = min(tph, pheight - min(py0, pheight));
+      const index_t xlim = min(tpw, pwidth - min(px0, pwidth));
+      __syncthreads();
+      for (index_t i = threadIdx.y; i < ylim; i += blockDim.y) {
+        for (index_t j = threadIdx.x; j < xlim; j += blockDim.x) {
+          spooled[i * tpw + j] = pp[i * ppitch + j];
+          sgrad[i * tpw + j] = gp[i * gpitch + j];
+        }
+      }
+      __syncthreads();
+      pp = spooled; gp = sgrad;
+      ppitch = tpw; gpitch = tpw;
+    }
+    const index_t y = y0 + threadIdx.y, x = x0 + threadIdx.x;
+    if (y < height && x < width) {
+      const DType vsrc = data_src[c][y][x];
+      const index_t py_begin = y < ksize_y ? 0 : (y - ksize_y + kstride_y) / kstride_y;
+      const index_t px_begin = x < ksize_x ? 0 : (x - ksize_x + kstride_x) / kstride_x;
+      const index_t py_end = min((y + kstride_y) / kstride_y, pheight);
+      const index_t px_end = min((x + kstride_x) / kstride_x, pwidth);
+      DType val = DType(0);
+      for (index_t py = py_begin; py < py_end; ++py) {
+        const DType *prow = pp + (py - py0) * ppitch - px0;
+        const DType *grow = gp + (py - py0) * gpitch - px0;
+        for (index_t px = px_begin; px < px_end; ++px) {
+          val += Reducer::PartialGrad(vsrc, prow[px]) * grow[px];
+        }
+      }
+      Saver::Save(grad_src[c][y][x], val);
+    }
+  }
+}
+/*! \brief grad_src = unpool<Reducer>(data_src, data_pooled, grad_pooled) on planes */
+template<typename Saver, typename Reducer, typename DType>
+inline void UnPool(Tensor<gpu, 3, DType> grad_src, const Tensor<gpu, 3, DType> &data_src,
+                   const Tensor<gpu, 3, DType> &data_pooled,
+                   const Tensor<gpu, 3, DType> &grad_pooled,
+                   index_t ksize_y, index_t ksize_x, index_t kstride_y, index_t kstride_x) {
+  const index_t ntile_y = (grad_src.size(1) + kUnPoolTileY - 1) / kUnPoolTileY;
+  const index_t ntile_x = (grad_src.size(2) + kUnPoolTileX - 1) / kUnPoolTileX;
+  const index_t ntile = grad_src.size(0) * ntile_y * ntile_x;
+  if (ntile == 0) return;
+  // most windows covering a tile in each direction
+  const index_t tph = (kUnPoolTileY + ksize_y - 2) / kstride_y + 1;
+  const index_t tpw = (kUnPoolTileX + ksize_x - 2) / kstride_x + 1;
+  const size_t smem = 2 * tph * tpw * sizeof(DType);
+  // large kernels read straight from global memory
+  const bool use_shared = smem <= (32UL << 10);
+  dim3 dimBlock(kUnPoolTileX, kUnPoolTileY, 1);
+  dim3 dimGrid(std::min(ntile, static_cast<index_t>(kMaxGridNum)), 1, 1);
+  CheckLaunchParam(dimGrid, dimBlock, "UnPool");
+  cudaStream_t stream = Stream<gpu>::GetStream(grad_src.stream_);
+  UnPoolKernel<Saver, Reducer, DType>
+      <<<dimGrid, dimBlock, use_shared ? smem : 0, stream>>>
+      (grad_src, data_src, data_pooled, grad_pooled, ksize_y, ksize_x, kstride_y, kstride_x,
+       ntile_y, ntile_x, ntile, tph, tpw, use_shared);
+}
+/*! \brief rows and columns of the tile of pixels of a block of PackColToPatch */
+const int kColToPatchTileY = 8, kColToPatchTileX = 32;
+/*!
+ * \brief each block takes tiles of kColToPatchTileY x kColToPatchTileX pixels of an image
+ *  plane, the taps reading each row and each column of the tile are found once, kept in
+ *  shared memory, then each thread gathers the taps of its pixel
+ */
+template<typename Saver, typename DType>
+__global__ void PackColToPatchKernel(Tensor<gpu, 4, DType> img, Tensor<gpu, 2, DType> col,
+                                     index_t psize_y, index_t psize_x,
+                                     index_t pstride_y, index_t pstride_x,
+                                     index_t pdilate_y, index_t pdilate_x,
+                                     index_t kstep_y, index_t kstep_x,
+                                     index_t o_height, index_t o_width,
+                                     index_t ntile_y, index_t ntile_x, index_t ntile) {
+  __shared__ index_t s_ky[2][kColToPatchTileY];
+  __shared__ index_t s_kx[2][kColToPatchTileX];
+  const index_t nchannel = img.size(1), height = img.size(2), width = img.size(3);
+  for (index_t t = blockIdx.x; t < ntile; t += gridDim.x) {
+    const index_t tx = t % ntile_x, ty = (t / ntile_x) % ntile_y, p = t / ntile_x / ntile_y;
+    const index_t c = p % nchannel, n = p / nchannel;
+    const index_t y = ty * kColToPatchTileY + threadIdx.y;
+    const index_t x = tx * kColToPatchTileX + threadIdx.x;
+    __syncthreads();
+    if (threadIdx.y == 0) {
+      s_kx[0][threadIdx.x] = expr::PatchTapBegin(x, psize_x, pstride_x, pdilate_x, kstep_x,
+                                                 o_width, &s_kx[1][threadIdx.x]);
+    }
+    if (threadIdx.x == 0) {
+      s_ky[0][threadIdx.y] = expr::PatchTapBegin(y, psize_y, pstride_y, pdilate_y, kstep_y,
+                                                 o_height, &s_ky[1][threadIdx.y]);
+    }
+    __syncthreads();
+    if (y < height && x < width) {
+      const index_t ky_end = s_ky[1][threadIdx.y], kx_begin = s_kx[0][threadIdx.x];
+      const index_t kx_end = s_kx[1][threadIdx.x];
+      DType res = DType(0);
+      for (index_t ky = s_ky[0][threadIdx.y]; ky < ky_end; ky += kstep_y) {
+        const index_t base = (n * o_height + (y - ky * pdilate_y) / pstride_y) * o_width;
+        for (index_t kx = kx_begin; kx < kx_end; kx += kstep_x) {
+          res += col[(c * psize_y + ky) * psize_x + kx][base + (x - kx * pdilate_x) / pstride_x];
+        }
+      }
+      Saver::Save(img[n][c][y][x], res);
+    }
+  }
+}
+/*! \brief img = pack_col2patch(col) */
+template<typename Saver, typename DType>
+inline void PackColToPatch(Tensor<gpu, 4, DType> img, const Tensor<gpu, 2, DType> &col,
+                           index_t psize_y, index_t psize_x,
+                           index_t pstride_y, index_t pstride_x,
+                           index_t pdilate_y, index_t pdilate_x) {
+  const index_t height = img.size(2), width = img.size(3);
+  const index_t ntile_y = (height + kColToPatchTileY - 1) / kColToPatchTileY;
+  const index_t ntile_x = (width + kColToPatchTileX - 1) / kColToPatchTileX;
+  const index_t ntile = img.size(0) * img.size(1) * ntile_y * ntile_x;
+  if (ntile == 0) return;
+  const index_t o_height = (height - (pdilate_y * (psize_y - 1) + 1)) / pstride_y + 1;
+  const index_t o_width = (width - (pdilate_x * (psize_x - 1) + 1)) / pstride_x + 1;
+  dim3 dimBlock(kColToPatchTileX, kColToPatchTileY, 1);
+  dim3 dimGrid(std::min(ntile, static_cast<index_t>(kMaxGridNum)), 1, 1);
+  CheckLaunchParam(dimGrid, dimBlock, "PackColToPatch");
+  cudaStream_t stream = Stream<gpu>::GetStream(img.stream_);
+  PackColToPatchKernel<Saver, DType><<<dimGrid, dimBlock, 0, stream>>>
+      (img, col, psize_y, psize_x, pstride_y, pstride_x, pdilate_y, pdilate_x,
+       expr::PatchTapStep(pstride_y, pdilate_y), expr::PatchTapStep(pstride_x, pdilate_x),
+       o_height, o_width, ntile_y, ntile_x, ntile);
+}
+/*!
+ * \brief a thread per (batch, y, x) pixel walks the channels, neighbouring threads read
+ *  neighbouring x so every channel row is read coalesced; sums keep a running sum,
+ *  selections keep the best value of the window and rescan only when it leaves
+ */
+template<typename Saver, typename Reducer, typename DType>
+__global__ void ChannelPoolKernel(Tensor<gpu, 4, DType> dst, Tensor<gpu, 4, DType> src,
+                                  index_t nsize, index_t stride, index_t pad, index_t limit,
+                                  index_t num) {
+  typedef typename AccType<DType>::type AType;
+  const bool run_sum = expr::ChannelWindow<Reducer>::kKind == expr::kChannelWindowSum;
+  const index_t nchannel = dst.size(1), height = dst.size(2), width = dst.size(3);
+  for (index_t i = blockIdx.x * blockDim.x + threadIdx.x; i < num;
+       i += blockDim.x * gridDim.x) {
+    const index_t x = i % width, y = (i / width) % height, n = i / width / height;
+    index_t lo = 0, hi = 0, arg = 0;
+    AType acc = AType(0);
+    DType best; Reducer::SetInitValue(best);
+    for (index_t c = 0; c < nchannel; ++c) {
+      index_t end;
+      const index_t begin = expr::ChannelPoolBegin(c, nsize, stride, pad, limit, &end);
+      DType res; Reducer::SetInitValue(res);
+      if (begin < end) {
+        if (begin >= hi) {
+          lo = hi = arg = begin;
+          acc = AType(0);
+          Reducer::SetInitValue(best);
+        }
+        if (run_sum) {
+          for (; hi < end; ++hi) acc += AType(src[n][hi][y][x]);
+          for (; lo < begin; ++lo) acc -= AType(src[n][lo][y][x]);
+          res = DType(acc);
+        } else {
+          if (arg < begin) {
+            // the best value left the window, rescan what remains of it
+            Reducer::SetInitValue(best);
+            hi = arg = begin;
+          }
+          for (; hi < end; ++hi) {
+            const DType v = src[n][hi][y][x];
+            DType t = best;
+            Reducer::Reduce(t, v);
+            // on ties the later channel stays in the window longer
+            if (t == v) {
+              best = v; arg = hi;
+            }
+          }
+          res = best;
+        }
+      }
+      Saver::Save(dst[n][c][y][x], res);
+    }
+  }
+}
+/*! \brief dst = chpool<Reducer>(src, nsize, stride, pad) on (batch, channel, y, x) */
+template<typename Saver, typename Reducer, typename DType>
+inline void ChannelPool(Tensor<gpu, 4, DType> dst, const Tensor<gpu, 4, DType> &src,
+                        index_t nsize, index_t stride, index_t pad) {
+  const index_t num = dst.size(0) * dst.size(2) * dst.size(3);
+  if (num == 0) return;
+  dim3 dimBlock(kBaseThreadNum);
+  dim3 dimGrid(std::min((num + kBaseThreadNum - 1) / kBaseThreadNum,
+                        static_cast<index_t>(kMaxGridNum)));
+  CheckLaunchParam(dimGrid, dimBlock, "ChannelPool");
+  cudaStream_t stream = Stream<gpu>::GetStream(dst.stream_);
+  ChannelPoolKernel<Saver, Reducer, DType><<<dimGrid, dimBlock, 0, stream>>>
+      (dst, src, nsize, stride, pad, src.size(1), num);
+}
+/*!
+ * \brief a thread per (batch, y, x) pixel walks the source channels with coalesced reads,
+ *  sums keep a running sum of the pooled gradient over the covering windows
+ */
+template<typename Saver, typename Reducer, typename DType>
+__global__ void ChannelUnpoolKernel(Tensor<gpu, 4, DType> grad_src,
+                                    Tensor<gpu, 4, DType> data_src,
+                                    Tensor<gpu, 4, DType> data_pooled,
+                                    Tensor<gpu, 4, DType> grad_pooled,
+                                    index_t nsize, index_t stride, index_t pad,
+                                    index_t limit, index_t num) {
+  typedef typename AccType<DType>::type AType;
+  const bool run_sum = expr::ChannelWindow<Reducer>::kKind == expr::kChannelWindowSum;
+  const index_t nchannel = grad_src.size(1), height = grad_src.size(2);
+  const index_t width = grad_src.size(3);
+  for (index_t i = blockIdx.x * blockDim.x + threadIdx.x; i < num;
+       i += blockDim.x * gridDim.x) {
+    const index_t x = i % width, y = (i / width) % height, n = i / width / height;
+    index_t lo = 0, hi = 0;
+    AType acc = AType(0);
+    for (index_t c = 0; c < nchannel; ++c) {
+      index_t end;
+      const index_t begin = expr::ChannelUnpoolBegin(c, nsize, stride, pad, limit, &end);
+      if (!run_sum || begin >= hi) {
+        acc = AType(0);
+        lo = hi = begin;
+      }
+      if (run_sum) {
+        for (; hi < end; ++hi) acc += AType(grad_pooled[n][hi][y][x]);
+        for (; lo < begin; ++lo) acc -= AType(grad_pooled[n][lo][y][x]);
+      } else {
+        const DType vsrc = data_src[n][c][y][x];
+        for (index_t cc = begin; cc < end; ++cc) {
+          acc += AType(Reducer::PartialGrad(vsrc, data_pooled[n][cc][y][x]) *
+                       grad_pooled[n][cc][y][x]);
+        }
+      }
+      Saver::Save(grad_src[n][c][y][x], DType(acc));
+    }
+  }
+}
+/*! \brief grad_src = ch_unpool<Reducer>(data_src, data_pooled, grad_pooled, ...) */
+template<typename Saver, typename Reducer, typename DType>
+inline void ChannelUnpool(Tensor<gpu, 4, DType> grad_src, const Tensor<gpu, 4, DType> &data_src,
+                          const Tensor<gpu, 4, DType> &data_pooled,
+                          const Tensor<gpu, 4, DType> &grad_pooled,
+                          index_t nsize, index_t stride, index_t pad) {
+  const index_t num = grad_src.size(0) * grad_src.size(2) * grad_src.size(3);
+  if (num == 0) return;
+  dim3 dimBlock(kBaseThreadNum);
+  dim3 dimGrid(std::min((num + kBaseThreadNum - 1) / kBaseThreadNum,
+                        static_cast<index_t>(kMaxGridNum)));
+  CheckLaunchParam(dimGrid, dimBlock, "ChannelUnpool");
+  cudaStream_t stream = Stream<gpu>::GetStream(grad_src.stream_);
+  ChannelUnpoolKernel<Saver, Reducer, DType><<<dimGrid, dimBlock, 0, stream>>>
+      (grad_src, data_src, data_pooled, grad_pooled, nsize, stride, pad,
+       grad_pooled.size(1), num);
+}
+
+/*! \brief blocks per multiprocessor a reduction aims for before splitting its reduced axis */
+const int kReduceBlocksPerSM = 4;
+/*! \brief fewest elements a block of a split reduction reduces per column */
+const int kReduceSplitMinItems = 2048;
+/*! \brief longest reduced axis of MapReduceKeepDim1 that one warp reduces per kept index */
+const int kReduceWarpMaxItems = 1024;
+/*!
+ * \brief how a reduction is spread over the device, chosen from its shape by
+ *  PlanReduceKeepLowest and PlanReduceKeepDim1
+ */
+struct ReducePlan {
+  enum Strategy {
+    /*! \brief blocks over the kept indices, each reduces the whole axis in one pass */
+    kSinglePass,
+    /*!
+     * \brief the reduced axis is cut into nsplit ranges, blocks write partial results
+     *  to a temporary buffer and a second kernel reduces them, for few kept indices
+     */
+    kSplitK,
+    /*! \brief one warp per kept index, for many short reductions */
+    kWarpPerRow
+  };
+  Strategy strategy;
+  /*! \brief number of ranges of the reduced axis for kSplitK, otherwise 1 */
+  index_t nsplit;
+  ReducePlan(Strategy strategy, index_t nsplit) : strategy(strategy), nsplit(nsplit) {}
+};
+/*!
+ * \brief number of ranges to cut a reduced axis of nitem elements into, so that nblock
+ *  blocks per range fill the device with per_sm blocks per multiprocessor, each range
+ *  keeping at least kReduceSplitMinItems
+ */
+inline index_t GetReduceSplit(index_t nblock, index_t nitem,
+                              int per_sm = kReduceBlocksPerSM) {
+  const index_t target = static_cast<index_t>(GetNumMultiProcessor()) * per_sm;
+  if (nblock >= target) return 1;
+  index_t nsplit = std::min((target + nblock - 1) / nblock,
+                            nitem / static_cast<index_t>(kReduceSplitMinItems));
+  nsplit = std::min(nsplit, static_cast<index_t>(kMaxGridNum));
+  return std::max(nsplit, static_cast<index_t>(1));
+}
+/*!
+ * \brief plan of MapReduceKeepLowest over eshape[0], the single pass reduces kMemUnit
+ *  columns per block, so a tall and narrow shape such as (1M, 16) is split
+ */
+inline ReducePlan PlanReduceKeepLowest(Shape<2> eshape, int per_sm = kReduceBlocksPerSM) {
+  const index_t nblock = (eshape[1] + kMemUnit - 1) >> kMemUnitBits;
+  const index_t nsplit = GetReduceSplit(nblock, eshape[0], per_sm);
+  return nsplit > 1 ? ReducePlan(ReducePlan::kSplitK, nsplit) :
+      ReducePlan(ReducePlan::kSinglePass, 1);
+}
+/*!
+ * \brief plan of MapReduceKeepDim1 of pshape, which keeps pshape[1] and reduces the rest:
+ *  a warp per kept index for short reductions, otherwise a block per kept index, split
+ *  when there are too few of them to fill the device
+ */
+inline ReducePlan PlanReduceKeepDim1(Shape<4> pshape, int per_sm = kReduceBlocksPerSM) {
+  const index_t nitem = pshape[0] * pshape[2] * pshape[3];
+  if (nitem <= static_cast<index_t>(kReduceWarpMaxItems)) {
+    return ReducePlan(ReducePlan::kWarpPerRow, 1);
+  }
+  const index_t nsplit = GetReduceSplit(pshape[1], nitem, per_sm);
+  return nsplit > 1 ? ReducePlan(ReducePlan::kSplitK, nsplit) :
+      ReducePlan(ReducePlan::kSinglePass, 1);
+}
+
+/*!
+ * \brief reduce rows [ybegin, yend) of the 1 << warp_bits columns of the block, the
+ *  thread (x, y) gets the result of column y of the block. Each thread folds a column
+ *  over the rows, the tile is transposed in shared memory and the warps reduce it with
+ *  shuffles.
+ */
+template<typename Reducer, int warp_bits, typename AType, typename Plan>
+__device__ AType MapRedKeepLowestTile(const Plan &plan, index_t ybegin, index_t yend,
+                                      index_t ncol) {
+  const unsigned warp_size = 1 << warp_bits;
+  // padded to avoid bank conflicts
+  __shared__ AType s_res[warp_size][warp_size + 1];
+  const index_t x = (blockIdx.x << warp_bits) + threadIdx.x;
+  AType res;
+  Reducer::SetInitValue(res);
+  if (x < ncol) {
+    for (index_t y = ybegin + threadIdx.y; y < yend; y += warp_size) {
+      Reducer::Reduce(res, AType(plan.Eval(y, x)));
+    }
+  }
+  s_res[threadIdx.x][threadIdx.y] = res;
   __syncthreads();
+  return WarpAllReduce<Reducer>(AType(s_res[threadIdx.y][threadIdx.x]),
+                                static_cast<int>(warp_size));
+}
 
-  if (threadIdx.y == 0 && x < eshape[1]) {
-    Saver::Save(dst.REval(0, x),  DType(s_res[threadIdx.x][0] * scale));
+template<typename Saver, typename Reducer, int warp_bits,
+         typename DType, typename DstPlan, typename Plan>
+__global__ void MapRedKeepLowestKernel(DstPlan dst, Plan plan,
+                                       DType scale, Shape<2> eshape) {
+  typedef typename AccType<DType>::type AType;
+  const AType res = MapRedKeepLowestTile<Reducer, warp_bits, AType>(plan, 0, eshape[0],
+                                                                    eshape[1]);
+  const index_t x = (blockIdx.x << warp_bits) + threadIdx.y;
+  if (threadIdx.x == 0 && x < eshape[1]) {
+    Saver::Save(dst.REval(0, x), DType(res * AType(scale)));
   }
 }
+/*! \brief first pass of the split MapReduceKeepLowest, range blockIdx.y of chunk rows */
+template<typename Reducer, int warp_bits, typename AType, typename Plan>
+__global__ void MapRedKeepLowestPartKernel(AType *part, Plan plan, Shape<2> eshape,
+                                           index_t chunk) {
+  const index_t ybegin = blockIdx.y * chunk;
+  const index_t yend = min(ybegin + chunk, eshape[0]);
+  const AType res = MapRedKeepLowestTile<Reducer, warp_bits, AType>(plan, ybegin, yend,
+                                                                    eshape[1]);
+  const index_t x = (blockIdx.x << warp_bits) + threadIdx.y;
+  if (threadIdx.x == 0 && x < eshape[1]) {
+    part[blockIdx.y * eshape[1] + x] = res;
+  }
+}
+/*! \brief reduce the nsplit partial results of each of the n kept indices and save them */
+template<typename Saver, typename Reducer, typename DType, typename AType, typename DstPlan>
+__global__ void MapRedMergePartKernel(DstPlan dst, const AType *part, index_t nsplit,
+                                      index_t n, DType scale) {
+  for (index_t x = blockIdx.x * blockDim.x + threadIdx.x; x < n;
+       x += blockDim.x * gridDim.x) {
+    AType res = part[x];
+    for (index_t i = 1; i < nsplit; ++i) Reducer::Reduce(res, part[i * n + x]);
+    Saver::Save(dst.REval(0, x), DType(res * AType(scale)));
+  }
+}
+/*! \brief second pass of the split reductions, into dst */
+template<typename Saver, typename Reducer, typename DstExp, typename DType, typename AType>
+inline void MapRedMergePart(expr::Plan<DstExp, DType> dst, const Tensor<gpu, 2, AType> &part,
+                            DType scale, cudaStream_t stream) {
+  const index_t n = part.size(1);
+  dim3 dimBlock(kBaseThreadNum);
+  dim3 dimGrid(std::min((n + kBaseThreadNum - 1) / kBaseThreadNum,
+                        static_cast<index_t>(kMaxGridNum)));
+  CheckLaunchParam(dimGrid, dimBlock, "MapRedMergePart");
+  MapRedMergePartKernel<Saver, Reducer, DType, AType, expr::Plan<DstExp, DType> >
+      <<<dimGrid, dimBlock, 0, stream>>>(dst, part.dptr_, part.size(0), n, scale);
+}
 
+/*!
+ * \brief candidates of the reductions, grid is the blocks per multiprocessor the split
+ *  aims for, 0 for kReduceBlocksPerSM, and block is not used
+ */
+const LaunchConfig kReduceLaunchCand[] = {{0, 0}, {0, 1}, {0, 2}, {0, 8}, {0, 16}};
+const int kNumReduceLaunchCand = sizeof(kReduceLaunchCand) / sizeof(kReduceLaunchCand[0]);
+/*! \brief blocks per multiprocessor of a reduction with cfg */
+inline int ReduceBlocksPerSM(const LaunchConfig &cfg) {
+  return cfg.grid > 0 ? cfg.grid : kReduceBlocksPerSM;
+}
+/*! \brief launch of MapReduceKeepLowest, see TunedLaunch */
+template<typename Saver, typename Reducer, typename DstExp, typename E, typename DType>
+struct MapReduceKeepLowestLaunch {
+  expr::Plan<DstExp, DType> dst;
+  const expr::Plan<E, DType> &plan;
+  DType scale;
+  Shape<2> eshape;
+  Stream<gpu> *s;
+  inline void operator()(const LaunchConfig &cfg) const;
+};
+/*!
+ * \brief dst = reduce of the rows of plan with the shape eshape, times scale
+ * \param out the memory of dst, to tune the launch with MSHADOW_USE_AUTOTUNE
+ */
 template<typename Saver, typename Reducer,
          typename DstExp, typename E, typename DType>
 inline void MapReduceKeepLowest(expr::Plan<DstExp, DType> dst,
                                 const expr::Plan<E, DType> &plan,
                                 DType scale, Shape<2> eshape,
-                                cudaStream_t stream) {
+                                Stream<gpu> *s, const TuneRegion &out = TuneRegion()) {
+  MapReduceKeepLowestLaunch<Saver, Reducer, DstExp, E, DType> launch = {
+    dst, plan, scale, eshape, s
+  };
+  TunedLaunch<MapReduceKeepLowestLaunch<Saver, Reducer, DstExp, E, DType> >(
+      "MapReduceKeepLowest", eshape[0], eshape[1], kReduceLaunchCand, kNumReduceLaunchCand,
+      out, Stream<gpu>::GetStream(s), launch);
+}
+template<typename Saver, typename Reducer, typename DstExp, typename E, typename DType>
+inline void MapReduceKeepLowestLaunch<Saver, Reducer, DstExp, E, DType>
+::operator()(const LaunchConfig &cfg) const {
+  typedef typename AccType<DType>::type AType;
+  cudaStream_t stream = Stream<gpu>::GetStream(s);
+  const ReducePlan rplan = PlanReduceKeepLowest(eshape, ReduceBlocksPerSM(cfg));
   dim3 dimBlock(kMemUnit, kMemUnit);
+  if (rplan.strategy == ReducePlan::kSplitK) {
+    const index_t chunk = (eshape[0] + rplan.nsplit - 1) / rplan.nsplit;
+    const index_t nsplit = (eshape[0] + chunk - 1) / chunk;
+    dim3 dimGrid((eshape[1] + kMemUnit - 1) >> kMemUnitBits, nsplit);
+    CheckLaunchParam(dimGrid, dimBlock, "MapRedKeepLowestPartKernel");
+    // with MSHADOW_USE_GPU_POOL the buffer is reused on the stream without synchronizing
+    Tensor<gpu, 2, AType> part(Shape2(nsplit, eshape[1]));
+    part.stream_ = s;
+    AllocSpace(&part, false);
+    MapRedKeepLowestPartKernel<Reducer, kMemUnitBits, AType, expr::Plan<E, DType> >
+        <<<dimGrid, dimBlock, 0, stream>>>(part.dptr_, plan, eshape, chunk);
+    MapRedMergePart<Saver, Reducer>(dst, part, scale, stream);
+    FreeSpace(&part);
+    return;
+  }
   dim3 dimGrid((eshape[1] + kMemUnit - 1) >> kMemUnitBits);
   CheckLaunchParam(dimGrid, dimBlock, "MapRedKeepLowestKernel");
   MapRedKeepLowestKernel<Saver, Reducer, kMemUnitBits, DType,
@@ -153,40 +1164,134 @@ inline void MapReduceKeepLowest(expr::Plan<DstExp, DType> dst,
       <<<dimGrid, dimBlock, 0, stream>>>(dst, plan, scale, eshape);
 }
 
+/*!
+ * \brief fold the items [begin, end) of kept index c of pshape, the flat index of
+ *  an item is (n, y, x) with x the fastest, threads stride over them by step
+ */
+template<typename Reducer, typename AType, typename Plan>
+__device__ AType MapReduceKeepDim1Fold(const Plan &plan, Shape<4> pshape, index_t c,
+                                       index_t begin, index_t end, index_t step) {
+  AType res;
+  Reducer::SetInitValue(res);
+  for (index_t i = begin; i < end; i += step) {
+    const index_t x = i % pshape[3];
+    const index_t j = i / pshape[3];
+    const index_t y = j % pshape[2];
+    const index_t n = j / pshape[2];
+    Reducer::Reduce(res, AType(plan.Eval((n * pshape[1] + c) * pshape[2] + y, x)));
+  }
+  return res;
+}
+
 template<typename Saver, typename Reducer, int block_dim_bits,
          typename DType, typename DstPlan, typename Plan>
 __global__ void MapReduceKeepDim1Kernel(DstPlan dst, Plan plan, DType scale, Shape<4> pshape) {
-  const int block_size = 1 << block_dim_bits;
-  __shared__ DType s_rec[block_size];
-  const int c = blockIdx.x;
+  typedef typename AccType<DType>::type AType;
+  __shared__ AType s_buf[32];
   const index_t tot = pshape[3] * pshape[2] * pshape[0];
-
-  DType res; Reducer::SetInitValue(res);
-  for (index_t i_offset = 0; i_offset < tot; i_offset += block_size) {
-    index_t i = i_offset + threadIdx.x;
-    if (i< tot) {
-      const index_t x = i % pshape[3];
-      i /= pshape[3];
-      const index_t y = i % pshape[2];
-      const index_t n = i / pshape[2];
-      Reducer::Reduce(res, plan.Eval((n * pshape[1] + c) * pshape[2] + y, x));
+  for (index_t c = blockIdx.x; c < pshape[1]; c += gridDim.x) {
+    AType res = MapReduceKeepDim1Fold<Reducer, AType>(plan, pshape, c, threadIdx.x, tot,
+                                                      1 << block_dim_bits);
+    res = RowAllReduce<Reducer>(res, s_buf);
+    if (threadIdx.x == 0) {
+      Saver::Save(dst.REval(0, c), DType(res * AType(scale)));
     }
   }
-  s_rec[threadIdx.x] = res;
-  __syncthreads();
-  Reduce1D<Reducer, block_dim_bits>(s_rec);
-  if (threadIdx.x == 0) {
-    Saver::Save(dst.REval(0, c), DType(s_rec[0] * scale));
+}
+/*! \brief first pass of the split MapReduceKeepDim1, range blockIdx.y of chunk items */
+template<typename Reducer, int block_dim_bits, typename AType, typename Plan>
+__global__ void MapReduceKeepDim1PartKernel(AType *part, Plan plan, Shape<4> pshape,
+                                            index_t chunk) {
+  __shared__ AType s_buf[32];
+  const index_t tot = pshape[3] * pshape[2] * pshape[0];
+  const index_t begin = blockIdx.y * chunk, end = min(begin + chunk, tot);
+  for (index_t c = blockIdx.x; c < pshape[1]; c += gridDim.x) {
+    AType res = MapReduceKeepDim1Fold<Reducer, AType>(plan, pshape, c, begin + threadIdx.x,
+                                                      end, 1 << block_dim_bits);
+    res = RowAllReduce<Reducer>(res, s_buf);
+    if (threadIdx.x == 0) part[blockIdx.y * pshape[1] + c] = res;
+  }
+}
+/*! \brief MapReduceKeepDim1 with the warp threadIdx.y of a block per kept index */
+template<typename Saver, typename Reducer, typename DType, typename DstPlan, typename Plan>
+__global__ void MapReduceKeepDim1WarpKernel(DstPlan dst, Plan plan, DType scale,
+                                            Shape<4> pshape) {
+  typedef typename AccType<DType>::type AType;
+  const index_t tot = pshape[3] * pshape[2] * pshape[0];
+  for (index_t c = blockIdx.x * blockDim.y + threadIdx.y; c < pshape[1];
+       c += gridDim.x * blockDim.y) {
+    AType res = MapReduceKeepDim1Fold<Reducer, AType>(plan, pshape, c, threadIdx.x, tot, 32);
+    res = WarpAllReduce<Reducer>(res);
+    if (threadIdx.x == 0) {
+      Saver::Save(dst.REval(0, c), DType(res * AType(scale)));
+    }
   }
 }
 
+/*! \brief launch of MapReduceKeepDim1, see TunedLaunch */
+template<typename Saver, typename Reducer, typename DstExp, typename E, typename DType>
+struct MapReduceKeepDim1Launch {
+  expr::Plan<DstExp, DType> dst;
+  const expr::Plan<E, DType> &plan;
+  DType scale;
+  Shape<4> pshape;
+  Stream<gpu> *s;
+  inline void operator()(const LaunchConfig &cfg) const;
+};
+/*!
+ * \brief dst[c] = reduce of plan over all but the index c of axis 1 of pshape, times scale
+ * \param out the memory of dst, to tune the launch with MSHADOW_USE_AUTOTUNE
+ */
 template<typename Saver, typename Reducer, typename DstExp, typename E, typename DType>
 inline void MapReduceKeepDim1(expr::Plan<DstExp, DType> dst,
                               const expr::Plan<E, DType> &plan,
                               DType scale, Shape<4> pshape,
-                              cudaStream_t stream) {
+                              Stream<gpu> *s, const TuneRegion &out = TuneRegion()) {
+  MapReduceKeepDim1Launch<Saver, Reducer, DstExp, E, DType> launch = {
+    dst, plan, scale, pshape, s
+  };
+  // one warp per kept index does not depend on the configuration
+  const bool warp = PlanReduceKeepDim1(pshape).strategy == ReducePlan::kWarpPerRow;
+  TunedLaunch<MapReduceKeepDim1Launch<Saver, Reducer, DstExp, E, DType> >(
+      "MapReduceKeepDim1", pshape[1], pshape[0] * pshape[2] * pshape[3],
+      kReduceLaunchCand, warp ? 1 : kNumReduceLaunchCand,
+      out, Stream<gpu>::GetStream(s), launch);
+}
+template<typename Saver, typename Reducer, typename DstExp, typename E, typename DType>
+inline void MapReduceKeepDim1Launch<Saver, Reducer, DstExp, E, DType>
+::operator()(const LaunchConfig &cfg) const {
+  typedef typename AccType<DType>::type AType;
+  cudaStream_t stream = Stream<gpu>::GetStream(s);
+  const ReducePlan rplan = PlanReduceKeepDim1(pshape, ReduceBlocksPerSM(cfg));
+  const index_t nkeep = pshape[1];
+  if (rplan.strategy == ReducePlan::kWarpPerRow) {
+    const int by = kBaseThreadNum / 32;
+    dim3 dimBlock(32, by);
+    dim3 dimGrid(std::min((nkeep + by - 1) / by, static_cast<index_t>(kMaxGridNum)));
+    CheckLaunchParam(dimGrid, dimBlock, "MapReduceKeepDim1Warp");
+    MapReduceKeepDim1WarpKernel<Saver, Reducer, DType,
+                                expr::Plan<DstExp, DType>,
+                                expr::Plan<E, DType> >
+        <<<dimGrid, dimBlock, 0, stream>>>(dst, plan, scale, pshape);
+    return;
+  }
   dim3 dimBlock(kBaseThreadNum);
-  dim3 dimGrid (pshape[1]);
+  if (rplan.strategy == ReducePlan::kSplitK) {
+    const index_t tot = pshape[0] * pshape[2] * pshape[3];
+    const index_t chunk = (tot + rplan.nsplit - 1) / rplan.nsplit;
+    const index_t nsplit = (tot + chunk - 1) / chunk;
+    dim3 dimGrid(nkeep, nsplit);
+    CheckLaunchParam(dimGrid, dimBlock, "MapReduceKeepDim1Part");
+    Tensor<gpu, 2, AType> part(Shape2(nsplit, nkeep));
+    part.stream_ = s;
+    AllocSpace(&part, false);
+    MapReduceKeepDim1PartKernel<Reducer, kBaseThreadBits, AType, expr::Plan<E, DType> >
+        <<<dimGrid, dimBlock, 0, stream>>>(part.dptr_, plan, pshape, chunk);
+    MapRedMergePart<Saver, Reducer>(dst, part, scale, stream);
+    FreeSpace(&part);
+    return;
+  }
+  dim3 dimGrid(std::min(nkeep, static_cast<index_t>(kMaxGridNum)));
   CheckLaunchParam(dimGrid, dimBlock, "MapReduceKeepDim1");
   MapReduceKeepDim1Kernel<Saver,Reducer,kBaseThreadBits, DType,
                           expr::Plan<DstExp, DType>,
@@ -307,19 +1412,43 @@ __global__ void SoftmaxKernel(DstPlan dst, SrcPlan src, index_t xmax) {
   }
 }
 
+/*! \brief candidates of the 2D Softmax, block is the threads per row, grid is not used */
+const LaunchConfig kSoftmaxLaunchCand[] = {{kBaseThreadNum, 0}, {128, 0}, {512, 0}, {1024, 0}};
+const int kNumSoftmaxLaunchCand = sizeof(kSoftmaxLaunchCand) / sizeof(kSoftmaxLaunchCand[0]);
+/*! \brief launch of SoftmaxKernel, see TunedLaunch */
+template<typename DType>
+struct SoftmaxLaunch {
+  Tensor<gpu, 2, DType> dst;
+  Tensor<gpu, 2, DType> src;
+  cudaStream_t stream;
+  template<int x_bits>
+  inline void Launch(void) const {
+    dim3 dimBlock(1 << x_bits);
+    dim3 dimGrid(dst.size(0));
+    CheckLaunchParam(dimGrid, dimBlock, "Softmax");
+    SoftmaxKernel<x_bits, DType>
+        <<<dimGrid, dimBlock, 0, stream>>>
+        (expr::MakePlan(dst),
+         expr::MakePlan(src),
+         dst.size(1));
+  }
+  inline void operator()(const LaunchConfig &cfg) const {
+    switch (cfg.block) {
+      case 128: this->template Launch<7>(); break;
+      case 512: this->template Launch<9>(); break;
+      case 1024: this->template Launch<10>(); break;
+      default: this->template Launch<kBaseThreadBits>(); break;
+    }
+  }
+};
 template<typename DType>
 inline void Softmax(Tensor<gpu, 2, DType> &dst,
                     const Tensor<gpu, 2, DType> &src) {
-  dim3 dimBlock(kBaseThreadNum);
-  dim3 dimGrid(dst.size(0));
   CHECK_EQ(dst.shape_, src.shape_) << "Softmax: shape mismatch";
-  CheckLaunchParam(dimGrid, dimBlock, "Softmax");
-  cudaStream_t stream = Stream<gpu>::GetStream(dst.stream_);
-  SoftmaxKernel<kBaseThreadBits, DType>
-      <<<dimGrid, dimBlock, 0, stream>>>
-      (expr::MakePlan(dst),
-       expr::MakePlan(src),
-       dst.size(1));
+  SoftmaxLaunch<DType> launch = {dst, src, Stream<gpu>::GetStream(dst.stream_)};
+  TunedLaunch<SoftmaxLaunch<DType> >(
+      "Softmax", dst.size(0), dst.size(1), kSoftmaxLaunchCand, kNumSoftmaxLaunchCand,
+      TuneRegionOf(dst, dst.shape_), launch.stream, launch);
 }
 
 template<typename DType>
@@ -360,6 +1489,263 @@ inline void SoftmaxGrad(Tensor<gpu, 2, DType> &dst,
        ignore_label);
 }
 
+/*! \brief elements per thread kept in registers by the fused softmax, wider rows are streamed */
+const int kSoftmaxCacheNum = 8;
+/*!
+ * \brief merge the partial result (om, os) into (m, s) of an online softmax,
+ *  m is the running max and s the running sum of exp(x - m)
+ */
+template<typename DType>
+__device__ void SoftmaxOnlineMerge(DType *m, DType *s, DType om, DType os) {
+  const DType nm = om > *m ? om : *m;
+  *s = (*m == nm ? *s : *s * op::exp::Map(*m - nm)) +
+      (om == nm ? os : os * op::exp::Map(om - nm));
+  *m = nm;
+}
+/*! \brief RowAllReduce of the online softmax pair, buf holds 64 * blockDim.y elements */
+template<typename DType>
+__device__ void SoftmaxOnlineRowReduce(DType *m, DType *s, DType *buf) {
+  for (int mask = 16; mask > 0; mask >>= 1) {
+    const DType om = MSHADOW_CUDA_SHFL_XOR(*m, mask, 32);
+    const DType os = MSHADOW_CUDA_SHFL_XOR(*s, mask, 32);
+    SoftmaxOnlineMerge(m, s, om, os);
+  }
+  if (blockDim.x > 32) {
+    const int lane = threadIdx.x & 31, wid = threadIdx.x >> 5;
+    DType *row = buf + threadIdx.y * 64;
+    __syncthreads();
+    if (lane == 0) {
+      row[wid] = *m;
+      row[32 + wid] = *s;
+    }
+    __syncthreads();
+    if (lane < static_cast<int>(blockDim.x >> 5)) {
+      *m = row[lane];
+      *s = row[32 + lane];
+    } else {
+      *m = limits::MinValue<DType>();
+      *s = DType(0);
+    }
+    for (int mask = 16; mask > 0; mask >>= 1) {
+      const DType om = MSHADOW_CUDA_SHFL_XOR(*m, mask, 32);
+      const DType os = MSHADOW_CUDA_SHFL_XOR(*s, mask, 32);
+      SoftmaxOnlineMerge(m, s, om, os);
+    }
+  }
+}
+/*!
+ * \brief fused softmax, cross entropy loss and its gradient, the threadIdx.x threads
+ *  of a block handle one row. With kCache > 0 the row is read once into registers,
+ *  with kCache == 0 the max and the normalizer are computed in one online pass,
+ *  and the row is read a second time to write the gradient.
+ */
+template<int kCache, typename DType, typename IndexType>
+__global__ void SoftmaxCrossEntropyKernel(Tensor<gpu, 2, DType> grad,
+                                          Tensor<gpu, 1, DType> loss,
+                                          const Tensor<gpu, 2, DType> src,
+                                          const Tensor<gpu, 1, IndexType> label,
+                                          bool use_ignore, IndexType ignore_label) {
+  __shared__ DType s_buf[2 * kMaxThreadsPerBlock];
+  const index_t nrow = src.size(0), xmax = src.size(1);
+  // every thread runs the same number of iterations, the reductions synchronize the block
+  for (index_t base = blockIdx.x * blockDim.y; base < nrow; base += gridDim.x * blockDim.y) {
+    const index_t y = base + threadIdx.y;
+    const bool active = y < nrow;
+    const DType *row = src.dptr_ + (active ? y : 0) * src.stride_;
+    DType m = limits::MinValue<DType>(), s = DType(0);
+    DType cache[kCache > 0 ? kCache : 1];
+    if (kCache > 0) {
+      #pragma unroll
+      for (int i = 0; i < kCache; ++i) {
+        const index_t x = threadIdx.x + i * blockDim.x;
+        cache[i] = active && x < xmax ? row[x] : limits::MinValue<DType>();
+        m = cache[i] > m ? cache[i] : m;
+      }
+      m = RowAllReduce<red::maximum>(m, s_buf);
+      #pragma unroll
+      for (int i = 0; i < kCache; ++i) {
+        const index_t x = threadIdx.x + i * blockDim.x;
+        cache[i] = x < xmax ? op::exp::Map(cache[i] - m) : DType(0);
+        s += cache[i];
+      }
+      s = RowAllReduce<red::sum>(s, s_buf);
+    } else {
+      for (index_t x = threadIdx.x; active && x < xmax; x += blockDim.x) {
+        SoftmaxOnlineMerge(&m, &s, row[x], DType(1));
+      }
+      SoftmaxOnlineRowReduce(&m, &s, s_buf);
+    }
+    if (!active) continue;
+    const int64_t k = static_cast<int64_t>(label.dptr_[y]);
+    const bool ignore = use_ignore && k == static_cast<int64_t>(ignore_label);
+    const bool valid = !ignore && k >= 0 && k < static_cast<int64_t>(xmax);
+    // only the thread of column k writes it, so it reads the energy of the label
+    // before the write, which lets grad be src
+    const bool owner = valid && static_cast<index_t>(k) % blockDim.x == threadIdx.x;
+    const DType ek = owner ? row[k] : DType(0);
+    const DType inv = ignore ? DType(0) : DType(1) / s;
+    DType *g = grad.dptr_ + y * grad.stride_;
+    if (kCache > 0) {
+      #pragma unroll
+      for (int i = 0; i < kCache; ++i) {
+        const index_t x = threadIdx.x + i * blockDim.x;
+        if (x < xmax) {
+          g[x] = ignore ? DType(0) : cache[i] * inv - DType(static_cast<int64_t>(x) == k);
+        }
+      }
+    } else {
+      for (index_t x = threadIdx.x; x < xmax; x += blockDim.x) {
+        g[x] = ignore ? DType(0) :
+            op::exp::Map(row[x] - m) * inv - DType(static_cast<int64_t>(x) == k);
+      }
+    }
+    if (owner) {
+      loss.dptr_[y] = op::log::Map(s) + m - ek;
+    } else if (!valid && threadIdx.x == 0) {
+      loss.dptr_[y] = DType(0);
+    }
+  }
+}
+
+/*!
+ * \brief launch shape of the row kernels of the fused softmax: the fewest warps that hold
+ *  a row in registers, rows narrower than kBaseThreadNum share a block
+ * \return whether the row fits in registers, otherwise it is streamed
+ */
+inline bool SoftmaxRowLaunchParam(index_t nrow, index_t xmax, dim3 *dimGrid, dim3 *dimBlock) {
+  int bx = 32;
+  while (bx < kMaxThreadsPerBlock && bx * kSoftmaxCacheNum < static_cast<int>(xmax)) bx <<= 1;
+  const int by = bx < kBaseThreadNum ? kBaseThreadNum / bx : 1;
+  *dimBlock = dim3(bx, by);
+  *dimGrid = dim3(std::min((nrow + by - 1) / by, static_cast<index_t>(kMaxGridNum)));
+  return static_cast<int>(xmax) <= bx * kSoftmaxCacheNum;
+}
+template<typename DType, typename IndexType>
+inline void SoftmaxCrossEntropy(Tensor<gpu, 2, DType> &grad,
+                                Tensor<gpu, 1, DType> &loss,
+                                const Tensor<gpu, 2, DType> &src,
+                                const Tensor<gpu, 1, IndexType> &label,
+                                bool use_ignore, IndexType ignore_label) {
+  CHECK_EQ(grad.shape_, src.shape_) << "SoftmaxCrossEntropy: shape mismatch";
+  CHECK_EQ(loss.size(0), src.size(0)) << "SoftmaxCrossEntropy: loss shape mismatch";
+  CHECK_EQ(label.size(0), src.size(0)) << "SoftmaxCrossEntropy: label shape mismatch";
+  if (src.size(0) == 0) return;
+  dim3 dimGrid, dimBlock;
+  const bool cached = SoftmaxRowLaunchParam(src.size(0), src.size(1), &dimGrid, &dimBlock);
+  CheckLaunchParam(dimGrid, dimBlock, "SoftmaxCrossEntropy");
+  cudaStream_t stream = Stream<gpu>::GetStream(grad.stream_);
+  if (cached) {
+    SoftmaxCrossEntropyKernel<kSoftmaxCacheNum, DType, IndexType>
+        <<<dimGrid, dimBlock, 0, stream>>>(grad, loss, src, label, use_ignore, ignore_label);
+  } else {
+    SoftmaxCrossEntropyKernel<0, DType, IndexType>
+        <<<dimGrid, dimBlock, 0, stream>>>(grad, loss, src, label, use_ignore, ignore_label);
+  }
+}
+
+/*!
+ * \brief log-softmax of each row, dst = src - (m + log(s)), the threadIdx.x threads of a
+ *  block handle one row. With kCache > 0 the row is read once into registers, with
+ *  kCache == 0 m and s are computed in one online pass and the row is read again.
+ */
+template<int kCache, typename DType>
+__global__ void LogSoftmaxKernel(Tensor<gpu, 2, DType> dst, const Tensor<gpu, 2, DType> src) {
+  __shared__ DType s_buf[2 * kMaxThreadsPerBlock];
+  const index_t nrow = src.size(0), xmax = src.size(1);
+  for (index_t base = blockIdx.x * blockDim.y; base < nrow; base += gridDim.x * blockDim.y) {
+    const index_t y = base + threadIdx.y;
+    const bool active = y < nrow;
+    const DType *row = src.dptr_ + (active ? y : 0) * src.stride_;
+    DType m = limits::MinValue<DType>(), s = DType(0);
+    DType cache[kCache > 0 ? kCache : 1];
+    if (kCache > 0) {
+      #pragma unroll
+      for (int i = 0; i < kCache; ++i) {
+        const index_t x = threadIdx.x + i * blockDim.x;
+        cache[i] = active && x < xmax ? row[x] : limits::MinValue<DType>();
+        m = cache[i] > m ? cache[i] : m;
+      }
+      m = RowAllReduce<red::maximum>(m, s_buf);
+      #pragma unroll
+      for (int i = 0; i < kCache; ++i) {
+        const index_t x = threadIdx.x + i * blockDim.x;
+        s += x < xmax ? op::exp::Map(cache[i] - m) : DType(0);
+      }
+      s = RowAllReduce<red::sum>(s, s_buf);
+    } else {
+      for (index_t x = threadIdx.x; active && x < xmax; x += blockDim.x) {
+        SoftmaxOnlineMerge(&m, &s, row[x], DType(1));
+      }
+      SoftmaxOnlineRowReduce(&m, &s, s_buf);
+    }
+    if (!active) continue;
+    const DType shift = m + op::log::Map(s);
+    DType *out = dst.dptr_ + y * dst.stride_;
+    if (kCache > 0) {
+      #pragma unroll
+      for (int i = 0; i < kCache; ++i) {
+        const index_t x = threadIdx.x + i * blockDim.x;
+        if (x < xmax) out[x] = cache[i] - shift;
+      }
+    } else {
+      for (index_t x = threadIdx.x; x < xmax; x += blockDim.x) out[x] = row[x] - shift;
+    }
+  }
+}
+
+template<typename DType>
+inline void LogSoftmax(Tensor<gpu, 2, DType> &dst,
+                       const Tensor<gpu, 2, DType> &src) {
+  CHECK_EQ(dst.shape_, src.shape_) << "LogSoftmax: shape mismatch";
+  if (src.size(0) == 0) return;
+  dim3 dimGrid, dimBlock;
+  const bool cached = SoftmaxRowLaunchParam(src.size(0), src.size(1), &dimGrid, &dimBlock);
+  CheckLaunchParam(dimGrid, dimBlock, "LogSoftmax");
+  cudaStream_t stream = Stream<gpu>::GetStream(dst.stream_);
+  if (cached) {
+    LogSoftmaxKernel<kSoftmaxCacheNum, DType><<<dimGrid, dimBlock, 0, stream>>>(dst, src);
+  } else {
+    LogSoftmaxKernel<0, DType><<<dimGrid, dimBlock, 0, stream>>>(dst, src);
+  }
+}
+
+/*! \brief gradient of the log-softmax of each row, dst = grad - exp(src) * sum(grad) */
+template<typename DType>
+__global__ void LogSoftmaxGradKernel(Tensor<gpu, 2, DType> dst,
+                                     const Tensor<gpu, 2, DType> src,
+                                     const Tensor<gpu, 2, DType> grad) {
+  __shared__ DType s_buf[2 * kMaxThreadsPerBlock];
+  const index_t nrow = src.size(0), xmax = src.size(1);
+  for (index_t base = blockIdx.x * blockDim.y; base < nrow; base += gridDim.x * blockDim.y) {
+    const index_t y = base + threadIdx.y;
+    const bool active = y < nrow;
+    const DType *g = grad.dptr_ + (active ? y : 0) * grad.stride_;
+    DType sum = DType(0);
+    for (index_t x = threadIdx.x; active && x < xmax; x += blockDim.x) sum += g[x];
+    sum = RowAllReduce<red::sum>(sum, s_buf);
+    if (!active) continue;
+    const DType *row = src.dptr_ + y * src.stride_;
+    DType *out = dst.dptr_ + y * dst.stride_;
+    for (index_t x = threadIdx.x; x < xmax; x += blockDim.x) {
+      out[x] = g[x] - op::exp::Map(row[x]) * sum;
+    }
+  }
+}
+
+template<typename DType>
+inline void LogSoftmaxGrad(Tensor<gpu, 2, DType> &dst,
+                           const Tensor<gpu, 2, DType> &src,
+                           const Tensor<gpu, 2, DType> &grad) {
+  CHECK_EQ(dst.shape_, src.shape_) << "LogSoftmaxGrad: shape mismatch";
+  CHECK_EQ(grad.shape_, src.shape_) << "LogSoftmaxGrad: grad shape mismatch";
+  if (src.size(0) == 0) return;
+  dim3 dimGrid, dimBlock;
+  SoftmaxRowLaunchParam(src.size(0), src.size(1), &dimGrid, &dimBlock);
+  CheckLaunchParam(dimGrid, dimBlock, "LogSoftmaxGrad");
+  cudaStream_t stream = Stream<gpu>::GetStream(dst.stream_);
+  LogSoftmaxGradKernel<DType><<<dimGrid, dimBlock, 0, stream>>>(dst, src, grad);
+}
+
 template<int n_bits, typename DType>
 __global__ void Softmax3DGradKernel(Tensor<gpu, 3, DType> dst,
                                     const Tensor<gpu, 3, DType> src,
@@ -492,6 +1878,106 @@ __global__ void AddTakeGradKernel(DstPlan dst,
   }
 }
 
+/*!
+ * \brief each warp copies the rows of src picked by index into dst,
+ *  as VecData when vec, then the rows are aligned and a multiple of the vector size
+ */
+template<typename Saver, bool vec, typename DType, typename IndexType>
+__global__ void TakeKernel(DType *dst, index_t dstride, const IndexType *index,
+                           const DType *src, index_t sstride, index_t nrow, index_t ncol) {
+  const index_t kSize = VecData<DType>::kSize;
+  for (index_t y = blockIdx.x * blockDim.y + threadIdx.y; y < nrow;
+       y += gridDim.x * blockDim.y) {
+    const DType *srow = src + static_cast<index_t>(index[y]) * sstride;
+    DType *drow = dst + y * dstride;
+    if (vec) {
+      for (index_t x = threadIdx.x * kSize; x < ncol; x += 32 * kSize) {
+        VecSaver<Saver, DType>::Save(drow + x, *reinterpret_cast<const VecData<DType>*>(srow + x));
+      }
+    } else {
+      for (index_t x = threadIdx.x; x < ncol; x += 32) {
+        Saver::Save(drow[x], srow[x]);
+      }
+    }
+  }
+}
+template<typename Saver, typename IndexType, typename DType>
+inline void Take(Tensor<gpu, 2, DType> dst,
+                 const Tensor<gpu, 1, IndexType> &index,
+                 const Tensor<gpu, 2, DType> &src) {
+  CHECK_EQ(dst.size(0), index.size(0)) << "Take: one row of dst per index";
+  CHECK_EQ(dst.size(1), src.size(1)) << "Take: the rows of dst and src differ";
+  const index_t nrow = dst.size(0), ncol = dst.size(1);
+  if (nrow == 0) return;
+  const int kRows = kBaseThreadNum / 32;
+  dim3 dimBlock(32, kRows, 1);
+  dim3 dimGrid(std::min((nrow + kRows - 1) / kRows, static_cast<index_t>(kMaxGridNum)), 1, 1);
+  CheckLaunchParam(dimGrid, dimBlock, "Take");
+  cudaStream_t stream = Stream<gpu>::GetStream(dst.stream_);
+  const bool vec = VecAligned(dst) && VecAligned(src) &&
+      ncol % VecData<DType>::kSize == 0;
+  if (vec) {
+    TakeKernel<Saver, true><<<dimGrid, dimBlock, 0, stream>>>
+        (dst.dptr_, dst.stride_, index.dptr_, src.dptr_, src.stride_, nrow, ncol);
+  } else {
+    TakeKernel<Saver, false><<<dimGrid, dimBlock, 0, stream>>>
+        (dst.dptr_, dst.stride_, index.dptr_, src.dptr_, src.stride_, nrow, ncol);
+  }
+}
+/*!
+ * \brief each warp sums the rows of one bag, every lane keeps the sums of its columns,
+ *  kCols columns per lane are kept in registers in one pass over the bag
+ */
+template<typename Saver, int kCols, typename DType, typename IndexType>
+__global__ void TakeBagKernel(DType *dst, index_t dstride, const IndexType *index,
+                              const IndexType *offset, const DType *src, index_t sstride,
+                              index_t nbag, index_t n, index_t ncol, bool mean) {
+  typedef typename AccType<DType>::type AType;
+  for (index_t b = blockIdx.x * blockDim.y + threadIdx.y; b < nbag;
+       b += gridDim.x * blockDim.y) {
+    const index_t begin = static_cast<index_t>(offset[b]);
+    const index_t end = b + 1 < nbag ? static_cast<index_t>(offset[b + 1]) : n;
+    const AType len = mean && end > begin ? AType(end - begin) : AType(1);
+    DType *drow = dst + b * dstride;
+    for (index_t x0 = 0; x0 < ncol; x0 += 32 * kCols) {
+      AType acc[kCols];
+      #pragma unroll
+      for (int j = 0; j < kCols; ++j) acc[j] = AType(0);
+      for (index_t i = begin; i < end; ++i) {
+        const DType *srow = src + static_cast<index_t>(index[i]) * sstride;
+        #pragma unroll
+        for (int j = 0; j < kCols; ++j) {
+          const index_t x = x0 + j * 32 + threadIdx.x;
+          if (x < ncol) acc[j] += AType(srow[x]);
+        }
+      }
+      #pragma unroll
+      for (int j = 0; j < kCols; ++j) {
+        const index_t x = x0 + j * 32 + threadIdx.x;
+        if (x < ncol) Saver::Save(drow[x], DType(acc[j] / len));
+      }
+    }
+  }
+}
+template<typename Saver, typename IndexType, typename DType>
+inline void TakeBag(Tensor<gpu, 2, DType> dst,
+                    const Tensor<gpu, 1, IndexType> &index,
+                    const Tensor<gpu, 1, IndexType> &offset,
+                    const Tensor<gpu, 2, DType> &src, bool mean) {
+  CHECK_EQ(dst.size(0), offset.size(0)) << "TakeBag: one row of dst per bag";
+  CHECK_EQ(dst.size(1), src.size(1)) << "TakeBag: the rows of dst and src differ";
+  const index_t nbag = dst.size(0);
+  if (nbag == 0) return;
+  const int kRows = kBaseThreadNum / 32;
+  dim3 dimBlock(32, kRows, 1);
+  dim3 dimGrid(std::min((nbag + kRows - 1) / kRows, static_cast<index_t>(kMaxGridNum)), 1, 1);
+  CheckLaunchParam(dimGrid, dimBlock, "TakeBag");
+  cudaStream_t stream = Stream<gpu>::GetStream(dst.stream_);
+  TakeBagKernel<Saver, 4><<<dimGrid, dimBlock, 0, stream>>>
+      (dst.dptr_, dst.stride_, index.dptr_, offset.dptr_, src.dptr_, src.stride_,
+       nbag, index.size(0), dst.size(1), mean);
+}
+
 template<int warp_bits, int SZ, typename DType, typename IdxType>
 __global__ void AddTakeGradLargeBatchKernel(DType* dst,
                                             const IdxType *sorted, const IdxType *index, const DType *src,
@@ -679,6 +2165,228 @@ inline void SortByKey(Tensor<gpu, 1, DType> keys, Tensor<gpu, 1, mshadow::half::
   bool is_ascend) {
   LOG(FATAL) << "SortByKey for half_t is not implemented!";
 }
+
+template<typename DType>
+inline void SortByKey(Tensor<gpu, 1, mshadow::bfloat::bf16_t> keys, Tensor<gpu, 1, DType> values,
+                      bool is_ascend) {
+  LOG(FATAL) << "SortByKey for bf16_t is not implemented!";
+}
+
+template<typename DType>
+inline void SortByKey(Tensor<gpu, 1, DType> keys, Tensor<gpu, 1, mshadow::bfloat::bf16_t> values,
+  bool is_ascend) {
+  LOG(FATAL) << "SortByKey for bf16_t is not implemented!";
+}
+/*!
+ * \brief maps a value to unsigned bits that compare in the same order,
+ *  used to select TopK by radix
+ */
+template<typename DType>
+struct TopKBits;
+template<>
+struct TopKBits<float> {
+  typedef unsigned UType;
+  MSHADOW_XINLINE static UType Encode(float v) {
+    const UType u = __float_as_uint(v);
+    return (u & 0x80000000U) ? ~u : (u | 0x80000000U);
+  }
+};
+template<>
+struct TopKBits<double> {
+  typedef unsigned long long UType;  // NOLINT(*)
+  MSHADOW_XINLINE static UType Encode(double v) {
+    const UType u = static_cast<UType>(__double_as_longlong(v));
+    return (u & 0x8000000000000000ULL) ? ~u : (u | 0x8000000000000000ULL);
+  }
+};
+template<>
+struct TopKBits<half::half_t> {
+  typedef unsigned UType;
+  MSHADOW_XINLINE static UType Encode(half::half_t v) {
+    return TopKBits<float>::Encode(static_cast<float>(v));
+  }
+};
+template<>
+struct TopKBits<bfloat::bf16_t> {
+  typedef unsigned UType;
+  MSHADOW_XINLINE static UType Encode(bfloat::bf16_t v) {
+    return TopKBits<float>::Encode(static_cast<float>(v));
+  }
+};
+template<>
+struct TopKBits<int> {
+  typedef unsigned UType;
+  MSHADOW_XINLINE static UType Encode(int v) {
+    return static_cast<UType>(v) ^ 0x80000000U;
+  }
+};
+template<>
+struct TopKBits<int64_t> {
+  typedef unsigned long long UType;  // NOLINT(*)
+  MSHADOW_XINLINE static UType Encode(int64_t v) {
+    return static_cast<UType>(v) ^ 0x8000000000000000ULL;
+  }
+};
+/*! \brief largest k the TopK kernel sorts in shared memory */
+const int kTopKMaxSort = 1024;
+/*!
+ * \brief one block per row: a radix select finds the k-th value a byte at a time, the
+ *  elements before it and the first of the ones equal to it are written out, then sorted
+ *  in shared memory when k is at most kTopKMaxSort. For the smallest elements the bits
+ *  are flipped, so the selection always looks for the largest.
+ */
+template<typename DType, typename IndexType>
+__global__ void TopKKernel(Tensor<gpu, 2, DType> src, index_t k,
+                           Tensor<gpu, 2, DType> values, Tensor<gpu, 2, IndexType> indices,
+                           bool is_ascend) {
+  typedef typename TopKBits<DType>::UType UType;
+  const int kBits = sizeof(UType) * 8;
+  const UType flip = is_ascend ? ~UType(0) : UType(0);
+  __shared__ unsigned hist[256];
+  __shared__ unsigned warp_count[kBaseThreadNum / 32];
+  __shared__ UType s_desired, s_mask;
+  __shared__ index_t s_remain, s_ngt, s_neq;
+  __shared__ UType skey[kTopKMaxSort];
+  __shared__ index_t sidx[kTopKMaxSort];
+  const index_t ncol = src.size(1);
+  const int tid = threadIdx.x, lane = tid & 31, warp = tid >> 5;
+  for (index_t y = blockIdx.x; y < src.size(0); y += gridDim.x) {
+    const DType *in = src[y].dptr_;
+    if (tid == 0) {
+      s_desired = 0; s_mask = 0; s_remain = k;
+    }
+    __syncthreads();
+    for (int shift = kBits - 8; shift >= 0; shift -= 8) {
+      for (int i = tid; i < 256; i += blockDim.x) hist[i] = 0;
+      __syncthreads();
+      const UType desired = s_desired, mask = s_mask;
+      for (index_t x = tid; x < ncol; x += blockDim.x) {
+        const UType u = TopKBits<DType>::Encode(in[x]) ^ flip;
+        if ((u & mask) == desired) atomicAdd(&hist[(u >> shift) & 255], 1U);
+      }
+      __syncthreads();
+      if (tid == 0) {
+        // the digit of the k-th largest, and how many of the rest are below it
+        index_t remain = s_remain;
+        int b = 255;
+        for (; b > 0 && hist[b] < remain; --b) remain -= hist[b];
+        s_remain = remain;
+        s_desired = desired | (static_cast<UType>(b) << shift);
+        s_mask = mask | (static_cast<UType>(255) << shift);
+      }
+      __syncthreads();
+    }
+    // all the elements above thr are taken, and the first take_eq equal to it
+    const UType thr = s_desired;
+    const index_t take_eq = s_remain, ngt = k - take_eq;
+    if (tid == 0) {
+      s_ngt = 0; s_neq = 0;
+    }
+    __syncthreads();
+    for (index_t base = 0; base < ncol; base += blockDim.x) {
+      const index_t x = base + tid;
+      const UType u = x < ncol ? TopKBits<DType>::Encode(in[x]) ^ flip : UType(0);
+      const bool eq = x < ncol && u == thr;
+      if (x < ncol && u > thr) {
+        const index_t pos = atomicAdd(&s_ngt, 1U);
+        values[y][pos] = in[x];
+        indices[y][pos] = static_cast<IndexType>(x);
+      }
+      // the rank of the equal ones by column
+      const unsigned ballot = MSHADOW_CUDA_BALLOT(eq);
+      if (lane == 0) warp_count[warp] = __popc(ballot);
+      __syncthreads();
+      index_t rank = s_neq + __popc(ballot & ((1U << lane) - 1U));
+      for (int w = 0; w < warp; ++w) rank += warp_count[w];
+      if (eq && rank < take_eq) {
+        values[y][ngt + rank] = in[x];
+        indices[y][ngt + rank] = static_cast<IndexType>(x);
+      }
+      __syncthreads();
+      if (tid == 0) {
+        for (int w = 0; w < static_cast<int>(blockDim.x >> 5); ++w) s_neq += warp_count[w];
+      }
+      __syncthreads();
+    }
+    if (k > kTopKMaxSort) continue;
+    // bitonic sort, the better element first, equal values by column
+    index_t n2 = 1;
+    while (n2 < k) n2 <<= 1;
+    for (index_t i = tid; i < n2; i += blockDim.x) {
+      if (i < k) {
+        skey[i] = TopKBits<DType>::Encode(values[y][i]) ^ flip;
+        sidx[i] = static_cast<index_t>(indices[y][i]);
+      } else {
+        skey[i] = 0; sidx[i] = ~index_t(0);
+      }
+    }
+    __syncthreads();
+    for (index_t size = 2; size <= n2; size <<= 1) {
+      for (index_t stride = size >> 1; stride > 0; stride >>= 1) {
+        for (index_t i = tid; i < n2; i += blockDim.x) {
+          const index_t j = i ^ stride;
+          if (j <= i) continue;
+          const bool j_first = skey[j] > skey[i] || (skey[j] == skey[i] && sidx[j] < sidx[i]);
+          if (j_first == ((i & size) == 0)) {
+            const UType tk = skey[i]; skey[i] = skey[j]; skey[j] = tk;
+            const index_t ti = sidx[i]; sidx[i] = sidx[j]; sidx[j] = ti;
+          }
+        }
+        __syncthreads();
+      }
+    }
+    for (index_t i = tid; i < k; i += blockDim.x) {
+      values[y][i] = in[sidx[i]];
+      indices[y][i] = static_cast<IndexType>(sidx[i]);
+    }
+    __syncthreads();
+  }
+}
+/*! \brief order of the (value, column) pairs of TopK, for rows too long to sort in a block */
+template<typename DType, typename IndexType>
+struct TopKOrder {
+  bool is_ascend;
+  explicit TopKOrder(bool is_ascend) : is_ascend(is_ascend) {}
+  __device__ bool operator()(const thrust::tuple<DType, IndexType> &a,
+                             const thrust::tuple<DType, IndexType> &b) const {
+    const DType va = thrust::get<0>(a), vb = thrust::get<0>(b);
+    if (is_ascend ? va < vb : va > vb) return true;
+    if (is_ascend ? vb < va : vb > va) return false;
+    return thrust::get<1>(a) < thrust::get<1>(b);
+  }
+};
+
+template<typename DType, typename IndexType>
+inline void TopK(const Tensor<gpu, 2, DType> &src, index_t k,
+                 Tensor<gpu, 2, DType> values, Tensor<gpu, 2, IndexType> indices,
+                 bool is_ascend) {
+  CHECK_LE(k, src.size(1)) << "TopK: k is larger than the rows";
+  CHECK(values.size(0) == src.size(0) && values.size(1) >= k)
+      << "TopK: values need " << src.size(0) << " rows of at least " << k;
+  CHECK(indices.size(0) == src.size(0) && indices.size(1) >= k)
+      << "TopK: indices need " << src.size(0) << " rows of at least " << k;
+  if (k == 0 || src.size(0) == 0) return;
+  dim3 dimBlock(kBaseThreadNum);
+  dim3 dimGrid(std::min(src.size(0), static_cast<index_t>(kMaxGridNum)));
+  CheckLaunchParam(dimGrid, dimBlock, "TopK");
+  cudaStream_t stream = Stream<gpu>::GetStream(src.stream_);
+  TopKKernel<DType, IndexType><<<dimGrid, dimBlock, 0, stream>>>(
+      src, k, values, indices, is_ascend);
+  if (k <= kTopKMaxSort) return;
+#if CUDA_VERSION >= 7000
+  // a sort per row, the selection already cut each row down to k elements
+  for (index_t y = 0; y < src.size(0); ++y) {
+    thrust::device_ptr<DType> v = thrust::device_pointer_cast(values[y].dptr_);
+    thrust::device_ptr<IndexType> i = thrust::device_pointer_cast(indices[y].dptr_);
+    thrust::sort(thrust::cuda::par.on(stream),
+                 thrust::make_zip_iterator(thrust::make_tuple(v, i)),
+                 thrust::make_zip_iterator(thrust::make_tuple(v + k, i + k)),
+                 TopKOrder<DType, IndexType>(is_ascend));
+  }
+#else
+  LOG(FATAL) << "TopK with k > " << kTopKMaxSort << " needs CUDA version >= 7.0";
+#endif
+}
 }  // namespace cuda
 }  // namespace mshadow
 #endif  // MSHADOW_CUDA_TENSOR_GPU_INL_CUH_
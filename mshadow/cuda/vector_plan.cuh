@@ -0,0 +1,540 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file vector_plan.cuh
+ * \brief plans that evaluate 16 bytes of consecutive elements of a row at once,
+ *  so the tensors of elementwise expressions are read and written with vector accesses.
+ *  The arithmetic of half_t vectors runs two elements per instruction on sm_53 and later.
+ */
+#ifndef MSHADOW_CUDA_VECTOR_PLAN_CUH_
+#define MSHADOW_CUDA_VECTOR_PLAN_CUH_
+#include "../tensor.h"
+
+namespace mshadow {
+namespace cuda {
+/*!
+ * \brief consecutive elements of DType that are loaded and stored as one access,
+ *  float4 for float, eight half_t for half
+ */
+template<typename DType>
+struct __align__(16) VecData {
+  /*! \brief number of elements */
+  static const index_t kSize = 16 / sizeof(DType);
+  /*! \brief the elements */
+  DType v[kSize];
+};
+/*!
+ * \brief binary OP applied to the elements of two vectors, the specializations of
+ *  half_t below use the paired __half2 instructions
+ */
+template<typename OP, typename DType>
+struct VecMap {
+  MSHADOW_XINLINE static VecData<DType> Map(const VecData<DType> &a,
+                                            const VecData<DType> &b) {
+    VecData<DType> r;
+    #pragma unroll
+    for (index_t i = 0; i < VecData<DType>::kSize; ++i) r.v[i] = OP::Map(a.v[i], b.v[i]);
+    return r;
+  }
+};
+#if MSHADOW_CUDA_HALF
+/*! \brief the paired half precision arithmetic is only used on sm_53 and later */
+#if defined(__CUDA_ARCH__) && __CUDA_ARCH__ >= 530
+#define MSHADOW_CUDA_HALF2 1
+#else
+#define MSHADOW_CUDA_HALF2 0
+#endif
+struct Half2Plus {
+  __device__ static __half2 Map(__half2 a, __half2 b) { return __hadd2(a, b); }
+};
+struct Half2Minus {
+  __device__ static __half2 Map(__half2 a, __half2 b) { return __hsub2(a, b); }
+};
+struct Half2Mul {
+  __device__ static __half2 Map(__half2 a, __half2 b) { return __hmul2(a, b); }
+};
+#if CUDA_VERSION >= 8000
+struct Half2Div {
+  __device__ static __half2 Map(__half2 a, __half2 b) { return __h2div(a, b); }
+};
+#endif
+/*!
+ * \brief VecMap of half_t that computes two elements per instruction with H2OP, and
+ *  converts each element to float and back with OP where __half2 is not available
+ */
+template<typename OP, typename H2OP>
+struct Half2VecMap {
+  MSHADOW_XINLINE static VecData<half::half_t> Map(const VecData<half::half_t> &a,
+                                                   const VecData<half::half_t> &b) {
+    VecData<half::half_t> r;
+#if MSHADOW_CUDA_HALF2
+    const __half2 *pa = reinterpret_cast<const __half2*>(a.v);
+    const __half2 *pb = reinterpret_cast<const __half2*>(b.v);
+    __half2 *pr = reinterpret_cast<__half2*>(r.v);
+    #pragma unroll
+    for (index_t i = 0; i < VecData<half::half_t>::kSize / 2; ++i) {
+      pr[i] = H2OP::Map(pa[i], pb[i]);
+    }
+#else
+    #pragma unroll
+    for (index_t i = 0; i < VecData<half::half_t>::kSize; ++i) {
+      r.v[i] = OP::Map(a.v[i], b.v[i]);
+    }
+#endif  // MSHADOW_CUDA_HALF2
+    return r;
+  }
+};
+template<>
+struct VecMap<op::plus, half::half_t> : public Half2VecMap<op::plus, Half2Plus> {};
+template<>
+struct VecMap<op::minus, half::half_t> : public Half2VecMap<op::minus, Half2Minus> {};
+template<>
+struct VecMap<op::mul, half::half_t> : public Half2VecMap<op::mul, Half2Mul> {};
+#if CUDA_VERSION >= 8000
+template<>
+struct VecMap<op::div, half::half_t> : public Half2VecMap<op::div, Half2Div> {};
+#endif
+#endif  // MSHADOW_CUDA_HALF
+/*!
+ * \brief whether the expression only has the nodes that have a VecPlan:
+ *  tensors, scalars and the maps on them, all of DType
+ * \tparam E the expression
+ * \tparam DType element type
+ */
+template<typename E, typename DType>
+struct VecCheck {
+  static const bool kPass = false;
+};
+template<int dim, typename DType>
+struct VecCheck<Tensor<gpu, dim, DType>, DType> {
+  static const bool kPass = true;
+};
+template<typename DType>
+struct VecCheck<expr::ScalarExp<DType>, DType> {
+  static const bool kPass = true;
+};
+template<typename OP, typename TA, typename DType, int etype>
+struct VecCheck<expr::UnaryMapExp<OP, TA, DType, etype>, DType> {
+  static const bool kPass = VecCheck<TA, DType>::kPass;
+};
+template<typename OP, typename TA, typename TB, typename DType, int etype>
+struct VecCheck<expr::BinaryMapExp<OP, TA, TB, DType, etype>, DType> {
+  static const bool kPass = VecCheck<TA, DType>::kPass && VecCheck<TB, DType>::kPass;
+};
+template<typename OP, typename TA, typename TB, typename TC, typename DType, int etype>
+struct VecCheck<expr::TernaryMapExp<OP, TA, TB, TC, DType, etype>, DType> {
+  static const bool kPass = VecCheck<TA, DType>::kPass && VecCheck<TB, DType>::kPass &&
+      VecCheck<TC, DType>::kPass;
+};
+// the complex expressions of interleaved numbers, a vector holds whole complex numbers;
+// cr and rc read their real operand at half the rate and are left to the plans
+template<typename OP, typename TA, typename TB, typename DType, int etype>
+struct VecCheck<expr::ComplexBinaryMapExp<op::complex::kBinaryCC, OP, TA, TB, DType, etype>,
+                DType> {
+  static const bool kPass = VecCheck<TA, DType>::kPass && VecCheck<TB, DType>::kPass;
+};
+template<int calctype, typename OP, typename TA, typename DType, int etype>
+struct VecCheck<expr::ComplexUnitaryExp<calctype, OP, TA, DType, etype>, DType> {
+  static const bool kPass = VecCheck<TA, DType>::kPass;
+};
+/*!
+ * \brief runtime check that every tensor of an expression that passes VecCheck
+ *  starts each row on a 16 byte boundary; the overloads of the complex expressions are
+ *  declared ahead of the maps that take them as operands, argument dependent lookup does
+ *  not search this namespace for the expressions
+ */
+template<int calctype, typename OP, typename TA, typename TB, typename DType, int etype>
+inline bool
+VecAligned(const expr::ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype> &e);
+template<int calctype, typename OP, typename TA, typename DType, int etype>
+inline bool VecAligned(const expr::ComplexUnitaryExp<calctype, OP, TA, DType, etype> &e);
+template<int dim, typename DType>
+inline bool VecAligned(const Tensor<gpu, dim, DType> &t) {
+  return (reinterpret_cast<size_t>(t.dptr_) & 15) == 0 &&
+      (dim == 1 || t.stride_ % VecData<DType>::kSize == 0);
+}
+template<typename DType>
+inline bool VecAligned(const expr::ScalarExp<DType> &e) {
+  return true;
+}
+template<typename OP, typename TA, typename DType, int etype>
+inline bool VecAligned(const expr::UnaryMapExp<OP, TA, DType, etype> &e) {
+  return VecAligned(e.src_);
+}
+template<typename OP, typename TA, typename TB, typename DType, int etype>
+inline bool VecAligned(const expr::BinaryMapExp<OP, TA, TB, DType, etype> &e) {
+  return VecAligned(e.lhs_) && VecAligned(e.rhs_);
+}
+template<typename OP, typename TA, typename TB, typename TC, typename DType, int etype>
+inline bool VecAligned(const expr::TernaryMapExp<OP, TA, TB, TC, DType, etype> &e) {
+  return VecAligned(e.item1_) && VecAligned(e.item2_) && VecAligned(e.item3_);
+}
+template<int calctype, typename OP, typename TA, typename TB, typename DType, int etype>
+inline bool
+VecAligned(const expr::ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype> &e) {
+  return VecAligned(e.lhs_) && VecAligned(e.rhs_);
+}
+template<int calctype, typename OP, typename TA, typename DType, int etype>
+inline bool VecAligned(const expr::ComplexUnitaryExp<calctype, OP, TA, DType, etype> &e) {
+  return VecAligned(e.src_);
+}
+/*!
+ * \brief evaluates VecData<DType>::kSize elements starting at (y, x), x is a multiple of
+ *  the size and the row has that many elements left
+ */
+template<typename E, typename DType>
+class VecPlan;
+
+template<int dim, typename DType>
+class VecPlan<Tensor<gpu, dim, DType>, DType> {
+ public:
+  explicit VecPlan(const Tensor<gpu, dim, DType> &t)
+      : dptr_(t.dptr_), stride_(t.stride_) {}
+  MSHADOW_XINLINE VecData<DType> Eval(index_t y, index_t x) const {
+    return *reinterpret_cast<const VecData<DType>*>(
+        dptr_ + static_cast<size_t>(y) * stride_ + x);
+  }
+
+ private:
+  const DType *dptr_;
+  index_t stride_;
+};
+template<typename DType>
+class VecPlan<expr::ScalarExp<DType>, DType> {
+ public:
+  explicit VecPlan(DType scalar) : scalar_(scalar) {}
+  MSHADOW_XINLINE VecData<DType> Eval(index_t y, index_t x) const {
+    VecData<DType> r;
+    #pragma unroll
+    for (index_t i = 0; i < VecData<DType>::kSize; ++i) r.v[i] = scalar_;
+    return r;
+  }
+
+ private:
+  DType scalar_;
+};
+template<typename OP, typename TA, typename DType, int etype>
+class VecPlan<expr::UnaryMapExp<OP, TA, DType, etype>, DType> {
+ public:
+  explicit VecPlan(const VecPlan<TA, DType> &src) : src_(src) {}
+  MSHADOW_XINLINE VecData<DType> Eval(index_t y, index_t x) const {
+    const VecData<DType> a = src_.Eval(y, x);
+    VecData<DType> r;
+    #pragma unroll
+    for (index_t i = 0; i < VecData<DType>::kSize; ++i) r.v[i] = OP::Map(a.v[i]);
+    return r;
+  }
+
+ private:
+  VecPlan<TA, DType> src_;
+};
+template<typename OP, typename TA, typename TB, typename DType, int etype>
+class VecPlan<expr::BinaryMapExp<OP, TA, TB, DType, etype>, DType> {
+ public:
+  VecPlan(const VecPlan<TA, DType> &lhs, const VecPlan<TB, DType> &rhs)
+      : lhs_(lhs), rhs_(rhs) {}
+  MSHADOW_XINLINE VecData<DType> Eval(index_t y, index_t x) const {
+    return VecMap<OP, DType>::Map(lhs_.Eval(y, x), rhs_.Eval(y, x));
+  }
+  /*! \brief plan of the left operand */
+  inline const VecPlan<TA, DType> &lhs(void) const {
+    return lhs_;
+  }
+  /*! \brief plan of the right operand */
+  inline const VecPlan<TB, DType> &rhs(void) const {
+    return rhs_;
+  }
+
+ private:
+  VecPlan<TA, DType> lhs_;
+  VecPlan<TB, DType> rhs_;
+};
+#if MSHADOW_CUDA_HALF
+/*! \brief a * b + c of half_t, one rounding with __hfma2 on sm_53 and later */
+template<typename TA, typename TB, typename TC, int etype_mul, int etype>
+class VecPlan<expr::BinaryMapExp<op::plus,
+                                 expr::BinaryMapExp<op::mul, TA, TB, half::half_t, etype_mul>,
+                                 TC, half::half_t, etype>, half::half_t> {
+ public:
+  typedef expr::BinaryMapExp<op::mul, TA, TB, half::half_t, etype_mul> MulExp;
+  VecPlan(const VecPlan<MulExp, half::half_t> &mul, const VecPlan<TC, half::half_t> &c)
+      : a_(mul.lhs()), b_(mul.rhs()), c_(c) {}
+  MSHADOW_XINLINE VecData<half::half_t> Eval(index_t y, index_t x) const {
+    const VecData<half::half_t> a = a_.Eval(y, x), b = b_.Eval(y, x), c = c_.Eval(y, x);
+    VecData<half::half_t> r;
+#if MSHADOW_CUDA_HALF2
+    const __half2 *pa = reinterpret_cast<const __half2*>(a.v);
+    const __half2 *pb = reinterpret_cast<const __half2*>(b.v);
+    const __half2 *pc = reinterpret_cast<const __half2*>(c.v);
+    __half2 *pr = reinterpret_cast<__half2*>(r.v);
+    #pragma unroll
+    for (index_t i = 0; i < VecData<half::half_t>::kSize / 2; ++i) {
+      pr[i] = __hfma2(pa[i], pb[i], pc[i]);
+    }
+#else
+    #pragma unroll
+    for (index_t i = 0; i < VecData<half::half_t>::kSize; ++i) {
+      r.v[i] = op::plus::Map(op::mul::Map(a.v[i], b.v[i]), c.v[i]);
+    }
+#endif  // MSHADOW_CUDA_HALF2
+    return r;
+  }
+
+ private:
+  VecPlan<TA, half::half_t> a_;
+  VecPlan<TB, half::half_t> b_;
+  VecPlan<TC, half::half_t> c_;
+};
+#endif  // MSHADOW_CUDA_HALF
+template<typename OP, typename TA, typename TB, typename TC, typename DType, int etype>
+class VecPlan<expr::TernaryMapExp<OP, TA, TB, TC, DType, etype>, DType> {
+ public:
+  VecPlan(const VecPlan<TA, DType> &item1, const VecPlan<TB, DType> &item2,
+          const VecPlan<TC, DType> &item3)
+      : item1_(item1), item2_(item2), item3_(item3) {}
+  MSHADOW_XINLINE VecData<DType> Eval(index_t y, index_t x) const {
+    const VecData<DType> a = item1_.Eval(y, x), b = item2_.Eval(y, x),
+        c = item3_.Eval(y, x);
+    VecData<DType> r;
+    #pragma unroll
+    for (index_t i = 0; i < VecData<DType>::kSize; ++i) {
+      r.v[i] = OP::Map(a.v[i], b.v[i], c.v[i]);
+    }
+    return r;
+  }
+
+ private:
+  VecPlan<TA, DType> item1_;
+  VecPlan<TB, DType> item2_;
+  VecPlan<TC, DType> item3_;
+};
+/*! \brief OP of the pairs of complex numbers of two vectors */
+template<typename OP, typename TA, typename TB, typename DType, int etype>
+class VecPlan<expr::ComplexBinaryMapExp<op::complex::kBinaryCC, OP, TA, TB, DType, etype>,
+              DType> {
+ public:
+  VecPlan(const VecPlan<TA, DType> &lhs, const VecPlan<TB, DType> &rhs)
+      : lhs_(lhs), rhs_(rhs) {}
+  MSHADOW_XINLINE VecData<DType> Eval(index_t y, index_t x) const {
+    const VecData<DType> a = lhs_.Eval(y, x), b = rhs_.Eval(y, x);
+    VecData<DType> r;
+    #pragma unroll
+    for (index_t i = 0; i < VecData<DType>::kSize; i += 2) {
+      r.v[i] = OP::RealMap(a.v[i], a.v[i + 1], b.v[i], b.v[i + 1]);
+      r.v[i + 1] = OP::ImagMap(a.v[i], a.v[i + 1], b.v[i], b.v[i + 1]);
+    }
+    return r;
+  }
+
+ private:
+  VecPlan<TA, DType> lhs_;
+  VecPlan<TB, DType> rhs_;
+};
+template<typename OP, typename TA, typename DType, int etype>
+class VecPlan<expr::ComplexUnitaryExp<op::complex::kUnitaryC2C, OP, TA, DType, etype>, DType> {
+ public:
+  explicit VecPlan(const VecPlan<TA, DType> &src) : src_(src) {}
+  MSHADOW_XINLINE VecData<DType> Eval(index_t y, index_t x) const {
+    const VecData<DType> a = src_.Eval(y, x);
+    VecData<DType> r;
+    #pragma unroll
+    for (index_t i = 0; i < VecData<DType>::kSize; i += 2) {
+      r.v[i] = OP::RealValue(a.v[i], a.v[i + 1]);
+      r.v[i + 1] = OP::ImagValue(a.v[i], a.v[i + 1]);
+    }
+    return r;
+  }
+
+ private:
+  VecPlan<TA, DType> src_;
+};
+/*! \brief the vector at x is made of the complex numbers of the two source vectors at 2 * x */
+template<typename OP, typename TA, typename DType, int etype>
+class VecPlan<expr::ComplexUnitaryExp<op::complex::kUnitaryC2R, OP, TA, DType, etype>, DType> {
+ public:
+  explicit VecPlan(const VecPlan<TA, DType> &src) : src_(src) {}
+  MSHADOW_XINLINE VecData<DType> Eval(index_t y, index_t x) const {
+    const index_t kHalf = VecData<DType>::kSize / 2;
+    const VecData<DType> lo = src_.Eval(y, x * 2);
+    const VecData<DType> hi = src_.Eval(y, x * 2 + VecData<DType>::kSize);
+    VecData<DType> r;
+    #pragma unroll
+    for (index_t i = 0; i < kHalf; ++i) {
+      r.v[i] = OP::RealValue(lo.v[i * 2], lo.v[i * 2 + 1]);
+      r.v[i + kHalf] = OP::RealValue(hi.v[i * 2], hi.v[i * 2 + 1]);
+    }
+    return r;
+  }
+
+ private:
+  VecPlan<TA, DType> src_;
+};
+
+// declared ahead of the maps that take them as operands, as for VecAligned
+template<int calctype, typename OP, typename TA, typename TB, typename DType, int etype>
+inline VecPlan<expr::ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype>, DType>
+MakeVecPlan(const expr::ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype> &e);
+template<int calctype, typename OP, typename TA, typename DType, int etype>
+inline VecPlan<expr::ComplexUnitaryExp<calctype, OP, TA, DType, etype>, DType>
+MakeVecPlan(const expr::ComplexUnitaryExp<calctype, OP, TA, DType, etype> &e);
+template<int dim, typename DType>
+inline VecPlan<Tensor<gpu, dim, DType>, DType>
+MakeVecPlan(const Tensor<gpu, dim, DType> &t) {
+  return VecPlan<Tensor<gpu, dim, DType>, DType>(t);
+}
+template<typename DType>
+inline VecPlan<expr::ScalarExp<DType>, DType> MakeVecPlan(const expr::ScalarExp<DType> &e) {
+  return VecPlan<expr::ScalarExp<DType>, DType>(e.scalar_);
+}
+template<typename OP, typename TA, typename DType, int etype>
+inline VecPlan<expr::UnaryMapExp<OP, TA, DType, etype>, DType>
+MakeVecPlan(const expr::UnaryMapExp<OP, TA, DType, etype> &e) {
+  return VecPlan<expr::UnaryMapExp<OP, TA, DType, etype>, DType>(MakeVecPlan(e.src_));
+}
+template<typename OP, typename TA, typename TB, typename DType, int etype>
+inline VecPlan<expr::BinaryMapExp<OP, TA, TB, DType, etype>, DType>
+MakeVecPlan(const expr::BinaryMapExp<OP, TA, TB, DType, etype> &e) {
+  return VecPlan<expr::BinaryMapExp<OP, TA, TB, DType, etype>,
+                 DType>(MakeVecPlan(e.lhs_), MakeVecPlan(e.rhs_));
+}
+template<typename OP, typename TA, typename TB, typename TC, typename DType, int etype>
+inline VecPlan<expr::TernaryMapExp<OP, TA, TB, TC, DType, etype>, DType>
+MakeVecPlan(const expr::TernaryMapExp<OP, TA, TB, TC, DType, etype> &e) {
+  return VecPlan<expr::TernaryMapExp<OP, TA, TB, TC, DType, etype>,
+                 DType>(MakeVecPlan(e.item1_), MakeVecPlan(e.item2_), MakeVecPlan(e.item3_));
+}
+template<int calctype, typename OP, typename TA, typename TB, typename DType, int etype>
+inline VecPlan<expr::ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype>, DType>
+MakeVecPlan(const expr::ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype> &e) {
+  return VecPlan<expr::ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype>,
+                 DType>(MakeVecPlan(e.lhs_), MakeVecPlan(e.rhs_));
+}
+template<int calctype, typename OP, typename TA, typename DType, int etype>
+inline VecPlan<expr::ComplexUnitaryExp<calctype, OP, TA, DType, etype>, DType>
+MakeVecPlan(const expr::ComplexUnitaryExp<calctype, OP, TA, DType, etype> &e) {
+  return VecPlan<expr::ComplexUnitaryExp<calctype, OP, TA, DType, etype>,
+                 DType>(MakeVecPlan(e.src_));
+}
+/*!
+ * \brief broadcasting a gpu tensor, such as the bias of x + broadcast_with_axis(bias),
+ *  reads a vector of a row of the source, or one source element repeated
+ * \tparam Index BroadcastAxisIndex or BroadcastMultiAxesIndex
+ */
+template<typename DType, typename Index>
+class BroadcastVecPlan {
+ public:
+  template<int dim>
+  BroadcastVecPlan(const Tensor<gpu, dim, DType> &src, const Index &index)
+      : dptr_(src.dptr_), stride_(src.stride_), index_(index) {}
+  MSHADOW_XINLINE VecData<DType> Eval(index_t y, index_t x) const {
+    const index_t r = index_.Row(y);
+    if (index_.keep_row_) {
+      return *reinterpret_cast<const VecData<DType>*>(
+          dptr_ + static_cast<size_t>(r) * stride_ + x);
+    }
+    const DType v = dptr_[static_cast<size_t>(index_.last_.Div(r)) * stride_ +
+                          index_.last_.Mod(r)];
+    VecData<DType> ret;
+    #pragma unroll
+    for (index_t i = 0; i < VecData<DType>::kSize; ++i) ret.v[i] = v;
+    return ret;
+  }
+
+ private:
+  const DType *dptr_;
+  index_t stride_;
+  Index index_;
+};
+
+template<int dimsrc, int dimdst, typename DType>
+struct VecCheck<expr::MakeTensorExp<expr::BroadcastWithAxisExp<Tensor<gpu, dimsrc, DType>,
+                                                               DType, dimsrc, dimdst>,
+                                    Tensor<gpu, dimsrc, DType>, dimdst, DType>, DType> {
+  static const bool kPass = true;
+};
+template<int dimsrc, typename DType>
+struct VecCheck<expr::MakeTensorExp<expr::BroadcastWithMultiAxesExp<Tensor<gpu, dimsrc, DType>,
+                                                                    DType, dimsrc>,
+                                    Tensor<gpu, dimsrc, DType>, dimsrc, DType>, DType> {
+  static const bool kPass = true;
+};
+// the source is only read in vectors when a row of the result is a row of the source
+template<int dimsrc, int dimdst, typename DType>
+inline bool VecAligned(const expr::MakeTensorExp<
+                       expr::BroadcastWithAxisExp<Tensor<gpu, dimsrc, DType>,
+                                                  DType, dimsrc, dimdst>,
+                       Tensor<gpu, dimsrc, DType>, dimdst, DType> &exp) {
+  const expr::BroadcastWithAxisExp<Tensor<gpu, dimsrc, DType>, DType, dimsrc, dimdst> &e =
+      exp.real_self();
+  return !expr::BroadcastAxisIndex(e.dst_last_, e.trailing_, e.size_, e.last_).keep_row_ ||
+      VecAligned(e.src_);
+}
+template<int dimsrc, typename DType>
+inline bool VecAligned(const expr::MakeTensorExp<
+                       expr::BroadcastWithMultiAxesExp<Tensor<gpu, dimsrc, DType>,
+                                                       DType, dimsrc>,
+                       Tensor<gpu, dimsrc, DType>, dimsrc, DType> &exp) {
+  const expr::BroadcastWithMultiAxesExp<Tensor<gpu, dimsrc, DType>, DType, dimsrc> &e =
+      exp.real_self();
+  return e.dst_last_ != e.last_ || VecAligned(e.src_);
+}
+template<int dimsrc, int dimdst, typename DType>
+class VecPlan<expr::MakeTensorExp<expr::BroadcastWithAxisExp<Tensor<gpu, dimsrc, DType>,
+                                                             DType, dimsrc, dimdst>,
+                                  Tensor<gpu, dimsrc, DType>, dimdst, DType>, DType>
+    : public BroadcastVecPlan<DType, expr::BroadcastAxisIndex> {
+ public:
+  explicit VecPlan(const expr::BroadcastWithAxisExp<Tensor<gpu, dimsrc, DType>,
+                                                    DType, dimsrc, dimdst> &e)
+      : BroadcastVecPlan<DType, expr::BroadcastAxisIndex>(
+          e.src_, expr::BroadcastAxisIndex(e.dst_last_, e.trailing_, e.size_, e.last_)) {}
+};
+template<int dimsrc, typename DType>
+class VecPlan<expr::MakeTensorExp<expr::BroadcastWithMultiAxesExp<Tensor<gpu, dimsrc, DType>,
+                                                                  DType, dimsrc>,
+                                  Tensor<gpu, dimsrc, DType>, dimsrc, DType>, DType>
+    : public BroadcastVecPlan<DType, expr::BroadcastMultiAxesIndex<dimsrc> > {
+ public:
+  explicit VecPlan(const expr::BroadcastWithMultiAxesExp<Tensor<gpu, dimsrc, DType>,
+                                                         DType, dimsrc> &e)
+      : BroadcastVecPlan<DType, expr::BroadcastMultiAxesIndex<dimsrc> >(
+          e.src_, expr::BroadcastMultiAxesIndex<dimsrc>(e.dst_last_, e.last_, e.axesnum_,
+                                                        e.trailings_, e.sizes_)) {}
+};
+template<typename SubType, typename SrcExp, int dim, typename DType>
+inline VecPlan<expr::MakeTensorExp<SubType, SrcExp, dim, DType>, DType>
+MakeVecPlan(const expr::MakeTensorExp<SubType, SrcExp, dim, DType> &e) {
+  return VecPlan<expr::MakeTensorExp<SubType, SrcExp, dim, DType>, DType>(e.real_self());
+}
+/*! \brief save a VecData to an aligned address, the destination is only read if Saver needs it */
+template<typename Saver, typename DType>
+struct VecSaver {
+  MSHADOW_XINLINE static void Save(DType *dst, const VecData<DType> &src) {
+    VecData<DType> d = *reinterpret_cast<const VecData<DType>*>(dst);
+    #pragma unroll
+    for (index_t i = 0; i < VecData<DType>::kSize; ++i) Saver::Save(d.v[i], src.v[i]);
+    *reinterpret_cast<VecData<DType>*>(dst) = d;
+  }
+};
+template<typename DType>
+struct VecSaver<sv::saveto, DType> {
+  MSHADOW_XINLINE static void Save(DType *dst, const VecData<DType> &src) {
+    *reinterpret_cast<VecData<DType>*>(dst) = src;
+  }
+};
+#if MSHADOW_CUDA_HALF
+/*! \brief dst += src and dst -= src of half_t go through VecMap, so use __half2 */
+template<typename Saver>
+struct Half2VecSaver {
+  MSHADOW_XINLINE static void Save(half::half_t *dst, const VecData<half::half_t> &src) {
+    VecData<half::half_t> *d = reinterpret_cast<VecData<half::half_t>*>(dst);
+    *d = VecMap<typename Saver::OPType, half::half_t>::Map(*d, src);
+  }
+};
+template<>
+struct VecSaver<sv::plusto, half::half_t> : public Half2VecSaver<sv::plusto> {};
+template<>
+struct VecSaver<sv::minusto, half::half_t> : public Half2VecSaver<sv::minusto> {};
+#endif  // MSHADOW_CUDA_HALF
+}  // namespace cuda
+}  // namespace mshadow
+#endif  // MSHADOW_CUDA_VECTOR_PLAN_CUH_
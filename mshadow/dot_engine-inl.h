@@ -7,8 +7,12 @@
 #ifndef MSHADOW_DOT_ENGINE_INL_H_
 #define MSHADOW_DOT_ENGINE_INL_H_
 
+#include <algorithm>
+#include <vector>
 #include "./base.h"
 #include "./extension/implicit_gemm.h"
+#include "./gemm_cpu-inl.h"
+#include "./profiler.h"
 
 #ifdef __CUDACC__
 #include "./cuda/tensor_gpu-inl.cuh"
@@ -111,6 +115,30 @@ struct BLASEngine {
   }
 };
 
+/*!
+ * \brief CPU: run batch_count contiguous gemm of a BLASEngine,
+ *  the batch is spread over the threads when it is large enough to keep all of them busy,
+ *  otherwise the products run one by one and each of them may use the threads internally
+ */
+template<typename Engine, typename DType>
+inline void BatchedGemmCPU(Stream<cpu> *stream,
+                           bool transa, bool transb,
+                           int m, int n, int k, DType alpha,
+                           const DType *A, int lda, const DType *B, int ldb,
+                           DType beta, DType *C, int ldc, int batch_count) {
+  if (batch_count <= 0) return;
+  const size_t sa = static_cast<size_t>(m) * k;
+  const size_t sb = static_cast<size_t>(k) * n;
+  const size_t sc = static_cast<size_t>(m) * n;
+  int nthread = GetNumParallelThread(stream, sc * k * batch_count);
+  if (batch_count < nthread) nthread = 1;
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < static_cast<openmp_index_t>(batch_count); ++i) {
+    Engine::gemm(stream, transa, transb, m, n, k, alpha,
+                 A + i * sa, lda, B + i * sb, ldb, beta, C + i * sc, ldc);
+  }
+}
+
 #if MSHADOW_STAND_ALONE
 template<>
 struct BLASEngine<cpu, float> {
@@ -124,24 +152,9 @@ struct BLASEngine<cpu, float> {
                           int m, int n, int k, float alpha,
                           const float *A, int lda, const float *B, int ldb,
                           float beta, float *C, int ldc) {
-    if (alpha == 1.0f && beta == 0.0f) {
-      bool transpose_left = transb;
-      bool transpose_right = transa;
-      Tensor<cpu, 2, float> lhs((float*)B, Shape2(transpose_left ? k : n, transpose_left ? n : k));  // NOLINT(*)
-      Tensor<cpu, 2, float> rhs((float*)A, Shape2(transpose_right ? m : k, transpose_right ? k : m));  // NOLINT(*)
-      Tensor<cpu, 2, float> dst(C, Shape2(m, n));
-      if (!transpose_left && !transpose_right) {
-        dst = expr::implicit_dot(lhs, rhs); return;
-      } else if (!transpose_left && transpose_right) {
-        dst = expr::implicit_dot(lhs, rhs.T()); return;
-      } else if (transpose_left && !transpose_right) {
-        dst = expr::implicit_dot(lhs.T(), rhs); return;
-      } else {
-        LOG(FATAL) << "Not implmented!";
-      }
-    } else {
-      LOG(FATAL) << "Not implmented!";
-    }
+    WaitPushedTasks(stream);
+    gemm::Gemm<float, MSHADOW_DEFAULT_PACKET>(stream, transa, transb, m, n, k, alpha,
+                                              A, lda, B, ldb, beta, C, ldc);
   }
   inline static void batched_gemm(Stream<cpu> *stream,
                                   bool transa, bool transb,
@@ -149,11 +162,9 @@ struct BLASEngine<cpu, float> {
                                   const float *A, int lda, const float *B, int ldb,
                                   float beta, float *C, int ldc, int batch_count,
                                   float **workspace) {
-    for (int i = 0; i < batch_count; ++i) {
-      gemm(stream, transa, transb, m, n, k, alpha,
-           A + i * m * k, lda, B + i * k * n, ldb,
-           beta, C + i * m * n, ldc);
-    }
+    WaitPushedTasks(stream);
+    BatchedGemmCPU<BLASEngine<cpu, float> >(stream, transa, transb, m, n, k, alpha,
+                                            A, lda, B, ldb, beta, C, ldc, batch_count);
   }
   inline static void gemv(Stream<cpu> *stream,
                           bool trans, int m, int n,
@@ -202,24 +213,9 @@ struct BLASEngine<cpu, double> {
                           int m, int n, int k, double alpha,
                           const double *A, int lda, const double *B, int ldb,
                           double beta, double *C, int ldc) {
-    if (alpha == 1.0f && beta == 0.0f) {
-      bool transpose_left = transb;
-      bool transpose_right = transa;
-      Tensor<cpu, 2, double> lhs((double*)B, Shape2(transpose_left ? k : n, transpose_left ? n : k));  // NOLINT(*)
-      Tensor<cpu, 2, double> rhs((double*)A, Shape2(transpose_right ? m : k, transpose_right ? k : m));  // NOLINT(*)
-      Tensor<cpu, 2, double> dst(C, Shape2(m, n));
-      if (!transpose_left && !transpose_right) {
-        dst = expr::implicit_dot(lhs, rhs); return;
-      } else if (!transpose_left && transpose_right) {
-        dst = expr::implicit_dot(lhs, rhs.T()); return;
-      } else if (transpose_left && !transpose_right) {
-        dst = expr::implicit_dot(lhs.T(), rhs); return;
-      } else {
-        LOG(FATAL) << "Not implmented!";
-      }
-    } else {
-      LOG(FATAL) << "Not implmented!";
-    }
+    WaitPushedTasks(stream);
+    gemm::Gemm<double, MSHADOW_DEFAULT_PACKET>(stream, transa, transb, m, n, k, alpha,
+                                               A, lda, B, ldb, beta, C, ldc);
   }
   inline static void batched_gemm(Stream<cpu> *stream,
                                   bool transa, bool transb,
@@ -227,11 +223,9 @@ struct BLASEngine<cpu, double> {
                                   const double *A, int lda, const double *B, int ldb,
                                   double beta, double *C, int ldc, int batch_count,
                                   double **workspace) {
-    for (int i = 0; i < batch_count; ++i) {
-      gemm(stream, transa, transb, m, n, k, alpha,
-           A + i * m * k, lda, B + i * k * n, ldb,
-           beta, C + i * m * n, ldc);
-    }
+    WaitPushedTasks(stream);
+    BatchedGemmCPU<BLASEngine<cpu, double> >(stream, transa, transb, m, n, k, alpha,
+                                             A, lda, B, ldb, beta, C, ldc, batch_count);
   }
   inline static void gemv(Stream<cpu> *stream,
                           bool trans, int m, int n,
@@ -281,6 +275,7 @@ struct BLASEngine<cpu, float> {
                           int m, int n, int k, float alpha,
                           const float *A, int lda, const float *B, int ldb,
                           float beta, float *C, int ldc) {
+    WaitPushedTasks(stream);
     cblas_sgemm(CblasColMajor, GetT(transa), GetT(transb),
                 m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
   }
@@ -290,17 +285,45 @@ struct BLASEngine<cpu, float> {
                                   const float *A, int lda, const float *B, int ldb,
                                   float beta, float *C, int ldc, int batch_count,
                                   float **workspace) {
-    for (int i = 0; i < batch_count; ++i) {
-      gemm(stream, transa, transb, m, n, k, alpha,
-           A + i * m * k, lda, B + i * k * n, ldb,
-           beta, C + i * m * n, ldc);
+    WaitPushedTasks(stream);
+#if MSHADOW_USE_MKL && defined(INTEL_MKL_VERSION) && INTEL_MKL_VERSION >= 20200000
+    // the batch is contiguous, no pointer array is needed
+    cblas_sgemm_batch_strided(CblasColMajor, GetT(transa), GetT(transb), m, n, k, alpha,
+                               A, lda, static_cast<MKL_INT>(m) * k,
+                               B, ldb, static_cast<MKL_INT>(k) * n,
+                               beta, C, ldc, static_cast<MKL_INT>(m) * n, batch_count);
+#elif MSHADOW_USE_MKL && defined(INTEL_MKL_VERSION) && INTEL_MKL_VERSION >= 110300
+    // one group of batch_count products, workspace holds the A, B and C pointers
+    bool alloc_workspace = false;
+    if (workspace == NULL) {
+      workspace = new float*[3 * batch_count];
+      alloc_workspace = true;
     }
+    GetBatchedView(workspace, const_cast<float*>(A), batch_count, m * k, stream);
+    GetBatchedView(workspace + batch_count,
+                   const_cast<float*>(B), batch_count, k * n, stream);
+    GetBatchedView(workspace + 2 * batch_count, C, batch_count, m * n, stream);
+    const CBLAS_TRANSPOSE ta = GetT(transa), tb = GetT(transb);
+    const MKL_INT mm = m, nn = n, kk = k, llda = lda, lldb = ldb, lldc = ldc;
+    const MKL_INT group_size = batch_count;
+    cblas_sgemm_batch(CblasColMajor, &ta, &tb, &mm, &nn, &kk, &alpha,
+                      (const float**)workspace, &llda,  // NOLINT(*)
+                      (const float**)(workspace + batch_count), &lldb,  // NOLINT(*)
+                      &beta, workspace + 2 * batch_count, &lldc, 1, &group_size);
+    if (alloc_workspace) {
+      delete [] workspace;
+    }
+#else
+    BatchedGemmCPU<BLASEngine<cpu, float> >(stream, transa, transb, m, n, k, alpha,
+                                            A, lda, B, ldb, beta, C, ldc, batch_count);
+#endif  // MSHADOW_USE_MKL && INTEL_MKL_VERSION >= 20200000
   }
   inline static void gemv(Stream<cpu> *stream,
                           bool trans, int m, int n,
                           float alpha, const float *A, int lda,
                           const float *X, int incX,
                           float beta, float *Y, int incY) {
+    WaitPushedTasks(stream);
     cblas_sgemv(CblasColMajor, GetT(trans), m, n, alpha,
                 A, lda, X, incX, beta, Y, incY);
   }
@@ -309,6 +332,7 @@ struct BLASEngine<cpu, float> {
                                   float alpha, const float *A, int lda,
                                   const float *X, int incX,
                                   float beta, float *Y, int incY, int batch_count) {
+    WaitPushedTasks(stream);
     for (int i = 0; i < batch_count; ++i) {
       gemv(stream, trans, m, n, alpha, A + i * m * n, lda,
            X + i * (trans ? m : n) * incX, incX,
@@ -319,12 +343,14 @@ struct BLASEngine<cpu, float> {
                          int m, int n, float alpha,
                          const float *X, int incX,
                          const float *Y, int incY, float *A, int lda) {
+    WaitPushedTasks(stream);
     cblas_sger(CblasColMajor, m, n, alpha, X, incX, Y, incY, A, lda);
   }
   inline static void batched_ger(Stream<cpu> *stream,
                          int m, int n, float alpha,
                          const float *X, int incX,
                          const float *Y, int incY, float *A, int lda, int batch_count) {
+    WaitPushedTasks(stream);
     for (int i = 0; i < batch_count; ++i) {
       ger(stream, m, n, alpha, X + i * m * incX, incX, Y + i * n * incY, incY,
           A + i * lda * n, lda);
@@ -335,6 +361,7 @@ struct BLASEngine<cpu, float> {
                          const float* X, int incX,
                          const float* Y, int incY,
                          float* ret) {
+    WaitPushedTasks(stream);
     *ret = cblas_sdot(n, X, incX, Y, incY);
   }
 };
@@ -351,6 +378,7 @@ struct BLASEngine<cpu, double> {
                           int m, int n, int k, double alpha,
                           const double *A, int lda, const double *B, int ldb,
                           double beta, double *C, int ldc) {
+    WaitPushedTasks(stream);
     cblas_dgemm(CblasColMajor, GetT(transa), GetT(transb),
                 m, n, k, alpha, A, lda, B, ldb, beta, C, ldc);
   }
@@ -360,17 +388,45 @@ struct BLASEngine<cpu, double> {
                                   const double *A, int lda, const double *B, int ldb,
                                   double beta, double *C, int ldc, int batch_count,
                                   double **workspace) {
-    for (int i = 0; i < batch_count; ++i) {
-      gemm(stream, transa, transb, m, n, k, alpha,
-           A + i * m * k, lda, B + i * k * n, ldb,
-           beta, C + i * m * n, ldc);
+    WaitPushedTasks(stream);
+#if MSHADOW_USE_MKL && defined(INTEL_MKL_VERSION) && INTEL_MKL_VERSION >= 20200000
+    // the batch is contiguous, no pointer array is needed
+    cblas_dgemm_batch_strided(CblasColMajor, GetT(transa), GetT(transb), m, n, k, alpha,
+                               A, lda, static_cast<MKL_INT>(m) * k,
+                               B, ldb, static_cast<MKL_INT>(k) * n,
+                               beta, C, ldc, static_cast<MKL_INT>(m) * n, batch_count);
+#elif MSHADOW_USE_MKL && defined(INTEL_MKL_VERSION) && INTEL_MKL_VERSION >= 110300
+    // one group of batch_count products, workspace holds the A, B and C pointers
+    bool alloc_workspace = false;
+    if (workspace == NULL) {
+      workspace = new double*[3 * batch_count];
+      alloc_workspace = true;
+    }
+    GetBatchedView(workspace, const_cast<double*>(A), batch_count, m * k, stream);
+    GetBatchedView(workspace + batch_count,
+                   const_cast<double*>(B), batch_count, k * n, stream);
+    GetBatchedView(workspace + 2 * batch_count, C, batch_count, m * n, stream);
+    const CBLAS_TRANSPOSE ta = GetT(transa), tb = GetT(transb);
+    const MKL_INT mm = m, nn = n, kk = k, llda = lda, lldb = ldb, lldc = ldc;
+    const MKL_INT group_size = batch_count;
+    cblas_dgemm_batch(CblasColMajor, &ta, &tb, &mm, &nn, &kk, &alpha,
+                      (const double**)workspace, &llda,  // NOLINT(*)
+                      (const double**)(workspace + batch_count), &lldb,  // NOLINT(*)
+                      &beta, workspace + 2 * batch_count, &lldc, 1, &group_size);
+    if (alloc_workspace) {
+      delete [] workspace;
     }
+#else
+    BatchedGemmCPU<BLASEngine<cpu, double> >(stream, transa, transb, m, n, k, alpha,
+                                             A, lda, B, ldb, beta, C, ldc, batch_count);
+#endif  // MSHADOW_USE_MKL && INTEL_MKL_VERSION >= 20200000
   }
   inline static void gemv(Stream<cpu> *stream,
                           bool trans, int m, int n, double alpha,
                           const double *A, int lda,
                           const double *X, int incX,
                           double beta, double *Y, int incY) {
+    WaitPushedTasks(stream);
     cblas_dgemv(CblasColMajor, GetT(trans), m, n, alpha,
                 A, lda, X, incX, beta, Y, incY);
   }
@@ -379,6 +435,7 @@ struct BLASEngine<cpu, double> {
                                   double alpha, const double *A, int lda,
                                   const double *X, int incX,
                                   double beta, double *Y, int incY, int batch_count) {
+    WaitPushedTasks(stream);
     for (int i = 0; i < batch_count; ++i) {
       gemv(stream, trans, m, n, alpha, A + i * m * n, lda,
            X + i * (trans ? m : n) * incX, incX,
@@ -389,12 +446,14 @@ struct BLASEngine<cpu, double> {
                          int m, int n, double alpha,
                          const double *X, int incX,
                          const double *Y, int incY, double *A, int lda) {
+    WaitPushedTasks(stream);
     cblas_dger(CblasColMajor, m, n, alpha, X, incX, Y, incY, A, lda);
   }
   inline static void batched_ger(Stream<cpu> *stream,
                          int m, int n, double alpha,
                          const double *X, int incX,
                          const double *Y, int incY, double *A, int lda, int batch_count) {
+    WaitPushedTasks(stream);
     for (int i = 0; i < batch_count; ++i) {
       ger(stream, m, n, alpha, X + i * m * incX, incX, Y + i * n * incY, incY,
           A + i * lda * n, lda);
@@ -405,12 +464,124 @@ struct BLASEngine<cpu, double> {
                          const double* X, int incX,
                          const double* Y, int incY,
                          double* ret) {
+    WaitPushedTasks(stream);
     *ret = cblas_ddot(n, X, incX, Y, incY);
   }
 };
 #endif  // MSHADOW_USE_CBLAS || MSHADOW_USE_MKL || MSHADOW_STAND_ALONE
+#if MSHADOW_USE_CBLAS || MSHADOW_USE_MKL || MSHADOW_STAND_ALONE
+/*!
+ * \brief CPU: cols columns of rows elements of a column major matrix with leading
+ *  dimension ld, converted between bf16_t and float
+ */
+template<typename DstDType, typename SrcDType>
+inline void ConvertColumns(DstDType *dst, int dst_ld, const SrcDType *src, int src_ld,
+                           int rows, int cols) {
+  for (int j = 0; j < cols; ++j) {
+    for (int i = 0; i < rows; ++i) {
+      dst[static_cast<size_t>(j) * dst_ld + i] =
+          DstDType(static_cast<float>(src[static_cast<size_t>(j) * src_ld + i]));
+    }
+  }
+}
+// bf16 products accumulate in float, MKL takes bf16 inputs directly, the other
+// backends multiply float copies of the inputs
+template<>
+struct BLASEngine<cpu, bfloat::bf16_t> {
+  inline static bool GetT(bool t) {
+    return t ? true : false;
+  }
+  inline static void SetStream(Stream<cpu> *stream) {
+  }
+  inline static void gemm(Stream<cpu> *stream,
+                          bool transa, bool transb,
+                          int m, int n, int k, bfloat::bf16_t alpha,
+                          const bfloat::bf16_t *A, int lda,
+                          const bfloat::bf16_t *B, int ldb, bfloat::bf16_t beta,
+                          bfloat::bf16_t *C, int ldc) {
+    WaitPushedTasks(stream);
+    if (m <= 0 || n <= 0) return;
+    const float alpha_f = float(alpha);  // NOLINT(*)
+    const float beta_f = float(beta);  // NOLINT(*)
+    std::vector<float> c(static_cast<size_t>(m) * n, 0.0f);
+    if (beta_f != 0.0f) ConvertColumns(&c[0], m, C, ldc, m, n);
+#if MSHADOW_USE_MKL && defined(INTEL_MKL_VERSION) && INTEL_MKL_VERSION >= 20200000
+    cblas_gemm_bf16bf16f32(CblasColMajor, BLASEngine<cpu, float>::GetT(transa),
+                           BLASEngine<cpu, float>::GetT(transb), m, n, k, alpha_f,
+                           reinterpret_cast<const MKL_BF16*>(A), lda,
+                           reinterpret_cast<const MKL_BF16*>(B), ldb,
+                           beta_f, &c[0], m);
+#else
+    const int arows = transa ? k : m, acols = transa ? m : k;
+    const int brows = transb ? n : k, bcols = transb ? k : n;
+    std::vector<float> a(static_cast<size_t>(arows) * acols);
+    std::vector<float> b(static_cast<size_t>(brows) * bcols);
+    ConvertColumns(a.size() != 0 ? &a[0] : NULL, arows, A, lda, arows, acols);
+    ConvertColumns(b.size() != 0 ? &b[0] : NULL, brows, B, ldb, brows, bcols);
+    BLASEngine<cpu, float>::gemm(stream, transa, transb, m, n, k, alpha_f,
+                                 a.size() != 0 ? &a[0] : NULL, std::max(arows, 1),
+                                 b.size() != 0 ? &b[0] : NULL, std::max(brows, 1),
+                                 beta_f, &c[0], m);
+#endif  // MSHADOW_USE_MKL && INTEL_MKL_VERSION >= 20200000
+    ConvertColumns(C, ldc, &c[0], m, m, n);
+  }
+  inline static void batched_gemm(Stream<cpu> *stream,
+                                  bool transa, bool transb,
+                                  int m, int n, int k, bfloat::bf16_t alpha,
+                                  const bfloat::bf16_t *A, int lda,
+                                  const bfloat::bf16_t *B, int ldb,
+                                  bfloat::bf16_t beta, bfloat::bf16_t *C, int ldc,
+                                  int batch_count, bfloat::bf16_t **workspace) {
+    WaitPushedTasks(stream);
+    BatchedGemmCPU<BLASEngine<cpu, bfloat::bf16_t> >(stream, transa, transb, m, n, k, alpha,
+                                                     A, lda, B, ldb, beta, C, ldc, batch_count);
+  }
+  inline static void gemv(Stream<cpu> *stream,
+                          bool trans, int m, int n, bfloat::bf16_t alpha,
+                          const bfloat::bf16_t *A, int lda,
+                          const bfloat::bf16_t *X, int incX, bfloat::bf16_t beta,
+                          bfloat::bf16_t *Y, int incY) {
+    LOG(FATAL) << "Not implmented!";
+  }
+  inline static void batched_gemv(Stream<cpu> *stream,
+                                  bool trans, int m, int n,
+                                  bfloat::bf16_t alpha, const bfloat::bf16_t *A, int lda,
+                                  const bfloat::bf16_t *X, int incX,
+                                  bfloat::bf16_t beta, bfloat::bf16_t *Y, int incY,
+                                  int batch_count) {
+    LOG(FATAL) << "Not implmented!";
+  }
+  inline static void ger(Stream<cpu> *stream,
+                         int m, int n, bfloat::bf16_t alpha,
+                         const bfloat::bf16_t *X, int incX,
+                         const bfloat::bf16_t *Y, int incY, bfloat::bf16_t *A, int lda) {
+    LOG(FATAL) << "Not implmented!";
+  }
+  inline static void batched_ger(Stream<cpu> *stream,
+                         int m, int n, bfloat::bf16_t alpha,
+                         const bfloat::bf16_t *X, int incX, const bfloat::bf16_t *Y, int incY,
+                         bfloat::bf16_t *A, int lda, int batch_count) {
+    LOG(FATAL) << "Not implmented!";
+  }
+  inline static void dot(Stream<cpu> *stream,
+                         int n,
+                         const bfloat::bf16_t* X, int incX,
+                         const bfloat::bf16_t* Y, int incY,
+                         bfloat::bf16_t *ret) {
+    LOG(FATAL) << "Not implmented!";
+  }
+};
+#endif  // MSHADOW_USE_CBLAS || MSHADOW_USE_MKL || MSHADOW_STAND_ALONE
 // CuBLAS redirect code
 #if MSHADOW_USE_CUDA
+// compute types of cublasGemmEx, cudaDataType before CUDA 11
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 11000
+#define MSHADOW_CUBLAS_COMPUTE_32F CUBLAS_COMPUTE_32F
+#define MSHADOW_CUBLAS_COMPUTE_16F CUBLAS_COMPUTE_16F
+#else
+#define MSHADOW_CUBLAS_COMPUTE_32F CUDA_R_32F
+#define MSHADOW_CUBLAS_COMPUTE_16F CUDA_R_16F
+#endif  // defined(CUDA_VERSION) && CUDA_VERSION >= 11000
 // All CuBLAS goes to here, use legacy API: not threadsafe
 template<>
 struct BLASEngine<gpu, half::half_t> {
@@ -422,13 +593,40 @@ struct BLASEngine<gpu, half::half_t> {
                     Stream<gpu>::GetStream(stream));
     CHECK_EQ(err, CUBLAS_STATUS_SUCCESS) << "Cublas set stream fail";
   }
+  // whether the gemm on stream accumulate in float
+  inline static bool AccFloat(Stream<gpu> *stream) {
+    switch (Stream<gpu>::GetGemmCompute(stream)) {
+      case kGemmComputeStorage: return false;
+      case kGemmComputeFloat32: return true;
+      default:
+#if MSHADOW_USE_PASCAL == 1
+        return false;
+#else
+        return true;
+#endif  // MSHADOW_USE_PASCAL == 1
+    }
+  }
   inline static void gemm(Stream<gpu> *stream,
                           bool transa, bool transb,
                           int m, int n, int k, half::half_t alpha,
                           const half::half_t *A, int lda,
                           const half::half_t *B, int ldb, half::half_t beta,
                           half::half_t *C, int ldc) {
-#if defined(CUDA_VERSION) && CUDA_VERSION >= 7050
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 9000
+    // half storage, the compute type follows the stream, tensor ops are allowed
+    const bool acc_float = AccFloat(stream);
+    float alpha_f = float(alpha);  // NOLINT(*)
+    float beta_f = float(beta);  // NOLINT(*)
+    cublasStatus_t err = cublasGemmEx(Stream<gpu>::GetBlasHandle(stream),
+                GetT(transa), GetT(transb), m, n, k,
+                acc_float ? static_cast<const void*>(&alpha_f) : &alpha.cuhalf_,
+                A, CUDA_R_16F, lda, B, CUDA_R_16F, ldb,
+                acc_float ? static_cast<const void*>(&beta_f) : &beta.cuhalf_,
+                C, CUDA_R_16F, ldc,
+                acc_float ? MSHADOW_CUBLAS_COMPUTE_32F : MSHADOW_CUBLAS_COMPUTE_16F,
+                CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+    CHECK_EQ(err, CUBLAS_STATUS_SUCCESS) << "Cublas GemmEx fail";
+#elif defined(CUDA_VERSION) && CUDA_VERSION >= 7050
 #if MSHADOW_USE_PASCAL == 1
     cublasStatus_t err = cublasHgemm(Stream<gpu>::GetBlasHandle(stream),
                 GetT(transa), GetT(transb), m, n, k, &alpha.cuhalf_,
@@ -453,7 +651,7 @@ struct BLASEngine<gpu, half::half_t> {
 #endif  // MSHADOW_USE_PASCAL == 1
 #else
     LOG(FATAL) << "Require CUDA version >= 7.5!";
-#endif  // defined(CUDA_VERSION) && CUDA_VERSION >= 7050
+#endif  // defined(CUDA_VERSION) && CUDA_VERSION >= 9000
   }
   inline static void batched_gemm(Stream<gpu> *stream,
                                   bool transa, bool transb,
@@ -461,11 +659,27 @@ struct BLASEngine<gpu, half::half_t> {
                                   const half::half_t *A, int lda, const half::half_t *B, int ldb,
                                   half::half_t beta, half::half_t *C, int ldc, int batch_count,
                                   half::half_t **workspace) {
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 9000
+    const bool acc_float = AccFloat(stream);
+    float alpha_f = float(alpha);  // NOLINT(*)
+    float beta_f = float(beta);  // NOLINT(*)
+    cublasStatus_t err = cublasGemmStridedBatchedEx(Stream<gpu>::GetBlasHandle(stream),
+                GetT(transa), GetT(transb), m, n, k,
+                acc_float ? static_cast<const void*>(&alpha_f) : &alpha.cuhalf_,
+                A, CUDA_R_16F, lda, static_cast<int64_t>(m) * k,
+                B, CUDA_R_16F, ldb, static_cast<int64_t>(k) * n,
+                acc_float ? static_cast<const void*>(&beta_f) : &beta.cuhalf_,
+                C, CUDA_R_16F, ldc, static_cast<int64_t>(m) * n, batch_count,
+                acc_float ? MSHADOW_CUBLAS_COMPUTE_32F : MSHADOW_CUBLAS_COMPUTE_16F,
+                CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+    CHECK_EQ(err, CUBLAS_STATUS_SUCCESS) << "Cublas GemmStridedBatchedEx fail";
+#else
     for (int i = 0; i < batch_count; ++i) {
       gemm(stream, transa, transb, m, n, k, alpha,
            A + i * m * k, lda, B + i * k * n, ldb,
            beta, C + i * m * n, ldc);
     }
+#endif  // defined(CUDA_VERSION) && CUDA_VERSION >= 9000
   }
   inline static void gemv(Stream<gpu> *stream,
                           bool trans, int m, int n, half::half_t alpha,
@@ -501,6 +715,90 @@ struct BLASEngine<gpu, half::half_t> {
     LOG(FATAL) << "Not implmented!";
   }
 };
+template<>
+struct BLASEngine<gpu, bfloat::bf16_t> {
+  inline static cublasOperation_t GetT(bool t) {
+    return t ? CUBLAS_OP_T : CUBLAS_OP_N;
+  }
+  inline static void SetStream(Stream<gpu> *stream) {
+    cublasStatus_t err = cublasSetStream(Stream<gpu>::GetBlasHandle(stream),
+                    Stream<gpu>::GetStream(stream));
+    CHECK_EQ(err, CUBLAS_STATUS_SUCCESS) << "Cublas set stream fail";
+  }
+  inline static void gemm(Stream<gpu> *stream,
+                          bool transa, bool transb,
+                          int m, int n, int k, bfloat::bf16_t alpha,
+                          const bfloat::bf16_t *A, int lda,
+                          const bfloat::bf16_t *B, int ldb, bfloat::bf16_t beta,
+                          bfloat::bf16_t *C, int ldc) {
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 11000
+    float alpha_f = float(alpha);  // NOLINT(*)
+    float beta_f = float(beta);  // NOLINT(*)
+    cublasStatus_t err = cublasGemmEx(Stream<gpu>::GetBlasHandle(stream),
+                GetT(transa), GetT(transb), m, n, k, &alpha_f,
+                A, CUDA_R_16BF, lda, B, CUDA_R_16BF, ldb, &beta_f,
+                C, CUDA_R_16BF, ldc, CUBLAS_COMPUTE_32F, CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+    CHECK_EQ(err, CUBLAS_STATUS_SUCCESS) << "Cublas GemmEx fail";
+#else
+    LOG(FATAL) << "Require CUDA version >= 11.0!";
+#endif  // defined(CUDA_VERSION) && CUDA_VERSION >= 11000
+  }
+  inline static void batched_gemm(Stream<gpu> *stream,
+                                  bool transa, bool transb,
+                                  int m, int n, int k, bfloat::bf16_t alpha,
+                                  const bfloat::bf16_t *A, int lda,
+                                  const bfloat::bf16_t *B, int ldb,
+                                  bfloat::bf16_t beta, bfloat::bf16_t *C, int ldc,
+                                  int batch_count, bfloat::bf16_t **workspace) {
+#if defined(CUDA_VERSION) && CUDA_VERSION >= 11000
+    float alpha_f = float(alpha);  // NOLINT(*)
+    float beta_f = float(beta);  // NOLINT(*)
+    cublasStatus_t err = cublasGemmStridedBatchedEx(Stream<gpu>::GetBlasHandle(stream),
+                GetT(transa), GetT(transb), m, n, k, &alpha_f,
+                A, CUDA_R_16BF, lda, static_cast<int64_t>(m) * k,
+                B, CUDA_R_16BF, ldb, static_cast<int64_t>(k) * n, &beta_f,
+                C, CUDA_R_16BF, ldc, static_cast<int64_t>(m) * n, batch_count,
+                CUBLAS_COMPUTE_32F, CUBLAS_GEMM_DEFAULT_TENSOR_OP);
+    CHECK_EQ(err, CUBLAS_STATUS_SUCCESS) << "Cublas GemmStridedBatchedEx fail";
+#else
+    LOG(FATAL) << "Require CUDA version >= 11.0!";
+#endif  // defined(CUDA_VERSION) && CUDA_VERSION >= 11000
+  }
+  inline static void gemv(Stream<gpu> *stream,
+                          bool trans, int m, int n, bfloat::bf16_t alpha,
+                          const bfloat::bf16_t *A, int lda,
+                          const bfloat::bf16_t *X, int incX, bfloat::bf16_t beta,
+                          bfloat::bf16_t *Y, int incY) {
+    LOG(FATAL) << "Not implmented!";
+  }
+  inline static void batched_gemv(Stream<gpu> *stream,
+                                  bool trans, int m, int n,
+                                  bfloat::bf16_t alpha, const bfloat::bf16_t *A, int lda,
+                                  const bfloat::bf16_t *X, int incX,
+                                  bfloat::bf16_t beta, bfloat::bf16_t *Y, int incY,
+                                  int batch_count) {
+    LOG(FATAL) << "Not implmented!";
+  }
+  inline static void ger(Stream<gpu> *stream,
+                         int m, int n, bfloat::bf16_t alpha,
+                         const bfloat::bf16_t *X, int incX,
+                         const bfloat::bf16_t *Y, int incY, bfloat::bf16_t *A, int lda) {
+    LOG(FATAL) << "Not implmented!";
+  }
+  inline static void batched_ger(Stream<gpu> *stream,
+                         int m, int n, bfloat::bf16_t alpha,
+                         const bfloat::bf16_t *X, int incX, const bfloat::bf16_t *Y, int incY,
+                         bfloat::bf16_t *A, int lda, int batch_count) {
+    LOG(FATAL) << "Not implmented!";
+  }
+  inline static void dot(Stream<gpu> *stream,
+                         int n,
+                         const bfloat::bf16_t* X, int incX,
+                         const bfloat::bf16_t* Y, int incY,
+                         bfloat::bf16_t *ret) {
+    LOG(FATAL) << "Not implmented!";
+  }
+};
 
 template<>
 struct BLASEngine<gpu, float> {
@@ -529,7 +827,15 @@ struct BLASEngine<gpu, float> {
                                   const float *A, int lda, const float *B, int ldb,
                                   float beta, float *C, int ldc, int batch_count,
                                   float **workspace) {
-#if defined(__CUDACC__) && CUDA_VERSION >= 4010
+#if defined(__CUDACC__) && CUDA_VERSION >= 8000
+    // the batch is contiguous, no pointer array is needed
+    cublasStatus_t err = cublasSgemmStridedBatched(Stream<gpu>::GetBlasHandle(stream),
+                GetT(transa), GetT(transb), m, n, k, &alpha,
+                A, lda, static_cast<long long>(m) * k,  // NOLINT(*)
+                B, ldb, static_cast<long long>(k) * n,  // NOLINT(*)
+                &beta, C, ldc, static_cast<long long>(m) * n, batch_count);  // NOLINT(*)
+    CHECK_EQ(err, CUBLAS_STATUS_SUCCESS) << "Cublas: SgemmStridedBatched fail";
+#elif defined(__CUDACC__) && CUDA_VERSION >= 4010
     // Cast DType* to DType** using workspace as a buffer
     bool alloc_workspace = false;
     if (workspace == NULL) {
@@ -557,7 +863,7 @@ struct BLASEngine<gpu, float> {
            A + i * m * k, lda, B + i * k * n, ldb,
            beta, C + i * m * n, ldc);
     }
-#endif  // defined(__CUDACC__) && CUDA_VERSION >= 4010
+#endif  // defined(__CUDACC__) && CUDA_VERSION >= 8000
   }
   inline static void gemv(Stream<gpu> *stream,
                           bool trans, int m, int n, float alpha,
@@ -638,7 +944,15 @@ struct BLASEngine<gpu, double> {
                                   const double *A, int lda, const double *B, int ldb,
                                   double beta, double *C, int ldc, int batch_count,
                                   double **workspace) {
-#if defined(__CUDACC__) && CUDA_VERSION >= 4010
+#if defined(__CUDACC__) && CUDA_VERSION >= 8000
+    // the batch is contiguous, no pointer array is needed
+    cublasStatus_t err = cublasDgemmStridedBatched(Stream<gpu>::GetBlasHandle(stream),
+                GetT(transa), GetT(transb), m, n, k, &alpha,
+                A, lda, static_cast<long long>(m) * k,  // NOLINT(*)
+                B, ldb, static_cast<long long>(k) * n,  // NOLINT(*)
+                &beta, C, ldc, static_cast<long long>(m) * n, batch_count);  // NOLINT(*)
+    CHECK_EQ(err, CUBLAS_STATUS_SUCCESS) << "Cublas: DgemmStridedBatched fail";
+#elif defined(__CUDACC__) && CUDA_VERSION >= 4010
     // Cast DType* to DType** using workspace as a buffer
     bool alloc_workspace = false;
     if (workspace == NULL) {
@@ -666,7 +980,7 @@ struct BLASEngine<gpu, double> {
            A + i * m * k, lda, B + i * k * n, ldb,
            beta, C + i * m * n, ldc);
     }
-#endif  // defined(__CUDACC__) && CUDA_VERSION >= 4010
+#endif  // defined(__CUDACC__) && CUDA_VERSION >= 8000
   }
   inline static void gemv(Stream<gpu> *stream,
                           bool trans, int m, int n, double alpha,
@@ -733,17 +1047,6 @@ struct DotEngine<SV, xpu, 2, 2, 2, transpose_left, transpose_right, DType> {
                           const Tensor<xpu, 2, DType> &rhs,
                           DType scale) {
     Tensor<xpu, 2, DType> &dst = *p_dst;
-#if MSHADOW_STAND_ALONE
-    if (xpu::kDevMask == cpu::kDevMask && scale == 1.0f) {
-      if (!transpose_left && !transpose_right) {
-        dst = expr::implicit_dot(lhs, rhs); return;
-      } else if (!transpose_left && transpose_right) {
-        dst = expr::implicit_dot(lhs, rhs.T()); return;
-      } else if (transpose_left && !transpose_right) {
-        dst = expr::implicit_dot(lhs.T(), rhs); return;
-      }
-    }
-#endif
     // set kernel stream
     // if there is no stream, crush
     BLASEngine<xpu, DType>::SetStream(dst.stream_);
@@ -751,6 +1054,8 @@ struct DotEngine<SV, xpu, 2, 2, 2, transpose_left, transpose_right, DType> {
     Shape<2> sright = GetShape(rhs.shape_, transpose_right);
     CHECK(dst.size(0) == sleft[0] && dst.size(1) == sright[1] && sleft[1] == sright[0])
       << "dot-gemm: matrix shape mismatch";
+    MSHADOW_PROFILE_SCOPE(kBLAS, "gemm", dst.shape_, sizeof(DType) *
+                          (dst.shape_.Size() + lhs.shape_.Size() + rhs.shape_.Size()));
     // use column major argument to compatible with most BLAS
     BLASEngine<xpu, DType>::gemm
         (dst.stream_,
@@ -781,6 +1086,8 @@ struct DotEngine<SV, xpu, 1, 1, 2, false, transpose_right, DType> {
       << "dst: " << dst.shape_ << "\n"
       << "lhs: " << lhs.shape_ << "\n"
       << "rhs: " << sright << "\n";
+    MSHADOW_PROFILE_SCOPE(kBLAS, "gemv", dst.shape_, sizeof(DType) *
+                          (dst.shape_.Size() + lhs.shape_.Size() + rhs.shape_.Size()));
     BLASEngine<xpu, DType>::gemv
         (dst.stream_,
          transpose_right,
@@ -806,6 +1113,8 @@ struct DotEngine<SV, xpu, 2, 1, 1, true, false, DType> {
       << "lhs: " << lhs.shape_ << "\n"
       << "rhs: " << rhs.shape_;
     if (SV::BetaBLAS() == 0.0f) {
+      MSHADOW_PROFILE_SCOPE(kBLAS, "ger", dst.shape_, sizeof(DType) *
+                            (dst.shape_.Size() + lhs.shape_.Size() + rhs.shape_.Size()));
       BLASEngine<xpu, DType>::ger
           (dst.stream_, rhs.size(0), lhs.size(0), scale * SV::AlphaBLAS(),
            rhs.dptr_, 1, lhs.dptr_, 1, dst.dptr_, dst.stride_);
@@ -403,7 +403,8 @@ struct ShapeCheck<dim, BinaryMapExp<OP, TA, TB, DType, etype> > {
     Shape<dim> shape2 = ShapeCheck<dim, TB>::Check(t.rhs_);
     if (shape1[0] == 0) return shape2;
     if (shape2[0] == 0) return shape1;
-    CHECK_EQ(shape1, shape2) << "BinaryMapExp: Shapes of operands are not the same, " <<
+    MSHADOW_CHECK_SHAPE_EQ(shape1, shape2)
+      << "BinaryMapExp: Shapes of operands are not the same, " <<
       "Shape1=" << shape1 << ", Shape2=" << shape2;
     return shape1;
   }
@@ -417,13 +418,98 @@ struct ShapeCheck<dim, TernaryMapExp<OP, TA, TB, TC, DType, etype> > {
     Shape<dim> shape1 = ShapeCheck<dim, TA>::Check(t.item1_);
     Shape<dim> shape2 = ShapeCheck<dim, TB>::Check(t.item2_);
     Shape<dim> shape3 = ShapeCheck<dim, TC>::Check(t.item3_);
-    bool same = (shape1 == shape2) && (shape2 == shape3);
-    CHECK(same) << "TernaryMapExp: Shapes of operands are not the same, " <<
+    MSHADOW_CHECK_SHAPE(shape1 == shape2 && shape2 == shape3)
+      << "TernaryMapExp: Shapes of operands are not the same, " <<
       "Shape1=" << shape1 << ", Shape2=" << shape2 << ", Shape3=" << shape3;
 
     return shape1;
   }
 };
+/*!
+ * \brief runtime check whether an expression only maps contiguous tensors and scalars
+ *  elementwise, so its plan gives the i-th element at (0, i) and an assignment of it can be
+ *  evaluated as one row of all the elements
+ * \tparam E expression
+ */
+template<typename E>
+struct FlatCheck {
+  /*!
+   * \param exp the expression
+   * \param addr the data pointers of the tensors are or-ed into it, for alignment checks
+   */
+  inline static bool Check(const E &exp, size_t *addr) {
+    return false;
+  }
+};
+template<typename DType>
+struct FlatCheck<ScalarExp<DType> > {
+  inline static bool Check(const ScalarExp<DType> &exp, size_t *addr) {
+    return true;
+  }
+};
+template<typename Device, int dim, typename DType>
+struct FlatCheck<Tensor<Device, dim, DType> > {
+  inline static bool Check(const Tensor<Device, dim, DType> &t, size_t *addr) {
+    *addr |= reinterpret_cast<size_t>(t.dptr_);
+    return t.CheckContiguous();
+  }
+};
+template<typename DstDType, typename SrcDType, typename EType, int etype>
+struct FlatCheck<TypecastExp<DstDType, SrcDType, EType, etype> > {
+  inline static bool
+  Check(const TypecastExp<DstDType, SrcDType, EType, etype> &exp, size_t *addr) {
+    return FlatCheck<EType>::Check(exp.exp, addr);
+  }
+};
+template<typename OP, typename TA, typename DType, int etype>
+struct FlatCheck<UnaryMapExp<OP, TA, DType, etype> > {
+  inline static bool Check(const UnaryMapExp<OP, TA, DType, etype> &t, size_t *addr) {
+    return FlatCheck<TA>::Check(t.src_, addr);
+  }
+};
+template<typename OP, typename TA, typename TB, typename DType, int etype>
+struct FlatCheck<BinaryMapExp<OP, TA, TB, DType, etype> > {
+  inline static bool Check(const BinaryMapExp<OP, TA, TB, DType, etype> &t, size_t *addr) {
+    return FlatCheck<TA>::Check(t.lhs_, addr) && FlatCheck<TB>::Check(t.rhs_, addr);
+  }
+};
+template<typename OP, typename TA, typename TB, typename TC, typename DType, int etype>
+struct FlatCheck<TernaryMapExp<OP, TA, TB, TC, DType, etype> > {
+  inline static bool
+  Check(const TernaryMapExp<OP, TA, TB, TC, DType, etype> &t, size_t *addr) {
+    return FlatCheck<TA>::Check(t.item1_, addr) && FlatCheck<TB>::Check(t.item2_, addr) &&
+        FlatCheck<TC>::Check(t.item3_, addr);
+  }
+};
+/*!
+ * \brief view dst as one row of all its elements if it and every tensor of exp are
+ *  contiguous, see FlatCheck; the loops and kernels of the assignment then do not stop
+ *  at the end of each row, which matters for narrow tensors
+ * \param flat the view of dst
+ * \param addr the data pointers of dst and of the tensors of exp or-ed together
+ * \return whether exp can be evaluated into the view
+ */
+template<typename Device, int dim, typename DType, typename E>
+inline bool FlatView(const Tensor<Device, dim, DType> &dst, const E &exp,
+                     Tensor<Device, 2, DType> *flat, size_t *addr) {
+  // a tensor of one dimension is a single row already
+  if (dim == 1 || !dst.CheckContiguous()) return false;
+  *addr = reinterpret_cast<size_t>(dst.dptr_);
+  if (!FlatCheck<E>::Check(exp, addr)) return false;
+  *flat = Tensor<Device, 2, DType>(dst.dptr_, Shape2(1, dst.shape_.Size()), dst.stream_);
+  return true;
+}
+/*!
+ * \brief engine of expressions that have a faster implementation than the
+ *  elementwise plan when they are the whole right hand side of an assignment,
+ *  such as transpose of a tensor. Map returns false to fall back to the plan.
+ */
+template<typename SV, typename RV, typename E, typename DType>
+struct MapExpDirectEngine {
+  inline static bool Map(RV *dst, const E &exp) {
+    return false;
+  }
+};
 }  // namespace expr
 
 }  // namespace mshadow
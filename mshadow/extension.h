@@ -8,6 +8,7 @@
 #ifndef MSHADOW_EXTENSION_H_
 #define MSHADOW_EXTENSION_H_
 #include "./expr_engine-inl.h"
+#include "./extension/materialize.h"
 #include "./extension/broadcast.h"
 #include "./extension/unpack_patch2col.h"
 #include "./extension/pack_col2patch.h"
@@ -38,4 +39,7 @@
 #include "./extension/complex.h"
 #include "./extension/range.h"
 #include "./extension/mask.h"
+#include "./extension/quantize.h"
+#include "./extension/multi_assign.h"
+#include "./extension/augment.h"
 #endif  // MSHADOW_EXTENSION_H_
@@ -0,0 +1,147 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file augment.h
+ * \brief fused data augmentation of image batches: per sample crop with padding,
+ *  horizontal flip, the change of layout from NHWC to NCHW, and the normalization
+ *  of each channel, from compact integer images to DType in one pass
+ */
+#ifndef MSHADOW_EXTENSION_AUGMENT_H_
+#define MSHADOW_EXTENSION_AUGMENT_H_
+#include "../extension.h"
+
+namespace mshadow {
+namespace expr {
+/*! \brief most channels augment normalizes, the constants are kept in the plan */
+const int kAugmentMaxChannel = 4;
+/*!
+ * \brief normalization of augment, out = (in - mean[c]) * scale[c],
+ *  the pixels outside the source image are pad_value
+ */
+struct AugmentNorm {
+  /*! \brief mean of each channel */
+  float mean[kAugmentMaxChannel];
+  /*! \brief scale of each channel, 1 / std */
+  float scale[kAugmentMaxChannel];
+  /*! \brief value of the padding, after normalization */
+  float pad_value;
+  /*! \brief the same mean and scale for all channels */
+  explicit AugmentNorm(float mean_all = 0.0f, float scale_all = 1.0f, float pad = 0.0f)
+      : pad_value(pad) {
+    for (int c = 0; c < kAugmentMaxChannel; ++c) {
+      mean[c] = mean_all; scale[c] = scale_all;
+    }
+  }
+  /*! \brief set the mean and the standard deviation of channel c */
+  inline AugmentNorm &Set(int c, float mean_c, float std_c) {
+    CHECK(c >= 0 && c < kAugmentMaxChannel) << "AugmentNorm: invalid channel " << c;
+    mean[c] = mean_c; scale[c] = 1.0f / std_c;
+    return *this;
+  }
+};
+/*!
+ * \brief fused augmentation expression, see augment
+ * \tparam SrcExp source images, NHWC
+ * \tparam ParamExp parameters of each sample
+ * \tparam SrcDType type of the source, e.g. uint8_t
+ * \tparam IType type of the parameters
+ * \tparam DType type of the result
+ */
+template<typename SrcExp, typename ParamExp, typename SrcDType, typename IType, typename DType>
+struct AugmentExp:
+      public MakeTensorExp<AugmentExp<SrcExp, ParamExp, SrcDType, IType, DType>,
+                           SrcExp, 4, DType> {
+  /*! \brief source images */
+  const SrcExp &src_;
+  /*! \brief parameters of each sample */
+  const ParamExp &param_;
+  /*! \brief normalization */
+  AugmentNorm norm_;
+  /*! \brief height and width of the source */
+  index_t src_height_, src_width_;
+  /*! \brief constructor */
+  AugmentExp(const SrcExp &src, const ParamExp &param,
+             const AugmentNorm &norm, Shape<2> oshape)
+      : src_(src), param_(param), norm_(norm) {
+    const Shape<4> sshape = ShapeCheck<4, SrcExp>::Check(src_);
+    const Shape<2> pshape = ShapeCheck<2, ParamExp>::Check(param_);
+    CHECK_EQ(pshape[0], sshape[0]) << "augment: expect one row of parameters per sample";
+    CHECK_EQ(pshape[1], 3U) << "augment: the parameters of a sample are (y, x, flip)";
+    CHECK_LE(sshape[3], static_cast<index_t>(kAugmentMaxChannel))
+        << "augment: at most " << kAugmentMaxChannel << " channels";
+    src_height_ = sshape[1];
+    src_width_ = sshape[2];
+    this->shape_ = Shape4(sshape[0], sshape[3], oshape[0], oshape[1]);
+  }
+};
+/*!
+ * \brief augment a batch of images in one pass, the result is NCHW:
+ *   out[n][c][y][x] = (src[n][y0 + y][x1][c] - mean[c]) * scale[c],
+ *   with (y0, x0, flip) = param[n], x1 = flip ? x0 + width - 1 - x : x0 + x,
+ *   and pad_value where (y0 + y, x1) is outside the source image.
+ *   A random crop takes y0, x0 in [0, H - height] and [0, W - width], offsets out of
+ *   these ranges pad the crop, so crop, pad and mirror are one expression.
+ *   On gpu the images can stay compact uint8 up to the device, a quarter of the bytes
+ *   of float, the transfer through a pinned buffer is then the only step on the host:
+ * \code
+ *  Tensor<cpu, 4, uint8_t> host(Shape4(n, h, w, 3));
+ *  AllocHost<gpu>(&host);
+ *  // decode into host, fill host_param with the random (y0, x0, flip) of each sample
+ *  Copy(images, host, stream);
+ *  Copy(param, host_param, stream);
+ *  data = augment<float>(images, param, AugmentNorm().Set(0, 123.7f, 58.4f)
+ *                        .Set(1, 116.3f, 57.1f).Set(2, 103.5f, 57.4f), Shape2(224, 224));
+ * \endcode
+ * \param src source images, NHWC, e.g. uint8_t
+ * \param param (y0, x0, flip) of each sample, shape (N, 3), of an integer type
+ * \param norm normalization of the channels and value of the padding
+ * \param oshape height and width of the result
+ * \tparam DType type of the result
+ */
+template<typename DType, typename SrcExp, typename SrcDType, int etype,
+         typename ParamExp, typename IType, int ptype>
+inline AugmentExp<SrcExp, ParamExp, SrcDType, IType, DType>
+augment(const Exp<SrcExp, SrcDType, etype> &src, const Exp<ParamExp, IType, ptype> &param,
+        const AugmentNorm &norm, Shape<2> oshape) {
+  TypeCheckPass<ExpInfo<SrcExp>::kDim == 4 && ExpInfo<ParamExp>::kDim == 2>
+      ::Error_Expression_Does_Not_Meet_Dimension_Req();
+  TypeCheckPass<(ExpInfo<SrcExp>::kDevMask & ExpInfo<ParamExp>::kDevMask) != 0>
+      ::Error_All_Tensor_in_Exp_Must_Have_Same_Type();
+  return AugmentExp<SrcExp, ParamExp, SrcDType, IType, DType>(src.self(), param.self(),
+                                                                norm, oshape);
+}
+//----------------------
+// Execution plan
+//----------------------
+template<typename SrcExp, typename ParamExp, typename SrcDType, typename IType, typename DType>
+struct Plan<AugmentExp<SrcExp, ParamExp, SrcDType, IType, DType>, DType> {
+ public:
+  explicit Plan(const AugmentExp<SrcExp, ParamExp, SrcDType, IType, DType> &e)
+      : src_(MakePlan(e.src_)), param_(MakePlan(e.param_)), norm_(e.norm_),
+        nchannel_(e.shape_[1]), height_(e.shape_[2]), width_(e.shape_[3]),
+        src_height_(e.src_height_), src_width_(e.src_width_) {}
+  MSHADOW_XINLINE DType Eval(index_t i, index_t j) const {
+    const index_t y = i % height_;
+    const index_t c = (i / height_) % nchannel_;
+    const index_t n = i / height_ / nchannel_;
+    const int64_t sy = static_cast<int64_t>(param_.Eval(n, 0)) + y;
+    const int64_t x0 = static_cast<int64_t>(param_.Eval(n, 1));
+    const int64_t sx = param_.Eval(n, 2) != IType(0) ?
+        x0 + static_cast<int64_t>(width_ - 1 - j) : x0 + j;
+    if (sy < 0 || sy >= static_cast<int64_t>(src_height_) ||
+        sx < 0 || sx >= static_cast<int64_t>(src_width_)) {
+      return DType(norm_.pad_value);
+    }
+    const index_t row = (n * src_height_ + static_cast<index_t>(sy)) * src_width_ +
+        static_cast<index_t>(sx);
+    return DType((static_cast<float>(src_.Eval(row, c)) - norm_.mean[c]) * norm_.scale[c]);
+  }
+
+ private:
+  Plan<SrcExp, SrcDType> src_;
+  Plan<ParamExp, IType> param_;
+  const AugmentNorm norm_;
+  const index_t nchannel_, height_, width_, src_height_, src_width_;
+};
+}  // namespace expr
+}  // namespace mshadow
+#endif  // MSHADOW_EXTENSION_AUGMENT_H_
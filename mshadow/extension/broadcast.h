@@ -7,6 +7,8 @@
 #ifndef MSHADOW_EXTENSION_BROADCAST_H_
 #define MSHADOW_EXTENSION_BROADCAST_H_
 #include "../extension.h"
+#include "./materialize.h"
+#include "../packet-inl.h"
 namespace mshadow {
 namespace expr {
 /*!
@@ -160,6 +162,82 @@ struct Plan<BroadcastScalarExp<SrcExp, DType, dimdst>, DType>{
  private:
   expr::Plan<SrcExp, DType> src_;
 };
+//----------------------
+// Packet plan of broadcasting a cpu tensor, used by bias layers such as
+// x += repmat(bias, n) or x += broadcast<1>(bias, x.shape_)
+//----------------------
+/*! \brief the source index only depends on the row, one element is repeated */
+template<typename DType, int dimdst, int dimdst_m_cast, PacketArch Arch>
+class PacketPlan<Broadcast1DExp<Tensor<cpu, 1, DType>, DType, dimdst, dimdst_m_cast>,
+                 DType, Arch> {
+ public:
+  static const int dimcast = dimdst - dimdst_m_cast;
+  explicit PacketPlan(const Broadcast1DExp<Tensor<cpu, 1, DType>, DType,
+                                           dimdst, dimdst_m_cast> &e)
+      : dptr_(e.src_.dptr_),
+        ystride_(e.shape_.ProdShape(dimcast + 1, dimdst - 1)),
+        length_(e.shape_[dimcast]) {}
+  MSHADOW_CINLINE packet::Packet<DType, Arch> EvalPacket(index_t y, index_t x) const {
+    return packet::Packet<DType, Arch>::Fill(Eval(y, x));
+  }
+  MSHADOW_CINLINE DType Eval(index_t y, index_t x) const {
+    return dptr_[(y / ystride_) % length_];
+  }
+
+ private:
+  const DType *dptr_;
+  const index_t ystride_, length_;
+};
+/*! \brief every row of the result is the source */
+template<typename DType, int dimdst, PacketArch Arch>
+class PacketPlan<Broadcast1DExp<Tensor<cpu, 1, DType>, DType, dimdst, 1>, DType, Arch> {
+ public:
+  explicit PacketPlan(const Broadcast1DExp<Tensor<cpu, 1, DType>, DType, dimdst, 1> &e)
+      : dptr_(e.src_.dptr_) {}
+  MSHADOW_CINLINE packet::Packet<DType, Arch> EvalPacket(index_t y, index_t x) const {
+    return packet::Packet<DType, Arch>::Load(dptr_ + x);
+  }
+  MSHADOW_CINLINE DType Eval(index_t y, index_t x) const {
+    return dptr_[x];
+  }
+
+ private:
+  const DType *dptr_;
+};
+template<typename DType, int dimdst, int dimdst_m_cast, PacketArch Arch>
+struct PacketCheck<Broadcast1DExp<Tensor<cpu, 1, DType>, DType, dimdst, dimdst_m_cast>, Arch> {
+  static const bool kPass = PacketCheck<DType, Arch>::kPass;
+};
+template<int dim, typename DType, int dimdst, int dimdst_m_cast, PacketArch Arch>
+struct PacketAlignCheck<dim, Broadcast1DExp<Tensor<cpu, 1, DType>, DType,
+                                            dimdst, dimdst_m_cast>, Arch> {
+  inline static bool Check(const Broadcast1DExp<Tensor<cpu, 1, DType>, DType,
+                                                dimdst, dimdst_m_cast> &e) {
+    return dimdst_m_cast != 1 || packet::CheckAlign<Arch>(e.src_.dptr_);
+  }
+};
+/*!
+ * \brief each element of the source is read once per row of the result,
+ *  so an expensive source expression is evaluated into a temporary first
+ */
+template<typename SV, typename Device, typename SrcExp, typename DType,
+         int dimdst, int dimdst_m_cast>
+struct MapExpDirectEngine<SV, Tensor<Device, dimdst, DType>,
+                          MakeTensorExp<Broadcast1DExp<SrcExp, DType, dimdst, dimdst_m_cast>,
+                                        SrcExp, dimdst, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, dimdst, DType> *dst,
+                         const MakeTensorExp<Broadcast1DExp<SrcExp, DType,
+                                                            dimdst, dimdst_m_cast>,
+                                             SrcExp, dimdst, DType> &exp) {
+    if (!ExpCost<SrcExp>::kMaterialize) return false;
+    const Broadcast1DExp<SrcExp, DType, dimdst, dimdst_m_cast> &e = exp.real_self();
+    MaterializedTensor<Device, 1, DType> src(e.src_, dst->stream_);
+    MapExp<SV>(dst, Broadcast1DExp<Tensor<Device, 1, DType>, DType, dimdst, dimdst_m_cast>
+               (src.data, e.shape_));
+    return true;
+  }
+};
 }  // namespace expr
 }  // namespace mshadow
 #endif  // MSHADOW_EXTENSION_BROADCAST_H_
@@ -7,8 +7,10 @@
 #ifndef MSHADOW_EXTENSION_BROADCAST_WITH_AXIS_H_
 #define MSHADOW_EXTENSION_BROADCAST_WITH_AXIS_H_
 
+#include <type_traits>
 #include <vector>
 #include "../extension.h"
+#include "../packet-inl.h"
 
 namespace mshadow {
 namespace expr {
@@ -210,6 +212,106 @@ broadcast_to(const Exp<SrcExp, DType, etype> &src, const TShape &target_shape) {
   return BroadcastWithMultiAxesExp<SrcExp, DType, ExpInfo<SrcExp>::kDim>(src.self(), axes, sizes);
 }
 
+/*!
+ * \brief unsigned division by a divisor fixed at construction, done with a multiply
+ *  high and two shifts (Granlund and Montgomery), so that the index math of a
+ *  broadcast costs a few instructions instead of a hardware division
+ */
+struct IndexDivisor {
+  /*! \brief the divisor */
+  index_t d_;
+  /*! \brief the magic multiplier */
+  index_t m_;
+  /*! \brief the two shifts */
+  int s1_, s2_;
+  explicit IndexDivisor(index_t d = 1) : d_(d == 0 ? 1 : d) {
+    int l = 0;
+    while (l < 32 && (static_cast<uint64_t>(1) << l) < d_) ++l;
+    m_ = static_cast<index_t>((static_cast<uint64_t>(1) << 32) *
+                              ((static_cast<uint64_t>(1) << l) - d_) / d_ + 1);
+    s1_ = l < 1 ? l : 1;
+    s2_ = l > 1 ? l - 1 : 0;
+  }
+  MSHADOW_XINLINE index_t Div(index_t n) const {
+    const index_t t = static_cast<index_t>((static_cast<uint64_t>(m_) * n) >> 32);
+    return (t + ((n - t) >> s1_)) >> s2_;
+  }
+  MSHADOW_XINLINE index_t Mod(index_t n) const {
+    return n - Div(n) * d_;
+  }
+};
+/*!
+ * \brief maps a row of the result of broadcast_with_axis, flattened to 2D, to the source.
+ *  When the broadcasting axis is not the last one, a row of the result is a row of the
+ *  source; otherwise, the row is one element of the source repeated.
+ */
+struct BroadcastAxisIndex {
+  /*! \brief whether a row of the result is a row of the source */
+  bool keep_row_;
+  /*! \brief rows of the source covered by the trailing dimensions */
+  IndexDivisor nrow_;
+  /*! \brief rows of the result covered by the broadcasting axis and trailing dimensions */
+  IndexDivisor rsize_;
+  /*! \brief size of the last dimension of src */
+  IndexDivisor last_;
+  BroadcastAxisIndex(index_t dst_last, index_t trailing, index_t size, index_t last)
+      : keep_row_(last != 0 && dst_last == last && trailing % last == 0),
+        nrow_(keep_row_ ? trailing / last : 1), rsize_(nrow_.d_ * size), last_(last) {}
+  /*!
+   * \brief the source row of result row y when keep_row_,
+   *  otherwise the flat index of the source element
+   */
+  MSHADOW_XINLINE index_t Row(index_t y) const {
+    return keep_row_ ? rsize_.Div(y) * nrow_.d_ + nrow_.Mod(y) : y;
+  }
+};
+/*!
+ * \brief maps a row of the result of broadcast_to, flattened to 2D, to the source,
+ *  same as BroadcastAxisIndex but over several broadcasting axes
+ */
+template<int dimsrc>
+struct BroadcastMultiAxesIndex {
+  /*! \brief whether a row of the result is a row of the source */
+  bool keep_row_;
+  /*! \brief rows of the result after each broadcasting axis, 1 for the unused ones */
+  IndexDivisor trailings_[dimsrc];
+  /*! \brief rows of the result from each broadcasting axis */
+  IndexDivisor rsizes_[dimsrc];
+  /*! \brief size of the last dimension of src */
+  IndexDivisor last_;
+  BroadcastMultiAxesIndex(index_t dst_last, index_t last, index_t axesnum,
+                          const Shape<dimsrc> &trailings, const Shape<dimsrc> &sizes)
+      : keep_row_(dst_last == last), last_(last) {
+    // otherwise the last dimension is the last broadcasting axis, and src has size 1 in it
+    const index_t naxes = keep_row_ || axesnum == 0 ? axesnum : axesnum - 1;
+    for (int i = 0; i < dimsrc; ++i) {
+      if (static_cast<index_t>(i) < naxes && dst_last != 0) {
+        trailings_[i] = IndexDivisor(trailings[i] / dst_last);
+        rsizes_[i] = IndexDivisor(trailings[i] / dst_last * sizes[i]);
+      }
+    }
+  }
+  /*!
+   * \brief the source row of result row y, it is also the flat index when !keep_row_;
+   *  the steps are unrolled at compile time, so that they are hoisted out of
+   *  the loops over a row
+   */
+  MSHADOW_XINLINE index_t Row(index_t y) const {
+    return Step<0>(y, std::integral_constant<bool, 0 < dimsrc>());
+  }
+
+ private:
+  template<int p>
+  MSHADOW_XINLINE index_t Step(index_t y, std::true_type) const {
+    return Step<p + 1>(rsizes_[p].Div(y) * trailings_[p].d_ + trailings_[p].Mod(y),
+                       std::integral_constant<bool, p + 1 < dimsrc>());
+  }
+  template<int p>
+  MSHADOW_XINLINE index_t Step(index_t y, std::false_type) const {
+    return y;
+  }
+};
+
 //----------------------
 // Execution plan
 //----------------------
@@ -217,41 +319,115 @@ template<typename SrcExp, typename DType, int dimsrc, int dimdst>
 struct Plan<BroadcastWithAxisExp<SrcExp, DType, dimsrc, dimdst>, DType> {
  public:
   explicit Plan(const BroadcastWithAxisExp<SrcExp, DType, dimsrc, dimdst> &e)
-       : src_(MakePlan(e.src_)), dst_last_(e.dst_last_),
-         trailing_(e.trailing_), size_(e.size_), last_(e.last_) {}
+       : src_(MakePlan(e.src_)),
+         index_(e.dst_last_, e.trailing_, e.size_, e.last_) {}
   MSHADOW_XINLINE DType Eval(index_t i, index_t j) const {
-    index_t x = (i * dst_last_ + j) / trailing_ / size_;
-    index_t y = (i * dst_last_ + j) % trailing_;
-    index_t z = x * trailing_ + y;
-    return src_.Eval(z / last_, z % last_);
+    const index_t r = index_.Row(i);
+    if (index_.keep_row_) return src_.Eval(r, j);
+    return src_.Eval(index_.last_.Div(r), index_.last_.Mod(r));
   }
 
  private:
   Plan<SrcExp, DType> src_;
-  const index_t dst_last_, trailing_, size_, last_;
+  const BroadcastAxisIndex index_;
 };
 
 template<typename SrcExp, typename DType, int dimsrc>
 struct Plan<BroadcastWithMultiAxesExp<SrcExp, DType, dimsrc>, DType> {
  public:
   explicit Plan(const BroadcastWithMultiAxesExp<SrcExp, DType, dimsrc> &e)
-    : src_(MakePlan(e.src_)), dst_last_(e.dst_last_), last_(e.last_), axesnum_(e.axesnum_),
-    trailings_(e.trailings_), sizes_(e.sizes_) {}
+    : src_(MakePlan(e.src_)),
+      index_(e.dst_last_, e.last_, e.axesnum_, e.trailings_, e.sizes_) {}
   MSHADOW_XINLINE DType Eval(index_t i, index_t j) const {
-    index_t indx = i * dst_last_ + j;
-    for (index_t p = 0; p < dimsrc; ++p) {
-      if (p >= axesnum_) {
-        break;
-      }
-      indx = (indx / trailings_[p] / sizes_[p]) * trailings_[p] + (indx % trailings_[p]);
-    }
-    return src_.Eval(indx / last_, indx % last_);
+    const index_t r = index_.Row(i);
+    if (index_.keep_row_) return src_.Eval(r, j);
+    return src_.Eval(index_.last_.Div(r), index_.last_.Mod(r));
   }
 
  private:
   Plan<SrcExp, DType> src_;
-  const index_t dst_last_, last_, axesnum_;
-  const Shape<dimsrc> trailings_, sizes_;
+  const BroadcastMultiAxesIndex<dimsrc> index_;
+};
+
+//----------------------
+// Packet plan of broadcasting a cpu tensor, such as the bias of x + broadcast_with_axis(bias)
+//----------------------
+/*!
+ * \brief a packet of a row of the source, or one source element repeated,
+ *  the source index only depends on the row and is computed once per packet
+ */
+template<int dimsrc, typename DType, typename Index, PacketArch Arch>
+class BroadcastPacketPlan {
+ public:
+  BroadcastPacketPlan(const Tensor<cpu, dimsrc, DType> &src, const Index &index)
+      : src_(src), index_(index) {}
+  MSHADOW_CINLINE packet::Packet<DType, Arch> EvalPacket(index_t y, index_t x) const {
+    const index_t r = index_.Row(y);
+    if (index_.keep_row_) return src_.EvalPacket(r, x);
+    return packet::Packet<DType, Arch>::Fill(src_.Eval(index_.last_.Div(r), index_.last_.Mod(r)));
+  }
+  MSHADOW_CINLINE DType Eval(index_t y, index_t x) const {
+    const index_t r = index_.Row(y);
+    if (index_.keep_row_) return src_.Eval(r, x);
+    return src_.Eval(index_.last_.Div(r), index_.last_.Mod(r));
+  }
+
+ private:
+  PacketPlan<Tensor<cpu, dimsrc, DType>, DType, Arch> src_;
+  const Index index_;
+};
+
+template<typename DType, int dimsrc, int dimdst, PacketArch Arch>
+class PacketPlan<BroadcastWithAxisExp<Tensor<cpu, dimsrc, DType>, DType, dimsrc, dimdst>,
+                 DType, Arch>
+    : public BroadcastPacketPlan<dimsrc, DType, BroadcastAxisIndex, Arch> {
+ public:
+  explicit PacketPlan(const BroadcastWithAxisExp<Tensor<cpu, dimsrc, DType>,
+                                                 DType, dimsrc, dimdst> &e)
+      : BroadcastPacketPlan<dimsrc, DType, BroadcastAxisIndex, Arch>(
+          e.src_, BroadcastAxisIndex(e.dst_last_, e.trailing_, e.size_, e.last_)) {}
+};
+
+template<typename DType, int dimsrc, PacketArch Arch>
+class PacketPlan<BroadcastWithMultiAxesExp<Tensor<cpu, dimsrc, DType>, DType, dimsrc>,
+                 DType, Arch>
+    : public BroadcastPacketPlan<dimsrc, DType, BroadcastMultiAxesIndex<dimsrc>, Arch> {
+ public:
+  explicit PacketPlan(const BroadcastWithMultiAxesExp<Tensor<cpu, dimsrc, DType>,
+                                                      DType, dimsrc> &e)
+      : BroadcastPacketPlan<dimsrc, DType, BroadcastMultiAxesIndex<dimsrc>, Arch>(
+          e.src_, BroadcastMultiAxesIndex<dimsrc>(e.dst_last_, e.last_, e.axesnum_,
+                                                  e.trailings_, e.sizes_)) {}
+};
+
+template<typename DType, int dimsrc, int dimdst, PacketArch Arch>
+struct PacketCheck<BroadcastWithAxisExp<Tensor<cpu, dimsrc, DType>, DType, dimsrc, dimdst>,
+                   Arch> {
+  static const bool kPass = PacketCheck<DType, Arch>::kPass;
+};
+template<typename DType, int dimsrc, PacketArch Arch>
+struct PacketCheck<BroadcastWithMultiAxesExp<Tensor<cpu, dimsrc, DType>, DType, dimsrc>,
+                   Arch> {
+  static const bool kPass = PacketCheck<DType, Arch>::kPass;
+};
+// the source is only loaded in packets when a row of the result is a row of the source
+template<int dim, typename DType, int dimsrc, int dimdst, PacketArch Arch>
+struct PacketAlignCheck<dim, BroadcastWithAxisExp<Tensor<cpu, dimsrc, DType>,
+                                                  DType, dimsrc, dimdst>, Arch> {
+  inline static bool Check(const BroadcastWithAxisExp<Tensor<cpu, dimsrc, DType>,
+                                                      DType, dimsrc, dimdst> &e) {
+    return !BroadcastAxisIndex(e.dst_last_, e.trailing_, e.size_, e.last_).keep_row_ ||
+        PacketAlignCheck<dimsrc, Tensor<cpu, dimsrc, DType>, Arch>::Check(e.src_);
+  }
+};
+template<int dim, typename DType, int dimsrc, PacketArch Arch>
+struct PacketAlignCheck<dim, BroadcastWithMultiAxesExp<Tensor<cpu, dimsrc, DType>,
+                                                       DType, dimsrc>, Arch> {
+  inline static bool Check(const BroadcastWithMultiAxesExp<Tensor<cpu, dimsrc, DType>,
+                                                           DType, dimsrc> &e) {
+    return e.dst_last_ != e.last_ ||
+        PacketAlignCheck<dimsrc, Tensor<cpu, dimsrc, DType>, Arch>::Check(e.src_);
+  }
 };
 }  // namespace expr
 }  // namespace mshadow
@@ -7,6 +7,7 @@
 #ifndef MSHADOW_EXTENSION_CHANNEL_POOL_H_
 #define MSHADOW_EXTENSION_CHANNEL_POOL_H_
 #include <algorithm>
+#include <vector>
 #include "../extension.h"
 namespace mshadow {
 namespace expr {
@@ -90,7 +91,7 @@ struct Plan<ChannelPoolingExp<Reducer, SrcExp, DType, srcdim>, DType> {
     const index_t n = i / channel_;
     const index_t x = j;
     const index_t cstart = c * stride_ < pad_ ? 0  : c * stride_ - pad_;
-    const index_t cend   = min(cstart + hnsize_, channel_);
+    const index_t cend   = min(cstart + hnsize_, src_channel_);
     DType res; Reducer::SetInitValue(res);
     for (index_t cc = cstart; cc < cend; ++cc) {
       Reducer::Reduce(res, src_.Eval((n * src_channel_ + cc) * height_ + y, x));
@@ -102,6 +103,172 @@ struct Plan<ChannelPoolingExp<Reducer, SrcExp, DType, srcdim>, DType> {
   Plan<SrcExp, DType> src_;
   const index_t channel_, height_, width_, hnsize_, stride_, pad_, src_channel_;
 };
+/*! \brief how the direct engine reduces the channel windows of a reducer */
+enum ChannelWindowKind {
+  /*! \brief unknown reducer, evaluated through the Plan */
+  kChannelWindowNone,
+  /*! \brief running sum, the entering channel is added and the leaving one subtracted */
+  kChannelWindowSum,
+  /*! \brief selection such as max or min, the channels are not invertible */
+  kChannelWindowSelect
+};
+/*! \brief channel window kind of Reducer */
+template<typename Reducer>
+struct ChannelWindow {
+  static const int kKind = kChannelWindowNone;
+};
+template<>
+struct ChannelWindow<red::sum> {
+  static const int kKind = kChannelWindowSum;
+};
+template<>
+struct ChannelWindow<red::maximum> {
+  static const int kKind = kChannelWindowSelect;
+};
+template<>
+struct ChannelWindow<red::minimum> {
+  static const int kKind = kChannelWindowSelect;
+};
+/*! \brief view of a tensor as (batch, channel, height, width), leading dimensions folded */
+template<typename Device, int dim, typename DType>
+inline Tensor<Device, 4, DType> ChannelPlanes(const Tensor<Device, dim, DType> &t) {
+  return Tensor<Device, 4, DType>(t.dptr_, Shape4(t.shape_.ProdShape(0, dim - 3),
+                                                  t.size(dim - 3), t.size(dim - 2),
+                                                  t.size(dim - 1)),
+                                  t.stride_, t.stream_);
+}
+/*!
+ * \brief first source channel of the window of output channel c, *end is set past the
+ *  last one; the bounds are those of the Plan, cut at the limit source channels
+ */
+MSHADOW_XINLINE index_t ChannelPoolBegin(index_t c, index_t nsize, index_t stride,
+                                         index_t pad, index_t limit, index_t *end) {
+  const index_t begin = c * stride < pad ? 0 : c * stride - pad;
+  *end = begin + nsize < limit ? begin + nsize : limit;
+  return begin;
+}
+/*!
+ * \brief CPU: chpool of the planes of src into dst, saved with SV.
+ *  Each (batch, row) pair walks the channels once with a row of width elements at a time:
+ *  sums keep a running row sum, selections use van Herk blocks of nsize channels whose
+ *  forward and backward partial reductions answer any window with a single reduce.
+ * \param dst pooled result, shape (batch, pchannel, height, width)
+ * \param src source, shape (batch, channel, height, width)
+ */
+template<typename SV, typename Reducer, typename DType>
+inline void ChannelPool(Tensor<cpu, 4, DType> dst, const Tensor<cpu, 4, DType> &src,
+                        index_t nsize, index_t stride, index_t pad) {
+  typedef typename AccType<DType>::type AType;
+  const bool run_sum = ChannelWindow<Reducer>::kKind == kChannelWindowSum;
+  const index_t nchannel = dst.size(1), height = dst.size(2), width = dst.size(3);
+  const index_t limit = src.size(1);
+  const index_t nrow = dst.size(0) * height;
+  if (nrow == 0 || width == 0) return;
+  // channels of the van Herk blocks, those past limit hold the initial value
+  const index_t nblock = run_sum ? 0 : (limit + nsize - 1) / nsize * nsize;
+  const index_t spitch = height * src.stride_, dpitch = height * dst.stride_;
+  DType init; Reducer::SetInitValue(init);
+#ifdef _OPENMP
+  const int nthread = GetNumParallelThread(dst.stream_, dst.shape_.Size());
+#endif
+  #pragma omp parallel num_threads(nthread) if (nthread > 1)
+  {
+    std::vector<AType> acc(run_sum ? width : 0);
+    std::vector<DType> fwd(nblock * width), bwd(nblock * width);
+    #pragma omp for schedule(static)
+    for (openmp_index_t r = 0; r < nrow; ++r) {
+      const index_t n = r / height, y = r % height;
+      const DType *splane = src.dptr_ + (n * src.size(1) * height + y) * src.stride_;
+      DType *dplane = dst.dptr_ + (n * nchannel * height + y) * dst.stride_;
+      if (!run_sum) {
+        for (index_t k = 0; k < nblock; ++k) {
+          DType *f = &fwd[k * width];
+          if (k < limit) {
+            std::copy(splane + k * spitch, splane + k * spitch + width, f);
+          } else {
+            std::fill(f, f + width, init);
+          }
+          std::copy(f, f + width, &bwd[k * width]);
+          if (k % nsize != 0) {
+            const DType *fprev = f - width;
+            for (index_t x = 0; x < width; ++x) Reducer::Reduce(f[x], fprev[x]);
+          }
+        }
+        for (index_t k = nblock; k-- > 0;) {
+          if (k % nsize == nsize - 1) continue;
+          DType *b = &bwd[k * width];
+          const DType *bnext = b + width;
+          for (index_t x = 0; x < width; ++x) Reducer::Reduce(b[x], bnext[x]);
+        }
+      }
+      index_t lo = 0, hi = 0;
+      for (index_t c = 0; c < nchannel; ++c) {
+        index_t end;
+        const index_t begin = ChannelPoolBegin(c, nsize, stride, pad, limit, &end);
+        DType *drow = dplane + c * dpitch;
+        if (begin >= end) {
+          for (index_t x = 0; x < width; ++x) SV::template Save<DType>(drow[x], init);
+        } else if (run_sum) {
+          if (begin >= hi) {
+            std::fill(acc.begin(), acc.end(), AType(0));
+            lo = hi = begin;
+          }
+          for (; hi < end; ++hi) {
+            const DType *srow = splane + hi * spitch;
+            for (index_t x = 0; x < width; ++x) acc[x] += AType(srow[x]);
+          }
+          for (; lo < begin; ++lo) {
+            const DType *srow = splane + lo * spitch;
+            for (index_t x = 0; x < width; ++x) acc[x] -= AType(srow[x]);
+          }
+          for (index_t x = 0; x < width; ++x) {
+            SV::template Save<DType>(drow[x], DType(acc[x]));
+          }
+        } else if (begin / nsize == (end - 1) / nsize) {
+          // the rest of the block lies past limit
+          const DType *b = &bwd[begin * width];
+          for (index_t x = 0; x < width; ++x) SV::template Save<DType>(drow[x], b[x]);
+        } else {
+          const DType *b = &bwd[begin * width], *f = &fwd[(end - 1) * width];
+          for (index_t x = 0; x < width; ++x) {
+            DType res = b[x];
+            Reducer::Reduce(res, f[x]);
+            SV::template Save<DType>(drow[x], res);
+          }
+        }
+      }
+    }
+  }
+}
+/*!
+ * \brief GPU: chpool of the planes of src into dst, a thread per pixel walks the channels,
+ *  defined in cuda/tensor_gpu-inl.cuh
+ */
+template<typename SV, typename Reducer, typename DType>
+inline void ChannelPool(Tensor<gpu, 4, DType> dst, const Tensor<gpu, 4, DType> &src,
+                        index_t nsize, index_t stride, index_t pad);
+/*! \brief channel pooling of a plain tensor by sum, max or min goes through the engine */
+template<typename SV, typename Reducer, typename Device, typename DType, int srcdim>
+struct MapExpDirectEngine<SV, Tensor<Device, srcdim, DType>,
+                          MakeTensorExp<ChannelPoolingExp<Reducer,
+                                                          Tensor<Device, srcdim, DType>,
+                                                          DType, srcdim>,
+                                        Tensor<Device, srcdim, DType>, srcdim, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, srcdim, DType> *dst,
+                         const MakeTensorExp<ChannelPoolingExp<Reducer,
+                                                               Tensor<Device, srcdim, DType>,
+                                                               DType, srcdim>,
+                                             Tensor<Device, srcdim, DType>,
+                                             srcdim, DType> &exp) {
+    if (ChannelWindow<Reducer>::kKind == kChannelWindowNone) return false;
+    const ChannelPoolingExp<Reducer, Tensor<Device, srcdim, DType>, DType, srcdim> &e =
+        exp.real_self();
+    ChannelPool<SV, Reducer>(ChannelPlanes(*dst), ChannelPlanes(e.src_),
+                             e.nsize_, e.stride_, e.pad_);
+    return true;
+  }
+};
 }  // namespace expr
 }  // namespace mshadow
 #endif  // MSHADOW_EXTENSION_CHANNEL_POOL_H_
@@ -7,7 +7,9 @@
 #ifndef MSHADOW_EXTENSION_CHANNEL_UNPOOL_H_
 #define MSHADOW_EXTENSION_CHANNEL_UNPOOL_H_
 #include <algorithm>
+#include <vector>
 #include "../extension.h"
+#include "./channel_pool.h"
 namespace mshadow {
 namespace expr {
 /*!
@@ -92,7 +94,7 @@ inline ChannelUnpoolingExp<Reducer, SrcExp, DType, ExpInfo<SrcExp>::kDim>
 ch_unpool(const Exp<SrcExp, DType, etype> &data_src,
        const Exp<SrcExp, DType, etype> &data_pooled,
        const Exp<SrcExp, DType, etype> &grad_pooled, index_t nsize) {
-  return ch_unpool(data_src, data_pooled, grad_pooled, nsize, 1, nsize / 2);
+  return ch_unpool<Reducer>(data_src, data_pooled, grad_pooled, nsize, 1, nsize / 2);
 }
 
 
@@ -103,8 +105,8 @@ template<typename Reducer, typename SrcExp, typename DType, int srcdim>
 struct Plan<ChannelUnpoolingExp<Reducer, SrcExp, DType, srcdim>, DType> {
  public:
   explicit Plan(const ChannelUnpoolingExp<Reducer, SrcExp, DType, srcdim> &e)
-      : data_src_(e.data_src_), data_pooled_(e.data_pooled_),
-        grad_pooled_(e.grad_pooled_), channel_(e.shape_[srcdim - 3]),
+      : data_src_(MakePlan(e.data_src_)), data_pooled_(MakePlan(e.data_pooled_)),
+        grad_pooled_(MakePlan(e.grad_pooled_)), channel_(e.shape_[srcdim - 3]),
         height_(e.shape_[srcdim - 2]), pchannel_(e.pchannel_),
         hnsize_(e.nsize_), stride_(e.kstride_), pad_(e.pad_) {}
   MSHADOW_XINLINE DType Eval(index_t i, index_t j) const {
@@ -117,7 +119,7 @@ struct Plan<ChannelUnpoolingExp<Reducer, SrcExp, DType, srcdim>, DType> {
     const index_t x = j;
     const index_t cstart = c < hnsize_ - pad_ ? 0
                         : (c - (hnsize_ - pad_) + stride_) / stride_;
-    const index_t cend = min((c + pad_ + stride_) / stride_, channel_);
+    const index_t cend = min((c + pad_ + stride_) / stride_, pchannel_);
     DType val = static_cast<DType>(0);
     for (index_t cc = cstart; cc < cend; ++cc) {
       val += Reducer::PartialGrad(vsrc,
@@ -131,6 +133,120 @@ struct Plan<ChannelUnpoolingExp<Reducer, SrcExp, DType, srcdim>, DType> {
   Plan<SrcExp, DType> data_src_, data_pooled_, grad_pooled_;
   const index_t channel_, height_, pchannel_, hnsize_, stride_, pad_;
 };
+/*!
+ * \brief first pooled channel whose window covers source channel c, *end is set past the
+ *  last one; the bounds are those of the Plan, cut at the limit pooled channels
+ */
+MSHADOW_XINLINE index_t ChannelUnpoolBegin(index_t c, index_t nsize, index_t stride,
+                                           index_t pad, index_t limit, index_t *end) {
+  const index_t last = (c + pad + stride) / stride;
+  *end = last < limit ? last : limit;
+  return c < nsize - pad ? 0 : (c - (nsize - pad) + stride) / stride;
+}
+/*!
+ * \brief CPU: grad_src = ch_unpool<Reducer>(data_src, data_pooled, grad_pooled) on planes.
+ *  Each (batch, row) pair walks the channels with a row of width elements at a time,
+ *  sums keep a running row sum of the pooled gradient over the covering windows.
+ * \param grad_src source gradient, shape (batch, channel, height, width)
+ * \param data_src pooling source
+ * \param data_pooled pooled result, shape (batch, pchannel, height, width)
+ * \param grad_pooled pooled gradient
+ */
+template<typename SV, typename Reducer, typename DType>
+inline void ChannelUnpool(Tensor<cpu, 4, DType> grad_src, const Tensor<cpu, 4, DType> &data_src,
+                          const Tensor<cpu, 4, DType> &data_pooled,
+                          const Tensor<cpu, 4, DType> &grad_pooled,
+                          index_t nsize, index_t stride, index_t pad) {
+  typedef typename AccType<DType>::type AType;
+  const bool run_sum = ChannelWindow<Reducer>::kKind == kChannelWindowSum;
+  const index_t nchannel = grad_src.size(1), height = grad_src.size(2);
+  const index_t width = grad_src.size(3), pchannel = grad_pooled.size(1);
+  const index_t limit = pchannel;
+  const index_t nrow = grad_src.size(0) * height;
+  if (nrow == 0 || width == 0) return;
+  const index_t gpitch = height * grad_src.stride_, spitch = height * data_src.stride_;
+  const index_t ppitch = height * data_pooled.stride_, qpitch = height * grad_pooled.stride_;
+#ifdef _OPENMP
+  const int nthread = GetNumParallelThread(grad_src.stream_, grad_src.shape_.Size());
+#endif
+  #pragma omp parallel num_threads(nthread) if (nthread > 1)
+  {
+    std::vector<AType> acc(width);
+    #pragma omp for schedule(static)
+    for (openmp_index_t r = 0; r < nrow; ++r) {
+      const index_t n = r / height, y = r % height;
+      DType *gplane = grad_src.dptr_ + (n * nchannel * height + y) * grad_src.stride_;
+      const DType *splane = data_src.dptr_ + (n * nchannel * height + y) * data_src.stride_;
+      const DType *pplane =
+          data_pooled.dptr_ + (n * pchannel * height + y) * data_pooled.stride_;
+      const DType *qplane =
+          grad_pooled.dptr_ + (n * pchannel * height + y) * grad_pooled.stride_;
+      index_t lo = 0, hi = 0;
+      for (index_t c = 0; c < nchannel; ++c) {
+        index_t end;
+        const index_t begin = ChannelUnpoolBegin(c, nsize, stride, pad, limit, &end);
+        if (!run_sum || begin >= hi) {
+          std::fill(acc.begin(), acc.end(), AType(0));
+          lo = hi = begin;
+        }
+        if (run_sum) {
+          for (; hi < end; ++hi) {
+            const DType *qrow = qplane + hi * qpitch;
+            for (index_t x = 0; x < width; ++x) acc[x] += AType(qrow[x]);
+          }
+          for (; lo < begin; ++lo) {
+            const DType *qrow = qplane + lo * qpitch;
+            for (index_t x = 0; x < width; ++x) acc[x] -= AType(qrow[x]);
+          }
+        } else {
+          const DType *srow = splane + c * spitch;
+          for (index_t cc = begin; cc < end; ++cc) {
+            const DType *prow = pplane + cc * ppitch, *qrow = qplane + cc * qpitch;
+            for (index_t x = 0; x < width; ++x) {
+              acc[x] += AType(Reducer::PartialGrad(srow[x], prow[x]) * qrow[x]);
+            }
+          }
+        }
+        DType *grow = gplane + c * gpitch;
+        for (index_t x = 0; x < width; ++x) {
+          SV::template Save<DType>(grow[x], DType(acc[x]));
+        }
+      }
+    }
+  }
+}
+/*!
+ * \brief GPU: ch_unpool on planes, a thread per pixel walks the channels,
+ *  defined in cuda/tensor_gpu-inl.cuh
+ */
+template<typename SV, typename Reducer, typename DType>
+inline void ChannelUnpool(Tensor<gpu, 4, DType> grad_src, const Tensor<gpu, 4, DType> &data_src,
+                          const Tensor<gpu, 4, DType> &data_pooled,
+                          const Tensor<gpu, 4, DType> &grad_pooled,
+                          index_t nsize, index_t stride, index_t pad);
+/*! \brief channel unpooling of plain tensors by sum, max or min goes through the engine */
+template<typename SV, typename Reducer, typename Device, typename DType, int srcdim>
+struct MapExpDirectEngine<SV, Tensor<Device, srcdim, DType>,
+                          MakeTensorExp<ChannelUnpoolingExp<Reducer,
+                                                            Tensor<Device, srcdim, DType>,
+                                                            DType, srcdim>,
+                                        Tensor<Device, srcdim, DType>, srcdim, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, srcdim, DType> *dst,
+                         const MakeTensorExp<ChannelUnpoolingExp<Reducer,
+                                                                 Tensor<Device, srcdim, DType>,
+                                                                 DType, srcdim>,
+                                             Tensor<Device, srcdim, DType>,
+                                             srcdim, DType> &exp) {
+    if (ChannelWindow<Reducer>::kKind == kChannelWindowNone) return false;
+    const ChannelUnpoolingExp<Reducer, Tensor<Device, srcdim, DType>, DType, srcdim> &e =
+        exp.real_self();
+    ChannelUnpool<SV, Reducer>(ChannelPlanes(*dst), ChannelPlanes(e.data_src_),
+                               ChannelPlanes(e.data_pooled_), ChannelPlanes(e.grad_pooled_),
+                               e.nsize_, e.kstride_, e.pad_);
+    return true;
+  }
+};
 }  // namespace expr
 }  // namespace mshadow
 #endif  // MSHADOW_EXTENSION_CHANNEL_UNPOOL_H_
@@ -8,6 +8,7 @@
 #define MSHADOW_EXTENSION_COMPLEX_H_
 #include <algorithm>
 #include "../extension.h"
+#include "../packet-inl.h"
 
 namespace mshadow {
 namespace op {
@@ -54,6 +55,15 @@ struct conjugate {
     index_t real_i, index_t real_j, index_t imag_i, index_t imag_j) {
     return -src_.Eval(imag_i, imag_j);
   }
+  /*! \brief the same maps on the values of one complex number */
+  template<typename DType>
+  MSHADOW_XINLINE static DType RealValue(DType real, DType imag) {
+    return real;
+  }
+  template<typename DType>
+  MSHADOW_XINLINE static DType ImagValue(DType real, DType imag) {
+    return -imag;
+  }
 };
 
 struct exchange {
@@ -67,6 +77,15 @@ struct exchange {
     index_t real_i, index_t real_j, index_t imag_i, index_t imag_j) {
     return src_.Eval(real_i, real_j);
   }
+  /*! \brief the same maps on the values of one complex number */
+  template<typename DType>
+  MSHADOW_XINLINE static DType RealValue(DType real, DType imag) {
+    return imag;
+  }
+  template<typename DType>
+  MSHADOW_XINLINE static DType ImagValue(DType real, DType imag) {
+    return real;
+  }
 };
 
 struct abs_square {
@@ -77,6 +96,11 @@ struct abs_square {
     DType image_val = src_.Eval(imag_i, imag_j);
     return real_val * real_val + image_val * image_val;
   }
+  /*! \brief the same map on the values of one complex number */
+  template<typename DType>
+  MSHADOW_XINLINE static DType RealValue(DType real, DType imag) {
+    return real * real + imag * imag;
+  }
 };
 
 struct sum_real_imag {
@@ -87,10 +111,73 @@ struct sum_real_imag {
     DType image_val = src_.Eval(imag_i, imag_j);
     return real_val + image_val;
   }
+  /*! \brief the same map on the values of one complex number */
+  template<typename DType>
+  MSHADOW_XINLINE static DType RealValue(DType real, DType imag) {
+    return real + imag;
+  }
 };
 }  // namespace complex
 }  // namespace op
 
+namespace packet {
+/*!
+ * \brief the complex operators on packets of interleaved complex numbers, the binary ones
+ *  and conjugate and exchange map packets to packets, abs_square and sum_real_imag map the
+ *  real and the imaginary parts of a packet of complex numbers each to their results
+ */
+template<typename OP, typename DType, PacketArch Arch>
+struct ComplexPacketOp {
+  static const bool kEnabled = false;
+};
+template<typename DType, PacketArch Arch>
+struct ComplexPacketOp<op::complex::mul, DType, Arch> {
+  static const bool kEnabled = ComplexPacketCheck<DType, Arch>::kPass;
+  MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& lhs,
+                                                 const Packet<DType, Arch>& rhs) {
+    return ComplexMul(lhs, rhs);
+  }
+};
+template<typename DType, PacketArch Arch>
+struct ComplexPacketOp<op::complex::div, DType, Arch> {
+  static const bool kEnabled = ComplexPacketCheck<DType, Arch>::kPass;
+  MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& lhs,
+                                                 const Packet<DType, Arch>& rhs) {
+    return ComplexDiv(lhs, rhs);
+  }
+};
+template<typename DType, PacketArch Arch>
+struct ComplexPacketOp<op::complex::conjugate, DType, Arch> {
+  static const bool kEnabled = ComplexPacketCheck<DType, Arch>::kPass;
+  MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& src) {
+    return Conj(src);
+  }
+};
+template<typename DType, PacketArch Arch>
+struct ComplexPacketOp<op::complex::exchange, DType, Arch> {
+  static const bool kEnabled = ComplexPacketCheck<DType, Arch>::kPass;
+  MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& src) {
+    return SwapPairs(src);
+  }
+};
+template<typename DType, PacketArch Arch>
+struct ComplexPacketOp<op::complex::abs_square, DType, Arch> {
+  static const bool kEnabled = ComplexPacketCheck<DType, Arch>::kPass;
+  MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& real,
+                                                 const Packet<DType, Arch>& imag) {
+    return real * real + imag * imag;
+  }
+};
+template<typename DType, PacketArch Arch>
+struct ComplexPacketOp<op::complex::sum_real_imag, DType, Arch> {
+  static const bool kEnabled = ComplexPacketCheck<DType, Arch>::kPass;
+  MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& real,
+                                                 const Packet<DType, Arch>& imag) {
+    return real + imag;
+  }
+};
+}  // namespace packet
+
 namespace expr {
 //--------------------
 // ComplexBinaryMapExp
@@ -265,25 +352,26 @@ struct ShapeCheck<dim, ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype> >
     if (shape1[0] == 0) return shape2;
     if (shape2[0] == 0) return shape1;
     if (calctype == op::complex::kBinaryCC) {
-      CHECK_EQ(shape1, shape2) << "ComplexBinaryMapExp (CC): Shapes of operands are not the same.";
-      CHECK_EQ(shape1[dim - 1] % 2, 0) <<
+      MSHADOW_CHECK_SHAPE_EQ(shape1, shape2)
+        << "ComplexBinaryMapExp (CC): Shapes of operands are not the same.";
+      MSHADOW_CHECK_SHAPE_EQ(shape1[dim - 1] % 2, 0) <<
         "ComplexBinaryMapExp (CC): Shape of the last dimension is not even. "
         "We must have real part + imaginary part.";
       return shape1;
     } else if (calctype == op::complex::kBinaryCR) {
       for (int i = 0; i < dim - 1; ++i) {
-        CHECK_EQ(shape1.shape_[i], shape2.shape_[i]) <<
+        MSHADOW_CHECK_SHAPE_EQ(shape1.shape_[i], shape2.shape_[i]) <<
           "ComplexBinaryMapExp (CR): Shapes of operands are not the same.";
       }
-      CHECK_EQ(shape1[dim - 1], shape2[dim - 1] * 2) <<
+      MSHADOW_CHECK_SHAPE_EQ(shape1[dim - 1], shape2[dim - 1] * 2) <<
         "ComplexBinaryMapExp (CR): Shapes of operands do not match.";
       return shape1;
     } else if (calctype == op::complex::kBinaryRC) {
       for (int i = 0; i < dim - 1; ++i) {
-        CHECK_EQ(shape1.shape_[i], shape2.shape_[i]) <<
+        MSHADOW_CHECK_SHAPE_EQ(shape1.shape_[i], shape2.shape_[i]) <<
           "ComplexBinaryMapExp (RC): Shapes of operands are not the same.";
       }
-      CHECK_EQ(shape2[dim - 1], shape1[dim - 1] * 2) <<
+      MSHADOW_CHECK_SHAPE_EQ(shape2[dim - 1], shape1[dim - 1] * 2) <<
         "ComplexBinaryMapExp (RC): Shapes of operands do not match.";
       return shape2;
     } else {
@@ -297,7 +385,8 @@ template<int dim, int calctype, typename OP, typename TA, typename DType, int et
 struct ShapeCheck<dim, ComplexUnitaryExp<calctype, OP, TA, DType, etype> > {
   inline static Shape<dim> Check(const ComplexUnitaryExp<calctype, OP, TA, DType, etype> &t) {
     Shape<dim> s = ShapeCheck<dim, TA>::Check(t.src_);
-    CHECK_EQ(s[dim - 1] % 2, 0) << "ComplexUnitaryExp: Shape of the last dimension is not even. "
+    MSHADOW_CHECK_SHAPE_EQ(s[dim - 1] % 2, 0)
+      << "ComplexUnitaryExp: Shape of the last dimension is not even. "
       "We must have real + imaginary.";
     if (calctype == op::complex::kUnitaryC2C) {
       return s;
@@ -448,6 +537,140 @@ struct ExpInfo<ComplexUnitaryExp<calctype, OP, TA, DType, etype> > {
   static const int kDevMask = ExpInfo<TA>::kDevMask;
 };
 
+// the complex expressions map their elements in place, or (c2r) read the complex
+// number 2 * x for the element x, which holds for the flat rows too
+template<int calctype, typename OP, typename TA, typename TB, typename DType, int etype>
+struct FlatCheck<ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype> > {
+  inline static bool
+  Check(const ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype> &t, size_t *addr) {
+    return FlatCheck<TA>::Check(t.lhs_, addr) && FlatCheck<TB>::Check(t.rhs_, addr);
+  }
+};
+
+template<int calctype, typename OP, typename TA, typename DType, int etype>
+struct FlatCheck<ComplexUnitaryExp<calctype, OP, TA, DType, etype> > {
+  inline static bool
+  Check(const ComplexUnitaryExp<calctype, OP, TA, DType, etype> &t, size_t *addr) {
+    return FlatCheck<TA>::Check(t.src_, addr);
+  }
+};
+
+//---------------------------------------------------------------------
+// packet plans of the cc, c2c and c2r expressions, a packet holds whole
+// complex numbers as x is aligned to the packet size, which is even
+//---------------------------------------------------------------------
+template<typename OP, typename TA, typename TB, int etype, typename DType, PacketArch Arch>
+class PacketPlan<ComplexBinaryMapExp<op::complex::kBinaryCC, OP, TA, TB, DType, etype>,
+                 DType, Arch> {
+ public:
+  PacketPlan(const PacketPlan<TA, DType, Arch> &lhs, const PacketPlan<TB, DType, Arch> &rhs)
+      : lhs_(lhs), rhs_(rhs) {}
+  MSHADOW_CINLINE packet::Packet<DType, Arch> EvalPacket(index_t y, index_t x) const {
+    return packet::ComplexPacketOp<OP, DType, Arch>::Map(lhs_.EvalPacket(y, x),
+                                                         rhs_.EvalPacket(y, x));
+  }
+  MSHADOW_CINLINE DType Eval(index_t y, index_t x) const {
+    const index_t base_x = static_cast<index_t>(x / 2) * 2;
+    if (x % 2 == 0) {
+      return OP::RealMap(lhs_.Eval(y, base_x), lhs_.Eval(y, base_x + 1),
+        rhs_.Eval(y, base_x), rhs_.Eval(y, base_x + 1));
+    } else {
+      return OP::ImagMap(lhs_.Eval(y, base_x), lhs_.Eval(y, base_x + 1),
+        rhs_.Eval(y, base_x), rhs_.Eval(y, base_x + 1));
+    }
+  }
+
+ private:
+  PacketPlan<TA, DType, Arch> lhs_;
+  PacketPlan<TB, DType, Arch> rhs_;
+};
+
+template<typename OP, typename TA, int etype, typename DType, PacketArch Arch>
+class PacketPlan<ComplexUnitaryExp<op::complex::kUnitaryC2C, OP, TA, DType, etype>,
+                 DType, Arch> {
+ public:
+  explicit PacketPlan(const PacketPlan<TA, DType, Arch> &src) : src_(src) {}
+  MSHADOW_CINLINE packet::Packet<DType, Arch> EvalPacket(index_t y, index_t x) const {
+    return packet::ComplexPacketOp<OP, DType, Arch>::Map(src_.EvalPacket(y, x));
+  }
+  MSHADOW_CINLINE DType Eval(index_t y, index_t x) const {
+    const index_t base_x = static_cast<index_t>(x / 2) * 2;
+    const DType real = src_.Eval(y, base_x), imag = src_.Eval(y, base_x + 1);
+    return x % 2 == 0 ? OP::RealValue(real, imag) : OP::ImagValue(real, imag);
+  }
+
+ private:
+  PacketPlan<TA, DType, Arch> src_;
+};
+
+// the packet at x is made of the complex numbers of the two source packets at 2 * x
+template<typename OP, typename TA, int etype, typename DType, PacketArch Arch>
+class PacketPlan<ComplexUnitaryExp<op::complex::kUnitaryC2R, OP, TA, DType, etype>,
+                 DType, Arch> {
+ public:
+  explicit PacketPlan(const PacketPlan<TA, DType, Arch> &src) : src_(src) {}
+  MSHADOW_CINLINE packet::Packet<DType, Arch> EvalPacket(index_t y, index_t x) const {
+    packet::Packet<DType, Arch> real, imag;
+    packet::Deinterleave(src_.EvalPacket(y, x * 2),
+                         src_.EvalPacket(y, x * 2 + packet::Packet<DType, Arch>::kSize),
+                         &real, &imag);
+    return packet::ComplexPacketOp<OP, DType, Arch>::Map(real, imag);
+  }
+  MSHADOW_CINLINE DType Eval(index_t y, index_t x) const {
+    return OP::RealValue(src_.Eval(y, x * 2), src_.Eval(y, x * 2 + 1));
+  }
+
+ private:
+  PacketPlan<TA, DType, Arch> src_;
+};
+
+template<PacketArch Arch, typename OP, typename TA, typename TB, typename DType, int etype>
+inline PacketPlan<ComplexBinaryMapExp<op::complex::kBinaryCC, OP, TA, TB, DType, etype>,
+                  DType, Arch>
+MakePacketPlan(const ComplexBinaryMapExp<op::complex::kBinaryCC, OP, TA, TB, DType, etype> &e) {
+  return PacketPlan<ComplexBinaryMapExp<op::complex::kBinaryCC, OP, TA, TB, DType, etype>,
+                    DType, Arch>(MakePacketPlan<Arch>(e.lhs_), MakePacketPlan<Arch>(e.rhs_));
+}
+
+template<PacketArch Arch, int calctype, typename OP, typename TA, typename DType, int etype>
+inline PacketPlan<ComplexUnitaryExp<calctype, OP, TA, DType, etype>, DType, Arch>
+MakePacketPlan(const ComplexUnitaryExp<calctype, OP, TA, DType, etype> &e) {
+  return PacketPlan<ComplexUnitaryExp<calctype, OP, TA, DType, etype>,
+                    DType, Arch>(MakePacketPlan<Arch>(e.src_));
+}
+
+// cr and rc are not vectorized, their real operand runs at half the rate
+template<int calctype, typename OP, typename TA, typename TB, typename DType, int etype,
+         PacketArch Arch>
+struct PacketCheck<ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype>, Arch> {
+  static const bool kPass = calctype == op::complex::kBinaryCC &&
+      packet::ComplexPacketOp<OP, DType, Arch>::kEnabled &&
+      PacketCheck<TA, Arch>::kPass && PacketCheck<TB, Arch>::kPass;
+};
+
+template<int calctype, typename OP, typename TA, typename DType, int etype, PacketArch Arch>
+struct PacketCheck<ComplexUnitaryExp<calctype, OP, TA, DType, etype>, Arch> {
+  static const bool kPass = packet::ComplexPacketOp<OP, DType, Arch>::kEnabled &&
+      PacketCheck<TA, Arch>::kPass;
+};
+
+template<int dim, int calctype, typename OP, typename TA, typename TB, typename DType,
+         int etype, PacketArch Arch>
+struct PacketAlignCheck<dim, ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype>, Arch> {
+  inline static bool
+  Check(const ComplexBinaryMapExp<calctype, OP, TA, TB, DType, etype> &t) {
+    return PacketAlignCheck<dim, TA, Arch>::Check(t.lhs_) &&
+        PacketAlignCheck<dim, TB, Arch>::Check(t.rhs_);
+  }
+};
+
+template<int dim, int calctype, typename OP, typename TA, typename DType, int etype,
+         PacketArch Arch>
+struct PacketAlignCheck<dim, ComplexUnitaryExp<calctype, OP, TA, DType, etype>, Arch> {
+  inline static bool Check(const ComplexUnitaryExp<calctype, OP, TA, DType, etype> &t) {
+    return PacketAlignCheck<dim, TA, Arch>::Check(t.src_);
+  }
+};
 }  // namespace expr
 }  // namespace mshadow
 #endif  // MSHADOW_EXTENSION_COMPLEX_H_
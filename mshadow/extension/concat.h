@@ -30,7 +30,7 @@ struct ConcatExp : public TRValue<ConcatExp<LhsExp, RhsExp,
   const RhsExp &src2_;
   index_t dcat_src1_;
   index_t dcat_src2_;
-  Shape<4> shape_;
+  Shape<srcdim> shape_;
   ConcatExp(const LhsExp &src1, const RhsExp &src2) : src1_(src1), src2_(src2) {
     Shape<srcdim> sshape1 = ShapeCheck<srcdim, LhsExp>::Check(src1_);
     Shape<srcdim> sshape2 = ShapeCheck<srcdim, RhsExp>::Check(src2_);
@@ -189,6 +189,116 @@ struct Plan<ConcatExp<LhsExp, RhsExp, Device, DType, srcdim, 1>, DType> {
   Plan<RhsExp, DType> src2_;
   const index_t width_src1_;
 };
+/*!
+ * \brief whether the slice of dimension cdim of a tensor is itself a tensor,
+ *  true when cdim is the last dimension or the dimensions before cdim are all 1
+ * \tparam cdim the dimension to slice on
+ */
+template<int cdim, typename Device, int dim, typename DType>
+inline bool HasSliceView(const Tensor<Device, dim, DType> &t) {
+  return cdim == dim - 1 || t.shape_.ProdShape(0, cdim) == 1;
+}
+/*!
+ * \brief the slice [begin, end) of dimension cdim of a tensor as a strided view,
+ *  producers can write their part of a concat straight into the preallocated output
+ *  and consumers of a split can read their part in place, so no copy is made.
+ *  With a leading batch dimension take the view of each batch, e.g.
+ *  SliceView<0>(out[b], c0, c1) for the channels [c0, c1) of a NCHW output
+ * \param t the tensor
+ * \param begin the beginning of the slice
+ * \param end the end of the slice
+ * \tparam cdim the dimension to slice on, see HasSliceView for the requirement
+ */
+template<int cdim, typename Device, int dim, typename DType>
+inline Tensor<Device, dim, DType>
+SliceView(const Tensor<Device, dim, DType> &t, index_t begin, index_t end) {
+  TypeCheckPass<cdim < dim>::Error_Expression_Does_Not_Meet_Dimension_Req();
+  CHECK(HasSliceView<cdim>(t))
+      << "SliceView: slice of dimension " << cdim << " of " << t.shape_ << " is not a tensor";
+  CHECK(begin <= end && end <= t.size(cdim)) << "SliceView: slice out of bound";
+  Shape<dim> shape = t.shape_;
+  shape[cdim] = end - begin;
+  const index_t offset = cdim == dim - 1 ?
+      begin : begin * t.shape_.ProdShape(cdim + 1, dim - 1) * t.stride_;
+  return Tensor<Device, dim, DType>(t.dptr_ + offset, shape, t.stride_, t.stream_);
+}
+/*!
+ * \brief copy part into the slice of whole that starts at begin in dimension cdim,
+ *  or the other way round, as a few bulk row copies instead of element-wise evaluation
+ * \param to_whole whether to copy part into whole, otherwise whole into part
+ */
+template<int cdim, typename Device, int dim, typename DType>
+inline void CopyConcatPart(const Tensor<Device, dim, DType> &whole,
+                           const Tensor<Device, dim, DType> &part,
+                           index_t begin, bool to_whole) {
+  Stream<Device> *stream = whole.stream_;
+  if (HasSliceView<cdim>(whole)) {
+    Tensor<Device, dim, DType> view = SliceView<cdim>(whole, begin, begin + part.size(cdim));
+    if (to_whole) {
+      Copy(view, part, stream);
+    } else {
+      Copy(part, view, stream);
+    }
+    return;
+  }
+  // each index of the dimensions before cdim holds one block of rows of both tensors
+  const index_t nblock = whole.shape_.ProdShape(0, cdim);
+  const index_t height = whole.shape_.ProdShape(cdim + 1, dim - 1), ncol = whole.size(dim - 1);
+  const index_t wrows = whole.size(cdim) * height, prows = part.size(cdim) * height;
+  const bool contiguous = whole.CheckContiguous() && part.CheckContiguous();
+  for (index_t b = 0; b < (contiguous ? 1 : nblock); ++b) {
+    Tensor<Device, 2, DType> wview, pview;
+    if (contiguous) {
+      // all blocks at once, one row of the views per block
+      wview = Tensor<Device, 2, DType>(whole.dptr_ + begin * height * ncol,
+                                       Shape2(nblock, prows * ncol), wrows * ncol, stream);
+      pview = Tensor<Device, 2, DType>(part.dptr_, Shape2(nblock, prows * ncol),
+                                       prows * ncol, stream);
+    } else {
+      wview = Tensor<Device, 2, DType>(whole.dptr_ + (b * wrows + begin * height) * whole.stride_,
+                                       Shape2(prows, ncol), whole.stride_, stream);
+      pview = Tensor<Device, 2, DType>(part.dptr_ + b * prows * part.stride_,
+                                       Shape2(prows, ncol), part.stride_, stream);
+    }
+    if (to_whole) {
+      Copy(wview, pview, stream);
+    } else {
+      Copy(pview, wview, stream);
+    }
+  }
+}
+/*! \brief concat of two tensors into a tensor is done with bulk copies */
+template<typename Device, typename DType, int srcdim, int dimsrc_m_cat>
+struct MapExpDirectEngine<sv::saveto, Tensor<Device, srcdim, DType>,
+                          ConcatExp<Tensor<Device, srcdim, DType>, Tensor<Device, srcdim, DType>,
+                                    Device, DType, srcdim, dimsrc_m_cat>,
+                          DType> {
+  static const int dimcat = srcdim - dimsrc_m_cat;
+  inline static bool Map(Tensor<Device, srcdim, DType> *dst,
+                         const ConcatExp<Tensor<Device, srcdim, DType>,
+                                         Tensor<Device, srcdim, DType>,
+                                         Device, DType, srcdim, dimsrc_m_cat> &exp) {
+    CopyConcatPart<dimcat>(*dst, exp.src1_, 0, true);
+    CopyConcatPart<dimcat>(*dst, exp.src2_, exp.dcat_src1_, true);
+    return true;
+  }
+};
+/*! \brief split of a tensor into the two tensors of a concat is done with bulk copies */
+template<typename Device, typename DType, int srcdim, int dimsrc_m_cat>
+struct MapExpDirectEngine<sv::saveto,
+                          ConcatExp<Tensor<Device, srcdim, DType>, Tensor<Device, srcdim, DType>,
+                                    Device, DType, srcdim, dimsrc_m_cat>,
+                          Tensor<Device, srcdim, DType>, DType> {
+  static const int dimcat = srcdim - dimsrc_m_cat;
+  inline static bool Map(ConcatExp<Tensor<Device, srcdim, DType>,
+                                   Tensor<Device, srcdim, DType>,
+                                   Device, DType, srcdim, dimsrc_m_cat> *dst,
+                         const Tensor<Device, srcdim, DType> &src) {
+    CopyConcatPart<dimcat>(src, dst->src1_, 0, false);
+    CopyConcatPart<dimcat>(src, dst->src2_, dst->dcat_src1_, false);
+    return true;
+  }
+};
 }  // namespace expr
 }   // namespace mshadow
 #endif  // MSHADOW_EXTENSION_CONCAT_H_
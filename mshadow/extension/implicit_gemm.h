@@ -7,6 +7,10 @@
 #ifndef MSHADOW_EXTENSION_IMPLICIT_GEMM_H_
 #define MSHADOW_EXTENSION_IMPLICIT_GEMM_H_
 
+#include <algorithm>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "../extension.h"
 #include "../packet-inl.h"
 
@@ -101,6 +105,138 @@ MakePlan(const ImplicitGEMMExp<LhsExp, RhsExp, DType> &exp) {
 }
 
 
+/*!
+ * \brief register tiled kernel of implicit_dot on row major tensors, a tile of
+ *  kMR rows and kNP packets of columns of dst is kept in registers, each step of
+ *  the inner dimension loads a row of rhs and broadcasts one element of lhs per row
+ * \tparam DType data type
+ * \tparam Arch packet arch
+ */
+template<typename DType, packet::PacketArch Arch>
+struct ImplicitGEMMKernel {
+  typedef packet::Packet<DType, Arch> TPacket;
+  /*! \brief rows of a tile */
+  static const index_t kMR = 4;
+  /*! \brief packets in a row of a tile */
+  static const index_t kNP = 2;
+  /*! \brief columns of a tile */
+  static const index_t kNR = kNP * TPacket::kSize;
+  /*!
+   * \brief tile[mr, np * kSize] = lhs[mr, k] * rhs[k, np * kSize],
+   *  the rows of tile are kNR apart and tile is aligned
+   */
+  template<index_t mr, index_t np>
+  MSHADOW_CINLINE static void Tile(index_t k, const DType *lhs, index_t lda,
+                                   const DType *rhs, index_t ldb, DType *tile) {
+    TPacket acc[mr][np];
+    for (index_t r = 0; r < mr; ++r) {
+      for (index_t c = 0; c < np; ++c) acc[r][c] = TPacket::Fill(DType(0));
+    }
+    for (index_t p = 0; p < k; ++p, rhs += ldb) {
+      TPacket b[np];
+      for (index_t c = 0; c < np; ++c) b[c] = TPacket::LoadUnAligned(rhs + c * TPacket::kSize);
+      for (index_t r = 0; r < mr; ++r) {
+        const TPacket a = TPacket::Fill(lhs[r * lda + p]);
+        for (index_t c = 0; c < np; ++c) acc[r][c] = packet::FMA(a, b[c], acc[r][c]);
+      }
+    }
+    for (index_t r = 0; r < mr; ++r) {
+      for (index_t c = 0; c < np; ++c) acc[r][c].Store(tile + r * kNR + c * TPacket::kSize);
+    }
+  }
+  /*! \brief the last nc < kSize columns of the tile, one dot product per element */
+  template<index_t mr>
+  MSHADOW_CINLINE static void TileTail(index_t k, const DType *lhs, index_t lda,
+                                       const DType *rhs, index_t ldb, index_t nc,
+                                       DType *tile) {
+    for (index_t r = 0; r < mr; ++r) {
+      for (index_t c = 0; c < nc; ++c) tile[r * kNR + c] = DType(0);
+    }
+    for (index_t p = 0; p < k; ++p, rhs += ldb) {
+      for (index_t r = 0; r < mr; ++r) {
+        const DType a = lhs[r * lda + p];
+        for (index_t c = 0; c < nc; ++c) tile[r * kNR + c] += a * rhs[c];
+      }
+    }
+  }
+  /*! \brief dst[0:mr, :] = lhs[0:mr, :] * rhs, tile is a kMR x kNR aligned buffer */
+  template<typename Saver, index_t mr>
+  inline static void Rows(Tensor<cpu, 2, DType> dst, const DType *lhs, index_t lda,
+                          const Tensor<cpu, 2, DType> &rhs, DType *tile) {
+    const index_t n = dst.size(1), k = rhs.size(0), ldb = rhs.stride_;
+    for (index_t j = 0; j < n;) {
+      index_t nc;
+      if (j + kNR <= n) {
+        nc = kNR;
+        Tile<mr, kNP>(k, lhs, lda, rhs.dptr_ + j, ldb, tile);
+      } else if (j + TPacket::kSize <= n) {
+        nc = TPacket::kSize;
+        Tile<mr, 1>(k, lhs, lda, rhs.dptr_ + j, ldb, tile);
+      } else {
+        nc = n - j;
+        TileTail<mr>(k, lhs, lda, rhs.dptr_ + j, ldb, nc, tile);
+      }
+      for (index_t r = 0; r < mr; ++r) {
+        for (index_t c = 0; c < nc; ++c) {
+          Saver::template Save<DType>(dst[r][j + c], tile[r * kNR + c]);
+        }
+      }
+      j += nc;
+    }
+  }
+  /*! \brief dst = lhs * rhs on row major tensors */
+  template<typename Saver>
+  inline static void Eval(Tensor<cpu, 2, DType> dst,
+                          const Tensor<cpu, 2, DType> &lhs,
+                          const Tensor<cpu, 2, DType> &rhs) {
+    const index_t m = dst.size(0), nblock = (m + kMR - 1) / kMR;
+    const int nthread = std::min(GetNumParallelThread(
+        dst.stream_, static_cast<size_t>(dst.shape_.Size()) * lhs.size(1)),
+        static_cast<int>(std::max(nblock, index_t(1))));
+    size_t pitch;
+    DType *tiles = static_cast<DType*>(packet::AlignedMallocPitch(
+        &pitch, kMR * kNR * sizeof(DType), nthread));
+    const index_t tstride = static_cast<index_t>(pitch / sizeof(DType));
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t b = 0; b < nblock; ++b) {
+#ifdef _OPENMP
+      DType *tile = tiles + static_cast<index_t>(omp_get_thread_num()) * tstride;
+#else
+      DType *tile = tiles;
+#endif
+      const index_t i = static_cast<index_t>(b) * kMR;
+      const DType *a = lhs.dptr_ + static_cast<size_t>(i) * lhs.stride_;
+      Tensor<cpu, 2, DType> d = dst.Slice(i, std::min(i + kMR, m));
+      switch (d.size(0)) {
+        case 4: Rows<Saver, 4>(d, a, lhs.stride_, rhs, tile); break;
+        case 3: Rows<Saver, 3>(d, a, lhs.stride_, rhs, tile); break;
+        case 2: Rows<Saver, 2>(d, a, lhs.stride_, rhs, tile); break;
+        default: Rows<Saver, 1>(d, a, lhs.stride_, rhs, tile); break;
+      }
+    }
+    packet::AlignedFree(tiles);
+  }
+};
+/*!
+ * \brief implicit_dot of two cpu tensors goes through the register tiled kernel
+ *  instead of one dot product per element, rows of rhs are read contiguously
+ */
+template<typename SV, typename DType>
+struct MapExpDirectEngine<SV, Tensor<cpu, 2, DType>,
+                          ImplicitGEMMExp<Tensor<cpu, 2, DType>,
+                                          Tensor<cpu, 2, DType>, DType>,
+                          DType> {
+  inline static bool Map(Tensor<cpu, 2, DType> *dst,
+                         const ImplicitGEMMExp<Tensor<cpu, 2, DType>,
+                                               Tensor<cpu, 2, DType>, DType> &exp) {
+    if (!PacketCheck<DType, MSHADOW_DEFAULT_PACKET>::kPass) return false;
+    if (dst->shape_.Size() == 0) return true;
+    ImplicitGEMMKernel<DType, MSHADOW_DEFAULT_PACKET>
+        ::template Eval<SV>(*dst, exp.lhs_, exp.rhs_);
+    return true;
+  }
+};
+
 template<int dim, typename LhsExp, typename RhsExp, typename DType>
 struct ShapeCheck<dim, ImplicitGEMMExp<LhsExp, RhsExp, DType> > {
   inline static Shape<dim>
@@ -109,7 +245,7 @@ struct ShapeCheck<dim, ImplicitGEMMExp<LhsExp, RhsExp, DType> > {
         << "ImplicitGEMMExp only support 2 dimension";
     Shape<dim> shape1 = ShapeCheck<dim, LhsExp>::Check(t.lhs_);
     Shape<dim> shape2 = ShapeCheck<dim, RhsExp>::Check(t.rhs_);
-    CHECK_EQ(shape1[1], shape2[0])
+    MSHADOW_CHECK_SHAPE_EQ(shape1[1], shape2[0])
       << "implicit_dot The matrix shape do  not match";
     return t.shape_;
   }
@@ -76,7 +76,8 @@ struct ShapeCheck<dim, MaskExp<IndexExp, SrcExp, DType> > {
       << "MaskExp only support 2D output";
     Shape<1> dshape = ShapeCheck<1, IndexExp>::Check(t.index_);
     Shape<2> wshape = ShapeCheck<2, SrcExp>::Check(t.src_);
-    CHECK_EQ(dshape[0], wshape[0]) << "MaskExp require inputs in same first dimention";
+    MSHADOW_CHECK_SHAPE_EQ(dshape[0], wshape[0])
+      << "MaskExp require inputs in same first dimention";
     Shape<dim> ret;
     ret[0] = wshape[0];
     ret[1] = wshape[1];
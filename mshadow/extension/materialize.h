@@ -0,0 +1,135 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file materialize.h
+ * \brief evaluate a subexpression once into a temporary tensor,
+ *  instead of once per element of the expression that consumes it
+ */
+#ifndef MSHADOW_EXTENSION_MATERIALIZE_H_
+#define MSHADOW_EXTENSION_MATERIALIZE_H_
+#include "../extension.h"
+
+/*!
+ * \brief cost, in ExpCost units, from which extensions that read their source several
+ *  times per element evaluate it into a temporary first
+ */
+#ifndef MSHADOW_MATERIALIZE_COST
+#define MSHADOW_MATERIALIZE_COST 2
+#endif
+
+namespace mshadow {
+template<typename Device>
+class Workspace;
+namespace expr {
+/*!
+ * \brief compile time estimate of the work to evaluate one element of an expression,
+ *  counted in operators: tensors and scalars are free, every map or extension costs one
+ * \tparam E the expression
+ */
+template<typename E>
+struct ExpCost {
+  /*! \brief unknown expressions are taken as expensive */
+  static const int kCost = MSHADOW_MATERIALIZE_COST;
+  /*! \brief whether it is worth evaluating the expression into a temporary */
+  static const bool kMaterialize = kCost >= MSHADOW_MATERIALIZE_COST;
+};
+template<typename Device, int dim, typename DType>
+struct ExpCost<Tensor<Device, dim, DType> > {
+  static const int kCost = 0;
+  static const bool kMaterialize = false;
+};
+template<typename DType>
+struct ExpCost<ScalarExp<DType> > {
+  static const int kCost = 0;
+  static const bool kMaterialize = false;
+};
+template<typename E, typename DType>
+struct ExpCost<TransposeExp<E, DType> > {
+  static const int kCost = ExpCost<E>::kCost;
+  static const bool kMaterialize = kCost >= MSHADOW_MATERIALIZE_COST;
+};
+template<typename DstDType, typename SrcDType, typename EType, int etype>
+struct ExpCost<TypecastExp<DstDType, SrcDType, EType, etype> > {
+  static const int kCost = ExpCost<EType>::kCost;
+  static const bool kMaterialize = kCost >= MSHADOW_MATERIALIZE_COST;
+};
+template<typename T, typename SrcExp, int dim, typename DType>
+struct ExpCost<MakeTensorExp<T, SrcExp, dim, DType> > {
+  static const int kCost = 1 + ExpCost<SrcExp>::kCost;
+  static const bool kMaterialize = kCost >= MSHADOW_MATERIALIZE_COST;
+};
+template<typename OP, typename TA, typename DType, int etype>
+struct ExpCost<UnaryMapExp<OP, TA, DType, etype> > {
+  static const int kCost = 1 + ExpCost<TA>::kCost;
+  static const bool kMaterialize = kCost >= MSHADOW_MATERIALIZE_COST;
+};
+template<typename OP, typename TA, typename TB, typename DType, int etype>
+struct ExpCost<BinaryMapExp<OP, TA, TB, DType, etype> > {
+  static const int kCost = 1 + ExpCost<TA>::kCost + ExpCost<TB>::kCost;
+  static const bool kMaterialize = kCost >= MSHADOW_MATERIALIZE_COST;
+};
+template<typename OP, typename TA, typename TB, typename TC, typename DType, int etype>
+struct ExpCost<TernaryMapExp<OP, TA, TB, TC, DType, etype> > {
+  static const int kCost = 1 + ExpCost<TA>::kCost + ExpCost<TB>::kCost + ExpCost<TC>::kCost;
+  static const bool kMaterialize = kCost >= MSHADOW_MATERIALIZE_COST;
+};
+/*!
+ * \brief temporary tensor holding an evaluated subexpression, freed on destruction.
+ *  Used by the extensions that materialize their source during an assignment.
+ * \tparam Device which device the tensor is on
+ * \tparam dim dimension of the tensor
+ * \tparam DType type of element in tensor
+ */
+template<typename Device, int dim, typename DType>
+struct MaterializedTensor {
+  /*! \brief the evaluated subexpression */
+  Tensor<Device, dim, DType> data;
+  /*!
+   * \brief evaluate exp into a new tensor
+   * \param exp the subexpression
+   * \param stream the stream the evaluation and its consumers run on
+   */
+  template<typename E, int etype>
+  MaterializedTensor(const Exp<E, DType, etype> &exp, Stream<Device> *stream) {
+    data.shape_ = ShapeCheck<dim, E>::Check(exp.self());
+    data.stream_ = stream;
+    AllocSpace(&data, false);
+    ExpEngine<sv::saveto, Tensor<Device, dim, DType>, DType>::Eval(&data, exp.self());
+  }
+  ~MaterializedTensor(void) {
+    FreeSpace(&data);
+  }
+
+ private:
+  MaterializedTensor(const MaterializedTensor &other);
+  MaterializedTensor &operator=(const MaterializedTensor &other);
+};
+/*!
+ * \brief evaluate exp once into a tensor taken from ws, to be used where a subexpression
+ *  would otherwise be evaluated again for each element that reads it
+ * \code
+ *  // the sigmoid is computed once per pixel instead of once per patch covering it
+ *  col = unpack_patch2col(materialize(F<sigmoid>(img) * scale, &ws), k, k, 1, 1);
+ * \endcode
+ * \param exp the subexpression
+ * \param ws workspace providing the tensor, the result is valid until ws.Reset
+ * \return the evaluated tensor, on the stream of ws
+ * \tparam Device which device the tensor is on
+ * \tparam E the expression type
+ * \tparam DType type of element in tensor
+ * \tparam etype type of expression
+ */
+template<typename Device, typename E, typename DType, int etype>
+inline Tensor<Device, ExpInfo<E>::kDim, DType>
+materialize(const Exp<E, DType, etype> &exp, Workspace<Device> *ws) {
+  const int dim = ExpInfo<E>::kDim;
+  TypeCheckPass<dim >= 1>::Error_Expression_Does_Not_Meet_Dimension_Req();
+  TypeCheckPass<(ExpInfo<E>::kDevMask & Device::kDevMask) != 0>
+      ::Error_All_Tensor_in_Exp_Must_Have_Same_Type();
+  Tensor<Device, dim, DType> ret =
+      ws->template Get<DType>(ShapeCheck<dim, E>::Check(exp.self()));
+  ExpEngine<sv::saveto, Tensor<Device, dim, DType>, DType>::Eval(&ret, exp.self());
+  return ret;
+}
+}  // namespace expr
+}  // namespace mshadow
+#endif  // MSHADOW_EXTENSION_MATERIALIZE_H_
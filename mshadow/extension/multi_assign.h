@@ -0,0 +1,264 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file multi_assign.h
+ * \brief evaluate several expressions into several destinations of the same shape in one pass
+ */
+#ifndef MSHADOW_EXTENSION_MULTI_ASSIGN_H_
+#define MSHADOW_EXTENSION_MULTI_ASSIGN_H_
+
+#include <algorithm>
+#include <type_traits>
+#include "../extension.h"
+#include "../packet-inl.h"
+
+namespace mshadow {
+namespace expr {
+/*!
+ * \brief a destination together with the expression MapMulti saves into it
+ * \tparam SV saver of the assignment
+ * \tparam E type of the expression
+ */
+template<typename SV, typename Device, int dim, typename DType, typename E>
+struct AssignPair {
+  typedef Device DeviceType;
+  typedef DType DataType;
+  static const int kDim = dim;
+  /*! \brief whether the pair can be evaluated with packets of the default arch */
+  static const bool kPacket = PacketCheck<E, MSHADOW_DEFAULT_PACKET>::kPass &&
+      PacketCheck<Tensor<Device, dim, DType>, MSHADOW_DEFAULT_PACKET>::kPass;
+  /*! \brief the destination */
+  Tensor<Device, dim, DType> dst_;
+  /*! \brief the expression */
+  const E &exp_;
+  AssignPair(const Tensor<Device, dim, DType> &dst, const E &exp)
+      : dst_(dst), exp_(exp) {}
+  inline Stream<Device> *stream(void) const {
+    return dst_.stream_;
+  }
+  inline const Shape<dim> &shape(void) const {
+    return dst_.shape_;
+  }
+  inline void Check(const Shape<dim> &shape) const {
+    CHECK_EQ(dst_.shape_, shape) << "MapMulti: all destinations need the same shape";
+    Shape<dim> eshape = ShapeCheck<dim, E>::Check(exp_);
+    CHECK(eshape[0] == 0 || eshape == shape)
+        << "MapMulti: Shape of Tensors are not consistent with target, "
+        << "eshape: " << eshape << " dshape:" << shape;
+  }
+  inline bool PacketAligned(void) const {
+    return PacketAlignCheck<dim, E, MSHADOW_DEFAULT_PACKET>::Check(exp_) &&
+        PacketAlignCheck<dim, Tensor<Device, dim, DType>, MSHADOW_DEFAULT_PACKET>::Check(dst_);
+  }
+};
+/*!
+ * \brief assignment of exp to dst with saver SV, to be evaluated by MapMulti
+ * \param dst the destination
+ * \param exp the expression
+ * \tparam SV saver, e.g. sv::saveto or sv::plusto
+ */
+template<typename SV, typename Device, int dim, typename DType, typename E, int etype>
+inline AssignPair<SV, Device, dim, DType, E>
+assign(const Tensor<Device, dim, DType> &dst, const Exp<E, DType, etype> &exp) {
+  TypeCheckPass<TypeCheck<Device, dim, DType, E>::kMapPass>
+      ::Error_All_Tensor_in_Exp_Must_Have_Same_Type();
+  return AssignPair<SV, Device, dim, DType, E>(dst, exp.self());
+}
+/*! \brief a list of assignments, A is evaluated before B at every element */
+template<typename A, typename B>
+struct MultiAssign {
+  typedef typename A::DeviceType DeviceType;
+  typedef typename A::DataType DataType;
+  static const int kDim = A::kDim;
+  /*! \brief packets are only used when all the destinations share a data type */
+  static const bool kPacket = A::kPacket && B::kPacket &&
+      std::is_same<DataType, typename B::DataType>::value;
+  const A a_;
+  const B b_;
+  MultiAssign(const A &a, const B &b) : a_(a), b_(b) {
+    TypeCheckPass<A::kDim == B::kDim>::Error_Expression_Does_Not_Meet_Dimension_Req();
+  }
+  inline Stream<DeviceType> *stream(void) const {
+    return a_.stream();
+  }
+  inline const Shape<kDim> &shape(void) const {
+    return a_.shape();
+  }
+  inline void Check(const Shape<kDim> &shape) const {
+    a_.Check(shape);
+    b_.Check(shape);
+  }
+  inline bool PacketAligned(void) const {
+    return a_.PacketAligned() && b_.PacketAligned();
+  }
+};
+/*! \brief plan of a list of assignments, Map(y, x) evaluates all of them at (y, x) */
+template<typename L>
+struct MultiAssignPlan;
+template<typename SV, typename Device, int dim, typename DType, typename E>
+struct MultiAssignPlan<AssignPair<SV, Device, dim, DType, E> > {
+ public:
+  explicit MultiAssignPlan(const AssignPair<SV, Device, dim, DType, E> &p)
+      : dst_(MakePlan(p.dst_)), exp_(MakePlan(p.exp_)) {}
+  MSHADOW_XINLINE void Map(index_t y, index_t x) {
+    SV::template Save<DType>(dst_.REval(y, x), exp_.Eval(y, x));
+  }
+
+ private:
+  Plan<Tensor<Device, dim, DType>, DType> dst_;
+  Plan<E, DType> exp_;
+};
+template<typename A, typename B>
+struct MultiAssignPlan<MultiAssign<A, B> > {
+ public:
+  explicit MultiAssignPlan(const MultiAssign<A, B> &l) : a_(l.a_), b_(l.b_) {}
+  MSHADOW_XINLINE void Map(index_t y, index_t x) {
+    a_.Map(y, x);
+    b_.Map(y, x);
+  }
+
+ private:
+  MultiAssignPlan<A> a_;
+  MultiAssignPlan<B> b_;
+};
+/*! \brief packet plan of a list of cpu assignments, MapPacket(y, x) evaluates a packet */
+template<typename L, packet::PacketArch Arch>
+struct MultiAssignPacketPlan;
+template<typename SV, int dim, typename DType, typename E, packet::PacketArch Arch>
+struct MultiAssignPacketPlan<AssignPair<SV, cpu, dim, DType, E>, Arch> {
+ public:
+  explicit MultiAssignPacketPlan(const AssignPair<SV, cpu, dim, DType, E> &p)
+      : dptr_(p.dst_.dptr_), stride_(p.dst_.stride_),
+        exp_(MakePacketPlan<Arch>(p.exp_)) {}
+  MSHADOW_CINLINE void MapPacket(index_t y, index_t x) const {
+    packet::Saver<SV, DType, Arch>::Save(dptr_ + y * stride_ + x, exp_.EvalPacket(y, x));
+  }
+  MSHADOW_CINLINE void Map(index_t y, index_t x) const {
+    SV::template Save<DType>(dptr_[y * stride_ + x], exp_.Eval(y, x));
+  }
+
+ private:
+  DType *dptr_;
+  index_t stride_;
+  PacketPlan<E, DType, Arch> exp_;
+};
+template<typename A, typename B, packet::PacketArch Arch>
+struct MultiAssignPacketPlan<MultiAssign<A, B>, Arch> {
+ public:
+  explicit MultiAssignPacketPlan(const MultiAssign<A, B> &l) : a_(l.a_), b_(l.b_) {}
+  MSHADOW_CINLINE void MapPacket(index_t y, index_t x) const {
+    a_.MapPacket(y, x);
+    b_.MapPacket(y, x);
+  }
+  MSHADOW_CINLINE void Map(index_t y, index_t x) const {
+    a_.Map(y, x);
+    b_.Map(y, x);
+  }
+
+ private:
+  MultiAssignPacketPlan<A, Arch> a_;
+  MultiAssignPacketPlan<B, Arch> b_;
+};
+/*!
+ * \brief runs a list of cpu assignments, rows are split among threads like MapPlan,
+ *  each thread works on a copy of the plan so the stores do not force it to be reloaded
+ */
+template<typename L, bool pass = L::kPacket>
+struct MultiAssignCPUEngine {
+  inline static void Map(const L &list, Shape<2> shape, int nthread) {
+    const MultiAssignPlan<L> plan(list);
+    const index_t nblock = (nthread <= 1 || shape[0] >= static_cast<index_t>(nthread)) ?
+        1 : (nthread + shape[0] - 1) / shape[0];
+    const index_t bsize = (shape[1] + nblock - 1) / nblock;
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t i = 0; i < shape[0] * nblock; ++i) {
+      const index_t y = static_cast<index_t>(i) / nblock;
+      const index_t xbegin = (static_cast<index_t>(i) % nblock) * bsize;
+      const index_t xend = std::min(xbegin + bsize, shape[1]);
+      MultiAssignPlan<L> p = plan;
+      for (index_t x = xbegin; x < xend; ++x) p.Map(y, x);
+    }
+  }
+};
+template<typename L>
+struct MultiAssignCPUEngine<L, true> {
+  inline static void Map(const L &list, Shape<2> shape, int nthread) {
+    if (!list.PacketAligned()) {
+      MultiAssignCPUEngine<L, false>::Map(list, shape, nthread);
+      return;
+    }
+    typedef typename L::DataType DType;
+    const packet::PacketArch Arch = MSHADOW_DEFAULT_PACKET;
+    const MultiAssignPacketPlan<L, Arch> plan(list);
+    const index_t xlen = packet::LowerAlign<DType, Arch>(shape[1]);
+    const index_t nblock = (nthread <= 1 || shape[0] >= static_cast<index_t>(nthread)) ?
+        1 : (nthread + shape[0] - 1) / shape[0];
+    const index_t bsize = packet::UpperAlign<DType, Arch>((shape[1] + nblock - 1) / nblock);
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t i = 0; i < shape[0] * nblock; ++i) {
+      const index_t y = static_cast<index_t>(i) / nblock;
+      const index_t xbegin = (static_cast<index_t>(i) % nblock) * bsize;
+      const index_t xend = std::min(xbegin + bsize, shape[1]);
+      const MultiAssignPacketPlan<L, Arch> p = plan;
+      index_t x = xbegin;
+      for (; x < std::min(xend, xlen); x += packet::Packet<DType, Arch>::kSize) {
+        p.MapPacket(y, x);
+      }
+      for (; x < xend; ++x) p.Map(y, x);
+    }
+  }
+};
+}  // namespace expr
+/*!
+ * \brief CPU: run a list of assignments built by MapMulti
+ * \param list the assignments
+ * \param stream the stream of the first destination
+ */
+template<typename L>
+inline void MapMulti(const L &list, Stream<cpu> *stream) {
+  WaitPushedTasks(stream);
+  const Shape<L::kDim> shape = list.shape();
+  list.Check(shape);
+  expr::MultiAssignCPUEngine<L>::Map(list, shape.FlatTo2D(),
+                                     GetNumParallelThread(stream, shape.Size()));
+}
+/*!
+ * \brief GPU: run a list of assignments built by MapMulti in one kernel,
+ *  defined in tensor_gpu-inl.h
+ */
+template<typename L>
+inline void MapMulti(const L &list, Stream<gpu> *stream);
+/*!
+ * \brief CPU/GPU: evaluate the assignments made by expr::assign in a single pass,
+ *  at every element the assignments run in order, so an expression can read a destination
+ *  assigned before it at the element being written, e.g. the moments of an Adam update
+ *  \code
+ *  MapMulti(assign<sv::saveto>(m, b1 * m + (1.0f - b1) * g),
+ *           assign<sv::saveto>(v, b2 * v + (1.0f - b2) * g * g),
+ *           assign<sv::minusto>(w, lr * m / (F<op::sqrt>(v) + eps)));
+ *  \endcode
+ *  the destinations must have the same shape and must not be read at other elements
+ * \param p1 the first assignment
+ * \param p2 the second assignment
+ */
+template<typename P1, typename P2>
+inline void MapMulti(const P1 &p1, const P2 &p2) {
+  const expr::MultiAssign<P1, P2> list(p1, p2);
+  MapMulti(list, list.stream());
+}
+/*! \brief CPU/GPU: evaluate three assignments in a single pass, see MapMulti */
+template<typename P1, typename P2, typename P3>
+inline void MapMulti(const P1 &p1, const P2 &p2, const P3 &p3) {
+  typedef expr::MultiAssign<P2, P3> Tail;
+  const expr::MultiAssign<P1, Tail> list(p1, Tail(p2, p3));
+  MapMulti(list, list.stream());
+}
+/*! \brief CPU/GPU: evaluate four assignments in a single pass, see MapMulti */
+template<typename P1, typename P2, typename P3, typename P4>
+inline void MapMulti(const P1 &p1, const P2 &p2, const P3 &p3, const P4 &p4) {
+  typedef expr::MultiAssign<P3, P4> Tail2;
+  typedef expr::MultiAssign<P2, Tail2> Tail1;
+  const expr::MultiAssign<P1, Tail1> list(p1, Tail1(p2, Tail2(p3, p4)));
+  MapMulti(list, list.stream());
+}
+}  // namespace mshadow
+#endif  // MSHADOW_EXTENSION_MULTI_ASSIGN_H_
@@ -7,6 +7,7 @@
 #ifndef MSHADOW_EXTENSION_PACK_COL2PATCH_H_
 #define MSHADOW_EXTENSION_PACK_COL2PATCH_H_
 #include <algorithm>
+#include <vector>
 #include "../extension.h"
 namespace mshadow {
 namespace expr {
@@ -98,6 +99,88 @@ pack_col2patch(const expr::Exp<SrcExp, DType, etype> &src,
                                                    pdilate_y, pdilate_x);
 }
 
+/*! \brief step between the taps of a patch dimension that read the same position */
+inline index_t PatchTapStep(index_t pstride, index_t pdilate) {
+  index_t a = pstride, b = pdilate;
+  while (b != 0) {
+    const index_t t = a % b; a = b; b = t;
+  }
+  return pstride / a;
+}
+/*!
+ * \brief the taps k of a patch dimension that read position y, those with
+ *  y = p * pstride + k * pdilate for a patch 0 <= p < osize and 0 <= k < psize.
+ *  They are begin, begin + kstep, ... up to *end, the patch of tap k is
+ *  (y - k * pdilate) / pstride.
+ * \param kstep PatchTapStep(pstride, pdilate)
+ * \return begin, equal to *end if no tap reads y
+ */
+MSHADOW_XINLINE index_t PatchTapBegin(index_t y, index_t psize, index_t pstride,
+                                      index_t pdilate, index_t kstep, index_t osize,
+                                      index_t *end) {
+  *end = y / pdilate + 1 < psize ? y / pdilate + 1 : psize;
+  // the patch must be below osize
+  const index_t last = (osize - 1) * pstride;
+  index_t k = y > last ? (y - last + pdilate - 1) / pdilate : 0;
+  const index_t lim = k + kstep < *end ? k + kstep : *end;
+  while (k < lim && (y - k * pdilate) % pstride != 0) ++k;
+  return k < lim ? k : *end;
+}
+/*!
+ * \brief CPU: img = pack_col2patch(col), saved with SV. The taps of each column are
+ *  found once and shared by all the rows, each row finds its taps once, so the taps
+ *  are gathered without testing the patches that do not cover the pixel.
+ * \param img the image, (batch, channel, height, width)
+ * \param col the columns, (channel * psize_y * psize_x, batch * o_height * o_width)
+ */
+template<typename SV, typename DType>
+inline void PackColToPatch(Tensor<cpu, 4, DType> img, const Tensor<cpu, 2, DType> &col,
+                           index_t psize_y, index_t psize_x,
+                           index_t pstride_y, index_t pstride_x,
+                           index_t pdilate_y, index_t pdilate_x) {
+  const index_t nchannel = img.size(1), height = img.size(2), width = img.size(3);
+  const index_t o_height = (height - (pdilate_y * (psize_y - 1) + 1)) / pstride_y + 1;
+  const index_t o_width = (width - (pdilate_x * (psize_x - 1) + 1)) / pstride_x + 1;
+  const index_t kstep_y = PatchTapStep(pstride_y, pdilate_y);
+  const index_t kstep_x = PatchTapStep(pstride_x, pdilate_x);
+  const index_t nrow = img.size(0) * nchannel * height;
+  if (nrow == 0 || width == 0) return;
+  std::vector<index_t> kx_begin(width), kx_end(width);
+  for (index_t x = 0; x < width; ++x) {
+    kx_begin[x] = PatchTapBegin(x, psize_x, pstride_x, pdilate_x, kstep_x, o_width,
+                                &kx_end[x]);
+  }
+  const int nthread = GetNumParallelThread(img.stream_, img.shape_.Size());
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t r = 0; r < nrow; ++r) {
+    const index_t y = r % height, c = r / height % nchannel, n = r / height / nchannel;
+    DType *irow = img.dptr_ + r * img.stride_;
+    index_t ky_end;
+    const index_t ky_begin = PatchTapBegin(y, psize_y, pstride_y, pdilate_y, kstep_y,
+                                           o_height, &ky_end);
+    for (index_t x = 0; x < width; ++x) {
+      DType res = static_cast<DType>(0);
+      for (index_t ky = ky_begin; ky < ky_end; ky += kstep_y) {
+        const index_t py = (y - ky * pdilate_y) / pstride_y;
+        const index_t base = (n * o_height + py) * o_width;
+        for (index_t kx = kx_begin[x]; kx < kx_end[x]; kx += kstep_x) {
+          const index_t px = (x - kx * pdilate_x) / pstride_x;
+          res += col.dptr_[((c * psize_y + ky) * psize_x + kx) * col.stride_ + base + px];
+        }
+      }
+      SV::template Save<DType>(irow[x], res);
+    }
+  }
+}
+/*!
+ * \brief GPU: img = pack_col2patch(col), a thread per pixel gathers its taps without
+ *  atomics, defined in cuda/tensor_gpu-inl.cuh
+ */
+template<typename SV, typename DType>
+inline void PackColToPatch(Tensor<gpu, 4, DType> img, const Tensor<gpu, 2, DType> &col,
+                           index_t psize_y, index_t psize_x,
+                           index_t pstride_y, index_t pstride_x,
+                           index_t pdilate_y, index_t pdilate_x);
 //----------------------
 // Execution plan
 //----------------------
@@ -112,31 +195,28 @@ struct Plan<PackColToPatchXExp<SrcExp, DType, dstdim>, DType> {
        o_height_((e.shape_[dstdim - 2] - (pdilate_y_ * (psize_y_ - 1) + 1)) /
                pstride_y_ + 1),
        o_width_((e.shape_[dstdim - 1] - (pdilate_x_ * (psize_x_ - 1) + 1)) /
-               pstride_x_ + 1) {
+               pstride_x_ + 1),
+       kstep_y_(PatchTapStep(e.pstride_y_, e.pdilate_y_)),
+       kstep_x_(PatchTapStep(e.pstride_x_, e.pdilate_x_)) {
     // note: i/o convention are same as unpack
   }
   MSHADOW_XINLINE DType Eval(index_t i, index_t j) const {
-    using namespace std;
     const index_t y = i % i_height_;
     const index_t idivh = i / i_height_;
     const index_t c = idivh % i_channel_;
     const index_t n = idivh / i_channel_;
     const index_t x = j;
-
-    const index_t psize_y_dilate = (pdilate_y_ * (psize_y_ - 1) + 1);
-    const index_t psize_x_dilate = (pdilate_x_ * (psize_x_ - 1) + 1);
-
-    const index_t py_min =
-        y < psize_y_dilate ? y % pdilate_y_ : (y-psize_y_dilate + pstride_y_) / pstride_y_;
-    const index_t px_min =
-        x < psize_x_dilate ? x % pdilate_x_ : (x-psize_x_dilate + pstride_x_) / pstride_x_;
-    const index_t py_max = min((y + pstride_y_) / pstride_y_, o_height_);
-    const index_t px_max = min((x + pstride_x_) / pstride_x_, o_width_);
+    index_t ky_end, kx_end;
+    const index_t ky_begin = PatchTapBegin(y, psize_y_, pstride_y_, pdilate_y_, kstep_y_,
+                                           o_height_, &ky_end);
+    const index_t kx_begin = PatchTapBegin(x, psize_x_, pstride_x_, pdilate_x_, kstep_x_,
+                                           o_width_, &kx_end);
     DType res = static_cast<DType>(0);
-    for (index_t py = py_min; py < py_max; py += pdilate_y_) {
-      for (index_t px = px_min; px < px_max; px += pdilate_x_) {
-        res += src_.Eval(((c * psize_y_ + (y - py*pstride_y_) / pdilate_y_) * psize_x_ +
-                         (x - px * pstride_x_) / pdilate_x_),
+    for (index_t ky = ky_begin; ky < ky_end; ky += kstep_y_) {
+      const index_t py = (y - ky * pdilate_y_) / pstride_y_;
+      for (index_t kx = kx_begin; kx < kx_end; kx += kstep_x_) {
+        const index_t px = (x - kx * pdilate_x_) / pstride_x_;
+        res += src_.Eval((c * psize_y_ + ky) * psize_x_ + kx,
                          (n * o_height_ + py) * o_width_ + px);
       }
     }
@@ -148,6 +228,29 @@ struct Plan<PackColToPatchXExp<SrcExp, DType, dstdim>, DType> {
   const index_t psize_y_, psize_x_, pstride_y_, pstride_x_, i_channel_;
   const index_t pdilate_y_, pdilate_x_;
   const index_t i_height_, o_height_, o_width_;
+  const index_t kstep_y_, kstep_x_;
+};
+/*! \brief pack_col2patch of a plain tensor into a tensor goes through the direct kernel */
+template<typename SV, typename Device, typename DType, int dstdim>
+struct MapExpDirectEngine<SV, Tensor<Device, dstdim, DType>,
+                          MakeTensorExp<PackColToPatchXExp<Tensor<Device, 2, DType>,
+                                                           DType, dstdim>,
+                                        Tensor<Device, 2, DType>, dstdim, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, dstdim, DType> *dst,
+                         const MakeTensorExp<PackColToPatchXExp<Tensor<Device, 2, DType>,
+                                                                DType, dstdim>,
+                                             Tensor<Device, 2, DType>, dstdim, DType> &exp) {
+    const PackColToPatchXExp<Tensor<Device, 2, DType>, DType, dstdim> &e = exp.real_self();
+    Tensor<Device, 4, DType> img(dst->dptr_,
+                                 Shape4(dst->shape_.ProdShape(0, dstdim - 3),
+                                        dst->size(dstdim - 3), dst->size(dstdim - 2),
+                                        dst->size(dstdim - 1)),
+                                 dst->stride_, dst->stream_);
+    PackColToPatch<SV>(img, e.src_, e.psize_y_, e.psize_x_, e.pstride_y_, e.pstride_x_,
+                       e.pdilate_y_, e.pdilate_x_);
+    return true;
+  }
 };
 }  // namespace expr
 }  // namespace mshadow
@@ -0,0 +1,276 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file quantize.h
+ * \brief affine quantization, real = scale * (q - zero_point), with uint8/int8 tensors:
+ *  quantize and dequantize expressions, and the uint8 x int8 -> int32 dot
+ *  with its output optionally requantized as it is saved
+ */
+#ifndef MSHADOW_EXTENSION_QUANTIZE_H_
+#define MSHADOW_EXTENSION_QUANTIZE_H_
+#include <cmath>
+#include "../extension.h"
+#include "../gemm_cpu-inl.h"
+
+namespace mshadow {
+namespace expr {
+/*!
+ * \brief convert a real value, already divided by the scale, to DType:
+ *  rounded to nearest, offset by the zero point and saturated for the integer types
+ * \tparam DType uint8_t, int8_t or float, float is kept as is
+ */
+template<typename DType>
+struct QuantizeValue {
+  MSHADOW_XINLINE static DType Map(float x, int32_t zero_point) {
+    return DType(x);
+  }
+};
+template<>
+struct QuantizeValue<uint8_t> {
+  MSHADOW_XINLINE static uint8_t Map(float x, int32_t zero_point) {
+    const float q = rintf(x) + static_cast<float>(zero_point);
+    return static_cast<uint8_t>(q < 0.0f ? 0.0f : (q > 255.0f ? 255.0f : q));
+  }
+};
+template<>
+struct QuantizeValue<int8_t> {
+  MSHADOW_XINLINE static int8_t Map(float x, int32_t zero_point) {
+    const float q = rintf(x) + static_cast<float>(zero_point);
+    return static_cast<int8_t>(q < -128.0f ? -128.0f : (q > 127.0f ? 127.0f : q));
+  }
+};
+/*!
+ * \brief quantize a real expression
+ * \tparam SrcExp source expression
+ * \tparam SrcDType type of the source
+ * \tparam DType uint8_t or int8_t
+ */
+template<typename SrcExp, typename SrcDType, typename DType>
+struct QuantizeExp:
+      public Exp<QuantizeExp<SrcExp, SrcDType, DType>, DType, type::kChainer> {
+  /*! \brief source operand */
+  const SrcExp &src_;
+  /*! \brief 1 / scale */
+  float inv_scale_;
+  /*! \brief zero point */
+  int32_t zero_point_;
+  /*! \brief constructor */
+  QuantizeExp(const SrcExp &src, float scale, int32_t zero_point)
+      : src_(src), inv_scale_(1.0f / scale), zero_point_(zero_point) {}
+};
+/*!
+ * \brief q = saturate(round(x / scale) + zero_point)
+ * \param src real valued expression
+ * \param scale real value of one step of q
+ * \param zero_point q of real value 0
+ * \tparam DType uint8_t or int8_t
+ */
+template<typename DType, typename SrcExp, typename SrcDType, int etype>
+inline QuantizeExp<SrcExp, SrcDType, DType>
+quantize(const Exp<SrcExp, SrcDType, etype> &src, float scale, int32_t zero_point) {
+  return QuantizeExp<SrcExp, SrcDType, DType>(src.self(), scale, zero_point);
+}
+/*!
+ * \brief dequantize a quantized expression to float
+ * \tparam SrcExp source expression
+ * \tparam SrcDType type of the source
+ */
+template<typename SrcExp, typename SrcDType>
+struct DequantizeExp:
+      public Exp<DequantizeExp<SrcExp, SrcDType>, float, type::kChainer> {
+  /*! \brief source operand */
+  const SrcExp &src_;
+  /*! \brief scale */
+  float scale_;
+  /*! \brief zero point */
+  int32_t zero_point_;
+  /*! \brief constructor */
+  DequantizeExp(const SrcExp &src, float scale, int32_t zero_point)
+      : src_(src), scale_(scale), zero_point_(zero_point) {}
+};
+/*!
+ * \brief x = scale * (q - zero_point)
+ * \param src quantized expression
+ * \param scale real value of one step of q
+ * \param zero_point q of real value 0
+ */
+template<typename SrcExp, typename SrcDType, int etype>
+inline DequantizeExp<SrcExp, SrcDType>
+dequantize(const Exp<SrcExp, SrcDType, etype> &src, float scale, int32_t zero_point) {
+  return DequantizeExp<SrcExp, SrcDType>(src.self(), scale, zero_point);
+}
+//----------------------
+// Execution plan
+//----------------------
+template<typename SrcExp, typename SrcDType, typename DType>
+struct Plan<QuantizeExp<SrcExp, SrcDType, DType>, DType> {
+ public:
+  explicit Plan(const QuantizeExp<SrcExp, SrcDType, DType> &e)
+      : src_(MakePlan(e.src_)), inv_scale_(e.inv_scale_), zero_point_(e.zero_point_) {}
+  MSHADOW_XINLINE DType Eval(index_t y, index_t x) const {
+    return QuantizeValue<DType>::Map(static_cast<float>(src_.Eval(y, x)) * inv_scale_,
+                                     zero_point_);
+  }
+
+ private:
+  expr::Plan<SrcExp, SrcDType> src_;
+  const float inv_scale_;
+  const int32_t zero_point_;
+};
+template<typename SrcExp, typename SrcDType>
+struct Plan<DequantizeExp<SrcExp, SrcDType>, float> {
+ public:
+  explicit Plan(const DequantizeExp<SrcExp, SrcDType> &e)
+      : src_(MakePlan(e.src_)), scale_(e.scale_), zero_point_(e.zero_point_) {}
+  MSHADOW_XINLINE float Eval(index_t y, index_t x) const {
+    return scale_ * static_cast<float>(static_cast<int32_t>(src_.Eval(y, x)) - zero_point_);
+  }
+
+ private:
+  expr::Plan<SrcExp, SrcDType> src_;
+  const float scale_;
+  const int32_t zero_point_;
+};
+template<typename SrcExp, typename SrcDType, typename DType>
+inline Plan<QuantizeExp<SrcExp, SrcDType, DType>, DType>
+MakePlan(const QuantizeExp<SrcExp, SrcDType, DType> &exp) {
+  return Plan<QuantizeExp<SrcExp, SrcDType, DType>, DType>(exp);
+}
+template<typename SrcExp, typename SrcDType>
+inline Plan<DequantizeExp<SrcExp, SrcDType>, float>
+MakePlan(const DequantizeExp<SrcExp, SrcDType> &exp) {
+  return Plan<DequantizeExp<SrcExp, SrcDType>, float>(exp);
+}
+template<int dim, typename SrcExp, typename SrcDType, typename DType>
+struct ShapeCheck<dim, QuantizeExp<SrcExp, SrcDType, DType> > {
+  inline static Shape<dim> Check(const QuantizeExp<SrcExp, SrcDType, DType> &t) {
+    return ShapeCheck<dim, SrcExp>::Check(t.src_);
+  }
+};
+template<int dim, typename SrcExp, typename SrcDType>
+struct ShapeCheck<dim, DequantizeExp<SrcExp, SrcDType> > {
+  inline static Shape<dim> Check(const DequantizeExp<SrcExp, SrcDType> &t) {
+    return ShapeCheck<dim, SrcExp>::Check(t.src_);
+  }
+};
+template<typename SrcExp, typename SrcDType, typename DType>
+struct ExpInfo<QuantizeExp<SrcExp, SrcDType, DType> > {
+  static const int kDim = ExpInfo<SrcExp>::kDim;
+  static const int kDevMask = ExpInfo<SrcExp>::kDevMask;
+};
+template<typename SrcExp, typename SrcDType>
+struct ExpInfo<DequantizeExp<SrcExp, SrcDType> > {
+  static const int kDim = ExpInfo<SrcExp>::kDim;
+  static const int kDevMask = ExpInfo<SrcExp>::kDevMask;
+};
+/*!
+ * \brief int32 product of a uint8 and an int8 matrix
+ */
+struct QuantizedDotExp:
+      public Exp<QuantizedDotExp, int32_t, type::kComplex> {
+  /*! \brief left operand */
+  const Tensor<cpu, 2, uint8_t> &lhs_;
+  /*! \brief right operand */
+  const Tensor<cpu, 2, int8_t> &rhs_;
+  /*! \brief zero point of lhs */
+  int32_t lhs_zero_point_;
+  /*! \brief constructor */
+  QuantizedDotExp(const Tensor<cpu, 2, uint8_t> &lhs, const Tensor<cpu, 2, int8_t> &rhs,
+                  int32_t lhs_zero_point)
+      : lhs_(lhs), rhs_(rhs), lhs_zero_point_(lhs_zero_point) {}
+};
+/*!
+ * \brief dst[i][j] = sum_k (lhs[i][k] - lhs_zero_point) * rhs[k][j], exact in int32
+ * \param lhs uint8 activations
+ * \param rhs int8 weights, symmetric
+ * \param lhs_zero_point zero point of lhs
+ */
+inline QuantizedDotExp dot(const Tensor<cpu, 2, uint8_t> &lhs,
+                           const Tensor<cpu, 2, int8_t> &rhs,
+                           int32_t lhs_zero_point = 0) {
+  return QuantizedDotExp(lhs, rhs, lhs_zero_point);
+}
+/*!
+ * \brief a quantized dot whose int32 result is converted to DType as it is saved
+ * \tparam DType uint8_t, int8_t or float
+ */
+template<typename DType>
+struct RequantizeExp:
+      public Exp<RequantizeExp<DType>, DType, type::kComplex> {
+  /*! \brief the product */
+  const QuantizedDotExp &dot_;
+  /*! \brief real value of one step of the int32 result, divided by the output scale */
+  float multiplier_;
+  /*! \brief zero point of the output */
+  int32_t zero_point_;
+  /*! \brief constructor */
+  RequantizeExp(const QuantizedDotExp &dot, float multiplier, int32_t zero_point)
+      : dot_(dot), multiplier_(multiplier), zero_point_(zero_point) {}
+};
+/*!
+ * \brief dst = saturate(round(dot * multiplier) + zero_point), fused into the gemm.
+ *  For lhs scale sa, rhs scale sb and output scale so the multiplier is sa * sb / so,
+ *  with DType float and multiplier sa * sb it dequantizes the product
+ * \code
+ *  out = requantize<uint8_t>(dot(act, weight, act_zero), sa * sb / so, out_zero);
+ * \endcode
+ */
+template<typename DType>
+inline RequantizeExp<DType>
+requantize(const QuantizedDotExp &dot, float multiplier, int32_t zero_point = 0) {
+  return RequantizeExp<DType>(dot, multiplier, zero_point);
+}
+/*! \brief saves the rows of the int32 product into a tensor */
+template<typename SV, typename DType>
+struct QuantizedDotSaver {
+  Tensor<cpu, 2, DType> dst;
+  float multiplier;
+  int32_t zero_point;
+  inline void operator()(index_t i, const int32_t *row) const {
+    DType *d = dst[i].dptr_;
+    for (index_t j = 0; j < dst.size(1); ++j) {
+      SV::Save(d[j], QuantizeValue<DType>::Map(static_cast<float>(row[j]) * multiplier,
+                                               zero_point));
+    }
+  }
+};
+template<typename SV>
+struct QuantizedDotSaver<SV, int32_t> {
+  Tensor<cpu, 2, int32_t> dst;
+  float multiplier;
+  int32_t zero_point;
+  inline void operator()(index_t i, const int32_t *row) const {
+    int32_t *d = dst[i].dptr_;
+    for (index_t j = 0; j < dst.size(1); ++j) SV::Save(d[j], row[j]);
+  }
+};
+template<typename SV, typename DType>
+inline void QuantizedDot(Tensor<cpu, 2, DType> *dst, const QuantizedDotExp &exp,
+                         float multiplier, int32_t zero_point) {
+  const Tensor<cpu, 2, uint8_t> &lhs = exp.lhs_;
+  const Tensor<cpu, 2, int8_t> &rhs = exp.rhs_;
+  CHECK(dst->size(0) == lhs.size(0) && dst->size(1) == rhs.size(1) &&
+        lhs.size(1) == rhs.size(0))
+      << "dot-int8: matrix shape mismatch";
+  QuantizedDotSaver<SV, DType> out;
+  out.dst = *dst;
+  out.multiplier = multiplier;
+  out.zero_point = zero_point;
+  gemm::GemmU8S8S32(dst->stream_, lhs.size(0), rhs.size(1), lhs.size(1),
+                    lhs.dptr_, lhs.stride_, exp.lhs_zero_point_,
+                    rhs.dptr_, rhs.stride_, out);
+}
+template<typename SV>
+struct ExpComplexEngine<SV, Tensor<cpu, 2, int32_t>, QuantizedDotExp, int32_t> {
+  inline static void Eval(Tensor<cpu, 2, int32_t> *dst, const QuantizedDotExp &exp) {
+    QuantizedDot<SV>(dst, exp, 1.0f, 0);
+  }
+};
+template<typename SV, typename DType>
+struct ExpComplexEngine<SV, Tensor<cpu, 2, DType>, RequantizeExp<DType>, DType> {
+  inline static void Eval(Tensor<cpu, 2, DType> *dst, const RequantizeExp<DType> &exp) {
+    QuantizedDot<SV>(dst, exp.dot_, exp.multiplier_, exp.zero_point_);
+  }
+};
+}  // namespace expr
+}  // namespace mshadow
+#endif  // MSHADOW_EXTENSION_QUANTIZE_H_
@@ -100,18 +100,29 @@ struct Plan<ReduceWithAxisExp<Reducer, SrcExp, DType, dimsrc, mask, dimdst>, DTy
  public:
   explicit Plan(const ReduceWithAxisExp<Reducer, SrcExp, DType, dimsrc, mask, dimdst> &e)
       : src_(MakePlan(e.src_)), last_dst_dim_(e.last_dst_dim_), trailing_(e.trailing_),
-        size_(e.size_), last_(e.last_) {}
+        size_(e.size_), last_(e.last_) {
+    // the axis either runs along the rows of the 2D source or along one row,
+    // so the source coordinates advance by a constant step instead of being divided
+    if (last_ != 0 && trailing_ % last_ == 0) {
+      rstep_ = trailing_ / last_; cstep_ = 0; generic_ = false;
+    } else if (trailing_ == 1 && size_ == last_) {
+      rstep_ = 0; cstep_ = 1; generic_ = false;
+    } else {
+      rstep_ = 0; cstep_ = 0; generic_ = true;
+    }
+  }
   MSHADOW_XINLINE DType Eval(index_t i, index_t j) const {
     index_t x = (i*last_dst_dim_ + j)/trailing_;
     index_t y = (i*last_dst_dim_ + j)%trailing_;
+    const index_t z0 = x*size_*trailing_+y;
+    const index_t row = generic_ ? 0 : z0/last_, col = generic_ ? 0 : z0%last_;
 
     if (mask) {
       index_t idx = 0;
       DType res; Reducer::SetInitValue(res);
       for (index_t k = 0; k < size_; ++k) {
-        index_t z = (x*size_+k)*trailing_+y;
         DType tmp = res;
-        Reducer::Reduce(res, src_.Eval(z/last_, z%last_));
+        Reducer::Reduce(res, this->EvalSrc(z0, row, col, k));
         if (tmp != res) {
           idx = k;
         }
@@ -120,16 +131,69 @@ struct Plan<ReduceWithAxisExp<Reducer, SrcExp, DType, dimsrc, mask, dimdst>, DTy
     } else {
       DType res; Reducer::SetInitValue(res);
       for (index_t k = 0; k < size_; ++k) {
-        index_t z = (x*size_+k)*trailing_+y;
-        Reducer::Reduce(res, src_.Eval(z/last_, z%last_));
+        Reducer::Reduce(res, this->EvalSrc(z0, row, col, k));
       }
       return res;
     }
   }
 
  private:
+  /*! \brief the k-th element along the axis, z0 is the flat index of the first one */
+  MSHADOW_XINLINE DType EvalSrc(index_t z0, index_t row, index_t col, index_t k) const {
+    if (generic_) {
+      const index_t z = z0 + k*trailing_;
+      return src_.Eval(z/last_, z%last_);
+    }
+    return src_.Eval(row + k*rstep_, col + k*cstep_);
+  }
   Plan<SrcExp, DType> src_;
   const index_t last_dst_dim_, trailing_, size_, last_;
+  index_t rstep_, cstep_;
+  bool generic_;
+};
+}  // namespace expr
+/*!
+ * \brief CPU: reduce a plain tensor along one axis, src and dst are the flattened 2D views,
+ *  src is read as (outer, size, trailing) and dst as (outer, trailing).
+ *  Reducing the last axis reduces each source row with the packet row kernel,
+ *  other axes reduce the strided rows of each output row in cache sized column tiles.
+ *  Defined in tensor_cpu-inl.h
+ * \tparam mask whether to save the index of the result along the axis instead of the result
+ */
+template<typename SV, typename Reducer, bool mask, typename DType>
+inline void ReduceWithAxis(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 2, DType> &src,
+                           index_t size, index_t trailing);
+/*!
+ * \brief GPU: reduce a plain tensor along one axis, a warp reduces each row when the
+ *  axis is the last one, otherwise the threads of a block cover consecutive columns
+ *  and split the axis among them, defined in tensor_gpu-inl.h
+ */
+template<typename SV, typename Reducer, bool mask, typename DType>
+inline void ReduceWithAxis(Tensor<gpu, 2, DType> dst, const Tensor<gpu, 2, DType> &src,
+                           index_t size, index_t trailing);
+namespace expr {
+/*! \brief reducing a plain tensor with axis goes through the direct kernels */
+template<typename SV, typename Device, typename Reducer, typename DType,
+         int dimsrc, bool mask, int dimdst>
+struct MapExpDirectEngine<SV, Tensor<Device, dimdst, DType>,
+                          MakeTensorExp<ReduceWithAxisExp<Reducer, Tensor<Device, dimsrc, DType>,
+                                                          DType, dimsrc, mask, dimdst>,
+                                        Tensor<Device, dimsrc, DType>, dimdst, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, dimdst, DType> *dst,
+                         const MakeTensorExp<ReduceWithAxisExp<Reducer,
+                                                               Tensor<Device, dimsrc, DType>,
+                                                               DType, dimsrc, mask, dimdst>,
+                                             Tensor<Device, dimsrc, DType>,
+                                             dimdst, DType> &exp) {
+    const ReduceWithAxisExp<Reducer, Tensor<Device, dimsrc, DType>,
+                            DType, dimsrc, mask, dimdst> &e = exp.real_self();
+    // an empty axis only produces the initial values, left to the plan
+    if (e.size_ == 0) return false;
+    if (dst->shape_.Size() == 0) return true;
+    ReduceWithAxis<SV, Reducer, mask>(dst->FlatTo2D(), e.src_.FlatTo2D(), e.size_, e.trailing_);
+    return true;
+  }
 };
 }  // namespace expr
 }  // namespace mshadow
@@ -7,6 +7,7 @@
 #ifndef MSHADOW_EXTENSION_SPATIAL_POOL_H_
 #define MSHADOW_EXTENSION_SPATIAL_POOL_H_
 #include <algorithm>
+#include <vector>
 #include "../extension.h"
 namespace mshadow {
 namespace expr {
@@ -147,6 +148,182 @@ struct Plan<PoolingExp< Reducer, SrcExp, DType, srcdim>, DType> {
   const index_t src_height_, src_width_;
   const index_t new_height_;
 };
+/*!
+ * \brief reduction of one pooling tap; for sum and max it is written without volatile,
+ *  so the loops over a row can be vectorized
+ */
+template<typename Reducer>
+struct PoolTapReducer {
+  template<typename DType>
+  MSHADOW_XINLINE static void Reduce(DType &dst, DType src) { // NOLINT(*)
+    Reducer::Reduce(dst, src);
+  }
+};
+template<>
+struct PoolTapReducer<red::sum> {
+  template<typename DType>
+  MSHADOW_XINLINE static void Reduce(DType &dst, DType src) { // NOLINT(*)
+    dst += src;
+  }
+};
+template<>
+struct PoolTapReducer<red::maximum> {
+  template<typename DType>
+  MSHADOW_XINLINE static void Reduce(DType &dst, DType src) { // NOLINT(*)
+    dst = dst < src ? src : dst;
+  }
+};
+/*! \brief view a tensor as a stack of 2D planes (nplane, height, width) */
+template<typename Device, int dim, typename DType>
+inline Tensor<Device, 3, DType> PoolPlanes(const Tensor<Device, dim, DType> &t) {
+  return Tensor<Device, 3, DType>(t.dptr_, Shape3(t.shape_.ProdShape(0, dim - 2),
+                                                  t.size(dim - 2), t.size(dim - 1)),
+                                  t.stride_, t.stream_);
+}
+/*!
+ * \brief CPU: pool each plane of src into dst, saved with SV.
+ *  Each source row is first reduced over the x window of every output column,
+ *  the rows of partial results are then reduced over the y window, so the taps shared
+ *  by overlapping windows are read once per row instead of once per window.
+ * \param dst pooled planes
+ * \param index if with_index, offset y * width + x of the maximum in the source plane,
+ *  the first one in row major order on ties
+ * \param src source planes
+ * \tparam with_index whether to record the argmax, only valid with red::maximum
+ */
+template<typename SV, typename Reducer, bool with_index, typename DType, typename IType>
+inline void Pool(Tensor<cpu, 3, DType> dst, Tensor<cpu, 3, IType> index,
+                 const Tensor<cpu, 3, DType> &src,
+                 index_t ksize_y, index_t ksize_x, index_t kstride_y, index_t kstride_x) {
+  WaitPushedTasks(dst.stream_);
+  const index_t nplane = src.size(0), height = src.size(1), width = src.size(2);
+  const index_t pheight = dst.size(1), pwidth = dst.size(2);
+  if (nplane == 0 || pheight == 0 || pwidth == 0) return;
+  // rows of the source covered by some window
+  const index_t nrow = std::min(height, (pheight - 1) * kstride_y + ksize_y);
+  const index_t nthread = std::min(static_cast<index_t>(
+      GetNumParallelThread(dst.stream_, src.shape_.Size())), nplane);
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t tid = 0; tid < nthread; ++tid) {
+    std::vector<DType> hval(nrow * pwidth), acc(pwidth);
+    std::vector<index_t> hidx(with_index ? nrow * pwidth : 0), accidx(with_index ? pwidth : 0);
+    const index_t cbegin = nplane * tid / nthread, cend = nplane * (tid + 1) / nthread;
+    for (index_t c = cbegin; c < cend; ++c) {
+      for (index_t y = 0; y < nrow; ++y) {
+        const DType *srow = src.dptr_ + (c * height + y) * src.stride_;
+        DType *hrow = &hval[y * pwidth];
+        for (index_t px = 0; px < pwidth; ++px) {
+          const index_t x_start = px * kstride_x;
+          const index_t x_end = std::min(x_start + ksize_x, width);
+          DType res; Reducer::SetInitValue(res);
+          if (with_index) {
+            index_t best = x_start;
+            for (index_t x = x_start; x < x_end; ++x) {
+              if (res < srow[x]) {
+                res = srow[x]; best = x;
+              }
+            }
+            hidx[y * pwidth + px] = best;
+          } else {
+            for (index_t x = x_start; x < x_end; ++x) {
+              PoolTapReducer<Reducer>::Reduce(res, srow[x]);
+            }
+          }
+          hrow[px] = res;
+        }
+      }
+      for (index_t py = 0; py < pheight; ++py) {
+        const index_t y_start = py * kstride_y;
+        const index_t y_end = std::min(y_start + ksize_y, height);
+        for (index_t px = 0; px < pwidth; ++px) Reducer::SetInitValue(acc[px]);
+        if (with_index) {
+          for (index_t px = 0; px < pwidth; ++px) {
+            accidx[px] = y_start * width + px * kstride_x;
+          }
+          for (index_t y = y_start; y < y_end; ++y) {
+            const DType *hrow = &hval[y * pwidth];
+            for (index_t px = 0; px < pwidth; ++px) {
+              if (acc[px] < hrow[px]) {
+                acc[px] = hrow[px]; accidx[px] = y * width + hidx[y * pwidth + px];
+              }
+            }
+          }
+          IType *irow = index.dptr_ + (c * pheight + py) * index.stride_;
+          for (index_t px = 0; px < pwidth; ++px) {
+            irow[px] = static_cast<IType>(accidx[px]);
+          }
+        } else {
+          for (index_t y = y_start; y < y_end; ++y) {
+            const DType *hrow = &hval[y * pwidth];
+            for (index_t px = 0; px < pwidth; ++px) {
+              PoolTapReducer<Reducer>::Reduce(acc[px], hrow[px]);
+            }
+          }
+        }
+        DType *drow = dst.dptr_ + (c * pheight + py) * dst.stride_;
+        for (index_t px = 0; px < pwidth; ++px) SV::template Save<DType>(drow[px], acc[px]);
+      }
+    }
+  }
+}
+/*!
+ * \brief GPU: pool each plane of src into dst through shared memory tiles,
+ *  defined in cuda/tensor_gpu-inl.cuh
+ */
+template<typename SV, typename Reducer, bool with_index, typename DType, typename IType>
+inline void Pool(Tensor<gpu, 3, DType> dst, Tensor<gpu, 3, IType> index,
+                 const Tensor<gpu, 3, DType> &src,
+                 index_t ksize_y, index_t ksize_x, index_t kstride_y, index_t kstride_x);
+/*! \brief pooling of a plain tensor goes through the direct kernel */
+template<typename SV, typename Reducer, typename Device, typename DType, int srcdim>
+struct MapExpDirectEngine<SV, Tensor<Device, srcdim, DType>,
+                          MakeTensorExp<PoolingExp<Reducer, Tensor<Device, srcdim, DType>,
+                                                   DType, srcdim>,
+                                        Tensor<Device, srcdim, DType>, srcdim, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, srcdim, DType> *dst,
+                         const MakeTensorExp<PoolingExp<Reducer,
+                                                        Tensor<Device, srcdim, DType>,
+                                                        DType, srcdim>,
+                                             Tensor<Device, srcdim, DType>,
+                                             srcdim, DType> &exp) {
+    const PoolingExp<Reducer, Tensor<Device, srcdim, DType>, DType, srcdim> &e =
+        exp.real_self();
+    Tensor<Device, 3, DType> dplanes = PoolPlanes(*dst);
+    Pool<SV, Reducer, false>(dplanes, dplanes, PoolPlanes(e.src_),
+                             e.ksize_y_, e.ksize_x_, e.kstride_y_, e.kstride_x_);
+    return true;
+  }
+};
 }  // namespace expr
+/*!
+ * \brief CPU/GPU: max pooling that also records where each maximum comes from,
+ *  so UnPoolWithIndex can route the gradient without scanning the windows again
+ * \param dst pooled result, shape (..., pheight, pwidth)
+ * \param index offset y * width + x of the maximum inside its source plane,
+ *  a float index is exact for planes up to 2^24 elements
+ * \param src source, shape (..., height, width)
+ * \param ksize_y kernel size in height
+ * \param ksize_x kernel size in width
+ * \param kstride_y stride in y directory
+ * \param kstride_x stride in x directory
+ */
+template<typename Device, int dim, typename DType, typename IType>
+inline void MaxPoolWithIndex(Tensor<Device, dim, DType> dst,
+                             Tensor<Device, dim, IType> index,
+                             const Tensor<Device, dim, DType> &src,
+                             index_t ksize_y, index_t ksize_x,
+                             index_t kstride_y, index_t kstride_x) {
+  expr::TypeCheckPass<dim >= 2>::Error_Expression_Does_Not_Meet_Dimension_Req();
+  CHECK_EQ(dst.shape_, index.shape_) << "MaxPoolWithIndex: index shape mismatch";
+  for (int k = 0; k < dim - 2; ++k) {
+    CHECK_EQ(dst.size(k), src.size(k)) << "MaxPoolWithIndex: pool and src shape mismatch";
+  }
+  CHECK(src.size(dim - 1) >= ksize_x && src.size(dim - 2) >= ksize_y)
+      << "MaxPoolWithIndex: kernel must be smaller than image";
+  expr::Pool<sv::saveto, red::maximum, true>(expr::PoolPlanes(dst), expr::PoolPlanes(index),
+                                             expr::PoolPlanes(src),
+                                             ksize_y, ksize_x, kstride_y, kstride_x);
+}
 }  // namespace mshadow
 #endif  // MSHADOW_EXTENSION_SPATIAL_POOL_H_
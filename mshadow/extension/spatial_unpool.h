@@ -7,7 +7,9 @@
 #ifndef MSHADOW_EXTENSION_SPATIAL_UNPOOL_H_
 #define MSHADOW_EXTENSION_SPATIAL_UNPOOL_H_
 #include <algorithm>
+#include <vector>
 #include "../extension.h"
+#include "./spatial_pool.h"
 namespace mshadow {
 namespace expr {
 /*!
@@ -130,6 +132,160 @@ struct Plan<UnPoolingExp<Reducer, SrcExp, DType, srcdim>, DType> {
   const index_t ksize_y_, ksize_x_;
   const index_t kstride_y_, kstride_x_;
 };
+/*!
+ * \brief CPU: grad_src = unpool<Reducer>(data_src, data_pooled, grad_pooled) on planes,
+ *  saved with SV. The windows covering each column are found once and shared by all
+ *  the rows, and each row finds its windows once.
+ * \param grad_src planes of the source gradient
+ * \param data_src planes of the pooling source
+ * \param data_pooled planes of the pooled result
+ * \param grad_pooled planes of the pooled gradient
+ */
+template<typename SV, typename Reducer, typename DType>
+inline void UnPool(Tensor<cpu, 3, DType> grad_src, const Tensor<cpu, 3, DType> &data_src,
+                   const Tensor<cpu, 3, DType> &data_pooled,
+                   const Tensor<cpu, 3, DType> &grad_pooled,
+                   index_t ksize_y, index_t ksize_x, index_t kstride_y, index_t kstride_x) {
+  const index_t height = grad_src.size(1), width = grad_src.size(2);
+  const index_t pheight = grad_pooled.size(1), pwidth = grad_pooled.size(2);
+  const index_t nrow = grad_src.size(0) * height;
+  if (nrow == 0 || width == 0) return;
+  std::vector<index_t> px_begin(width), px_end(width);
+  for (index_t x = 0; x < width; ++x) {
+    px_begin[x] = x < ksize_x ? 0 : (x - ksize_x + kstride_x) / kstride_x;
+    px_end[x] = std::min((x + kstride_x) / kstride_x, pwidth);
+  }
+#ifdef _OPENMP
+  const int nthread = GetNumParallelThread(grad_src.stream_, grad_src.shape_.Size());
+#endif
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t r = 0; r < nrow; ++r) {
+    const index_t c = r / height, y = r % height;
+    const index_t py_begin = y < ksize_y ? 0 : (y - ksize_y + kstride_y) / kstride_y;
+    const index_t py_end = std::min((y + kstride_y) / kstride_y, pheight);
+    const DType *srow = data_src.dptr_ + r * data_src.stride_;
+    DType *grow = grad_src.dptr_ + r * grad_src.stride_;
+    for (index_t x = 0; x < width; ++x) {
+      const DType vsrc = srow[x];
+      DType val = static_cast<DType>(0);
+      for (index_t py = py_begin; py < py_end; ++py) {
+        const DType *prow = data_pooled.dptr_ + (c * pheight + py) * data_pooled.stride_;
+        const DType *gprow = grad_pooled.dptr_ + (c * pheight + py) * grad_pooled.stride_;
+        for (index_t px = px_begin[x]; px < px_end[x]; ++px) {
+          val += Reducer::PartialGrad(vsrc, prow[px]) * gprow[px];
+        }
+      }
+      SV::template Save<DType>(grow[x], val);
+    }
+  }
+}
+/*!
+ * \brief GPU: unpool on planes, the pooled values of the windows covering a tile of the
+ *  source are staged in shared memory, a thread per element gathers them without atomics,
+ *  defined in cuda/tensor_gpu-inl.cuh
+ */
+template<typename SV, typename Reducer, typename DType>
+inline void UnPool(Tensor<gpu, 3, DType> grad_src, const Tensor<gpu, 3, DType> &data_src,
+                   const Tensor<gpu, 3, DType> &data_pooled,
+                   const Tensor<gpu, 3, DType> &grad_pooled,
+                   index_t ksize_y, index_t ksize_x, index_t kstride_y, index_t kstride_x);
+/*! \brief unpooling of plain tensors goes through the direct kernel */
+template<typename SV, typename Reducer, typename Device, typename DType, int srcdim>
+struct MapExpDirectEngine<SV, Tensor<Device, srcdim, DType>,
+                          MakeTensorExp<UnPoolingExp<Reducer, Tensor<Device, srcdim, DType>,
+                                                     DType, srcdim>,
+                                        Tensor<Device, srcdim, DType>, srcdim, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, srcdim, DType> *dst,
+                         const MakeTensorExp<UnPoolingExp<Reducer,
+                                                          Tensor<Device, srcdim, DType>,
+                                                          DType, srcdim>,
+                                             Tensor<Device, srcdim, DType>,
+                                             srcdim, DType> &exp) {
+    const UnPoolingExp<Reducer, Tensor<Device, srcdim, DType>, DType, srcdim> &e =
+        exp.real_self();
+    UnPool<SV, Reducer>(PoolPlanes(*dst), PoolPlanes(e.data_src_),
+                        PoolPlanes(e.data_pooled_), PoolPlanes(e.grad_pooled_),
+                        e.ksize_y_, e.ksize_x_, e.kstride_y_, e.kstride_x_);
+    return true;
+  }
+};
+/*!
+ * \brief CPU: grad_src = gradient routed back through the windows of MaxPoolWithIndex
+ * \param grad_src planes of the source gradient
+ * \param index planes of the argmax recorded by MaxPoolWithIndex
+ * \param grad_pooled planes of the pooled gradient
+ */
+template<typename DType, typename IType>
+inline void UnPoolWithIndex(Tensor<cpu, 3, DType> grad_src,
+                            const Tensor<cpu, 3, IType> &index,
+                            const Tensor<cpu, 3, DType> &grad_pooled,
+                            index_t ksize_y, index_t ksize_x,
+                            index_t kstride_y, index_t kstride_x) {
+  WaitPushedTasks(grad_src.stream_);
+  const index_t nplane = grad_src.size(0), height = grad_src.size(1), width = grad_src.size(2);
+  const index_t pheight = grad_pooled.size(1), pwidth = grad_pooled.size(2);
+  if (nplane == 0) return;
+  const index_t nthread = std::min(static_cast<index_t>(
+      GetNumParallelThread(grad_src.stream_, grad_src.shape_.Size())), nplane);
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t tid = 0; tid < nthread; ++tid) {
+    const index_t cbegin = nplane * tid / nthread, cend = nplane * (tid + 1) / nthread;
+    for (index_t c = cbegin; c < cend; ++c) {
+      for (index_t y = 0; y < height; ++y) {
+        DType *grow = grad_src.dptr_ + (c * height + y) * grad_src.stride_;
+        for (index_t x = 0; x < width; ++x) grow[x] = DType(0);
+      }
+      // planes do not overlap, so the scatter needs no atomics
+      for (index_t py = 0; py < pheight; ++py) {
+        const IType *irow = index.dptr_ + (c * pheight + py) * index.stride_;
+        const DType *prow = grad_pooled.dptr_ + (c * pheight + py) * grad_pooled.stride_;
+        for (index_t px = 0; px < pwidth; ++px) {
+          const index_t i = static_cast<index_t>(irow[px]);
+          grad_src.dptr_[(c * height + i / width) * grad_src.stride_ + i % width] += prow[px];
+        }
+      }
+    }
+  }
+}
+/*!
+ * \brief GPU: each source element gathers the pooled gradients of the windows covering it
+ *  whose argmax it is, defined in cuda/tensor_gpu-inl.cuh
+ */
+template<typename DType, typename IType>
+inline void UnPoolWithIndex(Tensor<gpu, 3, DType> grad_src,
+                            const Tensor<gpu, 3, IType> &index,
+                            const Tensor<gpu, 3, DType> &grad_pooled,
+                            index_t ksize_y, index_t ksize_x,
+                            index_t kstride_y, index_t kstride_x);
 }  // namespace expr
+/*!
+ * \brief CPU/GPU: gradient of MaxPoolWithIndex, each pooled gradient goes to the single
+ *  element recorded in index. Unlike unpool<red::maximum>, the windows are not scanned
+ *  again and ties do not duplicate the gradient.
+ * \param grad_src gradient of the source, overwritten, shape (..., height, width)
+ * \param index argmax recorded by MaxPoolWithIndex, shape (..., pheight, pwidth)
+ * \param grad_pooled gradient of the pooled result, shape (..., pheight, pwidth)
+ * \param ksize_y kernel size in height
+ * \param ksize_x kernel size in width
+ * \param kstride_y stride in y directory
+ * \param kstride_x stride in x directory
+ */
+template<typename Device, int dim, typename DType, typename IType>
+inline void UnPoolWithIndex(Tensor<Device, dim, DType> grad_src,
+                            const Tensor<Device, dim, IType> &index,
+                            const Tensor<Device, dim, DType> &grad_pooled,
+                            index_t ksize_y, index_t ksize_x,
+                            index_t kstride_y, index_t kstride_x) {
+  expr::TypeCheckPass<dim >= 2>::Error_Expression_Does_Not_Meet_Dimension_Req();
+  CHECK_EQ(grad_pooled.shape_, index.shape_) << "UnPoolWithIndex: index shape mismatch";
+  for (int k = 0; k < dim - 2; ++k) {
+    CHECK_EQ(grad_pooled.size(k), grad_src.size(k))
+        << "UnPoolWithIndex: pool and src shape mismatch";
+  }
+  expr::UnPoolWithIndex(expr::PoolPlanes(grad_src), expr::PoolPlanes(index),
+                        expr::PoolPlanes(grad_pooled),
+                        ksize_y, ksize_x, kstride_y, kstride_x);
+}
 }  // namespace mshadow
 #endif  // MSHADOW_EXTENSION_SPATIAL_UNPOOL_H_
@@ -0,0 +1,209 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file swap_blocks.h
+ * \brief tiled kernels of swapaxis and transpose of contiguous tensors,
+ *  used instead of the elementwise plan when the expression is a whole assignment.
+ *  Both are written as swapping two axes of a 5D view: dst[a][d][c][b][e] = src[a][b][c][d][e]
+ */
+#ifndef MSHADOW_EXTENSION_SWAP_BLOCKS_H_
+#define MSHADOW_EXTENSION_SWAP_BLOCKS_H_
+#include <algorithm>
+#include "../extension.h"
+#if MSHADOW_USE_SSE
+#include <xmmintrin.h>
+#endif
+
+namespace mshadow {
+namespace expr {
+/*!
+ * \brief shape of the 5D view that swaps axis a1 with axis a2 of shape, a2 < a1
+ */
+template<int dim>
+inline Shape<5> SwapBlocksShape(const Shape<dim> &shape, int a2, int a1) {
+  Shape<5> s;
+  s[0] = shape.ProdShape(0, a2);
+  s[1] = shape[a2];
+  s[2] = shape.ProdShape(a2 + 1, a1);
+  s[3] = shape[a1];
+  s[4] = shape.ProdShape(a1 + 1, dim);
+  return s;
+}
+/*!
+ * \brief try to write transpose(src, axes) as the swap of two groups of axes
+ * \param shape shape of the source
+ * \param axes axis i of the result is axis axes[i] of the source
+ * \param out the 5D view
+ * \return false if the permutation is not a single swap after merging adjacent axes
+ */
+template<int dim>
+inline bool TransposeBlocksShape(const Shape<dim> &shape, const Shape<dim> &axes,
+                                 Shape<5> *out) {
+  // axes of extent 1 can be moved freely, drop them and number the others in order
+  int id[dim], ax[dim];
+  index_t extent[dim], ext[dim];
+  int m = 0, n = 0;
+  for (int i = 0; i < dim; ++i) {
+    if (axes[i] >= static_cast<index_t>(dim)) return false;
+    id[i] = m;
+    if (shape[i] != 1) extent[m++] = shape[i];
+  }
+  for (int i = 0; i < dim; ++i) {
+    if (shape[axes[i]] != 1) ax[n++] = id[axes[i]];
+  }
+  // merge the runs of source axes that stay adjacent and in order,
+  // group i of the result covers source axes [first[i], first[i] + count[i])
+  int first[dim], count[dim];
+  int k = 0;
+  for (int i = 0; i < n; ++i) {
+    if (k != 0 && ax[i] == first[k - 1] + count[k - 1]) {
+      ++count[k - 1];
+    } else {
+      first[k] = ax[i]; count[k] = 1; ++k;
+    }
+  }
+  for (int i = 0; i < k; ++i) {
+    ext[i] = 1;
+    for (int j = first[i]; j < first[i] + count[i]; ++j) ext[i] *= extent[j];
+  }
+  // rank of each group in the source order
+  int rank[dim];
+  for (int i = 0; i < k; ++i) {
+    rank[i] = 0;
+    for (int j = 0; j < k; ++j) rank[i] += first[j] < first[i];
+  }
+  int x = 0;
+  while (x < k && rank[x] == x) ++x;
+  Shape<5> s;
+  if (x == k) {
+    // the order is kept, that is a copy
+    s[0] = s[1] = s[2] = s[3] = 1;
+    s[4] = shape.Size();
+    *out = s;
+    return true;
+  }
+  const int y = rank[x];
+  if (rank[y] != x) return false;
+  for (int i = x + 1; i < k; ++i) {
+    if (i != y && rank[i] != i) return false;
+  }
+  // the groups in the source order are the ones at the same position in the result,
+  // except x and y that are swapped
+  s[0] = s[2] = s[4] = 1;
+  for (int i = 0; i < x; ++i) s[0] *= ext[i];
+  s[1] = ext[y];
+  for (int i = x + 1; i < y; ++i) s[2] *= ext[i];
+  s[3] = ext[x];
+  for (int i = y + 1; i < k; ++i) s[4] *= ext[i];
+  *out = s;
+  return true;
+}
+/*!
+ * \brief move a tile of nb x nd elements to nd x nb, rows of dst are dstride apart,
+ *  rows of src are sstride apart
+ */
+template<typename SV, typename DType>
+inline void SwapTile(DType *dst, index_t dstride, const DType *src, index_t sstride,
+                     index_t nb, index_t nd) {
+  for (index_t b = 0; b < nb; ++b) {
+    for (index_t d = 0; d < nd; ++d) {
+      SV::template Save<DType>(dst[d * dstride + b], src[b * sstride + d]);
+    }
+  }
+}
+/*! \brief SwapTile, specialized for the types that have a register transpose */
+template<typename SV, typename DType>
+struct SwapTileKernel {
+  inline static void Run(DType *dst, index_t dstride, const DType *src, index_t sstride,
+                         index_t nb, index_t nd) {
+    SwapTile<SV>(dst, dstride, src, sstride, nb, nd);
+  }
+};
+#if MSHADOW_USE_SSE
+template<>
+struct SwapTileKernel<sv::saveto, float> {
+  inline static void Run(float *dst, index_t dstride, const float *src, index_t sstride,
+                         index_t nb, index_t nd) {
+    // transpose 4x4 blocks in registers, the border goes through the scalar loop
+    const index_t nb4 = nb & ~index_t(3), nd4 = nd & ~index_t(3);
+    for (index_t b = 0; b < nb4; b += 4) {
+      for (index_t d = 0; d < nd4; d += 4) {
+        const float *s = src + b * sstride + d;
+        __m128 r0 = _mm_loadu_ps(s);
+        __m128 r1 = _mm_loadu_ps(s + sstride);
+        __m128 r2 = _mm_loadu_ps(s + 2 * sstride);
+        __m128 r3 = _mm_loadu_ps(s + 3 * sstride);
+        _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+        float *t = dst + d * dstride + b;
+        _mm_storeu_ps(t, r0);
+        _mm_storeu_ps(t + dstride, r1);
+        _mm_storeu_ps(t + 2 * dstride, r2);
+        _mm_storeu_ps(t + 3 * dstride, r3);
+      }
+    }
+    if (nd4 != nd) {
+      SwapTile<sv::saveto>(dst + nd4 * dstride, dstride, src + nd4, sstride, nb, nd - nd4);
+    }
+    if (nb4 != nb) {
+      SwapTile<sv::saveto>(dst + nb4, dstride, src + nb4 * sstride, sstride, nb - nb4, nd4);
+    }
+  }
+};
+#endif  // MSHADOW_USE_SSE
+/*!
+ * \brief CPU: dst[a][d][c][b][e] = src[a][b][c][d][e], saved with SV
+ * \param dst contiguous destination
+ * \param src contiguous source
+ * \param s the 5D view of src
+ * \return true, every view is supported
+ */
+template<typename SV, typename DType>
+inline bool SwapBlocks(Tensor<cpu, 1, DType> dst, const Tensor<cpu, 1, DType> &src,
+                       const Shape<5> &s) {
+  const index_t A = s[0], B = s[1], C = s[2], D = s[3], E = s[4];
+  // 16x16 tiles of the (b, d) plane stay in L1 while they are moved,
+  // long runs of e are contiguous on both sides and need no tiling
+  const index_t kTile = 16;
+  const index_t tile = E >= kTile ? 1 : kTile;
+  const index_t nbt = (B + tile - 1) / tile, ndt = (D + tile - 1) / tile;
+  const index_t ntile = A * C * nbt * ndt;
+  const index_t nthread = std::min(static_cast<index_t>(
+      GetNumParallelThread(dst.stream_, s.Size())), std::max(ntile, index_t(1)));
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t tid = 0; tid < nthread; ++tid) {
+    const index_t tbegin = ntile * tid / nthread, tend = ntile * (tid + 1) / nthread;
+    for (index_t i = tbegin; i < tend; ++i) {
+      index_t t = i;
+      const index_t dt = t % ndt; t /= ndt;
+      const index_t bt = t % nbt; t /= nbt;
+      const index_t c = t % C, a = t / C;
+      const index_t b0 = bt * tile, b1 = std::min(b0 + tile, B);
+      const index_t d0 = dt * tile, d1 = std::min(d0 + tile, D);
+      const DType *sp = src.dptr_ + ((a * B * C + c) * D) * E;
+      DType *dp = dst.dptr_ + ((a * D * C + c) * B) * E;
+      if (E == 1) {
+        SwapTileKernel<SV, DType>::Run(dp + d0 * C * B + b0, C * B,
+                                       sp + b0 * C * D + d0, C * D, b1 - b0, d1 - d0);
+      } else {
+        for (index_t b = b0; b < b1; ++b) {
+          for (index_t d = d0; d < d1; ++d) {
+            const DType *se = sp + (b * C * D + d) * E;
+            DType *de = dp + (d * C * B + b) * E;
+            for (index_t e = 0; e < E; ++e) SV::template Save<DType>(de[e], se[e]);
+          }
+        }
+      }
+    }
+  }
+  return true;
+}
+/*!
+ * \brief GPU: dst[a][d][c][b][e] = src[a][b][c][d][e] through shared memory tiles,
+ *  defined in cuda/tensor_gpu-inl.cuh
+ * \return false if the view is not supported, the caller falls back to the plan
+ */
+template<typename SV, typename DType>
+inline bool SwapBlocks(Tensor<gpu, 1, DType> dst, const Tensor<gpu, 1, DType> &src,
+                       const Shape<5> &s);
+}  // namespace expr
+}  // namespace mshadow
+#endif  // MSHADOW_EXTENSION_SWAP_BLOCKS_H_
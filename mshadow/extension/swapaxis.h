@@ -9,6 +9,7 @@
 #include <algorithm>
 #include <utility>
 #include "../extension.h"
+#include "./swap_blocks.h"
 namespace mshadow {
 namespace expr {
 /*!
@@ -105,6 +106,24 @@ struct Plan<SwapAxisExp<SrcExp, DType, dimsrc, 1, a2>, DType> {
   Plan<SrcExp, DType> src_;
   const index_t shapex_, shapey_, shapez_;
 };
+/*! \brief swapaxis of a contiguous tensor goes through the tiled kernel */
+template<typename SV, typename Device, typename DType, int dimsrc, int m_a1, int a2>
+struct MapExpDirectEngine<SV, Tensor<Device, dimsrc, DType>,
+                          MakeTensorExp<SwapAxisExp<Tensor<Device, dimsrc, DType>,
+                                                    DType, dimsrc, m_a1, a2>,
+                                        Tensor<Device, dimsrc, DType>, dimsrc, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, dimsrc, DType> *dst,
+                         const MakeTensorExp<SwapAxisExp<Tensor<Device, dimsrc, DType>,
+                                                         DType, dimsrc, m_a1, a2>,
+                                             Tensor<Device, dimsrc, DType>,
+                                             dimsrc, DType> &exp) {
+    const Tensor<Device, dimsrc, DType> &src = exp.real_self().src_;
+    if (!dst->CheckContiguous() || !src.CheckContiguous()) return false;
+    return SwapBlocks<SV>(dst->FlatTo1D(), src.FlatTo1D(),
+                          SwapBlocksShape(src.shape_, a2, dimsrc - m_a1));
+  }
+};
 }  // namespace expr
 }  // namespace mshadow
 #endif  // MSHADOW_EXTENSION_SWAPAXIS_H_
@@ -93,6 +93,19 @@ struct ExpInfo<TakeExp<IndexExp, SrcExp, DType> > {
   static const int kDevMask = ExpInfo<IndexExp>::kDevMask;
 };
 
+/*! \brief take of rows of a tensor goes through the gather kernels */
+template<typename SV, typename Device, typename DType>
+struct MapExpDirectEngine<SV, Tensor<Device, 2, DType>,
+                          TakeExp<Tensor<Device, 1, DType>, Tensor<Device, 2, DType>, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, 2, DType> *dst,
+                         const TakeExp<Tensor<Device, 1, DType>,
+                                       Tensor<Device, 2, DType>, DType> &exp) {
+    Take<SV>(*dst, exp.index_, exp.src_);
+    return true;
+  }
+};
+
 }  // namespace expr
 }  // namespace mshadow
 
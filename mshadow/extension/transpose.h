@@ -8,6 +8,7 @@
 #define MSHADOW_EXTENSION_TRANSPOSE_H_
 #include <algorithm>
 #include "../extension.h"
+#include "./swap_blocks.h"
 namespace mshadow {
 namespace expr {
 /*!
@@ -83,6 +84,29 @@ struct Plan<TransposeExExp<SrcExp, DType, dimsrc>, DType> {
   const Shape<dimsrc> dst_in_src_stride_, dst_shape_;
 };
 
+/*!
+ * \brief transpose of a contiguous tensor goes through the tiled kernel
+ *  when the permutation swaps two groups of adjacent axes, such as NCHW to NHWC
+ */
+template<typename SV, typename Device, typename DType, int dimsrc>
+struct MapExpDirectEngine<SV, Tensor<Device, dimsrc, DType>,
+                          MakeTensorExp<TransposeExExp<Tensor<Device, dimsrc, DType>,
+                                                       DType, dimsrc>,
+                                        Tensor<Device, dimsrc, DType>, dimsrc, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, dimsrc, DType> *dst,
+                         const MakeTensorExp<TransposeExExp<Tensor<Device, dimsrc, DType>,
+                                                            DType, dimsrc>,
+                                             Tensor<Device, dimsrc, DType>,
+                                             dimsrc, DType> &exp) {
+    const TransposeExExp<Tensor<Device, dimsrc, DType>, DType, dimsrc> &e = exp.real_self();
+    Shape<5> s;
+    if (!dst->CheckContiguous() || !e.src_.CheckContiguous() ||
+        !TransposeBlocksShape(e.src_.shape_, e.axes_, &s)) return false;
+    return SwapBlocks<SV>(dst->FlatTo1D(), e.src_.FlatTo1D(), s);
+  }
+};
+
 /*!
  * \brief transform contiguous indices of the source tensor to indices of the transposed tensor.
  * input: Tensor<Device, k>: ishape
@@ -7,6 +7,7 @@
 #ifndef MSHADOW_EXTENSION_UNPACK_PATCH2COL_H_
 #define MSHADOW_EXTENSION_UNPACK_PATCH2COL_H_
 #include "../extension.h"
+#include "./materialize.h"
 namespace mshadow {
 namespace expr {
 /*!
@@ -146,6 +147,27 @@ struct Plan<UnpackPatchToColXExp<SrcExp, DType, srcdim>, DType> {
   const index_t pdilate_y_, pdilate_x_;
   const index_t i_height_, i_width_, o_height_, o_width_;
 };
+/*!
+ * \brief each element of the image is read once per patch covering it,
+ *  so an expensive image expression is evaluated into a temporary first
+ */
+template<typename SV, typename Device, typename SrcExp, typename DType, int srcdim>
+struct MapExpDirectEngine<SV, Tensor<Device, 2, DType>,
+                          MakeTensorExp<UnpackPatchToColXExp<SrcExp, DType, srcdim>,
+                                        SrcExp, 2, DType>,
+                          DType> {
+  inline static bool Map(Tensor<Device, 2, DType> *dst,
+                         const MakeTensorExp<UnpackPatchToColXExp<SrcExp, DType, srcdim>,
+                                             SrcExp, 2, DType> &exp) {
+    if (!ExpCost<SrcExp>::kMaterialize) return false;
+    const UnpackPatchToColXExp<SrcExp, DType, srcdim> &e = exp.real_self();
+    MaterializedTensor<Device, srcdim, DType> img(e.img_, dst->stream_);
+    MapExp<SV>(dst, UnpackPatchToColXExp<Tensor<Device, srcdim, DType>, DType, srcdim>
+               (img.data, e.psize_y_, e.psize_x_, e.pstride_y_, e.pstride_x_,
+                e.pdilate_y_, e.pdilate_x_));
+    return true;
+  }
+};
 }  // namespace expr
 }  // namespace mshadow
 #endif  // MSHADOW_EXTENSION_UNPACK_PATCH2COL_H_
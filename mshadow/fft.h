@@ -0,0 +1,344 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file fft.h
+ * \brief batched 1D and 2D discrete Fourier transforms of complex tensors, in the
+ *  interleaved layout of extension/complex.h: the last dimension holds the real and the
+ *  imaginary part of each number. They run on cuFFT on gpu, on the DFT of MKL when it
+ *  is the BLAS, and on the built-in transforms otherwise.
+ */
+#ifndef MSHADOW_FFT_H_
+#define MSHADOW_FFT_H_
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "./tensor.h"
+#if !MSHADOW_USE_CBLAS && MSHADOW_USE_MKL
+#include <mkl_dfti.h>
+#endif
+
+namespace mshadow {
+namespace fft {
+/*! \brief a complex number of the built-in transforms, laid out as an interleaved pair */
+template<typename DType>
+struct Complex {
+  DType re, im;
+};
+template<typename DType>
+MSHADOW_XINLINE Complex<DType> MakeComplex(DType re, DType im) {
+  Complex<DType> c;
+  c.re = re; c.im = im;
+  return c;
+}
+template<typename DType>
+MSHADOW_XINLINE Complex<DType> operator+(const Complex<DType> &a, const Complex<DType> &b) {
+  return MakeComplex(a.re + b.re, a.im + b.im);
+}
+template<typename DType>
+MSHADOW_XINLINE Complex<DType> operator-(const Complex<DType> &a, const Complex<DType> &b) {
+  return MakeComplex(a.re - b.re, a.im - b.im);
+}
+template<typename DType>
+MSHADOW_XINLINE Complex<DType> operator*(const Complex<DType> &a, const Complex<DType> &b) {
+  return MakeComplex(a.re * b.re - a.im * b.im, a.re * b.im + a.im * b.re);
+}
+/*!
+ * \brief the built-in transform of the sequences of one length: a Stockham autosort FFT of
+ *  radix 4 stages, and one radix 2 stage for odd powers of two, which needs no bit reversal;
+ *  other lengths take the direct O(n^2) sum
+ * \tparam DType float or double
+ */
+template<typename DType>
+class Transform {
+ public:
+  /*!
+   * \param n length of the sequences
+   * \param inverse the sign of the exponent is + for the inverse, which is not scaled
+   */
+  Transform(index_t n, bool inverse) : n_(n), inverse_(inverse), twiddle_(n) {
+    // exp(-+2 pi i k / n) is taken in double so the float table is rounded once
+    const double step = (inverse ? 1.0 : -1.0) * 6.283185307179586476925 /
+        static_cast<double>(n);
+    for (index_t k = 0; k < n; ++k) {
+      const double a = step * static_cast<double>(k);
+      twiddle_[k] = MakeComplex(static_cast<DType>(std::cos(a)),
+                                static_cast<DType>(std::sin(a)));
+    }
+  }
+  /*! \brief complex numbers of the work space of Run */
+  inline index_t WorkSize(void) const {
+    return 2 * n_;
+  }
+  /*!
+   * \brief transform a sequence, src and dst may be the same
+   * \param src the sequence, number j has its real part at src[j * sstep], imaginary next
+   * \param sstep step of src in elements of DType
+   * \param dst the result, laid out as src with dstep
+   * \param dstep step of dst in elements of DType
+   * \param scale the result is multiplied by it
+   * \param work WorkSize() complex numbers
+   */
+  inline void Run(const DType *src, index_t sstep, DType *dst, index_t dstep,
+                  DType scale, Complex<DType> *work) const {
+    Complex<DType> *x = work, *y = work + n_;
+    for (index_t j = 0; j < n_; ++j) x[j] = MakeComplex(src[j * sstep], src[j * sstep + 1]);
+    if ((n_ & (n_ - 1)) == 0) {
+      // stage with sequences of length n and stride s, the results are ordered in place
+      index_t n = n_, s = 1;
+      for (; n >= 4; n /= 4, s *= 4) {
+        Radix4(n, s, x, y);
+        std::swap(x, y);
+      }
+      if (n == 2) {
+        for (index_t q = 0; q < s; ++q) {
+          const Complex<DType> a = x[q], b = x[q + s];
+          y[q] = a + b;
+          y[q + s] = a - b;
+        }
+        std::swap(x, y);
+      }
+    } else {
+      for (index_t k = 0; k < n_; ++k) {
+        Complex<DType> acc = MakeComplex(DType(0), DType(0));
+        for (index_t j = 0, w = 0; j < n_; ++j) {
+          acc = acc + x[j] * twiddle_[w];
+          w += k;
+          if (w >= n_) w -= n_;
+        }
+        y[k] = acc;
+      }
+      std::swap(x, y);
+    }
+    for (index_t j = 0; j < n_; ++j) {
+      dst[j * dstep] = x[j].re * scale;
+      dst[j * dstep + 1] = x[j].im * scale;
+    }
+  }
+
+ private:
+  /*! \brief one radix 4 stage, x holds 4 * m sequences of length n / 4 interleaved by s */
+  inline void Radix4(index_t n, index_t s, const Complex<DType> *x, Complex<DType> *y) const {
+    const index_t m = n / 4, step = n_ / n;
+    for (index_t p = 0; p < m; ++p) {
+      const Complex<DType> w1 = twiddle_[p * step], w2 = twiddle_[2 * p * step],
+          w3 = twiddle_[3 * p * step];
+      const Complex<DType> *xp = x + s * p;
+      Complex<DType> *yp = y + s * 4 * p;
+      for (index_t q = 0; q < s; ++q) {
+        const Complex<DType> a = xp[q], b = xp[q + s * m], c = xp[q + 2 * s * m],
+            d = xp[q + 3 * s * m];
+        const Complex<DType> apc = a + c, amc = a - c, bpd = b + d, bmd = b - d;
+        // -i (b - d) for the forward transform, i (b - d) for the inverse
+        const Complex<DType> jbmd = inverse_ ? MakeComplex(-bmd.im, bmd.re) :
+            MakeComplex(bmd.im, -bmd.re);
+        yp[q] = apc + bpd;
+        yp[q + s] = (amc + jbmd) * w1;
+        yp[q + 2 * s] = (apc - bpd) * w2;
+        yp[q + 3 * s] = (amc - jbmd) * w3;
+      }
+    }
+  }
+  /*! \brief length */
+  index_t n_;
+  /*! \brief direction */
+  bool inverse_;
+  /*! \brief exp(-+2 pi i k / n) for k in [0, n) */
+  std::vector<Complex<DType> > twiddle_;
+};
+}  // namespace fft
+/*!
+ * \brief the transforms on a device, the tensors have been checked by the callers
+ * \tparam Device which device the tensors are on
+ * \tparam DType float or double
+ */
+template<typename Device, typename DType>
+struct FFTEngine;
+/*! \brief transforms on cpu, parallel over the sequences */
+template<typename DType>
+struct FFTEngine<cpu, DType> {
+  /*!
+   * \brief transform the rows of (batch, 2 * n) tensors
+   * \param scale the result is multiplied by it
+   */
+  inline static void Transform1D(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 2, DType> &src,
+                                 bool inverse, DType scale) {
+    WaitPushedTasks(src.stream_);
+    const index_t n = src.size(1) / 2;
+#if !MSHADOW_USE_CBLAS && MSHADOW_USE_MKL
+    if (src.stride_ % 2 == 0 && dst.stride_ % 2 == 0) {
+      MKL_LONG len = static_cast<MKL_LONG>(n);
+      const MKL_LONG dist[2] = {static_cast<MKL_LONG>(src.stride_ / 2),
+                                static_cast<MKL_LONG>(dst.stride_ / 2)};
+      MKLTransform(1, &len, src.size(0), dist, NULL, dst.dptr_, src.dptr_, inverse, scale);
+      return;
+    }
+#endif
+    const fft::Transform<DType> trans(n, inverse);
+    const index_t nrow = src.size(0);
+#ifdef _OPENMP
+    const int nthread = GetNumParallelThread(src.stream_, src.shape_.Size());
+#endif
+    #pragma omp parallel num_threads(nthread) if (nthread > 1)
+    {
+      std::vector<fft::Complex<DType> > work(trans.WorkSize());
+      #pragma omp for schedule(static)
+      for (openmp_index_t r = 0; r < nrow; ++r) {
+        trans.Run(src.dptr_ + r * src.stride_, 2, dst.dptr_ + r * dst.stride_, 2,
+                  scale, &work[0]);
+      }
+    }
+  }
+  /*!
+   * \brief transform the (h, w) planes of (batch, h, 2 * w) tensors
+   * \param scale the result is multiplied by it
+   */
+  inline static void Transform2D(Tensor<cpu, 3, DType> dst, const Tensor<cpu, 3, DType> &src,
+                                 bool inverse, DType scale) {
+    WaitPushedTasks(src.stream_);
+    const index_t nbatch = src.size(0), h = src.size(1), w = src.size(2) / 2;
+#if !MSHADOW_USE_CBLAS && MSHADOW_USE_MKL
+    if (src.stride_ % 2 == 0 && dst.stride_ % 2 == 0) {
+      MKL_LONG len[2] = {static_cast<MKL_LONG>(h), static_cast<MKL_LONG>(w)};
+      const MKL_LONG dist[2] = {static_cast<MKL_LONG>(h * src.stride_ / 2),
+                                static_cast<MKL_LONG>(h * dst.stride_ / 2)};
+      const MKL_LONG rstride[2] = {static_cast<MKL_LONG>(src.stride_ / 2),
+                                   static_cast<MKL_LONG>(dst.stride_ / 2)};
+      MKLTransform(2, len, nbatch, dist, rstride, dst.dptr_, src.dptr_, inverse, scale);
+      return;
+    }
+#endif
+    // the rows into dst, then the columns of dst in place
+    Transform1D(Tensor<cpu, 2, DType>(dst.dptr_, Shape2(nbatch * h, 2 * w), dst.stride_,
+                                      dst.stream_),
+                Tensor<cpu, 2, DType>(src.dptr_, Shape2(nbatch * h, 2 * w), src.stride_,
+                                      src.stream_), inverse, scale);
+    const fft::Transform<DType> trans(h, inverse);
+    const index_t ncol = nbatch * w;
+#ifdef _OPENMP
+    const int nthread = GetNumParallelThread(dst.stream_, dst.shape_.Size());
+#endif
+    #pragma omp parallel num_threads(nthread) if (nthread > 1)
+    {
+      std::vector<fft::Complex<DType> > work(trans.WorkSize());
+      #pragma omp for schedule(static)
+      for (openmp_index_t i = 0; i < ncol; ++i) {
+        const index_t b = static_cast<index_t>(i) / w, c = static_cast<index_t>(i) % w;
+        DType *col = dst.dptr_ + b * h * dst.stride_ + 2 * c;
+        trans.Run(col, dst.stride_, col, dst.stride_, DType(1), &work[0]);
+      }
+    }
+  }
+
+ private:
+#if !MSHADOW_USE_CBLAS && MSHADOW_USE_MKL
+  /*!
+   * \brief batched transform of MKL, in numbers of complex
+   * \param dist distances of the sequences of src and of dst
+   * \param rstride the row strides of src and of dst for 2D, with unit column stride
+   */
+  inline static void MKLTransform(int rank, MKL_LONG *len, index_t batch,
+                                  const MKL_LONG dist[2], const MKL_LONG *rstride,
+                                  DType *dst, const DType *src, bool inverse, DType scale) {
+    const DFTI_CONFIG_VALUE prec = sizeof(DType) == sizeof(double) ? DFTI_DOUBLE : DFTI_SINGLE;
+    DFTI_DESCRIPTOR_HANDLE desc = NULL;
+    DFTICheck(rank == 1 ? DftiCreateDescriptor(&desc, prec, DFTI_COMPLEX, 1, len[0]) :
+              DftiCreateDescriptor(&desc, prec, DFTI_COMPLEX, rank, len));
+    DFTICheck(DftiSetValue(desc, DFTI_NUMBER_OF_TRANSFORMS, static_cast<MKL_LONG>(batch)));
+    DFTICheck(DftiSetValue(desc, DFTI_INPUT_DISTANCE, dist[0]));
+    DFTICheck(DftiSetValue(desc, DFTI_OUTPUT_DISTANCE, dist[1]));
+    if (rstride != NULL) {
+      MKL_LONG istride[3] = {0, rstride[0], 1}, ostride[3] = {0, rstride[1], 1};
+      DFTICheck(DftiSetValue(desc, DFTI_INPUT_STRIDES, istride));
+      DFTICheck(DftiSetValue(desc, DFTI_OUTPUT_STRIDES, ostride));
+    }
+    DFTICheck(DftiSetValue(desc, DFTI_PLACEMENT,
+                           dst == src ? DFTI_INPLACE : DFTI_NOT_INPLACE));
+    // the scale goes through the variadic argument as a double for both precisions
+    DFTICheck(DftiSetValue(desc, inverse ? DFTI_BACKWARD_SCALE : DFTI_FORWARD_SCALE,
+                           static_cast<double>(scale)));
+    DFTICheck(DftiCommitDescriptor(desc));
+    void *in = const_cast<DType*>(src);
+    DFTICheck(inverse ? DftiComputeBackward(desc, in, dst) : DftiComputeForward(desc, in, dst));
+    DftiFreeDescriptor(&desc);
+  }
+  inline static void DFTICheck(MKL_LONG status) {
+    CHECK(DftiErrorClass(status, DFTI_NO_ERROR))
+        << "MKL DFT: " << DftiErrorMessage(status);
+  }
+#endif
+};
+/*! \brief transforms on gpu with cuFFT, see cuda/fft.cuh */
+template<typename DType>
+struct FFTEngine<gpu, DType> {
+  inline static void Transform1D(Tensor<gpu, 2, DType> dst, const Tensor<gpu, 2, DType> &src,
+                                 bool inverse, DType scale);
+  inline static void Transform2D(Tensor<gpu, 3, DType> dst, const Tensor<gpu, 3, DType> &src,
+                                 bool inverse, DType scale);
+};
+/*!
+ * \brief the discrete Fourier transform of each sequence of complex numbers along the last
+ *  dimension, dst[j] = sum_k src[k] exp(-2 pi i j k / n)
+ * \param dst the result, of the shape of src, may be src
+ * \param src the sequences, the last dimension is 2 * n with the interleaved real and
+ *  imaginary parts, the other dimensions are the batch
+ */
+template<typename Device, int dim, typename DType>
+inline void FFT(Tensor<Device, dim, DType> dst, const Tensor<Device, dim, DType> &src) {
+  CHECK_EQ(dst.shape_, src.shape_) << "FFT: shape mismatch";
+  CHECK_EQ(src.size(dim - 1) % 2, 0) << "FFT: the last dimension must hold complex pairs";
+  if (src.shape_.Size() == 0) return;
+  FFTEngine<Device, DType>::Transform1D(dst.FlatTo2D(), src.FlatTo2D(), false, DType(1));
+}
+/*!
+ * \brief the inverse of FFT, dst[j] = 1 / n sum_k src[k] exp(2 pi i j k / n)
+ * \param dst the result, of the shape of src, may be src
+ * \param src the sequences, as for FFT
+ */
+template<typename Device, int dim, typename DType>
+inline void IFFT(Tensor<Device, dim, DType> dst, const Tensor<Device, dim, DType> &src) {
+  CHECK_EQ(dst.shape_, src.shape_) << "IFFT: shape mismatch";
+  CHECK_EQ(src.size(dim - 1) % 2, 0) << "IFFT: the last dimension must hold complex pairs";
+  if (src.shape_.Size() == 0) return;
+  FFTEngine<Device, DType>::Transform1D(dst.FlatTo2D(), src.FlatTo2D(), true,
+                                        DType(2) / DType(src.size(dim - 1)));
+}
+/*! \brief view of a tensor of dim >= 2 as (batch, h, 2 * w) */
+template<typename Device, int dim, typename DType>
+inline Tensor<Device, 3, DType> FFTPlanes(const Tensor<Device, dim, DType> &t) {
+  const index_t h = t.size(dim - 2), w = t.size(dim - 1);
+  return Tensor<Device, 3, DType>(t.dptr_, Shape3(t.shape_.Size() / (h * w), h, w),
+                                  t.stride_, t.stream_);
+}
+/*!
+ * \brief the 2D discrete Fourier transform of each plane of complex numbers along the last
+ *  two dimensions, (h, 2 * w) with the interleaved real and imaginary parts
+ * \param dst the result, of the shape of src, may be src
+ * \param src the planes, the dimensions before the last two are the batch
+ */
+template<typename Device, int dim, typename DType>
+inline void FFT2D(Tensor<Device, dim, DType> dst, const Tensor<Device, dim, DType> &src) {
+  expr::TypeCheckPass<dim >= 2>::Error_Expression_Does_Not_Meet_Dimension_Req();
+  CHECK_EQ(dst.shape_, src.shape_) << "FFT2D: shape mismatch";
+  CHECK_EQ(src.size(dim - 1) % 2, 0) << "FFT2D: the last dimension must hold complex pairs";
+  if (src.shape_.Size() == 0) return;
+  FFTEngine<Device, DType>::Transform2D(FFTPlanes(dst), FFTPlanes(src), false, DType(1));
+}
+/*!
+ * \brief the inverse of FFT2D, scaled by 1 / (h * w)
+ * \param dst the result, of the shape of src, may be src
+ * \param src the planes, as for FFT2D
+ */
+template<typename Device, int dim, typename DType>
+inline void IFFT2D(Tensor<Device, dim, DType> dst, const Tensor<Device, dim, DType> &src) {
+  expr::TypeCheckPass<dim >= 2>::Error_Expression_Does_Not_Meet_Dimension_Req();
+  CHECK_EQ(dst.shape_, src.shape_) << "IFFT2D: shape mismatch";
+  CHECK_EQ(src.size(dim - 1) % 2, 0) << "IFFT2D: the last dimension must hold complex pairs";
+  if (src.shape_.Size() == 0) return;
+  FFTEngine<Device, DType>::Transform2D(
+      FFTPlanes(dst), FFTPlanes(src), true,
+      DType(2) / (DType(src.size(dim - 2)) * DType(src.size(dim - 1))));
+}
+}  // namespace mshadow
+#ifdef __CUDACC__
+#include "./cuda/fft.cuh"
+#endif
+#endif  // MSHADOW_FFT_H_
@@ -0,0 +1,602 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file fused_graph.h
+ * \brief elementwise expression graphs over TBlob that are built at runtime and run as one
+ *  fused pass, for the framework layers whose types and ranks are only known at runtime
+ *
+ *  The templates of the expression engine fuse at compile time, a framework that holds
+ *  TBlobs dispatches each op through MSHADOW_TYPE_SWITCH instead, one pass over memory per
+ *  op. A Graph records the ops of several such calls, with the functors of op::, and Run
+ *  evaluates them reading each input and writing the output once.
+ *
+ *  The graph is compiled once per signature, the ops and the types without the shapes and
+ *  the values of the scalars, and the result is cached. On cpu the compiled form is a
+ *  program over registers of kFusedBlock elements, each instruction a tight loop over a
+ *  block, so the dispatch costs once per block instead of once per element. On gpu, with
+ *  MSHADOW_USE_NVRTC, the graph is emitted as the source of a CUDA kernel by
+ *  GenerateCUDASource and compiled with NVRTC for the current device.
+ * \code
+ *  fused::Graph g;
+ *  int x = g.Input(kFloat16), b = g.Input(kFloat32);
+ *  int y = g.Unary(fused::kSigmoid, g.Binary(fused::kPlus, x, b));
+ *  g.SetOutput(g.Binary(fused::kMul, y, g.Scalar(0.5)), kFloat16);
+ *  fused::Run(g, {blob_x, blob_b}, blob_out, stream);
+ * \endcode
+ */
+#ifndef MSHADOW_FUSED_GRAPH_H_
+#define MSHADOW_FUSED_GRAPH_H_
+#include "./base.h"
+
+#if MSHADOW_IN_CXX11
+#include <algorithm>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "./tensor.h"
+#include "./tensor_blob.h"
+#if MSHADOW_USE_NVRTC
+#include <cuda.h>
+#include <nvrtc.h>
+#include <cstdlib>
+#endif  // MSHADOW_USE_NVRTC
+
+namespace mshadow {
+/*! \brief runtime fused elementwise graphs */
+namespace fused {
+/*! \brief operations of the nodes of a Graph, the unary and binary functors of op:: */
+enum OpCode {
+  kInput = 0,
+  kScalar,
+  kIdentity,
+  kExp,
+  kLog,
+  kTanh,
+  kSqrt,
+  kSigmoid,
+  kPlus,
+  kMinus,
+  kMul,
+  kDiv,
+  kMaximum,
+  kMinimum,
+  kNumOpCode
+};
+/*! \brief name of an op in the signature */
+inline const char *OpCodeName(int op) {
+  static const char *names[kNumOpCode] = {
+    "in", "scalar", "identity", "exp", "log", "tanh", "sqrt", "sigmoid",
+    "plus", "minus", "mul", "div", "maximum", "minimum"
+  };
+  return names[op];
+}
+/*! \brief whether op takes one operand */
+inline bool IsUnary(int op) {
+  return op >= kIdentity && op <= kSigmoid;
+}
+/*! \brief whether op takes two operands */
+inline bool IsBinary(int op) {
+  return op >= kPlus && op < kNumOpCode;
+}
+/*! \brief a node of a Graph */
+struct Node {
+  /*! \brief the OpCode */
+  int op;
+  /*! \brief the operands, earlier nodes, -1 if not used */
+  int lhs, rhs;
+  /*! \brief index of the input or of the scalar */
+  int index;
+};
+/*!
+ * \brief an elementwise graph, nodes only refer to earlier nodes.
+ *  Inputs are numbered in the order of the Input calls, all inputs and the output have
+ *  the same number of elements
+ */
+class Graph {
+ public:
+  Graph(void) : output_(-1), output_type_(kFloat32) {}
+  /*! \brief add an input of type type_flag, the next blob given to Run */
+  inline int Input(int type_flag) {
+    Node n = {kInput, -1, -1, static_cast<int>(input_types_.size())};
+    input_types_.push_back(type_flag);
+    return this->Push(n);
+  }
+  /*! \brief add a scalar, its value is not part of the signature */
+  inline int Scalar(double value) {
+    Node n = {kScalar, -1, -1, static_cast<int>(scalars_.size())};
+    scalars_.push_back(value);
+    return this->Push(n);
+  }
+  /*! \brief add op(src) */
+  inline int Unary(OpCode op, int src) {
+    CHECK(IsUnary(op)) << "fused::Graph: " << OpCodeName(op) << " is not unary";
+    this->CheckNode(src);
+    Node n = {op, src, -1, -1};
+    return this->Push(n);
+  }
+  /*! \brief add op(lhs, rhs) */
+  inline int Binary(OpCode op, int lhs, int rhs) {
+    CHECK(IsBinary(op)) << "fused::Graph: " << OpCodeName(op) << " is not binary";
+    this->CheckNode(lhs);
+    this->CheckNode(rhs);
+    Node n = {op, lhs, rhs, -1};
+    return this->Push(n);
+  }
+  /*! \brief the node that is stored to the output, as type_flag */
+  inline void SetOutput(int node, int type_flag) {
+    this->CheckNode(node);
+    output_ = node;
+    output_type_ = type_flag;
+  }
+  /*! \brief type the graph computes in: double if a blob is double, float otherwise */
+  inline int compute_type(void) const {
+    bool dbl = output_type_ == kFloat64;
+    for (size_t i = 0; i < input_types_.size(); ++i) dbl = dbl || input_types_[i] == kFloat64;
+    return dbl ? kFloat64 : kFloat32;
+  }
+  /*! \brief the key of the compiled graph: the ops and the types */
+  inline std::string Signature(void) const {
+    CHECK_GE(output_, 0) << "fused::Graph: no output";
+    std::ostringstream os;
+    os << 'c' << this->compute_type() << 'o' << output_type_ << ':' << output_;
+    for (size_t i = 0; i < nodes_.size(); ++i) {
+      const Node &n = nodes_[i];
+      os << '|' << OpCodeName(n.op);
+      if (n.op == kInput) os << n.index << ':' << input_types_[n.index];
+      if (n.op == kScalar) os << n.index;
+      if (n.lhs >= 0) os << '(' << n.lhs;
+      if (n.rhs >= 0) os << ',' << n.rhs;
+      if (n.lhs >= 0) os << ')';
+    }
+    return os.str();
+  }
+  /*! \brief the nodes */
+  inline const std::vector<Node> &nodes(void) const {
+    return nodes_;
+  }
+  /*! \brief types of the inputs */
+  inline const std::vector<int> &input_types(void) const {
+    return input_types_;
+  }
+  /*! \brief values of the scalars */
+  inline const std::vector<double> &scalars(void) const {
+    return scalars_;
+  }
+  /*! \brief the output node */
+  inline int output(void) const {
+    return output_;
+  }
+  /*! \brief type of the output */
+  inline int output_type(void) const {
+    return output_type_;
+  }
+  /*!
+   * \brief whether each node is needed by the output
+   */
+  inline std::vector<bool> Live(void) const {
+    std::vector<bool> live(nodes_.size(), false);
+    if (output_ < 0) return live;
+    live[output_] = true;
+    for (int i = output_; i >= 0; --i) {
+      if (!live[i]) continue;
+      if (nodes_[i].lhs >= 0) live[nodes_[i].lhs] = true;
+      if (nodes_[i].rhs >= 0) live[nodes_[i].rhs] = true;
+    }
+    return live;
+  }
+
+ private:
+  inline int Push(const Node &n) {
+    nodes_.push_back(n);
+    return static_cast<int>(nodes_.size()) - 1;
+  }
+  inline void CheckNode(int node) const {
+    CHECK(node >= 0 && node < static_cast<int>(nodes_.size()))
+        << "fused::Graph: invalid node " << node;
+  }
+  std::vector<Node> nodes_;
+  std::vector<int> input_types_;
+  std::vector<double> scalars_;
+  int output_, output_type_;
+};
+/*! \brief check that the blobs fit the graph, return the number of elements */
+inline index_t CheckBlobs(const Graph &graph, const std::vector<TBlob> &in,
+                          const TBlob &out, int dev_mask) {
+  CHECK_EQ(in.size(), graph.input_types().size()) << "fused::Run: number of inputs";
+  CHECK_EQ(out.type_flag_, graph.output_type()) << "fused::Run: type of the output";
+  CHECK_EQ(out.dev_mask_, dev_mask) << "fused::Run: device of the output";
+  CHECK(out.CheckContiguous()) << "fused::Run: the output must be contiguous";
+  const index_t size = out.Size();
+  for (size_t i = 0; i < in.size(); ++i) {
+    CHECK_EQ(in[i].type_flag_, graph.input_types()[i]) << "fused::Run: type of input " << i;
+    CHECK_EQ(in[i].dev_mask_, dev_mask) << "fused::Run: device of input " << i;
+    CHECK(in[i].CheckContiguous()) << "fused::Run: input " << i << " must be contiguous";
+    CHECK_EQ(in[i].Size(), size) << "fused::Run: size of input " << i;
+  }
+  return size;
+}
+
+/*! \brief elements of a register of the cpu programs */
+const index_t kFusedBlock = 256;
+/*! \brief a graph compiled for cpu */
+class CPUProgram {
+ public:
+  virtual ~CPUProgram(void) {}
+  /*! \brief evaluate the graph over size elements */
+  virtual void Run(const Graph &graph, const std::vector<TBlob> &in, const TBlob &out,
+                   index_t size, int nthread) const = 0;
+};
+/*!
+ * \brief the cpu program of a graph, in AType: the live nodes in order, registers are
+ *  reused once their last reader ran
+ */
+template<typename AType>
+class CPUProgramImpl : public CPUProgram {
+ public:
+  explicit CPUProgramImpl(const Graph &graph) : nreg_(0) {
+    const std::vector<Node> &nodes = graph.nodes();
+    const std::vector<bool> live = graph.Live();
+    std::vector<int> last(nodes.size(), -1), reg(nodes.size(), -1), free_reg;
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (!live[i]) continue;
+      if (nodes[i].lhs >= 0) last[nodes[i].lhs] = static_cast<int>(i);
+      if (nodes[i].rhs >= 0) last[nodes[i].rhs] = static_cast<int>(i);
+    }
+    last[graph.output()] = static_cast<int>(nodes.size());
+    for (size_t i = 0; i < nodes.size(); ++i) {
+      if (!live[i]) continue;
+      const Node &n = nodes[i];
+      Instr ins = {n.op, -1, n.lhs >= 0 ? reg[n.lhs] : -1, n.rhs >= 0 ? reg[n.rhs] : -1,
+                   n.op == kInput ? graph.input_types()[n.index] : -1, n.index};
+      // operands read last here free their registers first, an op may write in place
+      if (n.lhs >= 0 && last[n.lhs] == static_cast<int>(i)) free_reg.push_back(reg[n.lhs]);
+      if (n.rhs >= 0 && n.rhs != n.lhs && last[n.rhs] == static_cast<int>(i)) {
+        free_reg.push_back(reg[n.rhs]);
+      }
+      if (free_reg.empty()) {
+        reg[i] = nreg_++;
+      } else {
+        reg[i] = free_reg.back();
+        free_reg.pop_back();
+      }
+      ins.dst = reg[i];
+      code_.push_back(ins);
+    }
+    out_reg_ = reg[graph.output()];
+  }
+  virtual void Run(const Graph &graph, const std::vector<TBlob> &in, const TBlob &out,
+                   index_t size, int nthread) const {
+    const index_t nblock = (size + kFusedBlock - 1) / kFusedBlock;
+    const std::vector<double> &scalars = graph.scalars();
+    #pragma omp parallel num_threads(nthread) if (nthread > 1)
+    {
+      std::vector<AType> regs(static_cast<size_t>(nreg_) * kFusedBlock);
+      #pragma omp for schedule(static)
+      for (openmp_index_t b = 0; b < nblock; ++b) {
+        const index_t begin = static_cast<index_t>(b) * kFusedBlock;
+        const index_t n = std::min(kFusedBlock, size - begin);
+        for (size_t k = 0; k < code_.size(); ++k) {
+          const Instr &ins = code_[k];
+          AType *dst = &regs[ins.dst * kFusedBlock];
+          const AType *a = ins.lhs >= 0 ? &regs[ins.lhs * kFusedBlock] : NULL;
+          const AType *c = ins.rhs >= 0 ? &regs[ins.rhs * kFusedBlock] : NULL;
+          switch (ins.op) {
+            case kInput:
+              MSHADOW_TYPE_SWITCH(ins.type, DType, {
+                const DType *src = static_cast<const DType*>(in[ins.index].dptr_) + begin;
+                for (index_t i = 0; i < n; ++i) dst[i] = AType(src[i]);
+              });
+              break;
+            case kScalar: {
+              const AType v = AType(scalars[ins.index]);
+              for (index_t i = 0; i < n; ++i) dst[i] = v;
+              break;
+            }
+            case kIdentity: Map<op::identity>(dst, a, n); break;
+            case kExp: Map<op::exp>(dst, a, n); break;
+            case kLog: Map<op::log>(dst, a, n); break;
+            case kTanh: Map<op::tanh>(dst, a, n); break;
+            case kSqrt: Map<op::sqrt>(dst, a, n); break;
+            case kSigmoid: Map<op::sigmoid>(dst, a, n); break;
+            case kPlus: Map<op::plus>(dst, a, c, n); break;
+            case kMinus: Map<op::minus>(dst, a, c, n); break;
+            case kMul: Map<op::mul>(dst, a, c, n); break;
+            case kDiv: Map<op::div>(dst, a, c, n); break;
+            case kMaximum: Map<op::maximum>(dst, a, c, n); break;
+            case kMinimum: Map<op::minimum>(dst, a, c, n); break;
+            default: LOG(FATAL) << "fused::CPUProgram: unknown op " << ins.op;
+          }
+        }
+        const AType *res = &regs[out_reg_ * kFusedBlock];
+        MSHADOW_TYPE_SWITCH(out.type_flag_, DType, {
+          DType *dst = static_cast<DType*>(out.dptr_) + begin;
+          for (index_t i = 0; i < n; ++i) dst[i] = DType(res[i]);
+        });
+      }
+    }
+  }
+
+ private:
+  struct Instr {
+    int op, dst, lhs, rhs, type, index;
+  };
+  template<typename OP>
+  inline static void Map(AType *dst, const AType *a, index_t n) {
+    for (index_t i = 0; i < n; ++i) dst[i] = OP::Map(a[i]);
+  }
+  template<typename OP>
+  inline static void Map(AType *dst, const AType *a, const AType *b, index_t n) {
+    for (index_t i = 0; i < n; ++i) dst[i] = OP::Map(a[i], b[i]);
+  }
+  std::vector<Instr> code_;
+  int nreg_, out_reg_;
+};
+/*!
+ * \brief compiled graphs by key, shared by all threads
+ * \tparam Program type of the compiled graph
+ */
+template<typename Program>
+class ProgramCache {
+ public:
+  /*! \brief the program of key, made by create(void) the first time */
+  template<typename Create>
+  inline std::shared_ptr<const Program> Lookup(const std::string &key, Create create) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    typename std::unordered_map<std::string, std::shared_ptr<const Program> >::iterator
+        it = cache_.find(key);
+    if (it != cache_.end()) return it->second;
+    std::shared_ptr<const Program> prog(create());
+    cache_[key] = prog;
+    return prog;
+  }
+  /*! \brief number of programs */
+  inline size_t size(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cache_.size();
+  }
+  /*! \brief drop all programs */
+  inline void Clear(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    cache_.clear();
+  }
+  inline static ProgramCache *Get(void) {
+    static ProgramCache inst;
+    return &inst;
+  }
+
+ private:
+  std::mutex mutex_;
+  std::unordered_map<std::string, std::shared_ptr<const Program> > cache_;
+};
+/*!
+ * \brief evaluate graph on cpu, out = graph(in), the output may be one of the inputs
+ * \param graph the graph
+ * \param in the inputs, contiguous, of the types of the graph
+ * \param out the output, contiguous, with as many elements as each input
+ * \param stream the stream, its worker threads are used
+ */
+inline void Run(const Graph &graph, const std::vector<TBlob> &in, const TBlob &out,
+                Stream<cpu> *stream = NULL) {
+  WaitPushedTasks(stream);
+  const index_t size = CheckBlobs(graph, in, out, cpu::kDevMask);
+  if (size == 0) return;
+  std::shared_ptr<const CPUProgram> prog = ProgramCache<CPUProgram>::Get()->Lookup(
+      graph.Signature(), [&graph]() -> CPUProgram* {
+        if (graph.compute_type() == kFloat64) return new CPUProgramImpl<double>(graph);
+        return new CPUProgramImpl<float>(graph);
+      });
+  prog->Run(graph, in, out, size, GetNumParallelThread(stream, size));
+}
+
+/*! \brief name of the CUDA type of a type flag */
+inline const char *CUDATypeName(int type_flag) {
+  switch (type_flag) {
+    case kFloat32: return "float";
+    case kFloat64: return "double";
+    case kFloat16: return "__half";
+    case kBfloat16: return "__nv_bfloat16";
+    case kUint8: return "unsigned char";
+    case kInt32: return "int";
+    case kInt8: return "signed char";
+    default: LOG(FATAL) << "fused: unknown type " << type_flag;
+  }
+  return "";
+}
+/*!
+ * \brief source of a CUDA kernel evaluating graph, extern "C" void name(long long n,
+ *  inputs..., output, scalars...), a grid stride loop over the n elements.
+ *  The inputs and the output are pointers of their types, the scalars of compute_type.
+ */
+inline std::string GenerateCUDASource(const Graph &graph, const std::string &name) {
+  const std::vector<Node> &nodes = graph.nodes();
+  const std::vector<bool> live = graph.Live();
+  const bool dbl = graph.compute_type() == kFloat64;
+  const char *atype = dbl ? "double" : "float";
+  const char *f = dbl ? "" : "f";
+  bool fp16 = graph.output_type() == kFloat16, bf16 = graph.output_type() == kBfloat16;
+  for (size_t i = 0; i < graph.input_types().size(); ++i) {
+    fp16 = fp16 || graph.input_types()[i] == kFloat16;
+    bf16 = bf16 || graph.input_types()[i] == kBfloat16;
+  }
+  std::ostringstream os;
+  if (fp16) os << "#include <cuda_fp16.h>\n";
+  if (bf16) os << "#include <cuda_bf16.h>\n";
+  os << "extern \"C\" __global__ void " << name << "(long long n";
+  for (size_t i = 0; i < graph.input_types().size(); ++i) {
+    os << ", const " << CUDATypeName(graph.input_types()[i]) << " *__restrict__ in" << i;
+  }
+  os << ", " << CUDATypeName(graph.output_type()) << " *__restrict__ out";
+  for (size_t i = 0; i < graph.scalars().size(); ++i) os << ", " << atype << " s" << i;
+  os << ") {\n"
+     << "  for (long long i = blockIdx.x * (long long)blockDim.x + threadIdx.x; i < n;\n"
+     << "       i += (long long)blockDim.x * gridDim.x) {\n";
+  for (size_t i = 0; i < nodes.size(); ++i) {
+    if (!live[i]) continue;
+    const Node &nd = nodes[i];
+    std::ostringstream a, b;
+    a << 'v' << nd.lhs;
+    b << 'v' << nd.rhs;
+    os << "    const " << atype << " v" << i << " = ";
+    switch (nd.op) {
+      case kInput: {
+        const int t = graph.input_types()[nd.index];
+        if (t == kFloat16) {
+          os << '(' << atype << ")__half2float(in" << nd.index << "[i])";
+        } else if (t == kBfloat16) {
+          os << '(' << atype << ")__bfloat162float(in" << nd.index << "[i])";
+        } else {
+          os << '(' << atype << ")in" << nd.index << "[i]";
+        }
+        break;
+      }
+      case kScalar: os << 's' << nd.index; break;
+      case kIdentity: os << a.str(); break;
+      case kExp: os << "exp" << f << '(' << a.str() << ')'; break;
+      case kLog: os << "log" << f << '(' << a.str() << ')'; break;
+      case kTanh: os << "tanh" << f << '(' << a.str() << ')'; break;
+      case kSqrt: os << "sqrt" << f << '(' << a.str() << ')'; break;
+      case kSigmoid:
+        os << '(' << atype << ")1 / ((" << atype << ")1 + exp" << f << "(-" << a.str() << "))";
+        break;
+      case kPlus: os << a.str() << " + " << b.str(); break;
+      case kMinus: os << a.str() << " - " << b.str(); break;
+      case kMul: os << a.str() << " * " << b.str(); break;
+      case kDiv: os << a.str() << " / " << b.str(); break;
+      case kMaximum: os << a.str() << " > " << b.str() << " ? " << a.str() << " : " << b.str();
+        break;
+      case kMinimum: os << a.str() << " < " << b.str() << " ? " << a.str() << " : " << b.str();
+        break;
+      default: LOG(FATAL) << "fused::GenerateCUDASource: unknown op " << nd.op;
+    }
+    os << ";\n";
+  }
+  os << "    out[i] = ";
+  if (graph.output_type() == kFloat16) {
+    os << "__float2half((float)v" << graph.output() << ')';
+  } else if (graph.output_type() == kBfloat16) {
+    os << "__float2bfloat16((float)v" << graph.output() << ')';
+  } else {
+    os << '(' << CUDATypeName(graph.output_type()) << ")v" << graph.output();
+  }
+  os << ";\n  }\n}\n";
+  return os.str();
+}
+
+#if MSHADOW_USE_NVRTC
+#define MSHADOW_NVRTC_CALL(func)                                         \
+  {                                                                     \
+    nvrtcResult e = (func);                                             \
+    CHECK_EQ(e, NVRTC_SUCCESS) << "NVRTC: " << nvrtcGetErrorString(e);  \
+  }
+#define MSHADOW_CU_CALL(func)                                           \
+  {                                                                     \
+    CUresult e = (func);                                                \
+    if (e != CUDA_SUCCESS) {                                            \
+      const char *msg = "";                                             \
+      cuGetErrorString(e, &msg);                                        \
+      LOG(FATAL) << "CUDA driver: " << msg;                             \
+    }                                                                   \
+  }
+/*!
+ * \brief a graph compiled by NVRTC for one device, the module is loaded into the primary
+ *  context of the device, which the runtime API of the streams uses as well
+ */
+class GPUProgram {
+ public:
+  GPUProgram(const Graph &graph, int dev_id) {
+    const std::string src = GenerateCUDASource(graph, "mshadow_fused_kernel");
+    int major = 0, minor = 0;
+    MSHADOW_CUDA_CALL(cudaDeviceGetAttribute(&major, cudaDevAttrComputeCapabilityMajor, dev_id));
+    MSHADOW_CUDA_CALL(cudaDeviceGetAttribute(&minor, cudaDevAttrComputeCapabilityMinor, dev_id));
+    std::ostringstream arch;
+    arch << "--gpu-architecture=compute_" << major << minor;
+    // the headers of the half types are found under MSHADOW_NVRTC_INCLUDE or CUDA_HOME
+    const char *inc = getenv("MSHADOW_NVRTC_INCLUDE");
+    const char *home = getenv("CUDA_HOME");
+    const std::string include = std::string("--include-path=") +
+        (inc != NULL ? std::string(inc) :
+         std::string(home != NULL ? home : "/usr/local/cuda") + "/include");
+    const std::string arch_opt = arch.str();
+    const char *opts[] = {arch_opt.c_str(), include.c_str(), "--std=c++11"};
+    nvrtcProgram prog;
+    MSHADOW_NVRTC_CALL(nvrtcCreateProgram(&prog, src.c_str(), "mshadow_fused.cu", 0, NULL, NULL));
+    const nvrtcResult ret = nvrtcCompileProgram(prog, 3, opts);
+    if (ret != NVRTC_SUCCESS) {
+      size_t log_size = 0;
+      nvrtcGetProgramLogSize(prog, &log_size);
+      std::string log(log_size, '\0');
+      nvrtcGetProgramLog(prog, &log[0]);
+      nvrtcDestroyProgram(&prog);
+      LOG(FATAL) << "fused::GPUProgram: NVRTC failed: " << nvrtcGetErrorString(ret)
+                 << "\n" << log << "\n" << src;
+    }
+    size_t ptx_size = 0;
+    MSHADOW_NVRTC_CALL(nvrtcGetPTXSize(prog, &ptx_size));
+    std::string ptx(ptx_size, '\0');
+    MSHADOW_NVRTC_CALL(nvrtcGetPTX(prog, &ptx[0]));
+    MSHADOW_NVRTC_CALL(nvrtcDestroyProgram(&prog));
+    MSHADOW_CU_CALL(cuModuleLoadData(&module_, ptx.c_str()));
+    MSHADOW_CU_CALL(cuModuleGetFunction(&func_, module_, "mshadow_fused_kernel"));
+  }
+  ~GPUProgram(void) {
+    // the module is only unloaded while the driver is still up, not at exit
+    cuModuleUnload(module_);
+  }
+  /*! \brief launch the kernel over size elements on stream */
+  inline void Run(const Graph &graph, const std::vector<TBlob> &in, const TBlob &out,
+                  index_t size, cudaStream_t stream) const {
+    const bool dbl = graph.compute_type() == kFloat64;
+    long long n = size;  // NOLINT(*)
+    std::vector<void*> ptr(in.size() + 1);
+    std::vector<float> fscalar(graph.scalars().begin(), graph.scalars().end());
+    std::vector<double> dscalar(graph.scalars());
+    std::vector<void*> args;
+    args.push_back(&n);
+    for (size_t i = 0; i < in.size(); ++i) {
+      ptr[i] = in[i].dptr_;
+      args.push_back(&ptr[i]);
+    }
+    ptr[in.size()] = out.dptr_;
+    args.push_back(&ptr[in.size()]);
+    for (size_t i = 0; i < dscalar.size(); ++i) {
+      args.push_back(dbl ? static_cast<void*>(&dscalar[i]) : static_cast<void*>(&fscalar[i]));
+    }
+    const unsigned kThread = 256, kMaxBlock = 65535;
+    const unsigned nblock = static_cast<unsigned>(
+        std::min<size_t>((size + kThread - 1) / kThread, kMaxBlock));
+    MSHADOW_CU_CALL(cuLaunchKernel(func_, nblock, 1, 1, kThread, 1, 1, 0,
+                                   reinterpret_cast<CUstream>(stream), &args[0], NULL));
+  }
+
+ private:
+  CUmodule module_;
+  CUfunction func_;
+};
+/*!
+ * \brief evaluate graph on gpu, see Run of cpu, the kernel is compiled by NVRTC the first
+ *  time the signature is seen on the current device
+ */
+inline void Run(const Graph &graph, const std::vector<TBlob> &in, const TBlob &out,
+                Stream<gpu> *stream) {
+  const index_t size = CheckBlobs(graph, in, out, gpu::kDevMask);
+  if (size == 0) return;
+  int dev_id = 0;
+  MSHADOW_CUDA_CALL(cudaGetDevice(&dev_id));
+  std::ostringstream key;
+  key << dev_id << '@' << graph.Signature();
+  std::shared_ptr<const GPUProgram> prog = ProgramCache<GPUProgram>::Get()->Lookup(
+      key.str(), [&graph, dev_id]() { return new GPUProgram(graph, dev_id); });
+  prog->Run(graph, in, out, size, Stream<gpu>::GetStream(stream));
+}
+#else
+inline void Run(const Graph &graph, const std::vector<TBlob> &in, const TBlob &out,
+                Stream<gpu> *stream) {
+  LOG(FATAL) << "fused::Run on gpu requires MSHADOW_USE_NVRTC=1";
+}
+#endif  // MSHADOW_USE_NVRTC
+}  // namespace fused
+}  // namespace mshadow
+#endif  // MSHADOW_IN_CXX11
+#endif  // MSHADOW_FUSED_GRAPH_H_
@@ -0,0 +1,400 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file gemm_cpu-inl.h
+ * \brief built-in CPU GEMM used when no BLAS library is linked (MSHADOW_STAND_ALONE).
+ *  The operands are packed into cache sized blocks and multiplied by a register
+ *  blocked packet micro kernel, in the same column major convention as BLAS.
+ *  Also the uint8 x int8 -> int32 GEMM of the quantized dot.
+ */
+#ifndef MSHADOW_GEMM_CPU_INL_H_
+#define MSHADOW_GEMM_CPU_INL_H_
+#include <algorithm>
+#include <cstring>
+#include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+#if defined(__AVX512VNNI__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#include "./base.h"
+#include "./tensor.h"
+#include "./packet-inl.h"
+
+namespace mshadow {
+/*! \brief namespace of the built-in matrix multiplication */
+namespace gemm {
+/*!
+ * \brief block sizes of the GEMM
+ * \tparam DType data type
+ * \tparam Arch packet arch used by the micro kernel
+ */
+template<typename DType, packet::PacketArch Arch>
+struct GemmBlock {
+  typedef packet::Packet<DType, Arch> TPacket;
+  /*! \brief number of packets in a column of the micro tile */
+  static const index_t kMRPacket = 2;
+  /*! \brief rows of the micro tile */
+  static const index_t kMR = kMRPacket * TPacket::kSize;
+  /*! \brief columns of the micro tile */
+  static const index_t kNR = 4;
+  /*! \brief depth of a packed block, kMR x kKC micro panels stay in L1 */
+  static const index_t kKC = 256;
+  /*! \brief rows of a packed block of A, stays in L2 */
+  static const index_t kMC = 128;
+  /*! \brief columns of a packed block of B */
+  static const index_t kNC = 2048;
+};
+
+/*!
+ * \brief pack op(A)[ic:ic+mc, pc:pc+kc] into micro panels of kMR rows,
+ *  each panel is stored k major, rows beyond mc are zero filled
+ */
+template<typename DType, packet::PacketArch Arch>
+inline void PackA(bool trans, const DType *A, int lda,
+                  index_t ic, index_t mc, index_t pc, index_t kc, DType *dst) {
+  const index_t kMR = GemmBlock<DType, Arch>::kMR;
+  for (index_t ir = 0; ir < mc; ir += kMR) {
+    const index_t mr = std::min(kMR, mc - ir);
+    for (index_t p = 0; p < kc; ++p, dst += kMR) {
+      for (index_t r = 0; r < mr; ++r) {
+        const index_t i = ic + ir + r, q = pc + p;
+        dst[r] = trans ? A[q + i * lda] : A[i + q * lda];
+      }
+      for (index_t r = mr; r < kMR; ++r) dst[r] = DType(0);
+    }
+  }
+}
+/*!
+ * \brief pack op(B)[pc:pc+kc, jc+jr:jc+jr+kNR] into one k major micro panel,
+ *  columns beyond nc are zero filled
+ */
+template<typename DType, packet::PacketArch Arch>
+inline void PackB(bool trans, const DType *B, int ldb,
+                  index_t pc, index_t kc, index_t jc, index_t nr, DType *dst) {
+  const index_t kNR = GemmBlock<DType, Arch>::kNR;
+  for (index_t p = 0; p < kc; ++p, dst += kNR) {
+    for (index_t c = 0; c < nr; ++c) {
+      const index_t j = jc + c, q = pc + p;
+      dst[c] = trans ? B[j + q * ldb] : B[q + j * ldb];
+    }
+    for (index_t c = nr; c < kNR; ++c) dst[c] = DType(0);
+  }
+}
+/*!
+ * \brief micro kernel, tile = A panel * B panel, tile is kMR x kNR column major
+ */
+template<typename DType, packet::PacketArch Arch>
+MSHADOW_CINLINE void MicroKernel(index_t kc, const DType *pa, const DType *pb, DType *tile) {
+  typedef GemmBlock<DType, Arch> Block;
+  typedef typename Block::TPacket TPacket;
+  TPacket acc[Block::kNR][Block::kMRPacket];
+  for (index_t j = 0; j < Block::kNR; ++j) {
+    for (index_t r = 0; r < Block::kMRPacket; ++r) {
+      acc[j][r] = TPacket::Fill(DType(0));
+    }
+  }
+  for (index_t p = 0; p < kc; ++p, pa += Block::kMR, pb += Block::kNR) {
+    TPacket a[Block::kMRPacket];
+    for (index_t r = 0; r < Block::kMRPacket; ++r) {
+      a[r] = TPacket::Load(pa + r * TPacket::kSize);
+    }
+    for (index_t j = 0; j < Block::kNR; ++j) {
+      TPacket b = TPacket::Fill(pb[j]);
+      for (index_t r = 0; r < Block::kMRPacket; ++r) {
+        acc[j][r] = packet::FMA(a[r], b, acc[j][r]);
+      }
+    }
+  }
+  for (index_t j = 0; j < Block::kNR; ++j) {
+    for (index_t r = 0; r < Block::kMRPacket; ++r) {
+      acc[j][r].Store(tile + j * Block::kMR + r * TPacket::kSize);
+    }
+  }
+}
+/*!
+ * \brief C = alpha * op(A) * op(B) + beta * C, all matrices column major,
+ *   same arguments as cblas_gemm
+ * \param stream the stream, decides the number of threads
+ */
+template<typename DType, packet::PacketArch Arch>
+inline void Gemm(Stream<cpu> *stream,
+                 bool transa, bool transb,
+                 int m, int n, int k, DType alpha,
+                 const DType *A, int lda, const DType *B, int ldb,
+                 DType beta, DType *C, int ldc) {
+  typedef GemmBlock<DType, Arch> Block;
+  const index_t kMR = Block::kMR, kNR = Block::kNR;
+  const index_t kKC = Block::kKC, kMC = Block::kMC, kNC = Block::kNC;
+  if (m <= 0 || n <= 0) return;
+  if (k <= 0 || alpha == DType(0)) {
+    for (int j = 0; j < n; ++j) {
+      for (int i = 0; i < m; ++i) {
+        C[i + j * ldc] = beta == DType(0) ? DType(0) : beta * C[i + j * ldc];
+      }
+    }
+    return;
+  }
+  const int nthread = GetNumParallelThread(
+      stream, static_cast<size_t>(m) * static_cast<size_t>(n) * static_cast<size_t>(k));
+  // per thread, a packed block of A followed by a micro tile
+  const size_t abuf = kMC * kKC + kMR * kNR;
+  size_t pitch;
+  DType *bpack = static_cast<DType*>(packet::AlignedMallocPitch(
+      &pitch, kKC * kNC * sizeof(DType), 1));
+  DType *apack = static_cast<DType*>(packet::AlignedMallocPitch(
+      &pitch, abuf * sizeof(DType), nthread));
+  const index_t astride = static_cast<index_t>(pitch / sizeof(DType));
+  for (index_t jc = 0; jc < static_cast<index_t>(n); jc += kNC) {
+    const index_t nc = std::min(kNC, n - jc);
+    const index_t npanel = (nc + kNR - 1) / kNR;
+    for (index_t pc = 0; pc < static_cast<index_t>(k); pc += kKC) {
+      const index_t kc = std::min(kKC, k - pc);
+      // beta only applies to the first block along k
+      const DType beta_ = pc == 0 ? beta : DType(1);
+      #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+      for (openmp_index_t jp = 0; jp < npanel; ++jp) {
+        const index_t jr = static_cast<index_t>(jp) * kNR;
+        PackB<DType, Arch>(transb, B, ldb, pc, kc, jc + jr,
+                           std::min(kNR, nc - jr), bpack + jr * kc);
+      }
+      // split the rows of C into kMC blocks and the columns into chunks of panels,
+      // so that small m still keeps all threads busy
+      const index_t nib = (m + kMC - 1) / kMC;
+      const index_t njb = std::min(npanel, std::max(
+          index_t(1), (static_cast<index_t>(nthread) + nib - 1) / nib));
+      #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+      for (openmp_index_t item = 0; item < nib * njb; ++item) {
+#ifdef _OPENMP
+        const index_t tid = static_cast<index_t>(omp_get_thread_num());
+#else
+        const index_t tid = 0;
+#endif
+        DType *pa = apack + tid * astride;
+        DType *tile = pa + kMC * kKC;
+        const index_t ic = (static_cast<index_t>(item) / njb) * kMC;
+        const index_t mc = std::min(kMC, m - ic);
+        const index_t jb = static_cast<index_t>(item) % njb;
+        const index_t pbegin = npanel * jb / njb, pend = npanel * (jb + 1) / njb;
+        PackA<DType, Arch>(transa, A, lda, ic, mc, pc, kc, pa);
+        for (index_t jp = pbegin; jp < pend; ++jp) {
+          const index_t jr = jp * kNR;
+          const index_t nr = std::min(kNR, nc - jr);
+          for (index_t ir = 0; ir < mc; ir += kMR) {
+            const index_t mr = std::min(kMR, mc - ir);
+            MicroKernel<DType, Arch>(kc, pa + ir * kc, bpack + jr * kc, tile);
+            for (index_t j = 0; j < nr; ++j) {
+              DType *c = C + (ic + ir) + (jc + jr + j) * ldc;
+              const DType *t = tile + j * kMR;
+              if (beta_ == DType(0)) {
+                for (index_t i = 0; i < mr; ++i) c[i] = alpha * t[i];
+              } else {
+                for (index_t i = 0; i < mr; ++i) c[i] = alpha * t[i] + beta_ * c[i];
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+  packet::AlignedFree(bpack);
+  packet::AlignedFree(apack);
+}
+#ifdef __AVX512VNNI__
+/*! \brief columns of the packed panels of the int8 GEMM, one register of int32 */
+const index_t kInt8NR = 16;
+/*!
+ * \brief pack B[0:k, jc:jc+kInt8NR] (int8, row major) so that the 4 values of each
+ *  column in a quad of rows are adjacent, rows and columns beyond k and n are zero
+ */
+inline void PackBInt8(const int8_t *B, int ldb, index_t k, index_t n, index_t jc,
+                      int8_t *dst) {
+  const index_t nr = std::min(kInt8NR, n - jc);
+  for (index_t q = 0; q < k; q += 4, dst += 4 * kInt8NR) {
+    for (index_t c = 0; c < kInt8NR; ++c) {
+      for (index_t t = 0; t < 4; ++t) {
+        dst[c * 4 + t] =
+            (c < nr && q + t < k) ? B[(q + t) * ldb + jc + c] : static_cast<int8_t>(0);
+      }
+    }
+  }
+}
+/*!
+ * \brief mr <= 4 rows of C = A * B over the packed panels of B with vpdpbusd,
+ *  the rows of pa are padded to k4, crow holds mr rows of npanel * kInt8NR values
+ */
+inline void Int8RowKernel(index_t mr, index_t k4, index_t npanel, const uint8_t *pa,
+                          const int8_t *pb, int32_t *crow) {
+  const index_t cstride = npanel * kInt8NR;
+  for (index_t jp = 0; jp < npanel; ++jp) {
+    const int8_t *b = pb + jp * k4 * kInt8NR;
+    __m512i acc[4];
+    for (index_t r = 0; r < 4; ++r) acc[r] = _mm512_setzero_si512();
+    for (index_t q = 0; q < k4; q += 4, b += 4 * kInt8NR) {
+      const __m512i vb = _mm512_loadu_si512(b);
+      for (index_t r = 0; r < mr; ++r) {
+        int32_t a4;
+        std::memcpy(&a4, pa + r * k4 + q, sizeof(a4));
+        acc[r] = _mm512_dpbusd_epi32(acc[r], _mm512_set1_epi32(a4), vb);
+      }
+    }
+    for (index_t r = 0; r < mr; ++r) {
+      _mm512_storeu_si512(crow + r * cstride + jp * kInt8NR, acc[r]);
+    }
+  }
+}
+#endif  // __AVX512VNNI__
+/*!
+ * \brief C = (A - a_zero) * B with uint8 A (m x k), int8 B (k x n) and int32 C,
+ *  row major with leading dimensions lda and ldb. Rows of C are not stored, each
+ *  finished row i is passed as out(i, row) with n values, so that the caller can
+ *  requantize it while it is in cache.
+ *  Uses cblas_gemm_s8u8s32 with MKL, otherwise a VNNI or AVX2 kernel when the compiler
+ *  targets them, otherwise a portable kernel, all exact in int32.
+ * \param stream the stream, decides the number of threads
+ */
+template<typename Saver>
+inline void GemmU8S8S32(Stream<cpu> *stream, int m, int n, int k,
+                        const uint8_t *A, int lda, int32_t a_zero,
+                        const int8_t *B, int ldb, const Saver &out) {
+  if (m <= 0 || n <= 0) return;
+  // the zero point of A is taken out of the accumulators with the column sums of B
+  std::vector<int32_t> colsum(n, 0);
+  for (int p = 0; p < k; ++p) {
+    for (int j = 0; j < n; ++j) colsum[j] += B[p * ldb + j];
+  }
+#ifdef _OPENMP
+  const int nthread = GetNumParallelThread(
+      stream, static_cast<size_t>(m) * static_cast<size_t>(n) * static_cast<size_t>(k));
+#endif
+#if MSHADOW_USE_MKL && defined(INTEL_MKL_VERSION) && INTEL_MKL_VERSION >= 20180000
+  // column major C^T = B^T * A^T, MKL takes the signed operand first
+  std::vector<int32_t> c(static_cast<size_t>(m) * n);
+  const MKL_INT32 co = 0;
+  cblas_gemm_s8u8s32(CblasColMajor, CblasNoTrans, CblasNoTrans, CblasFixOffset,
+                     n, m, k, 1.0f, B, ldb, 0, A, lda, 0, 0.0f, &c[0], n, &co);
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < static_cast<openmp_index_t>(m); ++i) {
+    int32_t *row = &c[0] + static_cast<size_t>(i) * n;
+    for (int j = 0; j < n; ++j) row[j] -= a_zero * colsum[j];
+    out(static_cast<index_t>(i), row);
+  }
+#elif defined(__AVX512VNNI__)
+  const index_t k4 = (static_cast<index_t>(k) + 3) / 4 * 4;
+  const index_t npanel = (static_cast<index_t>(n) + kInt8NR - 1) / kInt8NR;
+  std::vector<int8_t> pb(npanel * k4 * kInt8NR);
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t jp = 0; jp < static_cast<openmp_index_t>(npanel); ++jp) {
+    PackBInt8(B, ldb, k, n, static_cast<index_t>(jp) * kInt8NR,
+              &pb[0] + static_cast<index_t>(jp) * k4 * kInt8NR);
+  }
+  // blocks of 4 rows, the rows of A are copied and padded to k4
+  const index_t nblock = (static_cast<index_t>(m) + 3) / 4;
+  #pragma omp parallel num_threads(nthread) if (nthread > 1)
+  {
+    std::vector<uint8_t> pa(4 * k4, 0);
+    std::vector<int32_t> crow(4 * npanel * kInt8NR);
+    #pragma omp for schedule(static)
+    for (openmp_index_t bi = 0; bi < static_cast<openmp_index_t>(nblock); ++bi) {
+      const index_t i = static_cast<index_t>(bi) * 4;
+      const index_t mr = std::min(index_t(4), m - i);
+      for (index_t r = 0; r < mr; ++r) {
+        std::memcpy(&pa[r * k4], A + (i + r) * lda, k);
+      }
+      Int8RowKernel(mr, k4, npanel, &pa[0], &pb[0], &crow[0]);
+      for (index_t r = 0; r < mr; ++r) {
+        int32_t *row = &crow[r * npanel * kInt8NR];
+        for (int j = 0; j < n; ++j) row[j] -= a_zero * colsum[j];
+        out(i + r, row);
+      }
+    }
+  }
+#elif defined(__AVX2__)
+  // blocks of 4 rows of C times 16 columns, pairs of rows of B are widened to int16
+  // and multiplied by pairs of A with vpmaddwd, exact in int32
+  const index_t nblock = (static_cast<index_t>(m) + 3) / 4;
+  const index_t n16 = static_cast<index_t>(n) / 16 * 16;
+  #pragma omp parallel num_threads(nthread) if (nthread > 1)
+  {
+    std::vector<int32_t> rows(4 * n);
+    #pragma omp for schedule(static)
+    for (openmp_index_t bi = 0; bi < static_cast<openmp_index_t>(nblock); ++bi) {
+      const index_t i = static_cast<index_t>(bi) * 4;
+      const index_t mr = std::min(index_t(4), m - i);
+      for (index_t j0 = 0; j0 < n16; j0 += 16) {
+        __m256i lo[4], hi[4];
+        for (index_t r = 0; r < 4; ++r) lo[r] = hi[r] = _mm256_setzero_si256();
+        for (int p = 0; p < k; p += 2) {
+          const __m256i b0 = _mm256_cvtepi8_epi16(
+              _mm_loadu_si128(reinterpret_cast<const __m128i*>(B + p * ldb + j0)));
+          const __m256i b1 = p + 1 < k ? _mm256_cvtepi8_epi16(
+              _mm_loadu_si128(reinterpret_cast<const __m128i*>(B + (p + 1) * ldb + j0)))
+              : _mm256_setzero_si256();
+          const __m256i bl = _mm256_unpacklo_epi16(b0, b1);
+          const __m256i bh = _mm256_unpackhi_epi16(b0, b1);
+          for (index_t r = 0; r < mr; ++r) {
+            const uint8_t *a = A + (i + r) * lda + p;
+            const int32_t a2 = a[0] | (p + 1 < k ? static_cast<int32_t>(a[1]) << 16 : 0);
+            const __m256i va = _mm256_set1_epi32(a2);
+            lo[r] = _mm256_add_epi32(lo[r], _mm256_madd_epi16(va, bl));
+            hi[r] = _mm256_add_epi32(hi[r], _mm256_madd_epi16(va, bh));
+          }
+        }
+        for (index_t r = 0; r < mr; ++r) {
+          // the unpacks interleave the 128 bit lanes, columns 0-3 and 8-11 are in lo
+          int32_t *c = &rows[r * n + j0];
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(c),
+                              _mm256_permute2x128_si256(lo[r], hi[r], 0x20));
+          _mm256_storeu_si256(reinterpret_cast<__m256i*>(c + 8),
+                              _mm256_permute2x128_si256(lo[r], hi[r], 0x31));
+        }
+      }
+      for (index_t r = 0; r < mr; ++r) {
+        int32_t *c = &rows[r * n];
+        const uint8_t *a = A + (i + r) * lda;
+        for (index_t j = n16; j < static_cast<index_t>(n); ++j) c[j] = 0;
+        for (int p = 0; p < k; ++p) {
+          for (index_t j = n16; j < static_cast<index_t>(n); ++j) {
+            c[j] += static_cast<int32_t>(a[p]) * B[p * ldb + j];
+          }
+        }
+        for (int j = 0; j < n; ++j) c[j] -= a_zero * colsum[j];
+        out(i + r, c);
+      }
+    }
+  }
+#else
+  // blocks of 4 rows of C times chunks of kChunk columns stay in L1 and reuse each
+  // row of B 4 times, rows of B are contiguous so that the compiler vectorizes
+  const index_t kChunk = 256;
+  const index_t nblock = (static_cast<index_t>(m) + 3) / 4;
+  #pragma omp parallel num_threads(nthread) if (nthread > 1)
+  {
+    std::vector<int32_t> rows(4 * n);
+    #pragma omp for schedule(static)
+    for (openmp_index_t bi = 0; bi < static_cast<openmp_index_t>(nblock); ++bi) {
+      const index_t i = static_cast<index_t>(bi) * 4;
+      const index_t mr = std::min(index_t(4), m - i);
+      for (index_t j0 = 0; j0 < static_cast<index_t>(n); j0 += kChunk) {
+        const index_t nc = std::min(kChunk, n - j0);
+        for (index_t r = 0; r < mr; ++r) {
+          int32_t *c = &rows[r * n + j0];
+          for (index_t j = 0; j < nc; ++j) c[j] = -a_zero * colsum[j0 + j];
+        }
+        for (int p = 0; p < k; ++p) {
+          const int8_t *b = B + p * ldb + j0;
+          for (index_t r = 0; r < mr; ++r) {
+            const int32_t ap = A[(i + r) * lda + p];
+            int32_t *c = &rows[r * n + j0];
+            for (index_t j = 0; j < nc; ++j) c[j] += ap * b[j];
+          }
+        }
+      }
+      for (index_t r = 0; r < mr; ++r) out(i + r, &rows[r * n]);
+    }
+  }
+#endif  // MSHADOW_USE_MKL && INTEL_MKL_VERSION >= 20180000
+}
+}  // namespace gemm
+}  // namespace mshadow
+#endif  // MSHADOW_GEMM_CPU_INL_H_
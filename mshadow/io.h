@@ -6,8 +6,17 @@
  */
 #ifndef MSHADOW_IO_H_
 #define MSHADOW_IO_H_
+#include <algorithm>
 #include "./tensor.h"
 
+/*!
+ * \brief size of the chunks a GPU tensor is moved through in SaveBinary/LoadBinary,
+ *  twice of this is the host memory needed
+ */
+#ifndef MSHADOW_IO_CHUNK_BYTES
+#define MSHADOW_IO_CHUNK_BYTES (16UL << 20)
+#endif
+
 namespace mshadow {
 namespace utils {
 /*!
@@ -84,6 +93,92 @@ template<int dim, typename DType, typename TStream>
 inline void LoadBinary(TStream &fi, // NOLINT(*)
                        Tensor<gpu, dim, DType> *dst, bool pre_alloc);
 
+#if MSHADOW_USE_CUDA
+class AsyncIOHandle;
+/*!
+ * \brief GPU: load a tensor by binary format asynchronously,
+ *   the file is read in chunks into two page-locked buffers in turn, so reading the
+ *   next chunk overlaps with copying the current one into the device.
+ *   It returns when the whole file is read, the last copies may still be running,
+ *   call handle->Wait() before using dst.
+ * \param fi input binary stream
+ * \param dst destination tensor, in the current device
+ * \param pre_alloc whether space is pre-allocated, if false, space allocation will happen
+ * \param handle the handle to wait on
+ * \param chunk_bytes size of each chunk
+ * \tparam dim dimension of tensor
+ * \tparam DType type of element in tensor
+ * \tparam TStream type of stream, need to support Read, Write, one example is utils::IStream.
+ */
+template<int dim, typename DType, typename TStream>
+inline void LoadBinaryAsync(TStream &fi, Tensor<gpu, dim, DType> *dst,  // NOLINT(*)
+                            bool pre_alloc, AsyncIOHandle *handle,
+                            size_t chunk_bytes = MSHADOW_IO_CHUNK_BYTES);
+/*!
+ * \brief handle of an asynchronous GPU transfer, holds a dedicated stream
+ *  and two page-locked buffers the data is moved through chunk by chunk
+ */
+class AsyncIOHandle {
+ public:
+  AsyncIOHandle(void) : stream_(NULL), nbytes_(0) {
+    buf_[0] = buf_[1] = NULL;
+  }
+  ~AsyncIOHandle(void) {
+    this->Wait();
+  }
+  /*! \brief whether all the copies issued are finished */
+  inline bool Done(void) const {
+    if (stream_ == NULL) return true;
+    cudaError_t err = cudaStreamQuery(stream_);
+    if (err == cudaErrorNotReady) return false;
+    MSHADOW_CUDA_CALL(err);
+    return true;
+  }
+  /*! \brief wait until all the copies finish, and release the resources */
+  inline void Wait(void) {
+    if (stream_ == NULL) return;
+    MSHADOW_CUDA_CALL(cudaStreamSynchronize(stream_));
+    for (int i = 0; i < 2; ++i) {
+      MSHADOW_CUDA_CALL(cudaEventDestroy(event_[i]));
+      FreeHost_<gpu>(buf_[i]);
+      buf_[i] = NULL;
+    }
+    MSHADOW_CUDA_CALL(cudaStreamDestroy(stream_));
+    stream_ = NULL;
+  }
+
+ private:
+  template<int dim, typename DType, typename TStream>
+  friend inline void LoadBinaryAsync(TStream &fi,  // NOLINT(*)
+                                     Tensor<gpu, dim, DType> *dst, bool pre_alloc,
+                                     AsyncIOHandle *handle, size_t chunk_bytes);
+  template<int dim, typename DType, typename TStream>
+  friend inline void SaveBinary(TStream &fo,  // NOLINT(*)
+                                const Tensor<gpu, dim, DType> &src);
+  // allocate the stream and buffers of nbytes each, in the current device
+  inline void Init(size_t nbytes) {
+    this->Wait();
+    MSHADOW_CUDA_CALL(cudaStreamCreateWithFlags(&stream_, cudaStreamNonBlocking));
+    for (int i = 0; i < 2; ++i) {
+      MSHADOW_CUDA_CALL(cudaEventCreateWithFlags(&event_[i], cudaEventDisableTiming));
+      buf_[i] = AllocHost_<gpu>(nbytes);
+    }
+    nbytes_ = nbytes;
+  }
+  // the copy stream
+  cudaStream_t stream_;
+  // events marking the last copy from/to each buffer
+  cudaEvent_t event_[2];
+  // the page-locked buffers
+  void *buf_[2];
+  // size of each buffer
+  size_t nbytes_;
+  // disable copy
+  AsyncIOHandle(const AsyncIOHandle &other);
+  AsyncIOHandle &operator=(const AsyncIOHandle &other);
+};
+#endif  // MSHADOW_USE_CUDA
+
 // implementations
 template<int dim, typename DType, typename TStream>
 inline void SaveBinary(TStream &fo, const Tensor<cpu, dim, DType> &src_) { // NOLINT(*)
@@ -93,16 +188,48 @@ inline void SaveBinary(TStream &fo, const Tensor<cpu, dim, DType> &src_) { // NO
     fo.Write(src[i].dptr_, sizeof(DType) * src.size(1));
   }
 }
+#if MSHADOW_USE_CUDA
+template<int dim, typename DType, typename TStream>
+inline void SaveBinary(TStream &fo, const Tensor<gpu, dim, DType> &src_) { // NOLINT(*)
+  fo.Write(&src_.shape_, sizeof(src_.shape_));
+  if (src_.shape_.Size() == 0) return;
+  // copy to CPU chunk by chunk, the copy of next chunk overlaps with writing current one
+  Tensor<gpu, 2, DType> src = src_.FlatTo2D();
+  const size_t row_bytes = src.size(1) * sizeof(DType);
+  const index_t nrow = std::max(static_cast<index_t>(MSHADOW_IO_CHUNK_BYTES / row_bytes),
+                                index_t(1));
+  const index_t nchunk = (src.size(0) + nrow - 1) / nrow;
+  AsyncIOHandle handle;
+  handle.Init(nrow * row_bytes);
+  for (index_t c = 0; c <= nchunk; ++c) {
+    if (c < nchunk) {
+      const index_t i = c * nrow, n = std::min(nrow, src.size(0) - i);
+      MSHADOW_CUDA_CALL(cudaMemcpy2DAsync(handle.buf_[c % 2], row_bytes,
+                                          src[i].dptr_, src.stride_ * sizeof(DType),
+                                          row_bytes, n, cudaMemcpyDeviceToHost,
+                                          handle.stream_));
+      MSHADOW_CUDA_CALL(cudaEventRecord(handle.event_[c % 2], handle.stream_));
+    }
+    if (c != 0) {
+      const index_t p = c - 1, i = p * nrow, n = std::min(nrow, src.size(0) - i);
+      MSHADOW_CUDA_CALL(cudaEventSynchronize(handle.event_[p % 2]));
+      fo.Write(handle.buf_[p % 2], n * row_bytes);
+    }
+  }
+}
+#else
 template<int dim, typename DType, typename TStream>
 inline void SaveBinary(TStream &fo, const Tensor<gpu, dim, DType> &src) { // NOLINT(*)
   // copy to CPU, then save
   Tensor<cpu, dim, DType> tmp(src.shape_);
-  AllocSpace(&tmp);
+  AllocHost<gpu>(&tmp);
   Stream<gpu> stream;
   Copy(tmp, src, &stream);
+  stream.Wait();
   SaveBinary(fo, tmp);
-  FreeSpace(&tmp);
+  FreeHost<gpu>(&tmp);
 }
+#endif  // MSHADOW_USE_CUDA
 template<int dim, typename DType, typename TStream>
 inline void LoadBinary(TStream &fi, // NOLINT(*)
                        Tensor<cpu, dim, DType> *dst_, bool pre_alloc) {
@@ -119,19 +246,62 @@ inline void LoadBinary(TStream &fi, // NOLINT(*)
     CHECK_NE(fi.Read(dst[i].dptr_, sizeof(DType) * dst.size(1)), 0) << "mshadow::LoadBinary";
   }
 }
+#if MSHADOW_USE_CUDA
+template<int dim, typename DType, typename TStream>
+inline void LoadBinaryAsync(TStream &fi, Tensor<gpu, dim, DType> *dst_,  // NOLINT(*)
+                            bool pre_alloc, AsyncIOHandle *handle, size_t chunk_bytes) {
+  Shape<dim> shape;
+  CHECK_NE(fi.Read(&shape, sizeof(shape)), 0) << "mshadow::LoadBinary";
+  if (pre_alloc) {
+    CHECK_EQ(shape, dst_->shape_) << "LoadBinary, shape do not match pre-allocated shape";
+  } else {
+    dst_->shape_ = shape; AllocSpace(dst_);
+  }
+  if (shape.Size() == 0) return;
+  Tensor<gpu, 2, DType> dst = dst_->FlatTo2D();
+  const size_t row_bytes = dst.size(1) * sizeof(DType);
+  const index_t nrow = std::max(static_cast<index_t>(chunk_bytes / row_bytes), index_t(1));
+  handle->Init(nrow * row_bytes);
+  for (index_t i = 0, b = 0; i < dst.size(0); i += nrow, b = 1 - b) {
+    const index_t n = std::min(nrow, dst.size(0) - i);
+    // wait until the copy issued two chunks before releases the buffer
+    MSHADOW_CUDA_CALL(cudaEventSynchronize(handle->event_[b]));
+    CHECK_NE(fi.Read(handle->buf_[b], n * row_bytes), 0) << "mshadow::LoadBinary";
+    MSHADOW_CUDA_CALL(cudaMemcpy2DAsync(dst[i].dptr_, dst.stride_ * sizeof(DType),
+                                        handle->buf_[b], row_bytes, row_bytes, n,
+                                        cudaMemcpyHostToDevice, handle->stream_));
+    MSHADOW_CUDA_CALL(cudaEventRecord(handle->event_[b], handle->stream_));
+  }
+}
+template<int dim, typename DType, typename TStream>
+inline void LoadBinary(TStream &fi, // NOLINT(*)
+                       Tensor<gpu, dim, DType> *dst, bool pre_alloc) {
+  AsyncIOHandle handle;
+  LoadBinaryAsync(fi, dst, pre_alloc, &handle);
+  handle.Wait();
+}
+#else
 template<int dim, typename DType, typename TStream>
 inline void LoadBinary(TStream &fi, // NOLINT(*)
                        Tensor<gpu, dim, DType> *dst, bool pre_alloc) {
-  Tensor<cpu, dim, DType> tmp;
-  LoadBinary(fi, &tmp, false);
+  Shape<dim> shape;
+  CHECK_NE(fi.Read(&shape, sizeof(shape)), 0) << "mshadow::LoadBinary";
   if (pre_alloc) {
-    CHECK_EQ(tmp.shape, dst->shape_) << "LoadBinary, shape do not match pre-allocated shape";
+    CHECK_EQ(shape, dst->shape_) << "LoadBinary, shape do not match pre-allocated shape";
   } else {
-    dst->shape = tmp.shape; AllocSpace(dst);
+    dst->shape_ = shape; AllocSpace(dst);
   }
+  if (shape.Size() == 0) return;
+  // read into page-locked memory, so the copy to the device runs asynchronously
+  Tensor<cpu, dim, DType> tmp(shape);
+  AllocHost<gpu>(&tmp);
+  CHECK_NE(fi.Read(tmp.dptr_, sizeof(DType) * shape.Size()), 0) << "mshadow::LoadBinary";
   Stream<gpu> stream;
   Copy(*dst, tmp, &stream);
-  FreeSpace(&tmp);
+  // the copy reads tmp asynchronously, finish it before tmp is released
+  stream.Wait();
+  FreeHost<gpu>(&tmp);
 }
+#endif  // MSHADOW_USE_CUDA
 }  // namespace mshadow
 #endif  // MSHADOW_IO_H_
@@ -0,0 +1,286 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file memory_plan.h
+ * \brief static memory plan of a sequence of operations, the intermediate tensors share
+ *  one arena by their lifetimes
+ */
+#ifndef MSHADOW_MEMORY_PLAN_H_
+#define MSHADOW_MEMORY_PLAN_H_
+#include <algorithm>
+#include <utility>
+#include <vector>
+#include "./tensor.h"
+
+namespace mshadow {
+/*!
+ * \brief plans the memory of the tensors of a fixed sequence of operations.
+ *  The tensors and the operations that read and write them are declared in the order
+ *  they run, Plan then gives each tensor an offset in one arena, so that two tensors
+ *  share memory only if no operation lies in both of their lifetimes. A tensor lives
+ *  from the first to the last operation that uses it, the ones marked by KeepAlive,
+ *  such as the inputs and the outputs of the network, and the ones no operation uses
+ *  live for the whole sequence.
+ *
+ *  An operation may also declare that an output can be written over one of its inputs,
+ *  e.g. for an activation, the output then takes the memory of the input if this is the
+ *  last read of the input and it is at least as large.
+ *
+ *  The offsets are assigned greedily by size, largest first, each tensor into the
+ *  smallest gap left by the tensors already placed whose lifetimes overlap with it.
+ * \code
+ *  MemoryPlan<gpu> mp(stream);
+ *  int x = mp.Declare<float>(Shape2(batch, nin));
+ *  int h = mp.Declare<float>(Shape2(batch, nhidden));
+ *  int a = mp.Declare<float>(Shape2(batch, nhidden));
+ *  int y = mp.Declare<float>(Shape2(batch, nout));
+ *  mp.KeepAlive(x); mp.KeepAlive(y);
+ *  mp.AddOp({x}, {h});                                   // h = dot(x, w1)
+ *  mp.AddOp({h}, {a}, {std::make_pair(h, a)});           // a = F<sigmoid>(h), in place
+ *  mp.AddOp({a}, {y});                                   // y = dot(a, w2)
+ *  mp.Plan();
+ *  Tensor<gpu, 2> th = mp.Get<float, 2>(h);
+ * \endcode
+ * \tparam Device which device the arena is on
+ */
+template<typename Device>
+class MemoryPlan {
+ public:
+  /*! \brief alignment of each tensor in bytes */
+  static const size_t kAlign = 256;
+  /*! \brief pairs (input, output) of an operation that may share memory */
+  typedef std::vector<std::pair<int, int> > InplaceList;
+  /*!
+   * \brief constructor
+   * \param stream the stream the tensors are used on
+   */
+  explicit MemoryPlan(Stream<Device> *stream = NULL)
+      : stream_(stream), planned_(false), nop_(0),
+        arena_(static_cast<char*>(NULL), Shape1(0), stream) {}
+  ~MemoryPlan(void) {
+    this->Release();
+  }
+  /*!
+   * \brief declare a contiguous tensor
+   * \param shape shape of the tensor
+   * \return the id of the tensor
+   * \tparam DType type of element in tensor
+   * \tparam dim dimension of tensor
+   */
+  template<typename DType, int dim>
+  inline int Declare(const Shape<dim> &shape) {
+    CHECK(!planned_) << "MemoryPlan: Declare after Plan";
+    Entry e;
+    e.type_flag = DataType<DType>::kFlag;
+    e.shape.assign(shape.shape_, shape.shape_ + dim);
+    e.bytes = (shape.Size() * sizeof(DType) + kAlign - 1) / kAlign * kAlign;
+    e.begin = -1; e.end = -1;
+    e.keep = false;
+    e.group = static_cast<int>(entry_.size());
+    e.merged = -1;
+    e.offset = 0;
+    entry_.push_back(e);
+    return e.group;
+  }
+  /*! \brief keep tensor id alive during the whole sequence */
+  inline void KeepAlive(int id) {
+    this->CheckId(id);
+    entry_[id].keep = true;
+  }
+  /*!
+   * \brief declare the next operation of the sequence
+   * \param inputs the tensors it reads
+   * \param outputs the tensors it writes
+   * \param inplace pairs (input, output) where the output may be written over the input,
+   *  the input must not be read after the output is written
+   * \return the index of the operation
+   */
+  inline int AddOp(const std::vector<int> &inputs, const std::vector<int> &outputs,
+                   const InplaceList &inplace = InplaceList()) {
+    CHECK(!planned_) << "MemoryPlan: AddOp after Plan";
+    const int op = nop_++;
+    for (size_t i = 0; i < inputs.size(); ++i) this->Use(inputs[i], op);
+    for (size_t i = 0; i < outputs.size(); ++i) this->Use(outputs[i], op);
+    for (size_t i = 0; i < inplace.size(); ++i) {
+      this->CheckId(inplace[i].first);
+      this->CheckId(inplace[i].second);
+      CHECK(std::find(inputs.begin(), inputs.end(), inplace[i].first) != inputs.end() &&
+            std::find(outputs.begin(), outputs.end(), inplace[i].second) != outputs.end())
+          << "MemoryPlan: an inplace pair must be an input and an output of the operation";
+      inplace_.push_back(Inplace(op, inplace[i]));
+    }
+    return op;
+  }
+  /*!
+   * \brief assign the offsets and allocate the arena, the sequence can not change after
+   */
+  inline void Plan(void) {
+    CHECK(!planned_) << "MemoryPlan: Plan called twice";
+    planned_ = true;
+    for (size_t i = 0; i < entry_.size(); ++i) {
+      Entry &e = entry_[i];
+      if (e.keep || e.begin < 0) {
+        e.begin = 0; e.end = std::max(nop_ - 1, 0);
+      }
+    }
+    this->MergeInplace();
+    // place the groups, largest first
+    std::vector<int> order;
+    for (size_t i = 0; i < entry_.size(); ++i) {
+      if (entry_[i].group == static_cast<int>(i)) order.push_back(static_cast<int>(i));
+    }
+    std::sort(order.begin(), order.end(), BySize(entry_));
+    std::vector<int> placed;
+    size_t total = 0;
+    for (size_t k = 0; k < order.size(); ++k) {
+      Entry &e = entry_[order[k]];
+      std::vector<std::pair<size_t, size_t> > busy;
+      for (size_t j = 0; j < placed.size(); ++j) {
+        const Entry &p = entry_[placed[j]];
+        if (p.begin <= e.end && e.begin <= p.end) {
+          busy.push_back(std::make_pair(p.offset, p.offset + p.bytes));
+        }
+      }
+      std::sort(busy.begin(), busy.end());
+      size_t best = 0, best_gap = 0, top = 0;
+      bool found = false;
+      for (size_t j = 0; j < busy.size(); ++j) {
+        if (busy[j].first >= top + e.bytes) {
+          const size_t gap = busy[j].first - top;
+          if (!found || gap < best_gap) {
+            best = top; best_gap = gap; found = true;
+          }
+        }
+        top = std::max(top, busy[j].second);
+      }
+      e.offset = found ? best : top;
+      total = std::max(total, e.offset + e.bytes);
+      placed.push_back(order[k]);
+    }
+    for (size_t i = 0; i < entry_.size(); ++i) {
+      entry_[i].offset = entry_[entry_[i].group].offset;
+    }
+    arena_.shape_ = Shape1(static_cast<index_t>(total));
+    arena_.stride_ = arena_.shape_[0];
+    if (total != 0) AllocSpace(&arena_, false);
+  }
+  /*!
+   * \brief get the tensor id, in the arena, after Plan
+   * \tparam DType type of element in tensor, as declared
+   * \tparam dim dimension of tensor, as declared
+   */
+  template<typename DType, int dim>
+  inline Tensor<Device, dim, DType> Get(int id) const {
+    CHECK(planned_) << "MemoryPlan: Get before Plan";
+    this->CheckId(id);
+    const Entry &e = entry_[id];
+    CHECK_EQ(e.type_flag, DataType<DType>::kFlag) << "MemoryPlan: type of tensor " << id;
+    CHECK_EQ(e.shape.size(), static_cast<size_t>(dim)) << "MemoryPlan: dim of tensor " << id;
+    Shape<dim> shape;
+    for (int i = 0; i < dim; ++i) shape[i] = e.shape[i];
+    return Tensor<Device, dim, DType>(reinterpret_cast<DType*>(arena_.dptr_ + e.offset),
+                                      shape, stream_);
+  }
+  /*! \return offset of tensor id in the arena, after Plan */
+  inline size_t offset(int id) const {
+    this->CheckId(id);
+    return entry_[id].offset;
+  }
+  /*! \return the operations tensor id lives in, [first, last], after Plan */
+  inline std::pair<int, int> lifetime(int id) const {
+    this->CheckId(id);
+    const Entry &g = entry_[entry_[id].group];
+    return std::make_pair(g.begin, g.end);
+  }
+  /*! \return bytes of the arena, after Plan */
+  inline size_t arena_bytes(void) const {
+    return arena_.size(0);
+  }
+  /*! \return bytes the tensors would take without sharing */
+  inline size_t total_bytes(void) const {
+    size_t total = 0;
+    for (size_t i = 0; i < entry_.size(); ++i) total += entry_[i].bytes;
+    return total;
+  }
+  /*! \brief free the arena, tensors handed out must not be used anymore */
+  inline void Release(void) {
+    if (arena_.dptr_ != NULL) FreeSpace(&arena_);
+    arena_.dptr_ = NULL;
+    arena_.shape_ = Shape1(0);
+  }
+
+ private:
+  /*! \brief a declared tensor */
+  struct Entry {
+    int type_flag;
+    std::vector<index_t> shape;
+    /*! \brief aligned bytes, of the whole group for a group leader */
+    size_t bytes;
+    /*! \brief first and last operation using it, of the whole group for a leader */
+    int begin, end;
+    bool keep;
+    /*! \brief the tensor whose memory it shares, itself if none */
+    int group;
+    /*! \brief the last operation an output joined the group at, for a group leader */
+    int merged;
+    size_t offset;
+  };
+  /*! \brief an inplace pair of operation op */
+  struct Inplace {
+    int op;
+    std::pair<int, int> io;
+    Inplace(int op, const std::pair<int, int> &io) : op(op), io(io) {}
+  };
+  /*! \brief order of the groups: larger, then earlier first */
+  struct BySize {
+    const std::vector<Entry> &entry;
+    explicit BySize(const std::vector<Entry> &entry) : entry(entry) {}
+    inline bool operator()(int a, int b) const {
+      if (entry[a].bytes != entry[b].bytes) return entry[a].bytes > entry[b].bytes;
+      return a < b;
+    }
+  };
+  inline void CheckId(int id) const {
+    CHECK(id >= 0 && id < static_cast<int>(entry_.size())) << "MemoryPlan: invalid tensor " << id;
+  }
+  inline void Use(int id, int op) {
+    this->CheckId(id);
+    Entry &e = entry_[id];
+    if (e.begin < 0) e.begin = op;
+    e.end = op;
+  }
+  // let each output of an inplace pair join the group of its input when that is safe
+  inline void MergeInplace(void) {
+    for (size_t i = 0; i < inplace_.size(); ++i) {
+      const int op = inplace_[i].op;
+      const int in = inplace_[i].io.first, out = inplace_[i].io.second;
+      const int g = entry_[in].group;
+      Entry &gi = entry_[g], &eo = entry_[out];
+      // the group must end here, and the output must start here and not be shared yet;
+      // only one output of the operation may join a group, the outputs are written at once
+      if (in == out || gi.end != op || gi.merged == op || gi.keep || eo.keep ||
+          eo.begin != op || eo.group != out || eo.bytes > gi.bytes) {
+        continue;
+      }
+      eo.group = g;
+      gi.end = eo.end;
+      gi.merged = op;
+    }
+  }
+  /*! \brief the stream */
+  Stream<Device> *stream_;
+  /*! \brief whether Plan was called */
+  bool planned_;
+  /*! \brief number of operations */
+  int nop_;
+  /*! \brief the tensors */
+  std::vector<Entry> entry_;
+  /*! \brief the inplace pairs, in the order of the operations */
+  std::vector<Inplace> inplace_;
+  /*! \brief the arena */
+  Tensor<Device, 1, char> arena_;
+  // disable copy
+  MemoryPlan(const MemoryPlan &other);
+  MemoryPlan &operator=(const MemoryPlan &other);
+};
+}  // namespace mshadow
+#endif  // MSHADOW_MEMORY_PLAN_H_
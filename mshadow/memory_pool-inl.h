@@ -0,0 +1,396 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file memory_pool-inl.h
+ * \brief caching allocators for GPU device memory and pinned host memory,
+ *  enabled by MSHADOW_USE_GPU_POOL. cudaMalloc, cudaFree and their host counterparts
+ *  synchronize the device, the pools keep freed blocks in size class bins
+ *  and hand them out again without going to the driver.
+ */
+#ifndef MSHADOW_MEMORY_POOL_INL_H_
+#define MSHADOW_MEMORY_POOL_INL_H_
+#include "./base.h"
+#include "./logging.h"
+
+#if MSHADOW_USE_CUDA && MSHADOW_USE_GPU_POOL
+#if !MSHADOW_IN_CXX11
+#error "MSHADOW_USE_GPU_POOL requires c++11"
+#endif
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+namespace mshadow {
+/*! \brief namespace of the memory pools */
+namespace pool {
+/*!
+ * \brief round a request up to its size class, classes are multiples of 512 bytes
+ *  and there are four classes per power of two, wasting at most a quarter of a block
+ * \param size requested bytes
+ */
+inline size_t RoundSizeClass(size_t size) {
+  const size_t kMinBlock = 512;
+  if (size <= kMinBlock) return kMinBlock;
+  size_t bit = kMinBlock;
+  while ((bit << 1) < size) bit <<= 1;
+  const size_t step = bit >> 2;
+  return (size + step - 1) / step * step;
+}
+/*!
+ * \brief switch to a device for the lifetime of the object, and switch back
+ */
+class DeviceGuard {
+ public:
+  explicit DeviceGuard(int dev_id) {
+    MSHADOW_CUDA_CALL(cudaGetDevice(&prev_));
+    if (prev_ != dev_id) MSHADOW_CUDA_CALL(cudaSetDevice(dev_id));
+    dev_id_ = dev_id;
+  }
+  ~DeviceGuard() {
+    if (prev_ != dev_id_) cudaSetDevice(prev_);
+  }
+
+ private:
+  int prev_, dev_id_;
+};
+/*!
+ * \brief caching allocator of one GPU device.
+ *  A freed block is tagged with the stream it was freed on and an event recorded there.
+ *  The same stream may take the block back at once, since its work is ordered after
+ *  the earlier uses; other streams take it only after the event completed.
+ *  Cached blocks are returned to the driver with ReleaseAll or Trim,
+ *  and automatically when cudaMalloc runs out of memory.
+ */
+class GPUMemoryPool {
+ public:
+  /*!
+   * \brief get the pool of a device, pools live until the program exits
+   * \param dev_id the device id
+   */
+  inline static GPUMemoryPool *Get(int dev_id) {
+    static std::mutex mutex;
+    // never deleted: blocks may only be freed while the CUDA runtime is still loaded
+    static std::vector<GPUMemoryPool*> pools;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pools.size() == 0) {
+      int count = 0;
+      MSHADOW_CUDA_CALL(cudaGetDeviceCount(&count));
+      pools.resize(count, NULL);
+    }
+    CHECK(dev_id >= 0 && dev_id < static_cast<int>(pools.size()))
+        << "GPUMemoryPool: invalid device " << dev_id;
+    if (pools[dev_id] == NULL) pools[dev_id] = new GPUMemoryPool(dev_id);
+    return pools[dev_id];
+  }
+  /*! \brief get the pool of the current device */
+  inline static GPUMemoryPool *Get(void) {
+    int dev_id;
+    MSHADOW_CUDA_CALL(cudaGetDevice(&dev_id));
+    return Get(dev_id);
+  }
+  /*!
+   * \brief free a block to the pool it came from, looking at the current device first
+   * \param ptr pointer returned by Alloc
+   * \param stream the stream the last use of the block was issued on
+   */
+  inline static void FreeAny(void *ptr, cudaStream_t stream) {
+    if (ptr == NULL) return;
+    if (Get()->Free(ptr, stream)) return;
+    int count = 0;
+    MSHADOW_CUDA_CALL(cudaGetDeviceCount(&count));
+    for (int i = 0; i < count; ++i) {
+      if (Get(i)->Free(ptr, stream)) return;
+    }
+    LOG(FATAL) << "GPUMemoryPool: pointer was not allocated by the pool";
+  }
+  /*!
+   * \brief allocate a block of at least size bytes
+   * \param size bytes requested
+   * \param stream the stream the block will be used on
+   */
+  inline void *Alloc(size_t size, cudaStream_t stream) {
+    const size_t bytes = RoundSizeClass(size);
+    std::lock_guard<std::mutex> lock(mutex_);
+    DeviceGuard guard(dev_id_);
+    std::vector<Block> &bin = free_[bytes];
+    for (size_t i = bin.size(); i != 0; --i) {
+      Block &b = bin[i - 1];
+      if (b.stream == stream || cudaEventQuery(b.event) == cudaSuccess) {
+        void *ptr = b.ptr;
+        events_.push_back(b.event);
+        b = bin.back();
+        bin.pop_back();
+        cached_bytes_ -= bytes;
+        return this->Track(ptr, bytes);
+      }
+    }
+    void *ptr = NULL;
+    cudaError_t err = cudaMalloc(&ptr, bytes);
+    if (err == cudaErrorMemoryAllocation) {
+      // clear the error state, give the cached blocks back and try again
+      cudaGetLastError();
+      this->ReleaseCached(0);
+      err = cudaMalloc(&ptr, bytes);
+    }
+    MSHADOW_CUDA_CALL(err);
+    return this->Track(ptr, bytes);
+  }
+  /*!
+   * \brief return a block to the pool
+   * \param ptr the block
+   * \param stream the stream the last use of the block was issued on
+   * \return false if the block does not belong to this pool
+   */
+  inline bool Free(void *ptr, cudaStream_t stream) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<void*, size_t>::iterator it = used_.find(ptr);
+    if (it == used_.end()) return false;
+    DeviceGuard guard(dev_id_);
+    Block b;
+    b.ptr = ptr;
+    b.stream = stream;
+    if (events_.size() != 0) {
+      b.event = events_.back();
+      events_.pop_back();
+    } else {
+      MSHADOW_CUDA_CALL(cudaEventCreateWithFlags(&b.event, cudaEventDisableTiming));
+    }
+    MSHADOW_CUDA_CALL(cudaEventRecord(b.event, stream));
+    free_[it->second].push_back(b);
+    cached_bytes_ += it->second;
+    used_bytes_ -= it->second;
+    used_.erase(it);
+    return true;
+  }
+  /*! \brief give every cached block back to the driver */
+  inline void ReleaseAll(void) {
+    this->Trim(0);
+  }
+  /*!
+   * \brief give cached blocks back to the driver, largest first,
+   *  until at most max_cached_bytes stay cached
+   * \param max_cached_bytes number of bytes to keep
+   */
+  inline void Trim(size_t max_cached_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    DeviceGuard guard(dev_id_);
+    this->ReleaseCached(max_cached_bytes);
+  }
+  /*! \return bytes currently handed out */
+  inline size_t used_bytes(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return used_bytes_;
+  }
+  /*! \return bytes cached in the pool */
+  inline size_t cached_bytes(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_bytes_;
+  }
+
+ private:
+  /*! \brief a cached block */
+  struct Block {
+    /*! \brief device pointer */
+    void *ptr;
+    /*! \brief stream of the last use */
+    cudaStream_t stream;
+    /*! \brief recorded on stream when the block was freed */
+    cudaEvent_t event;
+  };
+  /*! \brief device of the pool */
+  int dev_id_;
+  /*! \brief guards all the members below */
+  std::mutex mutex_;
+  /*! \brief cached blocks of each size class */
+  std::map<size_t, std::vector<Block> > free_;
+  /*! \brief blocks handed out and their size class */
+  std::unordered_map<void*, size_t> used_;
+  /*! \brief spare events */
+  std::vector<cudaEvent_t> events_;
+  /*! \brief statistics */
+  size_t used_bytes_, cached_bytes_;
+
+  explicit GPUMemoryPool(int dev_id)
+      : dev_id_(dev_id), used_bytes_(0), cached_bytes_(0) {}
+  inline void *Track(void *ptr, size_t bytes) {
+    used_[ptr] = bytes;
+    used_bytes_ += bytes;
+    return ptr;
+  }
+  // requires the lock and the device to be set
+  inline void ReleaseCached(size_t max_cached_bytes) {
+    std::map<size_t, std::vector<Block> >::reverse_iterator it;
+    for (it = free_.rbegin(); it != free_.rend() && cached_bytes_ > max_cached_bytes; ++it) {
+      std::vector<Block> &bin = it->second;
+      while (bin.size() != 0 && cached_bytes_ > max_cached_bytes) {
+        // cudaFree synchronizes the device, so the pending uses are done
+        MSHADOW_CUDA_CALL(cudaFree(bin.back().ptr));
+        events_.push_back(bin.back().event);
+        bin.pop_back();
+        cached_bytes_ -= it->first;
+      }
+    }
+    if (max_cached_bytes == 0) {
+      for (size_t i = 0; i < events_.size(); ++i) {
+        MSHADOW_CUDA_CALL(cudaEventDestroy(events_[i]));
+      }
+      events_.clear();
+    }
+  }
+};
+/*!
+ * \brief caching allocator of page-locked host memory, shared by all devices.
+ *  The host may write a block as soon as it is handed out, so a block freed with
+ *  a stream is only reused after the work queued on that stream has completed.
+ */
+class PinnedMemoryPool {
+ public:
+  /*! \brief get the pool, it lives until the program exits */
+  inline static PinnedMemoryPool *Get(void) {
+    // never deleted: blocks may only be freed while the CUDA runtime is still loaded
+    static PinnedMemoryPool *pool = new PinnedMemoryPool();
+    return pool;
+  }
+  /*!
+   * \brief whether a host pointer is page-locked, i.e. can be copied asynchronously
+   * \param ptr the pointer
+   */
+  inline static bool IsPinned(const void *ptr) {
+    cudaPointerAttributes attr;
+    if (cudaPointerGetAttributes(&attr, ptr) != cudaSuccess) {
+      // plain pageable memory is reported as an error by older runtimes
+      cudaGetLastError();
+      return false;
+    }
+#if CUDART_VERSION >= 10000
+    return attr.type == cudaMemoryTypeHost;
+#else
+    return attr.memoryType == cudaMemoryTypeHost;
+#endif
+  }
+  /*!
+   * \brief allocate a block of at least size bytes
+   * \param size bytes requested
+   */
+  inline void *Alloc(size_t size) {
+    const size_t bytes = RoundSizeClass(size);
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Block> &bin = free_[bytes];
+    for (size_t i = bin.size(); i != 0; --i) {
+      Block &b = bin[i - 1];
+      if (b.event == NULL || cudaEventQuery(b.event) == cudaSuccess) {
+        void *ptr = b.ptr;
+        if (b.event != NULL) MSHADOW_CUDA_CALL(cudaEventDestroy(b.event));
+        b = bin.back();
+        bin.pop_back();
+        cached_bytes_ -= bytes;
+        return this->Track(ptr, bytes);
+      }
+    }
+    void *ptr = NULL;
+    cudaError_t err = cudaHostAlloc(&ptr, bytes, cudaHostAllocPortable);
+    if (err == cudaErrorMemoryAllocation) {
+      cudaGetLastError();
+      this->ReleaseCached(0);
+      err = cudaHostAlloc(&ptr, bytes, cudaHostAllocPortable);
+    }
+    MSHADOW_CUDA_CALL(err);
+    return this->Track(ptr, bytes);
+  }
+  /*!
+   * \brief return a block that is no longer used by any pending transfer
+   * \param ptr the block
+   */
+  inline void Free(void *ptr) {
+    this->FreeBlock(ptr, NULL);
+  }
+  /*!
+   * \brief return a block, it is reused once the work queued on stream so far is done
+   * \param ptr the block
+   * \param stream stream of the current device the block was last used on
+   */
+  inline void Free(void *ptr, cudaStream_t stream) {
+    this->FreeBlock(ptr, &stream);
+  }
+  /*! \brief give every cached block back to the driver */
+  inline void ReleaseAll(void) {
+    this->Trim(0);
+  }
+  /*!
+   * \brief give cached blocks back to the driver, largest first,
+   *  until at most max_cached_bytes stay cached
+   * \param max_cached_bytes number of bytes to keep
+   */
+  inline void Trim(size_t max_cached_bytes) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    this->ReleaseCached(max_cached_bytes);
+  }
+  /*! \return bytes currently handed out */
+  inline size_t used_bytes(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return used_bytes_;
+  }
+  /*! \return bytes cached in the pool */
+  inline size_t cached_bytes(void) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return cached_bytes_;
+  }
+
+ private:
+  /*! \brief a cached block */
+  struct Block {
+    /*! \brief host pointer */
+    void *ptr;
+    /*! \brief recorded when the block was freed, NULL if it is free already */
+    cudaEvent_t event;
+  };
+  /*! \brief guards all the members below */
+  std::mutex mutex_;
+  /*! \brief cached blocks of each size class */
+  std::map<size_t, std::vector<Block> > free_;
+  /*! \brief blocks handed out and their size class */
+  std::unordered_map<void*, size_t> used_;
+  /*! \brief statistics */
+  size_t used_bytes_, cached_bytes_;
+
+  PinnedMemoryPool(void) : used_bytes_(0), cached_bytes_(0) {}
+  inline void *Track(void *ptr, size_t bytes) {
+    used_[ptr] = bytes;
+    used_bytes_ += bytes;
+    return ptr;
+  }
+  inline void FreeBlock(void *ptr, const cudaStream_t *stream) {
+    if (ptr == NULL) return;
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::unordered_map<void*, size_t>::iterator it = used_.find(ptr);
+    CHECK(it != used_.end()) << "PinnedMemoryPool: pointer was not allocated by the pool";
+    Block b;
+    b.ptr = ptr;
+    b.event = NULL;
+    if (stream != NULL) {
+      MSHADOW_CUDA_CALL(cudaEventCreateWithFlags(&b.event, cudaEventDisableTiming));
+      MSHADOW_CUDA_CALL(cudaEventRecord(b.event, *stream));
+    }
+    free_[it->second].push_back(b);
+    cached_bytes_ += it->second;
+    used_bytes_ -= it->second;
+    used_.erase(it);
+  }
+  // requires the lock
+  inline void ReleaseCached(size_t max_cached_bytes) {
+    std::map<size_t, std::vector<Block> >::reverse_iterator it;
+    for (it = free_.rbegin(); it != free_.rend() && cached_bytes_ > max_cached_bytes; ++it) {
+      std::vector<Block> &bin = it->second;
+      while (bin.size() != 0 && cached_bytes_ > max_cached_bytes) {
+        // cudaFreeHost synchronizes the device, so the pending transfers are done
+        MSHADOW_CUDA_CALL(cudaFreeHost(bin.back().ptr));
+        if (bin.back().event != NULL) MSHADOW_CUDA_CALL(cudaEventDestroy(bin.back().event));
+        bin.pop_back();
+        cached_bytes_ -= it->first;
+      }
+    }
+  }
+};
+}  // namespace pool
+}  // namespace mshadow
+#endif  // MSHADOW_USE_CUDA && MSHADOW_USE_GPU_POOL
+#endif  // MSHADOW_MEMORY_POOL_INL_H_
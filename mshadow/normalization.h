@@ -0,0 +1,466 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file normalization.h
+ * \brief batch and layer normalization with their gradients. The statistics are merged
+ *  with Welford's update in one pass over the data, and the normalization and the affine
+ *  transform are one elementwise pass, where the expressions of sumall_except_dim and
+ *  broadcast take a pass for each of the mean, the variance, the normalization, the scale
+ *  and the shift.
+ */
+#ifndef MSHADOW_NORMALIZATION_H_
+#define MSHADOW_NORMALIZATION_H_
+#include <algorithm>
+#include <cmath>
+#include <vector>
+#include "./tensor.h"
+
+namespace mshadow {
+/*!
+ * \brief count, mean and sum of the squared deviations of a set of values,
+ *  Welford's update adds one value, Merge adds another set (Chan et al.)
+ * \tparam AType type of the accumulation
+ */
+template<typename AType>
+struct WelfordStat {
+  /*! \brief number of values */
+  AType count;
+  /*! \brief mean of the values */
+  AType mean;
+  /*! \brief sum of the squared deviations from the mean */
+  AType m2;
+  MSHADOW_XINLINE WelfordStat(void) : count(0), mean(0), m2(0) {}
+  /*! \brief add the value x */
+  MSHADOW_XINLINE void Push(AType x) {
+    count += AType(1);
+    const AType delta = x - mean;
+    mean += delta / count;
+    m2 += delta * (x - mean);
+  }
+  /*! \brief add n values of mean bmean and squared deviations bm2 */
+  MSHADOW_XINLINE void Merge(AType n, AType bmean, AType bm2) {
+    const AType total = count + n;
+    if (total == AType(0)) return;
+    const AType delta = bmean - mean;
+    mean += delta * (n / total);
+    m2 += bm2 + delta * delta * (count * n / total);
+    count = total;
+  }
+  /*! \brief 1 / sqrt(variance + eps), the variance of the whole population */
+  MSHADOW_XINLINE AType InvStd(AType eps) const {
+    return AType(1) / sqrt(m2 / count + eps);
+  }
+};
+/*! \brief elements of a row the statistics are taken of while they are held in cache */
+const index_t kNormCacheItems = 4096;
+/*!
+ * \brief add the n values of x to st, by blocks of kNormCacheItems: the mean and the
+ *  deviations of a block are summed in two passes over the cached block, and merged.
+ *  The sum of the first pass loses the low bits of values far from zero, the deviations
+ *  of the second pass sum to that error, so they correct the mean and the squares.
+ */
+template<typename DType, typename AType>
+inline void NormRowStat(const DType *x, index_t n, WelfordStat<AType> *st) {
+  for (index_t begin = 0; begin < n; begin += kNormCacheItems) {
+    const index_t len = std::min(kNormCacheItems, n - begin);
+    const DType *p = x + begin;
+    AType sum = AType(0);
+    for (index_t i = 0; i < len; ++i) sum += AType(p[i]);
+    const AType mean = sum / AType(len);
+    AType dsum = AType(0), m2 = AType(0);
+    for (index_t i = 0; i < len; ++i) {
+      const AType d = AType(p[i]) - mean;
+      dsum += d;
+      m2 += d * d;
+    }
+    const AType shift = dsum / AType(len);
+    st->Merge(AType(len), mean + shift, m2 - dsum * shift);
+  }
+}
+/*!
+ * \brief the kernels of the normalizations on a device
+ * \tparam Device which device the tensors are on
+ * \tparam DType type of element in tensor
+ */
+template<typename Device, typename DType>
+struct NormEngine;
+/*! \brief normalizations on cpu, parallel over the rows */
+template<typename DType>
+struct NormEngine<cpu, DType> {
+  typedef typename AccType<DType>::type AType;
+  inline static void BatchNormForward(Tensor<cpu, 3, DType> out, Tensor<cpu, 1, DType> mean,
+                                      Tensor<cpu, 1, DType> invstd,
+                                      const Tensor<cpu, 3, DType> &data,
+                                      const Tensor<cpu, 1, DType> &gamma,
+                                      const Tensor<cpu, 1, DType> &beta, DType eps) {
+    WaitPushedTasks(data.stream_);
+    const index_t nchannel = data.size(1), len = data.size(2);
+    const index_t nrow = data.size(0) * nchannel;
+    std::vector<WelfordStat<AType> > stat(nrow);
+#ifdef _OPENMP
+    const int nthread = GetNumParallelThread(data.stream_, data.shape_.Size());
+#endif
+    #pragma omp parallel num_threads(nthread) if (nthread > 1)
+    {
+      #pragma omp for schedule(static)
+      for (openmp_index_t r = 0; r < nrow; ++r) {
+        NormRowStat(data.dptr_ + r * data.stride_, len, &stat[r]);
+      }
+      #pragma omp for schedule(static)
+      for (openmp_index_t c = 0; c < nchannel; ++c) {
+        WelfordStat<AType> st;
+        for (index_t r = c; r < nrow; r += nchannel) {
+          st.Merge(stat[r].count, stat[r].mean, stat[r].m2);
+        }
+        mean[c] = DType(st.mean);
+        invstd[c] = DType(st.InvStd(AType(eps)));
+      }
+      #pragma omp for schedule(static)
+      for (openmp_index_t r = 0; r < nrow; ++r) {
+        const index_t c = r % nchannel;
+        const AType scale = AType(gamma[c]) * AType(invstd[c]);
+        const AType shift = AType(beta[c]) - AType(mean[c]) * scale;
+        ApplyRow(out.dptr_ + r * out.stride_, data.dptr_ + r * data.stride_, len, scale, shift);
+      }
+    }
+  }
+  inline static void BatchNormApply(Tensor<cpu, 3, DType> out,
+                                    const Tensor<cpu, 3, DType> &data,
+                                    const Tensor<cpu, 1, DType> &mean,
+                                    const Tensor<cpu, 1, DType> &invstd,
+                                    const Tensor<cpu, 1, DType> &gamma,
+                                    const Tensor<cpu, 1, DType> &beta) {
+    WaitPushedTasks(data.stream_);
+    const index_t nchannel = data.size(1), len = data.size(2);
+    const index_t nrow = data.size(0) * nchannel;
+#ifdef _OPENMP
+    const int nthread = GetNumParallelThread(data.stream_, data.shape_.Size());
+#endif
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t r = 0; r < nrow; ++r) {
+      const index_t c = r % nchannel;
+      const AType scale = AType(gamma[c]) * AType(invstd[c]);
+      const AType shift = AType(beta[c]) - AType(mean[c]) * scale;
+      ApplyRow(out.dptr_ + r * out.stride_, data.dptr_ + r * data.stride_, len, scale, shift);
+    }
+  }
+  inline static void BatchNormBackward(Tensor<cpu, 3, DType> grad_data,
+                                       Tensor<cpu, 1, DType> grad_gamma,
+                                       Tensor<cpu, 1, DType> grad_beta,
+                                       const Tensor<cpu, 3, DType> &grad_out,
+                                       const Tensor<cpu, 3, DType> &data,
+                                       const Tensor<cpu, 1, DType> &mean,
+                                       const Tensor<cpu, 1, DType> &invstd,
+                                       const Tensor<cpu, 1, DType> &gamma) {
+    WaitPushedTasks(data.stream_);
+    const index_t nchannel = data.size(1), len = data.size(2);
+    const index_t nrow = data.size(0) * nchannel;
+    // sums of dy and of dy * (x - mean) of each row
+    std::vector<AType> sum(2 * nrow), coef(3 * nchannel);
+    const AType inv_count = AType(1) / AType(data.size(0) * len);
+#ifdef _OPENMP
+    const int nthread = GetNumParallelThread(data.stream_, data.shape_.Size());
+#endif
+    #pragma omp parallel num_threads(nthread) if (nthread > 1)
+    {
+      #pragma omp for schedule(static)
+      for (openmp_index_t r = 0; r < nrow; ++r) {
+        const DType *dy = grad_out.dptr_ + r * grad_out.stride_;
+        const DType *x = data.dptr_ + r * data.stride_;
+        const AType m = AType(mean[r % nchannel]);
+        AType sdy = AType(0), sdyx = AType(0);
+        for (index_t i = 0; i < len; ++i) {
+          sdy += AType(dy[i]);
+          sdyx += AType(dy[i]) * (AType(x[i]) - m);
+        }
+        sum[2 * r] = sdy; sum[2 * r + 1] = sdyx;
+      }
+      #pragma omp for schedule(static)
+      for (openmp_index_t c = 0; c < nchannel; ++c) {
+        AType sdy = AType(0), sdyx = AType(0);
+        for (index_t r = c; r < nrow; r += nchannel) {
+          sdy += sum[2 * r]; sdyx += sum[2 * r + 1];
+        }
+        const AType is = AType(invstd[c]);
+        grad_beta[c] = DType(sdy);
+        grad_gamma[c] = DType(sdyx * is);
+        // dx = k * dy - k * mean(dy) - k * is^2 * mean(dy * (x - mean)) * (x - mean)
+        const AType k = AType(gamma[c]) * is;
+        coef[3 * c] = k;
+        coef[3 * c + 1] = -k * sdy * inv_count;
+        coef[3 * c + 2] = -k * is * is * sdyx * inv_count;
+      }
+      #pragma omp for schedule(static)
+      for (openmp_index_t r = 0; r < nrow; ++r) {
+        const index_t c = r % nchannel;
+        const DType *dy = grad_out.dptr_ + r * grad_out.stride_;
+        const DType *x = data.dptr_ + r * data.stride_;
+        DType *dx = grad_data.dptr_ + r * grad_data.stride_;
+        const AType k = coef[3 * c], b = coef[3 * c + 1], q = coef[3 * c + 2];
+        const AType m = AType(mean[c]);
+        for (index_t i = 0; i < len; ++i) {
+          dx[i] = DType(k * AType(dy[i]) + b + q * (AType(x[i]) - m));
+        }
+      }
+    }
+  }
+  inline static void LayerNormForward(Tensor<cpu, 2, DType> out, Tensor<cpu, 1, DType> mean,
+                                      Tensor<cpu, 1, DType> invstd,
+                                      const Tensor<cpu, 2, DType> &data,
+                                      const Tensor<cpu, 1, DType> &gamma,
+                                      const Tensor<cpu, 1, DType> &beta, DType eps) {
+    WaitPushedTasks(data.stream_);
+    const index_t nrow = data.size(0), len = data.size(1);
+#ifdef _OPENMP
+    const int nthread = GetNumParallelThread(data.stream_, data.shape_.Size());
+#endif
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t r = 0; r < nrow; ++r) {
+      const DType *x = data.dptr_ + r * data.stride_;
+      DType *y = out.dptr_ + r * out.stride_;
+      WelfordStat<AType> st;
+      NormRowStat(x, len, &st);
+      const AType m = st.mean, is = st.InvStd(AType(eps));
+      mean[r] = DType(m);
+      invstd[r] = DType(is);
+      for (index_t i = 0; i < len; ++i) {
+        y[i] = DType((AType(x[i]) - m) * is * AType(gamma[i]) + AType(beta[i]));
+      }
+    }
+  }
+  inline static void LayerNormBackward(Tensor<cpu, 2, DType> grad_data,
+                                       Tensor<cpu, 1, DType> grad_gamma,
+                                       Tensor<cpu, 1, DType> grad_beta,
+                                       const Tensor<cpu, 2, DType> &grad_out,
+                                       const Tensor<cpu, 2, DType> &data,
+                                       const Tensor<cpu, 1, DType> &mean,
+                                       const Tensor<cpu, 1, DType> &invstd,
+                                       const Tensor<cpu, 1, DType> &gamma) {
+    WaitPushedTasks(data.stream_);
+    const index_t nrow = data.size(0), len = data.size(1);
+    const int nthread = GetNumParallelThread(data.stream_, data.shape_.Size());
+    // each thread sums the gradients of gamma and beta of its rows
+    std::vector<AType> part(static_cast<size_t>(nthread) * 2 * len, AType(0));
+    #pragma omp parallel num_threads(nthread) if (nthread > 1)
+    {
+#ifdef _OPENMP
+      AType *acc = &part[static_cast<size_t>(omp_get_thread_num()) * 2 * len];
+#else
+      AType *acc = &part[0];
+#endif
+      #pragma omp for schedule(static)
+      for (openmp_index_t r = 0; r < nrow; ++r) {
+        const DType *dy = grad_out.dptr_ + r * grad_out.stride_;
+        const DType *x = data.dptr_ + r * data.stride_;
+        DType *dx = grad_data.dptr_ + r * grad_data.stride_;
+        const AType m = AType(mean[r]), is = AType(invstd[r]);
+        AType s1 = AType(0), s2 = AType(0);
+        for (index_t i = 0; i < len; ++i) {
+          const AType xhat = (AType(x[i]) - m) * is;
+          const AType g = AType(dy[i]) * AType(gamma[i]);
+          s1 += g; s2 += g * xhat;
+          acc[i] += AType(dy[i]) * xhat;
+          acc[len + i] += AType(dy[i]);
+        }
+        s1 /= AType(len); s2 /= AType(len);
+        // dx = is * (dxhat - mean(dxhat) - xhat * mean(dxhat * xhat)), dxhat = dy * gamma
+        for (index_t i = 0; i < len; ++i) {
+          const AType xhat = (AType(x[i]) - m) * is;
+          dx[i] = DType(is * (AType(dy[i]) * AType(gamma[i]) - s1 - xhat * s2));
+        }
+      }
+      #pragma omp for schedule(static)
+      for (openmp_index_t i = 0; i < len; ++i) {
+        AType sg = AType(0), sb = AType(0);
+        for (int t = 0; t < nthread; ++t) {
+          sg += part[static_cast<size_t>(t) * 2 * len + i];
+          sb += part[static_cast<size_t>(t) * 2 * len + len + i];
+        }
+        grad_gamma[i] = DType(sg);
+        grad_beta[i] = DType(sb);
+      }
+    }
+  }
+
+ private:
+  inline static void ApplyRow(DType *y, const DType *x, index_t len,
+                              AType scale, AType shift) {
+    for (index_t i = 0; i < len; ++i) y[i] = DType(AType(x[i]) * scale + shift);
+  }
+};
+/*! \brief GPU normalizations, see cuda/normalization.cuh */
+template<typename DType>
+struct NormEngine<gpu, DType> {
+  inline static void BatchNormForward(Tensor<gpu, 3, DType> out, Tensor<gpu, 1, DType> mean,
+                                      Tensor<gpu, 1, DType> invstd,
+                                      const Tensor<gpu, 3, DType> &data,
+                                      const Tensor<gpu, 1, DType> &gamma,
+                                      const Tensor<gpu, 1, DType> &beta, DType eps);
+  inline static void BatchNormApply(Tensor<gpu, 3, DType> out,
+                                    const Tensor<gpu, 3, DType> &data,
+                                    const Tensor<gpu, 1, DType> &mean,
+                                    const Tensor<gpu, 1, DType> &invstd,
+                                    const Tensor<gpu, 1, DType> &gamma,
+                                    const Tensor<gpu, 1, DType> &beta);
+  inline static void BatchNormBackward(Tensor<gpu, 3, DType> grad_data,
+                                       Tensor<gpu, 1, DType> grad_gamma,
+                                       Tensor<gpu, 1, DType> grad_beta,
+                                       const Tensor<gpu, 3, DType> &grad_out,
+                                       const Tensor<gpu, 3, DType> &data,
+                                       const Tensor<gpu, 1, DType> &mean,
+                                       const Tensor<gpu, 1, DType> &invstd,
+                                       const Tensor<gpu, 1, DType> &gamma);
+  inline static void LayerNormForward(Tensor<gpu, 2, DType> out, Tensor<gpu, 1, DType> mean,
+                                      Tensor<gpu, 1, DType> invstd,
+                                      const Tensor<gpu, 2, DType> &data,
+                                      const Tensor<gpu, 1, DType> &gamma,
+                                      const Tensor<gpu, 1, DType> &beta, DType eps);
+  inline static void LayerNormBackward(Tensor<gpu, 2, DType> grad_data,
+                                       Tensor<gpu, 1, DType> grad_gamma,
+                                       Tensor<gpu, 1, DType> grad_beta,
+                                       const Tensor<gpu, 2, DType> &grad_out,
+                                       const Tensor<gpu, 2, DType> &data,
+                                       const Tensor<gpu, 1, DType> &mean,
+                                       const Tensor<gpu, 1, DType> &invstd,
+                                       const Tensor<gpu, 1, DType> &gamma);
+};
+/*!
+ * \brief batch normalization in training, the statistics of each channel are taken over
+ *  the batch and the positions: out = (data - mean[c]) * invstd[c] * gamma[c] + beta[c].
+ *  An NCHW batch is viewed as (N, C, H * W), the running averages of the statistics are
+ *  left to the caller, they are vectors of C elements.
+ * \param out the output, (N, C, M), may be data
+ * \param mean the mean of each channel, written
+ * \param invstd 1 / sqrt(var + eps) of each channel with the biased variance, written
+ * \param data the input, (N, C, M)
+ * \param gamma the scale of each channel
+ * \param beta the shift of each channel
+ * \param eps added to the variance
+ */
+template<typename Device, typename DType>
+inline void BatchNormForward(Tensor<Device, 3, DType> out, Tensor<Device, 1, DType> mean,
+                             Tensor<Device, 1, DType> invstd,
+                             const Tensor<Device, 3, DType> &data,
+                             const Tensor<Device, 1, DType> &gamma,
+                             const Tensor<Device, 1, DType> &beta, DType eps) {
+  CHECK_EQ(out.shape_, data.shape_) << "BatchNormForward: shape mismatch";
+  CHECK(mean.size(0) == data.size(1) && invstd.size(0) == data.size(1) &&
+        gamma.size(0) == data.size(1) && beta.size(0) == data.size(1))
+      << "BatchNormForward: the statistics and the parameters must have one entry per channel";
+  if (data.shape_.Size() == 0) return;
+  NormEngine<Device, DType>::BatchNormForward(out, mean, invstd, data, gamma, beta, eps);
+}
+/*!
+ * \brief batch normalization with given statistics, e.g. the running averages in
+ *  inference: out = (data - mean[c]) * invstd[c] * gamma[c] + beta[c]
+ * \param out the output, (N, C, M), may be data
+ * \param data the input, (N, C, M)
+ * \param mean the mean of each channel
+ * \param invstd 1 / sqrt(var + eps) of each channel
+ * \param gamma the scale of each channel
+ * \param beta the shift of each channel
+ */
+template<typename Device, typename DType>
+inline void BatchNormApply(Tensor<Device, 3, DType> out, const Tensor<Device, 3, DType> &data,
+                           const Tensor<Device, 1, DType> &mean,
+                           const Tensor<Device, 1, DType> &invstd,
+                           const Tensor<Device, 1, DType> &gamma,
+                           const Tensor<Device, 1, DType> &beta) {
+  CHECK_EQ(out.shape_, data.shape_) << "BatchNormApply: shape mismatch";
+  CHECK(mean.size(0) == data.size(1) && invstd.size(0) == data.size(1) &&
+        gamma.size(0) == data.size(1) && beta.size(0) == data.size(1))
+      << "BatchNormApply: the statistics and the parameters must have one entry per channel";
+  if (data.shape_.Size() == 0) return;
+  NormEngine<Device, DType>::BatchNormApply(out, data, mean, invstd, gamma, beta);
+}
+/*!
+ * \brief gradients of BatchNormForward, in one pass for the sums of each channel and one
+ *  elementwise pass for grad_data
+ * \param grad_data the gradient of the input, written, may be grad_out or data
+ * \param grad_gamma the gradient of gamma, written
+ * \param grad_beta the gradient of beta, written
+ * \param grad_out the gradient of the output
+ * \param data the input of the forward
+ * \param mean the mean written by the forward
+ * \param invstd the invstd written by the forward
+ * \param gamma the scale of each channel
+ */
+template<typename Device, typename DType>
+inline void BatchNormBackward(Tensor<Device, 3, DType> grad_data,
+                              Tensor<Device, 1, DType> grad_gamma,
+                              Tensor<Device, 1, DType> grad_beta,
+                              const Tensor<Device, 3, DType> &grad_out,
+                              const Tensor<Device, 3, DType> &data,
+                              const Tensor<Device, 1, DType> &mean,
+                              const Tensor<Device, 1, DType> &invstd,
+                              const Tensor<Device, 1, DType> &gamma) {
+  CHECK(grad_data.shape_ == data.shape_ && grad_out.shape_ == data.shape_)
+      << "BatchNormBackward: shape mismatch";
+  CHECK(mean.size(0) == data.size(1) && invstd.size(0) == data.size(1) &&
+        gamma.size(0) == data.size(1) && grad_gamma.size(0) == data.size(1) &&
+        grad_beta.size(0) == data.size(1))
+      << "BatchNormBackward: the statistics and the parameters must have one entry per channel";
+  if (data.shape_.Size() == 0) return;
+  NormEngine<Device, DType>::BatchNormBackward(grad_data, grad_gamma, grad_beta, grad_out,
+                                               data, mean, invstd, gamma);
+}
+/*!
+ * \brief layer normalization of each row, the statistics are taken over the row:
+ *  out[i][j] = (data[i][j] - mean[i]) * invstd[i] * gamma[j] + beta[j]
+ * \param out the output, (N, D), may be data
+ * \param mean the mean of each row, written
+ * \param invstd 1 / sqrt(var + eps) of each row with the biased variance, written
+ * \param data the input, (N, D)
+ * \param gamma the scale of each column
+ * \param beta the shift of each column
+ * \param eps added to the variance
+ */
+template<typename Device, typename DType>
+inline void LayerNormForward(Tensor<Device, 2, DType> out, Tensor<Device, 1, DType> mean,
+                             Tensor<Device, 1, DType> invstd,
+                             const Tensor<Device, 2, DType> &data,
+                             const Tensor<Device, 1, DType> &gamma,
+                             const Tensor<Device, 1, DType> &beta, DType eps) {
+  CHECK_EQ(out.shape_, data.shape_) << "LayerNormForward: shape mismatch";
+  CHECK(mean.size(0) == data.size(0) && invstd.size(0) == data.size(0))
+      << "LayerNormForward: the statistics must have one entry per row";
+  CHECK(gamma.size(0) == data.size(1) && beta.size(0) == data.size(1))
+      << "LayerNormForward: the parameters must have one entry per column";
+  if (data.shape_.Size() == 0) return;
+  NormEngine<Device, DType>::LayerNormForward(out, mean, invstd, data, gamma, beta, eps);
+}
+/*!
+ * \brief gradients of LayerNormForward, grad_data in one pass over the rows
+ * \param grad_data the gradient of the input, written, may be grad_out or data
+ * \param grad_gamma the gradient of gamma, written
+ * \param grad_beta the gradient of beta, written
+ * \param grad_out the gradient of the output
+ * \param data the input of the forward
+ * \param mean the mean written by the forward
+ * \param invstd the invstd written by the forward
+ * \param gamma the scale of each column
+ */
+template<typename Device, typename DType>
+inline void LayerNormBackward(Tensor<Device, 2, DType> grad_data,
+                              Tensor<Device, 1, DType> grad_gamma,
+                              Tensor<Device, 1, DType> grad_beta,
+                              const Tensor<Device, 2, DType> &grad_out,
+                              const Tensor<Device, 2, DType> &data,
+                              const Tensor<Device, 1, DType> &mean,
+                              const Tensor<Device, 1, DType> &invstd,
+                              const Tensor<Device, 1, DType> &gamma) {
+  CHECK(grad_data.shape_ == data.shape_ && grad_out.shape_ == data.shape_)
+      << "LayerNormBackward: shape mismatch";
+  CHECK(mean.size(0) == data.size(0) && invstd.size(0) == data.size(0))
+      << "LayerNormBackward: the statistics must have one entry per row";
+  CHECK(gamma.size(0) == data.size(1) && grad_gamma.size(0) == data.size(1) &&
+        grad_beta.size(0) == data.size(1))
+      << "LayerNormBackward: the parameters must have one entry per column";
+  if (data.shape_.Size() == 0) return;
+  NormEngine<Device, DType>::LayerNormBackward(grad_data, grad_gamma, grad_beta, grad_out,
+                                               data, mean, invstd, gamma);
+}
+}  // namespace mshadow
+#ifdef __CUDACC__
+#include "./cuda/normalization.cuh"
+#endif
+#endif  // MSHADOW_NORMALIZATION_H_
@@ -23,14 +23,33 @@ namespace packet {
 enum PacketArch {
   kPlain,
   kSSE2,
+  kAVX,
+  kAVX512
 };
 
-#if MSHADOW_USE_SSE
+#if MSHADOW_USE_AVX512
+#define MSHADOW_DEFAULT_PACKET  ::mshadow::packet::kAVX512
+#elif MSHADOW_USE_AVX
+#define MSHADOW_DEFAULT_PACKET  ::mshadow::packet::kAVX
+#elif MSHADOW_USE_SSE
 #define MSHADOW_DEFAULT_PACKET  ::mshadow::packet::kSSE2
 #else
 #define MSHADOW_DEFAULT_PACKET  ::mshadow::packet::kPlain
 #endif
 
+#if MSHADOW_USE_PACKET_DISPATCH
+/*!
+ * \brief inline qualifier of wide packet functions, they are compiled for a target other
+ *  than the translation unit and can only be inlined into kernels built for that target
+ */
+#define MSHADOW_PACKET_CINLINE inline
+/*! \brief attribute of the kernel entry a packet arch is dispatched to */
+#define MSHADOW_PACKET_TARGET_AVX __attribute__((target("avx2,fma,f16c"), flatten))
+#define MSHADOW_PACKET_TARGET_AVX512 __attribute__((target("avx512f,fma"), flatten))
+#else
+#define MSHADOW_PACKET_CINLINE MSHADOW_CINLINE
+#endif
+
 // whether packet operator is enabled.
 /*!
  * \brief Generic packet type
@@ -40,10 +59,31 @@ enum PacketArch {
 template<typename DType, PacketArch Arch = MSHADOW_DEFAULT_PACKET>
 struct Packet;
 
+/*!
+ * \brief conversion between a 16 bit floating point type DType in memory and
+ *  Packet<float, Arch>, specialized for half_t by the archs that have the F16C conversion
+ *  instructions and for bf16_t by the SIMD archs.
+ *  Round rounds the same as the constructor of DType, so packet and scalar evaluation
+ *  of DType expressions give the same bits.
+ */
+template<typename DType, PacketArch Arch>
+struct PacketConvert {
+  static const bool kEnabled = false;
+};
+
+/*! \brief log2 of the alignment in bytes required by the packet */
 template<PacketArch Arch>
 struct AlignBytes {
   static const index_t value = 4;
 };
+template<>
+struct AlignBytes<kAVX> {
+  static const index_t value = 5;
+};
+template<>
+struct AlignBytes<kAVX512> {
+  static const index_t value = 6;
+};
 
 }  // namespace packet
 }  // namespace mshadow
@@ -59,7 +99,9 @@ namespace packet {
 inline void* AlignedMallocPitch(size_t *out_pitch,
                                 size_t lspace,
                                 size_t num_line) {
-  const index_t bits = AlignBytes<MSHADOW_DEFAULT_PACKET>::value;
+  // align for the widest arch that may be picked at runtime
+  const index_t bits = MSHADOW_USE_PACKET_DISPATCH ?
+      AlignBytes<kAVX512>::value : AlignBytes<MSHADOW_DEFAULT_PACKET>::value;
   const index_t mask = (1 << bits) - 1;
 
   size_t pitch = ((lspace + mask) >> bits) << bits;
@@ -109,7 +151,7 @@ inline bool CheckAlign(void *ptr) {
  */
 template<typename DType, PacketArch Arch>
 inline index_t UpperAlign(index_t size) {
-  const index_t bits = AlignBytes<MSHADOW_DEFAULT_PACKET>::value;
+  const index_t bits = AlignBytes<Arch>::value;
   const index_t mask = (1 << bits) - 1;
   const index_t fsize = sizeof(DType);
   return (((size * fsize + mask) >> bits) << bits) / fsize;
@@ -122,7 +164,7 @@ inline index_t UpperAlign(index_t size) {
  */
 template<typename DType, PacketArch Arch>
 inline index_t LowerAlign(index_t size) {
-  const index_t bits = AlignBytes<MSHADOW_DEFAULT_PACKET>::value;
+  const index_t bits = AlignBytes<Arch>::value;
   const index_t fsize = sizeof(DType);
   return (((size * fsize) >> bits) << bits) / fsize;
 }
@@ -179,6 +221,154 @@ struct PacketOp<op::identity, DType, Arch> {
   }
 };
 
+/*!
+ * \brief fused multiply-add a * b + c, architectures with FMA
+ *  instructions overload this with a single rounding version
+ */
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> FMA(const Packet<DType, Arch>& a,
+                                        const Packet<DType, Arch>& b,
+                                        const Packet<DType, Arch>& c) {
+  return a * b + c;
+}
+/*!
+ * \brief whether a Packet<DType, Arch> holds whole interleaved complex numbers, the real
+ *  parts at the even lanes, and the arch has the pair primitives SwapPairs, DupReal,
+ *  DupImag, Conj and Deinterleave that the complex operations below are built on
+ */
+template<typename DType, PacketArch Arch>
+struct ComplexPacketCheck {
+  static const bool kPass = false;
+};
+/*! \brief interleaved complex a * b, rounded as the scalar formula */
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> ComplexMul(const Packet<DType, Arch>& a,
+                                               const Packet<DType, Arch>& b) {
+  // (ar * br, ar * bi) - conj(ai * bi, ai * br)
+  return DupReal(a) * b - Conj(DupImag(a) * SwapPairs(b));
+}
+/*! \brief interleaved complex a / b, rounded as the scalar formula */
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> ComplexDiv(const Packet<DType, Arch>& a,
+                                               const Packet<DType, Arch>& b) {
+  // (ar * br, ai * br) + conj(ai * bi, ar * bi), over br * br + bi * bi in both lanes
+  const Packet<DType, Arch> num = a * DupReal(b) + Conj(SwapPairs(a) * DupImag(b));
+  const Packet<DType, Arch> sq = b * b;
+  return num / (sq + SwapPairs(sq));
+}
+/*!
+ * \brief whether the transcendental functions (exp, log, tanh, sigmoid)
+ *  are vectorized for DType on Arch, only float is, plain packets support all types
+ */
+template<typename DType, PacketArch Arch>
+struct TranscendentalCheck {
+  static const bool kPass = Arch == kPlain;
+};
+template<PacketArch Arch>
+struct TranscendentalCheck<float, Arch> {
+  static const bool kPass = true;
+};
+#define MSHADOW_PACKET_UNARY_FUNC_OP(OP, Func, kPass)                        \
+  template<typename DType, PacketArch Arch>                                  \
+  struct PacketOp<OP, DType, Arch> {                                         \
+    static const bool kEnabled = kPass;                                      \
+    MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& src) { \
+      return Func(src);                                                      \
+    }                                                                        \
+  };
+MSHADOW_PACKET_UNARY_FUNC_OP(op::exp, Exp, (TranscendentalCheck<DType, Arch>::kPass))
+MSHADOW_PACKET_UNARY_FUNC_OP(op::log, Log, (TranscendentalCheck<DType, Arch>::kPass))
+MSHADOW_PACKET_UNARY_FUNC_OP(op::tanh, Tanh, (TranscendentalCheck<DType, Arch>::kPass))
+MSHADOW_PACKET_UNARY_FUNC_OP(op::sigmoid, Sigmoid, (TranscendentalCheck<DType, Arch>::kPass))
+MSHADOW_PACKET_UNARY_FUNC_OP(op::sqrt, Sqrt, true)
+#undef MSHADOW_PACKET_UNARY_FUNC_OP
+
+template<typename DType, PacketArch Arch>
+struct PacketOp<op::maximum, DType, Arch> {
+  static const bool kEnabled = true;
+  MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& lhs,
+                                                 const Packet<DType, Arch>& rhs) {
+    return Max(lhs, rhs);
+  }
+};
+template<typename DType, PacketArch Arch>
+struct PacketOp<op::minimum, DType, Arch> {
+  static const bool kEnabled = true;
+  MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& lhs,
+                                                 const Packet<DType, Arch>& rhs) {
+    return Min(lhs, rhs);
+  }
+};
+
+/*!
+ * \brief mark a user defined unary operator as packet safe, so expressions using it
+ *  stay vectorized. OP::Map must be a template over its argument type whose body only
+ *  uses +, -, *, / between arguments and the functions of namespace packet,
+ *  e.g. return a * a. Use it in the global namespace.
+ */
+#define MSHADOW_PACKET_UNARY_OP(OP)                                          \
+  namespace mshadow {                                                        \
+  namespace packet {                                                         \
+  template<typename DType, PacketArch Arch>                                  \
+  struct PacketOp<OP, DType, Arch> {                                         \
+    static const bool kEnabled = true;                                       \
+    MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& src) { \
+      return OP::Map(src);                                                   \
+    }                                                                        \
+  };                                                                         \
+  }                                                                          \
+  }
+/*! \brief binary version of MSHADOW_PACKET_UNARY_OP */
+#define MSHADOW_PACKET_BINARY_OP(OP)                                         \
+  namespace mshadow {                                                        \
+  namespace packet {                                                         \
+  template<typename DType, PacketArch Arch>                                  \
+  struct PacketOp<OP, DType, Arch> {                                         \
+    static const bool kEnabled = true;                                       \
+    MSHADOW_CINLINE static Packet<DType, Arch> Map(const Packet<DType, Arch>& lhs, \
+                                                   const Packet<DType, Arch>& rhs) { \
+      return OP::Map(lhs, rhs);                                              \
+    }                                                                        \
+  };                                                                         \
+  }                                                                          \
+  }
+
+/*!
+ * \brief packet version of a reducer in red::
+ *  kHorizontal tells whether a packet can be reduced to a scalar with Sum
+ */
+template<typename Reducer, typename DType, PacketArch Arch>
+struct PacketReducer {
+  static const bool kEnabled = false;
+  static const bool kHorizontal = false;
+};
+template<typename DType, PacketArch Arch>
+struct PacketReducer<red::sum, DType, Arch> {
+  static const bool kEnabled = true;
+  static const bool kHorizontal = true;
+  MSHADOW_CINLINE static void Reduce(Packet<DType, Arch> &dst,  // NOLINT(*)
+                                     const Packet<DType, Arch> &src) {
+    dst = dst + src;
+  }
+};
+template<typename DType, PacketArch Arch>
+struct PacketReducer<red::maximum, DType, Arch> {
+  static const bool kEnabled = true;
+  static const bool kHorizontal = false;
+  MSHADOW_CINLINE static void Reduce(Packet<DType, Arch> &dst,  // NOLINT(*)
+                                     const Packet<DType, Arch> &src) {
+    dst = Max(dst, src);
+  }
+};
+template<typename DType, PacketArch Arch>
+struct PacketReducer<red::minimum, DType, Arch> {
+  static const bool kEnabled = true;
+  static const bool kHorizontal = false;
+  MSHADOW_CINLINE static void Reduce(Packet<DType, Arch> &dst,  // NOLINT(*)
+                                     const Packet<DType, Arch> &src) {
+    dst = Min(dst, src);
+  }
+};
 
 // savers to do storage
 template<typename SV, typename TFloat, PacketArch Arch>
@@ -202,6 +392,35 @@ struct Saver<sv::saveto, TFloat, Arch> {
 #if MSHADOW_USE_SSE && !defined(__CUDACC__)
 #include "packet/sse-inl.h"
 #endif
+#if (MSHADOW_USE_AVX || MSHADOW_USE_PACKET_DISPATCH) && !defined(__CUDACC__)
+#include "packet/avx-inl.h"
+#endif
+#if (MSHADOW_USE_AVX512 || MSHADOW_USE_PACKET_DISPATCH) && !defined(__CUDACC__)
+#include "packet/avx512-inl.h"
+#endif
+#include "packet/float16-inl.h"
+#include "packet/math-inl.h"
+
+namespace mshadow {
+namespace packet {
+/*!
+ * \brief get the packet arch used for the packet kernels on this host,
+ *  this is MSHADOW_DEFAULT_PACKET unless MSHADOW_USE_PACKET_DISPATCH is set
+ */
+inline PacketArch GetHostPacketArch(void) {
+#if MSHADOW_USE_PACKET_DISPATCH
+  static const PacketArch arch =
+      __builtin_cpu_supports("avx512f") ? kAVX512 :
+      (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+       __builtin_cpu_supports("f16c")) ?
+      kAVX : MSHADOW_DEFAULT_PACKET;
+  return arch;
+#else
+  return MSHADOW_DEFAULT_PACKET;
+#endif
+}
+}  // namespace packet
+}  // namespace mshadow
 
 namespace mshadow {
 namespace expr {
@@ -265,15 +484,39 @@ class PacketPlan<BinaryMapExp<OP, TA, TB, DType, etype>, DType, Arch> {
   }
 
  private:
+  template<typename E, typename DT, PacketArch A>
+  friend class PacketPlan;
   PacketPlan<TA, DType, Arch> lhs_;
   PacketPlan<TB, DType, Arch> rhs_;
 };
 
+// a * b + c is mapped to fused multiply-add
+template<typename TA, typename TB, typename TC, int ltype, int etype,
+         typename DType, PacketArch Arch>
+class PacketPlan<BinaryMapExp<op::plus, BinaryMapExp<op::mul, TA, TB, DType, ltype>,
+                              TC, DType, etype>, DType, Arch> {
+ public:
+  PacketPlan(const PacketPlan<BinaryMapExp<op::mul, TA, TB, DType, ltype>, DType, Arch> &lhs,
+             const PacketPlan<TC, DType, Arch> &rhs)
+      : a_(lhs.lhs_), b_(lhs.rhs_), c_(rhs) {}
+  MSHADOW_CINLINE packet::Packet<DType, Arch> EvalPacket(index_t y, index_t x) const {
+    return packet::FMA(a_.EvalPacket(y, x), b_.EvalPacket(y, x), c_.EvalPacket(y, x));
+  }
+  MSHADOW_CINLINE DType Eval(index_t y, index_t x) const {
+    return a_.Eval(y, x) * b_.Eval(y, x) + c_.Eval(y, x);
+  }
+
+ private:
+  PacketPlan<TA, DType, Arch> a_;
+  PacketPlan<TB, DType, Arch> b_;
+  PacketPlan<TC, DType, Arch> c_;
+};
+
 template<typename OP, typename TA, int etype, typename DType, PacketArch Arch>
 class PacketPlan<UnaryMapExp<OP, TA, DType, etype>, DType, Arch> {
  public:
   PacketPlan(const PacketPlan<TA, DType, Arch> &src) : src_(src) {}
-  MSHADOW_CINLINE packet::Packet<DType> EvalPacket(index_t y, index_t x) const {
+  MSHADOW_CINLINE packet::Packet<DType, Arch> EvalPacket(index_t y, index_t x) const {
     return packet::PacketOp<OP, DType, Arch>::Map(src_.EvalPacket(y, x));
   }
   MSHADOW_CINLINE DType Eval(index_t y, index_t x) const {
@@ -284,6 +527,53 @@ class PacketPlan<UnaryMapExp<OP, TA, DType, etype>, DType, Arch> {
   PacketPlan<TA, DType, Arch> src_;
 };
 
+// remaps map tensor expression to subtype's packet plan
+template<typename SubType, typename SrcExp, int dim, typename DType, PacketArch Arch>
+class PacketPlan<MakeTensorExp<SubType, SrcExp, dim, DType>, DType, Arch> {
+ public:
+  explicit PacketPlan(const PacketPlan<SubType, DType, Arch> &src) : src_(src) {}
+  MSHADOW_CINLINE packet::Packet<DType, Arch> EvalPacket(index_t y, index_t x) const {
+    return src_.EvalPacket(y, x);
+  }
+  MSHADOW_CINLINE DType Eval(index_t y, index_t x) const {
+    return src_.Eval(y, x);
+  }
+
+ private:
+  PacketPlan<SubType, DType, Arch> src_;
+};
+
+// conversion between float and the 16 bit floating point types, the only casts that
+// pass PacketCheck, the float values of a 16 bit packet are read as is
+template<typename SrcDType, typename EType, int etype, PacketArch Arch>
+class PacketPlan<TypecastExp<float, SrcDType, EType, etype>, float, Arch> {
+ public:
+  explicit PacketPlan(const PacketPlan<EType, SrcDType, Arch> &src) : src_(src) {}
+  MSHADOW_CINLINE packet::Packet<float, Arch> EvalPacket(index_t y, index_t x) const {
+    return src_.EvalPacket(y, x).data_;
+  }
+  MSHADOW_CINLINE float Eval(index_t y, index_t x) const {
+    return static_cast<float>(src_.Eval(y, x));
+  }
+
+ private:
+  PacketPlan<EType, SrcDType, Arch> src_;
+};
+template<typename DstDType, typename EType, int etype, PacketArch Arch>
+class PacketPlan<TypecastExp<DstDType, float, EType, etype>, DstDType, Arch> {
+ public:
+  explicit PacketPlan(const PacketPlan<EType, float, Arch> &src) : src_(src) {}
+  MSHADOW_CINLINE packet::Packet<DstDType, Arch> EvalPacket(index_t y, index_t x) const {
+    return packet::Packet<DstDType, Arch>::Round(src_.EvalPacket(y, x));
+  }
+  MSHADOW_CINLINE DstDType Eval(index_t y, index_t x) const {
+    return DstDType(src_.Eval(y, x));
+  }
+
+ private:
+  PacketPlan<EType, float, Arch> src_;
+};
+
 template<PacketArch Arch, typename OP, typename TA, typename TB, typename DType, int etype>
 inline PacketPlan<BinaryMapExp<OP, TA, TB, DType, etype>, DType, Arch>
 MakePacketPlan(const BinaryMapExp<OP, TA, TB, DType, etype> &e);
@@ -296,10 +586,17 @@ template<PacketArch Arch, typename T, typename DType>
 inline PacketPlan<T, DType, Arch> MakePacketPlan(const RValueExp<T, DType> &e) {
   return PacketPlan<T, DType, Arch>(e.self());
 }
-template<PacketArch Arch, typename T, int dim, typename DType>
-inline PacketPlan<T, DType, Arch>
-MakePacketPlan(const MakeTensorExp<T, cpu, dim, DType> &e) {
-  return PacketPlan<T, DType, Arch>(e.real_self());
+template<PacketArch Arch, typename T, typename SrcExp, int dim, typename DType>
+inline PacketPlan<MakeTensorExp<T, SrcExp, dim, DType>, DType, Arch>
+MakePacketPlan(const MakeTensorExp<T, SrcExp, dim, DType> &e) {
+  return PacketPlan<MakeTensorExp<T, SrcExp, dim, DType>, DType, Arch>(
+      PacketPlan<T, DType, Arch>(e.real_self()));
+}
+template<PacketArch Arch, typename DstDType, typename SrcDType, typename EType, int etype>
+inline PacketPlan<TypecastExp<DstDType, SrcDType, EType, etype>, DstDType, Arch>
+MakePacketPlan(const TypecastExp<DstDType, SrcDType, EType, etype> &e) {
+  return PacketPlan<TypecastExp<DstDType, SrcDType, EType, etype>,
+                    DstDType, Arch>(MakePacketPlan<Arch>(e.exp));
 }
 template<PacketArch Arch, typename OP, typename TA, typename DType, int etype>
 inline PacketPlan<UnaryMapExp<OP, TA, DType, etype>, DType, Arch>
@@ -332,6 +629,14 @@ template<PacketArch Arch>
 struct PacketCheck<double, Arch> {
   static const bool kPass = true;
 };
+template<PacketArch Arch>
+struct PacketCheck<half::half_t, Arch> {
+  static const bool kPass = packet::PacketConvert<half::half_t, Arch>::kEnabled;
+};
+template<PacketArch Arch>
+struct PacketCheck<bfloat::bf16_t, Arch> {
+  static const bool kPass = packet::PacketConvert<bfloat::bf16_t, Arch>::kEnabled;
+};
 template<typename DType, PacketArch Arch>
 struct PacketCheck<ScalarExp<DType>, Arch> {
   static const bool kPass = PacketCheck<DType, Arch>::kPass;
@@ -340,6 +645,11 @@ template<int dim, typename DType, PacketArch Arch>
 struct PacketCheck<Tensor<cpu, dim, DType>, Arch> {
   static const bool kPass = PacketCheck<DType, Arch>::kPass;
 };
+// the extensions that have a packet plan specialize PacketCheck of their own type
+template<typename T, typename SrcExp, int dim, typename DType, PacketArch Arch>
+struct PacketCheck<MakeTensorExp<T, SrcExp, dim, DType>, Arch> {
+  static const bool kPass = PacketCheck<T, Arch>::kPass;
+};
 template<typename OP, typename TA, typename DType, int etype, PacketArch Arch>
 struct PacketCheck<UnaryMapExp<OP, TA, DType, etype>, Arch> {
   static const bool kPass = PacketCheck<TA, Arch>::kPass &&
@@ -350,6 +660,32 @@ struct PacketCheck< BinaryMapExp<OP, TA, TB, DType, etype>, Arch> {
   static const bool kPass = packet::PacketOp<OP, DType, Arch>::kEnabled &&
       PacketCheck<TA, Arch>::kPass && PacketCheck<TB, Arch>::kPass;
 };
+template<typename SrcDType, typename EType, int etype, PacketArch Arch>
+struct PacketCheck<TypecastExp<float, SrcDType, EType, etype>, Arch> {
+  static const bool kPass = packet::PacketConvert<SrcDType, Arch>::kEnabled &&
+      PacketCheck<EType, Arch>::kPass;
+};
+template<typename DstDType, typename EType, int etype, PacketArch Arch>
+struct PacketCheck<TypecastExp<DstDType, float, EType, etype>, Arch> {
+  static const bool kPass = packet::PacketConvert<DstDType, Arch>::kEnabled &&
+      PacketCheck<EType, Arch>::kPass;
+};
+template<typename EType, int etype, PacketArch Arch>
+struct PacketCheck<TypecastExp<float, float, EType, etype>, Arch> {
+  static const bool kPass = false;
+};
+/*!
+ * \brief whether E is vectorized by one of the packet archs that may be picked
+ *  at runtime, see GetHostPacketArch
+ */
+template<typename E>
+struct PacketHostCheck {
+  static const bool kPass = PacketCheck<E, MSHADOW_DEFAULT_PACKET>::kPass
+#if MSHADOW_USE_PACKET_DISPATCH
+      || PacketCheck<E, packet::kAVX>::kPass || PacketCheck<E, packet::kAVX512>::kPass
+#endif
+      ;  // NOLINT(*)
+};
 //----------------------------------------------------
 // Check if data is aligned and allow packet operation
 //----------------------------------------------------
@@ -372,6 +708,19 @@ struct PacketAlignCheck<dim, Tensor<cpu, dim, DType>, Arch> {
         packet::CheckAlign<Arch>(t.stride_ * sizeof(DType));
   }
 };
+template<int dim, typename T, typename SrcExp, int ldim, typename DType, PacketArch Arch>
+struct PacketAlignCheck<dim, MakeTensorExp<T, SrcExp, ldim, DType>, Arch> {
+  inline static bool Check(const MakeTensorExp<T, SrcExp, ldim, DType> &t) {
+    return PacketAlignCheck<dim, T, Arch>::Check(t.real_self());
+  }
+};
+template<int dim, typename DstDType, typename SrcDType, typename EType, int etype,
+         PacketArch Arch>
+struct PacketAlignCheck<dim, TypecastExp<DstDType, SrcDType, EType, etype>, Arch> {
+  inline static bool Check(const TypecastExp<DstDType, SrcDType, EType, etype> &t) {
+    return PacketAlignCheck<dim, EType, Arch>::Check(t.exp);
+  }
+};
 template<int dim, typename OP, typename TA, typename DType, int etype, PacketArch Arch>
 struct PacketAlignCheck<dim, UnaryMapExp<OP, TA, DType, etype>, Arch> {
   inline static bool Check(const UnaryMapExp<OP, TA, DType, etype> &t) {
@@ -387,23 +736,135 @@ struct PacketAlignCheck<dim, BinaryMapExp<OP, TA, TB, DType, etype>, Arch> {
   }
 };
 
+/*!
+ * \brief evaluate columns [xbegin, xend) of row y of the destination
+ * \param xlen columns below xlen are evaluated in packets
+ */
+template<typename SV, typename E, typename DType, PacketArch Arch>
+MSHADOW_CINLINE void MapPacketRow(Tensor<cpu, 2, DType> dst,
+                                  const expr::PacketPlan<E, DType, Arch>& plan_,
+                                  index_t y, index_t xbegin, index_t xend, index_t xlen) {
+  // a local copy, packet stores may alias anything and would force the members of
+  // the plan, and what is computed from them and y, to be reloaded for every packet
+  const expr::PacketPlan<E, DType, Arch> plan = plan_;
+  index_t x = xbegin;
+  for (; x < std::min(xend, xlen); x += packet::Packet<DType, Arch>::kSize) {
+    packet::Saver<SV, DType, Arch>::Save(&dst[y][x], plan.EvalPacket(y, x));
+  }
+  for (; x < xend; ++x) {
+    SV::Save(dst[y][x], plan.Eval(y, x));
+  }
+}
+/*!
+ * \brief entry of the packet kernel of one arch, specialized for the archs
+ *  that are compiled for a different target than the translation unit
+ */
+template<PacketArch Arch>
+struct PacketRowMapper {
+  template<typename SV, typename E, typename DType>
+  inline static void Map(Tensor<cpu, 2, DType> dst,
+                         const expr::PacketPlan<E, DType, Arch>& plan,
+                         index_t y, index_t xbegin, index_t xend, index_t xlen) {
+    MapPacketRow<SV>(dst, plan, y, xbegin, xend, xlen);
+  }
+};
+#if MSHADOW_USE_PACKET_DISPATCH
+template<>
+struct PacketRowMapper<packet::kAVX> {
+  template<typename SV, typename E, typename DType>
+  MSHADOW_PACKET_TARGET_AVX
+  inline static void Map(Tensor<cpu, 2, DType> dst,
+                         const expr::PacketPlan<E, DType, packet::kAVX>& plan,
+                         index_t y, index_t xbegin, index_t xend, index_t xlen) {
+    MapPacketRow<SV>(dst, plan, y, xbegin, xend, xlen);
+  }
+};
+template<>
+struct PacketRowMapper<packet::kAVX512> {
+  template<typename SV, typename E, typename DType>
+  MSHADOW_PACKET_TARGET_AVX512
+  inline static void Map(Tensor<cpu, 2, DType> dst,
+                         const expr::PacketPlan<E, DType, packet::kAVX512>& plan,
+                         index_t y, index_t xbegin, index_t xend, index_t xlen) {
+    MapPacketRow<SV>(dst, plan, y, xbegin, xend, xlen);
+  }
+};
+#endif  // MSHADOW_USE_PACKET_DISPATCH
+
 /*!
  * \brief use PacketPlan to compute result
+ * \param _dst the destination tensor
+ * \param plan the packet plan of the expression
+ * \param nthread number of threads to use, rows are split among threads,
+ *   and cut into packet aligned column blocks when there are fewer rows than threads
  */
 template<typename SV, typename E, int dim, typename DType, PacketArch Arch>
 inline void MapPacketPlan(Tensor<cpu, dim, DType> _dst,
-                          const expr::PacketPlan<E, DType, Arch>& plan) {
+                          const expr::PacketPlan<E, DType, Arch>& plan,
+                          int nthread = 1) {
   Tensor<cpu, 2, DType> dst = _dst.FlatTo2D();
-  const index_t xlen = packet::LowerAlign<DType, Arch>(dst.size(1));
-  for (index_t y = 0; y < dst.size(0); ++y) {
-    for (index_t x = 0; x < xlen; x += packet::Packet<DType, Arch>::kSize) {
-      packet::Saver<SV, DType, Arch>::Save(&dst[y][x], plan.EvalPacket(y, x));
-    }
-    for (index_t x = xlen; x < dst.size(1); ++x) {
-      SV::Save(dst[y][x], plan.Eval(y, x));
+  const index_t nrow = dst.size(0), ncol = dst.size(1);
+  const index_t xlen = packet::LowerAlign<DType, Arch>(ncol);
+  if (nthread <= 1) {
+    // skip the OpenMP region, which costs more than a small kernel even when not taken
+    for (index_t y = 0; y < nrow; ++y) {
+      PacketRowMapper<Arch>::template Map<SV>(dst, plan, y, 0, ncol, xlen);
     }
+    return;
+  }
+  const index_t nblock = nrow >= static_cast<index_t>(nthread) ?
+      1 : (nthread + nrow - 1) / nrow;
+  const index_t bsize = packet::UpperAlign<DType, Arch>((ncol + nblock - 1) / nblock);
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < nrow * nblock; ++i) {
+    const index_t y = static_cast<index_t>(i) / nblock;
+    const index_t xbegin = (static_cast<index_t>(i) % nblock) * bsize;
+    PacketRowMapper<Arch>::template Map<SV>(dst, plan, y, xbegin,
+                                            std::min(xbegin + bsize, ncol), xlen);
   }
 }
+/*!
+ * \brief map the expression using packet arch Arch if the data is aligned for it
+ * \return whether the expression was evaluated
+ */
+template<typename SV, PacketArch Arch, int dim, typename DType, typename E,
+         bool pass = PacketCheck<E, Arch>::kPass>
+struct PacketMapper {
+  inline static bool Map(Tensor<cpu, dim, DType> *dst, const E &exp, int nthread) {
+    return false;
+  }
+};
+template<typename SV, PacketArch Arch, int dim, typename DType, typename E>
+struct PacketMapper<SV, Arch, dim, DType, E, true> {
+  inline static bool Map(Tensor<cpu, dim, DType> *dst, const E &exp, int nthread) {
+    if (!PacketAlignCheck<dim, E, Arch>::Check(exp) ||
+        !PacketAlignCheck<dim, Tensor<cpu, dim, DType>, Arch>::Check(*dst)) return false;
+    MapPacketPlan<SV>(*dst, MakePacketPlan<Arch>(exp), nthread);
+    return true;
+  }
+};
+/*!
+ * \brief map an expression that passes FlatCheck into a row of all the elements of the
+ *  destination, using packet arch Arch if the data is aligned for it; the packets run
+ *  across the rows of the tensors, whose strides need not be aligned
+ * \param addr the data pointers of dst and of the tensors of exp or-ed together
+ * \return whether the expression was evaluated
+ */
+template<typename SV, PacketArch Arch, typename DType, typename E,
+         bool pass = PacketCheck<E, Arch>::kPass>
+struct PacketFlatMapper {
+  inline static bool Map(Tensor<cpu, 2, DType> dst, const E &exp, size_t addr, int nthread) {
+    return false;
+  }
+};
+template<typename SV, PacketArch Arch, typename DType, typename E>
+struct PacketFlatMapper<SV, Arch, DType, E, true> {
+  inline static bool Map(Tensor<cpu, 2, DType> dst, const E &exp, size_t addr, int nthread) {
+    if (!packet::CheckAlign<Arch>(addr)) return false;
+    MapPacketPlan<SV>(dst, MakePacketPlan<Arch>(exp), nthread);
+    return true;
+  }
+};
 }  // namespace expr
 }  // namespace mshadow
 #endif  // MSHADOW_PACKET_INL_H_
@@ -0,0 +1,342 @@
+/*!
+ *  Copyright (c) 2014 by Contributors
+ * \file avx-inl.h
+ * \brief support of avx packet optimization of some operations,
+ *  fused multiply-add is used when the compiler targets FMA
+ */
+#ifndef MSHADOW_PACKET_AVX_INL_H_
+#define MSHADOW_PACKET_AVX_INL_H_
+
+#include <immintrin.h>
+#include "../base.h"
+#include "../packet-inl.h"
+
+#if MSHADOW_USE_PACKET_DISPATCH
+// compiled for AVX2 and F16C regardless of the compiler flags, only called on hosts supporting it
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx2,fma,f16c"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx2,fma,f16c")
+#endif
+#endif
+
+namespace mshadow {
+namespace packet {
+template<>
+struct Packet<float, kAVX> {
+ public:
+  /*! \brief number of float in vector */
+  static const index_t kSize = 8;
+  /*! \brief The internal data */
+  __m256 data_;
+  // enable default copy constructor
+  Packet(void) {}
+  // constructor from the intrinsic type
+  explicit Packet(__m256 data) : data_(data) {}
+  // create a fill with the target value s
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX> Fill(float s) {
+    return Packet<float, kAVX>(_mm256_set1_ps(s));
+  }
+  // load from address
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX> Load(const float* src) {
+    return Packet<float, kAVX>(_mm256_load_ps(src));
+  }
+  // load from address
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX> LoadUnAligned(const float* src) {
+    return Packet<float, kAVX>(_mm256_loadu_ps(src));
+  }
+  // fill it with value s
+  MSHADOW_PACKET_CINLINE Packet<float, kAVX>& operator=(float s) {
+    data_ = _mm256_set1_ps(s);
+    return *this;
+  }
+  // store data into dst
+  MSHADOW_PACKET_CINLINE void Store(float* dst) const {
+    _mm256_store_ps(dst, data_);
+  }
+  // get the sum of all contents
+  MSHADOW_PACKET_CINLINE float Sum() const {
+    __m128 x = _mm_add_ps(_mm256_castps256_ps128(data_),
+                          _mm256_extractf128_ps(data_, 1));
+    x = _mm_add_ps(x, _mm_movehl_ps(x, x));
+    x = _mm_add_ss(x, _mm_shuffle_ps(x, x, 1));
+    return _mm_cvtss_f32(x);
+  }
+};
+
+/*! \brief vector real type for double */
+template<>
+struct Packet<double, kAVX> {
+  /*! \brief number of double in vector */
+  static const index_t kSize = 4;
+  // internal data
+  __m256d data_;
+  // constructor
+  Packet(void) {}
+  explicit Packet(__m256d data) : data_(data) {}
+  // create a fill with the target value s
+  MSHADOW_PACKET_CINLINE static Packet<double, kAVX> Fill(double s) {
+    return Packet<double, kAVX>(_mm256_set1_pd(s));
+  }
+  // load from address
+  MSHADOW_PACKET_CINLINE static Packet<double, kAVX> Load(const double* src) {
+    return Packet<double, kAVX>(_mm256_load_pd(src));
+  }
+  MSHADOW_PACKET_CINLINE static Packet<double, kAVX> LoadUnAligned(const double* src) {
+    return Packet<double, kAVX>(_mm256_loadu_pd(src));
+  }
+  // fill it with value s
+  MSHADOW_PACKET_CINLINE Packet<double, kAVX>& operator=(double s) {
+    data_ = _mm256_set1_pd(s);
+    return *this;
+  }
+  // store data into dst
+  MSHADOW_PACKET_CINLINE void Store(double* dst) const {
+    _mm256_store_pd(dst, data_);
+  }
+  // get sum of all content
+  inline double Sum(void) const {
+    __m128d x = _mm_add_pd(_mm256_castpd256_pd128(data_),
+                           _mm256_extractf128_pd(data_, 1));
+    x = _mm_add_sd(x, _mm_unpackhi_pd(x, x));
+    return _mm_cvtsd_f64(x);
+  }
+};
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> operator+(const Packet<float, kAVX>& lhs,
+                                                     const Packet<float, kAVX>& rhs) {
+  return Packet<float, kAVX>(_mm256_add_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> operator+(const Packet<double, kAVX>& lhs,
+                                                      const Packet<double, kAVX>& rhs) {
+  return Packet<double, kAVX>(_mm256_add_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> operator-(const Packet<float, kAVX>& lhs,
+                                                     const Packet<float, kAVX>& rhs) {
+  return Packet<float, kAVX>(_mm256_sub_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> operator-(const Packet<double, kAVX>& lhs,
+                                                      const Packet<double, kAVX>& rhs) {
+  return Packet<double, kAVX>(_mm256_sub_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> operator*(const Packet<float, kAVX>& lhs,
+                                                     const Packet<float, kAVX>& rhs) {
+  return Packet<float, kAVX>(_mm256_mul_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> operator*(const Packet<double, kAVX>& lhs,
+                                                      const Packet<double, kAVX>& rhs) {
+  return Packet<double, kAVX>(_mm256_mul_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> operator/(const Packet<float, kAVX>& lhs,
+                                                     const Packet<float, kAVX>& rhs) {
+  return Packet<float, kAVX>(_mm256_div_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> operator/(const Packet<double, kAVX>& lhs,
+                                                      const Packet<double, kAVX>& rhs) {
+  return Packet<double, kAVX>(_mm256_div_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> Max(const Packet<float, kAVX>& lhs,
+                                               const Packet<float, kAVX>& rhs) {
+  return Packet<float, kAVX>(_mm256_max_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> Max(const Packet<double, kAVX>& lhs,
+                                                const Packet<double, kAVX>& rhs) {
+  return Packet<double, kAVX>(_mm256_max_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> Min(const Packet<float, kAVX>& lhs,
+                                               const Packet<float, kAVX>& rhs) {
+  return Packet<float, kAVX>(_mm256_min_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> Min(const Packet<double, kAVX>& lhs,
+                                                const Packet<double, kAVX>& rhs) {
+  return Packet<double, kAVX>(_mm256_min_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> Sqrt(const Packet<float, kAVX>& src) {
+  return Packet<float, kAVX>(_mm256_sqrt_ps(src.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> Sqrt(const Packet<double, kAVX>& src) {
+  return Packet<double, kAVX>(_mm256_sqrt_pd(src.data_));
+}
+
+// primitives used by the transcendental functions in math-inl.h
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> Floor(const Packet<float, kAVX>& src) {
+  return Packet<float, kAVX>(_mm256_floor_ps(src.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> Exp2i(const Packet<float, kAVX>& n) {
+  __m256i e = _mm256_add_epi32(_mm256_cvtps_epi32(n.data_), _mm256_set1_epi32(127));
+  return Packet<float, kAVX>(_mm256_castsi256_ps(_mm256_slli_epi32(e, 23)));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> SplitExp(const Packet<float, kAVX>& src,
+                                                    Packet<float, kAVX>* exponent) {
+  __m256i i = _mm256_sub_epi32(_mm256_castps_si256(src.data_), _mm256_set1_epi32(0x3f3504f3));
+  exponent->data_ = _mm256_cvtepi32_ps(_mm256_srai_epi32(i, 23));
+  i = _mm256_add_epi32(_mm256_and_si256(i, _mm256_set1_epi32(0x007fffff)),
+                       _mm256_set1_epi32(0x3f3504f3));
+  return Packet<float, kAVX>(_mm256_castsi256_ps(i));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> SelectLT(const Packet<float, kAVX>& a,
+                                                    const Packet<float, kAVX>& b,
+                                                    const Packet<float, kAVX>& x,
+                                                    const Packet<float, kAVX>& y) {
+  return Packet<float, kAVX>(
+      _mm256_blendv_ps(y.data_, x.data_, _mm256_cmp_ps(a.data_, b.data_, _CMP_LT_OQ)));
+}
+
+// interleaved complex primitives, see ComplexPacketCheck
+template<>
+struct ComplexPacketCheck<float, kAVX> {
+  static const bool kPass = true;
+};
+template<>
+struct ComplexPacketCheck<double, kAVX> {
+  static const bool kPass = true;
+};
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> SwapPairs(const Packet<float, kAVX>& src) {
+  return Packet<float, kAVX>(_mm256_permute_ps(src.data_, 0xb1));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> SwapPairs(const Packet<double, kAVX>& src) {
+  return Packet<double, kAVX>(_mm256_permute_pd(src.data_, 0x5));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> DupReal(const Packet<float, kAVX>& src) {
+  return Packet<float, kAVX>(_mm256_moveldup_ps(src.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> DupReal(const Packet<double, kAVX>& src) {
+  return Packet<double, kAVX>(_mm256_movedup_pd(src.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> DupImag(const Packet<float, kAVX>& src) {
+  return Packet<float, kAVX>(_mm256_movehdup_ps(src.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> DupImag(const Packet<double, kAVX>& src) {
+  return Packet<double, kAVX>(_mm256_permute_pd(src.data_, 0xf));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> Conj(const Packet<float, kAVX>& src) {
+  const __m256 sign = _mm256_set_ps(-0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f, -0.0f, 0.0f);
+  return Packet<float, kAVX>(_mm256_xor_ps(src.data_, sign));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> Conj(const Packet<double, kAVX>& src) {
+  return Packet<double, kAVX>(_mm256_xor_pd(src.data_, _mm256_set_pd(-0.0, 0.0, -0.0, 0.0)));
+}
+
+// the real and the imaginary parts of the complex numbers of a then b
+MSHADOW_PACKET_CINLINE void Deinterleave(const Packet<float, kAVX>& a,
+                                         const Packet<float, kAVX>& b,
+                                         Packet<float, kAVX>* real, Packet<float, kAVX>* imag) {
+  const __m256 lo = _mm256_permute2f128_ps(a.data_, b.data_, 0x20);
+  const __m256 hi = _mm256_permute2f128_ps(a.data_, b.data_, 0x31);
+  real->data_ = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+  imag->data_ = _mm256_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+MSHADOW_PACKET_CINLINE void Deinterleave(const Packet<double, kAVX>& a,
+                                         const Packet<double, kAVX>& b,
+                                         Packet<double, kAVX>* real, Packet<double, kAVX>* imag) {
+  const __m256d lo = _mm256_permute2f128_pd(a.data_, b.data_, 0x20);
+  const __m256d hi = _mm256_permute2f128_pd(a.data_, b.data_, 0x31);
+  real->data_ = _mm256_unpacklo_pd(lo, hi);
+  imag->data_ = _mm256_unpackhi_pd(lo, hi);
+}
+
+#if defined(__FMA__) || MSHADOW_USE_PACKET_DISPATCH
+MSHADOW_PACKET_CINLINE Packet<float, kAVX> FMA(const Packet<float, kAVX>& a,
+                                               const Packet<float, kAVX>& b,
+                                               const Packet<float, kAVX>& c) {
+  return Packet<float, kAVX>(_mm256_fmadd_ps(a.data_, b.data_, c.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX> FMA(const Packet<double, kAVX>& a,
+                                                const Packet<double, kAVX>& b,
+                                                const Packet<double, kAVX>& c) {
+  return Packet<double, kAVX>(_mm256_fmadd_pd(a.data_, b.data_, c.data_));
+}
+#endif  // __FMA__
+
+#if defined(__F16C__) || MSHADOW_USE_PACKET_DISPATCH
+template<>
+struct PacketConvert<half::half_t, kAVX> {
+  static const bool kEnabled = true;
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX> Load(const half::half_t *src) {
+    return Packet<float, kAVX>(
+        _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src))));
+  }
+  // src holds values of half_t, the conversion is exact
+  MSHADOW_PACKET_CINLINE static void Store(half::half_t *dst, const Packet<float, kAVX> &src) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst),
+                     _mm256_cvtps_ph(src.data_, _MM_FROUND_TO_ZERO));
+  }
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX> Round(const Packet<float, kAVX> &src) {
+    // the conversion saturates, values past the largest half go to inf instead
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    const __m256 big = _mm256_cmp_ps(_mm256_andnot_ps(sign, src.data_),
+                                     _mm256_set1_ps(65504.0f), _CMP_GT_OQ);
+    const __m256 inf = _mm256_or_ps(_mm256_and_ps(sign, src.data_),
+                                    _mm256_castsi256_ps(_mm256_set1_epi32(0x7f800000)));
+    const __m256 x = _mm256_blendv_ps(src.data_, inf, big);
+    return Packet<float, kAVX>(_mm256_cvtph_ps(_mm256_cvtps_ph(x, _MM_FROUND_TO_ZERO)));
+  }
+};
+#endif  // __F16C__
+
+template<>
+struct PacketConvert<bfloat::bf16_t, kAVX> {
+  static const bool kEnabled = true;
+  // a bf16_t is the upper half of a float
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX> Load(const bfloat::bf16_t *src) {
+    const __m256i x = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(src)));
+    return Packet<float, kAVX>(_mm256_castsi256_ps(_mm256_slli_epi32(x, 16)));
+  }
+  // src holds values of bf16_t, the upper halves are in the range of int16 after the
+  // arithmetic shift, so the pack does not saturate, it packs within each 128 bit lane
+  MSHADOW_PACKET_CINLINE static void Store(bfloat::bf16_t *dst, const Packet<float, kAVX> &src) {
+    const __m256i x = _mm256_srai_epi32(_mm256_castps_si256(src.data_), 16);
+    const __m256i p = _mm256_permute4x64_epi64(_mm256_packs_epi32(x, x), 0x08);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dst), _mm256_castsi256_si128(p));
+  }
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX> Round(const Packet<float, kAVX> &src) {
+    // round to nearest even, nan is made quiet instead so that it stays a nan
+    const __m256i x = _mm256_castps_si256(src.data_);
+    const __m256i odd = _mm256_and_si256(_mm256_srli_epi32(x, 16), _mm256_set1_epi32(1));
+    const __m256i rounded = _mm256_add_epi32(x, _mm256_add_epi32(odd, _mm256_set1_epi32(0x7fff)));
+    const __m256i nan = _mm256_cmpgt_epi32(_mm256_and_si256(x, _mm256_set1_epi32(0x7fffffff)),
+                                           _mm256_set1_epi32(0x7f800000));
+    const __m256i quiet = _mm256_or_si256(x, _mm256_set1_epi32(0x00400000));
+    const __m256i r = _mm256_blendv_epi8(rounded, quiet, nan);
+    return Packet<float, kAVX>(
+        _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_srli_epi32(r, 16), 16)));
+  }
+};
+}  // namespace packet
+}  // namespace mshadow
+
+#if MSHADOW_USE_PACKET_DISPATCH
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
+#endif  // MSHADOW_PACKET_AVX_INL_H_
@@ -0,0 +1,347 @@
+/*!
+ *  Copyright (c) 2014 by Contributors
+ * \file avx512-inl.h
+ * \brief support of avx512 packet optimization of some operations
+ */
+#ifndef MSHADOW_PACKET_AVX512_INL_H_
+#define MSHADOW_PACKET_AVX512_INL_H_
+
+#include <immintrin.h>
+#include "../base.h"
+#include "../packet-inl.h"
+
+#if MSHADOW_USE_PACKET_DISPATCH
+// compiled for AVX-512 regardless of the compiler flags, only called on hosts supporting it
+#if defined(__clang__)
+#pragma clang attribute push(__attribute__((target("avx512f,fma"))), apply_to = function)
+#else
+#pragma GCC push_options
+#pragma GCC target("avx512f,fma")
+#endif
+#endif
+
+namespace mshadow {
+namespace packet {
+template<>
+struct Packet<float, kAVX512> {
+ public:
+  /*! \brief number of float in vector */
+  static const index_t kSize = 16;
+  /*! \brief The internal data */
+  __m512 data_;
+  // enable default copy constructor
+  Packet(void) {}
+  // constructor from the intrinsic type
+  explicit Packet(__m512 data) : data_(data) {}
+  // create a fill with the target value s
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX512> Fill(float s) {
+    return Packet<float, kAVX512>(_mm512_set1_ps(s));
+  }
+  // load from address
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX512> Load(const float* src) {
+    return Packet<float, kAVX512>(_mm512_load_ps(src));
+  }
+  // load from address
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX512> LoadUnAligned(const float* src) {
+    return Packet<float, kAVX512>(_mm512_loadu_ps(src));
+  }
+  // fill it with value s
+  MSHADOW_PACKET_CINLINE Packet<float, kAVX512>& operator=(float s) {
+    data_ = _mm512_set1_ps(s);
+    return *this;
+  }
+  // store data into dst
+  MSHADOW_PACKET_CINLINE void Store(float* dst) const {
+    _mm512_store_ps(dst, data_);
+  }
+  // get the sum of all contents
+  MSHADOW_PACKET_CINLINE float Sum() const {
+    return _mm512_reduce_add_ps(data_);
+  }
+};
+
+/*! \brief vector real type for double */
+template<>
+struct Packet<double, kAVX512> {
+  /*! \brief number of double in vector */
+  static const index_t kSize = 8;
+  // internal data
+  __m512d data_;
+  // constructor
+  Packet(void) {}
+  explicit Packet(__m512d data) : data_(data) {}
+  // create a fill with the target value s
+  MSHADOW_PACKET_CINLINE static Packet<double, kAVX512> Fill(double s) {
+    return Packet<double, kAVX512>(_mm512_set1_pd(s));
+  }
+  // load from address
+  MSHADOW_PACKET_CINLINE static Packet<double, kAVX512> Load(const double* src) {
+    return Packet<double, kAVX512>(_mm512_load_pd(src));
+  }
+  MSHADOW_PACKET_CINLINE static Packet<double, kAVX512> LoadUnAligned(const double* src) {
+    return Packet<double, kAVX512>(_mm512_loadu_pd(src));
+  }
+  // fill it with value s
+  MSHADOW_PACKET_CINLINE Packet<double, kAVX512>& operator=(double s) {
+    data_ = _mm512_set1_pd(s);
+    return *this;
+  }
+  // store data into dst
+  MSHADOW_PACKET_CINLINE void Store(double* dst) const {
+    _mm512_store_pd(dst, data_);
+  }
+  // get sum of all content
+  inline double Sum(void) const {
+    return _mm512_reduce_add_pd(data_);
+  }
+};
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> operator+(const Packet<float, kAVX512>& lhs,
+                                                        const Packet<float, kAVX512>& rhs) {
+  return Packet<float, kAVX512>(_mm512_add_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> operator+(const Packet<double, kAVX512>& lhs,
+                                                         const Packet<double, kAVX512>& rhs) {
+  return Packet<double, kAVX512>(_mm512_add_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> operator-(const Packet<float, kAVX512>& lhs,
+                                                        const Packet<float, kAVX512>& rhs) {
+  return Packet<float, kAVX512>(_mm512_sub_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> operator-(const Packet<double, kAVX512>& lhs,
+                                                         const Packet<double, kAVX512>& rhs) {
+  return Packet<double, kAVX512>(_mm512_sub_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> operator*(const Packet<float, kAVX512>& lhs,
+                                                        const Packet<float, kAVX512>& rhs) {
+  return Packet<float, kAVX512>(_mm512_mul_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> operator*(const Packet<double, kAVX512>& lhs,
+                                                         const Packet<double, kAVX512>& rhs) {
+  return Packet<double, kAVX512>(_mm512_mul_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> operator/(const Packet<float, kAVX512>& lhs,
+                                                        const Packet<float, kAVX512>& rhs) {
+  return Packet<float, kAVX512>(_mm512_div_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> operator/(const Packet<double, kAVX512>& lhs,
+                                                         const Packet<double, kAVX512>& rhs) {
+  return Packet<double, kAVX512>(_mm512_div_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> FMA(const Packet<float, kAVX512>& a,
+                                                  const Packet<float, kAVX512>& b,
+                                                  const Packet<float, kAVX512>& c) {
+  return Packet<float, kAVX512>(_mm512_fmadd_ps(a.data_, b.data_, c.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> FMA(const Packet<double, kAVX512>& a,
+                                                   const Packet<double, kAVX512>& b,
+                                                   const Packet<double, kAVX512>& c) {
+  return Packet<double, kAVX512>(_mm512_fmadd_pd(a.data_, b.data_, c.data_));
+}
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> Max(const Packet<float, kAVX512>& lhs,
+                                                  const Packet<float, kAVX512>& rhs) {
+  return Packet<float, kAVX512>(_mm512_max_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> Max(const Packet<double, kAVX512>& lhs,
+                                                   const Packet<double, kAVX512>& rhs) {
+  return Packet<double, kAVX512>(_mm512_max_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> Min(const Packet<float, kAVX512>& lhs,
+                                                  const Packet<float, kAVX512>& rhs) {
+  return Packet<float, kAVX512>(_mm512_min_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> Min(const Packet<double, kAVX512>& lhs,
+                                                   const Packet<double, kAVX512>& rhs) {
+  return Packet<double, kAVX512>(_mm512_min_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> Sqrt(const Packet<float, kAVX512>& src) {
+  return Packet<float, kAVX512>(_mm512_sqrt_ps(src.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> Sqrt(const Packet<double, kAVX512>& src) {
+  return Packet<double, kAVX512>(_mm512_sqrt_pd(src.data_));
+}
+
+// interleaved complex primitives, see ComplexPacketCheck, the zero masked forms are used
+// for the same reason as in the conversions below
+template<>
+struct ComplexPacketCheck<float, kAVX512> {
+  static const bool kPass = true;
+};
+template<>
+struct ComplexPacketCheck<double, kAVX512> {
+  static const bool kPass = true;
+};
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> SwapPairs(const Packet<float, kAVX512>& src) {
+  return Packet<float, kAVX512>(_mm512_maskz_permute_ps(0xffff, src.data_, 0xb1));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> SwapPairs(const Packet<double, kAVX512>& src) {
+  return Packet<double, kAVX512>(_mm512_maskz_permute_pd(0xff, src.data_, 0x55));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> DupReal(const Packet<float, kAVX512>& src) {
+  return Packet<float, kAVX512>(_mm512_maskz_moveldup_ps(0xffff, src.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> DupReal(const Packet<double, kAVX512>& src) {
+  return Packet<double, kAVX512>(_mm512_maskz_movedup_pd(0xff, src.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> DupImag(const Packet<float, kAVX512>& src) {
+  return Packet<float, kAVX512>(_mm512_maskz_movehdup_ps(0xffff, src.data_));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> DupImag(const Packet<double, kAVX512>& src) {
+  return Packet<double, kAVX512>(_mm512_maskz_permute_pd(0xff, src.data_, 0xff));
+}
+
+// the integer xor only needs avx512f, the float one is part of avx512dq
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> Conj(const Packet<float, kAVX512>& src) {
+  const __m512i sign = _mm512_set1_epi64(static_cast<int64_t>(0x8000000000000000ULL));
+  return Packet<float, kAVX512>(
+      _mm512_castsi512_ps(_mm512_xor_si512(_mm512_castps_si512(src.data_), sign)));
+}
+
+MSHADOW_PACKET_CINLINE Packet<double, kAVX512> Conj(const Packet<double, kAVX512>& src) {
+  const __m512i sign = _mm512_set_epi64(static_cast<int64_t>(0x8000000000000000ULL), 0,
+                                        static_cast<int64_t>(0x8000000000000000ULL), 0,
+                                        static_cast<int64_t>(0x8000000000000000ULL), 0,
+                                        static_cast<int64_t>(0x8000000000000000ULL), 0);
+  return Packet<double, kAVX512>(
+      _mm512_castsi512_pd(_mm512_xor_si512(_mm512_castpd_si512(src.data_), sign)));
+}
+
+// the real and the imaginary parts of the complex numbers of a then b
+MSHADOW_PACKET_CINLINE void Deinterleave(const Packet<float, kAVX512>& a,
+                                         const Packet<float, kAVX512>& b,
+                                         Packet<float, kAVX512>* real,
+                                         Packet<float, kAVX512>* imag) {
+  const __m512i even = _mm512_set_epi32(30, 28, 26, 24, 22, 20, 18, 16,
+                                        14, 12, 10, 8, 6, 4, 2, 0);
+  const __m512i odd = _mm512_set_epi32(31, 29, 27, 25, 23, 21, 19, 17,
+                                       15, 13, 11, 9, 7, 5, 3, 1);
+  real->data_ = _mm512_permutex2var_ps(a.data_, even, b.data_);
+  imag->data_ = _mm512_permutex2var_ps(a.data_, odd, b.data_);
+}
+
+MSHADOW_PACKET_CINLINE void Deinterleave(const Packet<double, kAVX512>& a,
+                                         const Packet<double, kAVX512>& b,
+                                         Packet<double, kAVX512>* real,
+                                         Packet<double, kAVX512>* imag) {
+  const __m512i even = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+  const __m512i odd = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+  real->data_ = _mm512_permutex2var_pd(a.data_, even, b.data_);
+  imag->data_ = _mm512_permutex2var_pd(a.data_, odd, b.data_);
+}
+
+// primitives used by the transcendental functions in math-inl.h
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> Floor(const Packet<float, kAVX512>& src) {
+  return Packet<float, kAVX512>(
+      _mm512_roundscale_ps(src.data_, _MM_FROUND_TO_NEG_INF | _MM_FROUND_NO_EXC));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> Exp2i(const Packet<float, kAVX512>& n) {
+  __m512i e = _mm512_add_epi32(_mm512_cvtps_epi32(n.data_), _mm512_set1_epi32(127));
+  return Packet<float, kAVX512>(_mm512_castsi512_ps(_mm512_slli_epi32(e, 23)));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> SplitExp(const Packet<float, kAVX512>& src,
+                                                       Packet<float, kAVX512>* exponent) {
+  __m512i i = _mm512_sub_epi32(_mm512_castps_si512(src.data_), _mm512_set1_epi32(0x3f3504f3));
+  exponent->data_ = _mm512_cvtepi32_ps(_mm512_srai_epi32(i, 23));
+  i = _mm512_add_epi32(_mm512_and_si512(i, _mm512_set1_epi32(0x007fffff)),
+                       _mm512_set1_epi32(0x3f3504f3));
+  return Packet<float, kAVX512>(_mm512_castsi512_ps(i));
+}
+
+MSHADOW_PACKET_CINLINE Packet<float, kAVX512> SelectLT(const Packet<float, kAVX512>& a,
+                                                       const Packet<float, kAVX512>& b,
+                                                       const Packet<float, kAVX512>& x,
+                                                       const Packet<float, kAVX512>& y) {
+  return Packet<float, kAVX512>(
+      _mm512_mask_blend_ps(_mm512_cmp_ps_mask(a.data_, b.data_, _CMP_LT_OQ), y.data_, x.data_));
+}
+
+// the zero masked forms of the conversions do the same with every lane selected, the plain
+// ones read an undefined register that some compilers warn about
+template<>
+struct PacketConvert<half::half_t, kAVX512> {
+  static const bool kEnabled = true;
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX512> Load(const half::half_t *src) {
+    return Packet<float, kAVX512>(
+        _mm512_maskz_cvtph_ps(0xffff, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src))));
+  }
+  // src holds values of half_t, the conversion is exact
+  MSHADOW_PACKET_CINLINE static void Store(half::half_t *dst,
+                                           const Packet<float, kAVX512> &src) {
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst),
+                        _mm512_maskz_cvtps_ph(0xffff, src.data_,
+                                              _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC));
+  }
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX512> Round(const Packet<float, kAVX512> &src) {
+    // the conversion saturates, values past the largest half go to inf instead
+    const __m512i bits = _mm512_castps_si512(src.data_);
+    const __mmask16 big = _mm512_cmp_ps_mask(_mm512_abs_ps(src.data_),
+                                             _mm512_set1_ps(65504.0f), _CMP_GT_OQ);
+    const __m512i inf = _mm512_or_si512(_mm512_and_si512(bits, _mm512_set1_epi32(0x80000000)),
+                                        _mm512_set1_epi32(0x7f800000));
+    const __m512 x = _mm512_castsi512_ps(_mm512_mask_blend_epi32(big, bits, inf));
+    return Packet<float, kAVX512>(_mm512_maskz_cvtph_ps(
+        0xffff, _mm512_maskz_cvtps_ph(0xffff, x, _MM_FROUND_TO_ZERO | _MM_FROUND_NO_EXC)));
+  }
+};
+
+template<>
+struct PacketConvert<bfloat::bf16_t, kAVX512> {
+  static const bool kEnabled = true;
+  // a bf16_t is the upper half of a float
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX512> Load(const bfloat::bf16_t *src) {
+    const __m512i x =
+        _mm512_maskz_cvtepu16_epi32(0xffff, _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src)));
+    return Packet<float, kAVX512>(_mm512_castsi512_ps(_mm512_maskz_slli_epi32(0xffff, x, 16)));
+  }
+  // src holds values of bf16_t
+  MSHADOW_PACKET_CINLINE static void Store(bfloat::bf16_t *dst,
+                                           const Packet<float, kAVX512> &src) {
+    const __m512i x = _mm512_maskz_srli_epi32(0xffff, _mm512_castps_si512(src.data_), 16);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst), _mm512_maskz_cvtepi32_epi16(0xffff, x));
+  }
+  MSHADOW_PACKET_CINLINE static Packet<float, kAVX512> Round(const Packet<float, kAVX512> &src) {
+    // round to nearest even, nan is made quiet instead so that it stays a nan
+    const __m512i x = _mm512_castps_si512(src.data_);
+    const __m512i odd = _mm512_and_si512(_mm512_maskz_srli_epi32(0xffff, x, 16), _mm512_set1_epi32(1));
+    const __m512i rounded = _mm512_add_epi32(x, _mm512_add_epi32(odd, _mm512_set1_epi32(0x7fff)));
+    const __mmask16 nan = _mm512_cmpgt_epi32_mask(
+        _mm512_and_si512(x, _mm512_set1_epi32(0x7fffffff)), _mm512_set1_epi32(0x7f800000));
+    const __m512i r = _mm512_mask_blend_epi32(
+        nan, rounded, _mm512_or_si512(x, _mm512_set1_epi32(0x00400000)));
+    return Packet<float, kAVX512>(
+        _mm512_castsi512_ps(_mm512_and_si512(r, _mm512_set1_epi32(0xffff0000))));
+  }
+};
+}  // namespace packet
+}  // namespace mshadow
+
+#if MSHADOW_USE_PACKET_DISPATCH
+#if defined(__clang__)
+#pragma clang attribute pop
+#else
+#pragma GCC pop_options
+#endif
+#endif
+#endif  // MSHADOW_PACKET_AVX512_INL_H_
@@ -0,0 +1,145 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file float16-inl.h
+ * \brief packets of the 16 bit floating point types half_t and bf16_t on the archs with a
+ *  PacketConvert, the elements are kept as float in registers and rounded after each
+ *  operation, so the results are the same as the scalar operators of the type
+ */
+#ifndef MSHADOW_PACKET_FLOAT16_INL_H_
+#define MSHADOW_PACKET_FLOAT16_INL_H_
+
+#include "../base.h"
+#include "../packet-inl.h"
+
+namespace mshadow {
+namespace packet {
+/*!
+ * \brief members shared by the packets of the 16 bit floating point types
+ * \tparam DType half_t or bf16_t
+ * \tparam Arch the arch of the packet
+ */
+template<typename DType, PacketArch Arch>
+struct Float16Packet {
+ public:
+  /*! \brief number of DType in vector */
+  static const index_t kSize = Packet<float, Arch>::kSize;
+  /*! \brief The internal data, every element is a value of DType */
+  Packet<float, Arch> data_;
+  // enable default copy constructor
+  Float16Packet(void) {}
+  // constructor from float values that are already values of DType
+  explicit Float16Packet(const Packet<float, Arch> &data) : data_(data) {}
+  // round float values to DType
+  MSHADOW_CINLINE static Packet<DType, Arch> Round(const Packet<float, Arch> &src) {
+    return Packet<DType, Arch>(PacketConvert<DType, Arch>::Round(src));
+  }
+  // create a fill with the target value s
+  MSHADOW_CINLINE static Packet<DType, Arch> Fill(DType s) {
+    return Packet<DType, Arch>(Packet<float, Arch>::Fill(static_cast<float>(s)));
+  }
+  // load from address, src needs to be aligned to the element only
+  MSHADOW_CINLINE static Packet<DType, Arch> Load(const DType* src) {
+    return Packet<DType, Arch>(PacketConvert<DType, Arch>::Load(src));
+  }
+  // load from address
+  MSHADOW_CINLINE static Packet<DType, Arch> LoadUnAligned(const DType* src) {
+    return Packet<DType, Arch>(PacketConvert<DType, Arch>::Load(src));
+  }
+  // fill it with value s
+  MSHADOW_CINLINE Float16Packet<DType, Arch>& operator=(DType s) {
+    data_ = Packet<float, Arch>::Fill(static_cast<float>(s));
+    return *this;
+  }
+  // store data into dst
+  MSHADOW_CINLINE void Store(DType* dst) const {
+    PacketConvert<DType, Arch>::Store(dst, data_);
+  }
+  // get the sum of all contents, added in float and rounded once
+  MSHADOW_CINLINE DType Sum() const {
+    return DType(data_.Sum());
+  }
+};
+
+// kPlain keeps the generic plain packet, PacketCheck never enables these types on it
+template<PacketArch Arch>
+struct Packet<half::half_t, Arch> : public Float16Packet<half::half_t, Arch> {
+  Packet(void) {}
+  explicit Packet(const Packet<float, Arch> &data)
+      : Float16Packet<half::half_t, Arch>(data) {}
+};
+
+template<PacketArch Arch>
+struct Packet<bfloat::bf16_t, Arch> : public Float16Packet<bfloat::bf16_t, Arch> {
+  Packet(void) {}
+  explicit Packet(const Packet<float, Arch> &data)
+      : Float16Packet<bfloat::bf16_t, Arch>(data) {}
+};
+
+/*!
+ * \brief the packet of AccType<DType>::type that holds the values of a packet of DType,
+ *  used by the reductions
+ */
+template<typename DType, PacketArch Arch>
+struct AccPacket {
+  MSHADOW_CINLINE static const Packet<DType, Arch>& Get(const Packet<DType, Arch> &src) {
+    return src;
+  }
+};
+template<PacketArch Arch>
+struct AccPacket<half::half_t, Arch> {
+  MSHADOW_CINLINE static const Packet<float, Arch>& Get(
+      const Packet<half::half_t, Arch> &src) {
+    return src.data_;
+  }
+};
+template<PacketArch Arch>
+struct AccPacket<bfloat::bf16_t, Arch> {
+  MSHADOW_CINLINE static const Packet<float, Arch>& Get(
+      const Packet<bfloat::bf16_t, Arch> &src) {
+    return src.data_;
+  }
+};
+
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> operator+(const Float16Packet<DType, Arch>& lhs,
+                                              const Float16Packet<DType, Arch>& rhs) {
+  return Float16Packet<DType, Arch>::Round(lhs.data_ + rhs.data_);
+}
+
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> operator-(const Float16Packet<DType, Arch>& lhs,
+                                              const Float16Packet<DType, Arch>& rhs) {
+  return Float16Packet<DType, Arch>::Round(lhs.data_ - rhs.data_);
+}
+
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> operator*(const Float16Packet<DType, Arch>& lhs,
+                                              const Float16Packet<DType, Arch>& rhs) {
+  return Float16Packet<DType, Arch>::Round(lhs.data_ * rhs.data_);
+}
+
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> operator/(const Float16Packet<DType, Arch>& lhs,
+                                              const Float16Packet<DType, Arch>& rhs) {
+  return Float16Packet<DType, Arch>::Round(lhs.data_ / rhs.data_);
+}
+
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> Max(const Float16Packet<DType, Arch>& lhs,
+                                        const Float16Packet<DType, Arch>& rhs) {
+  return Packet<DType, Arch>(Max(lhs.data_, rhs.data_));
+}
+
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> Min(const Float16Packet<DType, Arch>& lhs,
+                                        const Float16Packet<DType, Arch>& rhs) {
+  return Packet<DType, Arch>(Min(lhs.data_, rhs.data_));
+}
+
+template<typename DType, PacketArch Arch>
+MSHADOW_CINLINE Packet<DType, Arch> Sqrt(const Float16Packet<DType, Arch>& src) {
+  return Float16Packet<DType, Arch>::Round(Sqrt(src.data_));
+}
+}  // namespace packet
+}  // namespace mshadow
+#endif  // MSHADOW_PACKET_FLOAT16_INL_H_
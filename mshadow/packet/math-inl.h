@@ -0,0 +1,87 @@
+/*!
+ *  Copyright (c) 2014 by Contributors
+ * \file math-inl.h
+ * \brief vectorized exp, log, tanh and sigmoid of float packets,
+ *  built from the Floor, Exp2i, SplitExp and SelectLT primitives of each arch.
+ *  The polynomials follow cephes, with a maximum error of a few ulp.
+ */
+#ifndef MSHADOW_PACKET_MATH_INL_H_
+#define MSHADOW_PACKET_MATH_INL_H_
+
+#include <limits>
+#include "../base.h"
+#include "../packet-inl.h"
+
+namespace mshadow {
+namespace packet {
+template<PacketArch Arch>
+MSHADOW_CINLINE Packet<float, Arch> Exp(const Packet<float, Arch>& src) {
+  typedef Packet<float, Arch> P;
+  const P lower = P::Fill(-103.972076f), upper = P::Fill(88.7228391f);
+  P x = Min(Max(src, lower), upper);
+  // exp(x) = exp(r) * 2^n, n = round(x / ln2)
+  P n = Floor(x * P::Fill(1.44269504088896341f) + P::Fill(0.5f));
+  P r = x - n * P::Fill(0.693359375f) - n * P::Fill(-2.12194440e-4f);
+  P y = P::Fill(1.9875691500e-4f);
+  y = y * r + P::Fill(1.3981999507e-3f);
+  y = y * r + P::Fill(8.3334519073e-3f);
+  y = y * r + P::Fill(4.1665795894e-2f);
+  y = y * r + P::Fill(1.6666665459e-1f);
+  y = y * r + P::Fill(5.0000001201e-1f);
+  y = y * (r * r) + r + P::Fill(1.0f);
+  // scale in two steps so that both factors stay normal numbers
+  P n1 = Floor(n * P::Fill(0.5f));
+  P ans = y * Exp2i(n1) * Exp2i(n - n1);
+  // below the lower bound the result underflows to zero, above the upper one it overflows
+  // to inf, like the scalar exp; -inf gives 0, +inf and nan are returned as they are
+  const P inf = P::Fill(std::numeric_limits<float>::infinity());
+  ans = SelectLT(src, lower, P::Fill(0.0f), ans);
+  ans = SelectLT(upper, src, inf, ans);
+  return SelectLT(src, inf, ans, src);
+}
+
+template<PacketArch Arch>
+MSHADOW_CINLINE Packet<float, Arch> Log(const Packet<float, Arch>& src) {
+  typedef Packet<float, Arch> P;
+  // src = m * 2^e, m in [sqrt(1/2), sqrt(2))
+  P e;
+  P m = SplitExp(src, &e);
+  // log(m) = 2 atanh(s), s = (m - 1) / (m + 1)
+  P f = m - P::Fill(1.0f);
+  P s = f / (f + P::Fill(2.0f));
+  P z = s * s;
+  P y = P::Fill(1.0f / 9.0f);
+  y = y * z + P::Fill(1.0f / 7.0f);
+  y = y * z + P::Fill(1.0f / 5.0f);
+  y = y * z + P::Fill(1.0f / 3.0f);
+  y = y * z + P::Fill(1.0f);
+  P ans = e * P::Fill(0.693147180559945f) + (s + s) * y;
+  // zero gives -inf, negative values give nan
+  ans = SelectLT(src, P::Fill(std::numeric_limits<float>::min()),
+                 P::Fill(-std::numeric_limits<float>::infinity()), ans);
+  return SelectLT(src, P::Fill(0.0f), P::Fill(std::numeric_limits<float>::quiet_NaN()), ans);
+}
+
+template<PacketArch Arch>
+MSHADOW_CINLINE Packet<float, Arch> Tanh(const Packet<float, Arch>& src) {
+  typedef Packet<float, Arch> P;
+  // polynomial around zero, where 1 - 2 / (exp(2x) + 1) loses precision
+  P z = src * src;
+  P y = P::Fill(-5.70498872745e-3f);
+  y = y * z + P::Fill(2.06390887954e-2f);
+  y = y * z + P::Fill(-5.37397155531e-2f);
+  y = y * z + P::Fill(1.33314422036e-1f);
+  y = y * z + P::Fill(-3.33332819422e-1f);
+  y = y * z * src + src;
+  P t = P::Fill(1.0f) - P::Fill(2.0f) / (Exp(src + src) + P::Fill(1.0f));
+  return SelectLT(z, P::Fill(0.625f * 0.625f), y, t);
+}
+
+template<PacketArch Arch>
+MSHADOW_CINLINE Packet<float, Arch> Sigmoid(const Packet<float, Arch>& src) {
+  typedef Packet<float, Arch> P;
+  return P::Fill(1.0f) / (P::Fill(1.0f) + Exp(P::Fill(0.0f) - src));
+}
+}  // namespace packet
+}  // namespace mshadow
+#endif  // MSHADOW_PACKET_MATH_INL_H_
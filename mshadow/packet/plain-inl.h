@@ -71,6 +71,36 @@ MSHADOW_CINLINE Packet<DType, kPlain> operator/(const Packet<DType, kPlain>& lhs
                                                     const Packet<DType, kPlain>& rhs) {
   return Packet<DType, kPlain>(lhs.data_ / rhs.data_);
 }
+
+template<typename DType>
+MSHADOW_CINLINE Packet<DType, kPlain> Max(const Packet<DType, kPlain>& lhs,
+                                          const Packet<DType, kPlain>& rhs) {
+  return Packet<DType, kPlain>(op::maximum::Map(lhs.data_, rhs.data_));
+}
+
+template<typename DType>
+MSHADOW_CINLINE Packet<DType, kPlain> Min(const Packet<DType, kPlain>& lhs,
+                                          const Packet<DType, kPlain>& rhs) {
+  return Packet<DType, kPlain>(op::minimum::Map(lhs.data_, rhs.data_));
+}
+
+template<typename DType>
+MSHADOW_CINLINE Packet<DType, kPlain> Sqrt(const Packet<DType, kPlain>& src) {
+  return Packet<DType, kPlain>(op::sqrt::Map(src.data_));
+}
+// the transcendental functions of plain packets simply use the scalar version
+#define MSHADOW_PLAIN_PACKET_FUNC(Func, OP)                                  \
+  MSHADOW_CINLINE Packet<float, kPlain> Func(const Packet<float, kPlain>& src) { \
+    return Packet<float, kPlain>(OP::Map(src.data_));                        \
+  }                                                                          \
+  MSHADOW_CINLINE Packet<double, kPlain> Func(const Packet<double, kPlain>& src) { \
+    return Packet<double, kPlain>(OP::Map(src.data_));                       \
+  }
+MSHADOW_PLAIN_PACKET_FUNC(Exp, op::exp)
+MSHADOW_PLAIN_PACKET_FUNC(Log, op::log)
+MSHADOW_PLAIN_PACKET_FUNC(Tanh, op::tanh)
+MSHADOW_PLAIN_PACKET_FUNC(Sigmoid, op::sigmoid)
+#undef MSHADOW_PLAIN_PACKET_FUNC
 }  // namespace packet
 }  // namespace mshadow
 #endif  // MSHADOW_PACKET_PLAIN_INL_H_
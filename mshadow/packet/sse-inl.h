@@ -8,6 +8,9 @@
 #define MSHADOW_PACKET_SSE_INL_H_
 
 #include <emmintrin.h>
+#ifdef __F16C__
+#include <immintrin.h>
+#endif
 #include "../base.h"
 #include "../packet-inl.h"
 
@@ -142,6 +145,171 @@ MSHADOW_CINLINE Packet<double, kSSE2> operator/(const Packet<double, kSSE2>& lhs
   return Packet<double, kSSE2>(_mm_div_pd(lhs.data_, rhs.data_));
 }
 
+MSHADOW_CINLINE Packet<float, kSSE2> Max(const Packet<float, kSSE2>& lhs,
+                                          const Packet<float, kSSE2>& rhs) {
+  return Packet<float, kSSE2>(_mm_max_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_CINLINE Packet<double, kSSE2> Max(const Packet<double, kSSE2>& lhs,
+                                           const Packet<double, kSSE2>& rhs) {
+  return Packet<double, kSSE2>(_mm_max_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_CINLINE Packet<float, kSSE2> Min(const Packet<float, kSSE2>& lhs,
+                                          const Packet<float, kSSE2>& rhs) {
+  return Packet<float, kSSE2>(_mm_min_ps(lhs.data_, rhs.data_));
+}
+
+MSHADOW_CINLINE Packet<double, kSSE2> Min(const Packet<double, kSSE2>& lhs,
+                                           const Packet<double, kSSE2>& rhs) {
+  return Packet<double, kSSE2>(_mm_min_pd(lhs.data_, rhs.data_));
+}
+
+MSHADOW_CINLINE Packet<float, kSSE2> Sqrt(const Packet<float, kSSE2>& src) {
+  return Packet<float, kSSE2>(_mm_sqrt_ps(src.data_));
+}
+
+MSHADOW_CINLINE Packet<double, kSSE2> Sqrt(const Packet<double, kSSE2>& src) {
+  return Packet<double, kSSE2>(_mm_sqrt_pd(src.data_));
+}
+
+// primitives used by the transcendental functions in math-inl.h
+MSHADOW_CINLINE Packet<float, kSSE2> Floor(const Packet<float, kSSE2>& src) {
+  __m128 t = _mm_cvtepi32_ps(_mm_cvttps_epi32(src.data_));
+  // truncation rounds negative values up, step those down by one
+  return Packet<float, kSSE2>(
+      _mm_sub_ps(t, _mm_and_ps(_mm_cmpgt_ps(t, src.data_), _mm_set1_ps(1.0f))));
+}
+
+MSHADOW_CINLINE Packet<float, kSSE2> Exp2i(const Packet<float, kSSE2>& n) {
+  __m128i e = _mm_add_epi32(_mm_cvtps_epi32(n.data_), _mm_set1_epi32(127));
+  return Packet<float, kSSE2>(_mm_castsi128_ps(_mm_slli_epi32(e, 23)));
+}
+
+MSHADOW_CINLINE Packet<float, kSSE2> SplitExp(const Packet<float, kSSE2>& src,
+                                               Packet<float, kSSE2>* exponent) {
+  __m128i i = _mm_sub_epi32(_mm_castps_si128(src.data_), _mm_set1_epi32(0x3f3504f3));
+  exponent->data_ = _mm_cvtepi32_ps(_mm_srai_epi32(i, 23));
+  i = _mm_add_epi32(_mm_and_si128(i, _mm_set1_epi32(0x007fffff)), _mm_set1_epi32(0x3f3504f3));
+  return Packet<float, kSSE2>(_mm_castsi128_ps(i));
+}
+
+MSHADOW_CINLINE Packet<float, kSSE2> SelectLT(const Packet<float, kSSE2>& a,
+                                               const Packet<float, kSSE2>& b,
+                                               const Packet<float, kSSE2>& x,
+                                               const Packet<float, kSSE2>& y) {
+  __m128 mask = _mm_cmplt_ps(a.data_, b.data_);
+  return Packet<float, kSSE2>(_mm_or_ps(_mm_and_ps(mask, x.data_),
+                                        _mm_andnot_ps(mask, y.data_)));
+}
+
+// interleaved complex primitives, see ComplexPacketCheck
+template<>
+struct ComplexPacketCheck<float, kSSE2> {
+  static const bool kPass = true;
+};
+template<>
+struct ComplexPacketCheck<double, kSSE2> {
+  static const bool kPass = true;
+};
+
+MSHADOW_CINLINE Packet<float, kSSE2> SwapPairs(const Packet<float, kSSE2>& src) {
+  return Packet<float, kSSE2>(_mm_shuffle_ps(src.data_, src.data_, _MM_SHUFFLE(2, 3, 0, 1)));
+}
+
+MSHADOW_CINLINE Packet<double, kSSE2> SwapPairs(const Packet<double, kSSE2>& src) {
+  return Packet<double, kSSE2>(_mm_shuffle_pd(src.data_, src.data_, 1));
+}
+
+MSHADOW_CINLINE Packet<float, kSSE2> DupReal(const Packet<float, kSSE2>& src) {
+  return Packet<float, kSSE2>(_mm_shuffle_ps(src.data_, src.data_, _MM_SHUFFLE(2, 2, 0, 0)));
+}
+
+MSHADOW_CINLINE Packet<double, kSSE2> DupReal(const Packet<double, kSSE2>& src) {
+  return Packet<double, kSSE2>(_mm_unpacklo_pd(src.data_, src.data_));
+}
+
+MSHADOW_CINLINE Packet<float, kSSE2> DupImag(const Packet<float, kSSE2>& src) {
+  return Packet<float, kSSE2>(_mm_shuffle_ps(src.data_, src.data_, _MM_SHUFFLE(3, 3, 1, 1)));
+}
+
+MSHADOW_CINLINE Packet<double, kSSE2> DupImag(const Packet<double, kSSE2>& src) {
+  return Packet<double, kSSE2>(_mm_unpackhi_pd(src.data_, src.data_));
+}
+
+MSHADOW_CINLINE Packet<float, kSSE2> Conj(const Packet<float, kSSE2>& src) {
+  return Packet<float, kSSE2>(_mm_xor_ps(src.data_, _mm_set_ps(-0.0f, 0.0f, -0.0f, 0.0f)));
+}
+
+MSHADOW_CINLINE Packet<double, kSSE2> Conj(const Packet<double, kSSE2>& src) {
+  return Packet<double, kSSE2>(_mm_xor_pd(src.data_, _mm_set_pd(-0.0, 0.0)));
+}
+
+// the real and the imaginary parts of the complex numbers of a then b
+MSHADOW_CINLINE void Deinterleave(const Packet<float, kSSE2>& a, const Packet<float, kSSE2>& b,
+                                  Packet<float, kSSE2>* real, Packet<float, kSSE2>* imag) {
+  real->data_ = _mm_shuffle_ps(a.data_, b.data_, _MM_SHUFFLE(2, 0, 2, 0));
+  imag->data_ = _mm_shuffle_ps(a.data_, b.data_, _MM_SHUFFLE(3, 1, 3, 1));
+}
+
+MSHADOW_CINLINE void Deinterleave(const Packet<double, kSSE2>& a,
+                                  const Packet<double, kSSE2>& b,
+                                  Packet<double, kSSE2>* real, Packet<double, kSSE2>* imag) {
+  real->data_ = _mm_unpacklo_pd(a.data_, b.data_);
+  imag->data_ = _mm_unpackhi_pd(a.data_, b.data_);
+}
+
+#ifdef __F16C__
+template<>
+struct PacketConvert<half::half_t, kSSE2> {
+  static const bool kEnabled = true;
+  MSHADOW_CINLINE static Packet<float, kSSE2> Load(const half::half_t *src) {
+    return Packet<float, kSSE2>(
+        _mm_cvtph_ps(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(src))));
+  }
+  // src holds values of half_t, the conversion is exact
+  MSHADOW_CINLINE static void Store(half::half_t *dst, const Packet<float, kSSE2> &src) {
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst),
+                     _mm_cvtps_ph(src.data_, _MM_FROUND_TO_ZERO));
+  }
+  MSHADOW_CINLINE static Packet<float, kSSE2> Round(const Packet<float, kSSE2> &src) {
+    // the conversion saturates, values past the largest half go to inf instead
+    const __m128 sign = _mm_set1_ps(-0.0f);
+    const __m128 big = _mm_cmpgt_ps(_mm_andnot_ps(sign, src.data_), _mm_set1_ps(65504.0f));
+    const __m128 inf = _mm_or_ps(_mm_and_ps(sign, src.data_),
+                                 _mm_castsi128_ps(_mm_set1_epi32(0x7f800000)));
+    const __m128 x = _mm_or_ps(_mm_andnot_ps(big, src.data_), _mm_and_ps(big, inf));
+    return Packet<float, kSSE2>(_mm_cvtph_ps(_mm_cvtps_ph(x, _MM_FROUND_TO_ZERO)));
+  }
+};
+#endif  // __F16C__
+
+template<>
+struct PacketConvert<bfloat::bf16_t, kSSE2> {
+  static const bool kEnabled = true;
+  // a bf16_t is the upper half of a float
+  MSHADOW_CINLINE static Packet<float, kSSE2> Load(const bfloat::bf16_t *src) {
+    return Packet<float, kSSE2>(_mm_castsi128_ps(_mm_unpacklo_epi16(
+        _mm_setzero_si128(), _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src)))));
+  }
+  // src holds values of bf16_t, the upper halves are in the range of int16 after the
+  // arithmetic shift, so the pack does not saturate
+  MSHADOW_CINLINE static void Store(bfloat::bf16_t *dst, const Packet<float, kSSE2> &src) {
+    const __m128i x = _mm_srai_epi32(_mm_castps_si128(src.data_), 16);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dst), _mm_packs_epi32(x, x));
+  }
+  MSHADOW_CINLINE static Packet<float, kSSE2> Round(const Packet<float, kSSE2> &src) {
+    // round to nearest even, nan is made quiet instead so that it stays a nan
+    const __m128i x = _mm_castps_si128(src.data_);
+    const __m128i odd = _mm_and_si128(_mm_srli_epi32(x, 16), _mm_set1_epi32(1));
+    const __m128i rounded = _mm_add_epi32(x, _mm_add_epi32(odd, _mm_set1_epi32(0x7fff)));
+    const __m128i nan = _mm_cmpgt_epi32(_mm_and_si128(x, _mm_set1_epi32(0x7fffffff)),
+                                        _mm_set1_epi32(0x7f800000));
+    const __m128i quiet = _mm_or_si128(x, _mm_set1_epi32(0x00400000));
+    const __m128i r = _mm_or_si128(_mm_andnot_si128(nan, rounded), _mm_and_si128(nan, quiet));
+    return Packet<float, kSSE2>(_mm_castsi128_ps(_mm_slli_epi32(_mm_srli_epi32(r, 16), 16)));
+  }
+};
 }  // namespace packet
 }  // namespace mshadow
 #endif  // MSHADOW_PACKET_SSE_INL_H_
@@ -0,0 +1,188 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file profiler.h
+ * \brief optional instrumentation of the hot paths, enabled by MSHADOW_USE_PROFILER
+ *
+ *  MapExp, MapReduceKeepLowest, MapReduceKeepHighDim, Softmax, the BLAS calls and Copy
+ *  count their calls, elements, bytes and time per kind of op. With MSHADOW_USE_NVTX each
+ *  call is also an NVTX range named by the op, the shape and the expression type, which
+ *  groups the anonymous kernels in the timeline of nsight or nvprof.
+ *
+ *  The counters are dumped at exit to the file named by the environment variable
+ *  MSHADOW_PROFILER_DUMP, or to stderr when it is "stderr" or "1", see profiler::Dump.
+ *  Ops on gpu, and on cpu streams with a worker, run asynchronously, so their time is the
+ *  time spent on the host to launch them, the NVTX ranges give the device time.
+ *
+ *  Bytes are the memory an op at least moves: the destination of a map, the source of a
+ *  reduction, both sides of a softmax or a copy and the three matrices of a BLAS call.
+ *  With the flag off MSHADOW_PROFILE_SCOPE expands to nothing.
+ */
+#ifndef MSHADOW_PROFILER_H_
+#define MSHADOW_PROFILER_H_
+#include "./base.h"
+
+#if MSHADOW_USE_PROFILER
+#if !MSHADOW_IN_CXX11
+#error "MSHADOW_USE_PROFILER requires c++11"
+#endif
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <typeinfo>
+#ifdef __GNUG__
+#include <cxxabi.h>
+#endif
+#if MSHADOW_USE_NVTX
+#include <nvToolsExt.h>
+#endif
+
+namespace mshadow {
+namespace profiler {
+/*! \brief the kinds of ops that are counted */
+enum OpKind {
+  kMapExp = 0,
+  kReduceKeepLowest,
+  kReduceKeepHighDim,
+  kSoftmax,
+  kBLAS,
+  kCopy,
+  kNumOpKind
+};
+/*! \brief name of a kind of op */
+inline const char *OpKindName(int kind) {
+  static const char *names[kNumOpKind] = {
+    "MapExp", "MapReduceKeepLowest", "MapReduceKeepHighDim", "Softmax", "BLAS", "Copy"
+  };
+  return names[kind];
+}
+/*! \brief the counters of a kind of op, updated by all threads */
+struct OpStat {
+  std::atomic<uint64_t> calls, elements, bytes, nanosec;
+  OpStat(void) : calls(0), elements(0), bytes(0), nanosec(0) {}
+};
+/*! \brief the counters of all kinds, dumps them when the program exits if asked to */
+class Registry {
+ public:
+  OpStat stat[kNumOpKind];
+  ~Registry(void) {
+    const char *path = getenv("MSHADOW_PROFILER_DUMP");
+    if (path == NULL || path[0] == '\0') return;
+    if (!strcmp(path, "stderr") || !strcmp(path, "1")) {
+      this->Dump(stderr);
+    } else {
+      FILE *fo = fopen(path, "w");
+      if (fo == NULL) return;
+      this->Dump(fo);
+      fclose(fo);
+    }
+  }
+  inline void Dump(FILE *fo) const {
+    fprintf(fo, "%-22s %10s %14s %14s %12s %10s\n",
+            "op", "calls", "elements", "bytes", "time(ms)", "avg(us)");
+    for (int i = 0; i < kNumOpKind; ++i) {
+      const uint64_t calls = stat[i].calls.load();
+      if (calls == 0) continue;
+      const double ms = stat[i].nanosec.load() * 1e-6;
+      fprintf(fo, "%-22s %10llu %14llu %14llu %12.3f %10.3f\n", OpKindName(i),
+              static_cast<unsigned long long>(calls),  // NOLINT(*)
+              static_cast<unsigned long long>(stat[i].elements.load()),  // NOLINT(*)
+              static_cast<unsigned long long>(stat[i].bytes.load()),  // NOLINT(*)
+              ms, ms * 1e3 / calls);
+    }
+    fflush(fo);
+  }
+  inline void Reset(void) {
+    for (int i = 0; i < kNumOpKind; ++i) {
+      stat[i].calls = 0; stat[i].elements = 0;
+      stat[i].bytes = 0; stat[i].nanosec = 0;
+    }
+  }
+  inline static Registry *Get(void) {
+    static Registry inst;
+    return &inst;
+  }
+};
+/*! \brief the counters of a kind of op */
+inline const OpStat &Stat(OpKind kind) {
+  return Registry::Get()->stat[kind];
+}
+/*! \brief write the counters as a table */
+inline void Dump(FILE *fo) {
+  Registry::Get()->Dump(fo);
+}
+/*! \brief set all counters to zero */
+inline void Reset(void) {
+  Registry::Get()->Reset();
+}
+/*! \brief readable name of a type, computed once per type, long names are cut */
+template<typename T>
+inline const char *TypeName(void) {
+  static const std::string name = [] {
+    std::string ret = typeid(T).name();
+#ifdef __GNUG__
+    int status = 0;
+    char *demangled = abi::__cxa_demangle(ret.c_str(), NULL, NULL, &status);
+    if (status == 0 && demangled != NULL) ret = demangled;
+    free(demangled);
+#endif
+    if (ret.length() > 160) ret = ret.substr(0, 157) + "...";
+    return ret;
+  }();
+  return name.c_str();
+}
+/*!
+ * \brief counts an op from construction to destruction, and is an NVTX range if enabled
+ * \tparam TShape the shape type, whose Size() is the number of elements
+ */
+class Scope {
+ public:
+  template<typename TShape>
+  Scope(OpKind kind, const char *label, const TShape &shape, size_t bytes)
+      : kind_(kind), start_(std::chrono::steady_clock::now()) {
+    OpStat &s = Registry::Get()->stat[kind];
+    s.calls.fetch_add(1, std::memory_order_relaxed);
+    s.elements.fetch_add(shape.Size(), std::memory_order_relaxed);
+    s.bytes.fetch_add(bytes, std::memory_order_relaxed);
+#if MSHADOW_USE_NVTX
+    char msg[256];
+    int len = snprintf(msg, sizeof(msg), "%s (", OpKindName(kind));
+    for (int i = 0; i < TShape::kDimension && len < 64; ++i) {
+      len += snprintf(msg + len, sizeof(msg) - len, i == 0 ? "%lu" : ",%lu",
+                      static_cast<unsigned long>(shape[i]));  // NOLINT(*)
+    }
+    snprintf(msg + len, sizeof(msg) - len, ") %s", label);
+    nvtxRangePushA(msg);
+#endif
+  }
+  ~Scope(void) {
+#if MSHADOW_USE_NVTX
+    nvtxRangePop();
+#endif
+    const uint64_t ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start_).count();
+    Registry::Get()->stat[kind_].nanosec.fetch_add(ns, std::memory_order_relaxed);
+  }
+
+ private:
+  OpKind kind_;
+  std::chrono::steady_clock::time_point start_;
+};
+}  // namespace profiler
+}  // namespace mshadow
+/*!
+ * \brief count the rest of the enclosing block as an op
+ * \param kind profiler::OpKind of the op, without namespace
+ * \param label description of the op, such as profiler::TypeName<E>()
+ * \param shape shape of the op, its Size() is counted as the elements
+ * \param bytes bytes the op moves
+ */
+#define MSHADOW_PROFILE_SCOPE(kind, label, shape, bytes)                \
+  ::mshadow::profiler::Scope mshadow_profile_scope_(                    \
+      ::mshadow::profiler::kind, label, shape, bytes)
+#else
+#define MSHADOW_PROFILE_SCOPE(kind, label, shape, bytes)
+#endif  // MSHADOW_USE_PROFILER
+#endif  // MSHADOW_PROFILER_H_
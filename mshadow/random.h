@@ -21,8 +21,189 @@
 #define rand_r(x) rand()
 #endif
 
-
 namespace mshadow {
+/*!
+ * \brief Philox4x32-10 counter based generator (Salmon et al., Random123).
+ *  Each 128 bit counter is turned into four random words without any state,
+ *  so any part of a stream can be drawn independently, in any order, on any device.
+ */
+struct Philox4x32 {
+  /*!
+   * \brief generate the four words of a counter
+   * \param ctr the counter
+   * \param key0 first word of the key
+   * \param key1 second word of the key
+   * \param out the random words
+   */
+  MSHADOW_XINLINE static void Generate(const uint32_t ctr[4], uint32_t key0, uint32_t key1,
+                                       uint32_t out[4]) {
+    uint32_t c0 = ctr[0], c1 = ctr[1], c2 = ctr[2], c3 = ctr[3];
+    #pragma unroll
+    for (int r = 0; r < 10; ++r) {
+      const uint64_t p0 = static_cast<uint64_t>(0xD2511F53U) * c0;
+      const uint64_t p1 = static_cast<uint64_t>(0xCD9E8D57U) * c2;
+      const uint32_t hi0 = static_cast<uint32_t>(p0 >> 32), lo0 = static_cast<uint32_t>(p0);
+      const uint32_t hi1 = static_cast<uint32_t>(p1 >> 32), lo1 = static_cast<uint32_t>(p1);
+      c0 = hi1 ^ c1 ^ key0; c1 = lo1;
+      c2 = hi0 ^ c3 ^ key1; c3 = lo0;
+      key0 += 0x9E3779B9U; key1 += 0xBB67AE85U;
+    }
+    out[0] = c0; out[1] = c1; out[2] = c2; out[3] = c3;
+  }
+  /*!
+   * \brief words of block blk of stream seq
+   * \param seed the seed, used as key
+   * \param seq index of the stream, each sampling call uses a new one
+   * \param blk index of the block in the stream
+   * \param out the random words
+   */
+  MSHADOW_XINLINE static void Block(unsigned seed, uint64_t seq, uint64_t blk, uint32_t out[4]) {
+    uint32_t ctr[4];
+    ctr[0] = static_cast<uint32_t>(blk); ctr[1] = static_cast<uint32_t>(blk >> 32);
+    ctr[2] = static_cast<uint32_t>(seq); ctr[3] = static_cast<uint32_t>(seq >> 32);
+    Generate(ctr, seed, 0, out);
+  }
+};
+/*!
+ * \brief turns a block of Philox words into numbers of type DType,
+ *  the same code runs on CPU and GPU so both give the same stream
+ */
+template<typename DType>
+struct PhiloxDist;
+template<>
+struct PhiloxDist<float> {
+  /*! \brief numbers made from one block */
+  static const int kPerBlock = 4;
+  /*!
+   * \brief uniform in [a, b) if not gaussian, normal of mean a and deviation b otherwise,
+   *  standard uniforms are bit-identical across devices, other values up to device math
+   */
+  template<bool gaussian>
+  MSHADOW_XINLINE static void Sample(const uint32_t x[4], float a, float b, float out[4]) {
+    const float kScale = 1.0f / 16777216.0f;
+    if (gaussian) {
+      #pragma unroll
+      for (int i = 0; i < 4; i += 2) {
+        // u1 in (0, 1] keeps the log finite
+        const float u1 = ((x[i] >> 8) + 1) * kScale;
+        const float u2 = (x[i + 1] >> 8) * kScale;
+        const float r = sqrtf(-2.0f * logf(u1));
+        const float theta = 6.2831853071795864f * u2;
+        out[i] = a + r * cosf(theta) * b;
+        out[i + 1] = a + r * sinf(theta) * b;
+      }
+    } else {
+      #pragma unroll
+      for (int i = 0; i < 4; ++i) out[i] = (x[i] >> 8) * kScale * (b - a) + a;
+    }
+  }
+  /*! \brief number lane of the block, the same value Sample puts at out[lane] */
+  template<bool gaussian>
+  MSHADOW_XINLINE static float SampleOne(const uint32_t x[4], int lane, float a, float b) {
+    const float kScale = 1.0f / 16777216.0f;
+    if (gaussian) {
+      const int i = lane & ~1;
+      const float u1 = ((x[i] >> 8) + 1) * kScale;
+      const float u2 = (x[i + 1] >> 8) * kScale;
+      const float r = sqrtf(-2.0f * logf(u1));
+      const float theta = 6.2831853071795864f * u2;
+      return (lane & 1) == 0 ? a + r * cosf(theta) * b : a + r * sinf(theta) * b;
+    } else {
+      return (x[lane] >> 8) * kScale * (b - a) + a;
+    }
+  }
+};
+template<>
+struct PhiloxDist<double> {
+  /*! \brief numbers made from one block */
+  static const int kPerBlock = 2;
+  /*! \brief see PhiloxDist<float>::Sample, each number takes 53 bits of two words */
+  template<bool gaussian>
+  MSHADOW_XINLINE static void Sample(const uint32_t x[4], double a, double b, double out[2]) {
+    const double kScale = 1.0 / 9007199254740992.0;
+    const uint64_t w0 = ((static_cast<uint64_t>(x[0]) << 32) | x[1]) >> 11;
+    const uint64_t w1 = ((static_cast<uint64_t>(x[2]) << 32) | x[3]) >> 11;
+    if (gaussian) {
+      const double u1 = (w0 + 1) * kScale;
+      const double u2 = w1 * kScale;
+      const double r = sqrt(-2.0 * log(u1));
+      const double theta = 6.2831853071795864 * u2;
+      out[0] = a + r * cos(theta) * b;
+      out[1] = a + r * sin(theta) * b;
+    } else {
+      out[0] = w0 * kScale * (b - a) + a;
+      out[1] = w1 * kScale * (b - a) + a;
+    }
+  }
+  /*! \brief number lane of the block, the same value Sample puts at out[lane] */
+  template<bool gaussian>
+  MSHADOW_XINLINE static double SampleOne(const uint32_t x[4], int lane, double a, double b) {
+    double out[2];
+    Sample<gaussian>(x, a, b, out);
+    return out[lane];
+  }
+};
+namespace expr {
+/*!
+ * \brief random numbers generated inside the expression, element (i, j) of the flattened 2D
+ *  view takes number i * ncol + j of a Philox stream, the same as Random::SampleUniform or
+ *  Random::SampleGaussian give with MSHADOW_RANDOM_PHILOX. Nothing is stored, so any number of
+ *  random terms can appear in one expression and the whole expression runs in one pass.
+ * \tparam DType the type of elements
+ * \tparam dim dimension of the expression
+ * \tparam gaussian normal of mean a and deviation b if true, uniform in [a, b) otherwise
+ */
+template<typename DType, int dim, bool gaussian>
+struct RandomExp: public Exp<RandomExp<DType, dim, gaussian>, DType, type::kMapper> {
+  /*! \brief shape of the expression */
+  Shape<dim> shape_;
+  /*! \brief key of the stream */
+  unsigned seed_;
+  /*! \brief index of the stream */
+  uint64_t seq_;
+  /*! \brief parameters of the distribution */
+  DType a_, b_;
+  /*! \brief constructor */
+  RandomExp(Shape<dim> shape, unsigned seed, uint64_t seq, DType a, DType b)
+      : shape_(shape), seed_(seed), seq_(seq), a_(a), b_(b) {}
+};
+template<typename DType, int dim, bool gaussian>
+struct Plan<RandomExp<DType, dim, gaussian>, DType> {
+ public:
+  explicit Plan(const RandomExp<DType, dim, gaussian> &e)
+      : ncol_(e.shape_[dim - 1]), seed_(e.seed_), seq_(e.seq_), a_(e.a_), b_(e.b_) {}
+  MSHADOW_XINLINE DType Eval(index_t y, index_t x) const {
+    const int kPerBlock = PhiloxDist<DType>::kPerBlock;
+    const uint64_t e = static_cast<uint64_t>(y) * ncol_ + x;
+    uint32_t w[4];
+    Philox4x32::Block(seed_, seq_, e / kPerBlock, w);
+    return PhiloxDist<DType>::template SampleOne<gaussian>(w, static_cast<int>(e % kPerBlock),
+                                                          a_, b_);
+  }
+
+ private:
+  const index_t ncol_;
+  const unsigned seed_;
+  const uint64_t seq_;
+  const DType a_, b_;
+};
+template<typename DType, int dim, bool gaussian>
+inline Plan<RandomExp<DType, dim, gaussian>, DType>
+MakePlan(const RandomExp<DType, dim, gaussian> &exp) {
+  return Plan<RandomExp<DType, dim, gaussian>, DType>(exp);
+}
+template<int dim, typename DType, bool gaussian>
+struct ShapeCheck<dim, RandomExp<DType, dim, gaussian> > {
+  inline static Shape<dim> Check(const RandomExp<DType, dim, gaussian> &t) {
+    return t.shape_;
+  }
+};
+template<typename DType, int dim, bool gaussian>
+struct ExpInfo<RandomExp<DType, dim, gaussian> > {
+  static const int kDim = dim;
+  static const int kDevMask = 0xffff;
+};
+}  // namespace expr
 /*!
  * \brief random number generator
  * \tparam Device the device of random number generator
@@ -54,6 +235,7 @@ class Random<cpu, DType> {
     rnd_engine_.seed(seed);
 #endif
     this->rseed_ = static_cast<unsigned>(seed);
+    this->sequence_ = 0;
   }
   /*!
    * \brief get random seed used in random generator
@@ -78,6 +260,9 @@ class Random<cpu, DType> {
   template<int dim>
   inline void SampleUniform(Tensor<cpu, dim, DType> *dst,
                             DType a = 0.0f, DType b = 1.0f) {
+#if MSHADOW_RANDOM_PHILOX
+    this->PhiloxFill<false>(dst->FlatTo2D(), a, b);
+#else
     if (dst->CheckContiguous()) {
       this->GenUniform(dst->dptr_, dst->shape_.Size(), a, b);
     } else {
@@ -86,6 +271,7 @@ class Random<cpu, DType> {
         this->GenUniform(mat[i].dptr_, mat.size(1), a, b);
       }
     }
+#endif  // MSHADOW_RANDOM_PHILOX
   }
   /*!
    * \brief generate data from standard gaussian
@@ -97,6 +283,13 @@ class Random<cpu, DType> {
   template<int dim>
   inline void SampleGaussian(Tensor<cpu, dim, DType> *dst,
                              DType mu = 0.0f, DType sigma = 1.0f) {
+#if MSHADOW_RANDOM_PHILOX
+    // the stream is used even if not needed, to stay in step with Random<gpu>
+    if (sigma <= 0.0f) {
+      ++sequence_; *dst = mu; return;
+    }
+    this->PhiloxFill<true>(dst->FlatTo2D(), mu, sigma);
+#else
     if (sigma <= 0.0f) {
       *dst = mu; return;
     }
@@ -108,6 +301,7 @@ class Random<cpu, DType> {
         this->GenGaussian(mat[i].dptr_, mat.size(1), mu, sigma);
       }
     }
+#endif  // MSHADOW_RANDOM_PHILOX
   }
   /*!
    * \brief return a temporal expression storing standard gaussian random variables
@@ -133,7 +327,8 @@ class Random<cpu, DType> {
    *        can be used as part of expression
    *  Caution: this means expression such as A = uniform(s1) * uniform(s2) will give invalid result,
    *           since second call of gaussian(s2) makes gaussian(s1) invalid
-   *           A = gaussian(s1)*B+C; is correct; use one gaussian/uniform in each expression
+   *           A = gaussian(s1)*B+C; is correct; use one gaussian/uniform in each expression,
+   *           or fused_uniform that has no such restriction
    * \param shape shape of the tensor
    * \return a temporal expression storing standard uniform [0,1)
    * \tparam dim dimension of tensor
@@ -145,8 +340,69 @@ class Random<cpu, DType> {
     this->SampleUniform(&buffer_, 0.0f, 1.0f);
     return expr::reshape(buffer_, shape);
   }
+  /*!
+   * \brief return an expression generating uniform [a, b) numbers as it is evaluated,
+   *        no buffer is used, so several of them can appear in one expression
+   * \code
+   *  // dropout in one pass, threshold(a, b) is a user op returning a < b
+   *  out = F<threshold>(rnd.fused_uniform(x.shape_), pkeep) * x * (1.0f / pkeep);
+   * \endcode
+   * \param shape shape of the expression
+   * \param a lower bound of uniform
+   * \param b upper bound of uniform
+   * \tparam dim dimension of expression
+   */
+  template<int dim>
+  inline expr::RandomExp<DType, dim, false>
+  fused_uniform(Shape<dim> shape, DType a = 0.0f, DType b = 1.0f) {
+    return expr::RandomExp<DType, dim, false>(shape, rseed_, sequence_++, a, b);
+  }
+  /*!
+   * \brief return an expression generating gaussian numbers as it is evaluated,
+   *        no buffer is used, so several of them can appear in one expression
+   * \param shape shape of the expression
+   * \param mu mean
+   * \param sigma standard deviation
+   * \tparam dim dimension of expression
+   */
+  template<int dim>
+  inline expr::RandomExp<DType, dim, true>
+  fused_gaussian(Shape<dim> shape, DType mu = 0.0f, DType sigma = 1.0f) {
+    return expr::RandomExp<DType, dim, true>(shape, rseed_, sequence_++, mu, sigma);
+  }
 
  private:
+  /*! \brief index of the next Philox stream */
+  uint64_t sequence_;
+  /*!
+   * \brief fill mat from a new Philox stream, element (i, j) takes number i * ncol + j,
+   *  blocks of the stream are split over OpenMP threads
+   */
+  template<bool gaussian>
+  inline void PhiloxFill(Tensor<cpu, 2, DType> mat, DType a, DType b) {
+    const int kPerBlock = PhiloxDist<DType>::kPerBlock;
+    const index_t ncol = mat.size(1);
+    const size_t total = static_cast<size_t>(mat.size(0)) * ncol;
+    const size_t nblock = (total + kPerBlock - 1) / kPerBlock;
+    const uint64_t seq = sequence_++;
+    const unsigned seed = rseed_;
+    const openmp_index_t nthread = GetNumParallelThread(NULL, total);
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t tid = 0; tid < nthread; ++tid) {
+      const size_t bbegin = nblock * tid / nthread, bend = nblock * (tid + 1) / nthread;
+      for (size_t blk = bbegin; blk < bend; ++blk) {
+        uint32_t x[4];
+        DType v[kPerBlock];
+        Philox4x32::Block(seed, seq, blk, x);
+        PhiloxDist<DType>::template Sample<gaussian>(x, a, b, v);
+        for (int l = 0; l < kPerBlock; ++l) {
+          const size_t e = blk * kPerBlock + l;
+          if (e >= total) break;
+          mat.dptr_[(e / ncol) * mat.stride_ + e % ncol] = v[l];
+        }
+      }
+    }
+  }
 #if MSHADOW_IN_CXX11
   /*! \brief use c++11 random engine. */
   std::mt19937 rnd_engine_;
@@ -268,6 +524,8 @@ class Random<gpu, DType> {
     curandStatus_t status;
     status = curandSetPseudoRandomGeneratorSeed(gen_, seed);
     CHECK_EQ(status, CURAND_STATUS_SUCCESS) << "Set CURAND seed failed.";
+    this->rseed_ = static_cast<unsigned>(seed);
+    this->sequence_ = 0;
   }
   /*!
    * \brief generate data from uniform [a,b)
@@ -312,7 +570,8 @@ class Random<gpu, DType> {
    *        can be used as part of expression
    *  Caution: this means expression such as A = gaussian(s1) * gaussian(s2) will give invalid result,
    *           since second call of gaussian(s2) makes gaussian(s1) invalid
-   *           A = gaussian(s1)*B+C; is correct; use one gaussian/uniform in each expression
+   *           A = gaussian(s1)*B+C; is correct; use one gaussian/uniform in each expression,
+   *           or fused_uniform that has no such restriction
    * \param shape shape of the tensor
    * \return a temporal expression storing standard uniform [0,1)
    * \tparam dim dimension of tensor
@@ -320,6 +579,36 @@ class Random<gpu, DType> {
   template<int dim>
   inline expr::ReshapeExp<Tensor<gpu, 1, DType>, DType, dim, 1>
   uniform(Shape<dim> shape);
+  /*!
+   * \brief return an expression generating uniform [a, b) numbers as it is evaluated,
+   *        no buffer is used, so several of them can appear in one expression
+   * \code
+   *  // dropout in one pass, threshold(a, b) is a user op returning a < b
+   *  out = F<threshold>(rnd.fused_uniform(x.shape_), pkeep) * x * (1.0f / pkeep);
+   * \endcode
+   * \param shape shape of the expression
+   * \param a lower bound of uniform
+   * \param b upper bound of uniform
+   * \tparam dim dimension of expression
+   */
+  template<int dim>
+  inline expr::RandomExp<DType, dim, false>
+  fused_uniform(Shape<dim> shape, DType a = 0.0f, DType b = 1.0f) {
+    return expr::RandomExp<DType, dim, false>(shape, rseed_, sequence_++, a, b);
+  }
+  /*!
+   * \brief return an expression generating gaussian numbers as it is evaluated,
+   *        no buffer is used, so several of them can appear in one expression
+   * \param shape shape of the expression
+   * \param mu mean
+   * \param sigma standard deviation
+   * \tparam dim dimension of expression
+   */
+  template<int dim>
+  inline expr::RandomExp<DType, dim, true>
+  fused_gaussian(Shape<dim> shape, DType mu = 0.0f, DType sigma = 1.0f) {
+    return expr::RandomExp<DType, dim, true>(shape, rseed_, sequence_++, mu, sigma);
+  }
 
  private:
   inline void GenGaussian(float *dptr, size_t size, float mu, float sigma) {
@@ -350,8 +639,15 @@ class Random<gpu, DType> {
     CHECK_EQ(status, CURAND_STATUS_SUCCESS) << "CURAND Gen Uniform double failed."
                                             << " size = " << size;
   }
+  /*! \brief fill mat from a new Philox stream, same numbers as Random<cpu> */
+  template<bool gaussian>
+  inline void PhiloxFill(Tensor<gpu, 2, DType> mat, DType a, DType b);
   /*! \brief random numbeer generator */
   curandGenerator_t gen_;
+  /*! \brief seed, the key of the Philox streams */
+  unsigned rseed_;
+  /*! \brief index of the next Philox stream */
+  uint64_t sequence_;
   /*! \brief templ buffer */
   TensorContainer<gpu, 1, DType> buffer_;
 };  // class Random<gpu, DType>
@@ -359,10 +655,49 @@ class Random<gpu, DType> {
 
 #ifdef __CUDACC__
 // implementations that depends on cuda kernels
+namespace cuda {
+template<bool gaussian, typename DType>
+__global__ void PhiloxFillKernel(DType *dptr, index_t stride, index_t ncol,
+                                 uint64_t total, uint64_t nblock,
+                                 unsigned seed, uint64_t seq, DType a, DType b) {
+  const int kPerBlock = PhiloxDist<DType>::kPerBlock;
+  for (uint64_t blk = blockIdx.x * blockDim.x + threadIdx.x; blk < nblock;
+       blk += blockDim.x * gridDim.x) {
+    uint32_t x[4];
+    DType v[kPerBlock];
+    Philox4x32::Block(seed, seq, blk, x);
+    PhiloxDist<DType>::template Sample<gaussian>(x, a, b, v);
+    #pragma unroll
+    for (int l = 0; l < kPerBlock; ++l) {
+      const uint64_t e = blk * kPerBlock + l;
+      if (e < total) dptr[(e / ncol) * stride + e % ncol] = v[l];
+    }
+  }
+}
+}  // namespace cuda
+template<typename DType>
+template<bool gaussian>
+inline void Random<gpu, DType>::PhiloxFill(Tensor<gpu, 2, DType> mat, DType a, DType b) {
+  const int kPerBlock = PhiloxDist<DType>::kPerBlock;
+  const uint64_t total = static_cast<uint64_t>(mat.size(0)) * mat.size(1);
+  const uint64_t nblock = (total + kPerBlock - 1) / kPerBlock;
+  const uint64_t seq = sequence_++;
+  if (nblock == 0) return;
+  dim3 dimBlock(cuda::kBaseThreadNum);
+  dim3 dimGrid(std::min((nblock + cuda::kBaseThreadNum - 1) / cuda::kBaseThreadNum,
+                        static_cast<uint64_t>(cuda::kMaxGridNum)));
+  cuda::CheckLaunchParam(dimGrid, dimBlock, "PhiloxFill");
+  cuda::PhiloxFillKernel<gaussian, DType>
+      <<<dimGrid, dimBlock, 0, Stream<gpu>::GetStream(mat.stream_)>>>
+      (mat.dptr_, mat.stride_, mat.size(1), total, nblock, rseed_, seq, a, b);
+}
 template<typename DType>
 template<int dim>
 inline void Random<gpu, DType>::SampleUniform(
     Tensor<gpu, dim, DType> *dst, DType a, DType b) {
+#if MSHADOW_RANDOM_PHILOX
+  this->PhiloxFill<false>(dst->FlatTo2D(), a, b);
+#else
   if (a == 0.0f && b == 1.0f) {
     if (dst->CheckContiguous()) {
       this->GenUniform(dst->dptr_, dst->shape_.Size());
@@ -372,11 +707,18 @@ inline void Random<gpu, DType>::SampleUniform(
   } else {
     *dst = this->uniform(dst->shape_) * (b - a) + a;
   }
+#endif  // MSHADOW_RANDOM_PHILOX
 }
 template<typename DType>
 template<int dim>
 inline void Random<gpu, DType>::SampleGaussian(
     Tensor<gpu, dim, DType> *dst, DType mu, DType sigma) {
+#if MSHADOW_RANDOM_PHILOX
+  if (sigma <= 0.0f) {
+    ++sequence_; *dst = mu; return;
+  }
+  this->PhiloxFill<true>(dst->FlatTo2D(), mu, sigma);
+#else
   // We need to check whether the shape size is even since CuRand supports only normal distribution
   // generation of even number of elements.
   if (dst->CheckContiguous() && (dst->shape_.Size() % 2 == 0)) {
@@ -384,17 +726,23 @@ inline void Random<gpu, DType>::SampleGaussian(
   } else {
     *dst = this->gaussian(dst->shape_, mu, sigma);
   }
+#endif  // MSHADOW_RANDOM_PHILOX
 }
 
 template<typename DType>
 template<int dim>
 inline expr::ReshapeExp<Tensor<gpu, 1, DType>, DType, dim, 1>
 Random<gpu, DType>::gaussian(Shape<dim> shape, DType mu, DType sigma) {
+#if MSHADOW_RANDOM_PHILOX
+  buffer_.Resize(Shape1(shape.Size()));
+  this->SampleGaussian(&buffer_, mu, sigma);
+#else
   size_t aligned_sz = ((shape.Size() + 1UL) >> 1) << 1;
   // allocate alligned size
   buffer_.Resize(Shape1(aligned_sz));
   buffer_.Resize(Shape1(shape.Size()));
   this->GenGaussian(buffer_.dptr_, aligned_sz, mu, sigma);
+#endif  // MSHADOW_RANDOM_PHILOX
   return expr::reshape(buffer_, shape);
 }
 
@@ -403,7 +751,11 @@ template<int dim>
 inline expr::ReshapeExp<Tensor<gpu, 1, DType>, DType, dim, 1>
 Random<gpu, DType>::uniform(Shape<dim> shape) {
   buffer_.Resize(Shape1(shape.Size()));
+#if MSHADOW_RANDOM_PHILOX
+  this->SampleUniform(&buffer_, 0.0f, 1.0f);
+#else
   this->GenUniform(buffer_.dptr_, buffer_.size(0));
+#endif
   return expr::reshape(buffer_, shape);
 }
 #endif  // __CUDACC__
@@ -9,9 +9,75 @@
 #include "./base.h"
 #include "./tensor.h"
 #include "./logging.h"
+#if MSHADOW_USE_CUDA == 1 && MSHADOW_IN_CXX11
+#include <mutex>
+#include <vector>
+#endif
 
 namespace mshadow {
 #if MSHADOW_USE_CUDA == 1
+/*! \brief event of the GPU, created with NewEvent<gpu> */
+template<>
+struct Event<gpu> {
+  /*! \brief cudaEvent, recorded without timing */
+  cudaEvent_t event_;
+  /*!
+   * \brief mark the work issued to stream so far
+   * \param stream the stream, NULL is the default stream
+   */
+  inline void Record(Stream<gpu> *stream);
+  /*! \brief block the host until the recorded work completed */
+  inline void Wait(void) {
+    MSHADOW_CUDA_CALL(cudaEventSynchronize(event_));
+  }
+  /*!
+   * \brief query whether the recorded work completed
+   * \return true if it completed, or nothing was recorded
+   */
+  inline bool CheckDone(void) {
+    cudaError_t err = cudaEventQuery(event_);
+    if (err == cudaSuccess) return true;
+    if (err == cudaErrorNotReady) return false;
+    LOG(FATAL) << cudaGetErrorString(err);
+    return false;
+  }
+};
+#if CUDA_VERSION >= 10010
+/*!
+ * \brief the work recorded from a Stream<gpu> between BeginCapture and EndCapture,
+ *  replayed with a single graph launch. The replay reads and writes the same memory
+ *  as the recorded sequence, with the scalars it was recorded with.
+ */
+class StreamGraph {
+ public:
+  /*! \brief instantiate a captured graph, takes the ownership of graph */
+  explicit StreamGraph(cudaGraph_t graph) : graph_(graph) {
+#if CUDA_VERSION >= 12000
+    MSHADOW_CUDA_CALL(cudaGraphInstantiate(&exec_, graph_, 0));
+#else
+    MSHADOW_CUDA_CALL(cudaGraphInstantiate(&exec_, graph_, NULL, NULL, 0));
+#endif
+  }
+  ~StreamGraph(void) {
+    cudaGraphExecDestroy(exec_);
+    cudaGraphDestroy(graph_);
+  }
+  /*!
+   * \brief replay the recorded work
+   * \param stream the stream to run on, it does not need to be the one that was captured
+   */
+  inline void Launch(Stream<gpu> *stream);
+
+ private:
+  /*! \brief the recorded graph */
+  cudaGraph_t graph_;
+  /*! \brief executable instance of the graph */
+  cudaGraphExec_t exec_;
+  // not copyable, the graph is owned
+  StreamGraph(const StreamGraph &other);
+  StreamGraph &operator=(const StreamGraph &other);
+};
+#endif  // CUDA_VERSION >= 10010
 // Stream alocation
 // actual implementation of GPU stream in CUDA
 template<>
@@ -33,10 +99,13 @@ struct Stream<gpu> {
   HandleState blas_handle_ownership_;
   /*! \brief cudnn handle ownership */
   HandleState dnn_handle_ownership_;
+  /*! \brief precision the gemm on this stream accumulate in */
+  GemmCompute gemm_compute_;
 
   Stream(void) : stream_(0),
                  blas_handle_ownership_(NoHandle),
-                 dnn_handle_ownership_(NoHandle) {}
+                 dnn_handle_ownership_(NoHandle),
+                 gemm_compute_(kGemmComputeDefault) {}
   /*!
    * \brief wait for all the computation associated
    *  with this stream to complete
@@ -55,6 +124,14 @@ struct Stream<gpu> {
     LOG(FATAL) << cudaGetErrorString(err);
     return false;
   }
+  /*!
+   * \brief make the work issued to this stream afterwards wait for the work recorded
+   *  in event, the host is not blocked
+   * \param event the event
+   */
+  inline void WaitEvent(Event<gpu> *event) {
+    MSHADOW_CUDA_CALL(cudaStreamWaitEvent(stream_, event->event_, 0));
+  }
   /*!
    * \brief returns actual cudaStream_t given an input GPU stream pointer
    * \param stream pointer to GPU stream
@@ -82,6 +159,41 @@ struct Stream<gpu> {
       return stream->blas_handle_;
     }
   }
+  /*!
+   * \brief set the precision the gemm on this stream accumulate in
+   * \param compute the precision
+   */
+  inline void SetGemmCompute(GemmCompute compute) {
+    gemm_compute_ = compute;
+  }
+  /*!
+   * \brief return the precision the gemm on a stream accumulate in
+   * \param stream pointer to GPU stream, the default stream uses kGemmComputeDefault
+   */
+  inline static GemmCompute GetGemmCompute(Stream<gpu> *stream) {
+    return stream == NULL ? kGemmComputeDefault : stream->gemm_compute_;
+  }
+#if CUDA_VERSION >= 10010
+  /*!
+   * \brief start recording the work issued to this stream instead of running it,
+   *  including the cuBLAS and cuDNN calls through the handles of the stream.
+   *  Memory must not be allocated while recording, run the sequence once before capturing
+   *  it so the tensors, the memory pool and the cuBLAS workspace are set up.
+   */
+  inline void BeginCapture(void) {
+    CHECK(stream_ != 0) << "the default stream can not be captured";
+    if (blas_handle_ownership_ == OwnHandle) {
+      cublasStatus_t err = cublasSetStream(blas_handle_, stream_);
+      CHECK_EQ(err, CUBLAS_STATUS_SUCCESS) << "cublasSetStream failed";
+    }
+    MSHADOW_CUDA_CALL(cudaStreamBeginCapture(stream_, cudaStreamCaptureModeThreadLocal));
+  }
+  /*!
+   * \brief stop recording started by BeginCapture
+   * \return the recorded work, to be replayed with StreamGraph::Launch and deleted by the caller
+   */
+  inline StreamGraph *EndCapture(void);
+#endif  // CUDA_VERSION >= 10010
   /*! \brief Destory cublas handle if own it */
   inline void DestoryBlasHandle() {
     if (blas_handle_ownership_ == OwnHandle) {
@@ -129,6 +241,16 @@ struct Stream<gpu> {
 #endif
   }
 };
+#if CUDA_VERSION >= 10010
+inline StreamGraph *Stream<gpu>::EndCapture(void) {
+  cudaGraph_t graph;
+  MSHADOW_CUDA_CALL(cudaStreamEndCapture(stream_, &graph));
+  return new StreamGraph(graph);
+}
+inline void StreamGraph::Launch(Stream<gpu> *stream) {
+  MSHADOW_CUDA_CALL(cudaGraphLaunch(exec_, Stream<gpu>::GetStream(stream)));
+}
+#endif  // CUDA_VERSION >= 10010
 template<>
 inline Stream<gpu> *NewStream<gpu>(bool create_blas_handle,
                                    bool create_dnn_handle) {
@@ -149,6 +271,96 @@ inline void DeleteStream<gpu>(Stream<gpu> *stream) {
   stream->DestroyDnnHandle();
   delete stream;
 }
+inline void Event<gpu>::Record(Stream<gpu> *stream) {
+  MSHADOW_CUDA_CALL(cudaEventRecord(event_, Stream<gpu>::GetStream(stream)));
+}
+template<>
+inline Event<gpu> *NewEvent<gpu>(void) {
+  Event<gpu> *ev = new Event<gpu>();
+  MSHADOW_CUDA_CALL(cudaEventCreateWithFlags(&ev->event_, cudaEventDisableTiming));
+  return ev;
+}
+template<>
+inline void DeleteEvent<gpu>(Event<gpu> *event) {
+  MSHADOW_CUDA_CALL(cudaEventDestroy(event->event_));
+  delete event;
+}
+#if MSHADOW_IN_CXX11
+/*!
+ * \brief reusable streams of one GPU device, created once with their cublas handle.
+ *  A released stream may still be running, the work of the next owner is ordered
+ *  after it on the same stream.
+ */
+class StreamPool {
+ public:
+  /*!
+   * \brief get the pool of a device, pools live until the program exits
+   * \param dev_id the device id
+   */
+  inline static StreamPool *Get(int dev_id) {
+    static std::mutex mutex;
+    // never deleted: the streams may only be destroyed while the CUDA runtime is loaded
+    static std::vector<StreamPool*> pools;
+    std::lock_guard<std::mutex> lock(mutex);
+    if (pools.size() == 0) {
+      int count = 0;
+      MSHADOW_CUDA_CALL(cudaGetDeviceCount(&count));
+      pools.resize(count, NULL);
+    }
+    CHECK(dev_id >= 0 && dev_id < static_cast<int>(pools.size()))
+        << "StreamPool: invalid device " << dev_id;
+    if (pools[dev_id] == NULL) pools[dev_id] = new StreamPool(dev_id);
+    return pools[dev_id];
+  }
+  /*! \brief get the pool of the current device */
+  inline static StreamPool *Get(void) {
+    int dev_id;
+    MSHADOW_CUDA_CALL(cudaGetDevice(&dev_id));
+    return Get(dev_id);
+  }
+  /*!
+   * \brief take a stream of the device, with a cublas handle
+   * \param create_dnn_handle whether the stream needs a cudnn handle
+   * \return the stream, to be given back with Release instead of DeleteStream
+   */
+  inline Stream<gpu> *Acquire(bool create_dnn_handle = false) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t i = free_.size(); i != 0; --i) {
+      Stream<gpu> *s = free_[i - 1];
+      if (!create_dnn_handle || s->dnn_handle_ownership_ == Stream<gpu>::OwnHandle) {
+        free_[i - 1] = free_.back();
+        free_.pop_back();
+        return s;
+      }
+    }
+    int prev;
+    MSHADOW_CUDA_CALL(cudaGetDevice(&prev));
+    if (prev != dev_id_) MSHADOW_CUDA_CALL(cudaSetDevice(dev_id_));
+    Stream<gpu> *s = NewStream<gpu>(true, create_dnn_handle);
+    if (prev != dev_id_) MSHADOW_CUDA_CALL(cudaSetDevice(prev));
+    return s;
+  }
+  /*!
+   * \brief give a stream back to the pool, pending work on it is not waited for
+   * \param stream a stream returned by Acquire of this pool
+   */
+  inline void Release(Stream<gpu> *stream) {
+    // the precision is a setting of the owner
+    stream->SetGemmCompute(kGemmComputeDefault);
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(stream);
+  }
+
+ private:
+  explicit StreamPool(int dev_id) : dev_id_(dev_id) {}
+  /*! \brief device of the pool */
+  int dev_id_;
+  /*! \brief protects free_ */
+  std::mutex mutex_;
+  /*! \brief streams that are not handed out */
+  std::vector<Stream<gpu>*> free_;
+};
+#endif  // MSHADOW_IN_CXX11
 #endif
 }  // namespace mshadow
 #endif  // MSHADOW_STREAM_GPU_INL_H_
@@ -15,6 +15,7 @@
 #include <iostream>
 #include "./base.h"
 #include "./expression.h"
+#include "./cpu_worker-inl.h"
 
 namespace mshadow {
 /*! \brief device name CPU */
@@ -319,27 +320,175 @@ inline Shape<5> ConvertLayout(const Shape<5>& src, int src_layout, int dst_layou
   return dst2;
 }
 
+/*!
+ * \brief precision the products of a gemm are accumulated in, independent of the storage type.
+ *  Set on a GPU stream with Stream<gpu>::SetGemmCompute, dot and BatchGEMM on the stream use it
+ */
+enum GemmCompute {
+  /*! \brief fp32 for half_t unless MSHADOW_USE_PASCAL is set, the storage type otherwise */
+  kGemmComputeDefault = 0,
+  /*! \brief accumulate in the storage type */
+  kGemmComputeStorage = 1,
+  /*! \brief accumulate in fp32, 16 bit inputs may run on tensor cores */
+  kGemmComputeFloat32 = 2
+};
+template<typename Device>
+struct Stream;
+/*!
+ * \brief marks the work issued to a stream up to the point it was recorded,
+ *  other streams can wait for that work without blocking the host
+ */
+template<typename Device>
+struct Event {
+  // the CPU implementation, a stream without a worker has done its work when the call
+  // returns; for GPU it is specialized in stream_gpu-inl.h
+#if MSHADOW_IN_CXX11
+  /*! \brief the worker of the recorded stream, NULL if it had none */
+  CPUWorker *worker_;
+  /*! \brief sequence number of the last task recorded */
+  uint64_t seq_;
+  Event(void) : worker_(NULL), seq_(0) {}
+#endif
+  /*!
+   * \brief mark the work issued to stream so far
+   * \param stream the stream, it must outlive the waits on the event
+   */
+  inline void Record(Stream<Device> *stream) {
+#if MSHADOW_IN_CXX11
+    worker_ = stream != NULL ? stream->worker_ : NULL;
+    seq_ = worker_ != NULL ? worker_->NumPushed() : 0;
+#endif
+  }
+  /*! \brief block the host until the recorded work completed */
+  inline void Wait(void) {
+#if MSHADOW_IN_CXX11
+    if (worker_ != NULL) worker_->WaitFor(seq_);
+#endif
+  }
+  /*!
+   * \brief query whether the recorded work completed
+   * \return true if it completed, or nothing was recorded
+   */
+  inline bool CheckDone(void) {
+#if MSHADOW_IN_CXX11
+    if (worker_ != NULL) return worker_->CheckDone(seq_);
+#endif
+    return true;
+  }
+};
 /*!
  * \brief computaion stream structure, used for asynchronize computation
  */
 template<typename Device>
 struct Stream {
-  // this is only a dummy implementation for CPU
-  // for GPU, the actual implementation will be specialized in tensor_gpu-inl.h
+  // the CPU implementation, for GPU it is specialized in stream_gpu-inl.h.
+  // Kernels called with a CPU stream run on the calling thread; after StartWorker
+  // the tasks given to Push run in order on a thread of the stream, so that
+  // work on several streams can overlap. A kernel called with a stream that has a
+  // worker first waits for the pushed tasks, see WaitPushedTasks, so the work
+  // issued to the stream keeps its order.
+  /*!
+   * \brief number of threads used by parallel CPU kernels on this stream,
+   *  0 means use the OpenMP default
+   */
+  int nthread_;
+  /*!
+   * \brief kernels with fewer elements than this run serially on the calling thread
+   */
+  size_t parallel_threshold_;
+#if MSHADOW_IN_CXX11
+  /*! \brief the thread running the pushed tasks, NULL if they run synchronously */
+  CPUWorker *worker_;
+  /*! \brief constructor */
+  Stream(void)
+      : nthread_(0), parallel_threshold_(MSHADOW_CPU_PARALLEL_THRESHOLD), worker_(NULL) {}
+  /*! \brief waits for the pushed tasks and stops the worker */
+  ~Stream(void) {
+    delete worker_;
+  }
+  /*!
+   * \brief let the tasks pushed from now on run asynchronously on a thread
+   *  owned by the stream
+   */
+  inline void StartWorker(void) {
+    if (worker_ == NULL) worker_ = new CPUWorker();
+  }
+  /*!
+   * \brief issue a task to the stream, it runs after the tasks pushed before it.
+   *  Without a worker the task runs before Push returns.
+   * \param task the task, the kernels it calls should use this stream or none, since
+   *  waiting on this stream from one of its own tasks never returns
+   */
+  inline void Push(std::function<void()> task) {
+    if (worker_ != NULL) {
+      worker_->Push(std::move(task));
+    } else {
+      task();
+    }
+  }
+#else
+  /*! \brief constructor */
+  Stream(void)
+      : nthread_(0), parallel_threshold_(MSHADOW_CPU_PARALLEL_THRESHOLD) {}
+#endif
+  /*!
+   * \brief set number of threads used by parallel CPU kernels
+   * \param nthread number of threads, 0 means use the OpenMP default,
+   *   1 means always run serially
+   */
+  inline void SetNumThread(int nthread) {
+    nthread_ = nthread;
+  }
+  /*!
+   * \brief set the size below which CPU kernels stay serial
+   * \param threshold number of elements
+   */
+  inline void SetParallelThreshold(size_t threshold) {
+    parallel_threshold_ = threshold;
+  }
   /*!
    * \brief wait for all the computation associated
-   *  with this stream to complete
+   *  with this stream to complete, rethrows an exception of a pushed task
    */
-  inline void Wait(void) {}
+  inline void Wait(void) {
+#if MSHADOW_IN_CXX11
+    if (worker_ != NULL) worker_->Wait();
+#endif
+  }
   /*!
    * \brief query whether the the stream is idle
    * \return true if the stream is idle and all the job have been completed
    */
   inline bool CheckIdle(void) {
+#if MSHADOW_IN_CXX11
+    if (worker_ != NULL) return worker_->CheckDone(worker_->NumPushed());
+#endif
     return true;
   }
+  /*!
+   * \brief make the work issued to this stream afterwards wait for the work recorded
+   *  in event, the host is not blocked unless this stream has no worker
+   * \param event the event
+   */
+  inline void WaitEvent(Event<Device> *event) {
+#if MSHADOW_IN_CXX11
+    CPUWorker *other = event->worker_;
+    if (other == NULL || other == worker_) return;
+    if (worker_ != NULL) {
+      const uint64_t seq = event->seq_;
+      worker_->Push([other, seq] { other->WaitFor(seq); });
+    } else {
+      event->Wait();
+    }
+#endif
+  }
   /*! \brief create a blas handle */
   inline void CreateBlasHandle() {}
+
+ private:
+  // not copyable, the worker is owned
+  Stream(const Stream &other);
+  Stream &operator=(const Stream &other);
 };
 /*!
  * \brief Tensor RValue, this is the super type of all kinds of possible tensors
@@ -621,6 +770,19 @@ inline Stream<Device> *NewStream() {
  */
 template<typename Device>
 inline void DeleteStream(Stream<Device> *stream);
+/*!
+ * \brief create a new event
+ * \return a pointer to the created event
+ * \tparam Device the device type
+ */
+template<typename Device>
+inline Event<Device> *NewEvent(void);
+/*!
+ * \brief delete an event
+ * \param event the event to be deleted
+ */
+template<typename Device>
+inline void DeleteEvent(Event<Device> *event);
 /*!
  * \brief CPU/CPU: allocate space for CTensor, according to the shape in the obj
  *        this function is responsible to set the stride_ in each obj.shape
@@ -649,6 +811,16 @@ inline void AllocSpace(Tensor<cpu, dim, DType> *obj,
 template<int dim, typename DType>
 inline void AllocSpace(Tensor<gpu, dim, DType> *obj,
                        bool pad = MSHADOW_ALLOC_PAD);
+/*!
+ * \brief CPU: place the pages of a tensor that was just allocated, every page is first
+ *  written by the thread that MapExp on a tensor of the same shape and stream would give
+ *  its elements to, so with threads bound to cores (e.g. OMP_PROC_BIND) the pages land
+ *  on the NUMA node of the thread that computes on them. NewTensor does this already,
+ *  as it initializes in parallel. The content is undefined afterwards, as after AllocSpace.
+ * \param obj the tensor
+ */
+template<int dim, typename DType>
+inline void FirstTouch(Tensor<cpu, dim, DType> obj);
 /*!
  * \brief CPU/GPU: free the space of tensor, will set obj.dptr to NULL
  * \param obj the tensor object
@@ -745,6 +917,44 @@ inline void Softmax(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 2, DType> &ener
 template<typename DType>
 inline void Softmax(Tensor<gpu, 2, DType> dst, const Tensor<gpu, 2, DType> &energy);
 
+/*!
+ * \brief CPU/GPU: log-softmax: dst[i][j] = energy[i][j] - log(sum_j exp(energy[i][j])),
+ *   computed from the max and the normalizer of the row without exponentiating it twice
+ * \param dst destination
+ * \param energy input energy
+ */
+template<typename DType>
+inline void LogSoftmax(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 2, DType> &energy);
+/*!
+ * \brief CPU/GPU: log-softmax: dst[i][j] = energy[i][j] - log(sum_j exp(energy[i][j])),
+ *   computed from the max and the normalizer of the row without exponentiating it twice
+ * \param dst destination
+ * \param energy input energy
+ */
+template<typename DType>
+inline void LogSoftmax(Tensor<gpu, 2, DType> dst, const Tensor<gpu, 2, DType> &energy);
+/*!
+ * \brief CPU/GPU: gradient of the log-softmax: dst[i][j] = grad[i][j] - exp(src[i][j]) *
+ *   sum_j grad[i][j]
+ * \param dst destination, may be grad
+ * \param src output of LogSoftmax
+ * \param grad gradient with respect to the output
+ */
+template<typename DType>
+inline void LogSoftmaxGrad(Tensor<cpu, 2, DType> dst,
+                           const Tensor<cpu, 2, DType> &src,
+                           const Tensor<cpu, 2, DType> &grad);
+/*!
+ * \brief CPU/GPU: gradient of the log-softmax: dst[i][j] = grad[i][j] - exp(src[i][j]) *
+ *   sum_j grad[i][j]
+ * \param dst destination, may be grad
+ * \param src output of LogSoftmax
+ * \param grad gradient with respect to the output
+ */
+template<typename DType>
+inline void LogSoftmaxGrad(Tensor<gpu, 2, DType> dst,
+                           const Tensor<gpu, 2, DType> &src,
+                           const Tensor<gpu, 2, DType> &grad);
 /*!
  * \brief CPU/GPU: softmax gradient
  * \param dst destination
@@ -765,6 +975,70 @@ template<typename DType>
 inline void SoftmaxGrad(Tensor<gpu, 2, DType> dst,
                         const Tensor<gpu, 2, DType> &src,
                         const Tensor<gpu, 1, DType> &label);
+/*!
+ * \brief CPU/GPU: fused softmax and cross entropy loss, the energy of a row is read once
+ *   when it fits in registers, the softmax itself is not stored:
+ *   grad[i][j] = softmax(energy[i])[j] - (j == label[i]),
+ *   loss[i] = -log(softmax(energy[i])[label[i]])
+ *   The labels are class indices, no one_hot_encode or choose of them is built, rows whose
+ *   label is out of range get the softmax as gradient and zero loss. grad may be energy.
+ * \param grad gradient of the loss with respect to energy
+ * \param loss loss of each row
+ * \param energy input energy
+ * \param label label of each row, of an integer type or DType
+ */
+template<typename DType, typename IndexType>
+inline void SoftmaxCrossEntropy(Tensor<cpu, 2, DType> grad,
+                                Tensor<cpu, 1, DType> loss,
+                                const Tensor<cpu, 2, DType> &energy,
+                                const Tensor<cpu, 1, IndexType> &label);
+/*!
+ * \brief CPU/GPU: fused softmax and cross entropy loss,
+ *   rows labelled ignore_label get zero gradient and zero loss
+ * \param grad gradient of the loss with respect to energy
+ * \param loss loss of each row
+ * \param energy input energy
+ * \param label label of each row, of an integer type or DType
+ * \param ignore_label label to be ignored
+ */
+template<typename DType, typename IndexType>
+inline void SoftmaxCrossEntropy(Tensor<cpu, 2, DType> grad,
+                                Tensor<cpu, 1, DType> loss,
+                                const Tensor<cpu, 2, DType> &energy,
+                                const Tensor<cpu, 1, IndexType> &label,
+                                const IndexType &ignore_label);
+/*!
+ * \brief CPU/GPU: fused softmax and cross entropy loss, the energy of a row is read once
+ *   when it fits in registers, the softmax itself is not stored:
+ *   grad[i][j] = softmax(energy[i])[j] - (j == label[i]),
+ *   loss[i] = -log(softmax(energy[i])[label[i]])
+ *   The labels are class indices, no one_hot_encode or choose of them is built, rows whose
+ *   label is out of range get the softmax as gradient and zero loss. grad may be energy.
+ * \param grad gradient of the loss with respect to energy
+ * \param loss loss of each row
+ * \param energy input energy
+ * \param label label of each row, of an integer type or DType
+ */
+template<typename DType, typename IndexType>
+inline void SoftmaxCrossEntropy(Tensor<gpu, 2, DType> grad,
+                                Tensor<gpu, 1, DType> loss,
+                                const Tensor<gpu, 2, DType> &energy,
+                                const Tensor<gpu, 1, IndexType> &label);
+/*!
+ * \brief CPU/GPU: fused softmax and cross entropy loss,
+ *   rows labelled ignore_label get zero gradient and zero loss
+ * \param grad gradient of the loss with respect to energy
+ * \param loss loss of each row
+ * \param energy input energy
+ * \param label label of each row, of an integer type or DType
+ * \param ignore_label label to be ignored
+ */
+template<typename DType, typename IndexType>
+inline void SoftmaxCrossEntropy(Tensor<gpu, 2, DType> grad,
+                                Tensor<gpu, 1, DType> loss,
+                                const Tensor<gpu, 2, DType> &energy,
+                                const Tensor<gpu, 1, IndexType> &label,
+                                const IndexType &ignore_label);
 /*!
  * \brief CPU/GPU: Gradient accumulate of embedding matrix.
                    dst[index[i]] += src[i]
@@ -789,6 +1063,62 @@ template<typename IndexType, typename DType>
 inline void AddTakeGrad(Tensor<gpu, 2, DType> dst,
                         const Tensor<gpu, 1, IndexType>& index,
                         const Tensor<gpu, 2, DType> &src);
+/*!
+ * \brief CPU/GPU: gather rows of an embedding table, dst[i] = src[index[i]], saved with SV.
+ *  Each index is read once per row, the CPU prefetches the rows of the next indices and
+ *  the GPU copies every row with one warp, in 16 byte vectors when the rows are aligned.
+ *  take(index, src) of tensors assigned to a tensor is done with this
+ * \param dst destination, one row per index
+ * \param index the rows to take
+ * \param src the table
+ */
+template<typename SV, typename IndexType, typename DType>
+inline void Take(Tensor<cpu, 2, DType> dst,
+                 const Tensor<cpu, 1, IndexType> &index,
+                 const Tensor<cpu, 2, DType> &src);
+/*!
+ * \brief CPU/GPU: gather rows of an embedding table, dst[i] = src[index[i]], saved with SV.
+ *  Each index is read once per row, the CPU prefetches the rows of the next indices and
+ *  the GPU copies every row with one warp, in 16 byte vectors when the rows are aligned.
+ *  take(index, src) of tensors assigned to a tensor is done with this
+ * \param dst destination, one row per index
+ * \param index the rows to take
+ * \param src the table
+ */
+template<typename SV, typename IndexType, typename DType>
+inline void Take(Tensor<gpu, 2, DType> dst,
+                 const Tensor<gpu, 1, IndexType> &index,
+                 const Tensor<gpu, 2, DType> &src);
+/*!
+ * \brief CPU/GPU: sum or mean of bags of embedding rows, the taken rows are not materialized.
+                   dst[b] = sum of src[index[i]] for i in [offset[b], offset[b + 1]),
+                   the last bag ends at the end of index, empty bags give 0
+ * \param dst destination, one row per bag, saved with SV
+ * \param index the rows to take
+ * \param offset where each bag starts in index, non decreasing
+ * \param src the table
+ * \param mean whether to divide the sums by the bag sizes
+ */
+template<typename SV, typename IndexType, typename DType>
+inline void TakeBag(Tensor<cpu, 2, DType> dst,
+                    const Tensor<cpu, 1, IndexType> &index,
+                    const Tensor<cpu, 1, IndexType> &offset,
+                    const Tensor<cpu, 2, DType> &src, bool mean);
+/*!
+ * \brief CPU/GPU: sum or mean of bags of embedding rows, the taken rows are not materialized.
+                   dst[b] = sum of src[index[i]] for i in [offset[b], offset[b + 1]),
+                   the last bag ends at the end of index, empty bags give 0
+ * \param dst destination, one row per bag, saved with SV
+ * \param index the rows to take
+ * \param offset where each bag starts in index, non decreasing
+ * \param src the table
+ * \param mean whether to divide the sums by the bag sizes
+ */
+template<typename SV, typename IndexType, typename DType>
+inline void TakeBag(Tensor<gpu, 2, DType> dst,
+                    const Tensor<gpu, 1, IndexType> &index,
+                    const Tensor<gpu, 1, IndexType> &offset,
+                    const Tensor<gpu, 2, DType> &src, bool mean);
 /*!
  * \brief CPU/GPU: Gradient accumulate of embedding matrix.
                    dst[sorted[i]] += src[index[i]]
@@ -800,7 +1130,7 @@ inline void AddTakeGrad(Tensor<gpu, 2, DType> dst,
  */
 template<typename IndexType, typename DType>
 inline void AddTakeGradLargeBatch(Tensor<cpu, 2, DType> dst,
-                                  const Tensor<gpu, 1, IndexType>& sorted,
+                                  const Tensor<cpu, 1, IndexType>& sorted,
                                   const Tensor<cpu, 1, IndexType>& index,
                                   const Tensor<cpu, 2, DType> &src);
 /*!
@@ -817,6 +1147,21 @@ inline void AddTakeGradLargeBatch(Tensor<gpu, 2, DType> dst,
                                   const Tensor<gpu, 1, IndexType>& sorted,
                                   const Tensor<gpu, 1, IndexType>& index,
                                   const Tensor<gpu, 2, DType> &src);
+/*!
+ * \brief CPU: Gradient of embedding matrix as the rows it touches, instead of a dense update.
+                   rows[i] are the distinct values of index in ascending order and
+                   grad[i] is the sum of src[y] over the y with index[y] == rows[i]
+ * \param grad output gradient rows, needs one row per distinct index
+ * \param rows output row ids, of any type the index converts to
+ * \param index index to take
+ * \param src source output
+ * \return number of rows written to grad and rows
+ */
+template<typename IndexType, typename RType, typename DType>
+inline index_t TakeGradRowSparse(Tensor<cpu, 2, DType> grad,
+                                 Tensor<cpu, 1, RType> rows,
+                                 const Tensor<cpu, 1, IndexType> &index,
+                                 const Tensor<cpu, 2, DType> &src);
 /*!
  * \brief CPU/GPU: Fill the values of the destination matrix to specific rows in the source matrix.
                    dst[index[i]] = src[i]
@@ -859,6 +1204,49 @@ inline void SortByKey(Tensor<cpu, 1, KDType> keys, Tensor<cpu, 1, VDType> values
 template<typename KDType, typename VDType>
 inline void SortByKey(Tensor<gpu, 1, KDType> keys, Tensor<gpu, 1, VDType> values,
                       bool is_ascend = true);
+/*!
+ * \brief CPU/GPU: bytes of workspace SortByKey needs for the keys and values,
+ *  the CPU radix sort needs room for one copy of both, the GPU sort allocates its own
+ * \param keys the keys to sort
+ * \param values the values that sorts w.r.t the key
+ */
+template<typename KDType, typename VDType>
+inline size_t SortByKeyWorkspaceSize(const Tensor<cpu, 1, KDType> &keys,
+                                     const Tensor<cpu, 1, VDType> &values);
+/*!
+ * \brief CPU/GPU: bytes of workspace SortByKey needs for the keys and values,
+ *  the CPU radix sort needs room for one copy of both, the GPU sort allocates its own
+ * \param keys the keys to sort
+ * \param values the values that sorts w.r.t the key
+ */
+template<typename KDType, typename VDType>
+inline size_t SortByKeyWorkspaceSize(const Tensor<gpu, 1, KDType> &keys,
+                                     const Tensor<gpu, 1, VDType> &values);
+/*!
+ * \brief CPU/GPU: Sort key-value pairs stored in separate places, with a preallocated
+ *  workspace of at least SortByKeyWorkspaceSize bytes. (Stable sort is performed!)
+ *  Integral and floating point keys are sorted by a parallel radix sort on CPU, where
+ *  -0 and +0 are equal keys that keep their order, and NaN keys go after all the
+ *  others in ascending order.
+ * \param keys the keys to sort
+ * \param values the values that sorts w.r.t the key
+ * \param workspace scratch space, its content is overwritten
+ * \param is_ascend whether to sort key in ascending order
+ */
+template<typename KDType, typename VDType>
+inline void SortByKey(Tensor<cpu, 1, KDType> keys, Tensor<cpu, 1, VDType> values,
+                      Tensor<cpu, 1, char> workspace, bool is_ascend = true);
+/*!
+ * \brief CPU/GPU: Sort key-value pairs stored in separate places, with a preallocated
+ *  workspace of at least SortByKeyWorkspaceSize bytes. (Stable sort is performed!)
+ * \param keys the keys to sort
+ * \param values the values that sorts w.r.t the key
+ * \param workspace scratch space, its content is overwritten
+ * \param is_ascend whether to sort key in ascending order
+ */
+template<typename KDType, typename VDType>
+inline void SortByKey(Tensor<gpu, 1, KDType> keys, Tensor<gpu, 1, VDType> values,
+                      Tensor<gpu, 1, char> workspace, bool is_ascend = true);
 /*!
  * \brief CPU/GPU: Sort the keys within each segment. (Stable sort is performed!)
                    Segments is defined as an ascending ordered vector like [0, 0, 0, 1, 1, 2, 3, 3, 3,...]
@@ -869,6 +1257,49 @@ inline void SortByKey(Tensor<gpu, 1, KDType> keys, Tensor<gpu, 1, VDType> values
  */
 template<typename Device, typename VDType, typename SDType>
 inline void VectorizedSort(Tensor<Device, 1, VDType> values, Tensor<Device, 1, SDType> segments);
+/*!
+ * \brief CPU/GPU: the k largest elements of each row in descending order, or the k smallest
+ *  in ascending order, equal values ordered by column. Selects without sorting the rows,
+ *  all the rows are handled in one call.
+ * \param src the rows to select from
+ * \param k number of elements to keep of each row
+ * \param values the selected values, src.size(0) x k at least
+ * \param indices the columns of the selected values in src
+ * \param is_ascend whether to select the smallest elements instead
+ */
+template<typename DType, typename IndexType>
+inline void TopK(const Tensor<cpu, 2, DType> &src, index_t k,
+                 Tensor<cpu, 2, DType> values, Tensor<cpu, 2, IndexType> indices,
+                 bool is_ascend = false);
+/*!
+ * \brief CPU/GPU: the k largest elements of each row in descending order, or the k smallest
+ *  in ascending order, equal values ordered by column. Selects without sorting the rows,
+ *  all the rows are handled in one call.
+ * \param src the rows to select from
+ * \param k number of elements to keep of each row
+ * \param values the selected values, src.size(0) x k at least
+ * \param indices the columns of the selected values in src
+ * \param is_ascend whether to select the smallest elements instead
+ */
+template<typename DType, typename IndexType>
+inline void TopK(const Tensor<gpu, 2, DType> &src, index_t k,
+                 Tensor<gpu, 2, DType> values, Tensor<gpu, 2, IndexType> indices,
+                 bool is_ascend = false);
+/*!
+ * \brief CPU: decide the number of threads a parallel CPU kernel should use
+ * \param stream the stream the kernel runs on, can be NULL
+ * \param size number of elements processed by the kernel
+ * \return number of threads, 1 means run serially
+ */
+inline int GetNumParallelThread(Stream<cpu> *stream, size_t size);
+/*!
+ * \brief CPU: called by the kernels before they run on the calling thread, so that they run
+ *  after the tasks pushed to the worker of the stream. It waits for those tasks and rethrows
+ *  their exception; it does nothing without a worker, on the worker thread and inside a
+ *  parallel region, where the tasks would wait for themselves
+ * \param stream the stream the kernel runs on, can be NULL
+ */
+inline void WaitPushedTasks(Stream<cpu> *stream);
 
 // function declarations to support expression, no need to understand them
 // these functions do not need to be directly used
@@ -995,7 +1426,8 @@ inline void VectorDot(Tensor<Device, 1, DType> dst,
  * \param rhs Right operand vector
  * \param alpha multiplier of op(lhs)op(rhs)
  * \param beta multiplier of dst
- * \param workspace Workspace for casting DType* to DType** (batched-view), must have size >= 3 * batch_size
+ * \param workspace Workspace for casting DType* to DType** (batched-view), must have size >= 3 * batch_size,
+ *  only used by the BLAS without a strided batched gemm, may be empty
  */
 template<bool transpose_left, bool transpose_right, typename Device, typename DType>
 inline void BatchGEMM(Tensor<Device, 3, DType> dst,
@@ -1004,6 +1436,16 @@ inline void BatchGEMM(Tensor<Device, 3, DType> dst,
                       DType alpha,
                       DType beta,
                       Tensor<Device, 1, DType*> workspace);
+/*!
+ * \brief CPU/GPU: dst = alpha * op(lhs) op(rhs) + beta * dst, without a workspace,
+ *  the BLAS that need the batched view allocate it themselves
+ */
+template<bool transpose_left, bool transpose_right, typename Device, typename DType>
+inline void BatchGEMM(Tensor<Device, 3, DType> dst,
+                      const Tensor<Device, 3, DType> &lhs,
+                      const Tensor<Device, 3, DType> &rhs,
+                      DType alpha,
+                      DType beta);
 }  // namespace mshadow
 // include headers
 #include "./stream_gpu-inl.h"
@@ -1013,6 +1455,11 @@ inline void BatchGEMM(Tensor<Device, 3, DType> dst,
 #include "./tensor_gpu-inl.h"
 #include "./io.h"
 #include "./tensor_container.h"
+#include "./workspace.h"
+#include "./validated_plan.h"
+#include "./convolution.h"
+#include "./normalization.h"
+#include "./fft.h"
 #include "./tensor_blob.h"
 #include "./random.h"
 // add definition of scalar related operators
@@ -1032,4 +1479,7 @@ inline void BatchGEMM(Tensor<Device, 3, DType> dst,
 #define MSHADOW_SCALAR_ mshadow::half::half_t
 #include "./expr_scalar-inl.h"
 #undef MSHADOW_SCALAR_
+#define MSHADOW_SCALAR_ mshadow::bfloat::bf16_t
+#include "./expr_scalar-inl.h"
+#undef MSHADOW_SCALAR_
 #endif  // MSHADOW_TENSOR_H_
@@ -6,6 +6,7 @@
  */
 #ifndef MSHADOW_TENSOR_CONTAINER_H_
 #define MSHADOW_TENSOR_CONTAINER_H_
+#include <algorithm>
 #include "./tensor.h"
 #include "./io.h"
 
@@ -71,24 +72,57 @@ class TensorContainer: public Tensor<Device, dimension, DType> {
       mshadow::Copy(*this, src, this->stream_);
     }
   }
+#if MSHADOW_IN_CXX11
+  /*!
+   * \brief move constructor, takes over the space of src
+   * \param src source value, becomes empty
+   */
+  TensorContainer(TensorContainer<Device, dimension, DType> &&src)  // NOLINT(*)
+      : Tensor<Device, dimension, DType>(src), pad_(src.pad_), data_(src.data_) {
+    src.Reset();
+  }
+  /*!
+   * \brief move assignment, takes over the space of src
+   * \param src source value, becomes empty
+   * \return reference of self
+   */
+  inline TensorContainer &operator=(TensorContainer<Device, dimension, DType> &&src) {  // NOLINT(*)
+    if (this != &src) {
+      this->Release();
+      this->dptr_ = src.dptr_;
+      this->shape_ = src.shape_;
+      this->stride_ = src.stride_;
+      this->stream_ = src.stream_;
+      pad_ = src.pad_;
+      data_ = src.data_;
+      src.Reset();
+    }
+    return *this;
+  }
+#endif  // MSHADOW_IN_CXX11
   ~TensorContainer(void) {
     this->Release();
   }
   /*!
-   * \brief resize the container to given shape, content is NOT preserved
+   * \brief resize the container to given shape, content is NOT preserved.
+   *  The space is reused whenever it is large enough, otherwise it grows to
+   *  at least twice of the capacity, so a sequence of growing shapes
+   *  only reallocates a logarithmic number of times.
    * \param shape target shape
    */
   inline void Resize(const Shape<dimension> &shape) {
     Shape<2> s2 = shape.FlatTo2D();
-    if (s2.shape_[1] > data_.stride_ || s2.shape_[0] > data_.size(0)) {
-      this->AllocByShape(shape);
-    } else {
+    const size_t capacity = this->capacity();
+    if (this->pad_ && s2.shape_[1] <= data_.stride_ &&
+        s2.shape_[0] * static_cast<size_t>(data_.stride_) <= capacity) {
       this->shape_ = shape;
-      if (this->pad_) {
-        this->stride_ = data_.stride_;
-      } else {
-        this->stride_ = s2.shape_[1];
-      }
+      this->stride_ = data_.stride_;
+    } else if (s2.Size() <= capacity) {
+      // the padded layout does not fit, but the space is still enough for a contiguous one
+      this->shape_ = shape;
+      this->stride_ = s2.shape_[1];
+    } else {
+      this->AllocByShape(shape, capacity * 2);
     }
   }
   /*!
@@ -100,6 +134,37 @@ class TensorContainer: public Tensor<Device, dimension, DType> {
     this->Resize(shape);
     (*this) = initv;
   }
+  /*!
+   * \brief make sure every shape that flattens to at most shape.FlatTo2D() can be
+   *  set by Resize without reallocation, content is preserved
+   * \param shape the largest shape expected
+   */
+  inline void Reserve(const Shape<dimension> &shape) {
+    Shape<2> s2 = shape.FlatTo2D();
+    Shape<2> cur = this->shape_.FlatTo2D();
+    const bool fit = this->pad_ ?
+        s2.shape_[1] <= data_.stride_ &&
+        s2.shape_[0] * static_cast<size_t>(data_.stride_) <= this->capacity() :
+        s2.Size() <= this->capacity();
+    if (fit) return;
+    s2.shape_[0] = std::max(s2.shape_[0], cur.shape_[0]);
+    s2.shape_[1] = std::max(s2.shape_[1], cur.shape_[1]);
+    this->Reallocate(s2);
+  }
+  /*! \brief release the space beyond the current shape, content is preserved */
+  inline void ShrinkToFit(void) {
+    if (data_.dptr_ == NULL) return;
+    if (this->shape_.Size() == 0) {
+      this->Release(); return;
+    }
+    Shape<2> s2 = this->shape_.FlatTo2D();
+    if (s2.shape_[0] * static_cast<size_t>(this->stride_) == this->capacity()) return;
+    this->Reallocate(s2);
+  }
+  /*! \return number of elements the space holds, including the padding */
+  inline size_t capacity(void) const {
+    return data_.size(0) * static_cast<size_t>(data_.stride_);
+  }
   /*! \brief set whether padding is allowed in tensor */
   inline void set_pad(bool pad) {
     this->pad_ = pad;
@@ -175,6 +240,8 @@ class TensorContainer: public Tensor<Device, dimension, DType> {
       this->stride_ = 0;
       this->data_.stride_ = 0;
       this->data_.shape_[0] = 0;
+      // the space is reused in stream order by a caching allocator
+      data_.stream_ = this->stream_;
       try {
         mshadow::FreeSpace(&data_);
       } catch (const dmlc::Error &e) {
@@ -191,9 +258,15 @@ class TensorContainer: public Tensor<Device, dimension, DType> {
   /*! \brief the shape of data_ is actually current data space */
   Tensor<Device, 2, DType> data_;
 
-  inline void AllocByShape(const Shape<dimension>& shape) {
+  inline void AllocByShape(const Shape<dimension>& shape, size_t min_capacity = 0) {
     if (data_.dptr_ != NULL) this->Release();
     data_.shape_ = shape.FlatTo2D();
+    if (data_.size(1) != 0 && min_capacity > data_.shape_.Size()) {
+      // allocate more rows, so the space grows geometrically
+      data_.shape_[0] = std::max(data_.size(0), static_cast<index_t>(
+          (min_capacity + data_.size(1) - 1) / data_.size(1)));
+    }
+    data_.stream_ = this->stream_;
     mshadow::AllocSpace(&data_, pad_);
     this->dptr_ = data_.dptr_;
     this->shape_ = shape;
@@ -203,6 +276,31 @@ class TensorContainer: public Tensor<Device, dimension, DType> {
       this->stride_ = data_.size(1);
     }
   }
+  // move into new space of shape alloc, which covers the current shape
+  inline void Reallocate(const Shape<2> &alloc) {
+    Tensor<Device, 2, DType> ndata(alloc);
+    ndata.stream_ = this->stream_;
+    mshadow::AllocSpace(&ndata, pad_);
+    const Shape<dimension> shape = this->shape_;
+    const index_t stride = this->pad_ ? ndata.stride_ : shape.FlatTo2D()[1];
+    if (data_.dptr_ != NULL && shape.Size() != 0) {
+      Tensor<Device, 2, DType> dst(ndata.dptr_, shape.FlatTo2D(), stride, this->stream_);
+      mshadow::Copy(dst, this->FlatTo2D(), this->stream_);
+    }
+    this->Release();
+    data_ = ndata;
+    this->dptr_ = data_.dptr_;
+    this->shape_ = shape;
+    this->stride_ = stride;
+  }
+  // become empty without freeing the space, which is owned by another container now
+  inline void Reset(void) {
+    this->dptr_ = data_.dptr_ = NULL;
+    this->shape_[0] = 0;
+    this->stride_ = 0;
+    this->data_.stride_ = 0;
+    this->data_.shape_[0] = 0;
+  }
 };
 }  // namespace mshadow
 #endif  // MSHADOW_TENSOR_CONTAINER_H_
@@ -6,14 +6,23 @@
  */
 #ifndef MSHADOW_TENSOR_CPU_INL_H_
 #define MSHADOW_TENSOR_CPU_INL_H_
+#include <algorithm>
 #include <cstring>
 #include <functional>
+#include <limits>
+#include <type_traits>
 #include <utility>
 #include <vector>
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 #include "./base.h"
 #include "./tensor.h"
 #include "./packet-inl.h"
+#include "./profiler.h"
 #include "./dot_engine-inl.h"
+#include "./memory_pool-inl.h"
+#include "./cpu_allocator-inl.h"
 
 namespace mshadow {
 template<>
@@ -35,6 +44,14 @@ template<>
 inline void DeleteStream<cpu>(Stream<cpu> *stream) {
   delete stream;
 }
+template<>
+inline Event<cpu> *NewEvent<cpu>(void) {
+  return new Event<cpu>();
+}
+template<>
+inline void DeleteEvent<cpu>(Event<cpu> *event) {
+  delete event;
+}
 
 template<int ndim>
 inline std::ostream &operator<<(std::ostream &os, const Shape<ndim> &shape) { // NOLINT(*)
@@ -54,33 +71,45 @@ inline void *AllocHost_(size_t size);
 template<typename xpu>
 inline void FreeHost_(void * dptr);
 
-#ifdef __CUDACC__
+#if MSHADOW_USE_CUDA
 template<>
 inline void *AllocHost_<gpu>(size_t size) {
+#if MSHADOW_USE_GPU_POOL
+  return pool::PinnedMemoryPool::Get()->Alloc(size);
+#else
   void *dptr;
-  MSHADOW_CUDA_CALL(cudaMallocHost(&dptr, size, cudaHostAllocPortable));
+  MSHADOW_CUDA_CALL(cudaHostAlloc(&dptr, size, cudaHostAllocPortable));
   return dptr;
+#endif  // MSHADOW_USE_GPU_POOL
 }
 template<>
 inline void FreeHost_<gpu>(void *dptr) {
+#if MSHADOW_USE_GPU_POOL
+  // cudaFreeHost waits for the device, the same is achieved by reusing the block
+  // only after the work already queued on the default stream completed
+  pool::PinnedMemoryPool::Get()->Free(dptr, 0);
+#else
   MSHADOW_CUDA_CALL(cudaFreeHost(dptr));
+#endif  // MSHADOW_USE_GPU_POOL
 }
-#endif
-
-#ifdef _WIN32
-  typedef int64_t openmp_index_t;
-#else
-  typedef index_t openmp_index_t;
-#endif
+#endif  // MSHADOW_USE_CUDA
 
 template<>
 inline void *AllocHost_<cpu>(size_t size) {
+#if MSHADOW_USE_CPU_ALLOCATOR
+  return pool::CPUAlloc(size);
+#else
   size_t pitch;
   return packet::AlignedMallocPitch(&pitch, size, 1);
+#endif  // MSHADOW_USE_CPU_ALLOCATOR
 }
 template<>
 inline void FreeHost_<cpu>(void *dptr) {
+#if MSHADOW_USE_CPU_ALLOCATOR
+  pool::CPUFree(dptr);
+#else
   packet::AlignedFree(dptr);
+#endif  // MSHADOW_USE_CPU_ALLOCATOR
 }
 
 template<typename xpu, int dim, typename DType>
@@ -103,6 +132,17 @@ template<int dim, typename DType>
 inline void AllocSpace(Tensor<cpu, dim, DType> *obj, bool pad) {
   size_t pitch;
   void *dptr;
+#if MSHADOW_USE_CPU_ALLOCATOR
+  const size_t align = pool::ICPUAllocator::kCPUAlign;
+  if (pad) {
+    pitch = (obj->size(dim - 1) * sizeof(DType) + align - 1) / align * align;
+    dptr = pool::CPUAlloc(pitch * obj->shape_.FlatTo2D()[0]);
+    obj->stride_ = static_cast<index_t>(pitch / sizeof(DType));
+  } else {
+    obj->stride_ = obj->size(dim - 1);
+    dptr = pool::CPUAlloc(obj->shape_.Size() * sizeof(DType));
+  }
+#else
   if (pad) {
     dptr = packet::AlignedMallocPitch
         (&pitch, obj->size(dim - 1) * sizeof(DType), obj->shape_.FlatTo2D()[0]);
@@ -112,8 +152,36 @@ inline void AllocSpace(Tensor<cpu, dim, DType> *obj, bool pad) {
     dptr = packet::AlignedMallocPitch
         (&pitch, obj->shape_.Size() * sizeof(DType), 1);
   }
+#endif  // MSHADOW_USE_CPU_ALLOCATOR
   obj->dptr_ = reinterpret_cast<DType*>(dptr);
 }
+template<int dim, typename DType>
+inline void FirstTouch(Tensor<cpu, dim, DType> obj) {
+  Tensor<cpu, 2, DType> dst = obj.FlatTo2D();
+  const index_t nrow = dst.size(0), ncol = dst.size(1);
+  if (nrow == 0 || ncol == 0) return;
+  // touching more often than the page size of the host is harmless
+  const size_t kPage = 4096;
+  const index_t step = static_cast<index_t>(std::max(kPage / sizeof(DType),
+                                                     static_cast<size_t>(1)));
+  const int nthread = GetNumParallelThread(obj.stream_, dst.shape_.Size());
+  // the same blocks as MapPlan
+  const index_t nblock = (nthread <= 1 || nrow >= static_cast<index_t>(nthread)) ?
+      1 : (nthread + nrow - 1) / nrow;
+  const index_t bsize = (ncol + nblock - 1) / nblock;
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < nrow * nblock; ++i) {
+    const index_t y = static_cast<index_t>(i) / nblock;
+    const index_t xbegin = (static_cast<index_t>(i) % nblock) * bsize;
+    const index_t xend = std::min(xbegin + bsize, ncol);
+    if (xbegin >= xend) continue;
+    for (index_t x = xbegin; x < xend; x += step) {
+      dst[y][x] = DType(0);
+    }
+    // the last page, when the block starts in the middle of a page
+    dst[y][xend - 1] = DType(0);
+  }
+}
 template<typename Device, typename DType, int dim>
 inline Tensor<Device, dim, DType>
 NewTensor(const Shape<dim> &shape, DType initv, bool pad, Stream<Device> *stream_) {
@@ -125,15 +193,21 @@ NewTensor(const Shape<dim> &shape, DType initv, bool pad, Stream<Device> *stream
 }
 template<int dim, typename DType>
 inline void FreeSpace(Tensor<cpu, dim, DType> *obj) {
+#if MSHADOW_USE_CPU_ALLOCATOR
+  pool::CPUFree(obj->dptr_);
+#else
   packet::AlignedFree(obj->dptr_);
+#endif  // MSHADOW_USE_CPU_ALLOCATOR
   obj->dptr_ = NULL;
 }
 template<int dim, typename DType>
 inline void Copy(Tensor<cpu, dim, DType> _dst,
                  const Tensor<cpu, dim, DType> &_src,
                  Stream<cpu> *stream) {
-  CHECK_EQ(_dst.shape_, _src.shape_)
+  WaitPushedTasks(stream);
+  MSHADOW_CHECK_SHAPE_EQ(_dst.shape_, _src.shape_)
       << "Copy:shape mismatch:" << _dst.shape_ << " vs " << _src.shape_;
+  MSHADOW_PROFILE_SCOPE(kCopy, "cpu", _dst.shape_, 2 * sizeof(DType) * _dst.shape_.Size());
   if (_dst.CheckContiguous() && _src.CheckContiguous()) {
     memcpy(_dst.dptr_, _src.dptr_, sizeof(DType) * _dst.shape_.Size());
   } else {
@@ -145,15 +219,56 @@ inline void Copy(Tensor<cpu, dim, DType> _dst,
   }
 }
 
+inline int GetNumParallelThread(Stream<cpu> *stream, size_t size) {
+#ifdef _OPENMP
+  const size_t threshold = stream != NULL ?
+      stream->parallel_threshold_ : MSHADOW_CPU_PARALLEL_THRESHOLD;
+  // do not nest, the enclosing parallel region already owns the cores
+  if (size < threshold || omp_in_parallel()) return 1;
+  const int nthread = stream != NULL ? stream->nthread_ : 0;
+  return nthread > 0 ? nthread : omp_get_max_threads();
+#else
+  return 1;
+#endif
+}
+
+inline void WaitPushedTasks(Stream<cpu> *stream) {
+#if MSHADOW_IN_CXX11
+  if (stream == NULL || stream->worker_ == NULL) return;
+#ifdef _OPENMP
+  if (omp_in_parallel()) return;
+#endif
+  if (!stream->worker_->InWorkerThread()) stream->Wait();
+#endif
+}
+
 template<typename Saver, typename R, int dim,
          typename DType, typename E>
 inline void MapPlan(TRValue<R, cpu, dim, DType> *dst,
                     const expr::Plan<E, DType> &plan) {
   Shape<2> shape = expr::ShapeCheck<dim, R>::Check(dst->self()).FlatTo2D();
   expr::Plan<R, DType> dplan = expr::MakePlan(dst->self());
-  // temp remove openmp, as default setting throttles CPU
-  for (index_t y = 0; y < shape[0]; ++y) {
-    for (index_t x = 0; x < shape[1]; ++x) {
+  const int nthread = GetNumParallelThread(
+      expr::StreamInfo<cpu, R>::Get(dst->self()), shape.Size());
+  if (nthread <= 1) {
+    // an OpenMP region costs more than a small kernel even when its if clause is false
+    for (index_t y = 0; y < shape[0]; ++y) {
+      for (index_t x = 0; x < shape[1]; ++x) {
+        Saver::template Save<DType>(dplan.REval(y, x), plan.Eval(y, x));
+      }
+    }
+    return;
+  }
+  // split rows among threads, cut rows into column blocks when there are too few
+  const index_t nblock = shape[0] >= static_cast<index_t>(nthread) ?
+      1 : (nthread + shape[0] - 1) / shape[0];
+  const index_t bsize = (shape[1] + nblock - 1) / nblock;
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < shape[0] * nblock; ++i) {
+    const index_t y = static_cast<index_t>(i) / nblock;
+    const index_t xbegin = (static_cast<index_t>(i) % nblock) * bsize;
+    const index_t xend = std::min(xbegin + bsize, shape[1]);
+    for (index_t x = xbegin; x < xend; ++x) {
       // trust your compiler! -_- they will optimize it
       Saver::template Save<DType>(dplan.REval(y, x), plan.Eval(y, x));
     }
@@ -169,17 +284,65 @@ struct MapExpCPUEngine {
     MapPlan<Saver>(dst, MakePlan(exp.self()));
   }
 };
+template<typename SV, int dim, typename DType, typename E, int etype>
+struct MapExpCPUEngine<false, SV, Tensor<cpu, dim, DType>,
+                       dim, DType, E, etype> {
+  inline static void Map(Tensor<cpu, dim, DType> *dst,
+                         const expr::Exp<E, DType, etype> &exp) {
+    Tensor<cpu, 2, DType> flat;
+    size_t addr = 0;
+    if (expr::FlatView(*dst, exp.self(), &flat, &addr)) {
+      MapPlan<SV>(&flat, MakePlan(exp.self()));
+    } else {
+      MapPlan<SV>(dst, MakePlan(exp.self()));
+    }
+  }
+};
 
 template<typename SV, int dim, typename DType, typename E, int etype>
 struct MapExpCPUEngine<true, SV, Tensor<cpu, dim, DType>,
                        dim, DType, E, etype> {
   inline static void Map(Tensor<cpu, dim, DType> *dst,
                          const expr::Exp<E, DType, etype> &exp) {
-    if (expr::PacketAlignCheck<dim, E, MSHADOW_DEFAULT_PACKET>::Check(exp.self()) &&
-        expr::PacketAlignCheck<dim, Tensor<cpu, dim, DType>, MSHADOW_DEFAULT_PACKET>::Check(*dst)) {
-      expr::MapPacketPlan<SV>(dst->self(),
-                              expr::MakePacketPlan<MSHADOW_DEFAULT_PACKET>(exp.self()));
-    } else {
+    const int nthread = GetNumParallelThread(dst->stream_, dst->shape_.Size());
+    Tensor<cpu, 2, DType> flat;
+    size_t addr = 0;
+    if (expr::FlatView(*dst, exp.self(), &flat, &addr)) {
+#if MSHADOW_USE_PACKET_DISPATCH
+      switch (packet::GetHostPacketArch()) {
+        case packet::kAVX512:
+          if (expr::PacketFlatMapper<SV, packet::kAVX512, DType, E>
+              ::Map(flat, exp.self(), addr, nthread)) return;
+          // fall through
+        case packet::kAVX:
+          if (expr::PacketFlatMapper<SV, packet::kAVX, DType, E>
+              ::Map(flat, exp.self(), addr, nthread)) return;
+          // fall through
+        default: break;
+      }
+#endif
+      if (!expr::PacketFlatMapper<SV, MSHADOW_DEFAULT_PACKET, DType, E>
+          ::Map(flat, exp.self(), addr, nthread)) {
+        MapPlan<SV>(&flat, MakePlan(exp.self()));
+      }
+      return;
+    }
+#if MSHADOW_USE_PACKET_DISPATCH
+    // try the widest arch of the host first, fall back to narrower ones on misalignment
+    switch (packet::GetHostPacketArch()) {
+      case packet::kAVX512:
+        if (expr::PacketMapper<SV, packet::kAVX512, dim, DType, E>
+            ::Map(dst, exp.self(), nthread)) return;
+        // fall through
+      case packet::kAVX:
+        if (expr::PacketMapper<SV, packet::kAVX, dim, DType, E>
+            ::Map(dst, exp.self(), nthread)) return;
+        // fall through
+      default: break;
+    }
+#endif
+    if (!expr::PacketMapper<SV, MSHADOW_DEFAULT_PACKET, dim, DType, E>
+        ::Map(dst, exp.self(), nthread)) {
       MapPlan<SV>(dst, MakePlan(exp.self()));
     }
   }
@@ -190,40 +353,249 @@ template<typename Saver, typename R, int dim,
          typename DType, typename E, int etype>
 inline void MapExp(TRValue<R, cpu, dim, DType> *dst,
                    const expr::Exp<E, DType, etype> &exp) {
+  WaitPushedTasks(expr::StreamInfo<cpu, R>::Get(dst->self()));
   expr::TypeCheckPass<expr::TypeCheck<cpu, dim, DType, E>::kMapPass>
       ::Error_All_Tensor_in_Exp_Must_Have_Same_Type();
-  Shape<dim> eshape = expr::ShapeCheck<dim, E>::Check(exp.self());
+#if MSHADOW_SHAPE_CHECK || MSHADOW_USE_PROFILER
   Shape<dim> dshape = expr::ShapeCheck<dim, R>::Check(dst->self());
+#endif
+#if MSHADOW_SHAPE_CHECK
+  Shape<dim> eshape = expr::ShapeCheck<dim, E>::Check(exp.self());
   CHECK(eshape[0] == 0 || eshape == dshape)
       << "Assignment: Shape of Tensors are not consistent with target, "
       << "eshape: " << eshape << " dshape:" << dshape;
-  MapExpCPUEngine<expr::PacketCheck<E, MSHADOW_DEFAULT_PACKET>::kPass,
+#endif  // MSHADOW_SHAPE_CHECK
+  MSHADOW_PROFILE_SCOPE(kMapExp, profiler::TypeName<E>(), dshape, sizeof(DType) * dshape.Size());
+  if (expr::MapExpDirectEngine<Saver, R, E, DType>::Map(dst->ptrself(), exp.self())) return;
+  MapExpCPUEngine<expr::PacketHostCheck<E>::kPass,
                   Saver, R, dim, DType, E, etype>
   ::Map(dst->ptrself(), exp);
 }
 
+/*!
+ * \brief row reduction kernels used by MapReduceKeepLowest and MapReduceKeepHighDim,
+ *  the scalar version works with any expression.
+ *  Partial results are kept in AccType<DType>::type, float for the 16 bit types.
+ */
+template<typename Reducer, typename E, typename DType>
+struct MapRedRowKernel {
+  typedef typename AccType<DType>::type AType;
+  explicit MapRedRowKernel(const E &exp) : plan_(expr::MakePlan(exp)) {}
+  /*! \brief acc[x] = reduce of rows [ybegin, yend) at column x, for x in [xbegin, xend) */
+  inline void ReduceRows(AType *acc, index_t ybegin, index_t yend,
+                         index_t xbegin, index_t xend) const {
+    for (index_t x = xbegin; x < xend; ++x) {
+      acc[x] = AType(plan_.Eval(ybegin, x));
+    }
+    for (index_t y = ybegin + 1; y < yend; ++y) {
+      for (index_t x = xbegin; x < xend; ++x) {
+        Reducer::Reduce(acc[x], AType(plan_.Eval(y, x)));
+      }
+    }
+  }
+  /*! \brief reduce all elements of rows [ybegin, yend) into res */
+  inline void ReduceAll(AType &res, index_t ybegin, index_t yend,  // NOLINT(*)
+                        index_t ncol) const {
+    for (index_t y = ybegin; y < yend; ++y) {
+      for (index_t x = 0; x < ncol; ++x) {
+        Reducer::Reduce(res, AType(plan_.Eval(y, x)));
+      }
+    }
+  }
+
+ private:
+  expr::Plan<E, DType> plan_;
+};
+/*!
+ * \brief packet version of the row reduction kernel,
+ *  requires the rows of the expression and of acc to be packet aligned
+ */
+template<typename Reducer, typename E, typename DType>
+struct MapRedRowPacketKernel {
+  typedef typename AccType<DType>::type AType;
+  typedef packet::Packet<AType, MSHADOW_DEFAULT_PACKET> TPacket;
+  typedef packet::PacketReducer<Reducer, AType, MSHADOW_DEFAULT_PACKET> TReducer;
+  typedef packet::AccPacket<DType, MSHADOW_DEFAULT_PACKET> TAcc;
+  explicit MapRedRowPacketKernel(const E &exp)
+      : plan_(expr::MakePacketPlan<MSHADOW_DEFAULT_PACKET>(exp)) {}
+  /*! \brief whether the data of the expression is aligned for the kernel */
+  inline static bool Check(const E &exp) {
+    return expr::PacketAlignCheck<expr::ExpInfo<E>::kDim, E,
+                                  MSHADOW_DEFAULT_PACKET>::Check(exp);
+  }
+  inline void ReduceRows(AType *acc, index_t ybegin, index_t yend,
+                         index_t xbegin, index_t xend) const {
+    const index_t xlen = std::max(xbegin, std::min(
+        xend, packet::LowerAlign<DType, MSHADOW_DEFAULT_PACKET>(xend)));
+    for (index_t x = xbegin; x < xlen; x += TPacket::kSize) {
+      TAcc::Get(plan_.EvalPacket(ybegin, x)).Store(acc + x);
+    }
+    for (index_t x = xlen; x < xend; ++x) {
+      acc[x] = AType(plan_.Eval(ybegin, x));
+    }
+    for (index_t y = ybegin + 1; y < yend; ++y) {
+      for (index_t x = xbegin; x < xlen; x += TPacket::kSize) {
+        TPacket res = TPacket::Load(acc + x);
+        TReducer::Reduce(res, TAcc::Get(plan_.EvalPacket(y, x)));
+        res.Store(acc + x);
+      }
+      for (index_t x = xlen; x < xend; ++x) {
+        Reducer::Reduce(acc[x], AType(plan_.Eval(y, x)));
+      }
+    }
+  }
+  inline void ReduceAll(AType &res, index_t ybegin, index_t yend,  // NOLINT(*)
+                        index_t ncol) const {
+    // reducers without a horizontal packet reduction stay scalar here
+    const index_t xlen = TReducer::kHorizontal ?
+        packet::LowerAlign<DType, MSHADOW_DEFAULT_PACKET>(ncol) : 0;
+    TPacket pres = TPacket::Fill(AType(0));
+    for (index_t y = ybegin; y < yend; ++y) {
+      for (index_t x = 0; x < xlen; x += TPacket::kSize) {
+        TReducer::Reduce(pres, TAcc::Get(plan_.EvalPacket(y, x)));
+      }
+      for (index_t x = xlen; x < ncol; ++x) {
+        Reducer::Reduce(res, AType(plan_.Eval(y, x)));
+      }
+    }
+    if (xlen != 0) Reducer::Reduce(res, pres.Sum());
+  }
+
+ private:
+  expr::PacketPlan<E, DType, MSHADOW_DEFAULT_PACKET> plan_;
+};
+/*!
+ * \brief reduce a nrow x ncol expression over rows with the given kernel,
+ *  rows are split among threads, each thread reduces into its own row of acc
+ *  in column tiles that stay in cache, the partial rows are merged into acc[0]
+ */
+template<typename Reducer, typename Kernel, typename DType>
+inline void MapRedKeepLowestRun(const Kernel &kernel, Tensor<cpu, 2, DType> acc,
+                                index_t nrow, index_t ncol) {
+  const index_t nthread = acc.size(0);
+  const index_t tile = std::max(
+      index_t(1), packet::UpperAlign<DType, MSHADOW_DEFAULT_PACKET>(4096 / sizeof(DType)));
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < nthread; ++i) {
+    const index_t tid = static_cast<index_t>(i);
+    const index_t ybegin = nrow * tid / nthread, yend = nrow * (tid + 1) / nthread;
+    for (index_t x = 0; x < ncol; x += tile) {
+      kernel.ReduceRows(acc[tid].dptr_, ybegin, yend, x, std::min(x + tile, ncol));
+    }
+  }
+  for (index_t tid = 1; tid < nthread; ++tid) {
+    for (index_t x = 0; x < ncol; ++x) {
+      Reducer::Reduce(acc[0][x], acc[tid][x]);
+    }
+  }
+}
+
+/*!
+ * \brief reduce a (N, C, Y * X) view of an expression into C values,
+ *  channels are split among threads, together with the batch when there are
+ *  fewer channels than threads, partial results are merged in order
+ */
+template<typename Reducer, typename Kernel, typename DType>
+inline void MapRedKeepHighDimRun(const Kernel &kernel, const Shape<4> &pshape,
+                                 int nthread, DType *res) {
+  const index_t nsplit = static_cast<index_t>(nthread) <= pshape[1] ? 1 :
+      std::min(pshape[0], (nthread + pshape[1] - 1) / pshape[1]);
+  std::vector<DType> partial(pshape[1] * nsplit);
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < pshape[1] * nsplit; ++i) {
+    const index_t c = static_cast<index_t>(i) / nsplit;
+    const index_t part = static_cast<index_t>(i) % nsplit;
+    DType pres; Reducer::SetInitValue(pres);
+    for (index_t n = pshape[0] * part / nsplit;
+         n < pshape[0] * (part + 1) / nsplit; ++n) {
+      DType tres; Reducer::SetInitValue(tres);
+      const index_t y = (n * pshape[1] + c) * pshape[2];
+      kernel.ReduceAll(tres, y, y + pshape[2], pshape[3]);
+      Reducer::Reduce(pres, tres);
+    }
+    partial[i] = pres;
+  }
+  for (index_t c = 0; c < pshape[1]; ++c) {
+    res[c] = partial[c * nsplit];
+    for (index_t part = 1; part < nsplit; ++part) {
+      Reducer::Reduce(res[c], partial[c * nsplit + part]);
+    }
+  }
+}
+
+/*!
+ * \brief run the reductions with the packet kernel when the expression
+ *  and reducer support packets and the data is aligned, otherwise the scalar kernel
+ */
+template<typename Reducer, typename E, typename DType,
+         bool pass = expr::PacketCheck<E, MSHADOW_DEFAULT_PACKET>::kPass &&
+         packet::PacketReducer<Reducer, typename AccType<DType>::type,
+                               MSHADOW_DEFAULT_PACKET>::kEnabled>
+struct MapRedCPUEngine {
+  typedef typename AccType<DType>::type AType;
+  inline static void KeepLowest(const E &exp, Tensor<cpu, 2, AType> acc,
+                                index_t nrow, index_t ncol) {
+    MapRedKeepLowestRun<Reducer>(MapRedRowKernel<Reducer, E, DType>(exp), acc, nrow, ncol);
+  }
+  inline static void KeepHighDim(const E &exp, const Shape<4> &pshape,
+                                 int nthread, AType *res) {
+    MapRedKeepHighDimRun<Reducer>(MapRedRowKernel<Reducer, E, DType>(exp),
+                                  pshape, nthread, res);
+  }
+};
+template<typename Reducer, typename E, typename DType>
+struct MapRedCPUEngine<Reducer, E, DType, true> {
+  typedef typename AccType<DType>::type AType;
+  inline static void KeepLowest(const E &exp, Tensor<cpu, 2, AType> acc,
+                                index_t nrow, index_t ncol) {
+    if (MapRedRowPacketKernel<Reducer, E, DType>::Check(exp)) {
+      MapRedKeepLowestRun<Reducer>(MapRedRowPacketKernel<Reducer, E, DType>(exp),
+                                   acc, nrow, ncol);
+    } else {
+      MapRedCPUEngine<Reducer, E, DType, false>::KeepLowest(exp, acc, nrow, ncol);
+    }
+  }
+  inline static void KeepHighDim(const E &exp, const Shape<4> &pshape,
+                                 int nthread, AType *res) {
+    if (MapRedRowPacketKernel<Reducer, E, DType>::Check(exp)) {
+      MapRedKeepHighDimRun<Reducer>(MapRedRowPacketKernel<Reducer, E, DType>(exp),
+                                    pshape, nthread, res);
+    } else {
+      MapRedCPUEngine<Reducer, E, DType, false>::KeepHighDim(exp, pshape, nthread, res);
+    }
+  }
+};
+
 template<typename Saver, typename Reducer,
          typename R, typename DType, typename E, int etype>
 inline void MapReduceKeepLowest(TRValue<R, cpu, 1, DType> *dst,
                                 const expr::Exp<E, DType, etype> &exp,
                                 DType scale) {
+  WaitPushedTasks(expr::StreamInfo<cpu, R>::Get(dst->self()));
   expr::TypeCheckPass<expr::TypeCheck<cpu, 1, DType, E>::kRedPass>
       ::Error_TypeCheck_Not_Pass_For_Reduce_Exp();
   Shape<2> eshape = expr::ShapeCheck<expr::ExpInfo<E>::kDim, E>
       ::Check(exp.self()).FlatTo2D();
   Shape<1> dshape = expr::ShapeCheck<1, R>::Check(dst->self());
-  CHECK_EQ(eshape[1], dshape[0]) << "MapReduceKeepLowest::reduction dimension do not match";
+  MSHADOW_CHECK_SHAPE_EQ(eshape[1], dshape[0])
+      << "MapReduceKeepLowest::reduction dimension do not match";
   CHECK_NE(eshape[0], 0) << "can not reduce over empty tensor";
+  MSHADOW_PROFILE_SCOPE(kReduceKeepLowest, profiler::TypeName<E>(), eshape,
+                        sizeof(DType) * eshape.Size());
   // execution
+  const int nthread = std::min(
+      GetNumParallelThread(expr::StreamInfo<cpu, R>::Get(dst->self()), eshape.Size()),
+      static_cast<int>(eshape[0]));
+  // one row of partial results per thread, padded so packets can be stored
+  typedef typename AccType<DType>::type AType;
+  Tensor<cpu, 2, AType> acc(Shape2(nthread, eshape[1]));
+  AllocSpace(&acc, true);
+  MapRedCPUEngine<Reducer, E, DType>::KeepLowest(exp.self(), acc, eshape[0], eshape[1]);
   expr::Plan<R, DType> dplan = MakePlan(dst->self());
-  expr::Plan<E, DType> splan = MakePlan(exp.self());
   for (index_t x = 0; x < eshape[1]; ++x) {
-    DType res = splan.Eval(0, x);
-    for (index_t y = 1; y < eshape[0]; ++y) {
-      Reducer::Reduce(res, splan.Eval(y, x));
-    }
-    Saver::template Save<DType>(dplan.REval(0, x), res * scale);
+    Saver::template Save<DType>(dplan.REval(0, x), DType(acc[0][x] * AType(scale)));
   }
+  FreeSpace(&acc);
 }
 
 template<typename Saver, typename Reducer, int dimkeep,
@@ -231,52 +603,346 @@ template<typename Saver, typename Reducer, int dimkeep,
 inline void MapReduceKeepHighDim(TRValue<R, cpu, 1, DType> *dst,
                                  const expr::Exp<E, DType, etype> &exp,
                                  DType scale) {
+  WaitPushedTasks(expr::StreamInfo<cpu, R>::Get(dst->self()));
   expr::TypeCheckPass<expr::TypeCheck<cpu, dimkeep, DType, E>::kRedPass>
       ::Error_TypeCheck_Not_Pass_For_Reduce_Exp();
   typedef Shape<expr::ExpInfo<E>::kDim> EShape;
   EShape eshape = expr::ShapeCheck<expr::ExpInfo<E>::kDim, E>
       ::Check(exp.self());
   Shape<1> dshape = expr::ShapeCheck<1, R>::Check(dst->self());
-  CHECK_EQ(eshape[dimkeep], dshape[0])
+  MSHADOW_CHECK_SHAPE_EQ(eshape[dimkeep], dshape[0])
     << "MapReduceKeepHighDim::reduction dimension do not match";
   // use equvalent form
   Shape<4> pshape = Shape4(eshape.ProdShape(0, dimkeep),
                            eshape[dimkeep],
                            eshape.ProdShape(dimkeep + 1, EShape::kSubdim),
                            eshape[EShape::kSubdim]);
+  if (pshape[1] == 0) return;
+  MSHADOW_PROFILE_SCOPE(kReduceKeepHighDim, profiler::TypeName<E>(), eshape,
+                        sizeof(DType) * eshape.Size());
   // execution
+  const int nthread =
+      GetNumParallelThread(expr::StreamInfo<cpu, R>::Get(dst->self()), pshape.Size());
+  typedef typename AccType<DType>::type AType;
+  std::vector<AType> res(pshape[1]);
+  MapRedCPUEngine<Reducer, E, DType>::KeepHighDim(exp.self(), pshape, nthread, &res[0]);
   expr::Plan<R, DType> dplan = MakePlan(dst->self());
-  expr::Plan<E, DType> splan = MakePlan(exp.self());
   for (index_t c = 0; c < pshape[1]; ++c) {
-    DType res; Reducer::SetInitValue(res);
-    for (index_t n = 0; n < pshape[0]; ++n) {
-      DType tres; Reducer::SetInitValue(tres);
-      for (index_t y = 0; y < pshape[2]; ++y) {
-        for (index_t x = 0; x < pshape[3]; ++x) {
-          Reducer::Reduce(tres,
-                          splan.Eval((n * pshape[1] + c) * pshape[2] + y, x));
+    Saver::template Save<DType>(dplan.REval(0, c), DType(res[c] * AType(scale)));
+  }
+}
+
+/*!
+ * \brief reduce_with_axis of a plain tensor with the given row kernel,
+ *  see ReduceWithAxis, acc keeps the partial results of each thread
+ */
+template<typename SV, typename Reducer, typename Kernel, typename DType, typename AType>
+inline void ReduceWithAxisRun(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 2, DType> &src,
+                              index_t size, index_t trailing, Tensor<cpu, 2, AType> acc) {
+  const index_t nthread = acc.size(0), last = src.size(1);
+  if (trailing == 1 && size == last) {
+    // the axis is the last one: every source row gives one output
+    const index_t nrow = src.size(0), dlast = dst.size(1);
+    const Kernel kernel(src);
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t i = 0; i < nthread; ++i) {
+      const index_t tid = static_cast<index_t>(i);
+      for (index_t y = nrow * tid / nthread; y < nrow * (tid + 1) / nthread; ++y) {
+        AType res; Reducer::SetInitValue(res);
+        kernel.ReduceAll(res, y, y + 1, size);
+        SV::template Save<DType>(dst.dptr_[(y / dlast) * dst.stride_ + y % dlast], DType(res));
+      }
+    }
+    return;
+  }
+  // output row u reduces the source rows base(u) + k * nstep for k in [0, size)
+  const index_t nstep = trailing / last, nout = dst.size(0);
+  const index_t tile = std::max(
+      index_t(1), packet::UpperAlign<DType, MSHADOW_DEFAULT_PACKET>(4096 / sizeof(DType)));
+  const index_t ntile = (last + tile - 1) / tile, nitem = nout * ntile;
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < nthread; ++i) {
+    const index_t tid = static_cast<index_t>(i);
+    AType *pacc = acc[tid].dptr_;
+    for (index_t item = nitem * tid / nthread; item < nitem * (tid + 1) / nthread; ++item) {
+      const index_t u = item / ntile, xbegin = (item % ntile) * tile;
+      const index_t xend = std::min(xbegin + tile, last);
+      const index_t base = (u / nstep) * size * nstep + u % nstep;
+      const Kernel kernel(Tensor<cpu, 2, DType>(src.dptr_ + base * src.stride_,
+                                                Shape2(size, last), nstep * src.stride_,
+                                                src.stream_));
+      kernel.ReduceRows(pacc, 0, size, xbegin, xend);
+      DType *drow = dst.dptr_ + u * dst.stride_;
+      for (index_t x = xbegin; x < xend; ++x) {
+        SV::template Save<DType>(drow[x], DType(pacc[x]));
+      }
+    }
+  }
+}
+/*! \brief picks the packet row kernel for reduce_with_axis when it applies */
+template<typename Reducer, typename DType,
+         bool pass = expr::PacketCheck<Tensor<cpu, 2, DType>, MSHADOW_DEFAULT_PACKET>::kPass &&
+         packet::PacketReducer<Reducer, typename AccType<DType>::type,
+                               MSHADOW_DEFAULT_PACKET>::kEnabled>
+struct ReduceWithAxisCPUEngine {
+  typedef typename AccType<DType>::type AType;
+  template<typename SV>
+  inline static void Run(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 2, DType> &src,
+                         index_t size, index_t trailing, Tensor<cpu, 2, AType> acc) {
+    ReduceWithAxisRun<SV, Reducer, MapRedRowKernel<Reducer, Tensor<cpu, 2, DType>, DType> >
+        (dst, src, size, trailing, acc);
+  }
+};
+template<typename Reducer, typename DType>
+struct ReduceWithAxisCPUEngine<Reducer, DType, true> {
+  typedef typename AccType<DType>::type AType;
+  template<typename SV>
+  inline static void Run(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 2, DType> &src,
+                         index_t size, index_t trailing, Tensor<cpu, 2, AType> acc) {
+    typedef MapRedRowPacketKernel<Reducer, Tensor<cpu, 2, DType>, DType> Kernel;
+    if (Kernel::Check(src)) {
+      ReduceWithAxisRun<SV, Reducer, Kernel>(dst, src, size, trailing, acc);
+    } else {
+      ReduceWithAxisCPUEngine<Reducer, DType, false>::template Run<SV>(
+          dst, src, size, trailing, acc);
+    }
+  }
+};
+/*!
+ * \brief reduce_with_axis with mask, saves the position along the axis of the last
+ *  element that changed the result, the same as the plan of ReduceWithAxisExp
+ */
+template<typename SV, typename Reducer, typename DType>
+inline void ReduceWithAxisIndex(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 2, DType> &src,
+                                index_t size, index_t trailing, index_t nthread) {
+  const index_t last = src.size(1);
+  if (trailing == 1 && size == last) {
+    const index_t nrow = src.size(0), dlast = dst.size(1);
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t i = 0; i < nrow; ++i) {
+      const index_t y = static_cast<index_t>(i);
+      const DType *srow = src.dptr_ + y * src.stride_;
+      DType res; Reducer::SetInitValue(res);
+      index_t idx = 0;
+      for (index_t k = 0; k < size; ++k) {
+        DType tmp = res;
+        Reducer::Reduce(res, srow[k]);
+        if (tmp != res) idx = k;
+      }
+      SV::template Save<DType>(dst.dptr_[(y / dlast) * dst.stride_ + y % dlast],
+                               static_cast<DType>(static_cast<int>(idx)));
+    }
+    return;
+  }
+  const index_t nstep = trailing / last, nout = dst.size(0);
+  const index_t tile = std::max(index_t(1), index_t(4096 / sizeof(DType)));
+  const index_t ntile = (last + tile - 1) / tile, nitem = nout * ntile;
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < nthread; ++i) {
+    const index_t tid = static_cast<index_t>(i);
+    std::vector<DType> val(std::min(tile, last));
+    std::vector<index_t> idx(val.size());
+    for (index_t item = nitem * tid / nthread; item < nitem * (tid + 1) / nthread; ++item) {
+      const index_t u = item / ntile, xbegin = (item % ntile) * tile;
+      const index_t n = std::min(xbegin + tile, last) - xbegin;
+      const index_t base = (u / nstep) * size * nstep + u % nstep;
+      for (index_t x = 0; x < n; ++x) {
+        Reducer::SetInitValue(val[x]); idx[x] = 0;
+      }
+      for (index_t k = 0; k < size; ++k) {
+        const DType *srow = src.dptr_ + (base + k * nstep) * src.stride_ + xbegin;
+        for (index_t x = 0; x < n; ++x) {
+          DType tmp = val[x];
+          Reducer::Reduce(val[x], srow[x]);
+          if (tmp != val[x]) idx[x] = k;
         }
       }
-      Reducer::Reduce(res, tres);
+      DType *drow = dst.dptr_ + u * dst.stride_ + xbegin;
+      for (index_t x = 0; x < n; ++x) {
+        SV::template Save<DType>(drow[x], static_cast<DType>(static_cast<int>(idx[x])));
+      }
     }
-    Saver::template Save<DType>(dplan.REval(0, c), DType(res * scale));
   }
 }
+template<typename SV, typename Reducer, bool mask, typename DType>
+inline void ReduceWithAxis(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 2, DType> &src,
+                           index_t size, index_t trailing) {
+  const index_t nthread = static_cast<index_t>(std::min(static_cast<size_t>(
+      GetNumParallelThread(dst.stream_, src.shape_.Size())), dst.shape_.Size()));
+  if (mask) {
+    ReduceWithAxisIndex<SV, Reducer>(dst, src, size, trailing, nthread);
+    return;
+  }
+  // one row of partial results per thread, padded so packets can be stored
+  typedef typename AccType<DType>::type AType;
+  Tensor<cpu, 2, AType> acc(Shape2(nthread, src.size(1)));
+  AllocSpace(&acc, true);
+  ReduceWithAxisCPUEngine<Reducer, DType>::template Run<SV>(dst, src, size, trailing, acc);
+  FreeSpace(&acc);
+}
 
+/*!
+ * \brief kernels of the softmax of a row, or of the columns of a matrix: an online pass
+ *  keeps the running max m and the sum s of exp(x - m), rescaling s when m grows, so the
+ *  input is read once for both and each element costs one exp. Partial results are kept
+ *  in AccType<DType>::type, float uses the packet exp.
+ */
+template<typename DType,
+         bool pass = expr::PacketCheck<DType, MSHADOW_DEFAULT_PACKET>::kPass &&
+             packet::TranscendentalCheck<DType, MSHADOW_DEFAULT_PACKET>::kPass>
+struct SoftmaxRowKernel {
+  typedef typename AccType<DType>::type AType;
+  /*! \brief fold x into the running pair (m, s) */
+  MSHADOW_XINLINE static void Step(AType x, AType *m, AType *s) {
+    if (x > *m) {
+      *s = *s * std::exp(*m - x) + AType(1.0f);
+      *m = x;
+    } else {
+      *s += std::exp(x - *m);
+    }
+  }
+  /*! \brief m and s of src[0, n) */
+  inline static void Reduce(const DType *src, index_t n, AType *m, AType *s) {
+    *m = -std::numeric_limits<AType>::max();
+    *s = AType(0.0f);
+    for (index_t i = 0; i < n; ++i) Step(AType(src[i]), m, s);
+  }
+  /*! \brief fold src[i] into (m[i], s[i]) for i < n */
+  inline static void Update(const DType *src, index_t n, AType *m, AType *s) {
+    for (index_t i = 0; i < n; ++i) Step(AType(src[i]), m + i, s + i);
+  }
+  /*! \brief dst[i] = exp(src[i] - m) * scale for i < n */
+  inline static void Exp(DType *dst, const DType *src, index_t n, AType m, AType scale) {
+    for (index_t i = 0; i < n; ++i) dst[i] = DType(std::exp(AType(src[i]) - m) * scale);
+  }
+  /*! \brief dst[i] = exp(src[i] - m[i]) * scale[i] for i < n */
+  inline static void Exp(DType *dst, const DType *src, index_t n,
+                         const AType *m, const AType *scale) {
+    for (index_t i = 0; i < n; ++i) dst[i] = DType(std::exp(AType(src[i]) - m[i]) * scale[i]);
+  }
+  /*! \brief sum of src[0, n) */
+  inline static AType Sum(const DType *src, index_t n) {
+    AType sum = AType(0.0f);
+    for (index_t i = 0; i < n; ++i) sum += AType(src[i]);
+    return sum;
+  }
+  /*! \brief dst[i] = grad[i] - exp(src[i]) * sum for i < n */
+  inline static void LogGrad(DType *dst, const DType *src, const DType *grad,
+                             index_t n, AType sum) {
+    for (index_t i = 0; i < n; ++i) {
+      dst[i] = DType(AType(grad[i]) - std::exp(AType(src[i])) * sum);
+    }
+  }
+};
 template<typename DType>
-inline void Softmax(Tensor<cpu, 1, DType> dst,
-                    const Tensor<cpu, 1, DType> &energy) {
-  DType mmax = energy[0];
-  for (index_t x = 1; x < dst.size(0); ++x) {
-    if (mmax < energy[x]) mmax = energy[x];
+struct SoftmaxRowKernel<DType, true> : public SoftmaxRowKernel<DType, false> {
+  typedef SoftmaxRowKernel<DType, false> Base;
+  typedef packet::Packet<DType, MSHADOW_DEFAULT_PACKET> TPacket;
+  static const index_t kSize = TPacket::kSize;
+  /*! \brief the online step of each lane, the exp is of -|x - m| */
+  MSHADOW_CINLINE static void Step(const TPacket &x, TPacket *m, TPacket *s) {
+    const TPacket d = x - *m;
+    const TPacket e = packet::Exp(packet::Min(d, TPacket::Fill(DType(0.0f)) - d));
+    *s = packet::SelectLT(*m, x, *s * e + TPacket::Fill(DType(1.0f)), *s + e);
+    *m = packet::Max(*m, x);
   }
-  DType sum = DType(0.0f);
-  for (index_t x = 0; x < dst.size(0); ++x) {
-    dst[x] = std::exp(energy[x] - mmax);
-    sum += dst[x];
+  inline static void Reduce(const DType *src, index_t n, DType *m, DType *s) {
+    const index_t xend = packet::LowerAlign<DType, MSHADOW_DEFAULT_PACKET>(n);
+    if (xend == 0) {
+      Base::Reduce(src, n, m, s);
+      return;
+    }
+    TPacket pm = TPacket::Fill(-std::numeric_limits<DType>::max());
+    TPacket ps = TPacket::Fill(DType(0.0f));
+    for (index_t i = 0; i < xend; i += kSize) {
+      Step(TPacket::LoadUnAligned(src + i), &pm, &ps);
+    }
+    // merge the lanes at their max, then the rest of the row
+    alignas(64) DType lane[kSize];
+    pm.Store(lane);
+    DType mmax = lane[0];
+    for (index_t i = 1; i < kSize; ++i) mmax = std::max(mmax, lane[i]);
+    *m = mmax;
+    *s = (ps * packet::Exp(pm - TPacket::Fill(mmax))).Sum();
+    for (index_t i = xend; i < n; ++i) Base::Step(src[i], m, s);
+  }
+  inline static void Update(const DType *src, index_t n, DType *m, DType *s) {
+    // m and s are aligned
+    const index_t xend = packet::LowerAlign<DType, MSHADOW_DEFAULT_PACKET>(n);
+    for (index_t i = 0; i < xend; i += kSize) {
+      TPacket pm = TPacket::Load(m + i), ps = TPacket::Load(s + i);
+      Step(TPacket::LoadUnAligned(src + i), &pm, &ps);
+      pm.Store(m + i);
+      ps.Store(s + i);
+    }
+    Base::Update(src + xend, n - xend, m + xend, s + xend);
+  }
+  inline static void Exp(DType *dst, const DType *src, index_t n, DType m, DType scale) {
+    // walk dst up to its alignment, src is loaded unaligned
+    index_t i = 0;
+    for (; i < n && !packet::CheckAlign<MSHADOW_DEFAULT_PACKET>(dst + i); ++i) {
+      dst[i] = std::exp(src[i] - m) * scale;
+    }
+    const index_t xend = i + packet::LowerAlign<DType, MSHADOW_DEFAULT_PACKET>(n - i);
+    const TPacket pm = TPacket::Fill(m), pscale = TPacket::Fill(scale);
+    for (; i < xend; i += kSize) {
+      (packet::Exp(TPacket::LoadUnAligned(src + i) - pm) * pscale).Store(dst + i);
+    }
+    Base::Exp(dst + xend, src + xend, n - xend, m, scale);
   }
+  inline static void Exp(DType *dst, const DType *src, index_t n,
+                         const DType *m, const DType *scale) {
+    // dst is aligned, as m and scale
+    const index_t xend = packet::LowerAlign<DType, MSHADOW_DEFAULT_PACKET>(n);
+    for (index_t i = 0; i < xend; i += kSize) {
+      (packet::Exp(TPacket::LoadUnAligned(src + i) - TPacket::Load(m + i)) *
+       TPacket::Load(scale + i)).Store(dst + i);
+    }
+    Base::Exp(dst + xend, src + xend, n - xend, m + xend, scale + xend);
+  }
+  inline static DType Sum(const DType *src, index_t n) {
+    const index_t xend = packet::LowerAlign<DType, MSHADOW_DEFAULT_PACKET>(n);
+    TPacket sum = TPacket::Fill(DType(0.0f));
+    for (index_t i = 0; i < xend; i += kSize) sum = sum + TPacket::LoadUnAligned(src + i);
+    return sum.Sum() + Base::Sum(src + xend, n - xend);
+  }
+  inline static void LogGrad(DType *dst, const DType *src, const DType *grad,
+                             index_t n, DType sum) {
+    index_t i = 0;
+    for (; i < n && !packet::CheckAlign<MSHADOW_DEFAULT_PACKET>(dst + i); ++i) {
+      dst[i] = grad[i] - std::exp(src[i]) * sum;
+    }
+    const index_t xend = i + packet::LowerAlign<DType, MSHADOW_DEFAULT_PACKET>(n - i);
+    const TPacket psum = TPacket::Fill(sum);
+    for (; i < xend; i += kSize) {
+      (TPacket::LoadUnAligned(grad + i) -
+       packet::Exp(TPacket::LoadUnAligned(src + i)) * psum).Store(dst + i);
+    }
+    Base::LogGrad(dst + xend, src + xend, grad + xend, n - xend, sum);
+  }
+};
+
+template<typename DType>
+inline void Softmax(Tensor<cpu, 1, DType> dst,
+                    const Tensor<cpu, 1, DType> &energy) {
+  WaitPushedTasks(dst.stream_);
+  typedef SoftmaxRowKernel<DType> Kernel;
+  typename Kernel::AType m, s;
+  Kernel::Reduce(energy.dptr_, energy.size(0), &m, &s);
+  Kernel::Exp(dst.dptr_, energy.dptr_, dst.size(0), m, typename Kernel::AType(1.0f) / s);
+}
+
+template<typename DType>
+inline void LogSoftmax(Tensor<cpu, 1, DType> dst,
+                       const Tensor<cpu, 1, DType> &energy) {
+  WaitPushedTasks(dst.stream_);
+  typedef typename SoftmaxRowKernel<DType>::AType AType;
+  AType m, s;
+  SoftmaxRowKernel<DType>::Reduce(energy.dptr_, energy.size(0), &m, &s);
+  // the log of the normalizer is taken once, the row is not exponentiated again
+  const AType shift = m + std::log(s);
   for (index_t x = 0; x < dst.size(0); ++x) {
-    dst[x] /= sum;
+    dst[x] = DType(AType(energy[x]) - shift);
   }
 }
 
@@ -284,6 +950,7 @@ template<typename DType>
 inline void SoftmaxGrad(Tensor<cpu, 2, DType> dst,
                         const Tensor<cpu, 2, DType> &src,
                         const Tensor<cpu, 1, DType> &label) {
+  WaitPushedTasks(dst.stream_);
 #pragma omp parallel for
   for (openmp_index_t y = 0; y < dst.size(0); ++y) {
     const index_t k = static_cast<int>(label[y]);
@@ -302,6 +969,7 @@ inline void SoftmaxGrad(Tensor<cpu, 2, DType> dst,
                         const Tensor<cpu, 2, DType> &src,
                         const Tensor<cpu, 1, DType> &label,
                         const DType &ignore_label) {
+  WaitPushedTasks(dst.stream_);
 #pragma omp parallel for
   for (openmp_index_t y = 0; y < dst.size(0); ++y) {
     const index_t k = static_cast<int>(label[y]);
@@ -323,6 +991,7 @@ template<typename DType>
 inline void SoftmaxGrad(Tensor<cpu, 3, DType> dst,
                         const Tensor<cpu, 3, DType> &src,
                         const Tensor<cpu, 2, DType> &label) {
+  WaitPushedTasks(dst.stream_);
 #pragma omp parallel for
   for (openmp_index_t n = 0; n < dst.size(2); ++n) {
     for (index_t y = 0; y < dst.size(0); ++y) {
@@ -343,6 +1012,7 @@ inline void SoftmaxGrad(Tensor<cpu, 3, DType> dst,
                         const Tensor<cpu, 3, DType> &src,
                         const Tensor<cpu, 2, DType> &label,
                         const DType &ignore_label) {
+  WaitPushedTasks(dst.stream_);
 #pragma omp parallel for
   for (openmp_index_t n = 0; n < dst.size(2); ++n) {
     for (index_t y = 0; y < dst.size(0); ++y) {
@@ -367,33 +1037,286 @@ inline void SoftmaxGrad(Tensor<cpu, 3, DType> dst,
 template<typename DType>
 inline void Softmax(Tensor<cpu, 2, DType> dst,
                     const Tensor<cpu, 2, DType> &energy) {
+  WaitPushedTasks(dst.stream_);
   CHECK_EQ(dst.shape_, energy.shape_) << "Softmax: shape mismatch";
-#pragma omp parallel for
+  MSHADOW_PROFILE_SCOPE(kSoftmax, "cpu", dst.shape_, 2 * sizeof(DType) * dst.shape_.Size());
+  if (dst.size(1) == 0) return;
+  const int nthread = GetNumParallelThread(dst.stream_, dst.shape_.Size());
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
   for (openmp_index_t y = 0; y < dst.size(0); ++y) {
     Softmax(dst[y], energy[y]);
   }
 }
 
+template<typename DType>
+inline void LogSoftmax(Tensor<cpu, 2, DType> dst,
+                       const Tensor<cpu, 2, DType> &energy) {
+  WaitPushedTasks(dst.stream_);
+  CHECK_EQ(dst.shape_, energy.shape_) << "LogSoftmax: shape mismatch";
+  MSHADOW_PROFILE_SCOPE(kSoftmax, "cpu", dst.shape_, 2 * sizeof(DType) * dst.shape_.Size());
+  if (dst.size(1) == 0) return;
+  const int nthread = GetNumParallelThread(dst.stream_, dst.shape_.Size());
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t y = 0; y < dst.size(0); ++y) {
+    LogSoftmax(dst[y], energy[y]);
+  }
+}
+
+template<typename DType>
+inline void LogSoftmaxGrad(Tensor<cpu, 2, DType> dst,
+                           const Tensor<cpu, 2, DType> &src,
+                           const Tensor<cpu, 2, DType> &grad) {
+  WaitPushedTasks(dst.stream_);
+  CHECK_EQ(dst.shape_, src.shape_) << "LogSoftmaxGrad: shape mismatch";
+  CHECK_EQ(grad.shape_, src.shape_) << "LogSoftmaxGrad: grad shape mismatch";
+  typedef SoftmaxRowKernel<DType> Kernel;
+  const index_t xmax = dst.size(1);
+  const int nthread = GetNumParallelThread(dst.stream_, dst.shape_.Size());
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t y = 0; y < dst.size(0); ++y) {
+    Kernel::LogGrad(dst[y].dptr_, src[y].dptr_, grad[y].dptr_, xmax,
+                    Kernel::Sum(grad[y].dptr_, xmax));
+  }
+}
+
+// softmax cross entropy of one row, writes the gradient and returns the loss
+template<typename DType>
+inline DType SoftmaxCrossEntropyRow(Tensor<cpu, 1, DType> grad,
+                                    const Tensor<cpu, 1, DType> &energy,
+                                    int64_t k) {
+  typedef SoftmaxRowKernel<DType> Kernel;
+  typedef typename Kernel::AType AType;
+  const index_t xmax = energy.size(0);
+  AType m, s;
+  Kernel::Reduce(energy.dptr_, xmax, &m, &s);
+  // the energy of the label is read before grad overwrites it in place
+  const bool valid = k >= 0 && k < static_cast<int64_t>(xmax);
+  const AType ek = valid ? AType(energy[k]) : AType(0.0f);
+  Kernel::Exp(grad.dptr_, energy.dptr_, xmax, m, AType(1.0f) / s);
+  if (!valid) return DType(0.0f);
+  grad[k] -= DType(1.0f);
+  return DType(std::log(s) + m - ek);
+}
+
+template<typename DType, typename IndexType>
+inline void SoftmaxCrossEntropy(Tensor<cpu, 2, DType> grad,
+                                Tensor<cpu, 1, DType> loss,
+                                const Tensor<cpu, 2, DType> &energy,
+                                const Tensor<cpu, 1, IndexType> &label) {
+  WaitPushedTasks(grad.stream_);
+  CHECK_EQ(grad.shape_, energy.shape_) << "SoftmaxCrossEntropy: shape mismatch";
+  CHECK_EQ(loss.size(0), energy.size(0)) << "SoftmaxCrossEntropy: loss shape mismatch";
+  CHECK_EQ(label.size(0), energy.size(0)) << "SoftmaxCrossEntropy: label shape mismatch";
+  if (energy.size(1) == 0) {
+    // no class, the label is out of range and the gradient is empty
+    loss = DType(0.0f);
+    return;
+  }
+  const int nthread = GetNumParallelThread(grad.stream_, energy.shape_.Size());
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t y = 0; y < energy.size(0); ++y) {
+    loss[y] = SoftmaxCrossEntropyRow(grad[y], energy[y], static_cast<int64_t>(label[y]));
+  }
+}
+
+template<typename DType, typename IndexType>
+inline void SoftmaxCrossEntropy(Tensor<cpu, 2, DType> grad,
+                                Tensor<cpu, 1, DType> loss,
+                                const Tensor<cpu, 2, DType> &energy,
+                                const Tensor<cpu, 1, IndexType> &label,
+                                const IndexType &ignore_label) {
+  WaitPushedTasks(grad.stream_);
+  CHECK_EQ(grad.shape_, energy.shape_) << "SoftmaxCrossEntropy: shape mismatch";
+  CHECK_EQ(loss.size(0), energy.size(0)) << "SoftmaxCrossEntropy: loss shape mismatch";
+  CHECK_EQ(label.size(0), energy.size(0)) << "SoftmaxCrossEntropy: label shape mismatch";
+  if (energy.size(1) == 0) {
+    // no class, the label is out of range and the gradient is empty
+    loss = DType(0.0f);
+    return;
+  }
+  const int nthread = GetNumParallelThread(grad.stream_, energy.shape_.Size());
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t y = 0; y < energy.size(0); ++y) {
+    const int64_t k = static_cast<int64_t>(label[y]);
+    if (k == static_cast<int64_t>(ignore_label)) {
+      for (index_t x = 0; x < grad.size(1); ++x) grad[y][x] = DType(0.0f);
+      loss[y] = DType(0.0f);
+    } else {
+      loss[y] = SoftmaxCrossEntropyRow(grad[y], energy[y], k);
+    }
+  }
+}
+
 template<typename DType>
 inline void Softmax(Tensor<cpu, 3, DType> dst,
                     const Tensor<cpu, 3, DType> &energy) {
+  WaitPushedTasks(dst.stream_);
   CHECK_EQ(dst.shape_, energy.shape_) << "Softmax: shape mismatch";
-#pragma omp parallel for
-  for (openmp_index_t y = 0; y < dst.size(0); ++y) {
-    for (index_t n = 0; n < dst.size(2); ++n) {
-      DType mmax = energy[y][0][n];
-      for (index_t x = 1; x < dst.size(1); ++x) {
-        if (mmax < energy[y][x][n]) mmax = energy[y][x][n];
+  MSHADOW_PROFILE_SCOPE(kSoftmax, "cpu", dst.shape_, 2 * sizeof(DType) * dst.shape_.Size());
+  typedef SoftmaxRowKernel<DType> Kernel;
+  typedef typename Kernel::AType AType;
+  const index_t xmax = dst.size(1), nmax = dst.size(2);
+  if (xmax == 0 || nmax == 0) return;
+  const int nthread = std::min(GetNumParallelThread(dst.stream_, dst.shape_.Size()),
+                               static_cast<int>(std::max(dst.size(0), index_t(1))));
+  // the softmax runs over x for each n: the rows of x are read whole while every n keeps
+  // its own running pair, in the aligned rows of buf, and rows of dst that are not aligned
+  // are written through out
+  #pragma omp parallel num_threads(nthread) if (nthread > 1)
+  {
+    Tensor<cpu, 2, AType> buf(Shape2(2, nmax));
+    Tensor<cpu, 1, DType> out(Shape1(nmax));
+    AllocSpace(&buf, true);
+    AllocSpace(&out, true);
+    AType *m = buf[0].dptr_, *s = buf[1].dptr_;
+    #pragma omp for schedule(static)
+    for (openmp_index_t y = 0; y < dst.size(0); ++y) {
+      for (index_t n = 0; n < nmax; ++n) {
+        m[n] = -std::numeric_limits<AType>::max();
+        s[n] = AType(0.0f);
       }
-      DType sum = DType(0.0f);
-      for (index_t x = 0; x < dst.size(1); ++x) {
-        dst[y][x][n] = std::exp(energy[y][x][n] - mmax);
-        sum += dst[y][x][n];
+      for (index_t x = 0; x < xmax; ++x) {
+        Kernel::Update(energy[y][x].dptr_, nmax, m, s);
       }
-      for (index_t x = 0; x < dst.size(1); ++x) {
-        dst[y][x][n] /= sum;
+      for (index_t n = 0; n < nmax; ++n) s[n] = AType(1.0f) / s[n];
+      for (index_t x = 0; x < xmax; ++x) {
+        DType *row = dst[y][x].dptr_;
+        if (packet::CheckAlign<MSHADOW_DEFAULT_PACKET>(row)) {
+          Kernel::Exp(row, energy[y][x].dptr_, nmax, m, s);
+        } else {
+          Kernel::Exp(out.dptr_, energy[y][x].dptr_, nmax, m, s);
+          std::copy(out.dptr_, out.dptr_ + nmax, row);
+        }
       }
     }
+    FreeSpace(&out);
+    FreeSpace(&buf);
+  }
+}
+
+/*! \brief dst[i] += src[i] for i < n, with packets when DType has them */
+template<typename DType,
+         bool pass = expr::PacketCheck<DType, MSHADOW_DEFAULT_PACKET>::kPass>
+struct RowAccumulate {
+  inline static void Run(DType *dst, const DType *src, index_t n) {
+    for (index_t i = 0; i < n; ++i) dst[i] += src[i];
+  }
+};
+template<typename DType>
+struct RowAccumulate<DType, true> {
+  inline static void Run(DType *dst, const DType *src, index_t n) {
+    typedef packet::Packet<DType, MSHADOW_DEFAULT_PACKET> TPacket;
+    // walk dst up to its alignment, src is loaded unaligned
+    index_t i = 0;
+    for (; i < n && !packet::CheckAlign<MSHADOW_DEFAULT_PACKET>(dst + i); ++i) {
+      dst[i] += src[i];
+    }
+    const index_t xend = i + packet::LowerAlign<DType, MSHADOW_DEFAULT_PACKET>(n - i);
+    for (; i < xend; i += TPacket::kSize) {
+      (TPacket::Load(dst + i) + TPacket::LoadUnAligned(src + i)).Store(dst + i);
+    }
+    for (; i < n; ++i) dst[i] += src[i];
+  }
+};
+/*!
+ * \brief dst[drow[y]] += src[srow == NULL ? y : srow[y]] for every y.
+ *  Each thread owns the rows of dst with the same id modulo the number of threads
+ *  and adds to them in the order of y, so no row is shared and the result is the same
+ *  as the serial loop.
+ */
+template<typename IndexType, typename DType>
+inline void AddRowsByIndex(Tensor<cpu, 2, DType> dst, const Tensor<cpu, 1, IndexType> &drow,
+                           const IndexType *srow, const Tensor<cpu, 2, DType> &src) {
+  const index_t n = drow.size(0), ncol = src.size(1);
+  CHECK_EQ(dst.size(1), ncol) << "AddTakeGrad: the rows of dst and src differ in size";
+  const index_t nthread = std::min(static_cast<index_t>(GetNumParallelThread(
+      dst.stream_, static_cast<size_t>(n) * ncol)), std::max(dst.size(0), index_t(1)));
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t tid = 0; tid < nthread; ++tid) {
+    for (index_t y = 0; y < n; ++y) {
+      const index_t row = static_cast<index_t>(drow[y]);
+      if (row % nthread != tid) continue;
+      const index_t from = srow == NULL ? y : static_cast<index_t>(srow[y]);
+      RowAccumulate<DType>::Run(dst[row].dptr_, src[from].dptr_, ncol);
+    }
+  }
+}
+
+/*! \brief number of indices ahead whose rows Take and TakeBag prefetch */
+const index_t kTakePrefetchDist = 16;
+/*! \brief prefetch the ncol elements of a row */
+template<typename DType>
+inline void PrefetchRow(const DType *row, index_t ncol) {
+  const char *p = reinterpret_cast<const char*>(row);
+  for (size_t off = 0; off < ncol * sizeof(DType); off += 64) {
+    MSHADOW_PREFETCH(p + off);
+  }
+}
+
+template<typename SV, typename IndexType, typename DType>
+inline void Take(Tensor<cpu, 2, DType> dst,
+                 const Tensor<cpu, 1, IndexType> &index,
+                 const Tensor<cpu, 2, DType> &src) {
+  WaitPushedTasks(dst.stream_);
+  CHECK_EQ(dst.size(0), index.size(0)) << "Take: one row of dst per index";
+  CHECK_EQ(dst.size(1), src.size(1)) << "Take: the rows of dst and src differ";
+  const index_t n = index.size(0), ncol = src.size(1);
+  const int nthread = GetNumParallelThread(dst.stream_, dst.shape_.Size());
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t i = 0; i < n; ++i) {
+    const index_t y = static_cast<index_t>(i);
+    // the table is usually far larger than the cache, start loading the rows ahead
+    if (y + kTakePrefetchDist < n) {
+      PrefetchRow(src.dptr_ + static_cast<index_t>(index[y + kTakePrefetchDist]) * src.stride_,
+                  ncol);
+    }
+    const DType *srow = src.dptr_ + static_cast<index_t>(index[y]) * src.stride_;
+    DType *drow = dst.dptr_ + y * dst.stride_;
+    if (std::is_same<SV, sv::saveto>::value) {
+      memcpy(drow, srow, sizeof(DType) * ncol);
+    } else {
+      for (index_t x = 0; x < ncol; ++x) SV::template Save<DType>(drow[x], srow[x]);
+    }
+  }
+}
+
+template<typename SV, typename IndexType, typename DType>
+inline void TakeBag(Tensor<cpu, 2, DType> dst,
+                    const Tensor<cpu, 1, IndexType> &index,
+                    const Tensor<cpu, 1, IndexType> &offset,
+                    const Tensor<cpu, 2, DType> &src, bool mean) {
+  WaitPushedTasks(dst.stream_);
+  CHECK_EQ(dst.size(0), offset.size(0)) << "TakeBag: one row of dst per bag";
+  CHECK_EQ(dst.size(1), src.size(1)) << "TakeBag: the rows of dst and src differ";
+  typedef typename AccType<DType>::type AType;
+  const index_t nbag = offset.size(0), n = index.size(0), ncol = src.size(1);
+  for (index_t b = 0; b < nbag; ++b) {
+    const index_t end = b + 1 < nbag ? static_cast<index_t>(offset[b + 1]) : n;
+    CHECK(static_cast<index_t>(offset[b]) <= end && end <= n)
+        << "TakeBag: offsets must be non decreasing and within index";
+  }
+  const index_t nthread = std::min(static_cast<index_t>(
+      GetNumParallelThread(dst.stream_, static_cast<size_t>(n) * ncol)), nbag);
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t t = 0; t < nthread; ++t) {
+    const index_t tid = static_cast<index_t>(t);
+    std::vector<AType> acc(ncol);
+    for (index_t b = nbag * tid / nthread; b < nbag * (tid + 1) / nthread; ++b) {
+      const index_t begin = static_cast<index_t>(offset[b]);
+      const index_t end = b + 1 < nbag ? static_cast<index_t>(offset[b + 1]) : n;
+      std::fill(acc.begin(), acc.end(), AType(0));
+      for (index_t i = begin; i < end; ++i) {
+        if (i + kTakePrefetchDist < n) {
+          PrefetchRow(src.dptr_ + static_cast<index_t>(index[i + kTakePrefetchDist]) *
+                      src.stride_, ncol);
+        }
+        const DType *srow = src.dptr_ + static_cast<index_t>(index[i]) * src.stride_;
+        for (index_t x = 0; x < ncol; ++x) acc[x] += AType(srow[x]);
+      }
+      const AType len = mean && end > begin ? AType(end - begin) : AType(1);
+      DType *drow = dst.dptr_ + b * dst.stride_;
+      for (index_t x = 0; x < ncol; ++x) SV::template Save<DType>(drow[x], DType(acc[x] / len));
+    }
   }
 }
 
@@ -401,9 +1324,8 @@ template<typename IndexType, typename DType>
 inline void AddTakeGrad(Tensor<cpu, 2, DType> dst,
                         const Tensor<cpu, 1, IndexType>& index,
                         const Tensor<cpu, 2, DType> &src) {
-  for (index_t y = 0; y < index.size(0); ++y) {
-    dst[index[y]] += src[y];
-  }
+  WaitPushedTasks(dst.stream_);
+  AddRowsByIndex(dst, index, static_cast<const IndexType*>(NULL), src);
 }
 
 template<typename IndexType, typename DType>
@@ -411,15 +1333,47 @@ inline void AddTakeGradLargeBatch(Tensor<cpu, 2, DType> dst,
                                   const Tensor<cpu, 1, IndexType>& sorted,
                                   const Tensor<cpu, 1, IndexType>& index,
                                   const Tensor<cpu, 2, DType> &src) {
-  for (index_t y = 0; y < sorted.size(0); ++y) {
-    dst[sorted[y]] += src[index[y]];
+  WaitPushedTasks(dst.stream_);
+  AddRowsByIndex(dst, sorted, index.dptr_, src);
+}
+
+template<typename IndexType, typename RType, typename DType>
+inline index_t TakeGradRowSparse(Tensor<cpu, 2, DType> grad,
+                                 Tensor<cpu, 1, RType> rows,
+                                 const Tensor<cpu, 1, IndexType> &index,
+                                 const Tensor<cpu, 2, DType> &src) {
+  WaitPushedTasks(grad.stream_);
+  const index_t n = index.size(0);
+  CHECK_EQ(src.size(0), n) << "TakeGradRowSparse: one row of src per index";
+  CHECK_EQ(grad.size(1), src.size(1)) << "TakeGradRowSparse: the rows of grad and src differ";
+  std::vector<index_t> uniq(n);
+  for (index_t y = 0; y < n; ++y) uniq[y] = static_cast<index_t>(index[y]);
+  std::sort(uniq.begin(), uniq.end());
+  const index_t nrow = static_cast<index_t>(std::unique(uniq.begin(), uniq.end()) - uniq.begin());
+  CHECK(grad.size(0) >= nrow && rows.size(0) >= nrow)
+      << "TakeGradRowSparse: grad and rows need room for " << nrow << " rows";
+  // the position of the row of each index among the touched rows
+  std::vector<index_t> slot(n);
+  const int nthread = GetNumParallelThread(grad.stream_, n);
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t y = 0; y < n; ++y) {
+    slot[y] = static_cast<index_t>(std::lower_bound(uniq.begin(), uniq.begin() + nrow,
+        static_cast<index_t>(index[y])) - uniq.begin());
+  }
+  for (index_t i = 0; i < nrow; ++i) {
+    rows[i] = static_cast<RType>(uniq[i]);
+    std::fill(grad[i].dptr_, grad[i].dptr_ + grad.size(1), DType(0.0f));
   }
+  AddRowsByIndex(grad.Slice(0, nrow), Tensor<cpu, 1, index_t>(slot.data(), Shape1(n)),
+                 static_cast<const index_t*>(NULL), src);
+  return nrow;
 }
 
 template<typename IndexType, typename DType>
 inline void IndexFill(Tensor<cpu, 2, DType> dst,
                       const Tensor<cpu, 1, IndexType>& index,
                       const Tensor<cpu, 2, DType> &src) {
+  WaitPushedTasks(dst.stream_);
   for (index_t y = 0; y < index.size(0); ++y) {
     for (index_t j = 0; j < src.size(1); j++) {
       dst[index[y]][j] = src[y][j];
@@ -427,42 +1381,334 @@ inline void IndexFill(Tensor<cpu, 2, DType> dst,
   }
 }
 
+/*!
+ * \brief maps a key to an unsigned integer of the same size that sorts in the same order,
+ *  keys without a mapping are sorted by comparison
+ */
+template<typename DType, typename Enable = void>
+struct RadixKey {
+  static const bool kPass = false;
+};
+template<typename DType>
+struct RadixKey<DType, typename std::enable_if<std::is_integral<DType>::value &&
+                                               !std::is_same<DType, bool>::value>::type> {
+  static const bool kPass = true;
+  typedef typename std::make_unsigned<DType>::type UType;
+  // flipping the sign bit puts the negative values first
+  static const UType kFlip = std::is_signed<DType>::value ?
+      static_cast<UType>(UType(1) << (sizeof(UType) * 8 - 1)) : UType(0);
+  inline static UType Encode(DType v) {
+    return static_cast<UType>(static_cast<UType>(v) ^ kFlip);
+  }
+};
+/*!
+ * \brief the order preserving mapping of the bits of an IEEE floating point number,
+ *  kInf is the bit pattern of +inf. -0 is mapped as +0 so the two keep their order like
+ *  in a comparison sort; NaN of either sign come after +inf.
+ */
+template<typename UType, UType kInf>
+struct RadixFloatBits {
+  static const UType kSign = static_cast<UType>(UType(1) << (sizeof(UType) * 8 - 1));
+  // the code of -inf, the codes below it are the negative NaN
+  static const UType kNegNaN = static_cast<UType>(~(kSign | kInf));
+  // negative values flip every bit so larger magnitudes come first, positive ones the sign,
+  // then the codes are rotated so the negative NaN wrap around to the end
+  inline static UType Encode(UType u) {
+    if (u == kSign) u = 0;
+    const UType e = (u & kSign) ? static_cast<UType>(~u) : static_cast<UType>(u | kSign);
+    return static_cast<UType>(e - kNegNaN);
+  }
+};
+template<>
+struct RadixKey<float> {
+  static const bool kPass = true;
+  typedef uint32_t UType;
+  inline static UType Encode(float v) {
+    UType u;
+    std::memcpy(&u, &v, sizeof(u));
+    return RadixFloatBits<UType, 0x7F800000U>::Encode(u);
+  }
+};
+template<>
+struct RadixKey<double> {
+  static const bool kPass = true;
+  typedef uint64_t UType;
+  inline static UType Encode(double v) {
+    UType u;
+    std::memcpy(&u, &v, sizeof(u));
+    return RadixFloatBits<UType, 0x7FF0000000000000ULL>::Encode(u);
+  }
+};
+template<>
+struct RadixKey<half::half_t> {
+  static const bool kPass = true;
+  typedef uint16_t UType;
+  inline static UType Encode(half::half_t v) {
+    return RadixFloatBits<UType, 0x7C00U>::Encode(v.half_);
+  }
+};
+template<>
+struct RadixKey<bfloat::bf16_t> {
+  static const bool kPass = true;
+  typedef uint16_t UType;
+  inline static UType Encode(bfloat::bf16_t v) {
+    return RadixFloatBits<UType, 0x7F80U>::Encode(v.bf16_);
+  }
+};
+/*! \brief stable sort of key-value pairs, by radix when the key has a RadixKey */
+template<bool radix>
+struct SortByKeyEngine {
+  // stable sort of an index array by comparison
+  template<typename KDType, typename VDType>
+  inline static void Run(Tensor<cpu, 1, KDType> keys, Tensor<cpu, 1, VDType> values,
+                         char *workspace, bool is_ascend) {
+    std::vector<size_t> idx(keys.size(0));
+    std::vector<KDType> keys_vec(keys.size(0));
+    std::vector<VDType> values_vec(values.size(0));
+    for (index_t i = 0; i < keys.size(0); i++) {
+      idx[i] = i;
+      keys_vec[i] = keys[i];
+      values_vec[i] = values[i];
+    }
+    if (is_ascend) {
+      std::stable_sort(idx.begin(), idx.end(),
+                       [&keys_vec](size_t i1, size_t i2)
+                         {return keys_vec[i1] < keys_vec[i2]; });
+    } else {
+      std::stable_sort(idx.begin(), idx.end(),
+                       [&keys_vec](size_t i1, size_t i2)
+                         {return keys_vec[i1] > keys_vec[i2]; });
+    }
+    for (index_t i = 0; i < values.size(0); i++) {
+      keys[i] = keys_vec[idx[i]];
+      values[i] = values_vec[idx[i]];
+    }
+  }
+};
+template<>
+struct SortByKeyEngine<true> {
+  /*!
+   * \brief parallel LSD radix sort on bytes. The keys are moved between their own storage
+   *  and the workspace together with the values and encoded again at each pass, so the
+   *  sorted keys are the original ones, the bits of -0 included. Each thread scatters its
+   *  chunk after the chunks before it, so equal keys keep their order. The bytes that are
+   *  the same in all keys are skipped.
+   */
+  template<typename KDType, typename VDType>
+  inline static void Run(Tensor<cpu, 1, KDType> keys, Tensor<cpu, 1, VDType> values,
+                         char *workspace, bool is_ascend) {
+    typedef RadixKey<KDType> Key;
+    typedef typename Key::UType UType;
+    const int kPass = sizeof(UType), kBin = 256;
+    const index_t n = keys.size(0);
+    if (n < 2) return;
+    const index_t nthread = std::min(static_cast<index_t>(GetNumParallelThread(keys.stream_, n)),
+                                     n);
+    const index_t chunk = (n + nthread - 1) / nthread;
+    // the values go first in the workspace, they need the alignment; the keys after them
+    // may be misaligned, so they are read and written by memcpy
+    char *kbuf[2] = {reinterpret_cast<char*>(keys.dptr_), workspace + n * sizeof(VDType)};
+    VDType *vbuf[2] = {values.dptr_, reinterpret_cast<VDType*>(workspace)};
+    // the code of the key at i of a buffer, complemented for the descending order
+    auto code = [is_ascend](const char *kb, index_t i) {
+      KDType k;
+      std::memcpy(static_cast<void*>(&k), kb + i * sizeof(KDType), sizeof(k));
+      const UType u = Key::Encode(k);
+      return is_ascend ? u : static_cast<UType>(~u);
+    };
+    // count[(tid * kPass + pass) * kBin + digit], digits of the chunk of each thread
+    std::vector<index_t> count(static_cast<size_t>(nthread) * kPass * kBin, 0);
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t tid = 0; tid < nthread; ++tid) {
+      index_t *cnt = &count[static_cast<size_t>(tid) * kPass * kBin];
+      const index_t end = std::min(n, (tid + 1) * chunk);
+      for (index_t i = tid * chunk; i < end; ++i) {
+        const UType u = code(kbuf[0], i);
+        for (int p = 0; p < kPass; ++p) ++cnt[p * kBin + ((u >> (8 * p)) & 255)];
+      }
+    }
+    std::vector<index_t> offset(static_cast<size_t>(nthread) * kBin);
+    int cur = 0;
+    bool moved = false;
+    for (int p = 0; p < kPass; ++p) {
+      // the totals do not depend on the order, skip a byte that is the same everywhere
+      bool trivial = false;
+      for (int d = 0; d < kBin && !trivial; ++d) {
+        index_t total = 0;
+        for (index_t t = 0; t < nthread; ++t) total += count[(t * kPass + p) * kBin + d];
+        trivial = total == n;
+      }
+      if (trivial) continue;
+      const int shift = 8 * p;
+      if (moved) {
+        // the chunks hold other keys after a scatter, count them again
+        #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+        for (openmp_index_t tid = 0; tid < nthread; ++tid) {
+          index_t *cnt = &count[(static_cast<size_t>(tid) * kPass + p) * kBin];
+          std::fill(cnt, cnt + kBin, index_t(0));
+          const index_t end = std::min(n, (tid + 1) * chunk);
+          for (index_t i = tid * chunk; i < end; ++i) ++cnt[(code(kbuf[cur], i) >> shift) & 255];
+        }
+      }
+      index_t sum = 0;
+      for (int d = 0; d < kBin; ++d) {
+        for (index_t t = 0; t < nthread; ++t) {
+          offset[t * kBin + d] = sum;
+          sum += count[(t * kPass + p) * kBin + d];
+        }
+      }
+      const char *ksrc = kbuf[cur];
+      char *kdst = kbuf[1 - cur];
+      const VDType *vsrc = vbuf[cur];
+      VDType *vdst = vbuf[1 - cur];
+      #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+      for (openmp_index_t tid = 0; tid < nthread; ++tid) {
+        index_t *off = &offset[static_cast<size_t>(tid) * kBin];
+        const index_t end = std::min(n, (tid + 1) * chunk);
+        for (index_t i = tid * chunk; i < end; ++i) {
+          const index_t pos = off[(code(ksrc, i) >> shift) & 255]++;
+          std::memcpy(kdst + pos * sizeof(KDType), ksrc + i * sizeof(KDType), sizeof(KDType));
+          vdst[pos] = vsrc[i];
+        }
+      }
+      cur = 1 - cur;
+      moved = true;
+    }
+    if (cur == 0) return;
+    #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+    for (openmp_index_t tid = 0; tid < nthread; ++tid) {
+      const index_t begin = std::min(n, tid * chunk), end = std::min(n, (tid + 1) * chunk);
+      std::memcpy(static_cast<void*>(keys.dptr_ + begin), kbuf[1] + begin * sizeof(KDType),
+                  (end - begin) * sizeof(KDType));
+      std::copy(vbuf[1] + begin, vbuf[1] + end, values.dptr_ + begin);
+    }
+  }
+};
+
+template<typename KDType, typename VDType>
+inline size_t SortByKeyWorkspaceSize(const Tensor<cpu, 1, KDType> &keys,
+                                     const Tensor<cpu, 1, VDType> &values) {
+  return RadixKey<KDType>::kPass ?
+      static_cast<size_t>(keys.size(0)) * (sizeof(KDType) + sizeof(VDType)) : 0;
+}
+
 template<typename KDType, typename VDType>
 inline void SortByKey(Tensor<cpu, 1, KDType> keys, Tensor<cpu, 1, VDType> values,
-                      bool is_ascend) {
+                      Tensor<cpu, 1, char> workspace, bool is_ascend) {
+  WaitPushedTasks(keys.stream_);
   CHECK_EQ(keys.CheckContiguous(), true);
   CHECK_EQ(values.CheckContiguous(), true);
   CHECK_EQ(keys.size(0), values.size(0))
     << "The sizes of key/value are not equal! keys_size: " << keys.size(0)
     << "values_size: " << values.size(0);
-  std::vector<size_t> idx(keys.size(0));
-  std::vector<KDType> keys_vec(keys.size(0));
-  std::vector<VDType> values_vec(values.size(0));
-  for (int i = 0; i < keys.size(0); i++) {
-    idx[i] = i;
-    keys_vec[i] = keys[i];
-    values_vec[i] = values[i];
+  CHECK_GE(workspace.size(0), SortByKeyWorkspaceSize(keys, values))
+    << "SortByKey: workspace too small";
+  SortByKeyEngine<RadixKey<KDType>::kPass>::Run(keys, values, workspace.dptr_, is_ascend);
+}
+
+template<typename KDType, typename VDType>
+inline void SortByKey(Tensor<cpu, 1, KDType> keys, Tensor<cpu, 1, VDType> values,
+                      bool is_ascend) {
+  WaitPushedTasks(keys.stream_);
+  const size_t size = SortByKeyWorkspaceSize(keys, values);
+  CHECK_LE(size, static_cast<size_t>(std::numeric_limits<index_t>::max()))
+    << "SortByKey: too many keys";
+  Tensor<cpu, 1, char> workspace(NULL, Shape1(static_cast<index_t>(size)), keys.stream_);
+  if (size != 0) AllocSpace(&workspace, false);
+  SortByKey(keys, values, workspace, is_ascend);
+  if (size != 0) FreeSpace(&workspace);
+}
+
+template<typename Device, typename VDType, typename SDType>
+inline void VectorizedSort(Tensor<Device, 1, VDType> values, Tensor<Device, 1, SDType> segments) {
+  // We can sort each segments using two stable sorts, sharing one workspace
+  const size_t size = std::max(SortByKeyWorkspaceSize(values, segments),
+                               SortByKeyWorkspaceSize(segments, values));
+  CHECK_LE(size, static_cast<size_t>(std::numeric_limits<index_t>::max()))
+    << "VectorizedSort: too many keys";
+  Tensor<Device, 1, char> workspace(NULL, Shape1(static_cast<index_t>(size)), values.stream_);
+  if (workspace.size(0) != 0) AllocSpace(&workspace, false);
+  SortByKey(values, segments, workspace, true);
+  SortByKey(segments, values, workspace, true);
+  if (workspace.size(0) != 0) FreeSpace(&workspace);
+}
+
+/*! \brief whether (va, ia) comes before (vb, ib) in the result of TopK */
+template<bool is_ascend>
+struct TopKBefore {
+  template<typename DType>
+  inline static bool Run(DType va, index_t ia, DType vb, index_t ib) {
+    return va > vb || (!(vb > va) && ia < ib);
   }
-  if (is_ascend) {
-    std::stable_sort(idx.begin(), idx.end(),
-                     [&keys_vec](size_t i1, size_t i2)
-                       {return keys_vec[i1] < keys_vec[i2]; });
-  } else {
-    std::stable_sort(idx.begin(), idx.end(),
-                     [&keys_vec](size_t i1, size_t i2)
-                       {return keys_vec[i1] > keys_vec[i2]; });
+  template<typename DType>
+  inline bool operator()(const std::pair<DType, index_t> &a,
+                         const std::pair<DType, index_t> &b) const {
+    return Run(a.first, a.second, b.first, b.second);
+  }
+};
+template<>
+struct TopKBefore<true> {
+  template<typename DType>
+  inline static bool Run(DType va, index_t ia, DType vb, index_t ib) {
+    return va < vb || (!(vb < va) && ia < ib);
   }
-  for (index_t i = 0; i < values.size(0); i++) {
-    keys[i] = keys_vec[idx[i]];
-    values[i] = values_vec[idx[i]];
+  template<typename DType>
+  inline bool operator()(const std::pair<DType, index_t> &a,
+                         const std::pair<DType, index_t> &b) const {
+    return Run(a.first, a.second, b.first, b.second);
+  }
+};
+
+template<bool is_ascend, typename DType, typename IndexType>
+inline void TopKRows(const Tensor<cpu, 2, DType> &src, index_t k,
+                     Tensor<cpu, 2, DType> values, Tensor<cpu, 2, IndexType> indices) {
+  typedef std::pair<DType, index_t> Item;
+  const index_t nrow = src.size(0), ncol = src.size(1);
+  typedef TopKBefore<is_ascend> Before;
+#ifdef _OPENMP
+  const int nthread = std::min(GetNumParallelThread(src.stream_, static_cast<size_t>(nrow) * ncol),
+                               static_cast<int>(std::min(nrow, index_t(1) << 30)));
+#endif
+  #pragma omp parallel for num_threads(nthread) schedule(static) if (nthread > 1)
+  for (openmp_index_t y = 0; y < nrow; ++y) {
+    // heap of the k best seen so far, the worst of them on top
+    std::vector<Item> heap;
+    heap.reserve(k);
+    const DType *row = src[y].dptr_;
+    for (index_t x = 0; x < ncol; ++x) {
+      if (heap.size() < k) {
+        heap.push_back(Item(row[x], x));
+        std::push_heap(heap.begin(), heap.end(), Before());
+      } else if (TopKBefore<is_ascend>::Run(row[x], x, heap.front().first, heap.front().second)) {
+        std::pop_heap(heap.begin(), heap.end(), Before());
+        heap.back() = Item(row[x], x);
+        std::push_heap(heap.begin(), heap.end(), Before());
+      }
+    }
+    std::sort_heap(heap.begin(), heap.end(), Before());
+    for (index_t i = 0; i < k; ++i) {
+      values[y][i] = heap[i].first;
+      indices[y][i] = static_cast<IndexType>(heap[i].second);
+    }
   }
 }
 
-template<typename Device, typename VDType, typename SDType>
-inline void VectorizedSort(Tensor<Device, 1, VDType> values, Tensor<Device, 1, SDType> segments) {
-  // We can sort each segments using two stable sorts
-  SortByKey(values, segments, true);
-  SortByKey(segments, values, true);
+template<typename DType, typename IndexType>
+inline void TopK(const Tensor<cpu, 2, DType> &src, index_t k,
+                 Tensor<cpu, 2, DType> values, Tensor<cpu, 2, IndexType> indices,
+                 bool is_ascend) {
+  WaitPushedTasks(src.stream_);
+  CHECK_LE(k, src.size(1)) << "TopK: k is larger than the rows";
+  CHECK(values.size(0) == src.size(0) && values.size(1) >= k)
+      << "TopK: values need " << src.size(0) << " rows of at least " << k;
+  CHECK(indices.size(0) == src.size(0) && indices.size(1) >= k)
+      << "TopK: indices need " << src.size(0) << " rows of at least " << k;
+  if (k == 0) return;
+  if (is_ascend) {
+    TopKRows<true>(src, k, values, indices);
+  } else {
+    TopKRows<false>(src, k, values, indices);
+  }
 }
 
 // blas related
@@ -474,6 +1720,7 @@ inline void VectorDot(Tensor<Device, 1, DType> dst,
       << "VectorDot: Shape mismatch";
   CHECK_EQ(dst.size(0), 1)
       << "VectorDot: expect dst to be scalar";
+  MSHADOW_PROFILE_SCOPE(kBLAS, "dot", lhs.shape_, 2 * sizeof(DType) * lhs.shape_.Size());
   expr::BLASEngine<Device, DType>::SetStream(lhs.stream_);
   mshadow::expr::BLASEngine<Device, DType>::dot(
       lhs.stream_, lhs.size(0), lhs.dptr_, 1, rhs.dptr_, 1, dst.dptr_);
@@ -505,9 +1752,13 @@ inline void BatchGEMM(Tensor<Device, 3, DType> dst,
     << "dst: " << dst.shape_ << "\n"
     << "lhs: " << sleft << "\n"
     << "rhs: " << sright << "\n";
-  CHECK(workspace.size(0) >= 3 * batch_size)
-    << "Workspace Size must be bigger than " << 3 * batch_size;
-  CHECK_EQ(workspace.CheckContiguous(), true);
+  if (workspace.dptr_ != NULL) {
+    CHECK(workspace.size(0) >= 3 * batch_size)
+      << "Workspace Size must be bigger than " << 3 * batch_size;
+    CHECK_EQ(workspace.CheckContiguous(), true);
+  }
+  MSHADOW_PROFILE_SCOPE(kBLAS, "batched_gemm", dst.shape_, sizeof(DType) *
+                        (dst.shape_.Size() + lhs.shape_.Size() + rhs.shape_.Size()));
   // use column major argument to compatible with most BLAS
   expr::BLASEngine<Device, DType>::batched_gemm
     (dst.stream_,
@@ -522,5 +1773,15 @@ inline void BatchGEMM(Tensor<Device, 3, DType> dst,
     dst.dptr_, dst.stride_, batch_size,
     workspace.dptr_);
 }
+
+template<bool transpose_left, bool transpose_right, typename Device, typename DType>
+inline void BatchGEMM(Tensor<Device, 3, DType> dst,
+                      const Tensor<Device, 3, DType> &lhs,
+                      const Tensor<Device, 3, DType> &rhs,
+                      DType alpha,
+                      DType beta) {
+  BatchGEMM<transpose_left, transpose_right>(dst, lhs, rhs, alpha, beta,
+                                             Tensor<Device, 1, DType*>(NULL, Shape1(0)));
+}
 }  // namespace mshadow
 #endif  // MSHADOW_TENSOR_CPU_INL_H_
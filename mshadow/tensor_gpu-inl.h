@@ -8,6 +8,8 @@
 #define MSHADOW_TENSOR_GPU_INL_H_
 #include "./base.h"
 #include "./tensor.h"
+#include "./profiler.h"
+#include "./memory_pool-inl.h"
 
 namespace mshadow {
 #if MSHADOW_USE_CUDA
@@ -36,6 +38,19 @@ inline void SetDevice<gpu>(int devid) {
 }
 template<int dim, typename DType>
 inline void AllocSpace(Tensor<gpu, dim, DType> *obj, bool pad) {
+#if MSHADOW_USE_GPU_POOL
+  // rows are aligned to 256 bytes, enough for coalesced access
+  const size_t kPitchAlign = 256;
+  const size_t nrow = obj->shape_.FlatTo2D()[0];
+  size_t pitch = obj->size(dim - 1) * sizeof(DType);
+  if (pad && obj->size(dim - 1) >= MSHADOW_MIN_PAD_RATIO * 32 &&
+      kPitchAlign % sizeof(DType) == 0) {
+    pitch = (pitch + kPitchAlign - 1) / kPitchAlign * kPitchAlign;
+  }
+  obj->stride_ = static_cast<index_t>(pitch / sizeof(DType));
+  obj->dptr_ = static_cast<DType*>(pool::GPUMemoryPool::Get()->Alloc(
+      pitch * nrow, obj->stream_ == NULL ? 0 : obj->stream_->stream_));
+#else
   size_t pitch;
   // common choice for cuda mem align unit is 32
   if (pad && obj->size(dim - 1) >= MSHADOW_MIN_PAD_RATIO * 32) {
@@ -48,10 +63,15 @@ inline void AllocSpace(Tensor<gpu, dim, DType> *obj, bool pad) {
     MSHADOW_CUDA_CALL(cudaMallocPitch(reinterpret_cast<void**>(&(obj->dptr_)), &pitch,
                                       obj->shape_.Size() * sizeof(DType), 1));
   }
+#endif  // MSHADOW_USE_GPU_POOL
 }
 template<int dim, typename DType>
 inline void FreeSpace(Tensor<gpu, dim, DType> *obj) {
+#if MSHADOW_USE_GPU_POOL
+  pool::GPUMemoryPool::FreeAny(obj->dptr_, obj->stream_ == NULL ? 0 : obj->stream_->stream_);
+#else
   MSHADOW_CUDA_CALL(cudaFree(obj->dptr_));
+#endif  // MSHADOW_USE_GPU_POOL
   obj->dptr_ = NULL;
 }
 template<typename A, typename B, int dim, typename DType>
@@ -59,7 +79,9 @@ inline void Copy(Tensor<A, dim, DType> _dst,
                  Tensor<B, dim, DType> _src,
                  cudaMemcpyKind kind,
                  Stream<gpu> *stream) {
-  CHECK_EQ(_dst.shape_, _src.shape_) << "Copy:shape mismatch";
+  MSHADOW_CHECK_SHAPE_EQ(_dst.shape_, _src.shape_) << "Copy:shape mismatch";
+  MSHADOW_PROFILE_SCOPE(kCopy, kind == cudaMemcpyDeviceToDevice ? "gpu" : "host-gpu",
+                        _dst.shape_, 2 * sizeof(DType) * _dst.shape_.Size());
   Tensor<A, 2, DType> dst = _dst.FlatTo2D();
   Tensor<B, 2, DType> src = _src.FlatTo2D();
   MSHADOW_CUDA_CALL(cudaMemcpy2DAsync(dst.dptr_, dst.stride_ * sizeof(DType),
@@ -88,6 +110,21 @@ template<int dim, typename DType>
 inline void Copy(Tensor<gpu, dim, DType> dst,
                  const Tensor<cpu, dim, DType> &src,
                  Stream<gpu> *stream) {
+#if MSHADOW_USE_GPU_POOL
+  // a copy from pageable memory blocks the host until it is done,
+  // stage it in pinned memory so that it runs asynchronously and src can be reused at once
+  if (stream != NULL && src.shape_.Size() != 0 &&
+      !pool::PinnedMemoryPool::IsPinned(src.dptr_)) {
+    MSHADOW_CHECK_SHAPE_EQ(dst.shape_, src.shape_) << "Copy:shape mismatch";
+    pool::PinnedMemoryPool *pinned = pool::PinnedMemoryPool::Get();
+    Tensor<cpu, dim, DType> staging(static_cast<DType*>(
+        pinned->Alloc(src.shape_.Size() * sizeof(DType))), src.shape_);
+    Copy(staging, src);
+    Copy(dst, staging, cudaMemcpyHostToDevice, stream);
+    pinned->Free(staging.dptr_, Stream<gpu>::GetStream(stream));
+    return;
+  }
+#endif  // MSHADOW_USE_GPU_POOL
   Copy(dst, src, cudaMemcpyHostToDevice, stream);
 }
 #endif  // MSHADOW_USE_CUDA
@@ -104,17 +141,87 @@ inline void MapExp(TRValue<R, gpu, dim, DType> *dst,
                    const expr::Exp<E, DType, etype> &exp) {
   expr::TypeCheckPass<expr::TypeCheck<gpu, dim, DType, E>::kMapPass>
       ::Error_All_Tensor_in_Exp_Must_Have_Same_Type();
-  Shape<dim> eshape = expr::ShapeCheck<dim, E>::Check(exp.self());
   Shape<dim> dshape = expr::ShapeCheck<dim, R>::Check(dst->self());
+#if MSHADOW_SHAPE_CHECK
+  Shape<dim> eshape = expr::ShapeCheck<dim, E>::Check(exp.self());
   CHECK(eshape[0] == 0 || eshape == dshape)
     << "Assignment: Shape of Tensors are not consistent with target, "
     << "eshape: " << eshape << " dshape:" << dshape;
+#endif  // MSHADOW_SHAPE_CHECK
+  MSHADOW_PROFILE_SCOPE(kMapExp, profiler::TypeName<E>(), dshape, sizeof(DType) * dshape.Size());
+  if (expr::MapExpDirectEngine<Saver, R, E, DType>::Map(dst->ptrself(), exp.self())) return;
+  cudaStream_t stream = Stream<gpu>::GetStream(expr::StreamInfo<gpu, R>::Get(dst->self()));
+  if (cuda::MapFlatEngine<Saver, R, E, DType>::Map(dst->ptrself(), exp.self(), stream)) return;
+  if (cuda::MapVecEngine<Saver, R, E, DType>::Map(dst->ptrself(), exp.self(),
+                                                  dshape.FlatTo2D(), stream)) return;
   cuda::MapPlan<Saver>(MakePlan(dst->self()),
                        MakePlan(exp.self()),
-                       dshape.FlatTo2D(),
+                       dshape.FlatTo2D(), stream,
+                       cuda::TuneRegionOf(dst->self(), dshape.FlatTo2D()));
+}
+
+/*! \brief evaluate the plan of an expression into dst, the shapes are not checked */
+template<typename Saver, typename R, int dim, typename DType, typename E>
+inline void MapPlan(TRValue<R, gpu, dim, DType> *dst, const expr::Plan<E, DType> &plan) {
+  cuda::MapPlan<Saver>(MakePlan(dst->self()), plan,
+                       expr::ShapeCheck<dim, R>::Check(dst->self()).FlatTo2D(),
                        Stream<gpu>::GetStream(expr::StreamInfo<gpu, R>::Get(dst->self())));
 }
 
+namespace expr {
+template<typename SV, typename DType>
+inline bool SwapBlocks(Tensor<gpu, 1, DType> dst, const Tensor<gpu, 1, DType> &src,
+                       const Shape<5> &s) {
+  // runs of e longer than one are already coalesced in the elementwise plan
+  if (s[4] != 1) return false;
+  cuda::SwapBlocks<SV>(dst.dptr_, src.dptr_, s, Stream<gpu>::GetStream(dst.stream_));
+  return true;
+}
+template<typename SV, typename Reducer, bool with_index, typename DType, typename IType>
+inline void Pool(Tensor<gpu, 3, DType> dst, Tensor<gpu, 3, IType> index,
+                 const Tensor<gpu, 3, DType> &src,
+                 index_t ksize_y, index_t ksize_x, index_t kstride_y, index_t kstride_x) {
+  cuda::Pool<SV, Reducer, with_index>(dst, index, src, ksize_y, ksize_x, kstride_y, kstride_x);
+}
+template<typename DType, typename IType>
+inline void UnPoolWithIndex(Tensor<gpu, 3, DType> grad_src,
+                            const Tensor<gpu, 3, IType> &index,
+                            const Tensor<gpu, 3, DType> &grad_pooled,
+                            index_t ksize_y, index_t ksize_x,
+                            index_t kstride_y, index_t kstride_x) {
+  cuda::UnPoolWithIndex(grad_src, index, grad_pooled, ksize_y, ksize_x, kstride_y, kstride_x);
+}
+template<typename SV, typename Reducer, typename DType>
+inline void UnPool(Tensor<gpu, 3, DType> grad_src, const Tensor<gpu, 3, DType> &data_src,
+                   const Tensor<gpu, 3, DType> &data_pooled,
+                   const Tensor<gpu, 3, DType> &grad_pooled,
+                   index_t ksize_y, index_t ksize_x, index_t kstride_y, index_t kstride_x) {
+  cuda::UnPool<SV, Reducer>(grad_src, data_src, data_pooled, grad_pooled,
+                            ksize_y, ksize_x, kstride_y, kstride_x);
+}
+template<typename SV, typename DType>
+inline void PackColToPatch(Tensor<gpu, 4, DType> img, const Tensor<gpu, 2, DType> &col,
+                           index_t psize_y, index_t psize_x,
+                           index_t pstride_y, index_t pstride_x,
+                           index_t pdilate_y, index_t pdilate_x) {
+  cuda::PackColToPatch<SV>(img, col, psize_y, psize_x, pstride_y, pstride_x,
+                           pdilate_y, pdilate_x);
+}
+template<typename SV, typename Reducer, typename DType>
+inline void ChannelPool(Tensor<gpu, 4, DType> dst, const Tensor<gpu, 4, DType> &src,
+                        index_t nsize, index_t stride, index_t pad) {
+  cuda::ChannelPool<SV, Reducer>(dst, src, nsize, stride, pad);
+}
+template<typename SV, typename Reducer, typename DType>
+inline void ChannelUnpool(Tensor<gpu, 4, DType> grad_src, const Tensor<gpu, 4, DType> &data_src,
+                          const Tensor<gpu, 4, DType> &data_pooled,
+                          const Tensor<gpu, 4, DType> &grad_pooled,
+                          index_t nsize, index_t stride, index_t pad) {
+  cuda::ChannelUnpool<SV, Reducer>(grad_src, data_src, data_pooled, grad_pooled,
+                                   nsize, stride, pad);
+}
+}  // namespace expr
+
 template<typename Saver, typename Reducer,
          typename R, typename DType, typename E, int etype>
 inline void MapReduceKeepLowest(TRValue<R, gpu, 1, DType> *dst,
@@ -125,11 +232,15 @@ inline void MapReduceKeepLowest(TRValue<R, gpu, 1, DType> *dst,
   Shape<2> eshape = expr::ShapeCheck<expr::ExpInfo<E>::kDim, E>
       ::Check(exp.self()).FlatTo2D();
   Shape<1> dshape = expr::ShapeCheck<1, R>::Check(dst->self());
-  CHECK_EQ(eshape[1], dshape[0]) << "MapReduceKeepLowest::reduction dimension do not match";
+  MSHADOW_CHECK_SHAPE_EQ(eshape[1], dshape[0])
+      << "MapReduceKeepLowest::reduction dimension do not match";
   CHECK_NE(eshape[0], 0) << "can not reduce over empty tensor";
+  MSHADOW_PROFILE_SCOPE(kReduceKeepLowest, profiler::TypeName<E>(), eshape,
+                        sizeof(DType) * eshape.Size());
   cuda::MapReduceKeepLowest<Saver, Reducer>
       (MakePlan(dst->self()), MakePlan(exp.self()), scale, eshape,
-       Stream<gpu>::GetStream(expr::StreamInfo<gpu, R>::Get(dst->self())));
+       expr::StreamInfo<gpu, R>::Get(dst->self()),
+       cuda::TuneRegionOf(dst->self(), Shape2(1, dshape[0])));
 }
 
 template<typename Saver, typename Reducer, int dimkeep,
@@ -143,29 +254,49 @@ inline void MapReduceKeepHighDim(TRValue<R, gpu, 1, DType> *dst,
   EShape eshape = expr::ShapeCheck<expr::ExpInfo<E>::kDim, E>
       ::Check(exp.self());
     Shape<1> dshape = expr::ShapeCheck<1, R>::Check(dst->self());
-  CHECK_EQ(eshape[dimkeep], dshape[0]) << "MapReduceKeepHighDim::reduction dimension do not match";
+  MSHADOW_CHECK_SHAPE_EQ(eshape[dimkeep], dshape[0])
+      << "MapReduceKeepHighDim::reduction dimension do not match";
   // use equvalent form
   Shape<4> pshape = Shape4(eshape.ProdShape(0, dimkeep),
                            eshape[dimkeep],
                            eshape.ProdShape(dimkeep + 1, EShape::kSubdim),
                            eshape[EShape::kSubdim]);
+  MSHADOW_PROFILE_SCOPE(kReduceKeepHighDim, profiler::TypeName<E>(), eshape,
+                        sizeof(DType) * eshape.Size());
   // call equavalent map red dim 2
   cuda::MapReduceKeepDim1<Saver, Reducer>
       (MakePlan(dst->self()), MakePlan(exp.self()), scale, pshape,
-       Stream<gpu>::GetStream(expr::StreamInfo<gpu, R>::Get(dst->self())));
+       expr::StreamInfo<gpu, R>::Get(dst->self()),
+       cuda::TuneRegionOf(dst->self(), Shape2(1, dshape[0])));
 }
 template<typename DType>
 inline void Softmax(Tensor<gpu, 2, DType> dst,
                     const Tensor<gpu, 2, DType>& src) {
+  MSHADOW_PROFILE_SCOPE(kSoftmax, "gpu", dst.shape_, 2 * sizeof(DType) * dst.shape_.Size());
   cuda::Softmax(dst, src);
 }
 
 template<typename DType>
 inline void Softmax(Tensor<gpu, 3, DType> dst,
                     const Tensor<gpu, 3, DType>& src) {
+  MSHADOW_PROFILE_SCOPE(kSoftmax, "gpu", dst.shape_, 2 * sizeof(DType) * dst.shape_.Size());
   cuda::Softmax(dst, src);
 }
 
+template<typename DType>
+inline void LogSoftmax(Tensor<gpu, 2, DType> dst,
+                       const Tensor<gpu, 2, DType>& src) {
+  MSHADOW_PROFILE_SCOPE(kSoftmax, "gpu", dst.shape_, 2 * sizeof(DType) * dst.shape_.Size());
+  cuda::LogSoftmax(dst, src);
+}
+
+template<typename DType>
+inline void LogSoftmaxGrad(Tensor<gpu, 2, DType> dst,
+                           const Tensor<gpu, 2, DType> &src,
+                           const Tensor<gpu, 2, DType> &grad) {
+  cuda::LogSoftmaxGrad(dst, src, grad);
+}
+
 template<typename DType>
 inline void SoftmaxGrad(Tensor<gpu, 2, DType> dst,
                         const Tensor<gpu, 2, DType> &src,
@@ -181,6 +312,23 @@ inline void SoftmaxGrad(Tensor<gpu, 2, DType> dst,
   cuda::SoftmaxGrad(dst, src, label, ignore_label);
 }
 
+template<typename DType, typename IndexType>
+inline void SoftmaxCrossEntropy(Tensor<gpu, 2, DType> grad,
+                                Tensor<gpu, 1, DType> loss,
+                                const Tensor<gpu, 2, DType> &energy,
+                                const Tensor<gpu, 1, IndexType> &label) {
+  cuda::SoftmaxCrossEntropy(grad, loss, energy, label, false, IndexType(0));
+}
+
+template<typename DType, typename IndexType>
+inline void SoftmaxCrossEntropy(Tensor<gpu, 2, DType> grad,
+                                Tensor<gpu, 1, DType> loss,
+                                const Tensor<gpu, 2, DType> &energy,
+                                const Tensor<gpu, 1, IndexType> &label,
+                                const IndexType &ignore_label) {
+  cuda::SoftmaxCrossEntropy(grad, loss, energy, label, true, ignore_label);
+}
+
 template<typename DType>
 inline void SoftmaxGrad(Tensor<gpu, 3, DType> dst,
                         const Tensor<gpu, 3, DType> &src,
@@ -203,6 +351,21 @@ inline void AddTakeGrad(Tensor<gpu, 2, DType> dst,
   cuda::AddTakeGrad(dst, index, src);
 }
 
+template<typename SV, typename IndexType, typename DType>
+inline void Take(Tensor<gpu, 2, DType> dst,
+                 const Tensor<gpu, 1, IndexType> &index,
+                 const Tensor<gpu, 2, DType> &src) {
+  cuda::Take<SV>(dst, index, src);
+}
+
+template<typename SV, typename IndexType, typename DType>
+inline void TakeBag(Tensor<gpu, 2, DType> dst,
+                    const Tensor<gpu, 1, IndexType> &index,
+                    const Tensor<gpu, 1, IndexType> &offset,
+                    const Tensor<gpu, 2, DType> &src, bool mean) {
+  cuda::TakeBag<SV>(dst, index, offset, src, mean);
+}
+
 template<typename IndexType, typename DType>
 inline void AddTakeGradLargeBatch(Tensor<gpu, 2, DType> dst,
                                   const Tensor<gpu, 1, IndexType>& sorted,
@@ -217,12 +380,46 @@ inline void SortByKey(Tensor<gpu, 1, KDType> keys, Tensor<gpu, 1, VDType> values
   cuda::SortByKey(keys, values, is_ascend);
 }
 
+template<typename KDType, typename VDType>
+inline size_t SortByKeyWorkspaceSize(const Tensor<gpu, 1, KDType> &keys,
+                                     const Tensor<gpu, 1, VDType> &values) {
+  return 0;
+}
+
+template<typename KDType, typename VDType>
+inline void SortByKey(Tensor<gpu, 1, KDType> keys, Tensor<gpu, 1, VDType> values,
+                      Tensor<gpu, 1, char> workspace, bool is_ascend) {
+  // thrust allocates the temporary storage of the sort itself
+  cuda::SortByKey(keys, values, is_ascend);
+}
+
+template<typename DType, typename IndexType>
+inline void TopK(const Tensor<gpu, 2, DType> &src, index_t k,
+                 Tensor<gpu, 2, DType> values, Tensor<gpu, 2, IndexType> indices,
+                 bool is_ascend) {
+  cuda::TopK(src, k, values, indices, is_ascend);
+}
+
+template<typename SV, typename Reducer, bool mask, typename DType>
+inline void ReduceWithAxis(Tensor<gpu, 2, DType> dst, const Tensor<gpu, 2, DType> &src,
+                           index_t size, index_t trailing) {
+  cuda::ReduceWithAxis<SV, Reducer, mask>(dst, src, size, trailing);
+}
+
 template<typename IndexType, typename DType>
 inline void IndexFill(Tensor<gpu, 2, DType> dst,
                       const Tensor<gpu, 1, IndexType>& index,
                       const Tensor<gpu, 2, DType> &src) {
   cuda::IndexFill(dst, index, src);
 }
+
+template<typename L>
+inline void MapMulti(const L &list, Stream<gpu> *stream) {
+  const Shape<L::kDim> shape = list.shape();
+  list.Check(shape);
+  cuda::MapMulti(expr::MultiAssignPlan<L>(list), shape.FlatTo2D(),
+                 Stream<gpu>::GetStream(stream));
+}
 }  // namespace mshadow
 #endif  // __CUDACC__
 #endif  // MSHADOW_TENSOR_GPU_INL_H_
@@ -0,0 +1,79 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file validated_plan.h
+ * \brief an assignment whose types and shapes are checked once, then run many times
+ *  without walking the expression again, for the small ops repeated in every step
+ */
+#ifndef MSHADOW_VALIDATED_PLAN_H_
+#define MSHADOW_VALIDATED_PLAN_H_
+#include <utility>
+#include "./tensor.h"
+
+#if MSHADOW_IN_CXX11
+namespace mshadow {
+/*!
+ * \brief the assignment dst Saver exp, e.g. dst = a * b + 1 with Saver sv::saveto.
+ *  The constructor checks the types and the shapes as MapExp does, Run evaluates the
+ *  assignment on the stream of dst without checking again.
+ *
+ *  The plan keeps the pointers, strides and scalars of the expression, not the expression
+ *  itself, so it stays valid after the statement that made it for as long as the memory of
+ *  the tensors does; their contents are read again by every Run. Run evaluates the
+ *  elementwise plan, without the direct and packet engines MapExp picks for large tensors,
+ *  which suits the tiny tensors where the checks cost more than the evaluation.
+ * \code
+ *  auto step = MakeValidatedPlan<sv::saveto>(out, F<op::sigmoid>(in) * scale);
+ *  for each request:
+ *    fill in
+ *    step.Run();
+ * \endcode
+ * \tparam Saver how the result is stored, such as sv::saveto or sv::plusto
+ * \tparam Device the device of the tensors
+ * \tparam dim dimension of the destination
+ * \tparam DType data type
+ * \tparam E type of the expression
+ */
+template<typename Saver, typename Device, int dim, typename DType, typename E>
+class ValidatedPlan {
+ public:
+  /*! \brief type of the plan of the expression */
+  typedef decltype(expr::MakePlan(std::declval<const E&>())) ExpPlan;
+  template<int etype>
+  ValidatedPlan(const Tensor<Device, dim, DType> &dst, const expr::Exp<E, DType, etype> &exp)
+      : dst_(dst), plan_(expr::MakePlan(exp.self())) {
+    expr::TypeCheckPass<expr::TypeCheck<Device, dim, DType, E>::kMapPass>
+        ::Error_All_Tensor_in_Exp_Must_Have_Same_Type();
+#if MSHADOW_SHAPE_CHECK
+    Shape<dim> eshape = expr::ShapeCheck<dim, E>::Check(exp.self());
+    CHECK(eshape[0] == 0 || eshape == dst.shape_)
+        << "ValidatedPlan: Shape of Tensors are not consistent with target, "
+        << "eshape: " << eshape << " dshape:" << dst.shape_;
+#endif  // MSHADOW_SHAPE_CHECK
+  }
+  /*! \brief evaluate the assignment */
+  inline void Run(void) const {
+    Tensor<Device, dim, DType> dst = dst_;
+    MapPlan<Saver>(&dst, plan_);
+  }
+  /*! \brief the destination */
+  inline const Tensor<Device, dim, DType> &dst(void) const {
+    return dst_;
+  }
+
+ private:
+  Tensor<Device, dim, DType> dst_;
+  ExpPlan plan_;
+};
+/*!
+ * \brief check the assignment dst Saver exp once, see ValidatedPlan
+ * \param dst the destination, its memory must outlive the plan
+ * \param exp the expression, the memory of its tensors must outlive the plan
+ */
+template<typename Saver, typename Device, int dim, typename DType, typename E, int etype>
+inline ValidatedPlan<Saver, Device, dim, DType, E>
+MakeValidatedPlan(const Tensor<Device, dim, DType> &dst, const expr::Exp<E, DType, etype> &exp) {
+  return ValidatedPlan<Saver, Device, dim, DType, E>(dst, exp);
+}
+}  // namespace mshadow
+#endif  // MSHADOW_IN_CXX11
+#endif  // MSHADOW_VALIDATED_PLAN_H_
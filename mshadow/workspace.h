@@ -0,0 +1,140 @@
+/*!
+ *  Copyright (c) 2016 by Contributors
+ * \file workspace.h
+ * \brief scratch space arena that hands out temporary tensors of a stream
+ */
+#ifndef MSHADOW_WORKSPACE_H_
+#define MSHADOW_WORKSPACE_H_
+#include <algorithm>
+#include <vector>
+#include "./tensor.h"
+
+/*! \brief smallest block a Workspace allocates while it grows */
+#ifndef MSHADOW_WORKSPACE_MIN_BLOCK
+#define MSHADOW_WORKSPACE_MIN_BLOCK (1UL << 20)
+#endif
+
+namespace mshadow {
+/*!
+ * \brief arena of temporary tensors used by the operators running on a stream.
+ *  Get carves contiguous tensors out of the blocks the arena owns, Reset makes all of
+ *  them free again. Kernels on the stream run in order, so space handed out again
+ *  after Reset is only written once the earlier users are done.
+ *
+ *  Calling Reset before each operator bounds the memory by the largest operator,
+ *  instead of the sum over all of them. The first pass may need several blocks,
+ *  Reset then merges them into one block of the peak size.
+ * \code
+ *  Workspace<gpu> ws(stream);
+ *  for each operator:
+ *    ws.Reset();
+ *    Tensor<gpu, 2> col = ws.Get<float>(Shape2(k, n));
+ *    ...
+ * \endcode
+ * \tparam Device which device the tensors are on
+ */
+template<typename Device>
+class Workspace {
+ public:
+  /*! \brief alignment of each tensor in bytes */
+  static const size_t kAlign = 256;
+  /*!
+   * \brief constructor
+   * \param stream the stream the tensors are used on
+   */
+  explicit Workspace(Stream<Device> *stream = NULL)
+      : stream_(stream), cur_(0), offset_(0), used_(0), peak_(0), merge_(false) {}
+  ~Workspace(void) {
+    this->Release();
+  }
+  /*! \brief set the stream the tensors are used on */
+  inline void set_stream(Stream<Device> *stream) {
+    stream_ = stream;
+  }
+  /*!
+   * \brief get a contiguous scratch tensor, valid until the next Reset
+   * \param shape shape of the tensor
+   * \tparam DType type of element in tensor
+   * \tparam dim dimension of tensor
+   */
+  template<typename DType, int dim>
+  inline Tensor<Device, dim, DType> Get(const Shape<dim> &shape) {
+    const size_t size = (shape.Size() * sizeof(DType) + kAlign - 1) / kAlign * kAlign;
+    if (merge_) this->Merge();
+    while (cur_ < blocks_.size() && offset_ + size > blocks_[cur_].size(0)) {
+      ++cur_; offset_ = 0;
+    }
+    if (cur_ == blocks_.size()) {
+      // grow geometrically, so the first pass takes few blocks
+      const size_t nbytes = std::max(std::max(size, used_),
+                                     static_cast<size_t>(MSHADOW_WORKSPACE_MIN_BLOCK));
+      Tensor<Device, 1, char> b(Shape1(static_cast<index_t>(nbytes)));
+      b.stream_ = stream_;
+      AllocSpace(&b, false);
+      blocks_.push_back(b);
+      offset_ = 0;
+    }
+    Tensor<Device, dim, DType> ret(reinterpret_cast<DType*>(blocks_[cur_].dptr_ + offset_),
+                                   shape, stream_);
+    offset_ += size;
+    used_ += size;
+    peak_ = std::max(peak_, used_);
+    return ret;
+  }
+  /*!
+   * \brief make all the tensors handed out free again,
+   *  if several blocks were needed they are merged into one of the peak size
+   */
+  inline void Reset(void) {
+    merge_ = blocks_.size() > 1;
+    cur_ = 0; offset_ = 0; used_ = 0;
+  }
+  /*! \brief free all the blocks, tensors handed out must not be used anymore */
+  inline void Release(void) {
+    for (size_t i = 0; i < blocks_.size(); ++i) {
+      blocks_[i].stream_ = stream_;
+      FreeSpace(&blocks_[i]);
+    }
+    blocks_.clear();
+    cur_ = 0; offset_ = 0; used_ = 0; merge_ = false;
+  }
+  /*! \return bytes handed out since the last Reset */
+  inline size_t used_bytes(void) const {
+    return used_;
+  }
+  /*! \return the largest used_bytes seen so far */
+  inline size_t peak_bytes(void) const {
+    return peak_;
+  }
+  /*! \return bytes owned by the arena */
+  inline size_t allocated_bytes(void) const {
+    size_t total = 0;
+    for (size_t i = 0; i < blocks_.size(); ++i) total += blocks_[i].size(0);
+    return total;
+  }
+
+ private:
+  /*! \brief the stream */
+  Stream<Device> *stream_;
+  /*! \brief blocks owned by the arena */
+  std::vector<Tensor<Device, 1, char> > blocks_;
+  /*! \brief the block being carved, and the offset in it */
+  size_t cur_, offset_;
+  /*! \brief statistics */
+  size_t used_, peak_;
+  /*! \brief whether to merge the blocks before handing out the next tensor */
+  bool merge_;
+  // replace the blocks by one block of the peak size
+  inline void Merge(void) {
+    this->Release();
+    Tensor<Device, 1, char> b(Shape1(static_cast<index_t>(peak_)));
+    b.stream_ = stream_;
+    AllocSpace(&b, false);
+    blocks_.push_back(b);
+  }
+  // disable copy
+  Workspace(const Workspace &other);
+  Workspace &operator=(const Workspace &other);
+};
+}  // namespace mshadow
+#endif  // MSHADOW_WORKSPACE_H_
@@ -3,6 +3,7 @@
 
 #include "mshadow/tensor.h"
 #include "assert.h"
+#include <cmath>
 
 #define EPS 0.0001
 using namespace mshadow;
@@ -31,6 +32,7 @@ void Print2DTensor(Tensor<cpu, 2, float> const &ts) {
   }
 }
 
+#if MSHADOW_USE_CUDA
 template<>
 void Print2DTensor(Tensor<gpu, 2, float> const &tg) {
   Tensor<cpu, 2, float> tc = NewTensor<cpu, float>(tg.shape_, 0.0f);
@@ -64,4 +66,36 @@ bool Check1DTensor(Tensor<gpu, 1, float> const &tg, Tensor<cpu, 1, float> const
   FreeSpace(&tcc);
   return true;
 }
+#endif  // MSHADOW_USE_CUDA
+
+// the helpers of the cpu test programs
+
+// fails with the first element of a that differs from b by more than tol * (1 + |b|)
+template<int dim, typename DType>
+void CheckEqual(const Tensor<cpu, dim, DType> &a, const Tensor<cpu, dim, DType> &b,
+                const char *what, double tol = EPS) {
+  CHECK_EQ(a.shape_, b.shape_) << what;
+  Tensor<cpu, 2, DType> a2 = a.FlatTo2D(), b2 = b.FlatTo2D();
+  for (index_t i = 0; i < a2.size(0); ++i) {
+    for (index_t j = 0; j < a2.size(1); ++j) {
+      const double x = a2[i][j], y = b2[i][j];
+      CHECK_LT(std::fabs(x - y), tol * (1.0 + std::fabs(y)))
+          << what << ": mismatch at " << i << ", " << j << ": " << x << " vs " << y;
+    }
+  }
+}
+
+// fill t with ((i * mul) % mod) * scale + shift at the i-th element, every row of the
+// padded storage is visited
+template<int dim, typename DType>
+void Fill(Tensor<cpu, dim, DType> t, index_t mul, index_t mod,
+          double scale = 1.0, double shift = 0.0) {
+  Tensor<cpu, 2, DType> t2 = t.FlatTo2D();
+  for (index_t i = 0; i < t2.size(0); ++i) {
+    for (index_t j = 0; j < t2.size(1); ++j) {
+      t2[i][j] = static_cast<DType>(static_cast<double>((i * t2.size(1) + j) * mul % mod) *
+                                    scale + shift);
+    }
+  }
+}
 #endif
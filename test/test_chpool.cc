@@ -0,0 +1,103 @@
+// test chpool and ch_unpool, the direct engine and the Plan, against naive loops
+#include "test.h"
+#include <cmath>
+#include <cstdio>
+
+using namespace mshadow;
+using namespace mshadow::expr;
+
+// window of output channel c, the same bounds as the Plan of chpool
+void Window(index_t c, index_t nsize, index_t stride, index_t pad, index_t nchannel,
+            index_t *begin, index_t *end) {
+  *begin = c * stride < pad ? 0 : c * stride - pad;
+  *end = std::min(*begin + nsize, nchannel);
+}
+
+template<typename Reducer>
+void NaiveChannelPool(const Tensor<cpu, 4> &src, Tensor<cpu, 4> dst,
+                      index_t nsize, index_t stride, index_t pad) {
+  for (index_t n = 0; n < dst.size(0); ++n) {
+    for (index_t c = 0; c < dst.size(1); ++c) {
+      index_t begin, end;
+      Window(c, nsize, stride, pad, src.size(1), &begin, &end);
+      for (index_t y = 0; y < dst.size(2); ++y) {
+        for (index_t x = 0; x < dst.size(3); ++x) {
+          float res; Reducer::SetInitValue(res);
+          for (index_t cc = begin; cc < end; ++cc) {
+            Reducer::Reduce(res, src[n][cc][y][x]);
+          }
+          dst[n][c][y][x] = res;
+        }
+      }
+    }
+  }
+}
+
+template<typename Reducer>
+void NaiveChannelUnpool(const Tensor<cpu, 4> &data, const Tensor<cpu, 4> &pooled,
+                        const Tensor<cpu, 4> &grad, Tensor<cpu, 4> grad_src,
+                        index_t nsize, index_t stride, index_t pad) {
+  grad_src = 0.0f;
+  for (index_t n = 0; n < grad.size(0); ++n) {
+    for (index_t c = 0; c < grad.size(1); ++c) {
+      for (index_t cc = 0; cc < data.size(1); ++cc) {
+        // pooled channel c receives from source cc when cc is in the unpool window of c
+        const index_t first = cc < nsize - pad ? 0 : (cc - (nsize - pad) + stride) / stride;
+        const index_t last = (cc + pad + stride) / stride;
+        if (c < first || c >= last) continue;
+        for (index_t y = 0; y < grad.size(2); ++y) {
+          for (index_t x = 0; x < grad.size(3); ++x) {
+            grad_src[n][cc][y][x] +=
+                Reducer::PartialGrad(data[n][cc][y][x], pooled[n][c][y][x]) *
+                grad[n][c][y][x];
+          }
+        }
+      }
+    }
+  }
+}
+
+template<typename Reducer>
+void TestChannelPool(const char *name, index_t nchannel, index_t nsize,
+                     index_t stride, index_t pad) {
+  const index_t pchannel = (nchannel - nsize + pad * 2 + 1) / stride;
+  Shape<4> sshape = Shape4(2, nchannel, 3, 5), pshape = Shape4(2, pchannel, 3, 5);
+  TensorContainer<cpu, 4> data(sshape), pooled(pshape), expect(pshape);
+  TensorContainer<cpu, 4> grad(pshape), grad_src(sshape), expect_src(sshape);
+  Fill(data, 37, 23, 1.0f, -11.0f);
+  Fill(grad, 13, 7, 0.5f, 0.0f);
+  NaiveChannelPool<Reducer>(data, expect, nsize, stride, pad);
+  // the direct engine
+  pooled = chpool<Reducer>(data, nsize, stride, pad);
+  CheckEqual(pooled, expect, "chpool");
+  // the Plan
+  pooled = chpool<Reducer>(data * 1.0f, nsize, stride, pad);
+  CheckEqual(pooled, expect, "chpool plan");
+
+  NaiveChannelUnpool<Reducer>(data, pooled, grad, expect_src, nsize, stride, pad);
+  grad_src = ch_unpool<Reducer>(data, pooled, grad, nsize, stride, pad);
+  CheckEqual(grad_src, expect_src, "ch_unpool");
+  printf("Test for chpool<%s>, channel = %u, nsize = %u, stride = %u, pad = %u Pass!\n",
+         name, nchannel, nsize, stride, pad);
+}
+
+template<typename Reducer>
+void TestReducer(const char *name) {
+  // fewer output channels than input channels
+  TestChannelPool<Reducer>(name, 2, 2, 1, 0);
+  TestChannelPool<Reducer>(name, 7, 3, 2, 0);
+  // the same number of channels
+  TestChannelPool<Reducer>(name, 5, 3, 1, 1);
+  TestChannelPool<Reducer>(name, 6, 5, 1, 2);
+  // more output channels than input channels
+  TestChannelPool<Reducer>(name, 3, 3, 1, 2);
+}
+
+int main(void) {
+  InitTensorEngine<cpu>();
+  TestReducer<red::sum>("sum");
+  TestReducer<red::maximum>("maximum");
+  TestReducer<red::minimum>("minimum");
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}
@@ -0,0 +1,89 @@
+// test ConvolutionForward and its gradients against naive loops
+// a small tile, so the output is computed in several bands of rows
+#define MSHADOW_CONV_TILE_BYTES (1UL << 12)
+#include "test.h"
+#include <cmath>
+#include <cstdio>
+
+using namespace mshadow;
+using namespace mshadow::expr;
+
+// the input pixel under tap (ky, kx) of output (oy, ox), false if it is in the padding
+bool Tap(const ConvParam &p, const Shape<4> &ishape, index_t oy, index_t ox,
+         index_t ky, index_t kx, index_t *iy, index_t *ix) {
+  const int y = static_cast<int>(oy * p.stride_y + ky * p.dilate_y) - static_cast<int>(p.pad_y);
+  const int x = static_cast<int>(ox * p.stride_x + kx * p.dilate_x) - static_cast<int>(p.pad_x);
+  if (y < 0 || x < 0 || y >= static_cast<int>(ishape[2]) || x >= static_cast<int>(ishape[3])) {
+    return false;
+  }
+  *iy = y; *ix = x;
+  return true;
+}
+
+// calls f(n, f, c, oy, ox, iy, ix, w) for every product of the convolution
+template<typename F>
+void ForEachTap(const ConvParam &p, const Shape<4> &ishape, const Shape<4> &oshape, F f) {
+  for (index_t n = 0; n < oshape[0]; ++n) {
+    for (index_t m = 0; m < oshape[1]; ++m) {
+      for (index_t oy = 0; oy < oshape[2]; ++oy) {
+        for (index_t ox = 0; ox < oshape[3]; ++ox) {
+          for (index_t c = 0; c < ishape[1]; ++c) {
+            for (index_t ky = 0; ky < p.kernel_y; ++ky) {
+              for (index_t kx = 0; kx < p.kernel_x; ++kx) {
+                index_t iy, ix;
+                if (!Tap(p, ishape, oy, ox, ky, kx, &iy, &ix)) continue;
+                f(n, m, c, oy, ox, iy, ix, (c * p.kernel_y + ky) * p.kernel_x + kx);
+              }
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void TestConv(const ConvParam &p, Shape<4> ishape, index_t nfilter, const char *name) {
+  const Shape<4> oshape = p.OutShape(ishape, nfilter);
+  const index_t wsize = ishape[1] * p.kernel_y * p.kernel_x;
+  // TensorContainer pads the rows when the width is not a multiple of the alignment
+  TensorContainer<cpu, 4> in(ishape), out(oshape), expect(oshape);
+  TensorContainer<cpu, 4> grad_out(oshape), grad_in(ishape), expect_in(ishape);
+  TensorContainer<cpu, 2> weight(Shape2(nfilter, wsize)), grad_w(weight.shape_);
+  TensorContainer<cpu, 2> expect_w(weight.shape_);
+  Fill(in, 37, 29, 1.0 / 14.0, -1.0);
+  Fill(weight, 13, 17, 1.0 / 8.0, -1.0);
+  Fill(grad_out, 7, 11, 1.0 / 5.0, -1.0);
+  expect = 0.0f; expect_in = 0.0f; expect_w = 0.0f;
+  ForEachTap(p, ishape, oshape, [&](index_t n, index_t m, index_t c, index_t oy, index_t ox,
+                                    index_t iy, index_t ix, index_t w) {
+      expect[n][m][oy][ox] += weight[m][w] * in[n][c][iy][ix];
+      expect_in[n][c][iy][ix] += weight[m][w] * grad_out[n][m][oy][ox];
+      expect_w[m][w] += grad_out[n][m][oy][ox] * in[n][c][iy][ix];
+    });
+  Workspace<cpu> ws;
+  ConvolutionForward(in, weight, out, p, &ws);
+  CheckEqual(out, expect, "forward", 1e-3);
+  ws.Reset();
+  grad_in = 1.0f;
+  ConvolutionBackwardData(grad_out, weight, grad_in, p, &ws);
+  CheckEqual(grad_in, expect_in, "backward data", 1e-3);
+  ws.Reset();
+  grad_w = 1.0f;
+  ConvolutionBackwardWeight(grad_out, in, grad_w, p, &ws);
+  CheckEqual(grad_w, expect_w, "backward weight", 1e-3);
+  printf("Test for convolution, %s Pass!\n", name);
+}
+
+int main(void) {
+  InitTensorEngine<cpu>();
+  TestConv(ConvParam(3, 1, 1), Shape4(2, 3, 9, 11), 4, "3x3, pad 1");
+  TestConv(ConvParam(3, 2, 0), Shape4(2, 2, 12, 8), 5, "3x3, stride 2");
+  TestConv(ConvParam(3, 1, 2, 2), Shape4(1, 3, 10, 10), 2, "3x3, dilation 2");
+  TestConv(ConvParam(1), Shape4(3, 6, 5, 8), 4, "1x1, packed rows");
+  TestConv(ConvParam(1), Shape4(2, 6, 5, 7), 3, "1x1, padded rows");
+  ConvParam p(5, 1, 1);
+  p.kernel_x = 2; p.stride_x = 3;
+  TestConv(p, Shape4(2, 2, 13, 16), 3, "5x2, stride 1x3");
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}
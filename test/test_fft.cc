@@ -0,0 +1,138 @@
+// test FFT, IFFT, FFT2D and IFFT2D against a naive DFT in double
+#include "test.h"
+#include <cmath>
+#include <complex>
+#include <cstdio>
+#include <vector>
+
+using namespace mshadow;
+
+typedef std::complex<double> Cplx;
+
+// y[j] = sum_k x[k] exp(-+2 pi i j k / n), divided by n for the inverse
+std::vector<Cplx> NaiveDFT(const std::vector<Cplx> &x, bool inverse) {
+  const size_t n = x.size();
+  const double sign = inverse ? 1.0 : -1.0;
+  std::vector<Cplx> y(n);
+  for (size_t j = 0; j < n; ++j) {
+    Cplx s(0.0, 0.0);
+    for (size_t k = 0; k < n; ++k) {
+      // j * k mod n keeps the angle exact for large n
+      const double a = sign * 2.0 * M_PI * static_cast<double>((j * k) % n) / n;
+      s += x[k] * Cplx(std::cos(a), std::sin(a));
+    }
+    y[j] = inverse ? s / static_cast<double>(n) : s;
+  }
+  return y;
+}
+
+template<typename DType>
+Cplx Get(const Tensor<cpu, 2, DType> &t, index_t i, index_t k) {
+  return Cplx(t[i][2 * k], t[i][2 * k + 1]);
+}
+
+// the error of a sum of n terms grows with log n in the FFT and with n in the direct sum,
+// the tolerance is relative to n times the largest magnitude of the inputs
+template<typename DType>
+void CheckRows(const Tensor<cpu, 2, DType> &t, const std::vector<std::vector<Cplx> > &expect,
+               double norm, double tol, const char *what) {
+  for (index_t i = 0; i < t.size(0); ++i) {
+    for (index_t k = 0; k < t.size(1) / 2; ++k) {
+      CHECK_LT(std::abs(Get(t, i, k) - expect[i][k]), tol * (1.0 + norm))
+          << what << ": mismatch at " << i << ", " << k << ": "
+          << Get(t, i, k) << " vs " << expect[i][k];
+    }
+  }
+}
+
+template<typename DType>
+void Test1D(index_t nbatch, index_t n, double tol, const char *type) {
+  // TensorContainer pads the rows when 2 * n is not a multiple of the alignment
+  TensorContainer<cpu, 3, DType> src(Shape3(nbatch, 1, 2 * n)), dst(src.shape_);
+  TensorContainer<cpu, 3, DType> back(src.shape_);
+  Tensor<cpu, 2, DType> s = src.FlatTo2D(), d = dst.FlatTo2D(), b = back.FlatTo2D();
+  Fill(s, 37, 101, 1.0 / 101, -0.5);
+  std::vector<std::vector<Cplx> > x(nbatch, std::vector<Cplx>(n)), expect(nbatch);
+  double norm = 0.0;
+  for (index_t i = 0; i < nbatch; ++i) {
+    for (index_t k = 0; k < n; ++k) {
+      x[i][k] = Get(s, i, k);
+      norm = std::max(norm, std::abs(x[i][k]) * n);
+    }
+    expect[i] = NaiveDFT(x[i], false);
+  }
+  FFT(dst, src);
+  CheckRows(d, expect, norm, tol, "FFT");
+  IFFT(back, dst);
+  CheckRows(b, x, norm, tol, "IFFT of FFT");
+  for (index_t i = 0; i < nbatch; ++i) expect[i] = NaiveDFT(x[i], true);
+  IFFT(dst, src);
+  CheckRows(d, expect, norm / n, tol, "IFFT");
+  // in place
+  FFT(src, src);
+  for (index_t i = 0; i < nbatch; ++i) expect[i] = NaiveDFT(x[i], false);
+  CheckRows(s, expect, norm, tol, "FFT in place");
+  IFFT(src, src);
+  CheckRows(s, x, norm, tol, "IFFT in place");
+  printf("Test for FFT<%s>, batch = %u, n = %u Pass!\n", type, nbatch, n);
+}
+
+template<typename DType>
+void Test2D(index_t nbatch, index_t h, index_t w, double tol, const char *type) {
+  TensorContainer<cpu, 4, DType> src(Shape4(nbatch, 1, h, 2 * w)), dst(src.shape_);
+  TensorContainer<cpu, 4, DType> back(src.shape_);
+  Tensor<cpu, 2, DType> s = src.FlatTo2D(), d = dst.FlatTo2D(), b = back.FlatTo2D();
+  Fill(s, 13, 97, 1.0 / 97, -0.5);
+  // the rows of plane p are rows p * h to (p + 1) * h of the flattened view
+  std::vector<std::vector<Cplx> > x(nbatch * h, std::vector<Cplx>(w));
+  std::vector<std::vector<Cplx> > expect(nbatch * h), iexpect(nbatch * h);
+  double norm = 0.0;
+  for (index_t i = 0; i < nbatch * h; ++i) {
+    for (index_t k = 0; k < w; ++k) {
+      x[i][k] = Get(s, i, k);
+      norm = std::max(norm, std::abs(x[i][k]) * h * w);
+    }
+    expect[i] = NaiveDFT(x[i], false);
+    iexpect[i] = NaiveDFT(x[i], true);
+  }
+  for (index_t p = 0; p < nbatch; ++p) {
+    for (index_t k = 0; k < w; ++k) {
+      std::vector<Cplx> col(h), icol(h);
+      for (index_t r = 0; r < h; ++r) {
+        col[r] = expect[p * h + r][k];
+        icol[r] = iexpect[p * h + r][k];
+      }
+      col = NaiveDFT(col, false);
+      icol = NaiveDFT(icol, true);
+      for (index_t r = 0; r < h; ++r) {
+        expect[p * h + r][k] = col[r];
+        iexpect[p * h + r][k] = icol[r];
+      }
+    }
+  }
+  FFT2D(dst, src);
+  CheckRows(d, expect, norm, tol, "FFT2D");
+  IFFT2D(back, dst);
+  CheckRows(b, x, norm, tol, "IFFT2D of FFT2D");
+  IFFT2D(dst, src);
+  CheckRows(d, iexpect, norm / (h * w), tol, "IFFT2D");
+  FFT2D(src, src);
+  CheckRows(s, expect, norm, tol, "FFT2D in place");
+  printf("Test for FFT2D<%s>, batch = %u, h = %u, w = %u Pass!\n", type, nbatch, h, w);
+}
+
+int main(void) {
+  InitTensorEngine<cpu>();
+  // radix 4 stages, a radix 2 stage for the odd powers of two, and the direct sum
+  const index_t lens[] = {1, 2, 3, 4, 5, 8, 12, 16, 32, 100, 256, 512, 1000, 1024};
+  for (index_t n : lens) {
+    Test1D<float>(3, n, 1e-5, "float");
+    Test1D<double>(2, n, 1e-12, "double");
+  }
+  Test2D<float>(2, 8, 6, 1e-5, "float");
+  Test2D<float>(3, 5, 16, 1e-5, "float");
+  Test2D<double>(1, 32, 2, 1e-12, "double");
+  Test2D<double>(2, 1, 7, 1e-12, "double");
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}
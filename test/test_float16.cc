@@ -0,0 +1,143 @@
+// test the rounding of float to half_t and bf16_t, scalar and through the packet engine
+#include <mshadow/tensor.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+using namespace mshadow;
+using namespace mshadow::expr;
+
+inline uint32_t FloatBits(float f) {
+  uint32_t u; std::memcpy(&u, &f, sizeof(u)); return u;
+}
+inline float BitsFloat(uint32_t u) {
+  float f; std::memcpy(&f, &u, sizeof(f)); return f;
+}
+
+// float bit patterns to convert: a sweep of all exponents, the ties and their neighbours
+std::vector<float> TestValues(void) {
+  std::vector<float> v;
+  for (uint32_t u = 0; u < 0x7F800000U; u += 0x00001235U) {
+    v.push_back(BitsFloat(u)); v.push_back(BitsFloat(u | 0x80000000U));
+  }
+  for (uint32_t e = 0; e < 255; ++e) {
+    for (uint32_t m = 0; m < 8; ++m) {
+      const uint32_t u = (e << 23) | (m << 16) | 0x8000U;
+      v.push_back(BitsFloat(u)); v.push_back(BitsFloat(u - 1)); v.push_back(BitsFloat(u + 1));
+      v.push_back(-BitsFloat(u));
+    }
+  }
+  const float extra[] = {0.0f, -0.0f, 65504.0f, 65505.0f, 65519.0f, 65520.0f, 1e10f,
+                         6.1035156e-05f, 5.9604645e-08f, 2.9802322e-08f, 1e-9f,
+                         BitsFloat(0x7F7FFFFFU), BitsFloat(0x7F800000U)};
+  for (float f : extra) {
+    v.push_back(f); v.push_back(-f);
+  }
+  return v;
+}
+
+// bf16_t rounds to nearest even, overflow goes to inf and nan stays a nan
+uint16_t ReferenceBF16(float f) {
+  const uint32_t u = FloatBits(f);
+  if (std::isnan(f)) return 0xFFFFU;
+  const uint32_t down = u >> 16, rest = u & 0xFFFFU;
+  if (rest > 0x8000U || (rest == 0x8000U && (down & 1U))) return down + 1;
+  return down;
+}
+
+// half_t rounds toward zero, values past the largest half go to inf
+float ReferenceHalf(float f, const std::vector<float> &positive) {
+  const float a = std::fabs(f);
+  float r;
+  if (a > 65504.0f) {
+    r = HUGE_VALF;
+  } else {
+    r = *(std::upper_bound(positive.begin(), positive.end(), a) - 1);
+  }
+  return std::signbit(f) ? -r : r;
+}
+
+void TestScalar(const std::vector<float> &values, const std::vector<float> &positive) {
+  for (float f : values) {
+    const bfloat::bf16_t b(f);
+    const uint16_t expect = ReferenceBF16(f);
+    if (expect == 0xFFFFU) {
+      CHECK(std::isnan(static_cast<float>(b)));
+    } else {
+      CHECK_EQ(b.bf16_, expect) << "bf16_t(" << f << ")";
+    }
+    const half::half_t h(f);
+    CHECK_EQ(static_cast<float>(h), ReferenceHalf(f, positive)) << "half_t(" << f << ")";
+  }
+  // every value of the types converts back to itself
+  for (uint32_t u = 0; u < 0x10000U; ++u) {
+    half::half_t h; h.half_ = static_cast<uint16_t>(u);
+    bfloat::bf16_t b; b.bf16_ = static_cast<uint16_t>(u);
+    if (!std::isnan(static_cast<float>(h))) {
+      CHECK_EQ(half::half_t(static_cast<float>(h)).half_, h.half_);
+    }
+    if (!std::isnan(static_cast<float>(b))) {
+      CHECK_EQ(bfloat::bf16_t(static_cast<float>(b)).bf16_, b.bf16_);
+    }
+  }
+  CHECK(std::isnan(static_cast<float>(bfloat::bf16_t(BitsFloat(0x7F800001U)))));
+  CHECK(std::isnan(static_cast<float>(half::half_t(BitsFloat(0x7F800001U)))));
+  printf("Test for scalar rounding of half_t and bf16_t Pass!\n");
+}
+
+// the packet engine gives the bits of the scalar conversion and operators
+template<typename DType>
+void TestTensor(const std::vector<float> &values, const char *name) {
+  const index_t n = static_cast<index_t>(values.size());
+  // aligned storage, so the packet engine is used where the arch supports the type
+  TensorContainer<cpu, 1> f(Shape1(n));
+  TensorContainer<cpu, 1, DType> d(Shape1(n)), s(Shape1(n));
+  float *fdata = f.dptr_;
+  DType *ddata = d.dptr_, *sdata = s.dptr_;
+  for (index_t i = 0; i < n; ++i) fdata[i] = values[i];
+  d = tcast<DType>(f);
+  for (index_t i = 0; i < n; ++i) {
+    const float expect = static_cast<float>(DType(fdata[i]));
+    if (std::isnan(expect)) {
+      CHECK(std::isnan(static_cast<float>(ddata[i]))) << name << ": tcast of nan";
+    } else {
+      CHECK_EQ(static_cast<float>(ddata[i]), expect) << name << ": tcast of " << fdata[i];
+    }
+  }
+  // sums and products of values of the type are rounded again
+  for (index_t i = 0; i < n; ++i) sdata[i] = DType(values[(i * 7919) % n] * 0.37f);
+  std::vector<DType> expect(n);
+  for (index_t i = 0; i < n; ++i) expect[i] = ddata[i] * sdata[i] + sdata[i];
+  d = d * s + s;
+  for (index_t i = 0; i < n; ++i) {
+    if (std::isnan(static_cast<float>(expect[i]))) {
+      CHECK(std::isnan(static_cast<float>(ddata[i]))) << name << ": nan at " << i;
+    } else {
+      CHECK_EQ(static_cast<float>(ddata[i]), static_cast<float>(expect[i]))
+          << name << ": d * s + s at " << i;
+    }
+  }
+  f = tcast<float>(s);
+  for (index_t i = 0; i < n; ++i) {
+    CHECK(fdata[i] == static_cast<float>(sdata[i]) ||
+          (std::isnan(fdata[i]) && std::isnan(static_cast<float>(sdata[i]))));
+  }
+  printf("Test for tensor rounding of %s Pass!\n", name);
+}
+
+int main(void) {
+  InitTensorEngine<cpu>();
+  std::vector<float> positive;
+  for (uint32_t u = 0; u < 0x7C00U; ++u) {
+    half::half_t h; h.half_ = static_cast<uint16_t>(u);
+    positive.push_back(static_cast<float>(h));
+  }
+  const std::vector<float> values = TestValues();
+  TestScalar(values, positive);
+  TestTensor<half::half_t>(values, "half_t");
+  TestTensor<bfloat::bf16_t>(values, "bf16_t");
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}
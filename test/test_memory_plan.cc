@@ -0,0 +1,99 @@
+// test MemoryPlan: tensors that share memory never live at the same time
+#include <mshadow/tensor.h>
+#include <mshadow/memory_plan.h>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+using namespace mshadow;
+
+// two tensors may overlap in the arena only if they are one group or their lifetimes
+// are disjoint
+void CheckPlan(const MemoryPlan<cpu> &mp, const std::vector<int> &ids,
+               const std::vector<size_t> &bytes) {
+  for (size_t i = 0; i < ids.size(); ++i) {
+    CHECK_LE(mp.offset(ids[i]) + bytes[i], mp.arena_bytes());
+    for (size_t j = i + 1; j < ids.size(); ++j) {
+      const size_t a0 = mp.offset(ids[i]), a1 = a0 + bytes[i];
+      const size_t b0 = mp.offset(ids[j]), b1 = b0 + bytes[j];
+      if (a1 <= b0 || b1 <= a0) continue;
+      std::pair<int, int> la = mp.lifetime(ids[i]), lb = mp.lifetime(ids[j]);
+      CHECK(la == lb || la.second < lb.first || lb.second < la.first)
+          << "tensors " << ids[i] << " and " << ids[j] << " overlap while both alive";
+    }
+  }
+}
+
+void test_chain() {
+  MemoryPlan<cpu> mp;
+  int x = mp.Declare<float>(Shape2(4, 64));
+  int h = mp.Declare<float>(Shape2(4, 128));
+  int a = mp.Declare<float>(Shape2(4, 128));
+  int y = mp.Declare<float>(Shape2(4, 16));
+  mp.KeepAlive(x); mp.KeepAlive(y);
+  mp.AddOp({x}, {h});
+  mp.AddOp({h}, {a}, {std::make_pair(h, a)});
+  mp.AddOp({a}, {y});
+  mp.Plan();
+  // the activation is written over its input
+  CHECK_EQ(mp.offset(h), mp.offset(a));
+  CHECK_LT(mp.arena_bytes(), mp.total_bytes());
+  std::vector<int> ids = {x, h, a, y};
+  std::vector<size_t> bytes = {4 * 64 * 4, 4 * 128 * 4, 4 * 128 * 4, 4 * 16 * 4};
+  CheckPlan(mp, ids, bytes);
+  Tensor<cpu, 2> th = mp.Get<float, 2>(h);
+  CHECK_EQ(th.size(1), 128U);
+  printf("Test for chain of operations Pass!\n");
+}
+
+void test_two_inplace_outputs() {
+  // both outputs of one operation may be written over x, only one of them can be
+  MemoryPlan<cpu> mp;
+  int x = mp.Declare<float>(Shape1(64));
+  int a = mp.Declare<float>(Shape1(64));
+  int b = mp.Declare<float>(Shape1(64));
+  int y = mp.Declare<float>(Shape1(64));
+  mp.AddOp({}, {x});
+  mp.AddOp({x}, {a, b}, {std::make_pair(x, a), std::make_pair(x, b)});
+  mp.AddOp({b}, {y});
+  mp.KeepAlive(y);
+  mp.Plan();
+  CHECK_NE(mp.offset(a), mp.offset(b));
+  std::vector<int> ids = {x, a, b, y};
+  std::vector<size_t> bytes(4, 256);
+  CheckPlan(mp, ids, bytes);
+  printf("Test for two inplace outputs of one operation Pass!\n");
+}
+
+void test_reuse() {
+  // a long sequence of operations, each reads the previous two tensors
+  MemoryPlan<cpu> mp;
+  std::vector<int> ids;
+  std::vector<size_t> bytes;
+  for (int i = 0; i < 12; ++i) {
+    const index_t n = 64 * (1 + i % 3);
+    ids.push_back(mp.Declare<float>(Shape1(n)));
+    bytes.push_back(n * sizeof(float));
+  }
+  mp.KeepAlive(ids[0]);
+  mp.AddOp({}, {ids[0]});
+  mp.AddOp({ids[0]}, {ids[1]});
+  for (size_t i = 2; i < ids.size(); ++i) {
+    if (i % 4 == 0) {
+      mp.AddOp({ids[i - 2], ids[i - 1]}, {ids[i]}, {std::make_pair(ids[i - 2], ids[i])});
+    } else {
+      mp.AddOp({ids[i - 2], ids[i - 1]}, {ids[i]});
+    }
+  }
+  mp.Plan();
+  CheckPlan(mp, ids, bytes);
+  CHECK_LT(mp.arena_bytes(), mp.total_bytes());
+  printf("Test for reuse of a long sequence Pass!\n");
+}
+
+int main(void) {
+  test_chain();
+  test_two_inplace_outputs();
+  test_reuse();
+  return 0;
+}
@@ -0,0 +1,186 @@
+// test batch and layer normalization and their gradients against naive loops in double
+#include "test.h"
+#include <cmath>
+#include <cstdio>
+#include <vector>
+
+using namespace mshadow;
+
+void CheckNear(double a, double b, double tol, const char *what, index_t i) {
+  CHECK_LT(std::fabs(a - b), tol * (1.0 + std::fabs(b)))
+      << what << ": mismatch at " << i << ": " << a << " vs " << b;
+}
+
+// the values of channel c are x[k] for k in idx[c], all the naive statistics go through it
+struct Groups {
+  std::vector<std::vector<std::pair<index_t, index_t> > > idx;
+};
+
+// the normalization of each group: forward, then the gradients for dy
+void NaiveNorm(const Tensor<cpu, 2> &x, const Tensor<cpu, 2> &dy, const Groups &g,
+               const std::vector<double> &gamma, const std::vector<double> &beta,
+               bool per_column, double eps,
+               std::vector<double> *mean, std::vector<double> *invstd,
+               std::vector<std::vector<double> > *y, std::vector<std::vector<double> > *dx) {
+  y->assign(x.size(0), std::vector<double>(x.size(1)));
+  dx->assign(x.size(0), std::vector<double>(x.size(1)));
+  mean->resize(g.idx.size());
+  invstd->resize(g.idx.size());
+  for (size_t c = 0; c < g.idx.size(); ++c) {
+    const std::vector<std::pair<index_t, index_t> > &idx = g.idx[c];
+    const double n = static_cast<double>(idx.size());
+    double m = 0.0, v = 0.0;
+    for (size_t k = 0; k < idx.size(); ++k) m += x[idx[k].first][idx[k].second];
+    m /= n;
+    for (size_t k = 0; k < idx.size(); ++k) {
+      const double d = x[idx[k].first][idx[k].second] - m;
+      v += d * d;
+    }
+    const double is = 1.0 / std::sqrt(v / n + eps);
+    (*mean)[c] = m; (*invstd)[c] = is;
+    // the sums of the gradient of xhat, gamma is taken per element
+    double sum_g = 0.0, sum_gx = 0.0;
+    for (size_t k = 0; k < idx.size(); ++k) {
+      const index_t i = idx[k].first, j = idx[k].second;
+      const double gm = per_column ? gamma[j] : gamma[c];
+      const double bt = per_column ? beta[j] : beta[c];
+      const double xhat = (x[i][j] - m) * is;
+      (*y)[i][j] = xhat * gm + bt;
+      sum_g += dy[i][j] * gm;
+      sum_gx += dy[i][j] * gm * xhat;
+    }
+    for (size_t k = 0; k < idx.size(); ++k) {
+      const index_t i = idx[k].first, j = idx[k].second;
+      const double gm = per_column ? gamma[j] : gamma[c];
+      const double xhat = (x[i][j] - m) * is;
+      (*dx)[i][j] = is * (dy[i][j] * gm - sum_g / n - xhat * sum_gx / n);
+    }
+  }
+}
+
+void TestBatchNorm(index_t n, index_t c, index_t m, float offset) {
+  TensorContainer<cpu, 3> data(Shape3(n, c, m)), out(data.shape_), grad_out(data.shape_);
+  TensorContainer<cpu, 3> grad_data(data.shape_);
+  TensorContainer<cpu, 1> mean(Shape1(c)), invstd(Shape1(c)), gamma(Shape1(c)), beta(Shape1(c));
+  TensorContainer<cpu, 1> grad_gamma(Shape1(c)), grad_beta(Shape1(c));
+  Tensor<cpu, 2> x = data.FlatTo2D(), dy = grad_out.FlatTo2D();
+  // values around offset, so that a one pass sum of squares would lose the variance
+  Fill(x, 37, 101, 0.01f, offset);
+  Fill(dy, 13, 17, 0.125f, -1.0f);
+  std::vector<double> g(c), b(c);
+  for (index_t k = 0; k < c; ++k) {
+    gamma[k] = g[k] = 0.5f + 0.25f * k;
+    beta[k] = b[k] = -0.5f * k;
+  }
+  // row i * c + k of the flattened view is channel k of sample i
+  Groups groups;
+  groups.idx.resize(c);
+  for (index_t i = 0; i < x.size(0); ++i) {
+    for (index_t j = 0; j < m; ++j) groups.idx[i % c].push_back(std::make_pair(i, j));
+  }
+  std::vector<double> emean, einvstd;
+  std::vector<std::vector<double> > ey, edx;
+  const float eps = 1e-5f;
+  NaiveNorm(x, dy, groups, g, b, false, eps, &emean, &einvstd, &ey, &edx);
+  BatchNormForward(out, mean, invstd, data, gamma, beta, eps);
+  for (index_t k = 0; k < c; ++k) {
+    CheckNear(mean[k], emean[k], 1e-7, "batch norm mean", k);
+    CheckNear(invstd[k], einvstd[k], 1e-3, "batch norm invstd", k);
+  }
+  Tensor<cpu, 2> y = out.FlatTo2D(), dx = grad_data.FlatTo2D();
+  for (index_t i = 0; i < y.size(0); ++i) {
+    for (index_t j = 0; j < m; ++j) CheckNear(y[i][j], ey[i][j], 1e-3, "batch norm out", j);
+  }
+  BatchNormBackward(grad_data, grad_gamma, grad_beta, grad_out, data, mean, invstd, gamma);
+  for (index_t i = 0; i < dx.size(0); ++i) {
+    for (index_t j = 0; j < m; ++j) {
+      CheckNear(dx[i][j], edx[i][j], 2e-3, "batch norm grad_data", j);
+    }
+  }
+  for (index_t k = 0; k < c; ++k) {
+    double sg = 0.0, sb = 0.0;
+    for (size_t t = 0; t < groups.idx[k].size(); ++t) {
+      const index_t i = groups.idx[k][t].first, j = groups.idx[k][t].second;
+      sg += dy[i][j] * (x[i][j] - emean[k]) * einvstd[k];
+      sb += dy[i][j];
+    }
+    CheckNear(grad_gamma[k], sg, 1e-3, "batch norm grad_gamma", k);
+    CheckNear(grad_beta[k], sb, 1e-4, "batch norm grad_beta", k);
+  }
+  // the inference form with the statistics of the batch gives the same output
+  out = 0.0f;
+  BatchNormApply(out, data, mean, invstd, gamma, beta);
+  for (index_t i = 0; i < y.size(0); ++i) {
+    for (index_t j = 0; j < m; ++j) CheckNear(y[i][j], ey[i][j], 1e-3, "batch norm apply", j);
+  }
+  // in place
+  BatchNormForward(data, mean, invstd, data, gamma, beta, eps);
+  for (index_t i = 0; i < x.size(0); ++i) {
+    for (index_t j = 0; j < m; ++j) CheckNear(x[i][j], ey[i][j], 1e-3, "batch norm in place", j);
+  }
+  printf("Test for batch norm, shape = (%u, %u, %u), offset = %g Pass!\n", n, c, m, offset);
+}
+
+void TestLayerNorm(index_t n, index_t d, float offset) {
+  TensorContainer<cpu, 2> data(Shape2(n, d)), out(data.shape_), grad_out(data.shape_);
+  TensorContainer<cpu, 2> grad_data(data.shape_);
+  TensorContainer<cpu, 1> mean(Shape1(n)), invstd(Shape1(n)), gamma(Shape1(d)), beta(Shape1(d));
+  TensorContainer<cpu, 1> grad_gamma(Shape1(d)), grad_beta(Shape1(d));
+  Fill(data, 29, 97, 0.02f, offset);
+  Fill(grad_out, 11, 13, 0.25f, -1.5f);
+  std::vector<double> g(d), b(d);
+  for (index_t j = 0; j < d; ++j) {
+    gamma[j] = g[j] = 1.0f + 0.01f * (j % 10);
+    beta[j] = b[j] = 0.1f * (j % 3);
+  }
+  Groups groups;
+  groups.idx.resize(n);
+  for (index_t i = 0; i < n; ++i) {
+    for (index_t j = 0; j < d; ++j) groups.idx[i].push_back(std::make_pair(i, j));
+  }
+  std::vector<double> emean, einvstd;
+  std::vector<std::vector<double> > ey, edx;
+  const float eps = 1e-5f;
+  NaiveNorm(data, grad_out, groups, g, b, true, eps, &emean, &einvstd, &ey, &edx);
+  LayerNormForward(out, mean, invstd, data, gamma, beta, eps);
+  for (index_t i = 0; i < n; ++i) {
+    CheckNear(mean[i], emean[i], 1e-7, "layer norm mean", i);
+    CheckNear(invstd[i], einvstd[i], 1e-3, "layer norm invstd", i);
+    for (index_t j = 0; j < d; ++j) CheckNear(out[i][j], ey[i][j], 1e-3, "layer norm out", j);
+  }
+  LayerNormBackward(grad_data, grad_gamma, grad_beta, grad_out, data, mean, invstd, gamma);
+  for (index_t i = 0; i < n; ++i) {
+    for (index_t j = 0; j < d; ++j) {
+      CheckNear(grad_data[i][j], edx[i][j], 2e-3, "layer norm grad_data", j);
+    }
+  }
+  for (index_t j = 0; j < d; ++j) {
+    double sg = 0.0, sb = 0.0;
+    for (index_t i = 0; i < n; ++i) {
+      sg += grad_out[i][j] * (data[i][j] - emean[i]) * einvstd[i];
+      sb += grad_out[i][j];
+    }
+    CheckNear(grad_gamma[j], sg, 1e-3, "layer norm grad_gamma", j);
+    CheckNear(grad_beta[j], sb, 1e-4, "layer norm grad_beta", j);
+  }
+  // the gradient written over grad_out
+  LayerNormBackward(grad_out, grad_gamma, grad_beta, grad_out, data, mean, invstd, gamma);
+  for (index_t i = 0; i < n; ++i) {
+    for (index_t j = 0; j < d; ++j) {
+      CheckNear(grad_out[i][j], edx[i][j], 2e-3, "layer norm grad in place", j);
+    }
+  }
+  printf("Test for layer norm, shape = (%u, %u), offset = %g Pass!\n", n, d, offset);
+}
+
+int main(void) {
+  InitTensorEngine<cpu>();
+  TestBatchNorm(4, 3, 25, 0.0f);
+  TestBatchNorm(2, 5, 1000, 1000.0f);
+  TestBatchNorm(64, 2, 1, -3.0f);
+  TestLayerNorm(5, 7, 0.0f);
+  TestLayerNorm(3, 5000, 1000.0f);
+  TestLayerNorm(100, 64, 2.0f);
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}
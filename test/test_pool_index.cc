@@ -0,0 +1,133 @@
+// test pool, unpool, MaxPoolWithIndex and UnPoolWithIndex against naive loops
+#include "test.h"
+#include <cmath>
+#include <cstdio>
+
+using namespace mshadow;
+using namespace mshadow::expr;
+
+// window of pooled element (py, px), clipped at the border of the source
+void Window(index_t py, index_t px, index_t ky, index_t kx, index_t sy, index_t sx,
+            index_t height, index_t width, index_t *y0, index_t *y1,
+            index_t *x0, index_t *x1) {
+  *y0 = py * sy; *y1 = std::min(*y0 + ky, height);
+  *x0 = px * sx; *x1 = std::min(*x0 + kx, width);
+}
+
+template<typename Reducer>
+void NaivePool(const Tensor<cpu, 4> &src, Tensor<cpu, 4> dst,
+               index_t ky, index_t kx, index_t sy, index_t sx) {
+  for (index_t n = 0; n < dst.size(0); ++n) {
+    for (index_t c = 0; c < dst.size(1); ++c) {
+      for (index_t py = 0; py < dst.size(2); ++py) {
+        for (index_t px = 0; px < dst.size(3); ++px) {
+          index_t y0, y1, x0, x1;
+          Window(py, px, ky, kx, sy, sx, src.size(2), src.size(3), &y0, &y1, &x0, &x1);
+          float res; Reducer::SetInitValue(res);
+          for (index_t y = y0; y < y1; ++y) {
+            for (index_t x = x0; x < x1; ++x) Reducer::Reduce(res, src[n][c][y][x]);
+          }
+          dst[n][c][py][px] = res;
+        }
+      }
+    }
+  }
+}
+
+template<typename Reducer>
+void NaiveUnpool(const Tensor<cpu, 4> &data, const Tensor<cpu, 4> &pooled,
+                 const Tensor<cpu, 4> &grad, Tensor<cpu, 4> grad_src,
+                 index_t ky, index_t kx, index_t sy, index_t sx) {
+  grad_src = 0.0f;
+  for (index_t n = 0; n < grad.size(0); ++n) {
+    for (index_t c = 0; c < grad.size(1); ++c) {
+      for (index_t py = 0; py < grad.size(2); ++py) {
+        for (index_t px = 0; px < grad.size(3); ++px) {
+          index_t y0, y1, x0, x1;
+          Window(py, px, ky, kx, sy, sx, data.size(2), data.size(3), &y0, &y1, &x0, &x1);
+          for (index_t y = y0; y < y1; ++y) {
+            for (index_t x = x0; x < x1; ++x) {
+              grad_src[n][c][y][x] +=
+                  Reducer::PartialGrad(data[n][c][y][x], pooled[n][c][py][px]) *
+                  grad[n][c][py][px];
+            }
+          }
+        }
+      }
+    }
+  }
+}
+
+void TestPool(index_t height, index_t width, index_t ky, index_t kx,
+              index_t sy, index_t sx) {
+  const index_t ph = (height - ky) / sy + 1, pw = (width - kx) / sx + 1;
+  Shape<4> sshape = Shape4(2, 3, height, width), pshape = Shape4(2, 3, ph, pw);
+  TensorContainer<cpu, 4> data(sshape), pooled(pshape), expect(pshape), index(pshape);
+  TensorContainer<cpu, 4> grad(pshape), grad_src(sshape), expect_src(sshape);
+  // few distinct values, so the windows have ties
+  Fill(data, 37, 11, 1.0f, -5.0f);
+  Fill(grad, 13, 7, 0.5f, 0.25f);
+
+  NaivePool<red::sum>(data, expect, ky, kx, sy, sx);
+  pooled = pool<red::sum>(data, ky, kx, sy, sx);
+  CheckEqual(pooled, expect, "pool<sum>");
+  pooled = pool<red::sum>(data * 1.0f, ky, kx, sy, sx);
+  CheckEqual(pooled, expect, "pool<sum> plan");
+  NaiveUnpool<red::sum>(data, pooled, grad, expect_src, ky, kx, sy, sx);
+  grad_src = unpool<red::sum>(data, pooled, grad, ky, kx, sy, sx);
+  CheckEqual(grad_src, expect_src, "unpool<sum>");
+
+  NaivePool<red::maximum>(data, expect, ky, kx, sy, sx);
+  pooled = pool<red::maximum>(data, ky, kx, sy, sx);
+  CheckEqual(pooled, expect, "pool<maximum>");
+  pooled = pool<red::maximum>(data * 1.0f, ky, kx, sy, sx);
+  CheckEqual(pooled, expect, "pool<maximum> plan");
+  NaiveUnpool<red::maximum>(data, pooled, grad, expect_src, ky, kx, sy, sx);
+  grad_src = unpool<red::maximum>(data, pooled, grad, ky, kx, sy, sx);
+  CheckEqual(grad_src, expect_src, "unpool<maximum>");
+
+  pooled = 0.0f;
+  MaxPoolWithIndex(pooled, index, data, ky, kx, sy, sx);
+  CheckEqual(pooled, expect, "MaxPoolWithIndex");
+  // the index is the first maximum of the window in row major order
+  expect_src = 0.0f;
+  for (index_t n = 0; n < 2; ++n) {
+    for (index_t c = 0; c < 3; ++c) {
+      for (index_t py = 0; py < ph; ++py) {
+        for (index_t px = 0; px < pw; ++px) {
+          index_t y0, y1, x0, x1, best = 0;
+          Window(py, px, ky, kx, sy, sx, height, width, &y0, &y1, &x0, &x1);
+          bool found = false;
+          for (index_t y = y0; y < y1 && !found; ++y) {
+            for (index_t x = x0; x < x1 && !found; ++x) {
+              if (data[n][c][y][x] == expect[n][c][py][px]) {
+                best = y * width + x; found = true;
+              }
+            }
+          }
+          CHECK_EQ(static_cast<index_t>(index[n][c][py][px]), best)
+              << "MaxPoolWithIndex: index at " << py << ", " << px;
+          expect_src[n][c][best / width][best % width] += grad[n][c][py][px];
+        }
+      }
+    }
+  }
+  grad_src = -1.0f;
+  UnPoolWithIndex(grad_src, index, grad, ky, kx, sy, sx);
+  CheckEqual(grad_src, expect_src, "UnPoolWithIndex");
+  printf("Test for pooling, shape = (%u, %u), kernel = (%u, %u), stride = (%u, %u) Pass!\n",
+         height, width, ky, kx, sy, sx);
+}
+
+int main(void) {
+  InitTensorEngine<cpu>();
+  // windows that tile the source
+  TestPool(8, 12, 2, 2, 2, 2);
+  // overlapping windows
+  TestPool(9, 13, 3, 3, 2, 2);
+  TestPool(7, 10, 3, 2, 1, 1);
+  // windows that skip part of the source
+  TestPool(11, 9, 2, 3, 4, 3);
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}
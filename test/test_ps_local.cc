@@ -0,0 +1,131 @@
+// test the sums of LocalModel with keys fused into buckets, partitioned keys and stale pulls
+// only the local model, without the distributed backends
+#define MSHADOW_DIST_PS 0
+#define MSHADOW_RABIT_PS 0
+#include <mshadow/tensor.h>
+#include <mshadow-ps/mshadow_ps.h>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace mshadow;
+
+namespace mshadow {
+namespace ps {
+// the sums are done by LocalModel itself, there is no updater
+template<>
+IModelUpdater<float> *CreateModelUpdater(void) {
+  return NULL;
+}
+}  // namespace ps
+}  // namespace mshadow
+
+const int kNumDevice = 3;
+
+// element i of key k pushed by device d in round t
+inline float PushValue(int d, int k, int t, index_t i) {
+  return static_cast<float>((d + 1) * (k + 1) + t * 100 + static_cast<int>(i % 7));
+}
+
+// device d pushes every key each round and pulls the sums back, a pull may return the
+// sum of a round up to staleness rounds before the last push
+void RunWorker(ps::ISharedModel<cpu, float> *ps, int d, const std::vector<Shape<2> > &shapes,
+               int nround, int staleness) {
+  InitTensorEngine<cpu>();
+  const int nkey = static_cast<int>(shapes.size());
+  std::vector<TensorContainer<cpu, 2> > push(nkey), pull(nkey);
+  for (int k = 0; k < nkey; ++k) {
+    push[k].Resize(shapes[k]);
+    pull[k].Resize(shapes[k]);
+    ps->InitKey(shapes[k], k, d);
+  }
+  for (int t = 0; t < nround; ++t) {
+    for (int k = 0; k < nkey; ++k) {
+      Tensor<cpu, 2> p = push[k];
+      for (index_t y = 0; y < p.size(0); ++y) {
+        for (index_t x = 0; x < p.size(1); ++x) p[y][x] = PushValue(d, k, t, y * p.size(1) + x);
+      }
+      // the priority of the later keys is higher, as in back propagation
+      ps->Push(push[k], k, d, k);
+      ps->PullReq(pull[k], k, d, k);
+    }
+    for (int k = 0; k < nkey; ++k) {
+      ps->PullWait(k, d);
+      Tensor<cpu, 2> p = pull[k];
+      int round = -1;
+      for (index_t y = 0; y < p.size(0); ++y) {
+        for (index_t x = 0; x < p.size(1); ++x) {
+          const index_t i = y * p.size(1) + x;
+          float rest = p[y][x];
+          for (int dd = 0; dd < kNumDevice; ++dd) rest -= PushValue(dd, k, 0, i);
+          // the rest is kNumDevice * 100 * round
+          const int r = static_cast<int>(rest) / (kNumDevice * 100);
+          CHECK_EQ(rest, static_cast<float>(r * kNumDevice * 100))
+              << "key " << k << ", element " << i << ": " << p[y][x] << " is not a sum";
+          if (round == -1) round = r;
+          CHECK_EQ(r, round) << "key " << k << ": elements of different rounds";
+        }
+      }
+      CHECK(round <= t && round >= t - staleness)
+          << "key " << k << ": pulled the sum of round " << round << " in round " << t;
+    }
+  }
+  ShutdownTensorEngine<cpu>();
+}
+
+void TestLocalModel(const char *name, const std::vector<std::pair<std::string, std::string> >
+                    &params, const std::vector<Shape<2> > &shapes, int nround) {
+  ps::ISharedModel<cpu, float> *ps = ps::CreateSharedModel<cpu, float>("local");
+  int staleness = 0;
+  for (size_t i = 0; i < params.size(); ++i) {
+    ps->SetParam(params[i].first.c_str(), params[i].second.c_str());
+    if (params[i].first == "staleness") staleness = atoi(params[i].second.c_str());
+  }
+  std::vector<int> devs;
+  for (int d = 0; d < kNumDevice; ++d) devs.push_back(d);
+  ps->Init(devs);
+  std::vector<std::thread> workers;
+  for (int d = 0; d < kNumDevice; ++d) {
+    workers.push_back(std::thread(RunWorker, ps, d, shapes, nround, staleness));
+  }
+  for (size_t i = 0; i < workers.size(); ++i) workers[i].join();
+  delete ps;
+  printf("Test for LocalModel, %s Pass!\n", name);
+}
+
+int main(void) {
+  typedef std::pair<std::string, std::string> Param;
+  std::vector<Shape<2> > shapes;
+  shapes.push_back(Shape2(2, 3));
+  shapes.push_back(Shape2(1, 5));
+  shapes.push_back(Shape2(37, 5));
+  shapes.push_back(Shape2(4, 4));
+  shapes.push_back(Shape2(3, 7));
+  shapes.push_back(Shape2(64, 1));
+  shapes.push_back(Shape2(1, 1));
+  TestLocalModel("plain", std::vector<Param>(), shapes, 4);
+  // the small keys go to buckets of at most 24 elements
+  std::vector<Param> bucket;
+  bucket.push_back(Param("bucket_bound", "32"));
+  bucket.push_back(Param("bucket_size", "24"));
+  TestLocalModel("buckets", bucket, shapes, 4);
+  // the big keys are pushed and pulled in chunks
+  std::vector<Param> partition;
+  partition.push_back(Param("partition_size", "16"));
+  TestLocalModel("partitions", partition, shapes, 4);
+  partition.push_back(Param("push_thread", "one"));
+  partition.push_back(Param("pull_thread", "one"));
+  TestLocalModel("partitions, one thread", partition, shapes, 4);
+  // all together with stale pulls
+  std::vector<Param> stale(bucket);
+  stale.push_back(Param("partition_size", "16"));
+  stale.push_back(Param("staleness", "2"));
+  TestLocalModel("staleness 2", stale, shapes, 10);
+  stale.back().second = "0";
+  TestLocalModel("staleness 0", stale, shapes, 6);
+  return 0;
+}
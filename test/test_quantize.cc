@@ -0,0 +1,97 @@
+// test quantize, dequantize and the uint8 x int8 -> int32 dot against naive loops
+#include <mshadow/tensor.h>
+#include <cmath>
+#include <cstdio>
+
+using namespace mshadow;
+using namespace mshadow::expr;
+
+// the expressions multiply by 1 / scale, so the same is done here
+template<typename DType>
+DType NaiveQuantize(float x, float scale, int32_t zero_point, float lo, float hi) {
+  const float q = std::nearbyint(x * (1.0f / scale)) + static_cast<float>(zero_point);
+  return static_cast<DType>(std::min(std::max(q, lo), hi));
+}
+
+void TestQuantize(void) {
+  const index_t n = 1000;
+  const float scale = 0.05f;
+  TensorContainer<cpu, 2> x(Shape2(4, n)), y(Shape2(4, n));
+  TensorContainer<cpu, 2, uint8_t> qu(Shape2(4, n));
+  TensorContainer<cpu, 2, int8_t> qs(Shape2(4, n));
+  for (index_t i = 0; i < 4; ++i) {
+    // beyond the range of both types, and the halfway points of the steps
+    for (index_t j = 0; j < n; ++j) x[i][j] = (static_cast<float>(j) - 500.0f) * 0.0125f + i;
+  }
+  qu = quantize<uint8_t>(x, scale, 128);
+  qs = quantize<int8_t>(x * 1.0f, scale, -3);
+  for (index_t i = 0; i < 4; ++i) {
+    for (index_t j = 0; j < n; ++j) {
+      CHECK_EQ(qu[i][j], NaiveQuantize<uint8_t>(x[i][j], scale, 128, 0.0f, 255.0f))
+          << "quantize<uint8_t>(" << x[i][j] << ")";
+      CHECK_EQ(qs[i][j], NaiveQuantize<int8_t>(x[i][j], scale, -3, -128.0f, 127.0f))
+          << "quantize<int8_t>(" << x[i][j] << ")";
+    }
+  }
+  y = dequantize(qu, scale, 128);
+  for (index_t i = 0; i < 4; ++i) {
+    for (index_t j = 0; j < n; ++j) {
+      CHECK_EQ(y[i][j], scale * (static_cast<int32_t>(qu[i][j]) - 128));
+      // inside the range the error is at most half a step
+      if (qu[i][j] != 0 && qu[i][j] != 255) {
+        CHECK_LE(std::fabs(y[i][j] - x[i][j]), scale * 0.5f + 1e-6f);
+      }
+    }
+  }
+  printf("Test for quantize and dequantize Pass!\n");
+}
+
+void TestDot(index_t m, index_t n, index_t k, int32_t zero_point) {
+  // the operands are views of larger matrices, so the leading dimensions differ from k and n
+  TensorContainer<cpu, 2, uint8_t> abig(Shape2(m, k + 5));
+  TensorContainer<cpu, 2, int8_t> bbig(Shape2(k, n + 3));
+  for (index_t i = 0; i < m; ++i) {
+    for (index_t p = 0; p < k + 5; ++p) abig[i][p] = static_cast<uint8_t>((i * 31 + p * 17) % 256);
+  }
+  for (index_t p = 0; p < k; ++p) {
+    for (index_t j = 0; j < n + 3; ++j) {
+      bbig[p][j] = static_cast<int8_t>((p * 13 + j * 29) % 256 - 128);
+    }
+  }
+  Tensor<cpu, 2, uint8_t> a = abig.Slice(0, m);
+  a.shape_[1] = k;
+  Tensor<cpu, 2, int8_t> b(bbig.dptr_ + 1, Shape2(k, n), bbig.stride_, NULL);
+  TensorContainer<cpu, 2, int32_t> c(Shape2(m, n));
+  TensorContainer<cpu, 2, uint8_t> r(Shape2(m, n));
+  TensorContainer<cpu, 2> f(Shape2(m, n));
+  const float multiplier = 1.0f / 4096.0f;
+  c = dot(a, b, zero_point);
+  r = requantize<uint8_t>(dot(a, b, zero_point), multiplier, 100);
+  f = requantize<float>(dot(a, b, zero_point), 0.5f);
+  for (index_t i = 0; i < m; ++i) {
+    for (index_t j = 0; j < n; ++j) {
+      int32_t sum = 0;
+      for (index_t p = 0; p < k; ++p) {
+        sum += (static_cast<int32_t>(a[i][p]) - zero_point) * static_cast<int32_t>(b[p][j]);
+      }
+      CHECK_EQ(c[i][j], sum) << "dot-int8: (" << i << ", " << j << ")";
+      CHECK_EQ(r[i][j], NaiveQuantize<uint8_t>(static_cast<float>(sum) * multiplier, 1.0f,
+                                               100, 0.0f, 255.0f));
+      CHECK_EQ(f[i][j], static_cast<float>(sum) * 0.5f);
+    }
+  }
+  printf("Test for dot-int8, m = %u, n = %u, k = %u, zero_point = %d Pass!\n",
+         m, n, k, zero_point);
+}
+
+int main(void) {
+  InitTensorEngine<cpu>();
+  TestQuantize();
+  // shapes that fill the blocks of the kernels, and shapes with remainders
+  TestDot(8, 32, 64, 0);
+  TestDot(7, 37, 13, 128);
+  TestDot(1, 5, 1, 3);
+  TestDot(33, 100, 255, 255);
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}
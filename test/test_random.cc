@@ -0,0 +1,84 @@
+// test the Philox4x32-10 generator: known answers and the streams of Random<cpu>
+#define MSHADOW_RANDOM_PHILOX 1
+#include <mshadow/tensor.h>
+#include <cmath>
+#include <cstdio>
+
+using namespace mshadow;
+using namespace mshadow::expr;
+
+// the known answer test vectors of Random123 (kat_vectors, philox4x32 10 rounds)
+void TestKnownAnswer(void) {
+  const uint32_t ctr[3][4] = {
+    {0x00000000U, 0x00000000U, 0x00000000U, 0x00000000U},
+    {0xffffffffU, 0xffffffffU, 0xffffffffU, 0xffffffffU},
+    {0x243f6a88U, 0x85a308d3U, 0x13198a2eU, 0x03707344U}};
+  const uint32_t key[3][2] = {
+    {0x00000000U, 0x00000000U},
+    {0xffffffffU, 0xffffffffU},
+    {0xa4093822U, 0x299f31d0U}};
+  const uint32_t expect[3][4] = {
+    {0x6627e8d5U, 0xe169c58dU, 0xbc57ac4cU, 0x9b00dbd8U},
+    {0x408f276dU, 0x41c83b0eU, 0xa20bc7c6U, 0x6d5451fdU},
+    {0xd16cfe09U, 0x94fdccebU, 0x5001e420U, 0x24126ea1U}};
+  for (int t = 0; t < 3; ++t) {
+    uint32_t out[4];
+    Philox4x32::Generate(ctr[t], key[t][0], key[t][1], out);
+    for (int i = 0; i < 4; ++i) {
+      CHECK_EQ(out[i], expect[t][i]) << "Philox4x32: vector " << t << ", word " << i;
+    }
+  }
+  printf("Test for Philox4x32 known answers Pass!\n");
+}
+
+// element (i, j) of a sample is number i * ncol + j of its stream, also with padded rows
+template<typename DType>
+void TestStream(const char *name) {
+  const int kPerBlock = PhiloxDist<DType>::kPerBlock;
+  const index_t nrow = 37, ncol = 29;
+  const unsigned seed = 17;
+  Random<cpu, DType> rnd(seed);
+  TensorContainer<cpu, 2, DType> a(Shape2(nrow, ncol)), b(Shape2(nrow, ncol));
+  rnd.SampleUniform(&a, DType(-2.0f), DType(3.0f));
+  for (index_t i = 0; i < nrow; ++i) {
+    for (index_t j = 0; j < ncol; ++j) {
+      const uint64_t e = static_cast<uint64_t>(i) * ncol + j;
+      uint32_t w[4];
+      Philox4x32::Block(seed, 0, e / kPerBlock, w);
+      DType v[4];
+      PhiloxDist<DType>::template Sample<false>(w, DType(-2.0f), DType(3.0f), v);
+      CHECK_EQ(a[i][j], v[e % kPerBlock]) << name << ": uniform at " << i << ", " << j;
+      CHECK(a[i][j] >= DType(-2.0f) && a[i][j] < DType(3.0f));
+    }
+  }
+  // the fused expression of the next stream gives the numbers of the next sample
+  Random<cpu, DType> rnd2(seed);
+  rnd2.SampleUniform(&b);
+  rnd.SampleGaussian(&a, DType(1.0f), DType(2.0f));
+  b = rnd2.fused_gaussian(b.shape_, DType(1.0f), DType(2.0f));
+  for (index_t i = 0; i < nrow; ++i) {
+    for (index_t j = 0; j < ncol; ++j) {
+      CHECK_EQ(a[i][j], b[i][j]) << name << ": gaussian at " << i << ", " << j;
+    }
+  }
+  // moments of a large sample
+  TensorContainer<cpu, 1, DType> c(Shape1(1 << 18));
+  rnd.SampleGaussian(&c, DType(1.0f), DType(2.0f));
+  double sum = 0.0, sqr = 0.0;
+  for (index_t i = 0; i < c.size(0); ++i) {
+    sum += c[i]; sqr += static_cast<double>(c[i]) * c[i];
+  }
+  const double mean = sum / c.size(0), var = sqr / c.size(0) - mean * mean;
+  CHECK_LT(std::fabs(mean - 1.0), 0.02) << name << ": gaussian mean " << mean;
+  CHECK_LT(std::fabs(var - 4.0), 0.05) << name << ": gaussian variance " << var;
+  printf("Test for Random<cpu, %s> Philox stream Pass!\n", name);
+}
+
+int main(void) {
+  InitTensorEngine<cpu>();
+  TestKnownAnswer();
+  TestStream<float>("float");
+  TestStream<double>("double");
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}
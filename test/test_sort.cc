@@ -0,0 +1,105 @@
+// test SortByKey and TopK: stable results equal to a comparison sort
+#include <mshadow/tensor.h>
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <limits>
+#include <vector>
+
+using namespace mshadow;
+
+// the keys are compared as float, so -0 and +0 are equal keys
+template<typename KDType>
+void CheckSortByKey(const std::vector<float> &input, bool is_ascend, const char *name) {
+  const index_t n = static_cast<index_t>(input.size());
+  std::vector<KDType> keys(n);
+  std::vector<int> values(n);
+  for (index_t i = 0; i < n; ++i) {
+    keys[i] = KDType(input[i]);
+    values[i] = static_cast<int>(i);
+  }
+  std::vector<int> expect(values);
+  std::stable_sort(expect.begin(), expect.end(), [&](int a, int b) {
+      const float ka = static_cast<float>(keys[a]), kb = static_cast<float>(keys[b]);
+      return is_ascend ? ka < kb : ka > kb;
+    });
+  const std::vector<KDType> original(keys);
+  Tensor<cpu, 1, KDType> tkeys(keys.data(), Shape1(n));
+  Tensor<cpu, 1, int> tvalues(values.data(), Shape1(n));
+  SortByKey(tkeys, tvalues, is_ascend);
+  for (index_t i = 0; i < n; ++i) {
+    CHECK_EQ(values[i], expect[i]) << name << ": value at " << i;
+    // the sort only moves the keys, the sign of -0 is kept
+    CHECK_EQ(std::memcmp(&keys[i], &original[expect[i]], sizeof(KDType)), 0)
+        << name << ": bits of the key at " << i << ": " << static_cast<float>(keys[i]);
+  }
+  printf("Test for SortByKey<%s>, is_ascend = %d Pass!\n", name, is_ascend);
+}
+
+template<typename KDType>
+void TestSortByKey(const char *name) {
+  std::vector<float> input = {0.0f, -0.0f, 1.0f, 0.0f, -0.0f, -2.5f, 3.0f, -2.5f,
+                              -0.0f, 1.0f, -7.0f, 0.0f, 3.0f};
+  // enough keys for every thread to get a chunk
+  for (int i = 0; i < 5000; ++i) {
+    input.push_back(static_cast<float>((i * 7919) % 61 - 30) * 0.5f);
+  }
+  CheckSortByKey<KDType>(input, true, name);
+  CheckSortByKey<KDType>(input, false, name);
+}
+
+void TestNaN(void) {
+  const float nan = std::numeric_limits<float>::quiet_NaN();
+  const float inf = std::numeric_limits<float>::infinity();
+  std::vector<float> keys = {1.0f, -nan, -inf, nan, 0.0f, inf, -1.0f};
+  std::vector<int> values = {0, 1, 2, 3, 4, 5, 6};
+  const std::vector<float> original(keys);
+  Tensor<cpu, 1> tkeys(keys.data(), Shape1(7));
+  Tensor<cpu, 1, int> tvalues(values.data(), Shape1(7));
+  SortByKey(tkeys, tvalues, true);
+  const int expect[] = {2, 6, 4, 0, 5};
+  for (int i = 0; i < 5; ++i) CHECK_EQ(values[i], expect[i]);
+  CHECK(std::isnan(keys[5]) && std::isnan(keys[6]));
+  CHECK(values[5] == 1 || values[5] == 3);
+  for (int i = 0; i < 7; ++i) {
+    CHECK_EQ(std::memcmp(&keys[i], &original[values[i]], sizeof(float)), 0);
+  }
+  printf("Test for SortByKey with NaN Pass!\n");
+}
+
+void TestTopK(bool is_ascend) {
+  const index_t nrow = 7, ncol = 300, k = 20;
+  TensorContainer<cpu, 2> src(Shape2(nrow, ncol)), values(Shape2(nrow, k));
+  TensorContainer<cpu, 2, int> indices(Shape2(nrow, k));
+  for (index_t y = 0; y < nrow; ++y) {
+    for (index_t x = 0; x < ncol; ++x) {
+      // many ties, so the order by column matters
+      src[y][x] = static_cast<float>((x * 13 + y * 7) % 17);
+    }
+  }
+  TopK(src, k, values, indices, is_ascend);
+  for (index_t y = 0; y < nrow; ++y) {
+    std::vector<int> order(ncol);
+    for (index_t x = 0; x < ncol; ++x) order[x] = static_cast<int>(x);
+    std::stable_sort(order.begin(), order.end(), [&](int a, int b) {
+        return is_ascend ? src[y][a] < src[y][b] : src[y][a] > src[y][b];
+      });
+    for (index_t i = 0; i < k; ++i) {
+      CHECK_EQ(indices[y][i], order[i]) << "TopK: row " << y << ", rank " << i;
+      CHECK_EQ(values[y][i], src[y][order[i]]);
+    }
+  }
+  printf("Test for TopK, is_ascend = %d Pass!\n", is_ascend);
+}
+
+int main(void) {
+  TestSortByKey<float>("float");
+  TestSortByKey<double>("double");
+  TestSortByKey<half::half_t>("half_t");
+  TestSortByKey<bfloat::bf16_t>("bf16_t");
+  TestNaN();
+  TestTopK(false);
+  TestTopK(true);
+  return 0;
+}
@@ -0,0 +1,66 @@
+// test that the kernels called with a Stream<cpu> that has a worker run after the pushed tasks
+#include <mshadow/tensor.h>
+#include <chrono>
+#include <cstdio>
+#include <thread>
+
+using namespace mshadow;
+using namespace mshadow::expr;
+
+// a task that is still running when the kernel after it is called
+void SlowFill(Tensor<cpu, 2> t, float start) {
+  std::this_thread::sleep_for(std::chrono::milliseconds(50));
+  for (index_t i = 0; i < t.size(0); ++i) {
+    for (index_t j = 0; j < t.size(1); ++j) t[i][j] = start + i * t.size(1) + j;
+  }
+}
+
+void CheckFill(const Tensor<cpu, 2> &t, float start, float mul, float add, const char *what) {
+  for (index_t i = 0; i < t.size(0); ++i) {
+    for (index_t j = 0; j < t.size(1); ++j) {
+      CHECK_EQ(t[i][j], (start + i * t.size(1) + j) * mul + add)
+          << what << ": read before the pushed task at " << i << ", " << j;
+    }
+  }
+}
+
+int main(void) {
+  InitTensorEngine<cpu>();
+  Stream<cpu> *s = NewStream<cpu>();
+  s->StartWorker();
+  TensorContainer<cpu, 2> src(Shape2(7, 13)), dst(src.shape_), prod(Shape2(7, 7));
+  src.set_stream(s);
+  dst.set_stream(s);
+  prod.set_stream(s);
+  src = 0.0f;
+  dst = 0.0f;
+  Tensor<cpu, 2> tsrc = src, tdst = dst;
+  s->Push([tsrc] { SlowFill(tsrc, 1.0f); });
+  Copy(tdst, tsrc, s);
+  CheckFill(dst, 1.0f, 1.0f, 0.0f, "Copy");
+  printf("Test for Copy after a pushed task Pass!\n");
+  s->Push([tsrc] { SlowFill(tsrc, 2.0f); });
+  dst = src * 2.0f + 1.0f;
+  CheckFill(dst, 2.0f, 2.0f, 1.0f, "MapExp");
+  printf("Test for MapExp after a pushed task Pass!\n");
+  s->Push([tsrc] { SlowFill(tsrc, 3.0f); });
+  prod = dot(src, src.T());
+  for (index_t i = 0; i < 7; ++i) {
+    double sum = 0.0;
+    for (index_t j = 0; j < 13; ++j) {
+      const double v = 3.0 + i * 13 + j;
+      sum += v * v;
+    }
+    CHECK_EQ(prod[i][i], static_cast<float>(sum)) << "dot: read before the pushed task";
+  }
+  printf("Test for dot after a pushed task Pass!\n");
+  // a kernel in a pushed task runs at once on the worker, it does not wait for itself
+  s->Push([tsrc] { SlowFill(tsrc, 4.0f); });
+  s->Push([tsrc, tdst, s] { Copy(tdst, tsrc, s); });
+  s->Wait();
+  CheckFill(dst, 4.0f, 1.0f, 0.0f, "Copy in a pushed task");
+  printf("Test for a kernel in a pushed task Pass!\n");
+  DeleteStream(s);
+  ShutdownTensorEngine<cpu>();
+  return 0;
+}